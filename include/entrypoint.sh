@@ -4,9 +4,12 @@ echo "MariaDB K8s Auth Plugin - Distribution Image"
 echo ""
 echo "Plugin: auth_k8s.so"
 echo "  Authenticates using Kubernetes TokenReview API"
+echo "Client plugin: auth_k8s_client.so (optional)"
+echo "  Session tickets for auth_k8s_ticket accounts"
 echo ""
 echo "Usage:"
 echo "  Copy /mariadb/auth_k8s.so to your MariaDB plugin directory"
+echo "  Copy /mariadb/auth_k8s_client.so to the client library's plugin directory"
 echo ""
 echo "Example:"
 echo "  docker cp container:/mariadb/auth_k8s.so /usr/lib/mysql/plugin/"
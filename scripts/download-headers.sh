@@ -2,8 +2,12 @@
 #
 # Download MariaDB server headers and package them as a tarball
 #
-# Usage: ./scripts/download-headers.sh <version>
+# Usage: ./scripts/download-headers.sh <version> [--configured]
 #   version: MariaDB version tag (required, e.g., 10.6.22)
+#   --configured: also configure the server tree and add its generated
+#                 headers (my_config.h), as -DWITH_PSI=ON builds need. This
+#                 takes the server's configure dependencies (cmake, bison,
+#                 ncurses and OpenSSL development files).
 #
 
 set -e
@@ -11,7 +15,7 @@ set -e
 # Check for required argument
 if [ -z "$1" ]; then
     echo "Error: MariaDB version is required"
-    echo "Usage: $0 <version>"
+    echo "Usage: $0 <version> [--configured]"
     echo "Example: $0 10.6.22"
     exit 1
 fi
@@ -24,6 +28,15 @@ MARIADB_VERSION="$1"
 MARIADB_BRANCH="mariadb-${MARIADB_VERSION}"
 OUTPUT_DIR="include"
 OUTPUT_FILE="${OUTPUT_DIR}/mariadb-${MARIADB_VERSION}-headers.tar.gz"
+CONFIGURED=""
+
+if [ "$2" = "--configured" ]; then
+    CONFIGURED=1
+    OUTPUT_FILE="${OUTPUT_DIR}/mariadb-${MARIADB_VERSION}-headers-configured.tar.gz"
+elif [ -n "$2" ]; then
+    echo "Error: unknown option: $2"
+    exit 1
+fi
 
 echo "=========================================="
 echo "MariaDB Headers Download Script"
@@ -44,8 +57,15 @@ mkdir -p "${OUTPUT_DIR}"
 
 # Download headers from MariaDB git repository
 echo "Step 1/4: Cloning MariaDB repository (branch: ${MARIADB_BRANCH})..."
-git clone --depth 1 --branch "${MARIADB_BRANCH}" \
-    https://github.com/MariaDB/server.git "${TEMP_DIR}"
+if [ -n "${CONFIGURED}" ]; then
+    # Configuring needs the bundled Connector/C and wsrep-lib
+    git clone --depth 1 --branch "${MARIADB_BRANCH}" \
+        --recurse-submodules --shallow-submodules \
+        https://github.com/MariaDB/server.git "${TEMP_DIR}"
+else
+    git clone --depth 1 --branch "${MARIADB_BRANCH}" \
+        https://github.com/MariaDB/server.git "${TEMP_DIR}"
+fi
 
 # Create include directory structure in temp location
 echo "Step 2/4: Copying headers..."
@@ -53,10 +73,29 @@ HEADERS_DIR="${TEMP_DIR}/headers"
 mkdir -p "${HEADERS_DIR}/include"
 cp -r "${TEMP_DIR}/include/"* "${HEADERS_DIR}/include/"
 
-# Process mysql_version.h template if it exists
-echo "Step 3/4: Processing version template..."
+echo "Step 3/4: Generating headers..."
+if [ -n "${CONFIGURED}" ]; then
+    # Configure only; the generated headers land in the build tree's include/
+    cmake -S "${TEMP_DIR}" -B "${TEMP_DIR}/build" \
+        -DWITH_SSL=system \
+        -DWITH_WSREP=OFF \
+        -DWITH_UNIT_TESTS=OFF \
+        -DPLUGIN_COLUMNSTORE=NO \
+        -DPLUGIN_CONNECT=NO \
+        -DPLUGIN_MROONGA=NO \
+        -DPLUGIN_ROCKSDB=NO \
+        -DPLUGIN_S3=NO \
+        -DPLUGIN_SPIDER=NO > "${TEMP_DIR}/configure.log" || {
+        tail -n 50 "${TEMP_DIR}/configure.log"
+        echo "Error: configuring MariaDB failed"
+        exit 1
+    }
+    cp "${TEMP_DIR}/build/include/"*.h "${HEADERS_DIR}/include/"
+fi
+
+# Process mysql_version.h template if it exists and was not generated
 cd "${HEADERS_DIR}/include"
-if [ -f mysql_version.h.in ]; then
+if [ -f mysql_version.h.in ] && [ ! -f mysql_version.h ]; then
     # Extract version components
     VERSION_MAJOR=$(echo "${MARIADB_VERSION}" | cut -d. -f1)
     VERSION_MINOR=$(echo "${MARIADB_VERSION}" | cut -d. -f2)
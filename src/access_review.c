@@ -0,0 +1,338 @@
+/*
+ * Access Reviews Implementation
+ */
+
+#include "access_review.h"
+#include "cluster.h"
+#include "stats.h"
+#include "log.h"
+#include "instrumentation.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <json-c/json.h>
+
+#define REVIEW_PATH "/apis/authorization.k8s.io/v1/subjectaccessreviews"
+
+/* Longest verb and resource; group and name are DNS subdomains */
+#define VERB_MAX 63
+#define RESOURCE_MAX 63
+
+#define IDENTITY_MAX (K8S_MAX_NAMESPACE_LEN + K8S_MAX_NAME_LEN + 1)
+
+/* Cache key: namespace/name, prefixed with "<cluster>:" for remote clusters
+ * so that invalidating a local namespace never matches them */
+#define KEY_MAX (K8S_CLUSTER_NAME_MAX + 1 + IDENTITY_MAX)
+
+typedef enum {
+    STATE_OFF,
+    STATE_ON,
+    STATE_BROKEN                    /* A rule was set that cannot be used */
+} review_state_t;
+
+typedef struct {
+    char verb[VERB_MAX + 1];
+    char resource[RESOURCE_MAX + 1];
+    char group[K8S_MAX_NAME_LEN + 1];   /* Empty: the core API group */
+    char name[K8S_MAX_NAME_LEN + 1];    /* Empty: any object */
+} rule_t;
+
+typedef struct {
+    uint64_t hash;                  /* 0: free */
+    char identity[KEY_MAX + 1];     /* [cluster:]namespace/name */
+    int allowed;
+    time_t decided_at;
+} decision_t;
+
+static k8s_mutex_t lock = K8S_MUTEX_INITIALIZER(K8S_MUTEX_ACCESS_REVIEW);
+static review_state_t state = STATE_OFF;
+static rule_t rule;
+static char rule_text[K8S_ACCESS_REVIEW_RULE_MAX + 1];
+static int ttl = 0;
+static decision_t *slots = NULL;
+static int cached = 0;
+
+/* Bumped by every invalidation and rule change; a review started under an
+ * older generation may have missed one and is not cached */
+static uint64_t generation = 0;
+
+static uint64_t identity_hash(const char *identity) {
+    uint64_t h = 1469598103934665603ULL;
+    for (const char *c = identity; *c; c++) {
+        h = (h ^ (unsigned char)*c) * 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+/* Copy a part of at most max characters from allowed; 0 if it is not one */
+static int copy_part(const char *s, size_t len, size_t max, const char *allowed, char *out) {
+    if (len == 0 || len > max || strspn(s, allowed) < len) {
+        return 0;
+    }
+    memcpy(out, s, len);
+    out[len] = '\0';
+    return 1;
+}
+
+static int parse_rule(const char *text, rule_t *out) {
+    static const char dns[] = "abcdefghijklmnopqrstuvwxyz0123456789-.";
+
+    memset(out, 0, sizeof(*out));
+    if (!text || strlen(text) > K8S_ACCESS_REVIEW_RULE_MAX) {
+        return 0;
+    }
+    text += strspn(text, " ");
+    size_t verb_len = strcspn(text, " ");
+    if (!copy_part(text, verb_len, VERB_MAX, "abcdefghijklmnopqrstuvwxyz*", out->verb)) {
+        return 0;
+    }
+
+    const char *target = text + verb_len + strspn(text + verb_len, " ");
+    size_t target_len = strcspn(target, " ");
+    if (target[target_len + strspn(target + target_len, " ")] != '\0') {
+        return 0;
+    }
+
+    const char *slash = memchr(target, '/', target_len);
+    size_t type_len = slash ? (size_t)(slash - target) : target_len;
+    const char *dot = memchr(target, '.', type_len);
+    size_t resource_len = dot ? (size_t)(dot - target) : type_len;
+
+    if (!copy_part(target, resource_len, RESOURCE_MAX,
+                   "abcdefghijklmnopqrstuvwxyz0123456789-*", out->resource)) {
+        return 0;
+    }
+    if (dot && !copy_part(dot + 1, type_len - resource_len - 1, K8S_MAX_NAME_LEN, dns,
+                          out->group)) {
+        return 0;
+    }
+    if (slash && !copy_part(slash + 1, target_len - type_len - 1, K8S_MAX_NAME_LEN, dns,
+                            out->name)) {
+        return 0;
+    }
+    return 1;
+}
+
+int k8s_access_review_valid(const char *rule_string) {
+    rule_t parsed;
+    return !rule_string || !*rule_string || parse_rule(rule_string, &parsed);
+}
+
+/* Caller holds lock */
+static void drop_all(void) {
+    if (slots) {
+        memset(slots, 0, K8S_ACCESS_REVIEW_SLOTS * sizeof(decision_t));
+    }
+    cached = 0;
+    generation++;
+}
+
+int k8s_access_review_configure(const char *rule_string, int decision_ttl) {
+    rule_t parsed;
+    int ok = 1;
+
+    if (!rule_string) {
+        rule_string = "";
+    }
+
+    k8s_mutex_lock(&lock);
+    ttl = decision_ttl > 0 ? decision_ttl : 0;
+    if (strcmp(rule_string, rule_text) == 0 && state != STATE_BROKEN) {
+        k8s_mutex_unlock(&lock);
+        return 1;
+    }
+
+    drop_all();
+    snprintf(rule_text, sizeof(rule_text), "%s", rule_string);
+    if (!*rule_string) {
+        state = STATE_OFF;
+        k8s_free(slots);
+        slots = NULL;
+    } else if (!parse_rule(rule_string, &parsed)) {
+        state = STATE_BROKEN;
+        ok = 0;
+    } else {
+        if (!slots) {
+            slots = k8s_calloc(K8S_MEM_ACCESS_REVIEW, K8S_ACCESS_REVIEW_SLOTS,
+                               sizeof(decision_t));
+        }
+        rule = parsed;
+        state = slots ? STATE_ON : STATE_BROKEN;
+        ok = slots != NULL;
+    }
+    k8s_mutex_unlock(&lock);
+
+    if (!ok) {
+        K8S_LOG(K8S_LOG_ERROR, "authorize_unavailable", "rule=\"%s\" action=refuse_logins",
+                rule_string);
+    } else if (*rule_string) {
+        K8S_LOG(K8S_LOG_INFO, "authorize_configured", "rule=\"%s\" ttl=%d",
+                rule_string, decision_ttl);
+    }
+    return ok;
+}
+
+int k8s_access_review_enabled(void) {
+    k8s_mutex_lock(&lock);
+    int enabled = state != STATE_OFF;
+    k8s_mutex_unlock(&lock);
+    return enabled;
+}
+
+static json_object *build_review(const rule_t *r, const char *namespace, const char *name,
+                                 const char *uid) {
+    char user[IDENTITY_MAX + 32];
+    char ns_group[K8S_MAX_NAMESPACE_LEN + 32];
+    json_object *review = json_object_new_object();
+    json_object *spec = json_object_new_object();
+    json_object *groups = json_object_new_array();
+    json_object *attributes = json_object_new_object();
+
+    /* The groups every ServiceAccount token authenticates with, so the
+     * decision does not depend on how the login was authenticated */
+    snprintf(user, sizeof(user), "system:serviceaccount:%s:%s", namespace, name);
+    snprintf(ns_group, sizeof(ns_group), "system:serviceaccounts:%s", namespace);
+    json_object_array_add(groups, json_object_new_string("system:serviceaccounts"));
+    json_object_array_add(groups, json_object_new_string(ns_group));
+    json_object_array_add(groups, json_object_new_string("system:authenticated"));
+
+    json_object_object_add(attributes, "namespace", json_object_new_string(namespace));
+    json_object_object_add(attributes, "verb", json_object_new_string(r->verb));
+    json_object_object_add(attributes, "group", json_object_new_string(r->group));
+    json_object_object_add(attributes, "resource", json_object_new_string(r->resource));
+    if (r->name[0]) {
+        json_object_object_add(attributes, "name", json_object_new_string(r->name));
+    }
+
+    json_object_object_add(spec, "user", json_object_new_string(user));
+    if (uid && uid[0]) {
+        json_object_object_add(spec, "uid", json_object_new_string(uid));
+    }
+    json_object_object_add(spec, "groups", groups);
+    json_object_object_add(spec, "resourceAttributes", attributes);
+
+    json_object_object_add(review, "apiVersion",
+                           json_object_new_string("authorization.k8s.io/v1"));
+    json_object_object_add(review, "kind", json_object_new_string("SubjectAccessReview"));
+    json_object_object_add(review, "spec", spec);
+    return review;
+}
+
+/* status.allowed of a review response */
+static k8s_access_t parse_review(const char *body, const char *identity) {
+    json_object *response = body ? json_tokener_parse(body) : NULL;
+    json_object *status = NULL, *allowed = NULL, *reason = NULL;
+    k8s_access_t result = K8S_ACCESS_ERROR;
+
+    if (response && json_object_object_get_ex(response, "status", &status) &&
+        json_object_object_get_ex(status, "allowed", &allowed) &&
+        json_object_is_type(allowed, json_type_boolean)) {
+        result = json_object_get_boolean(allowed) ? K8S_ACCESS_ALLOWED : K8S_ACCESS_DENIED;
+        json_object_object_get_ex(status, "reason", &reason);
+        K8S_LOG(K8S_LOG_DEBUG, "access_reviewed", "identity=\"%s\" allowed=%d reason=\"%s\"",
+                identity, result == K8S_ACCESS_ALLOWED,
+                reason ? json_object_get_string(reason) : "");
+    } else if (body) {
+        K8S_LOG(K8S_LOG_WARNING, "access_review_failed", "reason=invalid_response");
+    }
+    if (response) {
+        json_object_put(response);
+    }
+    return result;
+}
+
+k8s_access_t k8s_access_review_check(const char *cluster, const char *namespace,
+                                     const char *name, const char *uid,
+                                     const k8s_config_t *config, int *cached_out) {
+    char identity[KEY_MAX + 1];
+    rule_t r;
+
+    if (cached_out) {
+        *cached_out = 0;
+    }
+    snprintf(identity, sizeof(identity), "%s%s%s/%s", cluster ? cluster : "",
+             cluster ? ":" : "", namespace, name);
+    uint64_t hash = identity_hash(identity);
+
+    k8s_mutex_lock(&lock);
+    if (state != STATE_ON) {
+        review_state_t current = state;
+        k8s_mutex_unlock(&lock);
+        return current == STATE_OFF ? K8S_ACCESS_ALLOWED : K8S_ACCESS_ERROR;
+    }
+    decision_t *slot = &slots[hash % K8S_ACCESS_REVIEW_SLOTS];
+    if (ttl > 0 && slot->hash == hash && strcmp(slot->identity, identity) == 0 &&
+        time(NULL) - slot->decided_at < ttl) {
+        int allowed = slot->allowed;
+        k8s_mutex_unlock(&lock);
+        if (cached_out) {
+            *cached_out = 1;
+        }
+        k8s_stats_inc(K8S_STAT_ACCESS_REVIEW_HITS);
+        return allowed ? K8S_ACCESS_ALLOWED : K8S_ACCESS_DENIED;
+    }
+    r = rule;
+    uint64_t started = generation;
+    k8s_mutex_unlock(&lock);
+
+    json_object *review = build_review(&r, namespace, name, uid);
+    k8s_stats_inc(K8S_STAT_ACCESS_REVIEWS);
+    char *body = k8s_api_post(REVIEW_PATH, json_object_to_json_string(review), config);
+    json_object_put(review);
+    k8s_access_t result = parse_review(body, identity);
+    k8s_free(body);
+
+    if (result == K8S_ACCESS_ERROR) {
+        return result;
+    }
+
+    /* Denials are kept too: a grant arrives through the RoleBinding watch,
+     * and a ServiceAccount that keeps failing should not cost reviews */
+    k8s_mutex_lock(&lock);
+    if (state == STATE_ON && ttl > 0 && generation == started) {
+        slot = &slots[hash % K8S_ACCESS_REVIEW_SLOTS];
+        if (!slot->hash) {
+            cached++;
+        }
+        slot->hash = hash;
+        memcpy(slot->identity, identity, sizeof(identity));
+        slot->allowed = result == K8S_ACCESS_ALLOWED;
+        slot->decided_at = time(NULL);
+    }
+    k8s_mutex_unlock(&lock);
+    return result;
+}
+
+void k8s_access_review_invalidate(const char *namespace) {
+    size_t ns_len = namespace ? strlen(namespace) : 0;
+
+    k8s_mutex_lock(&lock);
+    generation++;
+    for (int i = 0; slots && i < K8S_ACCESS_REVIEW_SLOTS; i++) {
+        decision_t *slot = &slots[i];
+        if (slot->hash && (!namespace || (strncmp(slot->identity, namespace, ns_len) == 0 &&
+                                          slot->identity[ns_len] == '/'))) {
+            slot->hash = 0;
+            cached--;
+        }
+    }
+    k8s_mutex_unlock(&lock);
+}
+
+int k8s_access_review_cached(void) {
+    k8s_mutex_lock(&lock);
+    int count = cached;
+    k8s_mutex_unlock(&lock);
+    return count;
+}
+
+void k8s_access_review_shutdown(void) {
+    k8s_mutex_lock(&lock);
+    drop_all();
+    k8s_free(slots);
+    slots = NULL;
+    state = STATE_OFF;
+    rule_text[0] = '\0';
+    k8s_mutex_unlock(&lock);
+}
@@ -0,0 +1,104 @@
+/*
+ * Access Reviews
+ *
+ * An optional authorization step after authentication: a ServiceAccount
+ * may only log in if Kubernetes RBAC allows it one action, checked with a
+ * SubjectAccessReview in the ServiceAccount's own namespace. Database
+ * access can then be granted and revoked with RoleBindings, e.g. to
+ * "connect databases.mariadb.example.com/orders".
+ *
+ * Decisions, allowed or not, are kept per ServiceAccount for a TTL, so a
+ * login costs at most one TokenReview; a cached or ticket login none. When
+ * the RoleBindings are watched (see watch.h), a change to one drops the
+ * decisions of its namespace and a ClusterRoleBinding change drops them
+ * all, so a grant or revocation applies to the next login without waiting
+ * for the TTL.
+ */
+
+#ifndef K8S_ACCESS_REVIEW_H
+#define K8S_ACCESS_REVIEW_H
+
+#include "tokenreview_api.h"
+
+/* Longest rule, as in auth_k8s_authorize */
+#define K8S_ACCESS_REVIEW_RULE_MAX 512
+
+/* Decisions kept; a ServiceAccount whose slot is taken is reviewed again */
+#define K8S_ACCESS_REVIEW_SLOTS 1024
+
+typedef enum {
+    K8S_ACCESS_ERROR = -1,          /* No usable answer from the API server */
+    K8S_ACCESS_DENIED = 0,
+    K8S_ACCESS_ALLOWED = 1
+} k8s_access_t;
+
+/**
+ * Check the syntax of a rule
+ *
+ * A rule is "<verb> <resource>[.<group>][/<name>]", as kubectl auth can-i
+ * spells it: "connect databases.mariadb.example.com/orders" asks whether
+ * the ServiceAccount may connect to the databases object named orders of
+ * the API group mariadb.example.com.
+ *
+ * @param rule Rule, NULL or empty for none
+ * @return 1 if the rule is empty or well-formed, 0 otherwise
+ */
+int k8s_access_review_valid(const char *rule);
+
+/**
+ * Set the rule and decision TTL
+ *
+ * Cached decisions are dropped when the rule changes.
+ *
+ * @param rule Rule, NULL or empty disables the check
+ * @param ttl Seconds a decision is reused (0: review every login)
+ * @return 1 on success, 0 if the rule is malformed or on allocation
+ *         failure; logins are then refused until a valid rule is set
+ */
+int k8s_access_review_configure(const char *rule, int ttl);
+
+/**
+ * @return 1 if logins need to pass the check, 0 otherwise
+ */
+int k8s_access_review_enabled(void);
+
+/**
+ * Decide whether a ServiceAccount may log in
+ *
+ * Decisions are cached per cluster: the same namespace/name in another
+ * cluster is another ServiceAccount.
+ *
+ * @param cluster Cluster of the ServiceAccount, NULL for the local one; the
+ *                review is sent to the API server of config
+ * @param namespace Namespace of the ServiceAccount
+ * @param name Name of the ServiceAccount
+ * @param uid UID of the ServiceAccount, may be empty
+ * @param config Configuration for K8s API access, used on a cache miss
+ * @param cached Set to 1 if the decision came from the cache, may be NULL
+ * @return The decision; always K8S_ACCESS_ALLOWED when disabled
+ */
+k8s_access_t k8s_access_review_check(const char *cluster, const char *namespace,
+                                     const char *name, const char *uid,
+                                     const k8s_config_t *config, int *cached);
+
+/**
+ * Drop cached decisions after an RBAC change
+ *
+ * Reviews in flight when this is called are not cached either.
+ *
+ * @param namespace Local namespace whose decisions are dropped, NULL for all
+ *                  decisions of every cluster
+ */
+void k8s_access_review_invalidate(const char *namespace);
+
+/**
+ * @return Number of cached decisions
+ */
+int k8s_access_review_cached(void);
+
+/**
+ * Disable the check and free the cache
+ */
+void k8s_access_review_shutdown(void);
+
+#endif /* K8S_ACCESS_REVIEW_H */
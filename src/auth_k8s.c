@@ -5,10 +5,33 @@
  */
 
 #include <mysql/plugin_auth.h>
+#include <mysql/plugin_audit.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <curl/curl.h>
 #include "tokenreview_api.h"
+#include "http_pool.h"
+#include "config_snapshot.h"
+#include "background.h"
+#include "stats.h"
+#include "identity_stats.h"
+#include "log.h"
+#include "instrumentation.h"
+#include "metrics.h"
+#include "token_cache.h"
+#include "watch.h"
+#include "denylist.h"
+#include "session.h"
+#include "jwks.h"
+#include "ticket.h"
+#include "policy.h"
+#include "access_review.h"
+#include "backend.h"
+#include "cluster.h"
+#include "issuers.h"
+#include "federated.h"
 #include "version.h"
 
 /* Feature flag: Set to 1 to enable TokenReview validation, 0 for POC mode */
@@ -16,176 +39,2505 @@
 #define ENABLE_TOKEN_VALIDATION 1
 #endif
 
+/* Interval in seconds at which the cached API credential is re-read */
+#define CREDENTIAL_REFRESH_INTERVAL 60
+
+/* Interval in seconds at which the CA bundle is checked for changes */
+#define CA_RELOAD_INTERVAL 30
+
+/* Interval in seconds at which the denylist file is checked for changes */
+#define DENYLIST_RELOAD_INTERVAL 5
+
+/* Interval in seconds at which the cluster registry file is checked for
+ * changes and the remote clusters' pools are looked after */
+#define CLUSTER_RELOAD_INTERVAL 5
+
+/* Interval in seconds at which the offline issuer directory is checked for
+ * changes */
+#define ISSUER_RELOAD_INTERVAL 5
+
+/* Interval in seconds at which optimistic logins are confirmed */
+#define CONFIRM_INTERVAL 1
+
+/* Seconds after which the API server's signing keys are fetched again */
+#define JWKS_MAX_AGE 300
+
+/* Interval in seconds at which replaced configuration snapshots are freed */
+#define SNAPSHOT_RECLAIM_INTERVAL 10
+
+/* Minimum age in seconds of a replaced snapshot before it may be freed */
+#define SNAPSHOT_GRACE_SECONDS 10
+
 /*
  * Plugin system variables
  *
  * Exposed as auth_k8s_api_url, auth_k8s_ca_path, auth_k8s_token_path,
- * auth_k8s_timeout. All are READONLY (set via my.cnf or command line only).
+ * auth_k8s_timeout, auth_k8s_pool_size, auth_k8s_keepalive_interval,
+ * auth_k8s_dns_ttl, auth_k8s_slow_auth_threshold, auth_k8s_log_level,
+ * auth_k8s_metrics_port, auth_k8s_cache_ttl, auth_k8s_cache_file,
+ * auth_k8s_cache_key_file, auth_k8s_watch_namespaces, auth_k8s_denylist_file,
+ * auth_k8s_revalidate_interval, auth_k8s_revalidate_kill, auth_k8s_optimistic,
+ * auth_k8s_optimistic_window, auth_k8s_ticket_ttl, auth_k8s_authorize,
+ * auth_k8s_authorize_ttl, auth_k8s_backends, auth_k8s_cluster_file,
+ * auth_k8s_issuer_dir, auth_k8s_federated_socket,
+ * auth_k8s_identity_status_limit.
+ * All but the cache file settings can be changed at runtime with SET GLOBAL;
+ * logins never read them directly but use the published configuration
+ * snapshot (the log level, metrics port, denylist, authorization settings,
+ * cluster registry, offline issuers, federated validator and identity
+ * status limit take effect immediately).
  */
 static char *opt_api_url = NULL;
 static char *opt_ca_path = NULL;
 static char *opt_token_path = NULL;
 static int opt_timeout = 10;
+static int opt_pool_size = 4;
+static int opt_keepalive_interval = 30;
+static int opt_dns_ttl = 60;
+static int opt_slow_auth_threshold = 1000;
+static int opt_log_level = K8S_LOG_DEFAULT_LEVEL;
+static int opt_metrics_port = 0;
+static int opt_cache_ttl = 0;
+static char *opt_cache_file = NULL;
+static char *opt_cache_key_file = NULL;
+static char *opt_watch_namespaces = NULL;
+static char *opt_denylist_file = NULL;
+static int opt_revalidate_interval = 0;
+static char opt_revalidate_kill = 0;
+static char opt_optimistic = 0;
+static int opt_optimistic_window = 30;
+static int opt_ticket_ttl = 300;
+static char *opt_authorize = NULL;
+static int opt_authorize_ttl = 60;
+static char *opt_backends = NULL;
+static char *opt_cluster_file = NULL;
+static char *opt_issuer_dir = NULL;
+static char *opt_federated_socket = NULL;
+static int opt_identity_status_limit = 100;
+
+/*
+ * Set while the auth_k8s_sessions audit plugin is installed. Connections
+ * are only tracked for revalidation while their end gets reported.
+ */
+static int sessions_tracked = 0;
+
+/*
+ * Settings changed by SET GLOBAL that the housekeeping thread has not
+ * applied yet. Only the newest one matters.
+ */
+static k8s_mutex_t pending_lock = K8S_MUTEX_INITIALIZER(K8S_MUTEX_PENDING);
+static k8s_snapshot_t *pending_snapshot = NULL;
+
+/*
+ * Snapshot whose pool the watches use. Holding it keeps the pool open until
+ * the watches have moved to a newer one.
+ */
+static k8s_mutex_t watch_lock = K8S_MUTEX_INITIALIZER(K8S_MUTEX_WATCH);
+static k8s_snapshot_t *watch_snapshot = NULL;
+
+static void schedule_reconfigure(void);
+static void configure_watch(void);
+static void retarget_watch(void);
+static int auth_k8s_plugin_deinit(void *p);
+
+/*
+ * The server's allocator, which plugin.h does not declare. The server
+ * allocates PLUGIN_VAR_MEMALLOC strings with it and frees them with it when
+ * the plugin is unloaded.
+ *
+ * my_sys.h declares it, but only configured server headers have my_sys.h,
+ * so it is declared here with the server's types spelled out: the key is a
+ * PSI_memory_key (unsigned int) and the flags a myf, which is ulonglong in
+ * current servers. Older servers' myf is ulong; the plugin only passes 0,
+ * and on the LP64 targets it is built for both travel in the same 64-bit
+ * register.
+ */
+typedef unsigned long long k8s_myf_t;
+extern char *my_strdup(unsigned int key, const char *from, k8s_myf_t flags);
+extern void my_free(void *ptr);
+
+/*
+ * Replace the value of a PLUGIN_VAR_MEMALLOC string variable
+ *
+ * The value handed to an update function lives in the statement's memory,
+ * or is the static default for SET GLOBAL ... = DEFAULT, so the variable
+ * keeps a copy of its own, as the server's update_func_str does.
+ */
+static void set_str(void *var_ptr, const void *save)
+{
+    const char *value = *(const char *const *)save;
+    char *old = *(char **)var_ptr;
+
+    *(char **)var_ptr = value ? my_strdup(0, value, 0) : NULL;
+    my_free(old);
+}
+
+/*
+ * Reject NULL and empty strings for path and URL variables
+ */
+static int check_not_empty(MYSQL_THD thd, struct st_mysql_sys_var *var,
+                           void *save, struct st_mysql_value *value)
+{
+    char buf[512];
+    int len = sizeof(buf);
+    const char *str = value->val_str(value, buf, &len);
+    (void)var;
+
+    if (!str || len == 0) {
+        return 1;
+    }
+    *(const char **)save = thd_strmake(thd, str, len);
+    return 0;
+}
+
+/*
+ * Store a new string value and publish it to logins
+ */
+static void update_str(MYSQL_THD thd, struct st_mysql_sys_var *var,
+                       void *var_ptr, const void *save)
+{
+    (void)thd;
+    (void)var;
+    set_str(var_ptr, save);
+    schedule_reconfigure();
+}
+
+/*
+ * Store a new integer value and publish it to logins
+ */
+static void update_int(MYSQL_THD thd, struct st_mysql_sys_var *var,
+                       void *var_ptr, const void *save)
+{
+    (void)thd;
+    (void)var;
+    *(int *)var_ptr = *(const int *)save;
+    schedule_reconfigure();
+}
+
+/*
+ * Store a new boolean value and publish it to logins
+ */
+static void update_bool(MYSQL_THD thd, struct st_mysql_sys_var *var,
+                        void *var_ptr, const void *save)
+{
+    (void)thd;
+    (void)var;
+    *(char *)var_ptr = *(const char *)save;
+    schedule_reconfigure();
+}
+
+/*
+ * Apply a new log level; no snapshot is needed
+ */
+static void update_log_level(MYSQL_THD thd, struct st_mysql_sys_var *var,
+                             void *var_ptr, const void *save)
+{
+    (void)thd;
+    (void)var;
+    *(int *)var_ptr = *(const int *)save;
+    k8s_log_set_level(*(int *)var_ptr);
+}
+
+static void update_identity_status_limit(MYSQL_THD thd, struct st_mysql_sys_var *var,
+                                         void *var_ptr, const void *save)
+{
+    (void)thd;
+    (void)var;
+    __atomic_store_n((int *)var_ptr, *(const int *)save, __ATOMIC_RELAXED);
+}
+
+/*
+ * Background task: restart the metrics listener on auth_k8s_metrics_port
+ * (0 stops it)
+ */
+static void metrics_task(void *arg)
+{
+    (void)arg;
+    int port = __atomic_load_n(&opt_metrics_port, __ATOMIC_RELAXED);
+
+    k8s_metrics_stop();
+    if (port > 0) {
+        k8s_metrics_start(port);
+    }
+}
+
+/*
+ * Move the metrics listener to a new port
+ *
+ * Stopping the listener joins its thread, so the restart is left to the
+ * housekeeping thread rather than done under the server's global variables
+ * lock.
+ */
+static void update_metrics_port(MYSQL_THD thd, struct st_mysql_sys_var *var,
+                                void *var_ptr, const void *save)
+{
+    (void)thd;
+    (void)var;
+    __atomic_store_n((int *)var_ptr, *(const int *)save, __ATOMIC_RELAXED);
+    if (!k8s_bg_run_now("metrics")) {
+        metrics_task(NULL);
+    }
+}
+
+/*
+ * Store new watch namespaces and restart the watches
+ */
+static void update_watch_namespaces(MYSQL_THD thd, struct st_mysql_sys_var *var,
+                                    void *var_ptr, const void *save)
+{
+    (void)thd;
+    (void)var;
+    set_str(var_ptr, save);
+    configure_watch();
+}
+
+/*
+ * Switch to a new denylist file (empty disables the denylist)
+ *
+ * The file is read by the housekeeping thread, not under the server's
+ * global variables lock.
+ */
+static void update_denylist_file(MYSQL_THD thd, struct st_mysql_sys_var *var,
+                                 void *var_ptr, const void *save)
+{
+    (void)thd;
+    (void)var;
+    set_str(var_ptr, save);
+    k8s_denylist_configure(*(char **)var_ptr);
+    if (!k8s_bg_run_now("denylist")) {
+        k8s_denylist_reload();
+    }
+}
+
+/*
+ * Switch to a new cluster registry file (empty disables remote clusters)
+ *
+ * As for the denylist, the file is read and the new clusters' pools are
+ * warmed by the housekeeping thread.
+ */
+static void update_cluster_file(MYSQL_THD thd, struct st_mysql_sys_var *var,
+                                void *var_ptr, const void *save)
+{
+    (void)thd;
+    (void)var;
+    set_str(var_ptr, save);
+    k8s_cluster_configure(*(char **)var_ptr);
+    if (!k8s_bg_run_now("clusters")) {
+        k8s_cluster_reload();
+    }
+}
+
+/*
+ * Switch to a new offline issuer directory (empty disables offline issuers)
+ */
+static void update_issuer_dir(MYSQL_THD thd, struct st_mysql_sys_var *var,
+                              void *var_ptr, const void *save)
+{
+    (void)thd;
+    (void)var;
+    set_str(var_ptr, save);
+    k8s_issuers_configure(*(char **)var_ptr);
+    if (!k8s_bg_run_now("issuers")) {
+        k8s_issuers_reload();
+    }
+}
+
+/*
+ * Switch to a new federated validator socket (empty disables it)
+ *
+ * Sockets to the previous path are closed once their requests are answered.
+ */
+static void update_federated_socket(MYSQL_THD thd, struct st_mysql_sys_var *var,
+                                    void *var_ptr, const void *save)
+{
+    (void)thd;
+    (void)var;
+    set_str(var_ptr, save);
+    k8s_federated_configure(*(char **)var_ptr);
+}
+
+/*
+ * Accept only empty or well-formed access review rules
+ */
+static int check_authorize(MYSQL_THD thd, struct st_mysql_sys_var *var,
+                           void *save, struct st_mysql_value *value)
+{
+    char buf[K8S_ACCESS_REVIEW_RULE_MAX + 1];
+    int len = sizeof(buf);
+    const char *str = value->val_str(value, buf, &len);
+    const char *rule = str ? thd_strmake(thd, str, len) : NULL;
+    (void)var;
+
+    if (!k8s_access_review_valid(rule)) {
+        return 1;
+    }
+    *(const char **)save = rule;
+    return 0;
+}
+
+/*
+ * Apply a new access review rule or TTL; decisions of an older rule are
+ * dropped, and the RoleBinding watches started or stopped
+ */
+static void update_authorize(MYSQL_THD thd, struct st_mysql_sys_var *var,
+                             void *var_ptr, const void *save)
+{
+    (void)thd;
+    (void)var;
+    if (var_ptr == &opt_authorize_ttl) {
+        opt_authorize_ttl = *(const int *)save;
+    } else {
+        set_str(var_ptr, save);
+    }
+    k8s_access_review_configure(opt_authorize, opt_authorize_ttl);
+    configure_watch();
+}
+
+/*
+ * Accept only well-formed backend chains
+ */
+static int check_backends(MYSQL_THD thd, struct st_mysql_sys_var *var,
+                          void *save, struct st_mysql_value *value)
+{
+    char buf[K8S_BACKEND_SPEC_MAX + 1];
+    int len = sizeof(buf);
+    const char *str = value->val_str(value, buf, &len);
+    const char *spec = str ? thd_strmake(thd, str, len) : NULL;
+    (void)var;
+
+    if (!k8s_backend_chain_parse(spec, NULL)) {
+        return 1;
+    }
+    *(const char **)save = spec;
+    return 0;
+}
 
 static MYSQL_SYSVAR_STR(api_url, opt_api_url,
-    PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+    PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_MEMALLOC,
     "Kubernetes API server URL",
-    NULL, NULL,
+    check_not_empty, update_str,
     "https://kubernetes.default.svc");
 
 static MYSQL_SYSVAR_STR(ca_path, opt_ca_path,
-    PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+    PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_MEMALLOC,
     "Path to Kubernetes CA certificate",
-    NULL, NULL,
+    check_not_empty, update_str,
     "/var/run/secrets/kubernetes.io/serviceaccount/ca.crt");
 
 static MYSQL_SYSVAR_STR(token_path, opt_token_path,
-    PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+    PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_MEMALLOC,
     "Path to service account token file for TokenReview API calls",
-    NULL, NULL,
+    check_not_empty, update_str,
     "/var/run/secrets/kubernetes.io/serviceaccount/token");
 
 static MYSQL_SYSVAR_INT(timeout, opt_timeout,
-    PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+    PLUGIN_VAR_RQCMDARG,
     "HTTP timeout in seconds for TokenReview API calls",
-    NULL, NULL,
+    NULL, update_int,
     10, 1, 300, 1);
 
+static MYSQL_SYSVAR_INT(pool_size, opt_pool_size,
+    PLUGIN_VAR_RQCMDARG,
+    "Number of API server connections kept open between logins",
+    NULL, update_int,
+    4, 1, K8S_HTTP_POOL_MAX_SIZE, 1);
+
+static MYSQL_SYSVAR_INT(keepalive_interval, opt_keepalive_interval,
+    PLUGIN_VAR_RQCMDARG,
+    "Seconds an idle API server connection may sit before it is pinged to keep it warm (0 disables pings)",
+    NULL, update_int,
+    30, 0, 3600, 1);
+
+static MYSQL_SYSVAR_INT(dns_ttl, opt_dns_ttl,
+    PLUGIN_VAR_RQCMDARG,
+    "Seconds between background re-resolutions of the pinned API server address (0 disables pinning)",
+    NULL, update_int,
+    60, 0, 86400, 1);
+
+static MYSQL_SYSVAR_INT(slow_auth_threshold, opt_slow_auth_threshold,
+    PLUGIN_VAR_RQCMDARG,
+    "Logins taking at least this many milliseconds log their latency breakdown (0 disables)",
+    NULL, update_int,
+    1000, 0, 3600000, 1);
+
+static MYSQL_SYSVAR_INT(log_level, opt_log_level,
+    PLUGIN_VAR_RQCMDARG,
+    "Error log verbosity: 0 = errors, 1 = warnings (failed logins), 2 = info (successful logins), 3 = debug",
+    NULL, update_log_level,
+    K8S_LOG_DEFAULT_LEVEL, K8S_LOG_ERROR, K8S_LOG_DEBUG, 1);
+
+static MYSQL_SYSVAR_INT(metrics_port, opt_metrics_port,
+    PLUGIN_VAR_RQCMDARG,
+    "TCP port of the Prometheus metrics endpoint (0 disables it)",
+    NULL, update_metrics_port,
+    0, 0, 65535, 1);
+
+static MYSQL_SYSVAR_INT(cache_ttl, opt_cache_ttl,
+    PLUGIN_VAR_RQCMDARG,
+    "Seconds a successfully validated token is accepted again without a TokenReview (0 disables the cache)",
+    NULL, update_int,
+    0, 0, 86400, 1);
+
+static MYSQL_SYSVAR_STR(cache_file, opt_cache_file,
+    PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+    "File keeping the token cache across restarts (empty: memory only)",
+    NULL, NULL,
+    "");
+
+static MYSQL_SYSVAR_STR(cache_key_file, opt_cache_key_file,
+    PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+    "File holding the secret that encrypts auth_k8s_cache_file",
+    NULL, NULL,
+    "");
+
+static MYSQL_SYSVAR_STR(watch_namespaces, opt_watch_namespaces,
+    PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_MEMALLOC,
+    "Comma-separated namespaces whose ServiceAccount and Pod deletions evict cached tokens (* for all, empty disables)",
+    NULL, update_watch_namespaces,
+    "");
+
+static MYSQL_SYSVAR_STR(denylist_file, opt_denylist_file,
+    PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_MEMALLOC,
+    "File listing revoked token hashes, ServiceAccount UIDs and namespace/name patterns (empty disables)",
+    NULL, update_denylist_file,
+    "");
+
+static MYSQL_SYSVAR_INT(revalidate_interval, opt_revalidate_interval,
+    PLUGIN_VAR_RQCMDARG,
+    "Seconds after which the token of a live connection is validated again (0 disables revalidation)",
+    NULL, update_int,
+    0, 0, 86400, 1);
+
+static MYSQL_SYSVAR_BOOL(revalidate_kill, opt_revalidate_kill,
+    PLUGIN_VAR_RQCMDARG,
+    "Kill connections whose token fails revalidation instead of only logging them",
+    NULL, update_bool,
+    0);
+
+static MYSQL_SYSVAR_BOOL(optimistic, opt_optimistic,
+    PLUGIN_VAR_RQCMDARG,
+    "Accept tokens whose signature verifies against the cluster's signing keys at once and confirm them with TokenReview in the background",
+    NULL, update_bool,
+    0);
+
+static MYSQL_SYSVAR_INT(optimistic_window, opt_optimistic_window,
+    PLUGIN_VAR_RQCMDARG,
+    "Seconds an optimistic login may stay unconfirmed before its connection is killed",
+    NULL, update_int,
+    30, 1, 3600, 1);
+
+static MYSQL_SYSVAR_INT(ticket_ttl, opt_ticket_ttl,
+    PLUGIN_VAR_RQCMDARG,
+    "Seconds a session ticket issued to auth_k8s_client lets it log in again without a TokenReview (0 issues none)",
+    NULL, update_int,
+    300, 0, 86400, 1);
+
+static MYSQL_SYSVAR_STR(authorize, opt_authorize,
+    PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_MEMALLOC,
+    "RBAC permission a ServiceAccount needs in its namespace to log in, as \"<verb> <resource>[.<group>][/<name>]\" (empty disables the SubjectAccessReview)",
+    check_authorize, update_authorize,
+    "");
+
+static MYSQL_SYSVAR_INT(authorize_ttl, opt_authorize_ttl,
+    PLUGIN_VAR_RQCMDARG,
+    "Seconds a SubjectAccessReview decision is reused for the same ServiceAccount (0 reviews every login)",
+    NULL, update_authorize,
+    60, 0, 86400, 1);
+
+static MYSQL_SYSVAR_STR(backends, opt_backends,
+    PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_MEMALLOC,
+    "Validation backends asked in order until one has a verdict, as \"<name>[:<timeout>], ...\" (tokenreview, jwks, federated)",
+    check_backends, update_str,
+    "tokenreview");
+
+static MYSQL_SYSVAR_STR(cluster_file, opt_cluster_file,
+    PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_MEMALLOC,
+    "File listing the remote clusters users named cluster/namespace/serviceaccount log in from, one \"<name> <api_url> <ca_path> <token_path> [<option>=<value> ...]\" per line (empty disables)",
+    NULL, update_cluster_file,
+    "");
+
+static MYSQL_SYSVAR_STR(issuer_dir, opt_issuer_dir,
+    PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_MEMALLOC,
+    "Directory of the signing keys of clusters verified offline, one <cluster>.jwks or <cluster>.pem per cluster (empty disables)",
+    NULL, update_issuer_dir,
+    "");
+
+static MYSQL_SYSVAR_STR(federated_socket, opt_federated_socket,
+    PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_MEMALLOC,
+    "Unix socket of the node-local token validator the federated backend asks (empty disables)",
+    NULL, update_federated_socket,
+    "");
+
+static MYSQL_SYSVAR_INT(identity_status_limit, opt_identity_status_limit,
+    PLUGIN_VAR_RQCMDARG,
+    "Most recently seen identities listed in the auth_k8s_identity_* status variables (0 lists none)",
+    NULL, update_identity_status_limit,
+    100, 0, K8S_IDENTITY_SLOTS, 1);
+
 static struct st_mysql_sys_var *auth_k8s_sys_vars[] = {
     MYSQL_SYSVAR(api_url),
     MYSQL_SYSVAR(ca_path),
     MYSQL_SYSVAR(token_path),
     MYSQL_SYSVAR(timeout),
+    MYSQL_SYSVAR(pool_size),
+    MYSQL_SYSVAR(keepalive_interval),
+    MYSQL_SYSVAR(dns_ttl),
+    MYSQL_SYSVAR(slow_auth_threshold),
+    MYSQL_SYSVAR(log_level),
+    MYSQL_SYSVAR(metrics_port),
+    MYSQL_SYSVAR(cache_ttl),
+    MYSQL_SYSVAR(cache_file),
+    MYSQL_SYSVAR(cache_key_file),
+    MYSQL_SYSVAR(watch_namespaces),
+    MYSQL_SYSVAR(denylist_file),
+    MYSQL_SYSVAR(revalidate_interval),
+    MYSQL_SYSVAR(revalidate_kill),
+    MYSQL_SYSVAR(optimistic),
+    MYSQL_SYSVAR(optimistic_window),
+    MYSQL_SYSVAR(ticket_ttl),
+    MYSQL_SYSVAR(authorize),
+    MYSQL_SYSVAR(authorize_ttl),
+    MYSQL_SYSVAR(backends),
+    MYSQL_SYSVAR(cluster_file),
+    MYSQL_SYSVAR(issuer_dir),
+    MYSQL_SYSVAR(federated_socket),
+    MYSQL_SYSVAR(identity_status_limit),
     NULL
 };
 
 /*
- * Server authentication function
- *
- * This function is called when a client attempts to authenticate.
+ * Copy the system variables into a new, unpublished snapshot
  *
- * @param vio - Communication channel with the client
- * @param info - Server connection information
- * @return 0 on success, 1 on failure
+ * Must be called while the server holds the variables stable, i.e. from
+ * plugin init or a sysvar update callback.
  */
-static int auth_k8s_server(MYSQL_PLUGIN_VIO *vio, MYSQL_SERVER_AUTH_INFO *info)
+static k8s_snapshot_t *snapshot_from_options(void)
 {
-    unsigned char *packet;
-    int packet_len;
+    k8s_config_t config;
+    k8s_config_init_default(&config);
+    config.api_server_url = opt_api_url;
+    config.ca_cert_path = opt_ca_path;
+    config.token_path = opt_token_path;
+    config.timeout_seconds = opt_timeout;
 
-    /* Send a request to the client for the ServiceAccount token */
-    if (vio->write_packet(vio, (unsigned char *)"", 0))
-    {
-        return CR_ERROR;
+    k8s_snapshot_t *snap = k8s_snapshot_create(&config, opt_pool_size,
+                                               opt_keepalive_interval, opt_dns_ttl);
+    if (snap) {
+        snap->slow_auth_ms = opt_slow_auth_threshold;
+        snap->cache_ttl = opt_cache_ttl;
+        snap->revalidate_interval = opt_revalidate_interval;
+        snap->revalidate_kill = opt_revalidate_kill;
+        snap->optimistic_window = opt_optimistic_window;
+        snap->ticket_ttl = opt_ticket_ttl;
+        /* SET GLOBAL checks the chain, a startup option is not checked */
+        if (opt_backends && !k8s_backend_chain_parse(opt_backends, &snap->backends)) {
+            K8S_LOG(K8S_LOG_ERROR, "backends_invalid", "backends=\"%s\" action=tokenreview",
+                    opt_backends);
+        }
+#ifdef MYSQL_SERVICE_SQL
+        snap->optimistic = opt_optimistic;
+#else
+        /* A connection that fails confirmation could not be killed */
+        if (opt_optimistic) {
+            K8S_LOG(K8S_LOG_WARNING, "optimistic_unavailable", "reason=no_sql_service");
+        }
+#endif
     }
+    return snap;
+}
 
-    /* Read the token from the client */
-    packet_len = vio->read_packet(vio, &packet);
-    if (packet_len < 0)
-    {
-        return CR_ERROR;
+/*
+ * Seconds between revalidation rounds
+ *
+ * Rounds run four times per interval, so a token is checked at most a
+ * quarter interval after it falls due.
+ */
+static int revalidate_period(int interval)
+{
+    if (interval <= 0) {
+        return 0;
     }
+    return interval >= 4 ? interval / 4 : 1;
+}
 
-    /* Check if token was provided */
-    if (packet_len == 0)
-    {
-        fprintf(stderr, "K8s Auth: No token provided\n");
-        info->password_used = PASSWORD_USED_NO;
-        return CR_ERROR;
-    }
+/*
+ * Whether logins under a snapshot need the API server's signing keys:
+ * for optimistic logins, or for the jwks backend
+ */
+static int uses_keys(const k8s_snapshot_t *snap)
+{
+    return snap->optimistic || k8s_backend_chain_find(&snap->backends, "jwks", NULL);
+}
 
-    info->password_used = PASSWORD_USED_YES;
+/*
+ * Fetch the signing keys, within the jwks backend's timeout if it has one
+ */
+static void refresh_keys(const k8s_snapshot_t *snap)
+{
+    k8s_config_t config = snap->config;
+    int timeout = 0;
 
-    /* Null-terminate the token string */
-    char *token = malloc(packet_len + 1);
-    if (!token) {
-        fprintf(stderr, "K8s Auth: Memory allocation failed\n");
-        return CR_ERROR;
+    if (k8s_backend_chain_find(&snap->backends, "jwks", &timeout) && timeout > 0) {
+        config.timeout_seconds = timeout;
     }
-    memcpy(token, packet, packet_len);
-    token[packet_len] = '\0';
-
-    /* Log token info (preview only for security) */
-    char token_preview[50] = {0};
-    int preview_len = packet_len < 40 ? packet_len : 40;
-    memcpy(token_preview, token, preview_len);
-    fprintf(stderr, "K8s Auth: Received token (length=%d, preview=%.40s...)\n",
-            packet_len, token_preview);
-    fprintf(stderr, "K8s Auth: Authenticating user '%s'\n", info->user_name);
+    k8s_jwks_refresh(&config);
+}
 
-#if ENABLE_TOKEN_VALIDATION
-    /* Build config from system variables */
-    k8s_config_t config;
-    config.api_server_url = opt_api_url;
-    config.ca_cert_path = opt_ca_path;
-    config.token_path = opt_token_path;
-    config.timeout_seconds = opt_timeout;
+/*
+ * Give a snapshot its connection pool and make it current
+ *
+ * The previous pool is kept when the new settings don't affect connections.
+ * Otherwise a new pool is created and warmed before it is published, so
+ * logins switch straight from the old warm pool to the new one; the old
+ * pool is closed once its last in-flight request has finished.
+ */
+static void apply_snapshot(k8s_snapshot_t *snap)
+{
+    k8s_snapshot_t *cur = k8s_snapshot_acquire();
 
-    /* Validate token with Kubernetes TokenReview API */
-    k8s_token_info_t token_info;
-    int valid = k8s_validate_token(token, &token_info, &config);
+    if (cur && cur->config.pool && k8s_snapshot_same_pool(cur, snap)) {
+        snap->config.pool = cur->config.pool;
+        k8s_snapshot_release(cur);
+    } else {
+        k8s_snapshot_release(cur);
 
-    free(token);
+        snap->config.pool = k8s_http_pool_create(&snap->config, snap->pool_size);
+        if (!snap->config.pool) {
+            K8S_LOG(K8S_LOG_WARNING, "pool_unavailable", "fallback=one_shot");
+        } else {
+            snap->owns_pool = 1;
+            if (snap->dns_ttl > 0) {
+                k8s_http_pool_resolve(snap->config.pool);
+            }
 
-    if (!valid || !token_info.authenticated) {
-        fprintf(stderr, "K8s Auth: Token validation failed\n");
-        return CR_ERROR;
+            int live = k8s_http_pool_ping(snap->config.pool, 0);
+            K8S_LOG(K8S_LOG_INFO, "pool_opened", "url=\"%s\" live=%d size=%d",
+                    snap->api_server_url, live, snap->pool_size);
+        }
     }
 
-    /* Build expected username from MariaDB user: namespace/serviceaccount */
-    char expected_user[K8S_MAX_NAMESPACE_LEN + K8S_MAX_NAME_LEN + 2];
-    snprintf(expected_user, sizeof(expected_user), "%s/%s",
-             token_info.namespace, token_info.service_account);
+    k8s_snapshot_publish(snap);
+    retarget_watch();
 
-    /* Verify that the MariaDB username matches the ServiceAccount */
-    if (strcmp(info->user_name, expected_user) != 0) {
-        fprintf(stderr, "K8s Auth: User mismatch. Expected '%s', got '%s'\n",
-                expected_user, info->user_name);
-        fprintf(stderr, "K8s Auth: Token is for %s/%s\n",
-                token_info.namespace, token_info.service_account);
-        return CR_ERROR;
+    k8s_bg_set_interval("keepalive", snap->keepalive_interval);
+    k8s_bg_set_interval("dns", snap->dns_ttl);
+    k8s_bg_set_interval("revalidate", revalidate_period(snap->revalidate_interval));
+    k8s_bg_set_interval("confirm", uses_keys(snap) ? CONFIRM_INTERVAL : 0);
+    if (snap->revalidate_interval == 0 && !snap->optimistic) {
+        k8s_session_clear();
     }
+}
 
-    fprintf(stderr, "K8s Auth: ✅ Authentication successful for %s/%s\n",
-            token_info.namespace, token_info.service_account);
-    return CR_OK;
+/*
+ * What happened during one login, for statistics and the slow-auth log
+ */
+typedef struct {
+    k8s_stat_t outcome;             /* Status counter describing the result */
+    unsigned long long client_us;   /* Token request until the token arrived */
+    k8s_request_timing_t timing;    /* TokenReview breakdown, zero if not called */
+    int slow_auth_ms;               /* Threshold from the snapshot used */
+    int authenticated;              /* The token or ticket proved the user name */
+} login_trace_t;
 
-#else
-    /* POC mode: Accept any non-empty token without validation */
-    free(token);
-    fprintf(stderr, "K8s Auth POC: ⚠️  Validation disabled - accepting token\n");
-    return CR_OK;
-#endif
+/*
+ * Short result name for log lines
+ */
+static const char *outcome_label(k8s_stat_t outcome)
+{
+    switch (outcome) {
+    case K8S_STAT_SUCCESSES:            return "success";
+    case K8S_STAT_FAIL_NO_TOKEN:        return "no_token";
+    case K8S_STAT_FAIL_REJECTED:        return "rejected";
+    case K8S_STAT_FAIL_USER_MISMATCH:   return "user_mismatch";
+    case K8S_STAT_FAIL_DENIED:          return "denied";
+    case K8S_STAT_FAIL_POLICY:          return "policy";
+    case K8S_STAT_FAIL_FORBIDDEN:       return "forbidden";
+    case K8S_STAT_FAIL_UNKNOWN_CLUSTER: return "unknown_cluster";
+    case K8S_STAT_FAIL_API_ERROR:       return "api_error";
+    default:                            return "internal_error";
+    }
 }
 
+#if ENABLE_TOKEN_VALIDATION
 /*
- * Plugin descriptor structure
+ * The API server of the cluster a login comes from, held while it is asked
  */
-static struct st_mysql_auth auth_k8s_handler = {
-    MYSQL_AUTHENTICATION_INTERFACE_VERSION,
-    "mysql_clear_password",  /* Client plugin name - use built-in clear password plugin */
-    auth_k8s_server,         /* Server authentication function */
-    NULL,                    /* Generate auth string (not used) */
-    NULL                     /* Validate auth string (not used) */
-};
+typedef struct {
+    k8s_snapshot_t *snap;           /* Local cluster */
+    k8s_cluster_lease_t lease;      /* Remote cluster */
+    k8s_config_t config;            /* With the account's timeout */
+} api_target_t;
 
 /*
- * Plugin declaration
- * Using mysql_declare_plugin for compatibility with MariaDB server loading
+ * Take the API server of a cluster
+ *
+ * @param cluster - Cluster name, K8S_CLUSTER_LOCAL for the local cluster
+ * @param policy - Policy of the account, NULL if it has none
+ * @param target - Filled on success; return it with target_release()
+ * @return K8S_CLUSTER_OK on success, otherwise why the cluster cannot be
+ *         asked (K8S_CLUSTER_UNKNOWN as well when no configuration is
+ *         published yet)
  */
-mysql_declare_plugin(auth_k8s)
+static k8s_cluster_status_t target_acquire(const char *cluster, const k8s_policy_t *policy,
+                                           api_target_t *target)
 {
-    MYSQL_AUTHENTICATION_PLUGIN,
-    &auth_k8s_handler,
-    "auth_k8s",
+    memset(target, 0, sizeof(*target));
+    if (strcmp(cluster, K8S_CLUSTER_LOCAL) == 0) {
+        target->snap = k8s_snapshot_acquire();
+        if (!target->snap) {
+            return K8S_CLUSTER_UNKNOWN;
+        }
+        target->config = target->snap->config;
+    } else {
+        k8s_cluster_status_t status = k8s_cluster_acquire(cluster, &target->lease);
+        if (status != K8S_CLUSTER_OK) {
+            return status;
+        }
+        target->config = target->lease.config;
+    }
+    target->config.timeout_seconds = k8s_policy_timeout(policy, target->config.timeout_seconds);
+    return K8S_CLUSTER_OK;
+}
+
+/*
+ * Return an API server taken with target_acquire()
+ *
+ * @param target - Target
+ * @param answered - As for k8s_cluster_release()
+ */
+static void target_release(api_target_t *target, int answered)
+{
+    k8s_snapshot_release(target->snap);
+    k8s_cluster_release(&target->lease, answered);
+}
+
+/*
+ * Check the pod a reviewed token is bound to against the account's policy
+ *
+ * @param policy - Policy of the account
+ * @param cluster - Cluster the token was reviewed by
+ * @param token_info - Reviewed token
+ * @return 1 if the pod carries every required label, 0 otherwise (tokens
+ *         bound to no pod, and pods that cannot be read, included)
+ */
+static int pod_allowed(const k8s_policy_t *policy, const char *cluster,
+                       const k8s_token_info_t *token_info)
+{
+    char path[64 + K8S_MAX_NAMESPACE_LEN + K8S_MAX_NAME_LEN];
+    api_target_t target;
+
+    if (!token_info->pod_name[0]) {
+        return 0;
+    }
+    if (target_acquire(cluster, policy, &target) != K8S_CLUSTER_OK) {
+        return 0;
+    }
+    snprintf(path, sizeof(path), "/api/v1/namespaces/%s/pods/%s",
+             token_info->namespace, token_info->pod_name);
+    char *pod = k8s_api_get(path, &target.config);
+    target_release(&target, pod != NULL);
+
+    int allowed = pod && k8s_policy_pod_allowed(policy, pod, token_info->pod_uid);
+    k8s_free(pod);
+    return allowed;
+}
+
+/*
+ * Apply the account's policy to an authenticated ServiceAccount
+ *
+ * Checks the groups and pod the policy requires, then, with mapping rules,
+ * proxies the login to the account the ServiceAccount maps to: the server
+ * then requires that account to have granted PROXY to the one the client
+ * logged in to, and reports the ServiceAccount as @@external_user.
+ *
+ * @param info - Server connection information; user_name is the
+ *               ServiceAccount as [cluster/]namespace/name
+ * @param policy - Policy of the account, NULL if it has none
+ * @param cluster - Cluster the login comes from
+ * @param identity - The ServiceAccount as namespace/name
+ * @param token_info - Result of the login's TokenReview, NULL if there was
+ *                     none (policies that need one never get that far)
+ * @return 1 if the login may proceed, 0 if the policy refuses it
+ */
+static int apply_policy(MYSQL_SERVER_AUTH_INFO *info, const k8s_policy_t *policy,
+                        const char *cluster, const char *identity,
+                        const k8s_token_info_t *token_info)
+{
+    const char *account = NULL;
+    const char *detail = NULL;
+
+    if (!policy) {
+        return 1;
+    }
+    if (token_info && !k8s_policy_groups_allowed(policy, token_info->groups)) {
+        detail = "group";
+    } else if (token_info && k8s_policy_pod_labels(policy) > 0 &&
+               !pod_allowed(policy, cluster, token_info)) {
+        detail = "pod_labels";
+    } else if (k8s_policy_rules(policy) > 0 &&
+               !(account = k8s_policy_map(policy, identity))) {
+        detail = "no_mapping";
+    }
+    if (detail) {
+        K8S_LOG(K8S_LOG_WARNING, "login_failed", "user=\"%s\" reason=policy detail=%s",
+                info->user_name, detail);
+        return 0;
+    }
+
+    if (account) {
+        snprintf(info->authenticated_as, sizeof(info->authenticated_as), "%s", account);
+        snprintf(info->external_user, sizeof(info->external_user), "%s", info->user_name);
+        K8S_LOG(K8S_LOG_DEBUG, "login_mapped", "user=\"%s\" account=\"%s\"",
+                info->user_name, account);
+    }
+    return 1;
+}
+
+/*
+ * Ask whether RBAC lets an authenticated ServiceAccount log in
+ *
+ * Decisions are cached per ServiceAccount, so most logins, and all cached
+ * and ticket logins of a known ServiceAccount, make no API call here.
+ *
+ * @param info - Server connection information
+ * @param policy - Policy of the account, NULL if it has none
+ * @param cluster - Cluster the login comes from; its API server is asked
+ * @param token_info - Authenticated ServiceAccount
+ * @return K8S_STAT_SUCCESSES if the login may proceed, otherwise the outcome
+ *         to fail it with
+ */
+static k8s_stat_t authorize(MYSQL_SERVER_AUTH_INFO *info, const k8s_policy_t *policy,
+                            const char *cluster, const k8s_token_info_t *token_info)
+{
+    int remote = strcmp(cluster, K8S_CLUSTER_LOCAL) != 0;
+    api_target_t target;
+    int cached = 0;
+
+    if (!k8s_access_review_enabled()) {
+        return K8S_STAT_SUCCESSES;
+    }
+    if (target_acquire(cluster, policy, &target) != K8S_CLUSTER_OK) {
+        if (remote) {
+            K8S_LOG(K8S_LOG_WARNING, "login_failed", "user=\"%s\" reason=api_error "
+                    "detail=cluster_unavailable", info->user_name);
+            return K8S_STAT_FAIL_API_ERROR;
+        }
+        K8S_LOG(K8S_LOG_ERROR, "config_unavailable", "user=\"%s\"", info->user_name);
+        return K8S_STAT_FAIL_INTERNAL;
+    }
+    k8s_access_t access = k8s_access_review_check(remote ? cluster : NULL,
+                                                  token_info->namespace,
+                                                  token_info->service_account,
+                                                  token_info->uid, &target.config, &cached);
+    target_release(&target, cached ? -1 : access != K8S_ACCESS_ERROR);
+
+    if (access == K8S_ACCESS_ALLOWED) {
+        return K8S_STAT_SUCCESSES;
+    }
+    k8s_stat_t outcome = access == K8S_ACCESS_DENIED ? K8S_STAT_FAIL_FORBIDDEN
+                                                     : K8S_STAT_FAIL_API_ERROR;
+    K8S_LOG(K8S_LOG_WARNING, "login_failed", "user=\"%s\" reason=%s detail=access_review "
+            "cached=%d", info->user_name, outcome_label(outcome), cached);
+    return outcome;
+}
+
+/*
+ * Check a session ticket
+ *
+ * A ticket that is forged, expired, for another account, for a revoked
+ * token or for a ServiceAccount the watches saw deleted is not an error:
+ * the client is asked for its token instead, which then gets the full
+ * checks. So is any ticket for an account whose policy needs a TokenReview
+ * of every login, and any ticket for a remote cluster's user: tickets are
+ * only issued for the local cluster.
+ *
+ * @param info - Server connection information
+ * @param ticket - Ticket as sent by the client
+ * @param len - Length of ticket
+ * @param policy - Policy of the account, NULL if it has none
+ * @param cluster - Cluster the user name names
+ * @param identity - The ServiceAccount the user name names, as namespace/name
+ * @param token_info - Filled with the identity the ticket was issued for
+ * @param digest - Receives the SHA-256 of the ticket's token
+ * @return 1 if the ticket authenticates the login, 0 otherwise
+ */
+static int ticket_valid(MYSQL_SERVER_AUTH_INFO *info, const char *ticket, size_t len,
+                        const k8s_policy_t *policy, const char *cluster,
+                        const char *identity, k8s_token_info_t *token_info,
+                        unsigned char *digest)
+{
+    char expected_user[K8S_MAX_NAMESPACE_LEN + K8S_MAX_NAME_LEN + 2];
+    const char *reason = NULL;
+
+    if (k8s_policy_strict(policy)) {
+        reason = "policy";
+    } else if (strcmp(cluster, K8S_CLUSTER_LOCAL) != 0) {
+        reason = "cluster";
+    } else if (!k8s_ticket_verify(ticket, len, token_info, digest)) {
+        reason = "invalid";
+    } else if (k8s_denylist_check_digest(digest) != K8S_DENY_NONE ||
+               k8s_session_denied_digest(digest) ||
+               k8s_denylist_check_identity(token_info->namespace, token_info->service_account,
+                                           token_info->uid) != K8S_DENY_NONE) {
+        reason = "denied";
+    } else if (k8s_watch_deleted(token_info->uid)) {
+        reason = "deleted";
+    } else {
+        snprintf(expected_user, sizeof(expected_user), "%s/%s",
+                 token_info->namespace, token_info->service_account);
+        if (strcmp(identity, expected_user) != 0) {
+            reason = "user_mismatch";
+        }
+    }
+
+    if (reason) {
+        K8S_LOG(K8S_LOG_DEBUG, "ticket_refused", "user=\"%s\" reason=%s",
+                info->user_name, reason);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Track a ticket login for revalidation
+ *
+ * A ticket only carries the digest of its token, so the connection joins
+ * the connections that logged in with the token itself and is revalidated
+ * and killed along with them. While revalidation is on, a ticket whose
+ * token no live connection uses is refused and the client sends its token.
+ *
+ * @return 1 if the ticket may be accepted, 0 otherwise
+ */
+static int ticket_tracked(MYSQL_SERVER_AUTH_INFO *info, const k8s_token_info_t *token_info,
+                          const unsigned char *digest)
+{
+    k8s_snapshot_t *snap = k8s_snapshot_acquire();
+    int revalidate = snap && snap->revalidate_interval > 0 &&
+                     __atomic_load_n(&sessions_tracked, __ATOMIC_ACQUIRE);
+    k8s_snapshot_release(snap);
+
+    if (!revalidate ||
+        k8s_session_attach(thd_get_thread_id(info->thd), digest, token_info->uid)) {
+        return 1;
+    }
+    K8S_LOG(K8S_LOG_DEBUG, "ticket_refused", "user=\"%s\" reason=untracked",
+            info->user_name);
+    return 0;
+}
+#endif
+
+/*
+ * Answer a ticket client's token with a ticket for its next login
+ *
+ * @param vio - Communication channel with the client
+ * @param token - Token the client logged in with
+ * @param token_info - Identity the token was reviewed for, or NULL to
+ *                     issue no ticket
+ * @param ttl - Ticket lifetime in seconds
+ * @return 1 if the answer was sent, 0 on client I/O failure
+ */
+static int send_ticket(MYSQL_PLUGIN_VIO *vio, const char *token,
+                       const k8s_token_info_t *token_info, int ttl)
+{
+    unsigned char msg[1 + 4 + K8S_TICKET_MAX_LEN + 1];
+    int len = 1;
+    int lifetime = 0;
+
+    msg[0] = K8S_TICKET_MSG_ISSUED;
+#if ENABLE_TOKEN_VALIDATION
+    if (token_info) {
+        lifetime = k8s_ticket_issue(token, token_info, ttl, (char *)msg + 5,
+                                    K8S_TICKET_MAX_LEN + 1);
+    }
+#else
+    (void)token;
+    (void)token_info;
+    (void)ttl;
+#endif
+    if (lifetime > 0) {
+        for (int i = 0; i < 4; i++) {
+            msg[1 + i] = (unsigned char)((unsigned int)lifetime >> (24 - 8 * i));
+        }
+        len = 5 + (int)strlen((char *)msg + 5);
+        k8s_stats_inc(K8S_STAT_TICKETS_ISSUED);
+    }
+    return vio->write_packet(vio, msg, len) == 0;
+}
+
+/*
+ * Authenticate one login
+ *
+ * With tickets set the exchange of ticket_protocol.h is used: the client may
+ * present a session ticket instead of its token, and gets a new ticket after
+ * a TokenReview.
+ *
+ * A user named cluster/namespace/serviceaccount logs in with a token of the
+ * remote cluster of cluster.h, reviewed by that cluster's API server alone:
+ * without the token cache, the backend chain, tickets or revalidation. A
+ * cluster not in the registry but with keys in issuers.h has its tokens
+ * verified against those keys instead.
+ *
+ * @param vio - Communication channel with the client
+ * @param info - Server connection information
+ * @param tickets - Speak the ticket exchange (auth_k8s_ticket)
+ * @param policy - Compiled authentication string, NULL if it is empty
+ * @param trace - Filled with the outcome and latency breakdown; the outcome
+ *                is K8S_STAT_COUNT if the client cannot use tickets
+ * @return CR_OK on success, CR_ERROR on failure
+ */
+static int authenticate(MYSQL_PLUGIN_VIO *vio, MYSQL_SERVER_AUTH_INFO *info,
+                        int tickets, const k8s_policy_t *policy, login_trace_t *trace)
+{
+    static const unsigned char hello = K8S_TICKET_MSG_HELLO;
+    unsigned char *packet;
+    int packet_len;
+    uint64_t started = k8s_stats_now_usec();
+    char cluster[K8S_CLUSTER_NAME_MAX + 1];
+    const char *identity;
+
+    /* Refused before the client is asked for anything */
+    if (!k8s_cluster_split_user(info->user_name, cluster, &identity))
+    {
+        K8S_LOG(K8S_LOG_WARNING, "login_failed", "user=\"%s\" reason=unknown_cluster",
+                info->user_name);
+        trace->outcome = K8S_STAT_FAIL_UNKNOWN_CLUSTER;
+        return CR_ERROR;
+    }
+    if (!k8s_policy_cluster_allowed(policy, cluster))
+    {
+        K8S_LOG(K8S_LOG_WARNING, "login_failed", "user=\"%s\" reason=policy detail=cluster",
+                info->user_name);
+        trace->outcome = K8S_STAT_FAIL_POLICY;
+        return CR_ERROR;
+    }
+    int remote = strcmp(cluster, K8S_CLUSTER_LOCAL) != 0;
+
+    /* Send a request to the client for the ServiceAccount token (or a ticket) */
+    if (vio->write_packet(vio, tickets ? &hello : (const unsigned char *)"", tickets ? 1 : 0))
+    {
+        return CR_ERROR;
+    }
+
+    /* Read the token from the client */
+    k8s_psi_stage(K8S_STAGE_READ_TOKEN);
+    packet_len = vio->read_packet(vio, &packet);
+    if (packet_len < 0)
+    {
+        return CR_ERROR;
+    }
+
+    if (tickets)
+    {
+        /* Clients without auth_k8s_client answer with an empty packet; the
+         * account's next authentication method takes over */
+        if (packet_len == 0)
+        {
+            K8S_LOG(K8S_LOG_DEBUG, "ticket_unsupported", "user=\"%s\"", info->user_name);
+            info->password_used = PASSWORD_USED_NO;
+            trace->outcome = K8S_STAT_COUNT;
+            return CR_ERROR;
+        }
+
+#if ENABLE_TOKEN_VALIDATION
+        if (packet[0] == K8S_TICKET_MSG_TICKET)
+        {
+            static const unsigned char accepted = K8S_TICKET_MSG_ACCEPTED;
+            static const unsigned char retry = K8S_TICKET_MSG_RETRY;
+            k8s_token_info_t ticket_info;
+            unsigned char digest[K8S_TICKET_DIGEST_LEN];
+
+            /* One MAC check instead of a TokenReview */
+            if (ticket_valid(info, (const char *)packet + 1, (size_t)packet_len - 1, policy,
+                             cluster, identity, &ticket_info, digest))
+            {
+                info->password_used = PASSWORD_USED_YES;
+                trace->authenticated = 1;
+                if (!apply_policy(info, policy, cluster, identity, NULL))
+                {
+                    trace->outcome = K8S_STAT_FAIL_POLICY;
+                    return CR_ERROR;
+                }
+                if ((trace->outcome = authorize(info, policy, cluster, &ticket_info)) !=
+                    K8S_STAT_SUCCESSES)
+                {
+                    return CR_ERROR;
+                }
+                if (ticket_tracked(info, &ticket_info, digest))
+                {
+                    if (vio->write_packet(vio, &accepted, 1))
+                    {
+                        return CR_ERROR;
+                    }
+                    k8s_stats_inc(K8S_STAT_TICKET_LOGINS);
+                    K8S_LOG(K8S_LOG_INFO, "login_succeeded", "user=\"%s\" ticket=1",
+                            info->user_name);
+                    trace->outcome = K8S_STAT_SUCCESSES;
+                    return CR_OK;
+                }
+            }
+
+            if (vio->write_packet(vio, &retry, 1) ||
+                (packet_len = vio->read_packet(vio, &packet)) < 0)
+            {
+                return CR_ERROR;
+            }
+        }
+#endif
+
+        if (packet_len == 0 || packet[0] != K8S_TICKET_MSG_TOKEN)
+        {
+            K8S_LOG(K8S_LOG_WARNING, "login_failed", "user=\"%s\" reason=protocol_error",
+                    info->user_name);
+            return CR_ERROR;
+        }
+        packet++;
+        packet_len--;
+    }
+    trace->client_us = k8s_stats_now_usec() - started;
+
+    /* Check if token was provided */
+    if (packet_len == 0)
+    {
+        K8S_LOG(K8S_LOG_WARNING, "login_failed", "user=\"%s\" reason=no_token",
+                info->user_name);
+        info->password_used = PASSWORD_USED_NO;
+        trace->outcome = K8S_STAT_FAIL_NO_TOKEN;
+        return CR_ERROR;
+    }
+
+    info->password_used = PASSWORD_USED_YES;
+
+    /* Null-terminate the token string */
+    char *token = k8s_malloc(K8S_MEM_TOKEN, packet_len + 1);
+    if (!token) {
+        K8S_LOG(K8S_LOG_ERROR, "out_of_memory", "where=token");
+        return CR_ERROR;
+    }
+    memcpy(token, packet, packet_len);
+    token[packet_len] = '\0';
+
+    /* Never log token contents, not even a prefix */
+    K8S_LOG(K8S_LOG_DEBUG, "login_started", "user=\"%s\" token_len=%d",
+            info->user_name, packet_len);
+
+#if ENABLE_TOKEN_VALIDATION
+    /* A revoked token is turned away before it costs a TokenReview */
+    if (k8s_denylist_check_token(token) != K8S_DENY_NONE) {
+        k8s_free(token);
+        K8S_LOG(K8S_LOG_WARNING, "login_failed", "user=\"%s\" reason=denied match=token",
+                info->user_name);
+        trace->outcome = K8S_STAT_FAIL_DENIED;
+        return CR_ERROR;
+    }
+
+    /* So is a token that failed revalidation or confirmation */
+    if (k8s_session_denied(token)) {
+        k8s_free(token);
+        K8S_LOG(K8S_LOG_WARNING, "login_failed", "user=\"%s\" reason=denied match=revoked",
+                info->user_name);
+        trace->outcome = K8S_STAT_FAIL_DENIED;
+        return CR_ERROR;
+    }
+
+    /* A remote cluster that is failing or saturated fails its logins at
+     * once instead of tying up more login threads. One the plugin does not
+     * reach may have its signing keys mounted instead. */
+    k8s_cluster_lease_t lease;
+    int offline = 0;
+    memset(&lease, 0, sizeof(lease));
+    if (remote) {
+        k8s_cluster_status_t status = k8s_cluster_acquire(cluster, &lease);
+        offline = status == K8S_CLUSTER_UNKNOWN && k8s_issuers_known(cluster);
+        if (status != K8S_CLUSTER_OK && !offline) {
+            k8s_free(token);
+            trace->outcome = status == K8S_CLUSTER_UNKNOWN ? K8S_STAT_FAIL_UNKNOWN_CLUSTER
+                                                           : K8S_STAT_FAIL_API_ERROR;
+            K8S_LOG(K8S_LOG_WARNING, "login_failed", "user=\"%s\" reason=%s%s",
+                    info->user_name, outcome_label(trace->outcome),
+                    status == K8S_CLUSTER_OPEN ? " detail=cluster_unavailable" :
+                    status == K8S_CLUSTER_BUSY ? " detail=cluster_busy" : "");
+            return CR_ERROR;
+        }
+    }
+
+    /* Pin the current configuration for the whole validation */
+    k8s_snapshot_t *snap = k8s_snapshot_acquire();
+    if (!snap) {
+        K8S_LOG(K8S_LOG_ERROR, "config_unavailable", "user=\"%s\"", info->user_name);
+        k8s_cluster_release(&lease, -1);
+        k8s_free(token);
+        return CR_ERROR;
+    }
+
+    /* The account's policy may narrow what the token is checked against */
+    k8s_config_t config = remote ? lease.config : snap->config;
+    config.timeout_seconds = k8s_policy_timeout(policy, config.timeout_seconds);
+    config.audience = k8s_policy_audience(policy);
+
+    k8s_token_info_t token_info;
+    k8s_cache_entry_t cached;
+    int cache_ttl = k8s_policy_cache_ttl(policy, snap->cache_ttl);
+    int strict = k8s_policy_strict(policy);
+    int ticket_ttl = snap->ticket_ttl;
+    int tracked = __atomic_load_n(&sessions_tracked, __ATOMIC_ACQUIRE);
+    /* Revalidation reviews for the local API server's audience */
+    int revalidate = snap->revalidate_interval > 0 && tracked && !config.audience && !remote;
+    /* Tokens of another cluster are only vouched for by its API server */
+    int reuse = !strict && !remote;
+    unsigned long thread_id = thd_get_thread_id(info->thd);
+    const k8s_backend_t *backend = NULL;
+    int from_cache = 0;
+    int optimistic = 0;
+    int local = 0;
+    int valid;
+    trace->slow_auth_ms = snap->slow_auth_ms;
+
+    if (snap->optimistic && reuse && tracked && k8s_jwks_verify(token, &token_info) &&
+        k8s_session_register(thread_id, token, &token_info, 0)) {
+        /* Signed by the cluster for its own audience (k8s_jwks_verify checks
+         * iss and aud like the jwks backend): accept now, the confirm task
+         * asks the API server and kills the connection if it disagrees */
+        valid = 1;
+        optimistic = 1;
+        k8s_stats_inc(K8S_STAT_OPTIMISTIC);
+        K8S_LOG(K8S_LOG_DEBUG, "optimistic_accept", "user=\"%s\"", info->user_name);
+    } else if (reuse && cache_ttl > 0 && k8s_token_cache_lookup(token, cache_ttl, &cached)) {
+        /* Reviewed recently (possibly before a restart): skip the API server */
+        memset(&token_info, 0, sizeof(token_info));
+        token_info.authenticated = 1;
+        token_info.reviewed = 1;
+        memcpy(token_info.namespace, cached.namespace, sizeof(cached.namespace));
+        memcpy(token_info.service_account, cached.service_account,
+               sizeof(cached.service_account));
+        memcpy(token_info.uid, cached.uid, sizeof(cached.uid));
+        token_info.validated_at = cached.validated_at;
+        valid = 1;
+        from_cache = 1;
+        k8s_stats_inc(K8S_STAT_CACHE_HITS);
+        K8S_LOG(K8S_LOG_DEBUG, "cache_hit", "user=\"%s\" age_s=%lld",
+                info->user_name, (long long)(time(NULL) - cached.validated_at));
+    } else if (offline) {
+        /* No network at all: the mounted keys are the only authority */
+        valid = k8s_issuers_verify(cluster, token, config.audience, &token_info);
+    } else if (remote) {
+        valid = k8s_validate_token(token, &token_info, &config);
+        trace->timing = token_info.timing;
+    } else {
+        if (reuse && cache_ttl > 0) {
+            k8s_stats_inc(K8S_STAT_CACHE_MISSES);
+        }
+
+        /* Validate token with the backend chain; groups, audience and pod
+         * checks need a TokenReview */
+        valid = k8s_backend_validate(token, &token_info, &config, strict, &backend);
+        trace->timing = token_info.timing;
+        local = backend && !backend->authoritative;
+    }
+
+    k8s_snapshot_release(snap);
+    k8s_cluster_release(&lease, token_info.reviewed);
+
+    if (!valid || !token_info.authenticated) {
+        k8s_free(token);
+        trace->outcome = token_info.reviewed && !token_info.authenticated ?
+            K8S_STAT_FAIL_REJECTED : K8S_STAT_FAIL_API_ERROR;
+        K8S_LOG(K8S_LOG_WARNING, "login_failed", "user=\"%s\" reason=%s",
+                info->user_name, outcome_label(trace->outcome));
+        return CR_ERROR;
+    }
+
+    /* Checked on cache hits too, so a revocation applies to cached tokens */
+    k8s_deny_t denied = k8s_denylist_check_identity(token_info.namespace,
+                                                    token_info.service_account,
+                                                    token_info.uid);
+    if (denied != K8S_DENY_NONE) {
+        if (optimistic) {
+            k8s_session_forget(thread_id);
+        }
+        k8s_free(token);
+        K8S_LOG(K8S_LOG_WARNING, "login_failed", "user=\"%s\" reason=denied match=%s",
+                info->user_name, denied == K8S_DENY_UID ? "uid" : "name");
+        trace->outcome = K8S_STAT_FAIL_DENIED;
+        return CR_ERROR;
+    }
+
+    /* Build expected username from MariaDB user: namespace/serviceaccount,
+     * after the cluster whose API server reviewed the token */
+    char expected_user[K8S_MAX_NAMESPACE_LEN + K8S_MAX_NAME_LEN + 2];
+    snprintf(expected_user, sizeof(expected_user), "%s/%s",
+             token_info.namespace, token_info.service_account);
+
+    /* Verify that the MariaDB username matches the ServiceAccount */
+    if (strcmp(identity, expected_user) != 0) {
+        if (optimistic) {
+            k8s_session_forget(thread_id);
+        }
+        k8s_free(token);
+        K8S_LOG(K8S_LOG_WARNING, "login_failed",
+                "user=\"%s\" reason=user_mismatch token_user=\"%s\"",
+                info->user_name, expected_user);
+        trace->outcome = K8S_STAT_FAIL_USER_MISMATCH;
+        return CR_ERROR;
+    }
+    trace->authenticated = 1;
+
+    if (!apply_policy(info, policy, cluster, identity,
+                      from_cache || optimistic ? NULL : &token_info)) {
+        if (optimistic) {
+            k8s_session_forget(thread_id);
+        }
+        k8s_free(token);
+        trace->outcome = K8S_STAT_FAIL_POLICY;
+        return CR_ERROR;
+    }
+
+    /* Asked after every other check, so refused logins cost no review */
+    k8s_stat_t authorized = authorize(info, policy, cluster, &token_info);
+    if (authorized != K8S_STAT_SUCCESSES) {
+        if (optimistic) {
+            k8s_session_forget(thread_id);
+        }
+        k8s_free(token);
+        trace->outcome = authorized;
+        return CR_ERROR;
+    }
+
+    /* A locally verified token has not been reviewed yet: no ticket for it,
+     * nor for one reviewed against the policy of this account only or by
+     * another cluster */
+    if (tickets && !send_ticket(vio, token,
+                                optimistic || local || !reuse ? NULL : &token_info,
+                                ticket_ttl)) {
+        if (optimistic) {
+            k8s_session_forget(thread_id);
+        }
+        k8s_free(token);
+        return CR_ERROR;
+    }
+
+    /* Only tokens that led to a login are cached, once the API server
+     * vouched for them without account-specific checks */
+    if (!from_cache && !optimistic && !local && reuse && cache_ttl > 0) {
+        k8s_token_cache_insert(token, &token_info, cache_ttl);
+    }
+
+    /* Remember the token so the connection can be revalidated while it lives */
+    if (revalidate && !optimistic) {
+        k8s_session_register(thread_id, token, &token_info, 1);
+    }
+    k8s_free(token);
+
+    if (offline) {
+        k8s_stats_inc(K8S_STAT_OFFLINE_LOGINS);
+    }
+    K8S_LOG(K8S_LOG_INFO, "login_succeeded", "user=\"%s\" cached=%d optimistic=%d",
+            info->user_name, from_cache, optimistic);
+    trace->outcome = K8S_STAT_SUCCESSES;
+    return CR_OK;
+
+#else
+    /* POC mode: Accept any non-empty token without validation */
+    (void)policy;
+    (void)remote;
+    if (tickets && !send_ticket(vio, token, NULL, 0)) {
+        k8s_free(token);
+        return CR_ERROR;
+    }
+    k8s_free(token);
+    K8S_LOG(K8S_LOG_WARNING, "validation_disabled", "user=\"%s\"", info->user_name);
+    trace->outcome = K8S_STAT_SUCCESSES;
+    return CR_OK;
+#endif
+}
+
+/*
+ * Run one login
+ *
+ * Counts the attempt and its outcome, records the login latency and logs
+ * the latency breakdown of logins slower than auth_k8s_slow_auth_threshold.
+ * A ticket login the client has no plugin for is not counted; the
+ * account's next authentication method handles it.
+ *
+ * @param vio - Communication channel with the client
+ * @param info - Server connection information
+ * @param tickets - Speak the session ticket exchange
+ * @return CR_OK on success, CR_ERROR on failure
+ */
+static int run_login(MYSQL_PLUGIN_VIO *vio, MYSQL_SERVER_AUTH_INFO *info, int tickets)
+{
+    uint64_t started = k8s_stats_now_usec();
+    login_trace_t trace;
+
+    memset(&trace, 0, sizeof(trace));
+    trace.outcome = K8S_STAT_FAIL_INTERNAL;
+
+    /* Compiled once per authentication string, not per login. Without its
+     * policy a login could end up in an account meant only for proxying */
+    k8s_policy_t *policy = k8s_policy_acquire(info->auth_string, info->auth_string_length);
+    int result = CR_ERROR;
+    if (policy && !k8s_policy_valid(policy)) {
+        K8S_LOG(K8S_LOG_WARNING, "login_failed", "user=\"%s\" reason=policy detail=invalid",
+                info->user_name);
+        trace.outcome = K8S_STAT_FAIL_POLICY;
+    } else if (policy || info->auth_string_length == 0) {
+        result = authenticate(vio, info, tickets, policy, &trace);
+    }
+    k8s_policy_release(policy);
+    k8s_psi_stage_end();
+    if (trace.outcome == K8S_STAT_COUNT) {
+        return result;
+    }
+    k8s_stats_inc(K8S_STAT_ATTEMPTS);
+    k8s_stats_inc(trace.outcome);
+
+    uint64_t elapsed = k8s_stats_now_usec() - started;
+    k8s_stats_record(K8S_HIST_LOGIN, elapsed);
+    /* Anyone can make up a user name; only proven ones get a row of their own */
+    k8s_identity_record(trace.authenticated ? info->user_name : NULL, result == CR_OK,
+                        elapsed);
+
+    if (trace.slow_auth_ms > 0 && elapsed >= (uint64_t)trace.slow_auth_ms * 1000) {
+        const k8s_request_timing_t *t = &trace.timing;
+        K8S_LOG(K8S_LOG_WARNING, "slow_login", "user=\"%s\" result=%s total_us=%llu "
+                "client_us=%llu queue_us=%llu dns_us=%llu connect_us=%llu tls_us=%llu "
+                "server_us=%llu transfer_us=%llu api_total_us=%llu parse_us=%llu",
+                info->user_name, outcome_label(trace.outcome),
+                (unsigned long long)elapsed, trace.client_us, t->queue_us, t->dns_us,
+                t->connect_us, t->tls_us, t->server_us, t->transfer_us, t->total_us,
+                t->parse_us);
+    }
+
+    return result;
+}
+
+/*
+ * Server authentication function
+ *
+ * This function is called when a client attempts to authenticate.
+ * The client sends its token as a clear text password.
+ *
+ * @param vio - Communication channel with the client
+ * @param info - Server connection information
+ * @return CR_OK on success, CR_ERROR on failure
+ */
+static int auth_k8s_server(MYSQL_PLUGIN_VIO *vio, MYSQL_SERVER_AUTH_INFO *info)
+{
+    return run_login(vio, info, 0);
+}
+
+/*
+ * Server authentication function for auth_k8s_client
+ *
+ * Like auth_k8s_server, but a client holding a session ticket logs in
+ * without a TokenReview.
+ *
+ * @param vio - Communication channel with the client
+ * @param info - Server connection information
+ * @return CR_OK on success, CR_ERROR on failure
+ */
+static int auth_k8s_ticket_server(MYSQL_PLUGIN_VIO *vio, MYSQL_SERVER_AUTH_INFO *info)
+{
+    return run_login(vio, info, 1);
+}
+
+/*
+ * Status variables
+ *
+ * Each SHOW_FUNC sums the statistics shards at SHOW time and returns a
+ * SHOW_ARRAY whose entries and values live in the server-provided buffer.
+ * Nested names are prefixed with the parent name, e.g. auth_k8s_attempts
+ * and auth_k8s_login_latency_p99_us.
+ */
+typedef struct {
+    SHOW_VAR vars[K8S_STAT_COUNT + 1];
+    unsigned long long values[K8S_STAT_COUNT];
+} counter_show_buf_t;
+
+typedef struct {
+    SHOW_VAR vars[6];
+    unsigned long long values[5];
+} histogram_show_buf_t;
+
+_Static_assert(sizeof(counter_show_buf_t) <= SHOW_VAR_FUNC_BUFF_SIZE,
+               "counter status variables exceed the SHOW_FUNC buffer");
+_Static_assert(sizeof(histogram_show_buf_t) <= SHOW_VAR_FUNC_BUFF_SIZE,
+               "histogram status variables exceed the SHOW_FUNC buffer");
+
+static int show_counters(MYSQL_THD thd, SHOW_VAR *var, void *buff,
+                         struct system_status_var *status, enum enum_var_type scope)
+{
+    counter_show_buf_t *buf = (counter_show_buf_t *)buff;
+    k8s_stats_totals_t totals;
+    (void)thd;
+    (void)status;
+    (void)scope;
+
+    k8s_stats_collect(&totals);
+    for (int i = 0; i < K8S_STAT_COUNT; i++) {
+        buf->values[i] = totals.counters[i];
+        buf->vars[i].name = k8s_stats_name((k8s_stat_t)i);
+        buf->vars[i].value = &buf->values[i];
+        buf->vars[i].type = SHOW_ULONGLONG;
+    }
+    memset(&buf->vars[K8S_STAT_COUNT], 0, sizeof(SHOW_VAR));
+
+    var->type = SHOW_ARRAY;
+    var->value = buf->vars;
+    return 0;
+}
+
+static int show_histogram(k8s_hist_t hist, SHOW_VAR *var, void *buff)
+{
+    static const char *names[] = { "count", "avg_us", "p50_us", "p95_us", "p99_us" };
+    histogram_show_buf_t *buf = (histogram_show_buf_t *)buff;
+    k8s_stats_totals_t totals;
+
+    k8s_stats_collect(&totals);
+    uint64_t count = totals.hist_count[hist];
+    buf->values[0] = count;
+    buf->values[1] = count ? totals.hist_sum[hist] / count : 0;
+    buf->values[2] = k8s_stats_percentile(&totals, hist, 50);
+    buf->values[3] = k8s_stats_percentile(&totals, hist, 95);
+    buf->values[4] = k8s_stats_percentile(&totals, hist, 99);
+
+    for (int i = 0; i < 5; i++) {
+        buf->vars[i].name = names[i];
+        buf->vars[i].value = &buf->values[i];
+        buf->vars[i].type = SHOW_ULONGLONG;
+    }
+    memset(&buf->vars[5], 0, sizeof(SHOW_VAR));
+
+    var->type = SHOW_ARRAY;
+    var->value = buf->vars;
+    return 0;
+}
+
+/* SHOW_FUNC wrapper reporting one histogram */
+#define HISTOGRAM_SHOW_FUNC(fn, hist) \
+    static int fn(MYSQL_THD thd, SHOW_VAR *var, void *buff, \
+                  struct system_status_var *status, enum enum_var_type scope) \
+    { \
+        (void)thd; \
+        (void)status; \
+        (void)scope; \
+        return show_histogram(hist, var, buff); \
+    }
+
+HISTOGRAM_SHOW_FUNC(show_login_latency, K8S_HIST_LOGIN)
+HISTOGRAM_SHOW_FUNC(show_api_latency, K8S_HIST_API)
+HISTOGRAM_SHOW_FUNC(show_queue_latency, K8S_HIST_QUEUE)
+HISTOGRAM_SHOW_FUNC(show_dns_latency, K8S_HIST_DNS)
+HISTOGRAM_SHOW_FUNC(show_connect_latency, K8S_HIST_CONNECT)
+HISTOGRAM_SHOW_FUNC(show_tls_latency, K8S_HIST_TLS)
+HISTOGRAM_SHOW_FUNC(show_server_latency, K8S_HIST_SERVER)
+HISTOGRAM_SHOW_FUNC(show_transfer_latency, K8S_HIST_TRANSFER)
+HISTOGRAM_SHOW_FUNC(show_parse_latency, K8S_HIST_PARSE)
+
+/*
+ * Per-identity statistics: one nested array per MariaDB user, reported as
+ * e.g. auth_k8s_identity_default/myapp_logins, for the
+ * auth_k8s_identity_status_limit most recently seen identities. SHOW STATUS
+ * is open to every user, so the limit also bounds what anyone can list.
+ * The entries don't fit into the SHOW_FUNC buffer and are allocated from
+ * the statement's memory.
+ */
+#define IDENTITY_FIELDS 8
+
+typedef struct {
+    SHOW_VAR vars[IDENTITY_FIELDS + 1];
+    unsigned long long values[IDENTITY_FIELDS];
+} identity_show_t;
+
+static void identity_show_fill(identity_show_t *e, const k8s_identity_row_t *row)
+{
+    static const char *names[IDENTITY_FIELDS] = {
+        "logins", "failures", "last_seen", "avg_us", "max_us", "p50_us", "p95_us", "p99_us"
+    };
+
+    e->values[0] = row->logins;
+    e->values[1] = row->failures;
+    e->values[2] = (unsigned long long)row->last_seen;
+    e->values[3] = row->logins ? row->latency_sum_us / row->logins : 0;
+    e->values[4] = row->latency_max_us;
+    e->values[5] = row->latency_p50_us;
+    e->values[6] = row->latency_p95_us;
+    e->values[7] = row->latency_p99_us;
+    for (int v = 0; v < IDENTITY_FIELDS; v++) {
+        e->vars[v].name = names[v];
+        e->vars[v].value = &e->values[v];
+        e->vars[v].type = SHOW_ULONGLONG;
+    }
+    memset(&e->vars[IDENTITY_FIELDS], 0, sizeof(SHOW_VAR));
+}
+
+static int show_identities(MYSQL_THD thd, SHOW_VAR *var, void *buff,
+                           struct system_status_var *status, enum enum_var_type scope)
+{
+    int limit = __atomic_load_n(&opt_identity_status_limit, __ATOMIC_RELAXED);
+    k8s_identity_row_t *rows = limit > 0 ?
+        k8s_malloc(K8S_MEM_STATUS, sizeof(k8s_identity_row_t) * (size_t)limit) : NULL;
+    int n = rows ? k8s_identity_collect(rows, limit) : 0;
+    SHOW_VAR *list = thd_alloc(thd, sizeof(SHOW_VAR) * (n + 1));
+    identity_show_t *entries = thd_alloc(thd, sizeof(identity_show_t) * (n + 1));
+    (void)status;
+    (void)scope;
+
+    if (!list || !entries) {
+        /* Report nothing rather than fail the whole SHOW STATUS */
+        list = (SHOW_VAR *)buff;
+        n = 0;
+    }
+
+    for (int i = 0; i < n; i++) {
+        identity_show_fill(&entries[i], &rows[i]);
+        list[i].name = thd_strmake(thd, rows[i].identity, strlen(rows[i].identity));
+        list[i].value = entries[i].vars;
+        list[i].type = SHOW_ARRAY;
+    }
+    memset(&list[n], 0, sizeof(SHOW_VAR));
+    k8s_free(rows);
+
+    var->type = SHOW_ARRAY;
+    var->value = list;
+    return 0;
+}
+
+/*
+ * Logins that proved no identity, such as rejected tokens or made-up user
+ * names, reported as auth_k8s_identities_unauthenticated_logins etc.
+ */
+static int show_identities_unauthenticated(MYSQL_THD thd, SHOW_VAR *var, void *buff,
+                                           struct system_status_var *status,
+                                           enum enum_var_type scope)
+{
+    identity_show_t *e = (identity_show_t *)buff;
+    k8s_identity_row_t row;
+    (void)thd;
+    (void)status;
+    (void)scope;
+
+    k8s_identity_unauthenticated(&row);
+    identity_show_fill(e, &row);
+    var->type = SHOW_ARRAY;
+    var->value = e->vars;
+    return 0;
+}
+
+_Static_assert(sizeof(identity_show_t) <= SHOW_VAR_FUNC_BUFF_SIZE,
+               "identity status variables exceed the SHOW_FUNC buffer");
+
+static int show_identities_evicted(MYSQL_THD thd, SHOW_VAR *var, void *buff,
+                                   struct system_status_var *status, enum enum_var_type scope)
+{
+    (void)thd;
+    (void)status;
+    (void)scope;
+    *(unsigned long long *)buff = k8s_identity_evictions();
+    var->type = SHOW_ULONGLONG;
+    var->value = buff;
+    return 0;
+}
+
+static int show_denylist_entries(MYSQL_THD thd, SHOW_VAR *var, void *buff,
+                                 struct system_status_var *status, enum enum_var_type scope)
+{
+    (void)thd;
+    (void)status;
+    (void)scope;
+    *(unsigned long long *)buff = (unsigned long long)k8s_denylist_count();
+    var->type = SHOW_ULONGLONG;
+    var->value = buff;
+    return 0;
+}
+
+static int show_issuer_keys(MYSQL_THD thd, SHOW_VAR *var, void *buff,
+                            struct system_status_var *status, enum enum_var_type scope)
+{
+    (void)thd;
+    (void)status;
+    (void)scope;
+    *(unsigned long long *)buff = (unsigned long long)k8s_issuers_count();
+    var->type = SHOW_ULONGLONG;
+    var->value = buff;
+    return 0;
+}
+
+static int show_sessions(MYSQL_THD thd, SHOW_VAR *var, void *buff,
+                         struct system_status_var *status, enum enum_var_type scope)
+{
+    (void)thd;
+    (void)status;
+    (void)scope;
+    *(unsigned long long *)buff = (unsigned long long)k8s_session_count();
+    var->type = SHOW_ULONGLONG;
+    var->value = buff;
+    return 0;
+}
+
+/*
+ * Per-backend statistics: one nested array per registered backend, e.g.
+ * auth_k8s_backend_tokenreview_unavailable
+ */
+typedef struct {
+    SHOW_VAR list[K8S_BACKEND_MAX + 1];
+    struct {
+        SHOW_VAR vars[7];
+        unsigned long long values[6];
+    } entries[K8S_BACKEND_MAX];
+} backend_show_buf_t;
+
+_Static_assert(sizeof(backend_show_buf_t) <= SHOW_VAR_FUNC_BUFF_SIZE,
+               "backend status variables exceed the SHOW_FUNC buffer");
+
+static int show_backends(MYSQL_THD thd, SHOW_VAR *var, void *buff,
+                         struct system_status_var *status, enum enum_var_type scope)
+{
+    static const char *names[] = {
+        "requests", "verdicts", "accepted", "unavailable", "avg_us", "healthy"
+    };
+    backend_show_buf_t *buf = (backend_show_buf_t *)buff;
+    int n = k8s_backend_count();
+    (void)thd;
+    (void)status;
+    (void)scope;
+
+    for (int i = 0; i < n; i++) {
+        const k8s_backend_t *backend = k8s_backend_get(i);
+        k8s_backend_stats_t stats;
+        memset(&stats, 0, sizeof(stats));
+        backend->stats(&stats);
+
+        unsigned long long *values = buf->entries[i].values;
+        values[0] = stats.requests;
+        values[1] = stats.verdicts;
+        values[2] = stats.accepted;
+        values[3] = stats.unavailable;
+        values[4] = stats.requests ? stats.time_us / stats.requests : 0;
+        values[5] = (unsigned long long)stats.healthy;
+        for (int v = 0; v < 6; v++) {
+            buf->entries[i].vars[v].name = names[v];
+            buf->entries[i].vars[v].value = &values[v];
+            buf->entries[i].vars[v].type = SHOW_ULONGLONG;
+        }
+        memset(&buf->entries[i].vars[6], 0, sizeof(SHOW_VAR));
+
+        buf->list[i].name = backend->name;
+        buf->list[i].value = buf->entries[i].vars;
+        buf->list[i].type = SHOW_ARRAY;
+    }
+    memset(&buf->list[n], 0, sizeof(SHOW_VAR));
+
+    var->type = SHOW_ARRAY;
+    var->value = buf->list;
+    return 0;
+}
+
+/*
+ * Per-cluster statistics: one nested array per remote cluster, e.g.
+ * auth_k8s_cluster_east_shed. Up to K8S_CLUSTER_MAX clusters don't fit into
+ * the SHOW_FUNC buffer, so the entries are allocated from the statement's
+ * memory, as for identities.
+ */
+typedef struct {
+    SHOW_VAR vars[7];
+    unsigned long long values[6];
+} cluster_show_t;
+
+static int show_clusters(MYSQL_THD thd, SHOW_VAR *var, void *buff,
+                         struct system_status_var *status, enum enum_var_type scope)
+{
+    static const char *names[] = {
+        "requests", "unavailable", "refused", "shed", "in_flight", "open"
+    };
+    k8s_cluster_row_t *rows = k8s_malloc(K8S_MEM_STATUS,
+                                        sizeof(k8s_cluster_row_t) * K8S_CLUSTER_MAX);
+    int n = rows ? k8s_cluster_collect(rows, K8S_CLUSTER_MAX) : 0;
+    SHOW_VAR *list = thd_alloc(thd, sizeof(SHOW_VAR) * (n + 1));
+    cluster_show_t *entries = thd_alloc(thd, sizeof(cluster_show_t) * (n + 1));
+    (void)status;
+    (void)scope;
+
+    if (!list || !entries) {
+        list = (SHOW_VAR *)buff;
+        n = 0;
+    }
+
+    for (int i = 0; i < n; i++) {
+        cluster_show_t *e = &entries[i];
+        e->values[0] = rows[i].requests;
+        e->values[1] = rows[i].unavailable;
+        e->values[2] = rows[i].refused;
+        e->values[3] = rows[i].shed;
+        e->values[4] = (unsigned long long)rows[i].in_flight;
+        e->values[5] = (unsigned long long)rows[i].open;
+        for (int v = 0; v < 6; v++) {
+            e->vars[v].name = names[v];
+            e->vars[v].value = &e->values[v];
+            e->vars[v].type = SHOW_ULONGLONG;
+        }
+        memset(&e->vars[6], 0, sizeof(SHOW_VAR));
+
+        list[i].name = thd_strmake(thd, rows[i].name, strlen(rows[i].name));
+        list[i].value = e->vars;
+        list[i].type = SHOW_ARRAY;
+    }
+    memset(&list[n], 0, sizeof(SHOW_VAR));
+    k8s_free(rows);
+
+    var->type = SHOW_ARRAY;
+    var->value = list;
+    return 0;
+}
+
+static SHOW_VAR auth_k8s_status_vars[] = {
+    {"auth_k8s", (char *)&show_counters, SHOW_FUNC},
+    {"auth_k8s_login_latency", (char *)&show_login_latency, SHOW_FUNC},
+    {"auth_k8s_api_latency", (char *)&show_api_latency, SHOW_FUNC},
+    {"auth_k8s_queue_latency", (char *)&show_queue_latency, SHOW_FUNC},
+    {"auth_k8s_dns_latency", (char *)&show_dns_latency, SHOW_FUNC},
+    {"auth_k8s_connect_latency", (char *)&show_connect_latency, SHOW_FUNC},
+    {"auth_k8s_tls_latency", (char *)&show_tls_latency, SHOW_FUNC},
+    {"auth_k8s_server_latency", (char *)&show_server_latency, SHOW_FUNC},
+    {"auth_k8s_transfer_latency", (char *)&show_transfer_latency, SHOW_FUNC},
+    {"auth_k8s_parse_latency", (char *)&show_parse_latency, SHOW_FUNC},
+    {"auth_k8s_identity", (char *)&show_identities, SHOW_FUNC},
+    {"auth_k8s_identities_evicted", (char *)&show_identities_evicted, SHOW_FUNC},
+    {"auth_k8s_identities_unauthenticated", (char *)&show_identities_unauthenticated, SHOW_FUNC},
+    {"auth_k8s_denylist_entries", (char *)&show_denylist_entries, SHOW_FUNC},
+    {"auth_k8s_issuer_keys", (char *)&show_issuer_keys, SHOW_FUNC},
+    {"auth_k8s_sessions", (char *)&show_sessions, SHOW_FUNC},
+    {"auth_k8s_backend", (char *)&show_backends, SHOW_FUNC},
+    {"auth_k8s_cluster", (char *)&show_clusters, SHOW_FUNC},
+    {NULL, NULL, SHOW_UNDEF}
+};
+
+/*
+ * Background task: keep idle pooled connections open
+ */
+static void keepalive_task(void *arg)
+{
+    (void)arg;
+    k8s_snapshot_t *snap = k8s_snapshot_acquire();
+    if (snap && snap->config.pool) {
+        k8s_http_pool_ping(snap->config.pool, snap->keepalive_interval);
+    }
+    k8s_snapshot_release(snap);
+}
+
+/*
+ * Background task: pick up the rotated API credential
+ */
+static void credential_task(void *arg)
+{
+    (void)arg;
+    k8s_snapshot_t *snap = k8s_snapshot_acquire();
+    if (snap && snap->config.pool) {
+        k8s_http_pool_refresh_credential(snap->config.pool);
+    }
+    k8s_snapshot_release(snap);
+}
+
+/*
+ * Background task: swap in a changed CA bundle
+ */
+static void ca_task(void *arg)
+{
+    (void)arg;
+    k8s_snapshot_t *snap = k8s_snapshot_acquire();
+    if (snap && snap->config.pool) {
+        k8s_http_pool_reload_ca(snap->config.pool);
+    }
+    k8s_snapshot_release(snap);
+}
+
+/*
+ * Background task: re-resolve the pinned API server address
+ */
+static void dns_task(void *arg)
+{
+    (void)arg;
+    k8s_snapshot_t *snap = k8s_snapshot_acquire();
+    if (snap && snap->config.pool) {
+        k8s_http_pool_resolve(snap->config.pool);
+    }
+    k8s_snapshot_release(snap);
+}
+
+/*
+ * Background task: apply settings changed by SET GLOBAL
+ */
+static void reconfigure_task(void *arg)
+{
+    (void)arg;
+    k8s_mutex_lock(&pending_lock);
+    k8s_snapshot_t *snap = pending_snapshot;
+    pending_snapshot = NULL;
+    k8s_mutex_unlock(&pending_lock);
+
+    if (snap) {
+        int timeout = snap->config.timeout_seconds;
+        int pool_size = snap->pool_size;
+        apply_snapshot(snap);
+        K8S_LOG(K8S_LOG_INFO, "config_updated", "timeout=%d pool_size=%d",
+                timeout, pool_size);
+    }
+}
+
+/*
+ * Background task: pick up a changed denylist file
+ */
+static void denylist_task(void *arg)
+{
+    (void)arg;
+    k8s_denylist_reload();
+}
+
+/*
+ * Background task: pick up a changed cluster registry and look after the
+ * remote clusters' pools, pinging them as keepalive_task does the local one
+ */
+static void clusters_task(void *arg)
+{
+    (void)arg;
+    k8s_cluster_reload();
+
+    k8s_snapshot_t *snap = k8s_snapshot_acquire();
+    int idle_seconds = snap ? snap->keepalive_interval : 0;
+    k8s_snapshot_release(snap);
+    k8s_cluster_maintain(idle_seconds);
+}
+
+/*
+ * Background task: pick up changed offline issuer keys
+ */
+static void issuers_task(void *arg)
+{
+    (void)arg;
+    k8s_issuers_reload();
+}
+
+/*
+ * How one revalidation round acts on revoked connections
+ */
+typedef struct {
+    int kill;                       /* auth_k8s_revalidate_kill was set */
+#ifdef MYSQL_SERVICE_SQL
+    MYSQL *mysql;                   /* Local connection, opened on first kill */
+#endif
+} revoke_context_t;
+
+/*
+ * Kill a connection whose token failed revalidation
+ *
+ * Killing goes through the server's SQL service (MariaDB 10.7 and later).
+ * The session registry has already logged and counted the revocation.
+ */
+static void revoke_session(unsigned long thread_id, const char *identity,
+                           const char *reason, void *arg)
+{
+    revoke_context_t *ctx = arg;
+    if (!ctx->kill) {
+        return;
+    }
+
+#ifdef MYSQL_SERVICE_SQL
+    if (!ctx->mysql) {
+        ctx->mysql = mysql_init(NULL);
+        if (ctx->mysql && !mysql_real_connect_local(ctx->mysql)) {
+            K8S_LOG(K8S_LOG_ERROR, "session_kill_failed", "reason=\"%s\"",
+                    mysql_error(ctx->mysql));
+            mysql_close(ctx->mysql);
+            ctx->mysql = NULL;
+        }
+        if (!ctx->mysql) {
+            ctx->kill = 0;
+            return;
+        }
+    }
+
+    char query[64];
+    snprintf(query, sizeof(query), "KILL CONNECTION %lu", thread_id);
+    if (mysql_real_query(ctx->mysql, query, strlen(query)) == 0) {
+        k8s_stats_inc(K8S_STAT_SESSIONS_KILLED);
+        K8S_LOG(K8S_LOG_WARNING, "session_killed", "user=\"%s\" thread_id=%lu reason=%s",
+                identity, thread_id, reason);
+    } else {
+        /* Most likely the connection closed in the meantime */
+        K8S_LOG(K8S_LOG_DEBUG, "session_kill_failed", "thread_id=%lu reason=\"%s\"",
+                thread_id, mysql_error(ctx->mysql));
+    }
+#else
+    (void)thread_id;
+    (void)identity;
+    (void)reason;
+    K8S_LOG(K8S_LOG_WARNING, "session_kill_unavailable", "reason=no_sql_service");
+    ctx->kill = 0;
+#endif
+}
+
+/*
+ * Background task: revalidate the tokens of live connections
+ */
+static void revalidate_task(void *arg)
+{
+    static int untracked_logged = 0;
+    (void)arg;
+
+    k8s_snapshot_t *snap = k8s_snapshot_acquire();
+    if (!snap || snap->revalidate_interval <= 0) {
+        k8s_snapshot_release(snap);
+        return;
+    }
+
+    if (!__atomic_load_n(&sessions_tracked, __ATOMIC_ACQUIRE)) {
+        if (!untracked_logged) {
+            K8S_LOG(K8S_LOG_WARNING, "revalidate_unavailable",
+                    "reason=audit_plugin_not_installed plugin=auth_k8s_sessions");
+            untracked_logged = 1;
+        }
+        k8s_snapshot_release(snap);
+        return;
+    }
+    untracked_logged = 0;
+
+    /* The pool size bounds the TokenReviews in flight, as it does for logins */
+    revoke_context_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.kill = snap->revalidate_kill;
+    k8s_session_revalidate(&snap->config, snap->revalidate_interval, snap->pool_size,
+                           revoke_session, &ctx);
+    k8s_snapshot_release(snap);
+
+#ifdef MYSQL_SERVICE_SQL
+    if (ctx.mysql) {
+        mysql_close(ctx.mysql);
+    }
+#endif
+}
+
+/*
+ * Background task: keep the signing keys fresh and confirm optimistic
+ * logins with TokenReview
+ *
+ * The keys are also kept for the jwks backend, without optimistic logins.
+ * A connection whose token the API server rejects, or does not answer for
+ * within auth_k8s_optimistic_window, is always killed: optimistic logins
+ * were only accepted on that condition.
+ */
+static void confirm_task(void *arg)
+{
+    static int untracked_logged = 0;
+    (void)arg;
+
+    k8s_snapshot_t *snap = k8s_snapshot_acquire();
+    if (!snap || !uses_keys(snap)) {
+        k8s_snapshot_release(snap);
+        return;
+    }
+
+    if (k8s_jwks_needs_refresh(JWKS_MAX_AGE)) {
+        refresh_keys(snap);
+    }
+    if (!snap->optimistic) {
+        k8s_snapshot_release(snap);
+        return;
+    }
+
+    if (!__atomic_load_n(&sessions_tracked, __ATOMIC_ACQUIRE)) {
+        if (!untracked_logged) {
+            K8S_LOG(K8S_LOG_WARNING, "optimistic_unavailable",
+                    "reason=audit_plugin_not_installed plugin=auth_k8s_sessions");
+            untracked_logged = 1;
+        }
+        k8s_snapshot_release(snap);
+        return;
+    }
+    untracked_logged = 0;
+
+    revoke_context_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.kill = 1;
+    k8s_session_confirm(&snap->config, snap->optimistic_window, snap->pool_size,
+                        revoke_session, &ctx);
+    k8s_snapshot_release(snap);
+
+#ifdef MYSQL_SERVICE_SQL
+    if (ctx.mysql) {
+        mysql_close(ctx.mysql);
+    }
+#endif
+}
+
+/*
+ * Background task: free configuration snapshots no login uses any more
+ */
+static void reclaim_task(void *arg)
+{
+    (void)arg;
+    k8s_snapshot_reclaim(SNAPSHOT_GRACE_SECONDS);
+}
+
+/*
+ * Remember the snapshot the watches now use and let go of the previous one
+ *
+ * Called with watch_lock held.
+ */
+static k8s_snapshot_t *swap_watch_snapshot(k8s_snapshot_t *snap)
+{
+    k8s_snapshot_t *previous = watch_snapshot;
+    watch_snapshot = snap;
+    return previous;
+}
+
+/*
+ * Start, restart or stop the ServiceAccount and Pod watches to match the
+ * system variables; with auth_k8s_authorize set, the RoleBindings are
+ * watched too
+ *
+ * The API server, credential and pool come from the current snapshot.
+ * Does nothing while they, the namespaces and the rule are unchanged, so it
+ * is cheap to call from every sysvar update.
+ */
+static void configure_watch(void)
+{
+#if ENABLE_TOKEN_VALIDATION
+    k8s_mutex_lock(&watch_lock);
+    k8s_snapshot_t *snap = k8s_snapshot_acquire();
+    if (snap) {
+        k8s_watch_config_t config = {
+            snap->config.api_server_url, snap->config.ca_cert_path, snap->config.token_path,
+            opt_watch_namespaces, opt_authorize && *opt_authorize, snap->config.pool
+        };
+        k8s_watch_configure(&config);
+    }
+    k8s_snapshot_t *previous = swap_watch_snapshot(snap);
+    k8s_mutex_unlock(&watch_lock);
+    k8s_snapshot_release(previous);
+#endif
+}
+
+/*
+ * Move running watches to the snapshot just published
+ *
+ * Runs on the housekeeping thread, which must not read the namespace and
+ * rule variables, so those stay as the watches have them.
+ */
+static void retarget_watch(void)
+{
+#if ENABLE_TOKEN_VALIDATION
+    k8s_mutex_lock(&watch_lock);
+    k8s_snapshot_t *snap = k8s_snapshot_acquire();
+    if (snap) {
+        k8s_watch_retarget(&snap->config);
+    }
+    k8s_snapshot_t *previous = swap_watch_snapshot(snap);
+    k8s_mutex_unlock(&watch_lock);
+    k8s_snapshot_release(previous);
+#endif
+}
+
+/*
+ * Queue the current system variables for publication
+ *
+ * Called from sysvar update callbacks. Building and warming a new pool can
+ * take a moment, and the server holds its global variables lock here, so the
+ * work is handed to the housekeeping thread. Logins keep using the previous
+ * snapshot until the new one is published.
+ */
+static void schedule_reconfigure(void)
+{
+#if ENABLE_TOKEN_VALIDATION
+    k8s_snapshot_t *snap = snapshot_from_options();
+    if (!snap) {
+        K8S_LOG(K8S_LOG_ERROR, "out_of_memory", "where=config action=change_not_applied");
+        return;
+    }
+
+    k8s_mutex_lock(&pending_lock);
+    k8s_snapshot_t *superseded = pending_snapshot;
+    pending_snapshot = snap;
+    k8s_mutex_unlock(&pending_lock);
+    k8s_snapshot_free(superseded);
+
+    if (!k8s_bg_run_now("reconfigure")) {
+        /* No housekeeping thread: apply in the caller */
+        reconfigure_task(NULL);
+    }
+#endif
+}
+
+/*
+ * Plugin initialization
+ *
+ * Sets up libcurl's global state (which is not thread-safe to do lazily),
+ * publishes the first configuration snapshot, loads the API credential and
+ * CA bundle, pins the API server address and opens the pooled connections,
+ * so that the first logins after a restart don't pay for DNS, TCP and TLS
+ * setup. Failing to reach the API server here is not fatal; failing to
+ * start the housekeeping thread is.
+ *
+ * @return 0 on success, 1 on failure
+ */
+static int auth_k8s_plugin_init(void *p)
+{
+    (void)p;
+
+    k8s_psi_register();
+
+    /* Without the drain thread log lines are written synchronously */
+    k8s_log_set_level(opt_log_level);
+    k8s_log_start();
+
+    if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+        K8S_LOG(K8S_LOG_ERROR, "init_failed", "reason=libcurl");
+        k8s_log_stop();
+        k8s_psi_unregister();
+        return 1;
+    }
+
+    /* A busy port only costs the metrics endpoint, not the plugin */
+    if (opt_metrics_port > 0) {
+        k8s_metrics_start(opt_metrics_port);
+    }
+
+#if ENABLE_TOKEN_VALIDATION
+    /* Tokens reviewed before a restart log in without a TokenReview */
+    if (opt_cache_file && *opt_cache_file) {
+        k8s_token_cache_open(opt_cache_file, opt_cache_key_file);
+    }
+
+    k8s_snapshot_t *snap = snapshot_from_options();
+    if (!snap) {
+        K8S_LOG(K8S_LOG_ERROR, "out_of_memory", "where=config");
+        k8s_token_cache_close();
+        k8s_metrics_stop();
+        curl_global_cleanup();
+        k8s_log_stop();
+        k8s_psi_unregister();
+        return 1;
+    }
+    int keepalive_interval = snap->keepalive_interval;
+    int dns_ttl = snap->dns_ttl;
+    int revalidate_interval = snap->revalidate_interval;
+    int keys = uses_keys(snap);
+    apply_snapshot(snap);
+
+    /* A rule that cannot be used refuses logins rather than skipping the check */
+    k8s_access_review_configure(opt_authorize, opt_authorize_ttl);
+    configure_watch();
+
+    /* Revocations apply from the first login on */
+    k8s_denylist_configure(opt_denylist_file);
+    k8s_denylist_reload();
+
+    /* Remote clusters' pools are warmed before their first logins */
+    k8s_cluster_configure(opt_cluster_file);
+    k8s_cluster_reload();
+    k8s_issuers_configure(opt_issuer_dir);
+    k8s_issuers_reload();
+    k8s_federated_configure(opt_federated_socket);
+
+    /* Tickets issued before a restart no longer verify */
+    k8s_ticket_init();
+
+    /* Optimistic logins and the jwks backend need the signing keys; failing
+     * here only means the first logins go through TokenReview */
+    if (keys) {
+        k8s_snapshot_t *cur = k8s_snapshot_acquire();
+        if (cur) {
+            refresh_keys(cur);
+        }
+        k8s_snapshot_release(cur);
+    }
+
+    /*
+     * Without the housekeeping thread credentials, CA bundles and addresses
+     * would never be refreshed and optimistic logins never confirmed, so
+     * the plugin does not load (k8s_bg_start logs why)
+     */
+    if (!k8s_bg_start()) {
+        auth_k8s_plugin_deinit(p);
+        return 1;
+    }
+    k8s_bg_add_task("credential", CREDENTIAL_REFRESH_INTERVAL, credential_task, NULL);
+    k8s_bg_add_task("ca", CA_RELOAD_INTERVAL, ca_task, NULL);
+    k8s_bg_add_task("keepalive", keepalive_interval, keepalive_task, NULL);
+    k8s_bg_add_task("dns", dns_ttl, dns_task, NULL);
+    k8s_bg_add_task("reconfigure", 0, reconfigure_task, NULL);
+    k8s_bg_add_task("metrics", 0, metrics_task, NULL);
+    k8s_bg_add_task("reclaim", SNAPSHOT_RECLAIM_INTERVAL, reclaim_task, NULL);
+    k8s_bg_add_task("denylist", DENYLIST_RELOAD_INTERVAL, denylist_task, NULL);
+    k8s_bg_add_task("clusters", CLUSTER_RELOAD_INTERVAL, clusters_task, NULL);
+    k8s_bg_add_task("issuers", ISSUER_RELOAD_INTERVAL, issuers_task, NULL);
+    k8s_bg_add_task("revalidate", revalidate_period(revalidate_interval),
+                    revalidate_task, NULL);
+    k8s_bg_add_task("confirm", keys ? CONFIRM_INTERVAL : 0, confirm_task, NULL);
+#endif
+
+    return 0;
+}
+
+/*
+ * Plugin deinitialization (server shutdown or UNINSTALL PLUGIN)
+ *
+ * Stops the watches, the housekeeping thread and the metrics listener before
+ * closing the pooled connections and the token cache file, and flushes the
+ * log last.
+ */
+static int auth_k8s_plugin_deinit(void *p)
+{
+    (void)p;
+
+    k8s_watch_stop();
+    k8s_bg_stop();
+    /* After the housekeeping thread, which restarts it on port changes */
+    k8s_metrics_stop();
+    /* And which takes a new watch snapshot when it publishes one */
+    k8s_mutex_lock(&watch_lock);
+    k8s_snapshot_release(swap_watch_snapshot(NULL));
+    k8s_mutex_unlock(&watch_lock);
+    k8s_session_clear();
+    k8s_jwks_clear();
+    k8s_ticket_shutdown();
+    k8s_policy_clear();
+    k8s_access_review_shutdown();
+    k8s_token_cache_close();
+    k8s_denylist_shutdown();
+    k8s_cluster_shutdown();
+    k8s_issuers_shutdown();
+    k8s_federated_shutdown();
+    k8s_snapshot_shutdown();
+
+    k8s_mutex_lock(&pending_lock);
+    k8s_snapshot_free(pending_snapshot);
+    pending_snapshot = NULL;
+    k8s_mutex_unlock(&pending_lock);
+
+    curl_global_cleanup();
+    k8s_log_stop();
+    k8s_psi_unregister();
+
+    return 0;
+}
+
+/*
+ * Plugin descriptor structure
+ */
+static struct st_mysql_auth auth_k8s_handler = {
+    MYSQL_AUTHENTICATION_INTERFACE_VERSION,
+    "mysql_clear_password",  /* Client plugin name - use built-in clear password plugin */
+    auth_k8s_server,         /* Server authentication function */
+    NULL,                    /* Generate auth string (not used) */
+    NULL                     /* Validate auth string (not used) */
+};
+
+static struct st_mysql_auth auth_k8s_ticket_handler = {
+    MYSQL_AUTHENTICATION_INTERFACE_VERSION,
+    "auth_k8s_client",       /* Client plugin name - companion plugin with session tickets */
+    auth_k8s_ticket_server,  /* Server authentication function */
+    NULL,                    /* Generate auth string (not used) */
+    NULL                     /* Validate auth string (not used) */
+};
+
+/*
+ * Connection tracking for session revalidation
+ *
+ * Authentication plugins are not told when a connection ends, so a small
+ * audit plugin in the same library reports disconnects and COM_CHANGE_USER
+ * to the session registry.
+ */
+static void sessions_notify(MYSQL_THD thd, unsigned int event_class, const void *event)
+{
+    (void)thd;
+    if (event_class != MYSQL_AUDIT_CONNECTION_CLASS) {
+        return;
+    }
+
+    const struct mysql_event_connection *conn = event;
+    switch (conn->event_subclass) {
+    case MYSQL_AUDIT_CONNECTION_DISCONNECT:
+        k8s_session_forget(conn->thread_id);
+        break;
+    case MYSQL_AUDIT_CONNECTION_CHANGE_USER:
+        k8s_session_user_changed(conn->thread_id, conn->user, conn->user_length);
+        break;
+    default:
+        break;
+    }
+}
+
+static int sessions_plugin_init(void *p)
+{
+    (void)p;
+    __atomic_store_n(&sessions_tracked, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * Without disconnect events tracked connections would never be forgotten
+ */
+static int sessions_plugin_deinit(void *p)
+{
+    (void)p;
+    __atomic_store_n(&sessions_tracked, 0, __ATOMIC_RELEASE);
+    k8s_session_clear();
+    return 0;
+}
+
+static struct st_mysql_audit auth_k8s_sessions_handler = {
+    MYSQL_AUDIT_INTERFACE_VERSION,
+    NULL,                    /* release_thd (not used) */
+    sessions_notify,         /* Event notification function */
+    { MYSQL_AUDIT_CONNECTION_CLASSMASK }
+};
+
+/*
+ * Plugin declaration
+ * Using mysql_declare_plugin for compatibility with MariaDB server loading
+ */
+mysql_declare_plugin(auth_k8s)
+{
+    MYSQL_AUTHENTICATION_PLUGIN,
+    &auth_k8s_handler,
+    "auth_k8s",
     "MariaDB K8s Auth Plugin Contributors",
     "Kubernetes ServiceAccount Authentication with TokenReview",
     PLUGIN_LICENSE_GPL,
-    NULL,                 /* Plugin init */
+    auth_k8s_plugin_init,   /* Plugin init */
+    auth_k8s_plugin_deinit, /* Plugin deinit */
+    PLUGIN_VERSION,
+    auth_k8s_status_vars, /* Status variables */
+    auth_k8s_sys_vars,    /* System variables */
+    NULL,                 /* Config options */
+    0                     /* Flags */
+},
+{
+    MYSQL_AUTHENTICATION_PLUGIN,
+    &auth_k8s_ticket_handler,
+    "auth_k8s_ticket",
+    "MariaDB K8s Auth Plugin Contributors",
+    "Kubernetes ServiceAccount Authentication with session tickets for auth_k8s_client",
+    PLUGIN_LICENSE_GPL,
+    NULL,                 /* Plugin init (shares auth_k8s's) */
     NULL,                 /* Plugin deinit */
     PLUGIN_VERSION,
     NULL,                 /* Status variables */
-    auth_k8s_sys_vars,    /* System variables */
+    NULL,                 /* System variables */
+    NULL,                 /* Config options */
+    0                     /* Flags */
+},
+{
+    MYSQL_AUDIT_PLUGIN,
+    &auth_k8s_sessions_handler,
+    "auth_k8s_sessions",
+    "MariaDB K8s Auth Plugin Contributors",
+    "Reports connection ends to auth_k8s for session revalidation",
+    PLUGIN_LICENSE_GPL,
+    sessions_plugin_init,   /* Plugin init */
+    sessions_plugin_deinit, /* Plugin deinit */
+    PLUGIN_VERSION,
+    NULL,                 /* Status variables */
+    NULL,                 /* System variables */
     NULL,                 /* Config options */
     0                     /* Flags */
 }
@@ -0,0 +1,213 @@
+/*
+ * MariaDB Kubernetes ServiceAccount Authentication Plugin - Client Side
+ *
+ * Companion of the auth_k8s_ticket server plugin. Sends the ServiceAccount
+ * token given as the password, like mysql_clear_password, and keeps the
+ * session ticket the server answers with, so that the next connection of
+ * this process to the same server and account presents the ticket and
+ * skips the TokenReview. A refused ticket costs one round trip: the token
+ * is sent instead.
+ */
+
+#include <mysql.h>
+#include <mysql/client_plugin.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include "ticket_protocol.h"
+
+/* Tickets kept per process; the one expiring first is replaced */
+#define TICKET_SLOTS 64
+
+/* Seconds before its expiry a ticket is no longer presented */
+#define TICKET_MARGIN 5
+
+#define KEY_LEN 32
+
+typedef struct {
+    unsigned char key[KEY_LEN];     /* SHA-256 of server, account and token */
+    time_t expires;                 /* 0: slot free */
+    size_t len;
+    char ticket[K8S_TICKET_MAX_LEN];
+} ticket_slot_t;
+
+static ticket_slot_t slots[TICKET_SLOTS];
+static pthread_mutex_t slots_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Key a ticket by everything it is only valid for
+ *
+ * The token is part of the key, so a rotated token never presents the
+ * ticket of its predecessor.
+ */
+static int ticket_key(MYSQL *mysql, const char *token, unsigned char *key)
+{
+    char port[16];
+    const char *parts[4];
+    unsigned int len = 0;
+    int ok;
+
+    snprintf(port, sizeof(port), "%u", mysql->port);
+    parts[0] = mysql->host ? mysql->host : "";
+    parts[1] = port;
+    parts[2] = mysql->user ? mysql->user : "";
+    parts[3] = token;
+
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    ok = ctx && EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) == 1;
+    for (int i = 0; ok && i < 4; i++) {
+        /* Include the terminator so the parts cannot run into each other */
+        ok = EVP_DigestUpdate(ctx, parts[i], strlen(parts[i]) + 1) == 1;
+    }
+    ok = ok && EVP_DigestFinal_ex(ctx, key, &len) == 1 && len == KEY_LEN;
+    EVP_MD_CTX_free(ctx);
+    return ok;
+}
+
+/* Copy an unexpired ticket for key into out; returns its length or 0 */
+static size_t find_ticket(const unsigned char *key, char *out)
+{
+    time_t now = time(NULL);
+    size_t len = 0;
+
+    pthread_mutex_lock(&slots_lock);
+    for (int i = 0; i < TICKET_SLOTS; i++) {
+        ticket_slot_t *s = &slots[i];
+        if (s->expires > now + TICKET_MARGIN && memcmp(s->key, key, KEY_LEN) == 0) {
+            memcpy(out, s->ticket, s->len);
+            len = s->len;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&slots_lock);
+    return len;
+}
+
+static void store_ticket(const unsigned char *key, const unsigned char *ticket, size_t len,
+                         unsigned int lifetime)
+{
+    ticket_slot_t *victim = NULL;
+
+    pthread_mutex_lock(&slots_lock);
+    for (int i = 0; i < TICKET_SLOTS; i++) {
+        ticket_slot_t *s = &slots[i];
+        if (s->expires && memcmp(s->key, key, KEY_LEN) == 0) {
+            victim = s;
+            break;
+        }
+        if (!victim || s->expires < victim->expires) {
+            victim = s;
+        }
+    }
+    memcpy(victim->key, key, KEY_LEN);
+    memcpy(victim->ticket, ticket, len);
+    victim->len = len;
+    victim->expires = time(NULL) + lifetime;
+    pthread_mutex_unlock(&slots_lock);
+}
+
+static void drop_ticket(const unsigned char *key)
+{
+    pthread_mutex_lock(&slots_lock);
+    for (int i = 0; i < TICKET_SLOTS; i++) {
+        if (slots[i].expires && memcmp(slots[i].key, key, KEY_LEN) == 0) {
+            OPENSSL_cleanse(&slots[i], sizeof(slots[i]));
+        }
+    }
+    pthread_mutex_unlock(&slots_lock);
+}
+
+/*
+ * Client authentication function
+ *
+ * Speaks the exchange of ticket_protocol.h: presents a stored ticket if
+ * there is one, otherwise (or once the server refused it) the token.
+ *
+ * @param vio - Communication channel with the server
+ * @param mysql - Connection; the password is the ServiceAccount token
+ * @return CR_OK on success, CR_ERROR on failure
+ */
+static int auth_k8s_client(MYSQL_PLUGIN_VIO *vio, MYSQL *mysql)
+{
+    unsigned char *packet;
+    unsigned char key[KEY_LEN];
+    unsigned char ticket[1 + K8S_TICKET_MAX_LEN];
+    const char *token = mysql->passwd ? mysql->passwd : "";
+    size_t token_len = strlen(token);
+    size_t ticket_len;
+    int packet_len;
+
+    /* The server opens the exchange */
+    packet_len = vio->read_packet(vio, &packet);
+    if (packet_len < 1 || packet[0] != K8S_TICKET_MSG_HELLO)
+    {
+        return CR_ERROR;
+    }
+
+    int keyed = ticket_key(mysql, token, key);
+    if (keyed && (ticket_len = find_ticket(key, (char *)ticket + 1)) > 0)
+    {
+        ticket[0] = K8S_TICKET_MSG_TICKET;
+        if (vio->write_packet(vio, ticket, (int)ticket_len + 1))
+        {
+            return CR_ERROR;
+        }
+        packet_len = vio->read_packet(vio, &packet);
+        if (packet_len == 1 && packet[0] == K8S_TICKET_MSG_ACCEPTED)
+        {
+            return CR_OK;
+        }
+        if (packet_len != 1 || packet[0] != K8S_TICKET_MSG_RETRY)
+        {
+            return CR_ERROR;
+        }
+        drop_ticket(key);
+    }
+
+    /* Send the token as mysql_clear_password would */
+    unsigned char *msg = malloc(token_len + 1);
+    if (!msg)
+    {
+        return CR_ERROR;
+    }
+    msg[0] = K8S_TICKET_MSG_TOKEN;
+    memcpy(msg + 1, token, token_len);
+    int failed = vio->write_packet(vio, msg, (int)token_len + 1);
+    OPENSSL_cleanse(msg, token_len + 1);
+    free(msg);
+    if (failed)
+    {
+        return CR_ERROR;
+    }
+
+    /* A rejected token ends the login with an error packet instead */
+    packet_len = vio->read_packet(vio, &packet);
+    if (packet_len < 1 || packet[0] != K8S_TICKET_MSG_ISSUED)
+    {
+        return CR_ERROR;
+    }
+    if (keyed && packet_len > 5 && packet_len - 5 <= K8S_TICKET_MAX_LEN)
+    {
+        unsigned int lifetime = ((unsigned int)packet[1] << 24) | ((unsigned int)packet[2] << 16) |
+                                ((unsigned int)packet[3] << 8) | packet[4];
+        store_ticket(key, packet + 5, (size_t)packet_len - 5, lifetime);
+    }
+    return CR_OK;
+}
+
+mysql_declare_client_plugin(AUTHENTICATION)
+    "auth_k8s_client",
+    "MariaDB K8s Auth Plugin Contributors",
+    "Kubernetes ServiceAccount token authentication with session tickets",
+    {1, 0, 0},
+    "GPL",
+    NULL,                    /* MySQL API (not used) */
+    NULL,                    /* Init */
+    NULL,                    /* Deinit */
+    NULL,                    /* Options */
+    auth_k8s_client          /* Client authentication function */
+mysql_end_client_plugin;
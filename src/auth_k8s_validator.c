@@ -0,0 +1,225 @@
+/*
+ * MariaDB Kubernetes ServiceAccount Authentication - Node Validator Daemon
+ *
+ * Runs the validator of validator.h on a Unix socket that the MariaDB
+ * servers of a node reach through their federated backend
+ * (auth_k8s_federated_socket). TokenReviews, API server connections and
+ * signing key fetches of the node then grow with the distinct tokens
+ * presented, not with the number of servers presenting them.
+ *
+ * Usage: auth_k8s_validator [options], see --help. Serves until SIGINT or
+ * SIGTERM.
+ */
+
+#include "validator.h"
+#include "background.h"
+#include "http_pool.h"
+#include "jwks.h"
+#include "log.h"
+#include <curl/curl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_SOCKET "/run/auth-k8s/validator.sock"
+
+/* Interval in seconds at which the cached API credential is re-read */
+#define CREDENTIAL_REFRESH_INTERVAL 60
+
+/* Interval in seconds at which the CA bundle is checked for changes */
+#define CA_RELOAD_INTERVAL 30
+
+/* Interval in seconds at which the signing keys' age is checked */
+#define JWKS_CHECK_INTERVAL 10
+
+/* Seconds after which the API server's signing keys are fetched again */
+#define JWKS_MAX_AGE 300
+
+/* Interval in seconds at which the counters are logged */
+#define STATS_INTERVAL 60
+
+static k8s_validator_options_t options;
+static int keepalive_interval = 30;
+
+static void keepalive_task(void *arg) {
+    (void)arg;
+    k8s_http_pool_ping(options.config.pool, keepalive_interval);
+}
+
+static void credential_task(void *arg) {
+    (void)arg;
+    k8s_http_pool_refresh_credential(options.config.pool);
+}
+
+static void ca_task(void *arg) {
+    (void)arg;
+    k8s_http_pool_reload_ca(options.config.pool);
+}
+
+static void jwks_task(void *arg) {
+    (void)arg;
+    if (k8s_jwks_needs_refresh(JWKS_MAX_AGE)) {
+        k8s_jwks_refresh(&options.config);
+    }
+}
+
+static void stats_task(void *arg) {
+    (void)arg;
+    k8s_validator_stats_t stats;
+
+    k8s_validator_stats(&stats);
+    K8S_LOG(K8S_LOG_INFO, "validator_stats", "clients=%d requests=%llu cache_hits=%llu "
+            "coalesced=%llu forged=%llu reviews=%llu unavailable=%llu", stats.clients,
+            stats.requests, stats.cache_hits, stats.coalesced, stats.forged, stats.reviews,
+            stats.unavailable);
+}
+
+static void usage(FILE *out, const char *name) {
+    fprintf(out,
+            "usage: %s [options]\n"
+            "  --socket PATH       socket to listen on (default: " DEFAULT_SOCKET ")\n"
+            "  --mode OCTAL        permissions of the socket (default: 0660)\n"
+            "  --api-url URL       API server (default: https://kubernetes.default.svc)\n"
+            "  --ca-path PATH      CA bundle of the API server\n"
+            "  --token-path PATH   credential for TokenReviews\n"
+            "  --timeout SECONDS   TokenReview timeout (default: 10)\n"
+            "  --pool-size N       warm API server connections (default: 8)\n"
+            "  --keepalive SECONDS idle connection ping interval, 0 disables (default: 30)\n"
+            "  --workers N         TokenReviews in flight at once (default: 16)\n"
+            "  --cache-ttl SECONDS valid tokens answered from the cache, 0 disables\n"
+            "                      (default: 60)\n"
+            "  --cache-size N      cached tokens (default: 4096)\n"
+            "  --no-screen         do not reject forged tokens with the signing keys\n"
+            "  --log-level N       0=error 1=warning 2=info 3=debug (default: 2)\n",
+            name);
+}
+
+/* Integer option in [min, max]; exits on anything else */
+static int int_arg(const char *name, const char *value, int base, int min, int max) {
+    char *end;
+    errno = 0;
+    long v = strtol(value, &end, base);
+    if (errno || end == value || *end || v < min || v > max) {
+        fprintf(stderr, "invalid --%s: %s\n", name, value);
+        exit(2);
+    }
+    return (int)v;
+}
+
+int main(int argc, char **argv) {
+    static const struct option longopts[] = {
+        { "socket", required_argument, NULL, 's' },
+        { "mode", required_argument, NULL, 'm' },
+        { "api-url", required_argument, NULL, 'u' },
+        { "ca-path", required_argument, NULL, 'c' },
+        { "token-path", required_argument, NULL, 't' },
+        { "timeout", required_argument, NULL, 'T' },
+        { "pool-size", required_argument, NULL, 'p' },
+        { "keepalive", required_argument, NULL, 'k' },
+        { "workers", required_argument, NULL, 'w' },
+        { "cache-ttl", required_argument, NULL, 'C' },
+        { "cache-size", required_argument, NULL, 'S' },
+        { "no-screen", no_argument, NULL, 'n' },
+        { "log-level", required_argument, NULL, 'l' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int pool_size = 8;
+    int log_level = K8S_LOG_INFO;
+    int opt;
+
+    k8s_config_init_default(&options.config);
+    options.socket_path = DEFAULT_SOCKET;
+    options.socket_mode = 0660;
+    options.workers = 16;
+    options.cache_ttl = 60;
+    options.cache_size = 4096;
+    options.screen = 1;
+
+    while ((opt = getopt_long(argc, argv, "h", longopts, NULL)) != -1) {
+        switch (opt) {
+        case 's': options.socket_path = optarg; break;
+        case 'm': options.socket_mode = int_arg("mode", optarg, 8, 0, 0777); break;
+        case 'u': options.config.api_server_url = optarg; break;
+        case 'c': options.config.ca_cert_path = optarg; break;
+        case 't': options.config.token_path = optarg; break;
+        case 'T': options.config.timeout_seconds = int_arg("timeout", optarg, 10, 1, 300); break;
+        case 'p': pool_size = int_arg("pool-size", optarg, 10, 1, K8S_HTTP_POOL_MAX_SIZE); break;
+        case 'k': keepalive_interval = int_arg("keepalive", optarg, 10, 0, 3600); break;
+        case 'w':
+            options.workers = int_arg("workers", optarg, 10, 1, K8S_VALIDATOR_MAX_WORKERS);
+            break;
+        case 'C': options.cache_ttl = int_arg("cache-ttl", optarg, 10, 0, 3600); break;
+        case 'S': options.cache_size = int_arg("cache-size", optarg, 10, 0, 1 << 20); break;
+        case 'n': options.screen = 0; break;
+        case 'l': log_level = int_arg("log-level", optarg, 10, 0, 3); break;
+        case 'h': usage(stdout, argv[0]); return 0;
+        default: usage(stderr, argv[0]); return 2;
+        }
+    }
+    if (optind < argc) {
+        usage(stderr, argv[0]);
+        return 2;
+    }
+
+    /* Signals are taken by sigwait; every thread started below inherits the mask */
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    k8s_log_set_level(log_level);
+    k8s_log_start();
+    if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+        K8S_LOG(K8S_LOG_ERROR, "init_failed", "reason=libcurl");
+        k8s_log_stop();
+        return 1;
+    }
+    options.config.pool = k8s_http_pool_create(&options.config, pool_size);
+    if (!options.config.pool) {
+        K8S_LOG(K8S_LOG_ERROR, "out_of_memory", "where=pool");
+        curl_global_cleanup();
+        k8s_log_stop();
+        return 1;
+    }
+
+    /* Without keys no token is screened; TokenReview still decides */
+    if (options.screen) {
+        k8s_jwks_refresh(&options.config);
+    }
+
+    /* A credential that is never refreshed expires under the workers */
+    if (!k8s_bg_start()) {
+        k8s_jwks_clear();
+        k8s_http_pool_destroy(options.config.pool);
+        curl_global_cleanup();
+        k8s_log_stop();
+        return 1;
+    }
+    k8s_bg_add_task("credential", CREDENTIAL_REFRESH_INTERVAL, credential_task, NULL);
+    k8s_bg_add_task("ca", CA_RELOAD_INTERVAL, ca_task, NULL);
+    k8s_bg_add_task("keepalive", keepalive_interval, keepalive_task, NULL);
+    k8s_bg_add_task("jwks", options.screen ? JWKS_CHECK_INTERVAL : 0, jwks_task, NULL);
+    k8s_bg_add_task("stats", STATS_INTERVAL, stats_task, NULL);
+
+    int status = 1;
+    if (k8s_validator_start(&options)) {
+        int sig;
+        sigwait(&signals, &sig);
+        K8S_LOG(K8S_LOG_INFO, "validator_signal", "signal=%d", sig);
+        k8s_validator_stop();
+        status = 0;
+    }
+
+    k8s_bg_stop();
+    k8s_jwks_clear();
+    k8s_http_pool_destroy(options.config.pool);
+    curl_global_cleanup();
+    k8s_log_stop();
+    return status;
+}
@@ -0,0 +1,403 @@
+/*
+ * Validation Backends Implementation
+ */
+
+#include "backend.h"
+#include "jwks.h"
+#include "federated.h"
+#include "stats.h"
+#include "log.h"
+#include "instrumentation.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Highest per-backend timeout, as for auth_k8s_timeout */
+#define TIMEOUT_MAX 300
+
+typedef struct {
+    uint64_t requests;
+    uint64_t verdicts;
+    uint64_t accepted;
+    uint64_t unavailable;
+    uint64_t time_us;
+    int failures;                   /* Consecutive calls without a verdict */
+    time_t retry_at;                /* Passed over until then once failing */
+} counters_t;
+
+static void record(counters_t *c, const k8s_token_info_t *infos, int count, uint64_t started) {
+    uint64_t verdicts = 0;
+    uint64_t accepted = 0;
+
+    for (int i = 0; i < count; i++) {
+        verdicts += infos[i].reviewed != 0;
+        accepted += infos[i].reviewed && infos[i].authenticated;
+    }
+    __atomic_add_fetch(&c->requests, (uint64_t)count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&c->verdicts, verdicts, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&c->accepted, accepted, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&c->unavailable, (uint64_t)count - verdicts, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&c->time_us, k8s_stats_now_usec() - started, __ATOMIC_RELAXED);
+
+    if (verdicts > 0) {
+        __atomic_store_n(&c->failures, 0, __ATOMIC_RELAXED);
+    } else if (count > 0 &&
+               __atomic_add_fetch(&c->failures, 1, __ATOMIC_RELAXED) >= K8S_BACKEND_FAILURES) {
+        __atomic_store_n(&c->retry_at, time(NULL) + K8S_BACKEND_RETRY_SECONDS,
+                         __ATOMIC_RELAXED);
+    }
+}
+
+/* Not failing, or failing for long enough to be tried again */
+static int responsive(const counters_t *c) {
+    return __atomic_load_n(&c->failures, __ATOMIC_RELAXED) < K8S_BACKEND_FAILURES ||
+           __atomic_load_n(&c->retry_at, __ATOMIC_RELAXED) <= time(NULL);
+}
+
+static void report(const counters_t *c, k8s_backend_stats_t *out) {
+    out->requests = __atomic_load_n(&c->requests, __ATOMIC_RELAXED);
+    out->verdicts = __atomic_load_n(&c->verdicts, __ATOMIC_RELAXED);
+    out->accepted = __atomic_load_n(&c->accepted, __ATOMIC_RELAXED);
+    out->unavailable = __atomic_load_n(&c->unavailable, __ATOMIC_RELAXED);
+    out->time_us = __atomic_load_n(&c->time_us, __ATOMIC_RELAXED);
+}
+
+/*
+ * TokenReview: the API server decides
+ */
+static counters_t tokenreview_counters;
+
+static int tokenreview_validate(const char *token, k8s_token_info_t *info,
+                                const k8s_config_t *config) {
+    uint64_t started = k8s_stats_now_usec();
+    int valid = k8s_validate_token(token, info, config);
+    record(&tokenreview_counters, info, 1, started);
+    return valid;
+}
+
+static int tokenreview_validate_batch(const char *const *tokens, int count,
+                                      k8s_token_info_t *infos, const k8s_config_t *config,
+                                      int concurrency) {
+    uint64_t started = k8s_stats_now_usec();
+    int verdicts = k8s_validate_tokens(tokens, count, infos, config, concurrency);
+    record(&tokenreview_counters, infos, count, started);
+    return verdicts;
+}
+
+static int tokenreview_health(void) {
+    return responsive(&tokenreview_counters);
+}
+
+static void tokenreview_stats(k8s_backend_stats_t *out) {
+    report(&tokenreview_counters, out);
+    out->healthy = tokenreview_health();
+}
+
+static const k8s_backend_t tokenreview_backend = {
+    "tokenreview", 1,
+    tokenreview_validate, tokenreview_validate_batch, tokenreview_health, tokenreview_stats
+};
+
+/*
+ * JWKS: the token's signature is checked against the cluster's signing
+ * keys. A token that does not verify gets no verdict, so that a later
+ * backend decides about legacy tokens and keys not fetched yet.
+ */
+static counters_t jwks_counters;
+
+static int jwks_validate(const char *token, k8s_token_info_t *info,
+                         const k8s_config_t *config) {
+    uint64_t started = k8s_stats_now_usec();
+    (void)config;
+
+    memset(info, 0, sizeof(*info));
+    int valid = k8s_jwks_verify(token, info);
+    info->reviewed = valid;
+    record(&jwks_counters, info, 1, started);
+    return valid;
+}
+
+static int jwks_validate_batch(const char *const *tokens, int count, k8s_token_info_t *infos,
+                               const k8s_config_t *config, int concurrency) {
+    int verdicts = 0;
+    (void)concurrency;
+
+    for (int i = 0; i < count; i++) {
+        if (tokens[i]) {
+            verdicts += jwks_validate(tokens[i], &infos[i], config);
+        }
+    }
+    return verdicts;
+}
+
+static int jwks_health(void) {
+    return k8s_jwks_count() > 0;
+}
+
+static void jwks_stats(k8s_backend_stats_t *out) {
+    report(&jwks_counters, out);
+    out->healthy = jwks_health();
+}
+
+static const k8s_backend_t jwks_backend = {
+    "jwks", 0,
+    jwks_validate, jwks_validate_batch, jwks_health, jwks_stats
+};
+
+/*
+ * Federated: a validator on the same node, such as kube-federated-auth,
+ * asked over a Unix socket. It reviews tokens with the API server, so its
+ * verdicts are authoritative.
+ */
+static counters_t federated_counters;
+
+static int federated_validate(const char *token, k8s_token_info_t *info,
+                              const k8s_config_t *config) {
+    uint64_t started = k8s_stats_now_usec();
+    int valid = k8s_federated_validate(NULL, token, config->audience, info,
+                                       config->timeout_seconds * 1000);
+    record(&federated_counters, info, 1, started);
+    return valid;
+}
+
+static int federated_validate_batch(const char *const *tokens, int count,
+                                    k8s_token_info_t *infos, const k8s_config_t *config,
+                                    int concurrency) {
+    uint64_t started = k8s_stats_now_usec();
+    int verdicts = k8s_federated_validate_batch(tokens, count, config->audience, infos,
+                                                config->timeout_seconds * 1000, concurrency);
+    record(&federated_counters, infos, count, started);
+    return verdicts;
+}
+
+static int federated_health(void) {
+    return k8s_federated_ready() && responsive(&federated_counters);
+}
+
+static void federated_stats(k8s_backend_stats_t *out) {
+    report(&federated_counters, out);
+    out->healthy = federated_health();
+}
+
+static const k8s_backend_t federated_backend = {
+    "federated", 1,
+    federated_validate, federated_validate_batch, federated_health, federated_stats
+};
+
+static const k8s_backend_t *const registry[] = {
+    &tokenreview_backend,
+    &jwks_backend,
+    &federated_backend,
+};
+
+#define REGISTERED ((int)(sizeof(registry) / sizeof(registry[0])))
+
+_Static_assert(REGISTERED <= K8S_BACKEND_MAX, "more backends than K8S_BACKEND_MAX");
+
+/* Used when no chain is configured */
+static const k8s_backend_chain_t default_chain = {
+    1, { { &tokenreview_backend, 0 } }
+};
+
+int k8s_backend_count(void) {
+    return REGISTERED;
+}
+
+const k8s_backend_t *k8s_backend_get(int index) {
+    return index >= 0 && index < REGISTERED ? registry[index] : NULL;
+}
+
+static const k8s_backend_t *lookup(const char *name, size_t len) {
+    for (int i = 0; i < REGISTERED; i++) {
+        if (strlen(registry[i]->name) == len && memcmp(registry[i]->name, name, len) == 0) {
+            return registry[i];
+        }
+    }
+    return NULL;
+}
+
+int k8s_backend_chain_parse(const char *spec, k8s_backend_chain_t *chain) {
+    k8s_backend_chain_t parsed;
+
+    memset(&parsed, 0, sizeof(parsed));
+    if (!spec || strlen(spec) > K8S_BACKEND_SPEC_MAX) {
+        return 0;
+    }
+
+    const char *p = spec;
+    for (;;) {
+        p += strspn(p, " ");
+        size_t len = strcspn(p, " ,:");
+        const k8s_backend_t *backend = lookup(p, len);
+        if (!backend || parsed.count == K8S_BACKEND_MAX) {
+            return 0;
+        }
+        for (int i = 0; i < parsed.count; i++) {
+            if (parsed.entries[i].backend == backend) {
+                return 0;
+            }
+        }
+        p += len;
+
+        int timeout = 0;
+        if (*p == ':') {
+            p++;
+            size_t digits = strspn(p, "0123456789");
+            if (digits == 0 || digits > 3) {
+                return 0;
+            }
+            timeout = atoi(p);
+            if (timeout < 1 || timeout > TIMEOUT_MAX) {
+                return 0;
+            }
+            p += digits;
+        }
+        parsed.entries[parsed.count].backend = backend;
+        parsed.entries[parsed.count].timeout = timeout;
+        parsed.count++;
+
+        p += strspn(p, " ");
+        if (*p == '\0') {
+            break;
+        }
+        if (*p++ != ',') {
+            return 0;
+        }
+    }
+
+    if (chain) {
+        *chain = parsed;
+    }
+    return 1;
+}
+
+static const k8s_backend_chain_t *chain_of(const k8s_config_t *config) {
+    return config->backends && config->backends->count > 0 ? config->backends : &default_chain;
+}
+
+int k8s_backend_chain_find(const k8s_backend_chain_t *chain, const char *name, int *timeout) {
+    if (!chain || chain->count == 0) {
+        chain = &default_chain;
+    }
+    for (int i = 0; i < chain->count; i++) {
+        if (strcmp(chain->entries[i].backend->name, name) == 0) {
+            if (timeout) {
+                *timeout = chain->entries[i].timeout;
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* The configuration a chain entry is called with */
+static k8s_config_t entry_config(const k8s_config_t *config, int timeout) {
+    k8s_config_t own = *config;
+    if (timeout > 0) {
+        own.timeout_seconds = timeout;
+    }
+    return own;
+}
+
+int k8s_backend_validate(const char *token, k8s_token_info_t *info, const k8s_config_t *config,
+                         int authoritative, const k8s_backend_t **backend) {
+    const k8s_backend_chain_t *chain = chain_of(config);
+    int eligible[K8S_BACKEND_MAX];
+    int n = 0;
+
+    memset(info, 0, sizeof(*info));
+    if (backend) {
+        *backend = NULL;
+    }
+    for (int i = 0; i < chain->count; i++) {
+        if (!authoritative || chain->entries[i].backend->authoritative) {
+            eligible[n++] = i;
+        }
+    }
+
+    for (int k = 0; k < n; k++) {
+        const k8s_backend_t *b = chain->entries[eligible[k]].backend;
+        int last = k == n - 1;
+
+        /* The last backend left is asked regardless */
+        if (!last && !b->health()) {
+            K8S_LOG(K8S_LOG_DEBUG, "backend_skipped", "backend=%s", b->name);
+            continue;
+        }
+
+        k8s_config_t own = entry_config(config, chain->entries[eligible[k]].timeout);
+        int valid = b->validate(token, info, &own);
+        if (info->reviewed) {
+            if (backend) {
+                *backend = b;
+            }
+            return valid;
+        }
+        if (!last) {
+            K8S_LOG(K8S_LOG_DEBUG, "backend_fallback", "backend=%s", b->name);
+        }
+    }
+    return 0;
+}
+
+int k8s_backend_validate_batch(const char *const *tokens, int count, k8s_token_info_t *infos,
+                               const k8s_config_t *config, int concurrency) {
+    const k8s_backend_chain_t *chain = chain_of(config);
+    const char **pending = NULL;
+    k8s_token_info_t *results = NULL;
+    int *index = NULL;
+    int asked = 0;
+    int verdicts = 0;
+
+    if (count <= 0) {
+        return 0;
+    }
+    memset(infos, 0, (size_t)count * sizeof(k8s_token_info_t));
+    for (int i = 0; i < chain->count; i++) {
+        const k8s_backend_t *b = chain->entries[i].backend;
+        if (!b->authoritative) {
+            continue;
+        }
+        k8s_config_t own = entry_config(config, chain->entries[i].timeout);
+
+        if (!asked) {
+            verdicts = b->validate_batch(tokens, count, infos, &own, concurrency);
+            asked = 1;
+            continue;
+        }
+
+        /* Only the tokens the previous backends had no verdict for */
+        if (!pending) {
+            pending = k8s_calloc(K8S_MEM_BACKEND, count, sizeof(char *));
+            results = k8s_calloc(K8S_MEM_BACKEND, count, sizeof(k8s_token_info_t));
+            index = k8s_calloc(K8S_MEM_BACKEND, count, sizeof(int));
+            if (!pending || !results || !index) {
+                K8S_LOG(K8S_LOG_ERROR, "out_of_memory", "where=backend_batch");
+                break;
+            }
+        }
+        int m = 0;
+        for (int t = 0; t < count; t++) {
+            if (tokens[t] && !infos[t].reviewed) {
+                index[m] = t;
+                pending[m++] = tokens[t];
+            }
+        }
+        if (m == 0) {
+            break;
+        }
+        K8S_LOG(K8S_LOG_DEBUG, "backend_fallback", "backend=%s tokens=%d", b->name, m);
+        verdicts += b->validate_batch(pending, m, results, &own, concurrency);
+        for (int r = 0; r < m; r++) {
+            if (results[r].reviewed) {
+                infos[index[r]] = results[r];
+            }
+        }
+    }
+
+    k8s_free(pending);
+    k8s_free(results);
+    k8s_free(index);
+    return verdicts;
+}
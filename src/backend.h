@@ -0,0 +1,160 @@
+/*
+ * Validation Backends
+ *
+ * A backend decides whether a token is valid and whose it is. Each one is
+ * a table of operations (validate, validate_batch, health, stats), and
+ * logins go through an ordered chain of them set by auth_k8s_backends, e.g.
+ * "jwks, tokenreview:3": the first backend that returns a verdict decides,
+ * the next one is only asked when a backend has no answer (API server
+ * unreachable, signing key unknown). A rejection is final.
+ *
+ * Built in are "tokenreview", the API server's TokenReview, "jwks", the
+ * local signature check of jwks.h, and "federated", a validator on the same
+ * node asked as in federated.h. Only TokenReview and the validator, which
+ * reviews with the API server, are authoritative: they know about deleted
+ * ServiceAccounts and pods, audiences and groups.
+ * Policies that depend on those, and the background revalidation of live
+ * sessions, only use the authoritative backends of the chain.
+ */
+
+#ifndef K8S_BACKEND_H
+#define K8S_BACKEND_H
+
+#include "tokenreview_api.h"
+
+/* Most backends registered, and so in a chain */
+#define K8S_BACKEND_MAX 4
+
+/* Longest chain, as in auth_k8s_backends */
+#define K8S_BACKEND_SPEC_MAX 256
+
+/* Consecutive calls without a verdict after which a backend that has a
+ * fallback is passed over */
+#define K8S_BACKEND_FAILURES 3
+
+/* Seconds a failing backend is passed over before it is tried again */
+#define K8S_BACKEND_RETRY_SECONDS 5
+
+/* Counters of one backend since the plugin was loaded */
+typedef struct {
+    unsigned long long requests;     /* Tokens it was asked about */
+    unsigned long long verdicts;     /* ... it returned a verdict for */
+    unsigned long long accepted;     /* ... it found valid */
+    unsigned long long unavailable;  /* ... it had no answer for */
+    unsigned long long time_us;      /* Time spent in it */
+    int healthy;                     /* Current health() result */
+} k8s_backend_stats_t;
+
+typedef struct k8s_backend {
+    const char *name;
+    int authoritative;               /* Verdicts account for revocation */
+
+    /**
+     * Validate one token
+     *
+     * @param token Token as sent by the client
+     * @param info Result; reviewed is 1 if the backend returned a verdict
+     * @param config Configuration, with this backend's timeout
+     * @return 1 if the token is valid, 0 otherwise
+     */
+    int (*validate)(const char *token, k8s_token_info_t *info, const k8s_config_t *config);
+
+    /**
+     * Validate several tokens at once, for background work
+     *
+     * @return Number of tokens a verdict was returned for
+     */
+    int (*validate_batch)(const char *const *tokens, int count, k8s_token_info_t *infos,
+                          const k8s_config_t *config, int concurrency);
+
+    /**
+     * Whether the backend is worth asking now; must not block
+     *
+     * @return 1 if usable, 0 if it would certainly have no answer
+     */
+    int (*health)(void);
+
+    /**
+     * Report the backend's counters
+     *
+     * @param out Filled with the counters and current health
+     */
+    void (*stats)(k8s_backend_stats_t *out);
+} k8s_backend_t;
+
+typedef struct k8s_backend_chain {
+    int count;                       /* 0: TokenReview alone */
+    struct {
+        const k8s_backend_t *backend;
+        int timeout;                 /* Seconds, 0 for auth_k8s_timeout */
+    } entries[K8S_BACKEND_MAX];
+} k8s_backend_chain_t;
+
+/**
+ * Parse a chain
+ *
+ * The chain is a comma-separated list of backend names, each optionally
+ * followed by ":<seconds>", its timeout in place of auth_k8s_timeout
+ * (1-300). A backend may appear once.
+ *
+ * @param spec Chain, e.g. "jwks, tokenreview:3"
+ * @param chain Parsed chain, may be NULL to only check the syntax
+ * @return 1 if the chain is well-formed, 0 otherwise
+ */
+int k8s_backend_chain_parse(const char *spec, k8s_backend_chain_t *chain);
+
+/**
+ * Look up a backend in a chain
+ *
+ * @param chain Chain, NULL or empty for TokenReview alone
+ * @param name Backend name
+ * @param timeout Set to the backend's timeout (0 if it has none), may be NULL
+ * @return 1 if the chain uses the backend, 0 otherwise
+ */
+int k8s_backend_chain_find(const k8s_backend_chain_t *chain, const char *name, int *timeout);
+
+/**
+ * Validate a token with the chain of config->backends
+ *
+ * Backends are asked in order until one returns a verdict. One that is
+ * unhealthy, or failed K8S_BACKEND_FAILURES times in a row, is passed over
+ * unless it is the last one left.
+ *
+ * @param token Token as sent by the client
+ * @param info Result of the backend that decided, or of the last one asked
+ * @param config Configuration for K8s API access and the chain
+ * @param authoritative Only ask authoritative backends
+ * @param backend Set to the backend that returned the verdict, or NULL;
+ *                may be NULL
+ * @return 1 if the token is valid, 0 otherwise
+ */
+int k8s_backend_validate(const char *token, k8s_token_info_t *info, const k8s_config_t *config,
+                         int authoritative, const k8s_backend_t **backend);
+
+/**
+ * Validate several tokens with the authoritative backends of the chain
+ *
+ * Tokens a backend has no verdict for are handed to the next one.
+ *
+ * @param tokens Tokens to validate (NULL entries are skipped)
+ * @param count Number of tokens
+ * @param infos Output, one entry per token
+ * @param config Configuration for K8s API access and the chain
+ * @param concurrency Most requests in flight at once
+ * @return Number of tokens a verdict was returned for
+ */
+int k8s_backend_validate_batch(const char *const *tokens, int count, k8s_token_info_t *infos,
+                               const k8s_config_t *config, int concurrency);
+
+/**
+ * @return Number of registered backends
+ */
+int k8s_backend_count(void);
+
+/**
+ * @param index Registration index, 0 to k8s_backend_count() - 1
+ * @return The backend
+ */
+const k8s_backend_t *k8s_backend_get(int index);
+
+#endif /* K8S_BACKEND_H */
@@ -0,0 +1,200 @@
+/*
+ * Background Housekeeping Thread Implementation
+ */
+
+#include "background.h"
+#include "log.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+typedef struct {
+    const char *name;
+    int interval_seconds;
+    k8s_bg_task_fn fn;
+    void *arg;
+    time_t next_run;
+    int run_now;            /* Requested by k8s_bg_run_now() */
+} bg_task_t;
+
+static pthread_mutex_t bg_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bg_cond;
+static pthread_t bg_thread;
+static int bg_running = 0;
+static int bg_stopping = 0;
+static int bg_kicked = 0;   /* Task table changed while the thread was busy */
+static bg_task_t bg_tasks[K8S_BG_MAX_TASKS];
+static int bg_task_count = 0;
+
+/**
+ * Thread main loop: run every due task, then sleep until the next one is due
+ * or until k8s_bg_stop() signals the condition variable.
+ */
+static void *bg_main(void *unused) {
+    (void)unused;
+
+    pthread_mutex_lock(&bg_lock);
+    while (!bg_stopping) {
+        time_t now = time(NULL);
+        bg_kicked = 0;
+        time_t next_wakeup = now + 60;
+
+        for (int i = 0; i < bg_task_count && !bg_stopping; i++) {
+            bg_task_t *task = &bg_tasks[i];
+            if (task->interval_seconds == 0 && !task->run_now) {
+                continue;  /* Paused */
+            }
+            if (task->next_run <= now || task->run_now) {
+                task->run_now = 0;
+                task->next_run = now + task->interval_seconds;
+
+                /* Run without the lock so tasks may register further tasks */
+                k8s_bg_task_fn fn = task->fn;
+                void *arg = task->arg;
+                pthread_mutex_unlock(&bg_lock);
+                fn(arg);
+                pthread_mutex_lock(&bg_lock);
+                now = time(NULL);
+            }
+            if (task->interval_seconds > 0 && task->next_run < next_wakeup) {
+                next_wakeup = task->next_run;
+            }
+        }
+
+        if (bg_stopping || bg_kicked || next_wakeup <= now) {
+            continue;
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += next_wakeup - now;
+        pthread_cond_timedwait(&bg_cond, &bg_lock, &deadline);
+    }
+    pthread_mutex_unlock(&bg_lock);
+
+    return NULL;
+}
+
+int k8s_bg_start(void) {
+    pthread_condattr_t attr;
+
+    pthread_mutex_lock(&bg_lock);
+    if (bg_running) {
+        pthread_mutex_unlock(&bg_lock);
+        return 1;
+    }
+
+    /* Monotonic clock so that wall-clock jumps don't stall the thread */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&bg_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    bg_stopping = 0;
+    if (pthread_create(&bg_thread, NULL, bg_main, NULL) != 0) {
+        K8S_LOG(K8S_LOG_ERROR, "init_failed", "reason=background_thread");
+        pthread_cond_destroy(&bg_cond);
+        pthread_mutex_unlock(&bg_lock);
+        return 0;
+    }
+    bg_running = 1;
+    pthread_mutex_unlock(&bg_lock);
+
+    return 1;
+}
+
+void k8s_bg_stop(void) {
+    pthread_mutex_lock(&bg_lock);
+    if (!bg_running) {
+        bg_task_count = 0;
+        pthread_mutex_unlock(&bg_lock);
+        return;
+    }
+    bg_stopping = 1;
+    pthread_cond_signal(&bg_cond);
+    pthread_mutex_unlock(&bg_lock);
+
+    pthread_join(bg_thread, NULL);
+
+    pthread_mutex_lock(&bg_lock);
+    pthread_cond_destroy(&bg_cond);
+    bg_running = 0;
+    bg_task_count = 0;
+    memset(bg_tasks, 0, sizeof(bg_tasks));
+    pthread_mutex_unlock(&bg_lock);
+}
+
+static bg_task_t *find_task(const char *name) {
+    for (int i = 0; i < bg_task_count; i++) {
+        if (strcmp(bg_tasks[i].name, name) == 0) {
+            return &bg_tasks[i];
+        }
+    }
+    return NULL;
+}
+
+int k8s_bg_add_task(const char *name, int interval_seconds, k8s_bg_task_fn fn, void *arg) {
+    if (!name || !fn || interval_seconds < 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&bg_lock);
+    if (bg_task_count >= K8S_BG_MAX_TASKS) {
+        pthread_mutex_unlock(&bg_lock);
+        K8S_LOG(K8S_LOG_ERROR, "task_rejected", "task=%s reason=too_many_tasks", name);
+        return 0;
+    }
+
+    bg_task_t *task = &bg_tasks[bg_task_count++];
+    task->name = name;
+    task->interval_seconds = interval_seconds;
+    task->fn = fn;
+    task->arg = arg;
+    task->next_run = time(NULL) + interval_seconds;
+
+    if (bg_running) {
+        bg_kicked = 1;
+        pthread_cond_signal(&bg_cond);
+    }
+    pthread_mutex_unlock(&bg_lock);
+
+    return 1;
+}
+
+int k8s_bg_set_interval(const char *name, int interval_seconds) {
+    if (!name || interval_seconds < 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&bg_lock);
+    bg_task_t *task = find_task(name);
+    if (task && task->interval_seconds != interval_seconds) {
+        task->interval_seconds = interval_seconds;
+        task->next_run = time(NULL) + interval_seconds;
+        if (bg_running) {
+            bg_kicked = 1;
+            pthread_cond_signal(&bg_cond);
+        }
+    }
+    pthread_mutex_unlock(&bg_lock);
+
+    return task != NULL;
+}
+
+int k8s_bg_run_now(const char *name) {
+    if (!name) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&bg_lock);
+    bg_task_t *task = bg_running ? find_task(name) : NULL;
+    if (task) {
+        task->run_now = 1;
+        bg_kicked = 1;
+        pthread_cond_signal(&bg_cond);
+    }
+    pthread_mutex_unlock(&bg_lock);
+
+    return task != NULL;
+}
@@ -0,0 +1,72 @@
+/*
+ * Background Housekeeping Thread
+ *
+ * A single plugin-owned thread that runs periodic maintenance tasks
+ * (connection keepalive, credential refresh, ...) off the login hot path.
+ */
+
+#ifndef K8S_BACKGROUND_H
+#define K8S_BACKGROUND_H
+
+/* Maximum number of periodic tasks that can be registered */
+#define K8S_BG_MAX_TASKS 16
+
+/**
+ * Periodic task callback
+ *
+ * @param arg Opaque argument given at registration
+ */
+typedef void (*k8s_bg_task_fn)(void *arg);
+
+/**
+ * Start the housekeeping thread
+ *
+ * @return 1 on success, 0 on failure
+ */
+int k8s_bg_start(void);
+
+/**
+ * Stop the housekeeping thread and forget all registered tasks
+ *
+ * Blocks until a task that is currently running has returned.
+ */
+void k8s_bg_stop(void);
+
+/**
+ * Register a periodic task
+ *
+ * The task first runs interval_seconds after registration and then every
+ * interval_seconds. Tasks run sequentially on the same thread.
+ *
+ * @param name Task name used in log messages and lookups (must outlive the task)
+ * @param interval_seconds Interval between runs (0 registers the task paused)
+ * @param fn Task callback
+ * @param arg Argument passed to fn
+ * @return 1 on success, 0 if the task table is full or arguments are invalid
+ */
+int k8s_bg_add_task(const char *name, int interval_seconds, k8s_bg_task_fn fn, void *arg);
+
+/**
+ * Change the interval of a registered task
+ *
+ * The next run is rescheduled interval_seconds from now.
+ *
+ * @param name Task name given at registration
+ * @param interval_seconds New interval (0 pauses the task)
+ * @return 1 on success, 0 if no such task is registered
+ */
+int k8s_bg_set_interval(const char *name, int interval_seconds);
+
+/**
+ * Run a registered task as soon as the thread is free
+ *
+ * Works for paused tasks too. A running task's next regular run follows
+ * one interval after this one.
+ *
+ * @param name Task name given at registration
+ * @return 1 if the run was scheduled, 0 if the thread is not running or
+ *         no such task is registered
+ */
+int k8s_bg_run_now(const char *name);
+
+#endif /* K8S_BACKGROUND_H */
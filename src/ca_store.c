@@ -0,0 +1,165 @@
+/*
+ * Shared In-Memory CA Trust Store Implementation
+ */
+
+#include "ca_store.h"
+#include "log.h"
+#include "instrumentation.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <openssl/pem.h>
+#include <openssl/err.h>
+
+struct k8s_ca_store {
+    char *ca_path;
+    k8s_mutex_t lock;       /* Protects store and count during a swap */
+    X509_STORE *store;      /* Current certificates, shared by reference */
+    int count;
+    struct stat loaded;     /* File identity at the last successful load */
+};
+
+/**
+ * Parse every certificate in a PEM bundle into a fresh X509_STORE
+ */
+static X509_STORE *load_bundle(const char *path, int *count) {
+    BIO *bio = BIO_new_file(path, "r");
+    if (!bio) {
+        ERR_clear_error();
+        return NULL;
+    }
+
+    X509_STORE *store = X509_STORE_new();
+    X509 *cert;
+    int n = 0;
+
+    while (store && (cert = PEM_read_bio_X509(bio, NULL, NULL, NULL)) != NULL) {
+        if (X509_STORE_add_cert(store, cert) == 1) {
+            n++;
+        }
+        X509_free(cert);
+    }
+    /* PEM_read_bio_X509 ends with a "no start line" error at EOF */
+    ERR_clear_error();
+    BIO_free(bio);
+
+    if (n == 0) {
+        X509_STORE_free(store);
+        return NULL;
+    }
+
+    *count = n;
+    return store;
+}
+
+static int same_file(const struct stat *a, const struct stat *b) {
+    return a->st_ino == b->st_ino && a->st_dev == b->st_dev && a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+/**
+ * libcurl callback run for each new SSL_CTX: install a reference to the
+ * current shared store instead of the certificates libcurl would load
+ */
+static CURLcode ssl_ctx_callback(CURL *curl, void *ssl_ctx, void *userptr) {
+    (void)curl;
+    k8s_ca_store_t *ca = (k8s_ca_store_t *)userptr;
+
+    k8s_mutex_lock(&ca->lock);
+    X509_STORE *store = ca->store;
+    X509_STORE_up_ref(store);
+    k8s_mutex_unlock(&ca->lock);
+
+    /* The SSL_CTX takes over our reference */
+    SSL_CTX_set_cert_store((SSL_CTX *)ssl_ctx, store);
+
+    return CURLE_OK;
+}
+
+k8s_ca_store_t *k8s_ca_store_create(const char *ca_path) {
+    struct stat st;
+    int count = 0;
+
+    if (!ca_path || stat(ca_path, &st) != 0) {
+        return NULL;
+    }
+
+    X509_STORE *store = load_bundle(ca_path, &count);
+    if (!store) {
+        return NULL;
+    }
+
+    k8s_ca_store_t *ca = k8s_calloc(K8S_MEM_CA_STORE, 1, sizeof(k8s_ca_store_t));
+    if (!ca || !(ca->ca_path = strdup(ca_path))) {
+        k8s_free(ca);
+        X509_STORE_free(store);
+        return NULL;
+    }
+
+    k8s_mutex_init(&ca->lock, K8S_MUTEX_CA_STORE);
+    ca->store = store;
+    ca->count = count;
+    ca->loaded = st;
+
+    return ca;
+}
+
+void k8s_ca_store_destroy(k8s_ca_store_t *ca) {
+    if (!ca) {
+        return;
+    }
+    X509_STORE_free(ca->store);
+    k8s_mutex_destroy(&ca->lock);
+    free(ca->ca_path);
+    k8s_free(ca);
+}
+
+int k8s_ca_store_reload(k8s_ca_store_t *ca) {
+    struct stat st;
+    int count = 0;
+
+    if (stat(ca->ca_path, &st) != 0 || same_file(&st, &ca->loaded)) {
+        return 0;
+    }
+
+    X509_STORE *store = load_bundle(ca->ca_path, &count);
+    if (!store) {
+        K8S_LOG(K8S_LOG_WARNING, "ca_reload_failed",
+                "path=\"%s\" reason=no_certificate action=keep_previous", ca->ca_path);
+        return 0;
+    }
+
+    k8s_mutex_lock(&ca->lock);
+    X509_STORE *old = ca->store;
+    ca->store = store;
+    ca->count = count;
+    ca->loaded = st;
+    k8s_mutex_unlock(&ca->lock);
+
+    /* Drops only our reference; live SSL_CTXs keep theirs */
+    X509_STORE_free(old);
+
+    K8S_LOG(K8S_LOG_INFO, "ca_reloaded", "path=\"%s\" certificates=%d", ca->ca_path, count);
+    return 1;
+}
+
+int k8s_ca_store_count(k8s_ca_store_t *ca) {
+    k8s_mutex_lock(&ca->lock);
+    int count = ca->count;
+    k8s_mutex_unlock(&ca->lock);
+    return count;
+}
+
+int k8s_ca_store_apply(CURL *curl, k8s_ca_store_t *ca) {
+    if (curl_easy_setopt(curl, CURLOPT_SSL_CTX_FUNCTION, ssl_ctx_callback) != CURLE_OK) {
+        return 0;
+    }
+    curl_easy_setopt(curl, CURLOPT_SSL_CTX_DATA, ca);
+    curl_easy_setopt(curl, CURLOPT_CAINFO, NULL);
+    curl_easy_setopt(curl, CURLOPT_CAPATH, NULL);
+    return 1;
+}
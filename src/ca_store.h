@@ -0,0 +1,66 @@
+/*
+ * Shared In-Memory CA Trust Store
+ *
+ * Parses the API server CA bundle once into an OpenSSL X509_STORE that every
+ * new TLS connection reuses through CURLOPT_SSL_CTX_FUNCTION, instead of
+ * libcurl reading and decoding the PEM file for each handshake. The store is
+ * replaced atomically when the file changes on disk.
+ */
+
+#ifndef K8S_CA_STORE_H
+#define K8S_CA_STORE_H
+
+#include <curl/curl.h>
+
+typedef struct k8s_ca_store k8s_ca_store_t;
+
+/**
+ * Load a PEM CA bundle into a new shared store
+ *
+ * @param ca_path Path to the PEM bundle
+ * @return New store, or NULL if the file holds no usable certificate
+ */
+k8s_ca_store_t *k8s_ca_store_create(const char *ca_path);
+
+/**
+ * Free the store
+ *
+ * Connections that already took a reference keep their certificates.
+ *
+ * @param store Store to free (NULL is ignored)
+ */
+void k8s_ca_store_destroy(k8s_ca_store_t *store);
+
+/**
+ * Re-parse the bundle if the file changed since the last load
+ *
+ * A change is detected by inode, size or modification time, which also
+ * covers the kubelet's atomic symlink swap of mounted secrets. An
+ * unreadable or empty file keeps the current certificates.
+ *
+ * @param store Store to refresh
+ * @return 1 if new certificates were installed, 0 otherwise
+ */
+int k8s_ca_store_reload(k8s_ca_store_t *store);
+
+/**
+ * Number of certificates in the current store
+ *
+ * @param store Store to inspect
+ * @return Certificate count
+ */
+int k8s_ca_store_count(k8s_ca_store_t *store);
+
+/**
+ * Configure a handle to verify peers against the shared store
+ *
+ * Clears CURLOPT_CAINFO/CURLOPT_CAPATH so libcurl does no CA file I/O.
+ *
+ * @param curl Handle to configure
+ * @param store Shared store
+ * @return 1 on success, 0 if the TLS backend does not support
+ *         CURLOPT_SSL_CTX_FUNCTION (the caller should fall back to CAINFO)
+ */
+int k8s_ca_store_apply(CURL *curl, k8s_ca_store_t *store);
+
+#endif /* K8S_CA_STORE_H */
@@ -0,0 +1,576 @@
+/*
+ * Cluster Registry Implementation
+ */
+
+#include "cluster.h"
+#include "http_pool.h"
+#include "log.h"
+#include "instrumentation.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/* Fields of a registry line: name, URL, CA, token and three options */
+#define MAX_FIELDS 7
+
+/* Highest max_inflight */
+#define INFLIGHT_MAX 1024
+
+typedef struct k8s_cluster {
+    char name[K8S_CLUSTER_NAME_MAX + 1];
+    char *api_url;                  /* One allocation holding all three strings */
+    char *ca_path;
+    char *token_path;
+    int timeout;
+    int pool_size;
+    int max_inflight;
+    k8s_http_pool_t *pool;          /* NULL: one-shot handles */
+    int refs;                       /* Registries listing it; under registry_lock */
+    time_t refreshed_at;            /* Credential, CA and address last refreshed */
+    int in_flight;
+    int failures;                   /* Consecutive leases without an answer */
+    time_t retry_at;                /* Logins fail at once until then once failing */
+    uint64_t requests;
+    uint64_t unavailable;
+    uint64_t refused;
+    uint64_t shed;
+} cluster_t;
+
+/* One immutable version of the registry file */
+typedef struct k8s_cluster_registry {
+    cluster_t *clusters[K8S_CLUSTER_MAX];
+    int count;
+    int users;                      /* Leases and reports currently holding it */
+    time_t retired_at;
+    struct k8s_cluster_registry *next_retired;
+} registry_t;
+
+static registry_t *current = NULL;
+
+/* Path, load state and retirement; never taken on the login path */
+static k8s_mutex_t registry_lock = K8S_MUTEX_INITIALIZER(K8S_MUTEX_CLUSTER);
+static char *registry_path = NULL;
+static struct stat loaded;          /* File identity at the last load attempt */
+static int have_loaded = 0;
+static int warned = 0;              /* A load failure was logged since the last success */
+static registry_t *retired_head = NULL;
+static registry_t *retired_tail = NULL;
+
+int k8s_cluster_name_valid(const char *name, size_t len) {
+    static const char allowed[] = "abcdefghijklmnopqrstuvwxyz0123456789-";
+
+    if (!name || len == 0 || len > K8S_CLUSTER_NAME_MAX) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (!name[i] || !strchr(allowed, name[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int k8s_cluster_split_user(const char *user, char *cluster, const char **identity) {
+    const char *first = strchr(user, '/');
+    const char *second = first ? strchr(first + 1, '/') : NULL;
+
+    if (!second || strchr(second + 1, '/')) {
+        snprintf(cluster, K8S_CLUSTER_NAME_MAX + 1, "%s", K8S_CLUSTER_LOCAL);
+        *identity = user;
+        return 1;
+    }
+
+    size_t len = (size_t)(first - user);
+    *identity = first + 1;
+    if (!k8s_cluster_name_valid(user, len)) {
+        cluster[0] = '\0';
+        return 0;
+    }
+    memcpy(cluster, user, len);
+    cluster[len] = '\0';
+    return 1;
+}
+
+static int same_file(const struct stat *a, const struct stat *b) {
+    return a->st_ino == b->st_ino && a->st_dev == b->st_dev && a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static int same_settings(const cluster_t *a, const cluster_t *b) {
+    return strcmp(a->name, b->name) == 0 && strcmp(a->api_url, b->api_url) == 0 &&
+           strcmp(a->ca_path, b->ca_path) == 0 && strcmp(a->token_path, b->token_path) == 0 &&
+           a->timeout == b->timeout && a->pool_size == b->pool_size &&
+           a->max_inflight == b->max_inflight;
+}
+
+/* Not failing, or failing for long enough to be tried again */
+static int responsive(const cluster_t *c) {
+    return __atomic_load_n(&c->failures, __ATOMIC_RELAXED) < K8S_CLUSTER_FAILURES ||
+           __atomic_load_n(&c->retry_at, __ATOMIC_RELAXED) <= time(NULL);
+}
+
+static void config_of(const cluster_t *c, k8s_config_t *config) {
+    k8s_config_init_default(config);
+    config->api_server_url = c->api_url;
+    config->ca_cert_path = c->ca_path;
+    config->token_path = c->token_path;
+    config->timeout_seconds = c->timeout;
+    config->pool = c->pool;
+}
+
+/*
+ * Copy a parsed line into a new cluster and open its pool
+ *
+ * Runs on the housekeeping thread: warming the pool may take up to
+ * K8S_HTTP_PING_TIMEOUT.
+ */
+static cluster_t *create_cluster(const cluster_t *spec) {
+    size_t url_len = strlen(spec->api_url) + 1;
+    size_t ca_len = strlen(spec->ca_path) + 1;
+    size_t token_len = strlen(spec->token_path) + 1;
+    cluster_t *c = k8s_calloc(K8S_MEM_CLUSTER, 1, sizeof(cluster_t));
+    char *strings = k8s_malloc(K8S_MEM_CLUSTER, url_len + ca_len + token_len);
+
+    if (!c || !strings) {
+        k8s_free(c);
+        k8s_free(strings);
+        return NULL;
+    }
+    *c = *spec;
+    c->api_url = memcpy(strings, spec->api_url, url_len);
+    c->ca_path = memcpy(strings + url_len, spec->ca_path, ca_len);
+    c->token_path = memcpy(strings + url_len + ca_len, spec->token_path, token_len);
+
+    k8s_config_t config;
+    config_of(c, &config);
+    c->pool = k8s_http_pool_create(&config, c->pool_size);
+    if (!c->pool) {
+        K8S_LOG(K8S_LOG_WARNING, "pool_unavailable", "cluster=%s fallback=one_shot", c->name);
+    } else {
+        k8s_http_pool_resolve(c->pool);
+        int live = k8s_http_pool_ping(c->pool, 0);
+        K8S_LOG(K8S_LOG_INFO, "pool_opened", "cluster=%s url=\"%s\" live=%d size=%d",
+                c->name, c->api_url, live, c->pool_size);
+    }
+    c->refreshed_at = time(NULL);
+    return c;
+}
+
+/* Caller holds registry_lock */
+static void drop_cluster(cluster_t *c) {
+    if (--c->refs == 0) {
+        k8s_http_pool_destroy(c->pool);
+        k8s_free(c->api_url);
+        k8s_free(c);
+    }
+}
+
+/* Caller holds registry_lock */
+static void free_registry(registry_t *reg) {
+    if (reg) {
+        for (int i = 0; i < reg->count; i++) {
+            drop_cluster(reg->clusters[i]);
+        }
+        k8s_free(reg);
+    }
+}
+
+/* Integer option value within [min, max], or -1 */
+static int option_value(const char *value, int min, int max) {
+    char *end;
+    errno = 0;
+    long v = strtol(value, &end, 10);
+    if (*value < '0' || *value > '9' || *end || errno || v < min || v > max) {
+        return -1;
+    }
+    return (int)v;
+}
+
+/**
+ * Parse one line; the strings of spec point into line
+ *
+ * @return NULL, or why the line cannot be used
+ */
+static const char *parse_line(char *line, cluster_t *spec) {
+    char *fields[MAX_FIELDS];
+    char *save = NULL;
+    int n = 0;
+
+    for (char *f = strtok_r(line, " \t\r", &save); f; f = strtok_r(NULL, " \t\r", &save)) {
+        if (n == MAX_FIELDS) {
+            return "too_many_fields";
+        }
+        fields[n++] = f;
+    }
+    if (n < 4) {
+        return "missing_fields";
+    }
+
+    memset(spec, 0, sizeof(*spec));
+    if (!k8s_cluster_name_valid(fields[0], strlen(fields[0]))) {
+        return "bad_name";
+    }
+    if (strcmp(fields[0], K8S_CLUSTER_LOCAL) == 0) {
+        return "reserved_name";
+    }
+    if (strncmp(fields[1], "https://", 8) != 0 && strncmp(fields[1], "http://", 7) != 0) {
+        return "bad_url";
+    }
+    if (fields[2][0] != '/' || fields[3][0] != '/') {
+        return "bad_path";
+    }
+    snprintf(spec->name, sizeof(spec->name), "%s", fields[0]);
+    spec->api_url = fields[1];
+    spec->ca_path = fields[2];
+    spec->token_path = fields[3];
+    spec->timeout = -1;
+    spec->pool_size = -1;
+    spec->max_inflight = -1;
+
+    for (int i = 4; i < n; i++) {
+        char *eq = strchr(fields[i], '=');
+        int *slot = NULL;
+        int max = 0;
+
+        if (eq) {
+            *eq = '\0';
+            if (strcmp(fields[i], "timeout") == 0) {
+                slot = &spec->timeout;
+                max = 300;
+            } else if (strcmp(fields[i], "pool_size") == 0) {
+                slot = &spec->pool_size;
+                max = K8S_HTTP_POOL_MAX_SIZE;
+            } else if (strcmp(fields[i], "max_inflight") == 0) {
+                slot = &spec->max_inflight;
+                max = INFLIGHT_MAX;
+            }
+        }
+        if (!slot) {
+            return "unknown_option";
+        }
+        if (*slot != -1) {
+            return "duplicate_option";
+        }
+        if ((*slot = option_value(eq + 1, 1, max)) == -1) {
+            return "bad_value";
+        }
+    }
+
+    if (spec->timeout == -1) {
+        spec->timeout = K8S_CLUSTER_DEFAULT_TIMEOUT;
+    }
+    if (spec->pool_size == -1) {
+        spec->pool_size = K8S_CLUSTER_DEFAULT_POOL_SIZE;
+    }
+    if (spec->max_inflight == -1) {
+        spec->max_inflight = K8S_CLUSTER_DEFAULT_MAX_INFLIGHT;
+    }
+    return NULL;
+}
+
+static cluster_t *find(const registry_t *reg, const char *name) {
+    for (int i = 0; reg && i < reg->count; i++) {
+        if (strcmp(reg->clusters[i]->name, name) == 0) {
+            return reg->clusters[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Build a registry from the contents of the file; clusters whose line is
+ * unchanged are taken over from the current registry. Caller holds
+ * registry_lock.
+ *
+ * @return New registry, or NULL on allocation failure
+ */
+static registry_t *build_registry(char *data, const char *path, int *skipped) {
+    registry_t *reg = k8s_calloc(K8S_MEM_CLUSTER, 1, sizeof(registry_t));
+    int number = 0;
+
+    if (!reg) {
+        return NULL;
+    }
+    *skipped = 0;
+
+    for (char *line = data; line; ) {
+        char *eol = strchr(line, '\n');
+        char *next = eol ? eol + 1 : NULL;
+        if (eol) {
+            *eol = '\0';
+        }
+        number++;
+        line += strspn(line, " \t\r");
+
+        if (*line && *line != '#') {
+            cluster_t spec;
+            const char *reason = parse_line(line, &spec);
+
+            if (!reason && find(reg, spec.name)) {
+                reason = "duplicate_name";
+            } else if (!reason && reg->count == K8S_CLUSTER_MAX) {
+                reason = "too_many_clusters";
+            }
+            if (reason) {
+                (*skipped)++;
+                K8S_LOG(K8S_LOG_WARNING, "cluster_invalid_line", "path=\"%s\" line=%d reason=%s",
+                        path, number, reason);
+            } else {
+                cluster_t *c = find(current, spec.name);
+                if (!c || !same_settings(c, &spec)) {
+                    c = create_cluster(&spec);
+                }
+                if (!c) {
+                    free_registry(reg);
+                    return NULL;
+                }
+                c->refs++;
+                reg->clusters[reg->count++] = c;
+            }
+        }
+        line = next;
+    }
+    return reg;
+}
+
+/*
+ * Make a registry current and retire the previous one; registry_lock must
+ * be held
+ */
+static void publish(registry_t *reg) {
+    registry_t *old = __atomic_exchange_n(&current, reg, __ATOMIC_ACQ_REL);
+    if (old) {
+        old->retired_at = time(NULL);
+        old->next_retired = NULL;
+        if (retired_tail) {
+            retired_tail->next_retired = old;
+        } else {
+            retired_head = old;
+        }
+        retired_tail = old;
+    }
+}
+
+/*
+ * Free retired registries nothing holds any more, along with the clusters
+ * no registry lists; registry_lock must be held
+ */
+static void reclaim(int grace_seconds) {
+    time_t now = time(NULL);
+
+    while (retired_head &&
+           now - retired_head->retired_at >= grace_seconds &&
+           __atomic_load_n(&retired_head->users, __ATOMIC_ACQUIRE) == 0) {
+        registry_t *reg = retired_head;
+        retired_head = reg->next_retired;
+        if (!retired_head) {
+            retired_tail = NULL;
+        }
+        free_registry(reg);
+    }
+}
+
+static registry_t *acquire_registry(void) {
+    registry_t *reg = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    if (reg) {
+        __atomic_add_fetch(&reg->users, 1, __ATOMIC_ACQ_REL);
+    }
+    return reg;
+}
+
+static void release_registry(registry_t *reg) {
+    if (reg) {
+        __atomic_sub_fetch(&reg->users, 1, __ATOMIC_ACQ_REL);
+    }
+}
+
+void k8s_cluster_configure(const char *path) {
+    if (path && !*path) {
+        path = NULL;
+    }
+
+    k8s_mutex_lock(&registry_lock);
+    if (path && registry_path && strcmp(path, registry_path) == 0) {
+        k8s_mutex_unlock(&registry_lock);
+        return;
+    }
+
+    free(registry_path);
+    registry_path = path ? strdup(path) : NULL;
+    if (path && !registry_path) {
+        K8S_LOG(K8S_LOG_ERROR, "out_of_memory", "where=cluster");
+    }
+    have_loaded = 0;
+    warned = 0;
+
+    if (!registry_path && current) {
+        publish(NULL);
+        K8S_LOG(K8S_LOG_INFO, "clusters_disabled", "clusters=0");
+    }
+    k8s_mutex_unlock(&registry_lock);
+}
+
+int k8s_cluster_reload(void) {
+    struct stat st;
+    int skipped = 0;
+    int installed = 0;
+
+    k8s_mutex_lock(&registry_lock);
+    reclaim(K8S_CLUSTER_GRACE_SECONDS);
+
+    if (registry_path && stat(registry_path, &st) != 0) {
+        if (!warned) {
+            K8S_LOG(K8S_LOG_WARNING, "clusters_load_failed",
+                    "path=\"%s\" reason=missing action=keep_previous", registry_path);
+            warned = 1;
+        }
+    } else if (registry_path && (!have_loaded || !same_file(&st, &loaded))) {
+        char *data = k8s_read_file(registry_path);
+        const char *reason = data ? "out_of_memory" : "unreadable";
+        registry_t *reg = data ? build_registry(data, registry_path, &skipped) : NULL;
+        free(data);
+
+        if (reg) {
+            publish(reg);
+            loaded = st;
+            have_loaded = 1;
+            warned = 0;
+            installed = 1;
+            K8S_LOG(K8S_LOG_INFO, "clusters_loaded", "path=\"%s\" clusters=%d skipped=%d",
+                    registry_path, reg->count, skipped);
+        } else if (!warned) {
+            K8S_LOG(K8S_LOG_WARNING, "clusters_load_failed",
+                    "path=\"%s\" reason=%s action=keep_previous", registry_path, reason);
+            warned = 1;
+        }
+    }
+    k8s_mutex_unlock(&registry_lock);
+
+    return installed;
+}
+
+k8s_cluster_status_t k8s_cluster_acquire(const char *name, k8s_cluster_lease_t *lease) {
+    registry_t *reg = acquire_registry();
+    cluster_t *c = find(reg, name);
+
+    memset(lease, 0, sizeof(*lease));
+    if (!c) {
+        release_registry(reg);
+        return K8S_CLUSTER_UNKNOWN;
+    }
+    if (!responsive(c)) {
+        __atomic_add_fetch(&c->refused, 1, __ATOMIC_RELAXED);
+        release_registry(reg);
+        return K8S_CLUSTER_OPEN;
+    }
+    if (__atomic_add_fetch(&c->in_flight, 1, __ATOMIC_ACQ_REL) > c->max_inflight) {
+        __atomic_sub_fetch(&c->in_flight, 1, __ATOMIC_ACQ_REL);
+        __atomic_add_fetch(&c->shed, 1, __ATOMIC_RELAXED);
+        release_registry(reg);
+        return K8S_CLUSTER_BUSY;
+    }
+
+    __atomic_add_fetch(&c->requests, 1, __ATOMIC_RELAXED);
+    lease->registry = reg;
+    lease->cluster = c;
+    config_of(c, &lease->config);
+    return K8S_CLUSTER_OK;
+}
+
+void k8s_cluster_release(k8s_cluster_lease_t *lease, int answered) {
+    cluster_t *c = lease->cluster;
+
+    if (!c) {
+        return;
+    }
+    if (answered > 0) {
+        if (__atomic_exchange_n(&c->failures, 0, __ATOMIC_RELAXED) >= K8S_CLUSTER_FAILURES) {
+            K8S_LOG(K8S_LOG_INFO, "cluster_recovered", "cluster=%s", c->name);
+        }
+    } else if (answered == 0) {
+        __atomic_add_fetch(&c->unavailable, 1, __ATOMIC_RELAXED);
+        int failures = __atomic_add_fetch(&c->failures, 1, __ATOMIC_RELAXED);
+        if (failures >= K8S_CLUSTER_FAILURES) {
+            __atomic_store_n(&c->retry_at, time(NULL) + K8S_CLUSTER_RETRY_SECONDS,
+                             __ATOMIC_RELAXED);
+        }
+        if (failures == K8S_CLUSTER_FAILURES) {
+            K8S_LOG(K8S_LOG_WARNING, "cluster_unavailable", "cluster=%s action=fail_fast "
+                    "retry_s=%d", c->name, K8S_CLUSTER_RETRY_SECONDS);
+        }
+    }
+    __atomic_sub_fetch(&c->in_flight, 1, __ATOMIC_ACQ_REL);
+    release_registry(lease->registry);
+    lease->cluster = NULL;
+    lease->registry = NULL;
+}
+
+void k8s_cluster_maintain(int idle_seconds) {
+    registry_t *reg = acquire_registry();
+    time_t now = time(NULL);
+
+    for (int i = 0; reg && i < reg->count; i++) {
+        cluster_t *c = reg->clusters[i];
+        if (!c->pool) {
+            continue;
+        }
+        if (now - c->refreshed_at >= K8S_CLUSTER_REFRESH_SECONDS) {
+            k8s_http_pool_refresh_credential(c->pool);
+            k8s_http_pool_reload_ca(c->pool);
+            k8s_http_pool_resolve(c->pool);
+            c->refreshed_at = now;
+        }
+        /* A failing cluster would hold up the housekeeping thread */
+        if (idle_seconds > 0 && responsive(c)) {
+            k8s_http_pool_ping(c->pool, idle_seconds);
+        }
+    }
+    release_registry(reg);
+}
+
+int k8s_cluster_collect(k8s_cluster_row_t *rows, int max) {
+    registry_t *reg = acquire_registry();
+    int n = 0;
+
+    for (; reg && n < reg->count && n < max; n++) {
+        const cluster_t *c = reg->clusters[n];
+        k8s_cluster_row_t *row = &rows[n];
+        memcpy(row->name, c->name, sizeof(row->name));
+        row->requests = __atomic_load_n(&c->requests, __ATOMIC_RELAXED);
+        row->unavailable = __atomic_load_n(&c->unavailable, __ATOMIC_RELAXED);
+        row->refused = __atomic_load_n(&c->refused, __ATOMIC_RELAXED);
+        row->shed = __atomic_load_n(&c->shed, __ATOMIC_RELAXED);
+        row->in_flight = __atomic_load_n(&c->in_flight, __ATOMIC_RELAXED);
+        row->open = !responsive(c);
+    }
+    release_registry(reg);
+    return n;
+}
+
+int k8s_cluster_count(void) {
+    registry_t *reg = acquire_registry();
+    int count = reg ? reg->count : 0;
+    release_registry(reg);
+    return count;
+}
+
+void k8s_cluster_shutdown(void) {
+    k8s_mutex_lock(&registry_lock);
+    publish(NULL);
+    while (retired_head) {
+        registry_t *reg = retired_head;
+        retired_head = reg->next_retired;
+        free_registry(reg);
+    }
+    retired_tail = NULL;
+
+    free(registry_path);
+    registry_path = NULL;
+    have_loaded = 0;
+    warned = 0;
+    k8s_mutex_unlock(&registry_lock);
+}
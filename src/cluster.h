@@ -0,0 +1,181 @@
+/*
+ * Cluster Registry
+ *
+ * Routes logins of MariaDB users named <cluster>/<namespace>/<name> to the
+ * API server of that cluster. Each remote cluster has its own URL, CA,
+ * credential file and warm connection pool, and its own circuit: after
+ * K8S_CLUSTER_FAILURES requests in a row without an answer its logins fail
+ * at once for K8S_CLUSTER_RETRY_SECONDS instead of each waiting out the
+ * timeout, and no more than max_inflight of its logins wait for it at the
+ * same time. Logins of the local cluster (two-part user names, or the
+ * cluster "local") never touch the registry, so a slow remote cluster costs
+ * them nothing.
+ *
+ * The registry file is loaded off the login path and published as one
+ * immutable list, as the denylist is. A cluster whose line did not change
+ * keeps its pool and circuit across reloads. One cluster per line; blank
+ * lines and lines starting with # are ignored:
+ *
+ *   <name> <api_url> <ca_path> <token_path> [timeout=<s>] [pool_size=<n>]
+ *          [max_inflight=<n>]
+ *
+ * Names are 1-63 characters of a-z, 0-9 and -; "local" is reserved.
+ */
+
+#ifndef K8S_CLUSTER_H
+#define K8S_CLUSTER_H
+
+#include "tokenreview_api.h"
+
+/* Name of the cluster the plugin runs in */
+#define K8S_CLUSTER_LOCAL "local"
+
+/* Longest cluster name */
+#define K8S_CLUSTER_NAME_MAX 63
+
+/* Most clusters in the registry file */
+#define K8S_CLUSTER_MAX 64
+
+/* Requests in a row without an answer after which a cluster is passed over */
+#define K8S_CLUSTER_FAILURES 3
+
+/* Seconds logins of a failing cluster fail at once before it is tried again */
+#define K8S_CLUSTER_RETRY_SECONDS 10
+
+/* Defaults of the per-cluster options */
+#define K8S_CLUSTER_DEFAULT_TIMEOUT 5
+#define K8S_CLUSTER_DEFAULT_POOL_SIZE 2
+#define K8S_CLUSTER_DEFAULT_MAX_INFLIGHT 16
+
+/* Seconds between re-reads of a cluster's credential and CA and
+ * re-resolutions of its address */
+#define K8S_CLUSTER_REFRESH_SECONDS 30
+
+/* Minimum age in seconds of a replaced registry before it may be freed */
+#define K8S_CLUSTER_GRACE_SECONDS 10
+
+typedef enum {
+    K8S_CLUSTER_OK,
+    K8S_CLUSTER_UNKNOWN,             /* Not in the registry */
+    K8S_CLUSTER_OPEN,                /* Failing; retried after a while */
+    K8S_CLUSTER_BUSY                 /* max_inflight logins already waiting */
+} k8s_cluster_status_t;
+
+/* A remote cluster's API server, held for one login's requests */
+typedef struct {
+    struct k8s_cluster_registry *registry;
+    struct k8s_cluster *cluster;
+    k8s_config_t config;             /* The cluster's API server and pool */
+} k8s_cluster_lease_t;
+
+/* One cluster, as reported by k8s_cluster_collect() */
+typedef struct {
+    char name[K8S_CLUSTER_NAME_MAX + 1];
+    unsigned long long requests;     /* Leases granted */
+    unsigned long long unavailable;  /* ... that got no answer */
+    unsigned long long refused;      /* Logins failed while the circuit was open */
+    unsigned long long shed;         /* Logins failed at max_inflight */
+    int in_flight;                   /* Leases held now */
+    int open;                        /* Circuit currently open */
+} k8s_cluster_row_t;
+
+/**
+ * Check a cluster name
+ *
+ * @param name Name
+ * @param len Length of name
+ * @return 1 if it is 1-63 characters of a-z, 0-9 and -, 0 otherwise
+ */
+int k8s_cluster_name_valid(const char *name, size_t len);
+
+/**
+ * Split a MariaDB user name into cluster and ServiceAccount
+ *
+ * "<cluster>/<namespace>/<name>" names a cluster, "<namespace>/<name>" and
+ * anything else the local one.
+ *
+ * @param user MariaDB user name
+ * @param cluster Set to the cluster name, K8S_CLUSTER_LOCAL for the local
+ *                cluster; at least K8S_CLUSTER_NAME_MAX + 1 bytes
+ * @param identity Set to the namespace/name part of user
+ * @return 1 on success, 0 if the cluster part is not a valid name
+ */
+int k8s_cluster_split_user(const char *user, char *cluster, const char **identity);
+
+/**
+ * Set the registry file
+ *
+ * The file is read by the next k8s_cluster_reload(). An empty path drops
+ * every cluster at once.
+ *
+ * @param path Registry file (copied); NULL or empty disables remote clusters
+ */
+void k8s_cluster_configure(const char *path);
+
+/**
+ * Load the registry file again if it changed since the last load
+ *
+ * New clusters get their pool created and warmed before they are published.
+ * A missing or unreadable file keeps the current registry; lines that
+ * cannot be parsed are skipped and logged. Also frees replaced registries
+ * older than K8S_CLUSTER_GRACE_SECONDS that no login uses any more.
+ *
+ * @return 1 if a new registry was installed, 0 otherwise
+ */
+int k8s_cluster_reload(void);
+
+/**
+ * Take a cluster's API server for one login
+ *
+ * Never blocks: a cluster with an open circuit or max_inflight leases held
+ * is refused at once. Every lease granted must be returned with
+ * k8s_cluster_release().
+ *
+ * @param name Cluster name
+ * @param lease Filled on success
+ * @return K8S_CLUSTER_OK if the lease was granted, why not otherwise
+ */
+k8s_cluster_status_t k8s_cluster_acquire(const char *name, k8s_cluster_lease_t *lease);
+
+/**
+ * Return a lease and feed the result into the cluster's circuit
+ *
+ * @param lease Lease from k8s_cluster_acquire()
+ * @param answered 1 if the API server answered, 0 if it could not be
+ *                 reached, -1 if it was not asked after all
+ */
+void k8s_cluster_release(k8s_cluster_lease_t *lease, int answered);
+
+/**
+ * Keep the pools of the registered clusters usable
+ *
+ * Pings idle connections of clusters that are not failing and, every
+ * K8S_CLUSTER_REFRESH_SECONDS, re-reads credentials and CA bundles and
+ * re-resolves addresses. Called from the housekeeping thread.
+ *
+ * @param idle_seconds Ping connections idle for at least this long, 0 for none
+ */
+void k8s_cluster_maintain(int idle_seconds);
+
+/**
+ * Report the registered clusters
+ *
+ * @param rows Output
+ * @param max Size of rows
+ * @return Number of rows filled
+ */
+int k8s_cluster_collect(k8s_cluster_row_t *rows, int max);
+
+/**
+ * @return Number of clusters in the current registry
+ */
+int k8s_cluster_count(void);
+
+/**
+ * Free the current and all replaced registries and forget the path
+ *
+ * Only safe once no login can hold a lease.
+ */
+void k8s_cluster_shutdown(void);
+
+#endif /* K8S_CLUSTER_H */
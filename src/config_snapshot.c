@@ -0,0 +1,158 @@
+/*
+ * Immutable Configuration Snapshots Implementation
+ */
+
+#include "config_snapshot.h"
+#include "instrumentation.h"
+#include "http_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+static k8s_snapshot_t *current = NULL;
+
+/* Serializes publishers and reclaim; never taken on the login path */
+static k8s_mutex_t retire_lock = K8S_MUTEX_INITIALIZER(K8S_MUTEX_SNAPSHOT);
+static k8s_snapshot_t *retired_head = NULL;
+static k8s_snapshot_t *retired_tail = NULL;
+
+static int same_str(const char *a, const char *b) {
+    return strcmp(a ? a : "", b ? b : "") == 0;
+}
+
+static void destroy_snapshot(k8s_snapshot_t *snap) {
+    if (snap->owns_pool) {
+        k8s_http_pool_destroy(snap->config.pool);
+    }
+    k8s_snapshot_free(snap);
+}
+
+k8s_snapshot_t *k8s_snapshot_create(const k8s_config_t *config, int pool_size,
+                                    int keepalive_interval, int dns_ttl) {
+    if (!config) {
+        return NULL;
+    }
+
+    k8s_snapshot_t *snap = k8s_calloc(K8S_MEM_SNAPSHOT, 1, sizeof(k8s_snapshot_t));
+    if (!snap) {
+        return NULL;
+    }
+
+    snap->api_server_url = strdup(config->api_server_url ? config->api_server_url : "");
+    snap->ca_cert_path = strdup(config->ca_cert_path ? config->ca_cert_path : "");
+    snap->token_path = strdup(config->token_path ? config->token_path : "");
+    if (!snap->api_server_url || !snap->ca_cert_path || !snap->token_path) {
+        k8s_snapshot_free(snap);
+        return NULL;
+    }
+
+    snap->config = *config;
+    snap->config.api_server_url = snap->api_server_url;
+    snap->config.ca_cert_path = snap->ca_cert_path;
+    snap->config.token_path = snap->token_path;
+    if (config->backends) {
+        snap->backends = *config->backends;
+    }
+    snap->config.backends = &snap->backends;
+    snap->pool_size = pool_size;
+    snap->keepalive_interval = keepalive_interval;
+    snap->dns_ttl = dns_ttl;
+    snap->owns_pool = config->pool != NULL;
+
+    return snap;
+}
+
+void k8s_snapshot_free(k8s_snapshot_t *snap) {
+    if (!snap) {
+        return;
+    }
+    free(snap->api_server_url);
+    free(snap->ca_cert_path);
+    free(snap->token_path);
+    k8s_free(snap);
+}
+
+int k8s_snapshot_same_pool(const k8s_snapshot_t *a, const k8s_snapshot_t *b) {
+    return same_str(a->api_server_url, b->api_server_url) &&
+           same_str(a->ca_cert_path, b->ca_cert_path) &&
+           same_str(a->token_path, b->token_path) &&
+           a->pool_size == b->pool_size &&
+           /* Pinned addresses stay in the pool's DNS cache once set */
+           (a->dns_ttl > 0) == (b->dns_ttl > 0);
+}
+
+void k8s_snapshot_publish(k8s_snapshot_t *snap) {
+    k8s_mutex_lock(&retire_lock);
+
+    k8s_snapshot_t *old = current;
+    if (old && old->config.pool && old->config.pool == snap->config.pool) {
+        old->owns_pool = 0;
+        snap->owns_pool = 1;
+    }
+
+    __atomic_store_n(&current, snap, __ATOMIC_RELEASE);
+
+    if (old) {
+        old->retired_at = time(NULL);
+        old->next_retired = NULL;
+        if (retired_tail) {
+            retired_tail->next_retired = old;
+        } else {
+            retired_head = old;
+        }
+        retired_tail = old;
+    }
+
+    k8s_mutex_unlock(&retire_lock);
+}
+
+k8s_snapshot_t *k8s_snapshot_acquire(void) {
+    k8s_snapshot_t *snap = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    if (snap) {
+        __atomic_add_fetch(&snap->users, 1, __ATOMIC_ACQ_REL);
+    }
+    return snap;
+}
+
+void k8s_snapshot_release(k8s_snapshot_t *snap) {
+    if (snap) {
+        __atomic_sub_fetch(&snap->users, 1, __ATOMIC_ACQ_REL);
+    }
+}
+
+int k8s_snapshot_reclaim(int grace_seconds) {
+    int freed = 0;
+    time_t now = time(NULL);
+
+    k8s_mutex_lock(&retire_lock);
+    while (retired_head &&
+           now - retired_head->retired_at >= grace_seconds &&
+           __atomic_load_n(&retired_head->users, __ATOMIC_ACQUIRE) == 0) {
+        k8s_snapshot_t *snap = retired_head;
+        retired_head = snap->next_retired;
+        if (!retired_head) {
+            retired_tail = NULL;
+        }
+        destroy_snapshot(snap);
+        freed++;
+    }
+    k8s_mutex_unlock(&retire_lock);
+
+    return freed;
+}
+
+void k8s_snapshot_shutdown(void) {
+    k8s_mutex_lock(&retire_lock);
+    while (retired_head) {
+        k8s_snapshot_t *snap = retired_head;
+        retired_head = snap->next_retired;
+        destroy_snapshot(snap);
+    }
+    retired_tail = NULL;
+
+    k8s_snapshot_t *snap = __atomic_exchange_n(&current, NULL, __ATOMIC_ACQ_REL);
+    if (snap) {
+        destroy_snapshot(snap);
+    }
+    k8s_mutex_unlock(&retire_lock);
+}
@@ -0,0 +1,124 @@
+/*
+ * Immutable Configuration Snapshots
+ *
+ * The settings in effect for a login (API server, credentials, timeouts and
+ * the connection pool built from them) are published as one immutable
+ * snapshot. Logins pick up the current snapshot with a single atomic load,
+ * so SET GLOBAL never blocks authentication and a login never observes half
+ * of a change. Replaced snapshots are retired and freed once no login uses
+ * them any more.
+ */
+
+#ifndef K8S_CONFIG_SNAPSHOT_H
+#define K8S_CONFIG_SNAPSHOT_H
+
+#include <time.h>
+#include "tokenreview_api.h"
+#include "backend.h"
+
+typedef struct k8s_snapshot {
+    k8s_config_t config;          /* Strings and chain point at the owned copies
+                                     below; config.pool may be NULL (one-shot handles) */
+    int pool_size;
+    int keepalive_interval;
+    int dns_ttl;
+    int slow_auth_ms;             /* Slow-auth log threshold (0: disabled) */
+    int cache_ttl;                /* Seconds a validated token is reused (0: no cache) */
+    int revalidate_interval;      /* Seconds between revalidations of live sessions (0: off) */
+    int revalidate_kill;          /* Kill sessions whose token stopped being valid */
+    int optimistic;               /* Accept locally verified tokens before TokenReview */
+    int optimistic_window;        /* Seconds an optimistic login may go unconfirmed */
+    int ticket_ttl;               /* Lifetime of issued session tickets (0: none issued) */
+    k8s_backend_chain_t backends; /* Validation backends in order (count 0: TokenReview) */
+
+    /* Internal */
+    char *api_server_url;
+    char *ca_cert_path;
+    char *token_path;
+    int owns_pool;                /* Destroy config.pool when freed */
+    int users;                    /* Logins and tasks currently using it */
+    time_t retired_at;
+    struct k8s_snapshot *next_retired;
+} k8s_snapshot_t;
+
+/**
+ * Create an unpublished snapshot
+ *
+ * The configuration strings and backend chain are copied; config->pool is
+ * taken as is.
+ *
+ * @param config API server configuration
+ * @param pool_size Number of pooled connections
+ * @param keepalive_interval Idle seconds before a pooled connection is pinged
+ * @param dns_ttl Seconds between re-resolutions of the API server (0: no pinning)
+ * @return New snapshot, or NULL on allocation failure
+ */
+k8s_snapshot_t *k8s_snapshot_create(const k8s_config_t *config, int pool_size,
+                                    int keepalive_interval, int dns_ttl);
+
+/**
+ * Free a snapshot that was never published
+ *
+ * The pool it references is not touched.
+ *
+ * @param snap Snapshot to free (NULL is ignored)
+ */
+void k8s_snapshot_free(k8s_snapshot_t *snap);
+
+/**
+ * Whether two snapshots can use the same connection pool
+ *
+ * True when the API server, CA, credential, pool size and DNS pinning mode
+ * are identical; timeouts and housekeeping intervals may differ.
+ *
+ * @param a First snapshot
+ * @param b Second snapshot
+ * @return 1 if a pool built for a is valid for b, 0 otherwise
+ */
+int k8s_snapshot_same_pool(const k8s_snapshot_t *a, const k8s_snapshot_t *b);
+
+/**
+ * Make a snapshot current and retire the previous one
+ *
+ * If the new snapshot reuses the previous snapshot's pool, ownership of the
+ * pool moves to the new snapshot. Publishers are serialized internally.
+ *
+ * @param snap Snapshot to publish; owned by this module afterwards
+ */
+void k8s_snapshot_publish(k8s_snapshot_t *snap);
+
+/**
+ * Take a reference to the current snapshot without locking
+ *
+ * @return Current snapshot, or NULL if none was published
+ */
+k8s_snapshot_t *k8s_snapshot_acquire(void);
+
+/**
+ * Drop a reference obtained from k8s_snapshot_acquire()
+ *
+ * @param snap Snapshot to release (NULL is ignored)
+ */
+void k8s_snapshot_release(k8s_snapshot_t *snap);
+
+/**
+ * Free retired snapshots that are no longer in use
+ *
+ * Snapshots are freed oldest first, so a pool shared by several snapshots
+ * is only destroyed after every snapshot using it is gone. The grace period
+ * covers readers that loaded the pointer but have not counted themselves
+ * yet.
+ *
+ * @param grace_seconds Minimum time since retirement
+ * @return Number of snapshots freed
+ */
+int k8s_snapshot_reclaim(int grace_seconds);
+
+/**
+ * Free the current and all retired snapshots
+ *
+ * Only safe once no login or background task can use them.
+ */
+void k8s_snapshot_shutdown(void);
+
+#endif /* K8S_CONFIG_SNAPSHOT_H */
@@ -0,0 +1,514 @@
+/*
+ * Revocation Denylist Implementation
+ */
+
+#include "denylist.h"
+#include "log.h"
+#include "instrumentation.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+
+/* First byte of every key: what kind of entry it is */
+#define KEY_TOKEN 't'
+#define KEY_UID 'u'
+#define KEY_NAME 'n'
+
+/* Longest key, kind byte included; longer entries can never match */
+#define KEY_MAX 512
+
+#define TOKEN_HASH_LEN 32
+#define MIN_SLOTS 16
+
+typedef struct {
+    uint64_t hash;                  /* 0: slot free */
+    uint32_t offset;                /* Key position in the arena */
+    uint32_t length;
+} index_slot_t;
+
+/*
+ * One immutable, indexed version of the file. At most half of the slots
+ * are used, so a probe sequence always ends at a free slot.
+ */
+typedef struct denylist {
+    index_slot_t *slots;
+    uint32_t mask;                  /* Slot count - 1 */
+    char *keys;                     /* Arena holding every key */
+    uint32_t keys_used;
+    int count;
+    int tokens;                     /* Entries per kind, to skip needless work */
+    int uids;
+    int names;
+    int users;                      /* Logins currently checking it */
+    time_t retired_at;
+    struct denylist *next_retired;
+} denylist_t;
+
+static denylist_t *current = NULL;
+
+/* Path, load state and retirement; never taken on the login path */
+static k8s_mutex_t list_lock = K8S_MUTEX_INITIALIZER(K8S_MUTEX_DENYLIST);
+static char *list_path = NULL;
+static struct stat loaded;          /* File identity at the last load attempt */
+static int have_loaded = 0;
+static int warned = 0;              /* A load failure was logged since the last success */
+static denylist_t *retired_head = NULL;
+static denylist_t *retired_tail = NULL;
+
+static uint64_t key_hash(const char *key, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)key[i]) * 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+static int same_file(const struct stat *a, const struct stat *b) {
+    return a->st_ino == b->st_ino && a->st_dev == b->st_dev && a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static void free_list(denylist_t *list) {
+    if (list) {
+        k8s_free(list->slots);
+        k8s_free(list->keys);
+        k8s_free(list);
+    }
+}
+
+static int contains(const denylist_t *list, const char *key, size_t len) {
+    uint64_t hash = key_hash(key, len);
+    for (uint32_t i = hash & list->mask; ; i = (i + 1) & list->mask) {
+        const index_slot_t *slot = &list->slots[i];
+        if (!slot->hash) {
+            return 0;
+        }
+        if (slot->hash == hash && slot->length == len &&
+            memcmp(list->keys + slot->offset, key, len) == 0) {
+            return 1;
+        }
+    }
+}
+
+/**
+ * Add a key unless it is already listed
+ *
+ * @return 1 if added, 0 if a duplicate
+ */
+static int insert(denylist_t *list, const char *key, size_t len) {
+    uint64_t hash = key_hash(key, len);
+    uint32_t i = hash & list->mask;
+
+    for (; list->slots[i].hash; i = (i + 1) & list->mask) {
+        const index_slot_t *slot = &list->slots[i];
+        if (slot->hash == hash && slot->length == len &&
+            memcmp(list->keys + slot->offset, key, len) == 0) {
+            return 0;
+        }
+    }
+
+    memcpy(list->keys + list->keys_used, key, len);
+    list->slots[i].hash = hash;
+    list->slots[i].offset = list->keys_used;
+    list->slots[i].length = (uint32_t)len;
+    list->keys_used += (uint32_t)len;
+    list->count++;
+    return 1;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/**
+ * Turn one trimmed line into its key
+ *
+ * @return Key length, or 0 if the line is not a valid entry
+ */
+static size_t parse_entry(const char *line, size_t len, char *key) {
+    for (size_t i = 0; i < len; i++) {
+        if (is_space(line[i])) {
+            return 0;
+        }
+    }
+
+    if (len > 7 && memcmp(line, "sha256:", 7) == 0) {
+        if (len - 7 != TOKEN_HASH_LEN * 2) {
+            return 0;
+        }
+        key[0] = KEY_TOKEN;
+        for (size_t i = 0; i < TOKEN_HASH_LEN; i++) {
+            int hi = hex_value(line[7 + 2 * i]);
+            int lo = hex_value(line[8 + 2 * i]);
+            if (hi < 0 || lo < 0) {
+                return 0;
+            }
+            key[1 + i] = (char)(hi << 4 | lo);
+        }
+        return 1 + TOKEN_HASH_LEN;
+    }
+
+    if (len + 1 > KEY_MAX) {
+        return 0;
+    }
+
+    if (len > 4 && memcmp(line, "uid:", 4) == 0) {
+        key[0] = KEY_UID;
+        memcpy(key + 1, line + 4, len - 4);
+        return 1 + len - 4;
+    }
+
+    const char *slash = memchr(line, '/', len);
+    if (!slash || slash == line || slash == line + len - 1 ||
+        memchr(slash + 1, '/', line + len - slash - 1)) {
+        return 0;
+    }
+    key[0] = KEY_NAME;
+    memcpy(key + 1, line, len);
+    return 1 + len;
+}
+
+/**
+ * Index the contents of a denylist file
+ *
+ * Every key is at most one byte longer than its line (the newline or the
+ * end of the file makes up for it), so the arena never outgrows the file.
+ */
+static denylist_t *build_index(const char *data, size_t size, const char *path, int *skipped) {
+    size_t lines = 1;
+    for (const char *p = data; (p = memchr(p, '\n', data + size - p)) != NULL; p++) {
+        lines++;
+    }
+
+    uint32_t slots = MIN_SLOTS;
+    while (slots < lines * 2) {
+        slots <<= 1;
+    }
+
+    denylist_t *list = k8s_calloc(K8S_MEM_DENYLIST, 1, sizeof(denylist_t));
+    if (!list ||
+        !(list->slots = k8s_calloc(K8S_MEM_DENYLIST, slots, sizeof(index_slot_t))) ||
+        !(list->keys = k8s_malloc(K8S_MEM_DENYLIST, size + 1))) {
+        free_list(list);
+        return NULL;
+    }
+    list->mask = slots - 1;
+
+    const char *end = data + size;
+    const char *line = data;
+    int number = 0;
+    *skipped = 0;
+
+    while (line < end) {
+        const char *eol = memchr(line, '\n', end - line);
+        const char *next = eol ? eol + 1 : end;
+        if (!eol) {
+            eol = end;
+        }
+        number++;
+
+        while (line < eol && is_space(*line)) {
+            line++;
+        }
+        while (eol > line && is_space(eol[-1])) {
+            eol--;
+        }
+
+        if (line < eol && *line != '#') {
+            char key[KEY_MAX];
+            size_t len = parse_entry(line, eol - line, key);
+            if (len == 0) {
+                (*skipped)++;
+                K8S_LOG(K8S_LOG_WARNING, "denylist_invalid_line", "path=\"%s\" line=%d",
+                        path, number);
+            } else if (insert(list, key, len)) {
+                list->tokens += key[0] == KEY_TOKEN;
+                list->uids += key[0] == KEY_UID;
+                list->names += key[0] == KEY_NAME;
+            }
+        }
+        line = next;
+    }
+
+    return list;
+}
+
+/**
+ * Map and index a denylist file
+ *
+ * @param st Filled with the identity of the file that was read
+ * @return New list, or NULL (logged) if the file could not be used
+ */
+static denylist_t *load_file(const char *path, struct stat *st, int *skipped) {
+    const char *reason = NULL;
+    denylist_t *list = NULL;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        reason = "unreadable";
+    } else if (fstat(fd, st) != 0 || !S_ISREG(st->st_mode)) {
+        reason = "not_a_file";
+    } else if (st->st_size > K8S_DENYLIST_MAX_SIZE) {
+        reason = "too_large";
+    } else {
+        size_t size = (size_t)st->st_size;
+        const char *data = "";
+        int mapped = 0;
+
+        if (size > 0) {
+            void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) {
+                reason = "mmap_failed";
+            } else {
+                data = map;
+                mapped = 1;
+            }
+        }
+        if (!reason) {
+            list = build_index(data, size, path, skipped);
+            if (!list) {
+                reason = "out_of_memory";
+            }
+        }
+        if (mapped) {
+            munmap((void *)data, size);
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    if (reason && !warned) {
+        K8S_LOG(K8S_LOG_WARNING, "denylist_load_failed",
+                "path=\"%s\" reason=%s action=keep_previous", path, reason);
+        warned = 1;
+    }
+    return list;
+}
+
+/*
+ * Make a list current and retire the previous one; list_lock must be held
+ */
+static void publish(denylist_t *list) {
+    denylist_t *old = __atomic_exchange_n(&current, list, __ATOMIC_ACQ_REL);
+    if (old) {
+        old->retired_at = time(NULL);
+        old->next_retired = NULL;
+        if (retired_tail) {
+            retired_tail->next_retired = old;
+        } else {
+            retired_head = old;
+        }
+        retired_tail = old;
+    }
+}
+
+/*
+ * Free retired lists no login uses any more; list_lock must be held
+ */
+static void reclaim(int grace_seconds) {
+    time_t now = time(NULL);
+
+    while (retired_head &&
+           now - retired_head->retired_at >= grace_seconds &&
+           __atomic_load_n(&retired_head->users, __ATOMIC_ACQUIRE) == 0) {
+        denylist_t *list = retired_head;
+        retired_head = list->next_retired;
+        if (!retired_head) {
+            retired_tail = NULL;
+        }
+        free_list(list);
+    }
+}
+
+static denylist_t *acquire(void) {
+    denylist_t *list = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    if (list) {
+        __atomic_add_fetch(&list->users, 1, __ATOMIC_ACQ_REL);
+    }
+    return list;
+}
+
+static void release(denylist_t *list) {
+    if (list) {
+        __atomic_sub_fetch(&list->users, 1, __ATOMIC_ACQ_REL);
+    }
+}
+
+void k8s_denylist_configure(const char *path) {
+    if (path && !*path) {
+        path = NULL;
+    }
+
+    k8s_mutex_lock(&list_lock);
+    if (path && list_path && strcmp(path, list_path) == 0) {
+        k8s_mutex_unlock(&list_lock);
+        return;
+    }
+
+    free(list_path);
+    list_path = path ? strdup(path) : NULL;
+    if (path && !list_path) {
+        K8S_LOG(K8S_LOG_ERROR, "out_of_memory", "where=denylist");
+    }
+    have_loaded = 0;
+    warned = 0;
+
+    if (!list_path && current) {
+        publish(NULL);
+        K8S_LOG(K8S_LOG_INFO, "denylist_disabled", "entries=0");
+    }
+    k8s_mutex_unlock(&list_lock);
+}
+
+int k8s_denylist_reload(void) {
+    struct stat st;
+    int skipped = 0;
+    int installed = 0;
+
+    k8s_mutex_lock(&list_lock);
+    reclaim(K8S_DENYLIST_GRACE_SECONDS);
+
+    if (list_path && stat(list_path, &st) != 0) {
+        if (!warned) {
+            K8S_LOG(K8S_LOG_WARNING, "denylist_load_failed",
+                    "path=\"%s\" reason=missing action=keep_previous", list_path);
+            warned = 1;
+        }
+    } else if (list_path && (!have_loaded || !same_file(&st, &loaded))) {
+        denylist_t *list = load_file(list_path, &st, &skipped);
+        if (list) {
+            publish(list);
+            loaded = st;
+            have_loaded = 1;
+            warned = 0;
+            installed = 1;
+            K8S_LOG(K8S_LOG_INFO, "denylist_loaded", "path=\"%s\" entries=%d skipped=%d",
+                    list_path, list->count, skipped);
+        }
+    }
+    k8s_mutex_unlock(&list_lock);
+
+    return installed;
+}
+
+k8s_deny_t k8s_denylist_check_token(const char *token) {
+    denylist_t *list = acquire();
+    k8s_deny_t result = K8S_DENY_NONE;
+
+    if (list && list->tokens > 0 && token) {
+        unsigned char key[1 + TOKEN_HASH_LEN];
+        unsigned int len = 0;
+        key[0] = KEY_TOKEN;
+        if (EVP_Digest(token, strlen(token), key + 1, &len, EVP_sha256(), NULL) == 1 &&
+            contains(list, (const char *)key, sizeof(key))) {
+            result = K8S_DENY_TOKEN;
+        }
+    }
+    release(list);
+
+    return result;
+}
+
+k8s_deny_t k8s_denylist_check_digest(const unsigned char *digest) {
+    denylist_t *list = acquire();
+    k8s_deny_t result = K8S_DENY_NONE;
+
+    if (list && list->tokens > 0 && digest) {
+        unsigned char key[1 + TOKEN_HASH_LEN];
+        key[0] = KEY_TOKEN;
+        memcpy(key + 1, digest, TOKEN_HASH_LEN);
+        if (contains(list, (const char *)key, sizeof(key))) {
+            result = K8S_DENY_TOKEN;
+        }
+    }
+    release(list);
+
+    return result;
+}
+
+/*
+ * Build the key of a namespace/name pattern
+ *
+ * @return Key length, or 0 if it would exceed KEY_MAX
+ */
+static size_t name_key(char *key, const char *ns, const char *name) {
+    int len = snprintf(key, KEY_MAX, "%c%s/%s", KEY_NAME, ns, name);
+    return len > 0 && len < KEY_MAX ? (size_t)len : 0;
+}
+
+k8s_deny_t k8s_denylist_check_identity(const char *ns, const char *name, const char *uid) {
+    denylist_t *list = acquire();
+    k8s_deny_t result = K8S_DENY_NONE;
+    char key[KEY_MAX];
+    size_t len;
+
+    if (!list) {
+        return K8S_DENY_NONE;
+    }
+
+    if (list->uids > 0 && uid && *uid) {
+        len = strlen(uid);
+        if (len + 1 < KEY_MAX) {
+            key[0] = KEY_UID;
+            memcpy(key + 1, uid, len);
+            if (contains(list, key, len + 1)) {
+                result = K8S_DENY_UID;
+            }
+        }
+    }
+
+    if (result == K8S_DENY_NONE && list->names > 0 && ns && name) {
+        const char *patterns[4][2] = {
+            { ns, name }, { ns, "*" }, { "*", name }, { "*", "*" }
+        };
+        for (int i = 0; i < 4 && result == K8S_DENY_NONE; i++) {
+            len = name_key(key, patterns[i][0], patterns[i][1]);
+            if (len && contains(list, key, len)) {
+                result = K8S_DENY_NAME;
+            }
+        }
+    }
+    release(list);
+
+    return result;
+}
+
+int k8s_denylist_count(void) {
+    denylist_t *list = acquire();
+    int count = list ? list->count : 0;
+    release(list);
+    return count;
+}
+
+void k8s_denylist_shutdown(void) {
+    k8s_mutex_lock(&list_lock);
+    publish(NULL);
+    while (retired_head) {
+        denylist_t *list = retired_head;
+        retired_head = list->next_retired;
+        free_list(list);
+    }
+    retired_tail = NULL;
+
+    free(list_path);
+    list_path = NULL;
+    have_loaded = 0;
+    warned = 0;
+    k8s_mutex_unlock(&list_lock);
+}
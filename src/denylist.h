@@ -0,0 +1,105 @@
+/*
+ * Revocation Denylist
+ *
+ * Lets an operator shut out a token or ServiceAccount immediately, without
+ * waiting for it to expire or restarting mariadbd. The denylist file is
+ * memory-mapped and parsed into an open-addressing hash index that is
+ * published as one immutable list, so a login checks it with a single
+ * atomic load and a few probes however long the list is. A changed file is
+ * indexed off the login path and swapped in atomically; replaced lists are
+ * freed once no login uses them any more.
+ *
+ * One entry per line; blank lines and lines starting with # are ignored:
+ *
+ *   sha256:<64 hex digits>   a token, by the SHA-256 of the token as sent
+ *   uid:<uid>                a ServiceAccount, by UID
+ *   <namespace>/<name>       a ServiceAccount, by name; either part may be *
+ */
+
+#ifndef K8S_DENYLIST_H
+#define K8S_DENYLIST_H
+
+/* Largest denylist file that is loaded */
+#define K8S_DENYLIST_MAX_SIZE (16 * 1024 * 1024)
+
+/* Minimum age in seconds of a replaced list before it may be freed */
+#define K8S_DENYLIST_GRACE_SECONDS 10
+
+typedef enum {
+    K8S_DENY_NONE,
+    K8S_DENY_TOKEN,                  /* Token hash is listed */
+    K8S_DENY_UID,                    /* ServiceAccount UID is listed */
+    K8S_DENY_NAME                    /* namespace/name matches a listed pattern */
+} k8s_deny_t;
+
+/**
+ * Set the denylist file
+ *
+ * The file is read by the next k8s_denylist_reload(). An empty path drops
+ * the current list at once.
+ *
+ * @param path Denylist file (copied); NULL or empty disables the denylist
+ */
+void k8s_denylist_configure(const char *path);
+
+/**
+ * Index the denylist file again if it changed since the last load
+ *
+ * A change is detected by inode, size or modification time. A missing,
+ * unreadable or oversized file keeps the current list, so revocations are
+ * never lifted by accident; lines that cannot be parsed are skipped and
+ * logged. Also frees replaced lists older than K8S_DENYLIST_GRACE_SECONDS
+ * that no login uses any more.
+ *
+ * The file should be replaced by rename (as the kubelet does for mounted
+ * ConfigMaps), not rewritten in place, while it is being read.
+ *
+ * @return 1 if a new list was installed, 0 otherwise
+ */
+int k8s_denylist_reload(void);
+
+/**
+ * Check a client token against the listed token hashes
+ *
+ * The token is only hashed when the list holds token entries.
+ *
+ * @param token Token as sent by the client
+ * @return K8S_DENY_TOKEN if listed, K8S_DENY_NONE otherwise
+ */
+k8s_deny_t k8s_denylist_check_token(const char *token);
+
+/**
+ * Check the SHA-256 of a token against the listed token hashes
+ *
+ * For callers that no longer have the token itself (session tickets).
+ *
+ * @param digest SHA-256 of the token (32 bytes)
+ * @return K8S_DENY_TOKEN if listed, K8S_DENY_NONE otherwise
+ */
+k8s_deny_t k8s_denylist_check_digest(const unsigned char *digest);
+
+/**
+ * Check an authenticated ServiceAccount against the listed UIDs and names
+ *
+ * @param ns Namespace
+ * @param name ServiceAccount name
+ * @param uid ServiceAccount UID (NULL or empty skips the UID check)
+ * @return Why the ServiceAccount is denied, or K8S_DENY_NONE
+ */
+k8s_deny_t k8s_denylist_check_identity(const char *ns, const char *name, const char *uid);
+
+/**
+ * Number of entries in the current list
+ *
+ * @return Entry count, 0 if no list is loaded
+ */
+int k8s_denylist_count(void);
+
+/**
+ * Free the current and all replaced lists and forget the path
+ *
+ * Only safe once no login can check the list.
+ */
+void k8s_denylist_shutdown(void);
+
+#endif /* K8S_DENYLIST_H */
@@ -0,0 +1,545 @@
+/*
+ * Federated Validator Client Implementation
+ */
+
+#include "federated.h"
+#include "federated_protocol.h"
+#include "instrumentation.h"
+#include "stats.h"
+#include "log.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+_Static_assert(K8S_FEDERATED_PATH_MAX < sizeof(((struct sockaddr_un *)0)->sun_path),
+               "K8S_FEDERATED_PATH_MAX exceeds sun_path");
+_Static_assert((K8S_FEDERATED_INFLIGHT & (K8S_FEDERATED_INFLIGHT - 1)) == 0,
+               "K8S_FEDERATED_INFLIGHT must be a power of two");
+
+#define SLOT_FREE 0
+#define SLOT_WAITING 1                /* Sent, answer not read yet */
+#define SLOT_DONE 2                   /* info filled, or the socket broke */
+
+/* Longest string of a frame */
+#define STRING_MAX 65535
+
+/* Fields of a VALID result, in frame order */
+#define RESULT_FIELDS 7
+
+typedef struct {
+    uint32_t id;                    /* Its index modulo K8S_FEDERATED_INFLIGHT */
+    int state;                      /* SLOT_*; read without locks */
+    k8s_token_info_t *info;         /* The waiter's, filled under recv_lock */
+} slot_t;
+
+typedef struct {
+    int fd;
+    int users;                      /* Callers holding it, under pool_lock */
+    int detached;                   /* Out of sockets[], freed by the last user */
+    int broken;                     /* Takes no more requests */
+
+    k8s_mutex_t send_lock;          /* Whole frames, slot claims, seq */
+    uint32_t seq;
+    slot_t slots[K8S_FEDERATED_INFLIGHT];
+
+    k8s_mutex_t recv_lock;          /* The one reader, which fills every slot */
+    size_t have;                    /* Bytes of in read but not handled */
+    unsigned char in[K8S_FEDERATED_FRAME_MAX];
+} fed_socket_t;
+
+static k8s_mutex_t pool_lock = K8S_MUTEX_INITIALIZER(K8S_MUTEX_FEDERATED);
+static char socket_path[K8S_FEDERATED_PATH_MAX + 1];
+static fed_socket_t *sockets[K8S_FEDERATED_SOCKETS];
+static unsigned next_socket = 0;
+static int configured = 0;
+static time_t retry_at = 0;         /* No connect before then */
+
+static void put_u16(unsigned char *p, size_t v) {
+    p[0] = (unsigned char)(v >> 8);
+    p[1] = (unsigned char)v;
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static unsigned char *put_string(unsigned char *p, const char *s, size_t len) {
+    put_u16(p, len);
+    memcpy(p + 2, s, len);
+    return p + 2 + len;
+}
+
+/* Size of the VALIDATE frame of a token, 0 if it does not fit */
+static size_t request_size(size_t cluster_len, size_t audience_len, const char *token) {
+    size_t token_len = strlen(token);
+    size_t size = K8S_FEDERATED_HEADER_LEN + 6 + cluster_len + audience_len + token_len;
+
+    if (cluster_len > STRING_MAX || audience_len > STRING_MAX || token_len > STRING_MAX ||
+        size > K8S_FEDERATED_FRAME_MAX) {
+        return 0;
+    }
+    return size;
+}
+
+/* The id is patched in once a slot is claimed */
+static void encode_request(unsigned char *p, size_t size, const char *cluster,
+                           const char *audience, const char *token) {
+    put_u32(p, (uint32_t)(size - 4));
+    p[4] = K8S_FEDERATED_MSG_VALIDATE;
+    p += K8S_FEDERATED_HEADER_LEN;
+    p = put_string(p, cluster, strlen(cluster));
+    p = put_string(p, audience, strlen(audience));
+    put_string(p, token, strlen(token));
+}
+
+static void socket_free(fed_socket_t *s) {
+    close(s->fd);
+    k8s_mutex_destroy(&s->send_lock);
+    k8s_mutex_destroy(&s->recv_lock);
+    k8s_free(s);
+}
+
+/* Called with pool_lock held */
+static fed_socket_t *socket_open(const char *path) {
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+
+    if (fd < 0) {
+        K8S_LOG(K8S_LOG_ERROR, "federated_unavailable", "path=\"%s\" error=\"%s\"", path,
+                strerror(errno));
+        return NULL;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        K8S_LOG(K8S_LOG_WARNING, "federated_unavailable", "path=\"%s\" error=\"%s\"", path,
+                strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    fed_socket_t *s = k8s_calloc(K8S_MEM_FEDERATED, 1, sizeof(*s));
+    if (!s) {
+        K8S_LOG(K8S_LOG_ERROR, "out_of_memory", "where=federated_socket");
+        close(fd);
+        return NULL;
+    }
+    s->fd = fd;
+    k8s_mutex_init(&s->send_lock, K8S_MUTEX_FEDERATED_SOCKET);
+    k8s_mutex_init(&s->recv_lock, K8S_MUTEX_FEDERATED_SOCKET);
+    K8S_LOG(K8S_LOG_DEBUG, "federated_connected", "path=\"%s\"", path);
+    return s;
+}
+
+/* Called with pool_lock held */
+static void socket_detach(int i) {
+    fed_socket_t *s = sockets[i];
+
+    sockets[i] = NULL;
+    if (s->users == 0) {
+        socket_free(s);
+    } else {
+        s->detached = 1;
+    }
+}
+
+/* A socket for one exchange, opened if need be; NULL if there is none */
+static fed_socket_t *socket_acquire(void) {
+    fed_socket_t *s = NULL;
+
+    k8s_mutex_lock(&pool_lock);
+    if (socket_path[0]) {
+        int i = (int)(next_socket++ % K8S_FEDERATED_SOCKETS);
+        if (sockets[i] && __atomic_load_n(&sockets[i]->broken, __ATOMIC_ACQUIRE)) {
+            socket_detach(i);
+        }
+        if (!sockets[i] && time(NULL) >= retry_at) {
+            sockets[i] = socket_open(socket_path);
+            if (!sockets[i]) {
+                __atomic_store_n(&retry_at, time(NULL) + K8S_FEDERATED_RETRY_SECONDS,
+                                 __ATOMIC_RELAXED);
+            }
+        }
+        s = sockets[i];
+        if (s) {
+            s->users++;
+        }
+    }
+    k8s_mutex_unlock(&pool_lock);
+    return s;
+}
+
+static void socket_release(fed_socket_t *s) {
+    k8s_mutex_lock(&pool_lock);
+    if (--s->users == 0 && s->detached) {
+        socket_free(s);
+    }
+    k8s_mutex_unlock(&pool_lock);
+}
+
+/*
+ * Close a socket to new requests and give its waiters no verdict. Called
+ * with recv_lock held, so no answer is being filled in.
+ */
+static void socket_break(fed_socket_t *s) {
+    k8s_mutex_lock(&s->send_lock);
+    __atomic_store_n(&s->broken, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < K8S_FEDERATED_INFLIGHT; i++) {
+        slot_t *slot = &s->slots[i];
+        if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) == SLOT_WAITING) {
+            memset(slot->info, 0, sizeof(*slot->info));
+            __atomic_store_n(&slot->state, SLOT_DONE, __ATOMIC_RELEASE);
+        }
+    }
+    k8s_mutex_unlock(&s->send_lock);
+    shutdown(s->fd, SHUT_RDWR);
+}
+
+static int send_all(int fd, const unsigned char *buf, size_t len, uint64_t deadline) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n > 0) {
+            buf += n;
+            len -= (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            return 0;
+        }
+        uint64_t now = k8s_stats_now_usec();
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        if (now >= deadline) {
+            errno = ETIMEDOUT;
+            return 0;
+        }
+        poll(&pfd, 1, (int)((deadline - now + 999) / 1000));
+    }
+    return 1;
+}
+
+/* Copy a string of a frame into a field; 0 if it does not fit */
+static int take_string(const unsigned char **p, const unsigned char *end, char *out,
+                       size_t size) {
+    if (end - *p < 2) {
+        return 0;
+    }
+    size_t len = (size_t)(*p)[0] << 8 | (*p)[1];
+    if ((size_t)(end - *p - 2) < len || len >= size) {
+        return 0;
+    }
+    memcpy(out, *p + 2, len);
+    out[len] = '\0';
+    *p += 2 + len;
+    return 1;
+}
+
+/*
+ * Hand out the first buffered answer. Called with recv_lock held.
+ *
+ * @return 1 if an answer was handed out, 0 if none is complete, -1 if the
+ *         validator broke the protocol
+ */
+static int dispatch(fed_socket_t *s) {
+    if (s->have < 4) {
+        return 0;
+    }
+    size_t len = get_u32(s->in);
+    if (len < K8S_FEDERATED_HEADER_LEN - 4 + 1 || len > K8S_FEDERATED_FRAME_MAX - 4) {
+        return -1;
+    }
+    if (s->have < len + 4) {
+        return 0;
+    }
+
+    const unsigned char *p = s->in + K8S_FEDERATED_HEADER_LEN;
+    const unsigned char *end = s->in + 4 + len;
+    uint32_t id = get_u32(s->in + 5);
+    slot_t *slot = &s->slots[id % K8S_FEDERATED_INFLIGHT];
+    if (s->in[4] != K8S_FEDERATED_MSG_RESULT ||
+        __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != SLOT_WAITING || slot->id != id) {
+        return -1;
+    }
+
+    k8s_token_info_t *info = slot->info;
+    int status = *p++;
+    memset(info, 0, sizeof(*info));
+    if (status == K8S_FEDERATED_VALID) {
+        struct {
+            char *out;
+            size_t size;
+        } fields[RESULT_FIELDS] = {
+            { info->namespace, sizeof(info->namespace) },
+            { info->service_account, sizeof(info->service_account) },
+            { info->username, sizeof(info->username) },
+            { info->uid, sizeof(info->uid) },
+            { info->groups, sizeof(info->groups) },
+            { info->pod_name, sizeof(info->pod_name) },
+            { info->pod_uid, sizeof(info->pod_uid) },
+        };
+        for (int i = 0; i < RESULT_FIELDS; i++) {
+            if (!take_string(&p, end, fields[i].out, fields[i].size)) {
+                return -1;
+            }
+        }
+        info->authenticated = 1;
+        info->validated_at = time(NULL);
+    } else if (status != K8S_FEDERATED_REJECTED && status != K8S_FEDERATED_UNAVAILABLE) {
+        return -1;
+    }
+    if (p != end) {
+        return -1;
+    }
+    info->reviewed = status != K8S_FEDERATED_UNAVAILABLE;
+    __atomic_store_n(&slot->state, SLOT_DONE, __ATOMIC_RELEASE);
+
+    s->have -= len + 4;
+    memmove(s->in, s->in + len + 4, s->have);
+    return 1;
+}
+
+static int all_done(const fed_socket_t *s, const int *claimed, int n) {
+    for (int i = 0; i < n; i++) {
+        if (__atomic_load_n(&s->slots[claimed[i]].state, __ATOMIC_ACQUIRE) != SLOT_DONE) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Read answers until those of claimed are in. Whoever holds recv_lock
+ * reads for every waiter of the socket, so a waiter whose answer came in
+ * meanwhile finds it handed out once it gets the lock.
+ */
+static void await(fed_socket_t *s, const int *claimed, int n, uint64_t deadline) {
+    k8s_mutex_lock(&s->recv_lock);
+    while (!all_done(s, claimed, n)) {
+        int handled = dispatch(s);
+        if (handled < 0) {
+            K8S_LOG(K8S_LOG_ERROR, "federated_protocol_error", "frame_len=%u",
+                    (unsigned)get_u32(s->in));
+            socket_break(s);
+            break;
+        }
+        if (handled > 0) {
+            continue;
+        }
+
+        uint64_t now = k8s_stats_now_usec();
+        if (now >= deadline) {
+            K8S_LOG(K8S_LOG_WARNING, "federated_timeout", "requests=%d", n);
+            socket_break(s);
+            break;
+        }
+        struct pollfd pfd = { s->fd, POLLIN, 0 };
+        if (poll(&pfd, 1, (int)((deadline - now + 999) / 1000)) <= 0) {
+            continue;
+        }
+        ssize_t got = recv(s->fd, s->in + s->have, sizeof(s->in) - s->have, 0);
+        if (got > 0) {
+            s->have += (size_t)got;
+        } else if (got == 0 || (errno != EAGAIN && errno != EINTR)) {
+            K8S_LOG(K8S_LOG_WARNING, "federated_closed", "error=\"%s\"",
+                    got == 0 ? "end of stream" : strerror(errno));
+            socket_break(s);
+            break;
+        }
+    }
+    k8s_mutex_unlock(&s->recv_lock);
+}
+
+/*
+ * Send one request per token in a single write and wait for the answers.
+ * Tokens the socket has no free slot for are not sent.
+ *
+ * @return Number of tokens sent
+ */
+static int exchange(fed_socket_t *s, const char *cluster, const char *const *tokens, int n,
+                    const char *audience, k8s_token_info_t **infos, uint64_t deadline) {
+    size_t cluster_len = strlen(cluster);
+    size_t audience_len = strlen(audience);
+    size_t sizes[K8S_FEDERATED_INFLIGHT];
+    int claimed[K8S_FEDERATED_INFLIGHT];
+    size_t total = 0;
+    int sent = 0;
+    int failed = 0;
+
+    for (int i = 0; i < n; i++) {
+        sizes[i] = request_size(cluster_len, audience_len, tokens[i]);
+        total += sizes[i];
+    }
+    unsigned char *buf = total ? k8s_malloc(K8S_MEM_FEDERATED, total) : NULL;
+    if (!buf) {
+        return 0;
+    }
+
+    /* Oversized tokens get no verdict */
+    size_t len = 0;
+    int frames[K8S_FEDERATED_INFLIGHT];
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        if (sizes[i]) {
+            encode_request(buf + len, sizes[i], cluster, audience, tokens[i]);
+            len += sizes[i];
+            frames[m++] = i;
+        }
+    }
+
+    k8s_mutex_lock(&s->send_lock);
+    if (!__atomic_load_n(&s->broken, __ATOMIC_ACQUIRE)) {
+        size_t off = 0;
+        for (int c = 0; c < K8S_FEDERATED_INFLIGHT && sent < m; c++) {
+            slot_t *slot = &s->slots[c];
+            if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != SLOT_FREE) {
+                continue;
+            }
+            /* The id names the slot its answer goes to */
+            slot->id = s->seq++ * K8S_FEDERATED_INFLIGHT + (uint32_t)c;
+            slot->info = infos[frames[sent]];
+            __atomic_store_n(&slot->state, SLOT_WAITING, __ATOMIC_RELEASE);
+            put_u32(buf + off + 5, slot->id);
+            off += sizes[frames[sent]];
+            claimed[sent++] = c;
+        }
+        failed = sent > 0 && !send_all(s->fd, buf, off, deadline);
+    }
+    k8s_mutex_unlock(&s->send_lock);
+    k8s_free(buf);
+
+    /* Part of a frame may have gone out: the stream is lost */
+    if (failed) {
+        K8S_LOG(K8S_LOG_WARNING, "federated_closed", "error=\"%s\"", strerror(errno));
+        k8s_mutex_lock(&s->recv_lock);
+        socket_break(s);
+        k8s_mutex_unlock(&s->recv_lock);
+    }
+
+    if (sent > 0) {
+        await(s, claimed, sent, deadline);
+        for (int k = 0; k < sent; k++) {
+            __atomic_store_n(&s->slots[claimed[k]].state, SLOT_FREE, __ATOMIC_RELEASE);
+        }
+    }
+    return sent;
+}
+
+void k8s_federated_configure(const char *path) {
+    size_t len = path ? strlen(path) : 0;
+
+    if (len > K8S_FEDERATED_PATH_MAX) {
+        K8S_LOG(K8S_LOG_ERROR, "federated_invalid", "path=\"%s\" reason=too_long "
+                "action=disable", path);
+        len = 0;
+    }
+    k8s_mutex_lock(&pool_lock);
+    for (int i = 0; i < K8S_FEDERATED_SOCKETS; i++) {
+        if (sockets[i]) {
+            socket_detach(i);
+        }
+    }
+    memcpy(socket_path, path ? path : "", len);
+    socket_path[len] = '\0';
+    __atomic_store_n(&retry_at, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&configured, len > 0, __ATOMIC_RELEASE);
+    k8s_mutex_unlock(&pool_lock);
+}
+
+int k8s_federated_ready(void) {
+    return __atomic_load_n(&configured, __ATOMIC_ACQUIRE) &&
+           __atomic_load_n(&retry_at, __ATOMIC_RELAXED) <= time(NULL);
+}
+
+int k8s_federated_validate(const char *cluster, const char *token, const char *audience,
+                           k8s_token_info_t *info, int timeout_ms) {
+    uint64_t started = k8s_stats_now_usec();
+    uint64_t deadline = started + (uint64_t)timeout_ms * 1000;
+
+    memset(info, 0, sizeof(*info));
+    if (!request_size(cluster ? strlen(cluster) : 0, audience ? strlen(audience) : 0, token)) {
+        K8S_LOG(K8S_LOG_WARNING, "federated_skipped", "reason=too_long token_len=%zu",
+                strlen(token));
+        return 0;
+    }
+    /* A socket with every slot taken or broken hands over to the next */
+    for (int attempt = 0; attempt < K8S_FEDERATED_SOCKETS; attempt++) {
+        fed_socket_t *s = socket_acquire();
+        if (!s) {
+            break;
+        }
+        int sent = exchange(s, cluster ? cluster : "", &token, 1, audience ? audience : "",
+                            &info, deadline);
+        socket_release(s);
+        if (sent) {
+            break;
+        }
+    }
+    info->timing.total_us = k8s_stats_now_usec() - started;
+    return info->reviewed && info->authenticated;
+}
+
+int k8s_federated_validate_batch(const char *const *tokens, int count, const char *audience,
+                                 k8s_token_info_t *infos, int timeout_ms, int concurrency) {
+    int window = concurrency < 1 ? 1 :
+                 concurrency > K8S_FEDERATED_INFLIGHT ? K8S_FEDERATED_INFLIGHT : concurrency;
+    const char *group[K8S_FEDERATED_INFLIGHT];
+    k8s_token_info_t *outs[K8S_FEDERATED_INFLIGHT];
+    int verdicts = 0;
+    int i = 0;
+
+    if (count <= 0) {
+        return 0;
+    }
+    memset(infos, 0, (size_t)count * sizeof(k8s_token_info_t));
+    while (i < count) {
+        int n = 0;
+        for (; i < count && n < window; i++) {
+            if (tokens[i]) {
+                group[n] = tokens[i];
+                outs[n++] = &infos[i];
+            }
+        }
+        if (n == 0) {
+            break;
+        }
+        fed_socket_t *s = socket_acquire();
+        if (!s) {
+            break;
+        }
+        exchange(s, "", group, n, audience ? audience : "", outs,
+                 k8s_stats_now_usec() + (uint64_t)timeout_ms * 1000);
+        socket_release(s);
+        for (int k = 0; k < n; k++) {
+            verdicts += outs[k]->reviewed;
+        }
+    }
+    return verdicts;
+}
+
+int k8s_federated_sockets(void) {
+    int open = 0;
+
+    k8s_mutex_lock(&pool_lock);
+    for (int i = 0; i < K8S_FEDERATED_SOCKETS; i++) {
+        open += sockets[i] && !__atomic_load_n(&sockets[i]->broken, __ATOMIC_ACQUIRE);
+    }
+    k8s_mutex_unlock(&pool_lock);
+    return open;
+}
+
+void k8s_federated_shutdown(void) {
+    k8s_federated_configure(NULL);
+}
@@ -0,0 +1,89 @@
+/*
+ * Federated Validator Client
+ *
+ * Asks a token validator on the same node, such as kube-federated-auth, over
+ * a Unix socket with the binary frames of federated_protocol.h instead of
+ * HTTP and JSON. A few sockets are kept open and shared by all callers:
+ * each caller writes its request and waits for the answer with its id,
+ * while requests of other callers are in flight on the same socket, and a
+ * batch goes out in one write. Whichever waiter holds a socket's read side
+ * hands out every answer it reads, so no thread is dedicated to it.
+ *
+ * A socket that times out or breaks the protocol is closed and its waiters
+ * get no verdict; the next caller opens a new one.
+ */
+
+#ifndef K8S_FEDERATED_H
+#define K8S_FEDERATED_H
+
+#include "tokenreview_api.h"
+
+/* Sockets kept open to the validator */
+#define K8S_FEDERATED_SOCKETS 4
+
+/* Most requests in flight per socket */
+#define K8S_FEDERATED_INFLIGHT 32
+
+/* Longest socket path (sun_path) */
+#define K8S_FEDERATED_PATH_MAX 107
+
+/* Seconds a failed connect is not retried */
+#define K8S_FEDERATED_RETRY_SECONDS 1
+
+/**
+ * Set the validator's socket
+ *
+ * Open sockets to a previous path are closed once their requests are done.
+ *
+ * @param path Socket path (copied); NULL or empty disables the validator
+ */
+void k8s_federated_configure(const char *path);
+
+/**
+ * Whether the validator is worth asking now
+ *
+ * @return 1 if a socket is configured and the last connect did not fail
+ *         within K8S_FEDERATED_RETRY_SECONDS, 0 otherwise
+ */
+int k8s_federated_ready(void);
+
+/**
+ * Validate a token with the validator
+ *
+ * @param cluster Cluster the token is of, NULL for the validator's own
+ * @param token Token as sent by the client
+ * @param audience Audience the token must be issued for, or NULL
+ * @param info Result; reviewed is 1 if the validator returned a verdict
+ * @param timeout_ms Most time to wait for the answer
+ * @return 1 if the token is valid, 0 otherwise
+ */
+int k8s_federated_validate(const char *cluster, const char *token, const char *audience,
+                           k8s_token_info_t *info, int timeout_ms);
+
+/**
+ * Validate several tokens, pipelined on one socket
+ *
+ * @param tokens Tokens to validate (NULL entries are skipped)
+ * @param count Number of tokens
+ * @param audience Audience the tokens must be issued for, or NULL
+ * @param infos Output, one entry per token, as for k8s_federated_validate()
+ * @param timeout_ms Most time to wait for each group of answers
+ * @param concurrency Most requests in flight at once
+ * @return Number of tokens the validator returned a verdict for
+ */
+int k8s_federated_validate_batch(const char *const *tokens, int count, const char *audience,
+                                 k8s_token_info_t *infos, int timeout_ms, int concurrency);
+
+/**
+ * @return Number of open sockets
+ */
+int k8s_federated_sockets(void);
+
+/**
+ * Close every socket and forget the path
+ *
+ * Only safe once no caller can be waiting for an answer.
+ */
+void k8s_federated_shutdown(void);
+
+#endif /* K8S_FEDERATED_H */
@@ -0,0 +1,42 @@
+/*
+ * Federated Validator Protocol
+ *
+ * Frames between the plugin and a node-local token validator (such as
+ * kube-federated-auth) on a Unix stream socket. Every frame is a 4-byte
+ * big-endian length of the rest of the frame, a type byte and a 4-byte
+ * big-endian request id the client chose:
+ *
+ *   VALIDATE <cluster> <audience> <token>
+ *   RESULT   <status> [<namespace> <service_account> <username> <uid>
+ *                      <groups> <pod_name> <pod_uid>]
+ *
+ * Strings are a 2-byte big-endian length followed by that many bytes,
+ * without a terminating NUL; an empty cluster is the validator's own and an
+ * empty audience the API server's. RESULT carries the strings only with
+ * status VALID; groups are separated by newlines.
+ *
+ * A client may send any number of VALIDATE frames without waiting; each is
+ * answered by exactly one RESULT with its id, in any order. A malformed
+ * frame ends the connection.
+ *
+ * Shared by the plugin and the validator; keep it free of server-only
+ * headers.
+ */
+
+#ifndef K8S_FEDERATED_PROTOCOL_H
+#define K8S_FEDERATED_PROTOCOL_H
+
+#define K8S_FEDERATED_MSG_VALIDATE 'V'  /* client: validate a token */
+#define K8S_FEDERATED_MSG_RESULT 'R'    /* validator: the verdict on one */
+
+#define K8S_FEDERATED_VALID 0           /* The token is valid, fields follow */
+#define K8S_FEDERATED_REJECTED 1        /* The token is not valid */
+#define K8S_FEDERATED_UNAVAILABLE 2     /* No verdict, e.g. API server unreachable */
+
+/* Length prefix, type and request id */
+#define K8S_FEDERATED_HEADER_LEN 9
+
+/* Longest frame, length prefix included */
+#define K8S_FEDERATED_FRAME_MAX 65536
+
+#endif /* K8S_FEDERATED_PROTOCOL_H */
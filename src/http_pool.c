@@ -0,0 +1,507 @@
+/*
+ * Warm Connection Pool Implementation
+ */
+
+#include "http_pool.h"
+#include "resolver.h"
+#include "ca_store.h"
+#include "instrumentation.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/* TCP keepalive probes keep idle connections from being dropped by NAT/LBs */
+#define TCP_KEEPIDLE_SECONDS 30
+#define TCP_KEEPINTVL_SECONDS 10
+
+typedef struct {
+    CURL *curl;                   /* NULL until first use or after a failed transfer */
+    int busy;                     /* Checked out by a caller */
+    time_t last_used;             /* Time the handle was last returned */
+    struct curl_slist *resolve;   /* CURLOPT_RESOLVE list last given to curl */
+    unsigned resolve_gen;         /* Generation of resolve (0: not applied) */
+} pool_slot_t;
+
+struct k8s_http_pool {
+    k8s_config_t config;           /* Points at the owned copies below */
+    char *api_server_url;
+    char *ca_cert_path;
+    char *token_path;
+
+    CURLSH *share;                 /* Shared DNS, TLS session and connection caches */
+    k8s_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+
+    k8s_mutex_t lock;              /* Protects slots, credential and resolve entry */
+    int size;
+    pool_slot_t slots[K8S_HTTP_POOL_MAX_SIZE];
+    char *credential;              /* Bearer token for API calls */
+    k8s_ca_store_t *ca_store;      /* Parsed CA bundle, NULL until loadable */
+
+    k8s_resolver_t resolver;       /* API server host and port */
+    char resolve_entry[K8S_RESOLVER_MAX_ENTRY_LEN];  /* Pinned "host:port:addrs" */
+    unsigned resolve_gen;          /* Bumped whenever resolve_entry changes */
+};
+
+static void share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+    (void)handle;
+    (void)access;
+    k8s_http_pool_t *pool = (k8s_http_pool_t *)userptr;
+    k8s_mutex_lock(&pool->share_locks[data]);
+}
+
+static void share_unlock(CURL *handle, curl_lock_data data, void *userptr) {
+    (void)handle;
+    k8s_http_pool_t *pool = (k8s_http_pool_t *)userptr;
+    k8s_mutex_unlock(&pool->share_locks[data]);
+}
+
+static size_t discard_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+    (void)contents;
+    (void)userp;
+    return size * nmemb;
+}
+
+/**
+ * Apply the options every pooled handle carries across curl_easy_reset()
+ */
+static void apply_pool_options(k8s_http_pool_t *pool, CURL *curl) {
+    curl_easy_setopt(curl, CURLOPT_SHARE, pool->share);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, (long)TCP_KEEPIDLE_SECONDS);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, (long)TCP_KEEPINTVL_SECONDS);
+}
+
+/**
+ * Hand the current pinned addresses to a pooled handle
+ *
+ * Entries given through CURLOPT_RESOLVE land in the shared DNS cache and
+ * never expire there, so each slot only needs to pass a new generation
+ * once; other handles, including temporary ones, then find it in the cache.
+ * The caller must own the slot (busy).
+ */
+static void apply_resolve(k8s_http_pool_t *pool, pool_slot_t *slot) {
+    char entry[K8S_RESOLVER_MAX_ENTRY_LEN];
+    unsigned gen;
+
+    k8s_mutex_lock(&pool->lock);
+    gen = pool->resolve_gen;
+    if (gen == slot->resolve_gen) {
+        k8s_mutex_unlock(&pool->lock);
+        return;
+    }
+    memcpy(entry, pool->resolve_entry, sizeof(entry));
+    k8s_mutex_unlock(&pool->lock);
+
+    struct curl_slist *list = curl_slist_append(NULL, entry);
+    if (!list) {
+        return;
+    }
+    curl_easy_setopt(slot->curl, CURLOPT_RESOLVE, list);
+    curl_slist_free_all(slot->resolve);
+    slot->resolve = list;
+    slot->resolve_gen = gen;
+}
+
+static CURL *new_handle(k8s_http_pool_t *pool) {
+    CURL *curl = curl_easy_init();
+    if (!curl) {
+        K8S_LOG(K8S_LOG_ERROR, "init_failed", "reason=curl_handle");
+        return NULL;
+    }
+    apply_pool_options(pool, curl);
+    return curl;
+}
+
+void k8s_http_apply_common(CURL *curl, const k8s_config_t *config) {
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)config->timeout_seconds);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+    /* SSL/TLS configuration */
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
+
+    /* Verify against the pool's parsed CA store when there is one, so that
+     * new connections skip reading and decoding the PEM file */
+    k8s_ca_store_t *ca_store = config->pool ?
+        __atomic_load_n(&config->pool->ca_store, __ATOMIC_ACQUIRE) : NULL;
+    if (!ca_store || !k8s_ca_store_apply(curl, ca_store)) {
+        curl_easy_setopt(curl, CURLOPT_CAINFO, config->ca_cert_path);
+    }
+}
+
+k8s_http_pool_t *k8s_http_pool_create(const k8s_config_t *config, int size) {
+    if (!config || size < 1) {
+        return NULL;
+    }
+    if (size > K8S_HTTP_POOL_MAX_SIZE) {
+        size = K8S_HTTP_POOL_MAX_SIZE;
+    }
+
+    k8s_http_pool_t *pool = k8s_calloc(K8S_MEM_POOL, 1, sizeof(k8s_http_pool_t));
+    if (!pool) {
+        return NULL;
+    }
+
+    pool->api_server_url = strdup(config->api_server_url);
+    pool->ca_cert_path = strdup(config->ca_cert_path);
+    pool->token_path = strdup(config->token_path);
+    pool->share = curl_share_init();
+    if (!pool->api_server_url || !pool->ca_cert_path || !pool->token_path || !pool->share) {
+        K8S_LOG(K8S_LOG_ERROR, "out_of_memory", "where=pool");
+        curl_share_cleanup(pool->share);
+        free(pool->api_server_url);
+        free(pool->ca_cert_path);
+        free(pool->token_path);
+        k8s_free(pool);
+        return NULL;
+    }
+
+    pool->config = *config;
+    pool->config.api_server_url = pool->api_server_url;
+    pool->config.ca_cert_path = pool->ca_cert_path;
+    pool->config.token_path = pool->token_path;
+    pool->config.pool = pool;
+    pool->size = size;
+
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        k8s_mutex_init(&pool->share_locks[i], K8S_MUTEX_POOL_SHARE);
+    }
+    k8s_mutex_init(&pool->lock, K8S_MUTEX_POOL);
+
+    curl_share_setopt(pool->share, CURLSHOPT_LOCKFUNC, share_lock);
+    curl_share_setopt(pool->share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    curl_share_setopt(pool->share, CURLSHOPT_USERDATA, pool);
+    curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    /* Connections live in the share, so any handle (including ones driven by
+     * the multi interface during warm-up) can reuse any idle connection */
+    curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+    if (!k8s_http_pool_refresh_credential(pool)) {
+        K8S_LOG(K8S_LOG_WARNING, "credential_missing", "path=\"%s\" action=retry",
+                pool->token_path);
+    }
+
+    pool->ca_store = k8s_ca_store_create(pool->ca_cert_path);
+    if (!pool->ca_store) {
+        K8S_LOG(K8S_LOG_WARNING, "ca_missing", "path=\"%s\" action=retry",
+                pool->ca_cert_path);
+    }
+
+    return pool;
+}
+
+void k8s_http_pool_destroy(k8s_http_pool_t *pool) {
+    if (!pool) {
+        return;
+    }
+
+    for (int i = 0; i < pool->size; i++) {
+        if (pool->slots[i].curl) {
+            curl_easy_cleanup(pool->slots[i].curl);
+        }
+        curl_slist_free_all(pool->slots[i].resolve);
+    }
+    curl_share_cleanup(pool->share);
+    k8s_ca_store_destroy(pool->ca_store);
+
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        k8s_mutex_destroy(&pool->share_locks[i]);
+    }
+    k8s_mutex_destroy(&pool->lock);
+
+    free(pool->credential);
+    free(pool->api_server_url);
+    free(pool->ca_cert_path);
+    free(pool->token_path);
+    k8s_free(pool);
+}
+
+CURL *k8s_http_pool_acquire(k8s_http_pool_t *pool) {
+    pool_slot_t *best = NULL;
+
+    k8s_mutex_lock(&pool->lock);
+    for (int i = 0; i < pool->size; i++) {
+        pool_slot_t *slot = &pool->slots[i];
+        if (slot->busy) {
+            continue;
+        }
+        /* Most recently used handle is the one most likely to be connected */
+        if (!best || (slot->curl && !best->curl) ||
+            (!slot->curl == !best->curl && slot->last_used > best->last_used)) {
+            best = slot;
+        }
+    }
+    if (best) {
+        best->busy = 1;
+    }
+    k8s_mutex_unlock(&pool->lock);
+
+    if (!best) {
+        /* Pool exhausted: use a temporary handle that still shares caches */
+        return new_handle(pool);
+    }
+
+    if (!best->curl) {
+        CURL *curl = new_handle(pool);
+        k8s_mutex_lock(&pool->lock);
+        best->curl = curl;
+        best->resolve_gen = 0;
+        if (!curl) {
+            best->busy = 0;
+        }
+        k8s_mutex_unlock(&pool->lock);
+        if (!curl) {
+            return NULL;
+        }
+    }
+
+    apply_resolve(pool, best);
+    return best->curl;
+}
+
+void k8s_http_pool_release(k8s_http_pool_t *pool, CURL *curl, int reusable) {
+    pool_slot_t *slot = NULL;
+
+    if (!curl) {
+        return;
+    }
+
+    k8s_mutex_lock(&pool->lock);
+    for (int i = 0; i < pool->size; i++) {
+        if (pool->slots[i].curl == curl) {
+            slot = &pool->slots[i];
+            break;
+        }
+    }
+    k8s_mutex_unlock(&pool->lock);
+
+    if (!slot) {
+        curl_easy_cleanup(curl);
+        return;
+    }
+
+    if (reusable) {
+        /* Drop per-request options (they point at caller memory) but keep
+         * the live connection and caches */
+        curl_easy_reset(curl);
+        apply_pool_options(pool, curl);
+    } else {
+        curl_easy_cleanup(curl);
+        curl = NULL;
+    }
+
+    k8s_mutex_lock(&pool->lock);
+    slot->curl = curl;
+    if (!curl) {
+        slot->resolve_gen = 0;
+    }
+    slot->last_used = time(NULL);
+    slot->busy = 0;
+    k8s_mutex_unlock(&pool->lock);
+}
+
+int k8s_http_pool_refresh_credential(k8s_http_pool_t *pool) {
+    char *credential = k8s_read_file(pool->token_path);
+    int loaded;
+
+    k8s_mutex_lock(&pool->lock);
+    if (credential) {
+        free(pool->credential);
+        pool->credential = credential;
+    }
+    /* On a failed read keep the previous credential: the kubelet swaps
+     * projected token files atomically, so failures are transient */
+    loaded = pool->credential != NULL;
+    k8s_mutex_unlock(&pool->lock);
+
+    return loaded;
+}
+
+int k8s_http_pool_auth_header(k8s_http_pool_t *pool, char *buf, size_t len) {
+    int ok = 0;
+
+    k8s_mutex_lock(&pool->lock);
+    int have_credential = pool->credential != NULL;
+    k8s_mutex_unlock(&pool->lock);
+
+    if (!have_credential && !k8s_http_pool_refresh_credential(pool)) {
+        return 0;
+    }
+
+    k8s_mutex_lock(&pool->lock);
+    if (pool->credential) {
+        int n = snprintf(buf, len, "Authorization: Bearer %s", pool->credential);
+        ok = n > 0 && (size_t)n < len;
+    }
+    k8s_mutex_unlock(&pool->lock);
+
+    return ok;
+}
+
+int k8s_http_pool_ping(k8s_http_pool_t *pool, int idle_seconds) {
+    pool_slot_t *batch[K8S_HTTP_POOL_MAX_SIZE];
+    int batch_count = 0;
+    int live = 0;
+    time_t now = time(NULL);
+
+    /* Check out every idle handle that is due */
+    k8s_mutex_lock(&pool->lock);
+    for (int i = 0; i < pool->size; i++) {
+        pool_slot_t *slot = &pool->slots[i];
+        if (!slot->busy && now - slot->last_used >= idle_seconds) {
+            slot->busy = 1;
+            batch[batch_count++] = slot;
+        }
+    }
+    k8s_mutex_unlock(&pool->lock);
+
+    if (batch_count == 0) {
+        return 0;
+    }
+
+    char url[1024];
+    snprintf(url, sizeof(url), "%s/livez", pool->api_server_url);
+
+    char auth_header[4096];
+    struct curl_slist *headers = NULL;
+    if (k8s_http_pool_auth_header(pool, auth_header, sizeof(auth_header))) {
+        headers = curl_slist_append(headers, auth_header);
+    }
+
+    CURLM *multi = curl_multi_init();
+    int results[K8S_HTTP_POOL_MAX_SIZE] = {0};
+
+    for (int i = 0; i < batch_count; i++) {
+        if (!batch[i]->curl) {
+            CURL *fresh = new_handle(pool);
+            k8s_mutex_lock(&pool->lock);
+            batch[i]->curl = fresh;
+            batch[i]->resolve_gen = 0;
+            k8s_mutex_unlock(&pool->lock);
+        }
+        CURL *curl = batch[i]->curl;
+        if (!curl || !multi) {
+            continue;
+        }
+        apply_resolve(pool, batch[i]);
+        k8s_http_apply_common(curl, &pool->config);
+        curl_easy_setopt(curl, CURLOPT_URL, url);
+        curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard_callback);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)K8S_HTTP_PING_TIMEOUT);
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *)&results[i]);
+        curl_multi_add_handle(multi, curl);
+    }
+
+    if (multi) {
+        int running = 0;
+        do {
+            if (curl_multi_perform(multi, &running) != CURLM_OK) {
+                break;
+            }
+            if (running) {
+                curl_multi_wait(multi, NULL, 0, 200, NULL);
+            }
+        } while (running);
+
+        CURLMsg *msg;
+        int pending;
+        while ((msg = curl_multi_info_read(multi, &pending)) != NULL) {
+            if (msg->msg == CURLMSG_DONE && msg->data.result == CURLE_OK) {
+                int *result = NULL;
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&result);
+                if (result) {
+                    *result = 1;
+                }
+            }
+        }
+
+        for (int i = 0; i < batch_count; i++) {
+            if (batch[i]->curl) {
+                curl_multi_remove_handle(multi, batch[i]->curl);
+            }
+        }
+        curl_multi_cleanup(multi);
+    }
+
+    /* Return the handles; reset clears the per-ping options */
+    for (int i = 0; i < batch_count; i++) {
+        CURL *curl = batch[i]->curl;
+        if (curl) {
+            curl_easy_reset(curl);
+            apply_pool_options(pool, curl);
+        }
+        live += results[i];
+    }
+
+    k8s_mutex_lock(&pool->lock);
+    for (int i = 0; i < batch_count; i++) {
+        batch[i]->last_used = now;
+        batch[i]->busy = 0;
+    }
+    k8s_mutex_unlock(&pool->lock);
+
+    curl_slist_free_all(headers);
+
+    return live;
+}
+
+int k8s_http_pool_resolve(k8s_http_pool_t *pool) {
+    char entry[K8S_RESOLVER_MAX_ENTRY_LEN];
+
+    if (!pool->resolver.host[0] && !k8s_resolver_init(&pool->resolver, pool->api_server_url)) {
+        /* IP literal or unparsable URL: nothing to pin */
+        pool->resolver.host[0] = '\0';
+        return 0;
+    }
+
+    int count = k8s_resolver_resolve(&pool->resolver, entry, sizeof(entry));
+    if (count == 0) {
+        /* Keep serving the previous addresses; stale beats a DNS outage */
+        K8S_LOG(K8S_LOG_WARNING, "resolve_failed", "host=%s action=keep_previous",
+                pool->resolver.host);
+        return 0;
+    }
+
+    k8s_mutex_lock(&pool->lock);
+    if (strcmp(entry, pool->resolve_entry) != 0) {
+        memcpy(pool->resolve_entry, entry, sizeof(entry));
+        pool->resolve_gen++;
+        if (pool->resolve_gen == 0) {
+            pool->resolve_gen = 1;
+        }
+        K8S_LOG(K8S_LOG_INFO, "address_pinned", "entry=%s", entry);
+    }
+    k8s_mutex_unlock(&pool->lock);
+
+    return count;
+}
+
+int k8s_http_pool_pinned(k8s_http_pool_t *pool, char *entry, size_t len) {
+    k8s_mutex_lock(&pool->lock);
+    int n = pool->resolve_entry[0] ? snprintf(entry, len, "%s", pool->resolve_entry) : 0;
+    k8s_mutex_unlock(&pool->lock);
+    return n > 0 && (size_t)n < len;
+}
+
+int k8s_http_pool_reload_ca(k8s_http_pool_t *pool) {
+    if (pool->ca_store) {
+        return k8s_ca_store_reload(pool->ca_store);
+    }
+
+    /* Only the housekeeping thread creates the store, readers just need to
+     * see a fully built one */
+    k8s_ca_store_t *ca_store = k8s_ca_store_create(pool->ca_cert_path);
+    if (!ca_store) {
+        return 0;
+    }
+    __atomic_store_n(&pool->ca_store, ca_store, __ATOMIC_RELEASE);
+    K8S_LOG(K8S_LOG_INFO, "ca_loaded", "path=\"%s\" certificates=%d",
+            pool->ca_cert_path, k8s_ca_store_count(ca_store));
+    return 1;
+}
@@ -0,0 +1,156 @@
+/*
+ * Warm Connection Pool for Kubernetes API Server Requests
+ *
+ * Keeps a small set of libcurl easy handles and the connections to the API
+ * server open between logins. The handles share DNS, TLS session and
+ * connection caches, and the pool caches the bearer credential and the
+ * parsed CA bundle so that logins neither re-read files nor pay for a cold
+ * handshake.
+ */
+
+#ifndef K8S_HTTP_POOL_H
+#define K8S_HTTP_POOL_H
+
+#include <curl/curl.h>
+#include "tokenreview_api.h"
+
+/* Upper bound for the number of pooled handles */
+#define K8S_HTTP_POOL_MAX_SIZE 64
+
+/* Timeout in seconds for warm-up and keepalive requests */
+#define K8S_HTTP_PING_TIMEOUT 2
+
+typedef struct k8s_http_pool k8s_http_pool_t;
+
+/**
+ * Create a connection pool for the given API server
+ *
+ * The configuration strings are copied. The credential is loaded
+ * immediately; a missing token file is not fatal and is retried on
+ * the next refresh.
+ *
+ * @param config API server configuration
+ * @param size Number of handles kept warm (1..K8S_HTTP_POOL_MAX_SIZE)
+ * @return New pool, or NULL on allocation failure
+ */
+k8s_http_pool_t *k8s_http_pool_create(const k8s_config_t *config, int size);
+
+/**
+ * Close all pooled connections and free the pool
+ *
+ * No handle may be checked out when this is called.
+ *
+ * @param pool Pool to destroy (NULL is ignored)
+ */
+void k8s_http_pool_destroy(k8s_http_pool_t *pool);
+
+/**
+ * Check out a handle, preferring the most recently used idle one
+ *
+ * When every pooled handle is busy a temporary handle is created; it still
+ * shares the DNS, TLS session and connection caches.
+ *
+ * @param pool Pool to take the handle from
+ * @return Handle ready for request-specific options, or NULL on failure
+ */
+CURL *k8s_http_pool_acquire(k8s_http_pool_t *pool);
+
+/**
+ * Return a handle obtained from k8s_http_pool_acquire()
+ *
+ * @param pool Pool the handle came from
+ * @param curl Handle to return
+ * @param reusable 0 if the last transfer failed and its connection should
+ *                 not be trusted; the handle is then recreated
+ */
+void k8s_http_pool_release(k8s_http_pool_t *pool, CURL *curl, int reusable);
+
+/**
+ * Format the "Authorization: Bearer ..." header from the cached credential
+ *
+ * Reloads the credential first if it could not be loaded before.
+ *
+ * @param pool Pool holding the credential
+ * @param buf Output buffer
+ * @param len Size of buf
+ * @return 1 on success, 0 if no credential is available or buf is too small
+ */
+int k8s_http_pool_auth_header(k8s_http_pool_t *pool, char *buf, size_t len);
+
+/**
+ * Re-read the credential file
+ *
+ * Projected ServiceAccount tokens are rotated by the kubelet, so this is
+ * called periodically from the housekeeping thread.
+ *
+ * @param pool Pool holding the credential
+ * @return 1 if a credential is loaded afterwards, 0 otherwise
+ */
+int k8s_http_pool_refresh_credential(k8s_http_pool_t *pool);
+
+/**
+ * Open and TLS-handshake connections on idle handles
+ *
+ * Sends a lightweight GET /livez on every idle handle that has not been used
+ * for at least idle_seconds, all in parallel, so the total time is bounded by
+ * K8S_HTTP_PING_TIMEOUT. Used both for warm-up at plugin init (idle_seconds
+ * = 0) and as the periodic keepalive.
+ *
+ * @param pool Pool to warm
+ * @param idle_seconds Only ping handles idle for at least this long
+ * @return Number of handles with a live connection afterwards
+ */
+int k8s_http_pool_ping(k8s_http_pool_t *pool, int idle_seconds);
+
+/**
+ * Resolve the API server host and pin the result for all pooled handles
+ *
+ * Called once at plugin init and then periodically from the housekeeping
+ * thread, so DNS is never on the login path. If resolution fails the
+ * previously pinned addresses stay in use.
+ *
+ * @param pool Pool to update
+ * @return Number of pinned addresses from this resolution, 0 if the host
+ *         is an IP address or could not be resolved
+ */
+int k8s_http_pool_resolve(k8s_http_pool_t *pool);
+
+/**
+ * Copy the pinned addresses for a handle that is not part of the pool
+ *
+ * Long-running requests, such as watches, keep their own handles rather
+ * than hold pooled ones; they pass this entry as CURLOPT_RESOLVE.
+ *
+ * @param pool Pool to read
+ * @param entry Output, "host:port:addrs"
+ * @param len Size of entry
+ * @return 1 if an address is pinned, 0 otherwise
+ */
+int k8s_http_pool_pinned(k8s_http_pool_t *pool, char *entry, size_t len);
+
+/**
+ * Pick up a changed CA bundle
+ *
+ * Re-parses the CA file into the pool's shared trust store when it changed
+ * on disk, or creates the store if the file could not be loaded before.
+ * Called periodically from the housekeeping thread.
+ *
+ * @param pool Pool to update
+ * @return 1 if new certificates were installed, 0 otherwise
+ */
+int k8s_http_pool_reload_ca(k8s_http_pool_t *pool);
+
+/**
+ * Apply transport options shared by every API server request
+ *
+ * Sets TLS verification, CA trust and timeout. Handles of a pool verify
+ * against its shared in-memory CA store; one-shot handles use the CA file.
+ * Requests on a pool's handles must use identical options so that libcurl
+ * can reuse the warm connections.
+ *
+ * @param curl Handle to configure
+ * @param config API server configuration
+ */
+void k8s_http_apply_common(CURL *curl, const k8s_config_t *config);
+
+#endif /* K8S_HTTP_POOL_H */
@@ -0,0 +1,191 @@
+/*
+ * Per-Identity Login Statistics Implementation
+ */
+
+#include "identity_stats.h"
+#include "instrumentation.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define SETS (K8S_IDENTITY_SLOTS / K8S_IDENTITY_WAYS)
+
+typedef struct {
+    k8s_identity_row_t row;
+    uint64_t hash;                      /* 0: slot free */
+    uint64_t last_use;                  /* Tick of the latest login, for LRU */
+    uint32_t latency[K8S_HIST_BUCKETS]; /* Login latency, bucketed as in stats.h */
+} identity_slot_t;
+
+static identity_slot_t slots[SETS][K8S_IDENTITY_WAYS];
+static k8s_mutex_t stripes[K8S_IDENTITY_STRIPES] = {
+    [0 ... K8S_IDENTITY_STRIPES - 1] = K8S_MUTEX_INITIALIZER(K8S_MUTEX_IDENTITY)
+};
+static uint64_t evictions = 0;
+static uint64_t ticks = 0;
+
+/* Logins that never proved an identity, outside the table */
+static identity_slot_t unauthenticated;
+static k8s_mutex_t unauthenticated_lock = K8S_MUTEX_INITIALIZER(K8S_MUTEX_IDENTITY);
+
+static uint64_t name_hash(const char *name) {
+    uint64_t h = 1469598103934665603ULL;
+    for (const char *p = name; *p; p++) {
+        h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+/* Count one login in a slot; its lock must be held */
+static void account(identity_slot_t *slot, int success, uint64_t usec, time_t now) {
+    slot->row.logins++;
+    if (!success) {
+        slot->row.failures++;
+    }
+    if (!slot->row.first_seen) {
+        slot->row.first_seen = now;
+    }
+    slot->row.last_seen = now;
+    slot->row.latency_sum_us += usec;
+    if (usec > slot->row.latency_max_us) {
+        slot->row.latency_max_us = usec;
+    }
+    slot->latency[k8s_stats_bucket(usec)]++;
+}
+
+/* Upper bound of the bucket holding a percentile of a slot's logins */
+static uint64_t percentile(const identity_slot_t *slot, double percentile) {
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)slot->row.logins + 0.5);
+    uint64_t seen = 0;
+
+    if (rank < 1) {
+        rank = 1;
+    }
+    for (int b = 0; b < K8S_HIST_BUCKETS; b++) {
+        seen += slot->latency[b];
+        if (seen >= rank) {
+            return k8s_stats_bucket_upper(b);
+        }
+    }
+    return 0;
+}
+
+/* A slot's row with its percentiles; its lock must be held */
+static void snapshot(const identity_slot_t *slot, k8s_identity_row_t *row) {
+    *row = slot->row;
+    row->latency_p50_us = percentile(slot, 50);
+    row->latency_p95_us = percentile(slot, 95);
+    row->latency_p99_us = percentile(slot, 99);
+}
+
+void k8s_identity_record(const char *identity, int success, uint64_t usec) {
+    char name[K8S_IDENTITY_NAME_MAX + 1];
+    time_t now = time(NULL);
+
+    if (!identity) {
+        k8s_mutex_lock(&unauthenticated_lock);
+        account(&unauthenticated, success, usec, now);
+        k8s_mutex_unlock(&unauthenticated_lock);
+        return;
+    }
+    strncpy(name, identity, K8S_IDENTITY_NAME_MAX);
+    name[K8S_IDENTITY_NAME_MAX] = '\0';
+
+    uint64_t hash = name_hash(name);
+    size_t set = hash % SETS;
+    identity_slot_t *ways = slots[set];
+    identity_slot_t *slot = NULL;
+    identity_slot_t *victim = NULL;
+
+    k8s_mutex_lock(&stripes[set % K8S_IDENTITY_STRIPES]);
+    for (int i = 0; i < K8S_IDENTITY_WAYS; i++) {
+        identity_slot_t *s = &ways[i];
+        if (s->hash == hash && strcmp(s->row.identity, name) == 0) {
+            slot = s;
+            break;
+        }
+        /* Prefer a free slot, then the least recently seen one */
+        if (!victim || (victim->hash && (!s->hash || s->last_use < victim->last_use))) {
+            victim = s;
+        }
+    }
+
+    if (!slot) {
+        slot = victim;
+        if (slot->hash) {
+            __atomic_add_fetch(&evictions, 1, __ATOMIC_RELAXED);
+        }
+        memset(slot, 0, sizeof(*slot));
+        slot->hash = hash;
+        strcpy(slot->row.identity, name);
+    }
+
+    account(slot, success, usec, now);
+    slot->last_use = __atomic_add_fetch(&ticks, 1, __ATOMIC_RELAXED);
+    k8s_mutex_unlock(&stripes[set % K8S_IDENTITY_STRIPES]);
+}
+
+static int compare_last_seen(const void *a, const void *b) {
+    time_t x = ((const k8s_identity_row_t *)a)->last_seen;
+    time_t y = ((const k8s_identity_row_t *)b)->last_seen;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+int k8s_identity_collect(k8s_identity_row_t *rows, int max) {
+    int n = 0;
+
+    for (size_t set = 0; set < SETS && max > 0; set++) {
+        k8s_mutex_lock(&stripes[set % K8S_IDENTITY_STRIPES]);
+        for (int i = 0; i < K8S_IDENTITY_WAYS; i++) {
+            const identity_slot_t *slot = &slots[set][i];
+            int at = n;
+
+            if (!slot->hash) {
+                continue;
+            }
+            /* Once rows is full, a row seen later replaces the oldest */
+            if (n == max) {
+                at = 0;
+                for (int r = 1; r < n; r++) {
+                    if (rows[r].last_seen < rows[at].last_seen) {
+                        at = r;
+                    }
+                }
+                if (rows[at].last_seen >= slot->row.last_seen) {
+                    continue;
+                }
+            } else {
+                n++;
+            }
+            snapshot(slot, &rows[at]);
+        }
+        k8s_mutex_unlock(&stripes[set % K8S_IDENTITY_STRIPES]);
+    }
+    qsort(rows, (size_t)n, sizeof(*rows), compare_last_seen);
+    return n;
+}
+
+void k8s_identity_unauthenticated(k8s_identity_row_t *row) {
+    k8s_mutex_lock(&unauthenticated_lock);
+    snapshot(&unauthenticated, row);
+    k8s_mutex_unlock(&unauthenticated_lock);
+}
+
+uint64_t k8s_identity_evictions(void) {
+    return __atomic_load_n(&evictions, __ATOMIC_RELAXED);
+}
+
+void k8s_identity_reset(void) {
+    for (int s = 0; s < K8S_IDENTITY_STRIPES; s++) {
+        k8s_mutex_lock(&stripes[s]);
+    }
+    memset(slots, 0, sizeof(slots));
+    __atomic_store_n(&evictions, 0, __ATOMIC_RELAXED);
+    for (int s = K8S_IDENTITY_STRIPES - 1; s >= 0; s--) {
+        k8s_mutex_unlock(&stripes[s]);
+    }
+    k8s_mutex_lock(&unauthenticated_lock);
+    memset(&unauthenticated, 0, sizeof(unauthenticated));
+    k8s_mutex_unlock(&unauthenticated_lock);
+}
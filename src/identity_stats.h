@@ -0,0 +1,85 @@
+/*
+ * Per-Identity Login Statistics
+ *
+ * Login counts, failures, last-seen time and latency for each MariaDB user
+ * (namespace/serviceaccount) that proved its identity to the plugin; logins
+ * that did not, which anyone can make up a user name for, share one
+ * aggregate row outside the table. The table
+ * has a fixed number of slots grouped into small sets; a new identity
+ * replaces the least recently seen one in its set, so any number of
+ * distinct accounts keeps memory bounded. Sets are spread over a few
+ * locks, so logins of different identities rarely contend.
+ */
+
+#ifndef K8S_IDENTITY_STATS_H
+#define K8S_IDENTITY_STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+/* Total slots, i.e. identities tracked at most */
+#define K8S_IDENTITY_SLOTS 1024
+
+/* Slots per set; an identity can only live in the set its name hashes to */
+#define K8S_IDENTITY_WAYS 8
+
+/* Locks guarding the sets */
+#define K8S_IDENTITY_STRIPES 16
+
+/* Longest identity kept; longer names are truncated */
+#define K8S_IDENTITY_NAME_MAX 128
+
+typedef struct {
+    char identity[K8S_IDENTITY_NAME_MAX + 1];
+    uint64_t logins;
+    uint64_t failures;
+    time_t first_seen;
+    time_t last_seen;
+    uint64_t latency_sum_us;
+    uint64_t latency_max_us;
+    uint64_t latency_p50_us;        /* Bucket upper bounds, as k8s_stats_percentile() */
+    uint64_t latency_p95_us;
+    uint64_t latency_p99_us;
+} k8s_identity_row_t;
+
+/**
+ * Account one finished login
+ *
+ * @param identity MariaDB user name of a login whose token or ticket proved
+ *                 it, or NULL for the unauthenticated row
+ * @param success Whether the login succeeded
+ * @param usec Login latency in microseconds
+ */
+void k8s_identity_record(const char *identity, int success, uint64_t usec);
+
+/**
+ * Copy the most recently seen identities
+ *
+ * Each set is copied under its lock, so every row is consistent.
+ *
+ * @param rows Output array, most recently seen first
+ * @param max Capacity of rows
+ * @return Number of rows written
+ */
+int k8s_identity_collect(k8s_identity_row_t *rows, int max);
+
+/**
+ * Copy the row of the logins that proved no identity
+ *
+ * @param row Output, with an empty identity
+ */
+void k8s_identity_unauthenticated(k8s_identity_row_t *row);
+
+/**
+ * Number of identities replaced to make room for new ones
+ *
+ * @return Total since load
+ */
+uint64_t k8s_identity_evictions(void);
+
+/**
+ * Forget every identity
+ */
+void k8s_identity_reset(void);
+
+#endif /* K8S_IDENTITY_STATS_H */
@@ -0,0 +1,223 @@
+/*
+ * Performance Schema Instrumentation Implementation
+ *
+ * Compiled only with WITH_PSI; uses the server's PSI interface directly, so
+ * the configured server headers have to come first.
+ */
+
+#include <my_global.h>
+#include <mysql/psi/psi.h>
+#include <string.h>
+#include "instrumentation.h"
+
+#define CATEGORY "auth_k8s"
+
+/* Statically initialized mutexes instrumented on first use */
+#define MAX_LAZY_MUTEXES 64
+
+static PSI_stage_info stage_info[K8S_STAGE_COUNT] = {
+    [K8S_STAGE_READ_TOKEN] = { 0, "k8s: reading client token", 0 },
+    [K8S_STAGE_TOKENREVIEW] = { 0, "k8s: waiting for TokenReview", 0 },
+    [K8S_STAGE_PARSE] = { 0, "k8s: parsing response", 0 },
+};
+
+static PSI_mutex_key mutex_keys[K8S_MUTEX_COUNT];
+static PSI_mutex_info mutex_info[K8S_MUTEX_COUNT] = {
+    [K8S_MUTEX_POOL] = { &mutex_keys[K8S_MUTEX_POOL], "pool_lock", 0 },
+    [K8S_MUTEX_POOL_SHARE] = { &mutex_keys[K8S_MUTEX_POOL_SHARE], "pool_share_lock", 0 },
+    [K8S_MUTEX_CA_STORE] = { &mutex_keys[K8S_MUTEX_CA_STORE], "ca_store_lock", 0 },
+    [K8S_MUTEX_SNAPSHOT] = { &mutex_keys[K8S_MUTEX_SNAPSHOT], "snapshot_lock", PSI_FLAG_GLOBAL },
+    [K8S_MUTEX_PENDING] = { &mutex_keys[K8S_MUTEX_PENDING], "pending_lock", PSI_FLAG_GLOBAL },
+    [K8S_MUTEX_IDENTITY] = { &mutex_keys[K8S_MUTEX_IDENTITY], "identity_lock", 0 },
+    [K8S_MUTEX_TOKEN_CACHE] = { &mutex_keys[K8S_MUTEX_TOKEN_CACHE], "token_cache_lock", 0 },
+    [K8S_MUTEX_DENYLIST] = { &mutex_keys[K8S_MUTEX_DENYLIST], "denylist_lock", PSI_FLAG_GLOBAL },
+    [K8S_MUTEX_SESSION] = { &mutex_keys[K8S_MUTEX_SESSION], "session_lock", PSI_FLAG_GLOBAL },
+    [K8S_MUTEX_JWKS] = { &mutex_keys[K8S_MUTEX_JWKS], "jwks_lock", PSI_FLAG_GLOBAL },
+    [K8S_MUTEX_POLICY] = { &mutex_keys[K8S_MUTEX_POLICY], "policy_lock", PSI_FLAG_GLOBAL },
+    [K8S_MUTEX_ACCESS_REVIEW] = { &mutex_keys[K8S_MUTEX_ACCESS_REVIEW], "access_review_lock",
+                                  PSI_FLAG_GLOBAL },
+    [K8S_MUTEX_CLUSTER] = { &mutex_keys[K8S_MUTEX_CLUSTER], "cluster_lock", PSI_FLAG_GLOBAL },
+    [K8S_MUTEX_ISSUERS] = { &mutex_keys[K8S_MUTEX_ISSUERS], "issuers_lock", PSI_FLAG_GLOBAL },
+    [K8S_MUTEX_FEDERATED] = { &mutex_keys[K8S_MUTEX_FEDERATED], "federated_lock",
+                              PSI_FLAG_GLOBAL },
+    [K8S_MUTEX_FEDERATED_SOCKET] = { &mutex_keys[K8S_MUTEX_FEDERATED_SOCKET],
+                                     "federated_socket_lock", 0 },
+    [K8S_MUTEX_WATCH] = { &mutex_keys[K8S_MUTEX_WATCH], "watch_lock", PSI_FLAG_GLOBAL },
+};
+
+static PSI_memory_key memory_keys[K8S_MEM_COUNT];
+static PSI_memory_info memory_info[K8S_MEM_COUNT] = {
+    [K8S_MEM_TOKEN] = { &memory_keys[K8S_MEM_TOKEN], "token", 0 },
+    [K8S_MEM_RESPONSE] = { &memory_keys[K8S_MEM_RESPONSE], "tokenreview_response", 0 },
+    [K8S_MEM_POOL] = { &memory_keys[K8S_MEM_POOL], "connection_pool", PSI_FLAG_GLOBAL },
+    [K8S_MEM_SNAPSHOT] = { &memory_keys[K8S_MEM_SNAPSHOT], "config_snapshot", PSI_FLAG_GLOBAL },
+    [K8S_MEM_CA_STORE] = { &memory_keys[K8S_MEM_CA_STORE], "ca_store", PSI_FLAG_GLOBAL },
+    [K8S_MEM_STATUS] = { &memory_keys[K8S_MEM_STATUS], "status_buffer", 0 },
+    [K8S_MEM_DENYLIST] = { &memory_keys[K8S_MEM_DENYLIST], "denylist", PSI_FLAG_GLOBAL },
+    [K8S_MEM_SESSION] = { &memory_keys[K8S_MEM_SESSION], "session_registry", PSI_FLAG_GLOBAL },
+    [K8S_MEM_JWKS] = { &memory_keys[K8S_MEM_JWKS], "jwks", PSI_FLAG_GLOBAL },
+    [K8S_MEM_POLICY] = { &memory_keys[K8S_MEM_POLICY], "account_policy", PSI_FLAG_GLOBAL },
+    [K8S_MEM_ACCESS_REVIEW] = { &memory_keys[K8S_MEM_ACCESS_REVIEW], "access_review",
+                                PSI_FLAG_GLOBAL },
+    [K8S_MEM_BACKEND] = { &memory_keys[K8S_MEM_BACKEND], "backend", PSI_FLAG_GLOBAL },
+    [K8S_MEM_CLUSTER] = { &memory_keys[K8S_MEM_CLUSTER], "cluster_registry", PSI_FLAG_GLOBAL },
+    [K8S_MEM_ISSUERS] = { &memory_keys[K8S_MEM_ISSUERS], "issuer_keys", PSI_FLAG_GLOBAL },
+    [K8S_MEM_FEDERATED] = { &memory_keys[K8S_MEM_FEDERATED], "federated", PSI_FLAG_GLOBAL },
+    [K8S_MEM_WATCH] = { &memory_keys[K8S_MEM_WATCH], "watch", PSI_FLAG_GLOBAL },
+};
+
+/* Header in front of every instrumented allocation */
+typedef union {
+    struct {
+        size_t size;
+        PSI_memory_key key;
+        struct PSI_thread *owner;
+    } h;
+    max_align_t align;
+} mem_header_t;
+
+static int registered = 0;
+static pthread_mutex_t lazy_lock = PTHREAD_MUTEX_INITIALIZER;
+static k8s_mutex_t *lazy_mutexes[MAX_LAZY_MUTEXES];
+static int lazy_count = 0;
+
+void k8s_psi_register(void) {
+    PSI_stage_info *stages[K8S_STAGE_COUNT];
+    for (int i = 0; i < K8S_STAGE_COUNT; i++) {
+        stages[i] = &stage_info[i];
+    }
+
+    PSI_STAGE_CALL(register_stage)(CATEGORY, stages, K8S_STAGE_COUNT);
+    PSI_MUTEX_CALL(register_mutex)(CATEGORY, mutex_info, K8S_MUTEX_COUNT);
+    PSI_MEMORY_CALL(register_memory)(CATEGORY, memory_info, K8S_MEM_COUNT);
+    __atomic_store_n(&registered, 1, __ATOMIC_RELEASE);
+}
+
+void k8s_psi_unregister(void) {
+    __atomic_store_n(&registered, 0, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&lazy_lock);
+    for (int i = 0; i < lazy_count; i++) {
+        struct PSI_mutex *psi = __atomic_exchange_n(&lazy_mutexes[i]->psi, NULL,
+                                                    __ATOMIC_ACQ_REL);
+        if (psi) {
+            PSI_MUTEX_CALL(destroy_mutex)(psi);
+        }
+    }
+    lazy_count = 0;
+    pthread_mutex_unlock(&lazy_lock);
+}
+
+void k8s_psi_stage(k8s_stage_t stage) {
+    PSI_STAGE_CALL(start_stage)(stage_info[stage].m_key, __FILE__, __LINE__);
+}
+
+void k8s_psi_stage_end(void) {
+    PSI_STAGE_CALL(end_stage)();
+}
+
+void k8s_mutex_init(k8s_mutex_t *m, k8s_mutex_class_t cls) {
+    pthread_mutex_init(&m->mutex, NULL);
+    m->cls = cls;
+    m->psi = __atomic_load_n(&registered, __ATOMIC_ACQUIRE) ?
+        PSI_MUTEX_CALL(init_mutex)(mutex_keys[cls], &m->mutex) : NULL;
+}
+
+void k8s_mutex_destroy(k8s_mutex_t *m) {
+    if (m->psi) {
+        PSI_MUTEX_CALL(destroy_mutex)(m->psi);
+        m->psi = NULL;
+    }
+    pthread_mutex_destroy(&m->mutex);
+}
+
+/**
+ * Instance of a statically initialized mutex, created on first use
+ */
+static struct PSI_mutex *lazy_instance(k8s_mutex_t *m) {
+    struct PSI_mutex *psi = __atomic_load_n(&m->psi, __ATOMIC_ACQUIRE);
+    if (psi || !__atomic_load_n(&registered, __ATOMIC_ACQUIRE)) {
+        return psi;
+    }
+
+    pthread_mutex_lock(&lazy_lock);
+    psi = m->psi;
+    if (!psi && lazy_count < MAX_LAZY_MUTEXES) {
+        psi = PSI_MUTEX_CALL(init_mutex)(mutex_keys[m->cls], &m->mutex);
+        lazy_mutexes[lazy_count++] = m;
+        __atomic_store_n(&m->psi, psi, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&lazy_lock);
+    return psi;
+}
+
+int k8s_mutex_lock(k8s_mutex_t *m) {
+    struct PSI_mutex *psi = lazy_instance(m);
+    if (!psi) {
+        return pthread_mutex_lock(&m->mutex);
+    }
+
+    PSI_mutex_locker_state state;
+    PSI_mutex_locker *locker = PSI_MUTEX_CALL(start_mutex_wait)(&state, psi, PSI_MUTEX_LOCK,
+                                                                __FILE__, __LINE__);
+    int rc = pthread_mutex_lock(&m->mutex);
+    if (locker) {
+        PSI_MUTEX_CALL(end_mutex_wait)(locker, rc);
+    }
+    return rc;
+}
+
+int k8s_mutex_unlock(k8s_mutex_t *m) {
+    struct PSI_mutex *psi = __atomic_load_n(&m->psi, __ATOMIC_ACQUIRE);
+    if (psi) {
+        PSI_MUTEX_CALL(unlock_mutex)(psi);
+    }
+    return pthread_mutex_unlock(&m->mutex);
+}
+
+void *k8s_malloc(k8s_mem_class_t cls, size_t size) {
+    mem_header_t *h = malloc(sizeof(mem_header_t) + size);
+    if (!h) {
+        return NULL;
+    }
+    h->h.size = size;
+    h->h.owner = NULL;
+    h->h.key = PSI_MEMORY_CALL(memory_alloc)(memory_keys[cls], size, &h->h.owner);
+    return h + 1;
+}
+
+void *k8s_calloc(k8s_mem_class_t cls, size_t count, size_t size) {
+    if (size && count > (size_t)-1 / size) {
+        return NULL;
+    }
+    void *ptr = k8s_malloc(cls, count * size);
+    if (ptr) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+void *k8s_realloc(k8s_mem_class_t cls, void *ptr, size_t size) {
+    if (!ptr) {
+        return k8s_malloc(cls, size);
+    }
+
+    mem_header_t *old = (mem_header_t *)ptr - 1;
+    size_t old_size = old->h.size;
+    mem_header_t *h = realloc(old, sizeof(mem_header_t) + size);
+    if (!h) {
+        return NULL;
+    }
+    h->h.key = PSI_MEMORY_CALL(memory_realloc)(h->h.key, old_size, size, &h->h.owner);
+    h->h.size = size;
+    return h + 1;
+}
+
+void k8s_free(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    mem_header_t *h = (mem_header_t *)ptr - 1;
+    PSI_MEMORY_CALL(memory_free)(h->h.key, h->h.size, h->h.owner);
+    free(h);
+}
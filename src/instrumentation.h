@@ -0,0 +1,153 @@
+/*
+ * Performance Schema Instrumentation
+ *
+ * Reports the plugin's stages, mutex waits and memory to performance_schema,
+ * so login time and allocations are attributed to the plugin instead of to
+ * connection setup. Only built with -DWITH_PSI=ON, which needs configured
+ * server headers (my_config.h); otherwise every wrapper below compiles to
+ * the plain pthread or libc call.
+ */
+
+#ifndef K8S_INSTRUMENTATION_H
+#define K8S_INSTRUMENTATION_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+typedef enum {
+    K8S_STAGE_READ_TOKEN,            /* "k8s: reading client token" */
+    K8S_STAGE_TOKENREVIEW,           /* "k8s: waiting for TokenReview" */
+    K8S_STAGE_PARSE,                 /* "k8s: parsing response" */
+    K8S_STAGE_COUNT
+} k8s_stage_t;
+
+typedef enum {
+    K8S_MUTEX_POOL,                  /* Connection pool slots and credential */
+    K8S_MUTEX_POOL_SHARE,            /* libcurl DNS/TLS session share */
+    K8S_MUTEX_CA_STORE,
+    K8S_MUTEX_SNAPSHOT,              /* Snapshot publication and retirement */
+    K8S_MUTEX_PENDING,               /* Settings waiting to be applied */
+    K8S_MUTEX_IDENTITY,              /* Per-identity statistics stripes */
+    K8S_MUTEX_TOKEN_CACHE,           /* Validated token cache stripes */
+    K8S_MUTEX_DENYLIST,              /* Denylist reload and retirement */
+    K8S_MUTEX_SESSION,               /* Live session registry */
+    K8S_MUTEX_JWKS,                  /* Issuer signing keys */
+    K8S_MUTEX_POLICY,                /* Compiled account policy cache */
+    K8S_MUTEX_ACCESS_REVIEW,         /* Access review rule and decisions */
+    K8S_MUTEX_CLUSTER,               /* Cluster registry reload and retirement */
+    K8S_MUTEX_ISSUERS,               /* Offline issuer reload and retirement */
+    K8S_MUTEX_FEDERATED,             /* Federated validator sockets */
+    K8S_MUTEX_FEDERATED_SOCKET,      /* Requests and answers of one socket */
+    K8S_MUTEX_WATCH,                 /* Pool the watches use */
+    K8S_MUTEX_COUNT
+} k8s_mutex_class_t;
+
+typedef enum {
+    K8S_MEM_TOKEN,                   /* Client token copies */
+    K8S_MEM_RESPONSE,                /* TokenReview response bodies */
+    K8S_MEM_POOL,
+    K8S_MEM_SNAPSHOT,
+    K8S_MEM_CA_STORE,
+    K8S_MEM_STATUS,                  /* SHOW STATUS scratch buffers */
+    K8S_MEM_DENYLIST,                /* Denylist index and keys */
+    K8S_MEM_SESSION,                 /* Live session registry and revalidation */
+    K8S_MEM_JWKS,                    /* Issuer signing keys */
+    K8S_MEM_POLICY,                  /* Compiled account policies */
+    K8S_MEM_ACCESS_REVIEW,           /* Cached access review decisions */
+    K8S_MEM_BACKEND,                 /* Backend fallback batches */
+    K8S_MEM_CLUSTER,                 /* Cluster registry */
+    K8S_MEM_ISSUERS,                 /* Offline issuer key index */
+    K8S_MEM_FEDERATED,               /* Federated validator sockets and requests */
+    K8S_MEM_WATCH,                   /* Watch streams, list bodies and UID sets */
+    K8S_MEM_COUNT
+} k8s_mem_class_t;
+
+/*
+ * A mutex performance_schema can see. Statically initialized mutexes are
+ * instrumented on first use once k8s_psi_register() has run.
+ */
+typedef struct {
+    pthread_mutex_t mutex;
+    struct PSI_mutex *psi;
+    int cls;
+} k8s_mutex_t;
+
+#define K8S_MUTEX_INITIALIZER(cls) { PTHREAD_MUTEX_INITIALIZER, NULL, (cls) }
+
+#ifdef K8S_WITH_PSI
+
+/**
+ * Register the plugin's stage, mutex and memory classes
+ *
+ * Call from plugin init before any instrumented object is used.
+ */
+void k8s_psi_register(void);
+
+/**
+ * Forget every instrumented mutex instance
+ *
+ * Call from plugin deinit, after the last instrumented mutex is destroyed.
+ */
+void k8s_psi_unregister(void);
+
+/**
+ * Enter a stage in the calling (connection) thread
+ *
+ * @param stage Stage to report
+ */
+void k8s_psi_stage(k8s_stage_t stage);
+
+/**
+ * End the current stage of the calling thread
+ */
+void k8s_psi_stage_end(void);
+
+void k8s_mutex_init(k8s_mutex_t *m, k8s_mutex_class_t cls);
+void k8s_mutex_destroy(k8s_mutex_t *m);
+int k8s_mutex_lock(k8s_mutex_t *m);
+int k8s_mutex_unlock(k8s_mutex_t *m);
+
+/**
+ * Allocate memory accounted to a memory class
+ *
+ * Memory from these functions must be released with k8s_free().
+ */
+void *k8s_malloc(k8s_mem_class_t cls, size_t size);
+void *k8s_calloc(k8s_mem_class_t cls, size_t count, size_t size);
+void *k8s_realloc(k8s_mem_class_t cls, void *ptr, size_t size);
+void k8s_free(void *ptr);
+
+#else
+
+#define k8s_psi_register() ((void)0)
+#define k8s_psi_unregister() ((void)0)
+#define k8s_psi_stage(stage) ((void)(stage))
+#define k8s_psi_stage_end() ((void)0)
+
+static inline void k8s_mutex_init(k8s_mutex_t *m, k8s_mutex_class_t cls) {
+    pthread_mutex_init(&m->mutex, NULL);
+    m->psi = NULL;
+    m->cls = cls;
+}
+
+static inline void k8s_mutex_destroy(k8s_mutex_t *m) {
+    pthread_mutex_destroy(&m->mutex);
+}
+
+static inline int k8s_mutex_lock(k8s_mutex_t *m) {
+    return pthread_mutex_lock(&m->mutex);
+}
+
+static inline int k8s_mutex_unlock(k8s_mutex_t *m) {
+    return pthread_mutex_unlock(&m->mutex);
+}
+
+#define k8s_malloc(cls, size) ((void)(cls), malloc(size))
+#define k8s_calloc(cls, count, size) ((void)(cls), calloc((count), (size)))
+#define k8s_realloc(cls, ptr, size) ((void)(cls), realloc((ptr), (size)))
+#define k8s_free(ptr) free(ptr)
+
+#endif /* K8S_WITH_PSI */
+
+#endif /* K8S_INSTRUMENTATION_H */
@@ -0,0 +1,704 @@
+/*
+ * Offline Issuers Implementation
+ */
+
+#include "issuers.h"
+#include "jwks.h"
+#include "jwt.h"
+#include "cluster.h"
+#include "log.h"
+#include "instrumentation.h"
+#include <dirent.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <json-c/json.h>
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/core_names.h>
+#include <openssl/x509.h>
+
+/* Smallest RSA key accepted, in bits */
+#define MIN_RSA_BITS 2048
+
+/* Key ids derived from PEM keys: unpadded base64url of a SHA-256 */
+#define DERIVED_KID_LEN 43
+
+/* The keys of one file */
+typedef struct {
+    char name[K8S_CLUSTER_NAME_MAX + 1];
+    char issuer[K8S_ISSUER_MAX + 1];
+    char audience[K8S_ISSUER_MAX + 1];  /* Required of tokens without a policy audience */
+} bundle_t;
+
+typedef struct {
+    uint64_t hash;                  /* 0: empty */
+    int bundle;
+    k8s_jwk_t key;
+} slot_t;
+
+/* One immutable version of the directory */
+typedef struct issuer_index {
+    bundle_t bundles[K8S_ISSUERS_MAX_BUNDLES];
+    int bundle_count;
+    slot_t *slots;
+    uint32_t mask;
+    int key_count;
+    int users;                      /* Logins currently verifying against it */
+    time_t retired_at;
+    struct issuer_index *next_retired;
+} index_t;
+
+/* A file as read by a reload */
+typedef struct {
+    bundle_t bundle;
+    k8s_jwk_t keys[K8S_ISSUERS_MAX_KEYS];
+    int count;
+} parsed_t;
+
+static index_t *current = NULL;
+
+/* Directory, load state and retirement; never taken on the login path */
+static k8s_mutex_t issuers_lock = K8S_MUTEX_INITIALIZER(K8S_MUTEX_ISSUERS);
+static char *issuer_dir = NULL;
+static uint64_t loaded_signature = 0;   /* Directory listing at the last load */
+static int have_loaded = 0;
+static int warned = 0;                  /* A load failure was logged since the last success */
+static index_t *retired_head = NULL;
+static index_t *retired_tail = NULL;
+
+static uint64_t fnv(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint64_t key_hash(const char *issuer, const char *kid) {
+    uint64_t h = fnv(1469598103934665603ULL, issuer, strlen(issuer) + 1);
+    h = fnv(h, kid, strlen(kid));
+    return h ? h : 1;
+}
+
+static void free_index(index_t *index) {
+    if (index) {
+        for (uint32_t i = 0; index->slots && i <= index->mask; i++) {
+            if (index->slots[i].hash) {
+                k8s_jwks_free_keys(&index->slots[i].key, 1);
+            }
+        }
+        k8s_free(index->slots);
+        k8s_free(index);
+    }
+}
+
+static const slot_t *find(const index_t *index, const char *issuer, const char *kid) {
+    uint64_t hash = key_hash(issuer, kid);
+    for (uint32_t i = hash & index->mask; ; i = (i + 1) & index->mask) {
+        const slot_t *slot = &index->slots[i];
+        if (!slot->hash) {
+            return NULL;
+        }
+        if (slot->hash == hash && strcmp(slot->key.kid, kid) == 0 &&
+            strcmp(index->bundles[slot->bundle].issuer, issuer) == 0) {
+            return slot;
+        }
+    }
+}
+
+/**
+ * Index a key, taking over its reference
+ *
+ * @return 1 if added, 0 if the issuer already has a key with this id
+ */
+static int insert(index_t *index, int bundle, k8s_jwk_t *key) {
+    const char *issuer = index->bundles[bundle].issuer;
+    uint64_t hash = key_hash(issuer, key->kid);
+    uint32_t i = hash & index->mask;
+
+    for (; index->slots[i].hash; i = (i + 1) & index->mask) {
+        const slot_t *slot = &index->slots[i];
+        if (slot->hash == hash && strcmp(slot->key.kid, key->kid) == 0 &&
+            strcmp(index->bundles[slot->bundle].issuer, issuer) == 0) {
+            return 0;
+        }
+    }
+    index->slots[i].hash = hash;
+    index->slots[i].bundle = bundle;
+    index->slots[i].key = *key;
+    index->key_count++;
+    key->pkey = NULL;
+    return 1;
+}
+
+/* The key id the API server gives a public key */
+static int derive_kid(EVP_PKEY *pkey, char *kid) {
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    unsigned char *der = NULL;
+    unsigned char digest[32];
+    unsigned int digest_len = 0;
+    int der_len = i2d_PUBKEY(pkey, &der);
+
+    if (der_len <= 0 || EVP_Digest(der, (size_t)der_len, digest, &digest_len,
+                                   EVP_sha256(), NULL) != 1) {
+        OPENSSL_free(der);
+        return 0;
+    }
+    OPENSSL_free(der);
+
+    size_t o = 0;
+    unsigned int acc = 0;
+    int bits = 0;
+    for (unsigned int i = 0; i < digest_len; i++) {
+        acc = (acc << 8) | digest[i];
+        bits += 8;
+        while (bits >= 6) {
+            bits -= 6;
+            kid[o++] = alphabet[(acc >> bits) & 63];
+        }
+    }
+    if (bits > 0) {
+        kid[o++] = alphabet[(acc << (6 - bits)) & 63];
+    }
+    kid[o] = '\0';
+    return o == DERIVED_KID_LEN;
+}
+
+/* Algorithm a PEM key signs with; 0 if it is not usable for tokens */
+static int pem_alg(EVP_PKEY *pkey, k8s_jwk_alg_t *alg) {
+    char group[32];
+
+    if (EVP_PKEY_is_a(pkey, "RSA")) {
+        *alg = K8S_JWK_RS256;
+        return EVP_PKEY_get_bits(pkey) >= MIN_RSA_BITS;
+    }
+    if (EVP_PKEY_is_a(pkey, "EC") &&
+        EVP_PKEY_get_utf8_string_param(pkey, OSSL_PKEY_PARAM_GROUP_NAME, group,
+                                       sizeof(group), NULL) == 1 &&
+        strcmp(group, "prime256v1") == 0) {
+        *alg = K8S_JWK_ES256;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Value of a "<field>: <value>" line before the first PEM block
+ *
+ * @return 1 if found, 0 if absent, -1 if longer than K8S_ISSUER_MAX
+ */
+static int pem_field(const char *data, const char *field, char *out) {
+    size_t field_len = strlen(field);
+
+    out[0] = '\0';
+    for (const char *line = data; line && *line; ) {
+        const char *eol = strchr(line, '\n');
+        size_t len = eol ? (size_t)(eol - line) : strlen(line);
+
+        if (strncmp(line, "-----BEGIN", 10) == 0) {
+            return 0;
+        }
+        if (len > field_len && strncmp(line, field, field_len) == 0 && line[field_len] == ':') {
+            const char *value = line + field_len + 1;
+            const char *end = line + len;
+            while (value < end && (*value == ' ' || *value == '\t')) {
+                value++;
+            }
+            while (end > value && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) {
+                end--;
+            }
+            if ((size_t)(end - value) > K8S_ISSUER_MAX) {
+                return -1;
+            }
+            memcpy(out, value, (size_t)(end - value));
+            out[end - value] = '\0';
+            return 1;
+        }
+        line = eol ? eol + 1 : NULL;
+    }
+    return 0;
+}
+
+/**
+ * The "audience" member of a JWKS bundle
+ *
+ * @return 1 if found, 0 if absent, -1 if it is not a string that fits
+ */
+static int jwks_audience(const char *data, char *out) {
+    json_object *root = json_tokener_parse(data);
+    json_object *aud = NULL;
+    int found = 0;
+
+    out[0] = '\0';
+    if (root && json_object_object_get_ex(root, "audience", &aud)) {
+        found = -1;
+        if (json_object_is_type(aud, json_type_string) &&
+            strlen(json_object_get_string(aud)) <= K8S_ISSUER_MAX) {
+            snprintf(out, K8S_ISSUER_MAX + 1, "%s", json_object_get_string(aud));
+            found = 1;
+        }
+    }
+    json_object_put(root);
+    return found;
+}
+
+/* Keys of a PEM bundle; returns how many were usable */
+static int parse_pem(const char *data, parsed_t *out) {
+    BIO *bio = BIO_new_mem_buf(data, -1);
+    EVP_PKEY *pkey;
+    int count = 0;
+
+    pem_field(data, "issuer", out->bundle.issuer);
+    while (bio && count < K8S_ISSUERS_MAX_KEYS &&
+           (pkey = PEM_read_bio_PUBKEY(bio, NULL, NULL, NULL)) != NULL) {
+        k8s_jwk_t *key = &out->keys[count];
+        if (pem_alg(pkey, &key->alg) && derive_kid(pkey, key->kid)) {
+            key->pkey = pkey;
+            count++;
+        } else {
+            EVP_PKEY_free(pkey);
+        }
+    }
+    /* The end of the data ends the loop with an error queued */
+    ERR_clear_error();
+    BIO_free(bio);
+    return count;
+}
+
+/**
+ * Read one bundle
+ *
+ * @return NULL, or why the file cannot be used
+ */
+static const char *parse_bundle(const char *path, int pem, parsed_t *out) {
+    char *data = k8s_read_file(path);
+    if (!data) {
+        return "unreadable";
+    }
+
+    out->count = pem ? parse_pem(data, out)
+                     : k8s_jwks_parse(data, out->keys, K8S_ISSUERS_MAX_KEYS,
+                                      out->bundle.issuer, sizeof(out->bundle.issuer));
+    int audience = pem ? pem_field(data, "audience", out->bundle.audience)
+                       : jwks_audience(data, out->bundle.audience);
+    free(data);
+
+    if (out->count < 0) {
+        out->count = 0;
+        return "not_a_jwks";
+    }
+    if (!out->bundle.issuer[0]) {
+        return "missing_issuer";
+    }
+    if (audience < 0 || (audience > 0 && !out->bundle.audience[0])) {
+        return "bad_audience";
+    }
+    /* Like the API server, which issues tokens for its issuer by default */
+    if (!audience) {
+        memcpy(out->bundle.audience, out->bundle.issuer, sizeof(out->bundle.audience));
+    }
+    if (out->count == 0) {
+        return "no_usable_keys";
+    }
+    return NULL;
+}
+
+/* Bundle name and format of a directory entry; 0 if it is not a bundle */
+static int bundle_name(const char *entry, char *name, int *pem) {
+    const char *dot = strrchr(entry, '.');
+    if (entry[0] == '.' || !dot) {
+        return 0;
+    }
+    if (strcmp(dot, ".pem") == 0) {
+        *pem = 1;
+    } else if (strcmp(dot, ".jwks") == 0) {
+        *pem = 0;
+    } else {
+        return 0;
+    }
+    /* Too long a name is left empty, to be reported as bad */
+    size_t len = (size_t)(dot - entry);
+    if (len > K8S_CLUSTER_NAME_MAX) {
+        len = 0;
+    }
+    memcpy(name, entry, len);
+    name[len] = '\0';
+    return 1;
+}
+
+/* Bundle index of a cluster in an index, or -1 */
+static int find_bundle(const index_t *index, const char *name) {
+    for (int i = 0; index && i < index->bundle_count; i++) {
+        if (strcmp(index->bundles[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Copy the keys a cluster had in the current index; issuers_lock must be
+ * held
+ */
+static int keep_previous(const char *name, parsed_t *out) {
+    int b = find_bundle(current, name);
+    if (b < 0) {
+        return 0;
+    }
+    memset(out, 0, sizeof(*out));
+    out->bundle = current->bundles[b];
+    for (uint32_t i = 0; i <= current->mask && out->count < K8S_ISSUERS_MAX_KEYS; i++) {
+        const slot_t *slot = &current->slots[i];
+        if (slot->hash && slot->bundle == b && EVP_PKEY_up_ref(slot->key.pkey)) {
+            out->keys[out->count++] = slot->key;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Parse every bundle of the directory into a new index; issuers_lock must
+ * be held
+ *
+ * @return New index, or NULL on allocation failure
+ */
+static index_t *build_index(const char *dir, char (*names)[NAME_MAX + 1], int count,
+                            int *skipped) {
+    index_t *index = k8s_calloc(K8S_MEM_ISSUERS, 1, sizeof(index_t));
+    parsed_t *parsed = k8s_calloc(K8S_MEM_ISSUERS, K8S_ISSUERS_MAX_BUNDLES, sizeof(parsed_t));
+    int n = 0;
+    int keys = 0;
+
+    *skipped = 0;
+    if (!index || !parsed) {
+        k8s_free(index);
+        k8s_free(parsed);
+        return NULL;
+    }
+
+    for (int i = 0; i < count; i++) {
+        char path[PATH_MAX];
+        char name[K8S_CLUSTER_NAME_MAX + 1];
+        int pem = 0;
+        const char *reason = NULL;
+        int unusable = 0;           /* The file itself, rather than its place */
+        parsed_t *p = &parsed[n];
+
+        bundle_name(names[i], name, &pem);
+        memset(p, 0, sizeof(*p));
+        snprintf(p->bundle.name, sizeof(p->bundle.name), "%s", name);
+
+        if (!k8s_cluster_name_valid(name, strlen(name))) {
+            reason = "bad_name";
+        } else if (strcmp(name, K8S_CLUSTER_LOCAL) == 0) {
+            reason = "reserved_name";
+        } else if (n == K8S_ISSUERS_MAX_BUNDLES) {
+            reason = "too_many_bundles";
+        } else {
+            for (int j = 0; j < n; j++) {
+                if (strcmp(parsed[j].bundle.name, name) == 0) {
+                    reason = "duplicate_name";
+                }
+            }
+        }
+        if (!reason) {
+            snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+            reason = parse_bundle(path, pem, p);
+            unusable = reason != NULL;
+        }
+        for (int j = 0; !reason && j < n; j++) {
+            if (strcmp(parsed[j].bundle.issuer, p->bundle.issuer) == 0) {
+                reason = "duplicate_issuer";
+            }
+        }
+
+        if (reason) {
+            (*skipped)++;
+            k8s_jwks_free_keys(p->keys, K8S_ISSUERS_MAX_KEYS);
+            /* A file caught half-written keeps the keys it had */
+            int kept = unusable && keep_previous(name, p);
+            K8S_LOG(K8S_LOG_WARNING, "issuer_invalid", "file=\"%s/%s\" reason=%s action=%s",
+                    dir, names[i], reason, kept ? "keep_previous" : "skip");
+            if (!kept) {
+                continue;
+            }
+        }
+        keys += p->count;
+        n++;
+    }
+
+    uint32_t capacity = 16;
+    while (capacity < (uint32_t)keys * 2) {
+        capacity <<= 1;
+    }
+    index->slots = k8s_calloc(K8S_MEM_ISSUERS, capacity, sizeof(slot_t));
+    index->mask = capacity - 1;
+    for (int b = 0; b < n; b++) {
+        if (index->slots) {
+            index->bundles[b] = parsed[b].bundle;
+            for (int k = 0; k < parsed[b].count; k++) {
+                insert(index, b, &parsed[b].keys[k]);
+            }
+        }
+        k8s_jwks_free_keys(parsed[b].keys, parsed[b].count);
+    }
+    index->bundle_count = n;
+    k8s_free(parsed);
+
+    if (!index->slots) {
+        free_index(index);
+        return NULL;
+    }
+    return index;
+}
+
+/*
+ * Make an index current and retire the previous one; issuers_lock must be
+ * held
+ */
+static void publish(index_t *index) {
+    index_t *old = __atomic_exchange_n(&current, index, __ATOMIC_ACQ_REL);
+    if (old) {
+        old->retired_at = time(NULL);
+        old->next_retired = NULL;
+        if (retired_tail) {
+            retired_tail->next_retired = old;
+        } else {
+            retired_head = old;
+        }
+        retired_tail = old;
+    }
+}
+
+/* Free retired indexes nothing holds any more; issuers_lock must be held */
+static void reclaim(int grace_seconds) {
+    time_t now = time(NULL);
+
+    while (retired_head &&
+           now - retired_head->retired_at >= grace_seconds &&
+           __atomic_load_n(&retired_head->users, __ATOMIC_ACQUIRE) == 0) {
+        index_t *index = retired_head;
+        retired_head = index->next_retired;
+        if (!retired_head) {
+            retired_tail = NULL;
+        }
+        free_index(index);
+    }
+}
+
+static index_t *acquire_index(void) {
+    index_t *index = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    if (index) {
+        __atomic_add_fetch(&index->users, 1, __ATOMIC_ACQ_REL);
+    }
+    return index;
+}
+
+static void release_index(index_t *index) {
+    if (index) {
+        __atomic_sub_fetch(&index->users, 1, __ATOMIC_ACQ_REL);
+    }
+}
+
+void k8s_issuers_configure(const char *dir) {
+    if (dir && !*dir) {
+        dir = NULL;
+    }
+
+    k8s_mutex_lock(&issuers_lock);
+    if (dir && issuer_dir && strcmp(dir, issuer_dir) == 0) {
+        k8s_mutex_unlock(&issuers_lock);
+        return;
+    }
+
+    free(issuer_dir);
+    issuer_dir = dir ? strdup(dir) : NULL;
+    if (dir && !issuer_dir) {
+        K8S_LOG(K8S_LOG_ERROR, "out_of_memory", "where=issuers");
+    }
+    have_loaded = 0;
+    warned = 0;
+
+    if (!issuer_dir && current) {
+        publish(NULL);
+        K8S_LOG(K8S_LOG_INFO, "issuers_disabled", "keys=0");
+    }
+    k8s_mutex_unlock(&issuers_lock);
+}
+
+/**
+ * List the bundles of the directory and fold their file identities into a
+ * signature that changes whenever one of them does
+ *
+ * @return Number of names, -1 if the directory cannot be read
+ */
+static int list_bundles(const char *dir, char (*names)[NAME_MAX + 1], int max,
+                        uint64_t *signature) {
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    int count = 0;
+
+    if (!d) {
+        return -1;
+    }
+    *signature = 0;
+    while ((entry = readdir(d)) != NULL) {
+        char path[PATH_MAX];
+        char name[K8S_CLUSTER_NAME_MAX + 1];
+        struct stat st;
+        int pem;
+
+        if (!bundle_name(entry->d_name, name, &pem) || count == max) {
+            continue;
+        }
+        /* Follows the symlinks of mounted ConfigMaps and Secrets */
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        uint64_t h = fnv(1469598103934665603ULL, entry->d_name, strlen(entry->d_name));
+        h = fnv(h, &st.st_ino, sizeof(st.st_ino));
+        h = fnv(h, &st.st_dev, sizeof(st.st_dev));
+        h = fnv(h, &st.st_size, sizeof(st.st_size));
+        h = fnv(h, &st.st_mtim, sizeof(st.st_mtim));
+        /* Independent of the order entries are listed in */
+        *signature += h;
+        snprintf(names[count++], NAME_MAX + 1, "%s", entry->d_name);
+    }
+    closedir(d);
+    *signature += (uint64_t)count;
+    return count;
+}
+
+int k8s_issuers_reload(void) {
+    /* A few extra names so that too many bundles are reported */
+    enum { MAX_NAMES = K8S_ISSUERS_MAX_BUNDLES + 8 };
+    char (*names)[NAME_MAX + 1] = NULL;
+    uint64_t signature = 0;
+    int skipped = 0;
+    int installed = 0;
+
+    k8s_mutex_lock(&issuers_lock);
+    reclaim(K8S_ISSUERS_GRACE_SECONDS);
+
+    if (issuer_dir) {
+        names = k8s_malloc(K8S_MEM_ISSUERS, sizeof(*names) * MAX_NAMES);
+    }
+    int count = names ? list_bundles(issuer_dir, names, MAX_NAMES, &signature) : 0;
+
+    if (issuer_dir && (!names || count < 0)) {
+        if (!warned) {
+            K8S_LOG(K8S_LOG_WARNING, "issuers_load_failed",
+                    "dir=\"%s\" reason=%s action=keep_previous", issuer_dir,
+                    names ? "unreadable" : "out_of_memory");
+            warned = 1;
+        }
+    } else if (issuer_dir && (!have_loaded || signature != loaded_signature)) {
+        index_t *index = build_index(issuer_dir, names, count, &skipped);
+
+        if (index) {
+            publish(index);
+            loaded_signature = signature;
+            have_loaded = 1;
+            warned = 0;
+            installed = 1;
+            K8S_LOG(K8S_LOG_INFO, "issuers_loaded", "dir=\"%s\" issuers=%d keys=%d skipped=%d",
+                    issuer_dir, index->bundle_count, index->key_count, skipped);
+        } else if (!warned) {
+            K8S_LOG(K8S_LOG_WARNING, "issuers_load_failed",
+                    "dir=\"%s\" reason=out_of_memory action=keep_previous", issuer_dir);
+            warned = 1;
+        }
+    }
+    k8s_mutex_unlock(&issuers_lock);
+
+    k8s_free(names);
+    return installed;
+}
+
+int k8s_issuers_known(const char *cluster) {
+    index_t *index = acquire_index();
+    int known = find_bundle(index, cluster) >= 0;
+    release_index(index);
+    return known;
+}
+
+int k8s_issuers_verify(const char *cluster, const char *token, const char *audience,
+                       k8s_token_info_t *info) {
+    char kid[K8S_JWKS_KID_MAX + 1];
+    char issuer[K8S_ISSUER_MAX + 1] = "";
+    k8s_jwk_alg_t alg;
+    int has_kid = 0;
+    const char *reason = NULL;
+    int verified = 0;
+
+    memset(info, 0, sizeof(*info));
+    json_object *payload = token ? k8s_jwt_payload(token) : NULL;
+    json_object *iss = NULL;
+
+    if (!payload || !k8s_jwks_header(token, &alg, kid, &has_kid) || !has_kid ||
+        !json_object_object_get_ex(payload, "iss", &iss) ||
+        !json_object_is_type(iss, json_type_string) ||
+        strlen(json_object_get_string(iss)) > K8S_ISSUER_MAX) {
+        reason = "not_verifiable";
+    } else {
+        snprintf(issuer, sizeof(issuer), "%s", json_object_get_string(iss));
+    }
+
+    if (!reason) {
+        index_t *index = acquire_index();
+        const slot_t *slot = index ? find(index, issuer, kid) : NULL;
+        const bundle_t *bundle = slot ? &index->bundles[slot->bundle] : NULL;
+
+        if (!slot) {
+            reason = "unknown_key";
+        } else if (strcmp(bundle->name, cluster) != 0) {
+            reason = "other_cluster";
+        } else if (!k8s_jwt_audience_matches(payload, audience ? audience : bundle->audience)) {
+            reason = "audience";
+        } else if (!(verified = k8s_jwks_verify_key(token, &slot->key, bundle->issuer,
+                                                    NULL, info))) {
+            reason = "invalid";
+        }
+        release_index(index);
+    }
+    json_object_put(payload);
+
+    info->reviewed = 1;
+    if (reason) {
+        K8S_LOG(K8S_LOG_DEBUG, "issuer_refused", "cluster=%s reason=%s", cluster, reason);
+        return 0;
+    }
+
+    /* As the API server reports them for a ServiceAccount */
+    snprintf(info->groups, sizeof(info->groups),
+             "system:serviceaccounts\nsystem:serviceaccounts:%s\nsystem:authenticated",
+             info->namespace);
+    return verified;
+}
+
+int k8s_issuers_count(void) {
+    index_t *index = acquire_index();
+    int count = index ? index->key_count : 0;
+    release_index(index);
+    return count;
+}
+
+void k8s_issuers_shutdown(void) {
+    k8s_mutex_lock(&issuers_lock);
+    publish(NULL);
+    reclaim(0);
+    free(issuer_dir);
+    issuer_dir = NULL;
+    have_loaded = 0;
+    warned = 0;
+    k8s_mutex_unlock(&issuers_lock);
+}
@@ -0,0 +1,103 @@
+/*
+ * Offline Issuers
+ *
+ * Verifies the tokens of clusters the plugin cannot reach, against their
+ * signing keys mounted as files, so that their logins make no network
+ * request at all. Each file of the issuer directory holds the keys of one
+ * cluster and is named after it:
+ *
+ *   <cluster>.jwks   the cluster's /openid/v1/jwks document, with the
+ *                    cluster's issuer added as an "issuer" member
+ *   <cluster>.pem    a line "issuer: <issuer>", then PEM public keys
+ *
+ * A bundle may name the audience its tokens must be issued for, as an
+ * "audience" member or an "audience: <audience>" line; it defaults to the
+ * issuer, the API server's own audience.
+ *
+ * PEM keys get the key id the API server derives from them. All keys are
+ * indexed by issuer and key id in one hash table, rebuilt off the login path
+ * when a file changes and published as a whole, as the denylist is. A file
+ * that cannot be used keeps the keys it had.
+ *
+ * A verified token is trusted like a token of the jwks backend: its
+ * signature, time claims and ServiceAccount are checked, but not whether
+ * the ServiceAccount or pod still exist.
+ */
+
+#ifndef K8S_ISSUERS_H
+#define K8S_ISSUERS_H
+
+#include "tokenreview_api.h"
+
+/* Longest issuer kept */
+#define K8S_ISSUER_MAX 512
+
+/* Most bundles in the directory */
+#define K8S_ISSUERS_MAX_BUNDLES 64
+
+/* Most keys per bundle */
+#define K8S_ISSUERS_MAX_KEYS 8
+
+/* Minimum age in seconds of a replaced index before it may be freed */
+#define K8S_ISSUERS_GRACE_SECONDS 10
+
+/**
+ * Set the issuer directory
+ *
+ * The directory is read by the next k8s_issuers_reload(). An empty path
+ * drops every key at once.
+ *
+ * @param dir Directory (copied); NULL or empty disables offline issuers
+ */
+void k8s_issuers_configure(const char *dir);
+
+/**
+ * Load the bundles again if any of them changed since the last load
+ *
+ * Also frees replaced indexes older than K8S_ISSUERS_GRACE_SECONDS that no
+ * login uses any more.
+ *
+ * @return 1 if a new index was installed, 0 otherwise
+ */
+int k8s_issuers_reload(void);
+
+/**
+ * Whether a cluster has a bundle
+ *
+ * @param cluster Cluster name
+ * @return 1 if keys of the cluster are loaded, 0 otherwise
+ */
+int k8s_issuers_known(const char *cluster);
+
+/**
+ * Verify a token of a cluster against its bundle
+ *
+ * The token must name its issuer and key id, the key must be in the
+ * cluster's bundle, and the token's aud must include the given audience,
+ * or without one the bundle's. Every call is a verdict: a token that does
+ * not verify is rejected.
+ *
+ * @param cluster Cluster the login comes from
+ * @param token Token as sent by the client
+ * @param audience Audience the token must be issued for, or NULL for the
+ *                 bundle's
+ * @param info Filled like a TokenReview result, with reviewed set to 1 and
+ *             the groups the API server would report
+ * @return 1 if the token verified, 0 otherwise
+ */
+int k8s_issuers_verify(const char *cluster, const char *token, const char *audience,
+                       k8s_token_info_t *info);
+
+/**
+ * @return Number of keys in the current index
+ */
+int k8s_issuers_count(void);
+
+/**
+ * Free the current and all replaced indexes and forget the directory
+ *
+ * Only safe once no login can be verifying a token.
+ */
+void k8s_issuers_shutdown(void);
+
+#endif /* K8S_ISSUERS_H */
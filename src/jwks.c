@@ -0,0 +1,492 @@
+/*
+ * Issuer Signing Keys Implementation
+ */
+
+#include "jwks.h"
+#include "jwt.h"
+#include "log.h"
+#include "instrumentation.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <json-c/json.h>
+#include <openssl/evp.h>
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/core_names.h>
+#include <openssl/param_build.h>
+
+/* Largest encoded header and signature accepted */
+#define MAX_HEADER_LEN 4096
+#define MAX_SIGNATURE_LEN 1400
+
+/* Largest RSA modulus accepted, in bytes (8192 bits) */
+#define MAX_MODULUS_LEN 1024
+
+static k8s_mutex_t jwks_lock = K8S_MUTEX_INITIALIZER(K8S_MUTEX_JWKS);
+static k8s_jwk_t *keys = NULL;
+static int key_count = 0;
+static time_t loaded_at = 0;
+static time_t unknown_kid_at = 0;   /* Last token naming a key not in the set */
+static time_t fetched_at = 0;       /* Last fetch attempt */
+static char key_issuer[K8S_JWKS_ISSUER_MAX + 1] = "";   /* Issuer the keys sign for */
+
+static const char *get_string(json_object *obj, const char *key) {
+    json_object *value = NULL;
+    if (!json_object_object_get_ex(obj, key, &value) ||
+        !json_object_is_type(value, json_type_string)) {
+        return NULL;
+    }
+    return json_object_get_string(value);
+}
+
+/* Decode a base64url member into buf; 0 if missing, invalid or too long */
+static int get_bytes(json_object *obj, const char *key, unsigned char *buf, size_t max,
+                     size_t *len) {
+    const char *text = get_string(obj, key);
+    size_t text_len = text ? strlen(text) : 0;
+    if (text_len == 0 || text_len * 3 / 4 > max) {
+        return 0;
+    }
+    return k8s_base64url_decode(text, text_len, buf, len);
+}
+
+static EVP_PKEY *pkey_from_params(const char *type, OSSL_PARAM *params) {
+    EVP_PKEY *pkey = NULL;
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_from_name(NULL, type, NULL);
+    if (!ctx || EVP_PKEY_fromdata_init(ctx) <= 0 ||
+        EVP_PKEY_fromdata(ctx, &pkey, EVP_PKEY_PUBLIC_KEY, params) <= 0) {
+        pkey = NULL;
+    }
+    EVP_PKEY_CTX_free(ctx);
+    return pkey;
+}
+
+static EVP_PKEY *rsa_key(json_object *jwk) {
+    unsigned char n[MAX_MODULUS_LEN + 2];
+    unsigned char e[16];
+    size_t n_len = 0, e_len = 0;
+    EVP_PKEY *pkey = NULL;
+
+    if (!get_bytes(jwk, "n", n, sizeof(n), &n_len) ||
+        !get_bytes(jwk, "e", e, sizeof(e), &e_len) || n_len < 256) {
+        return NULL;
+    }
+
+    BIGNUM *bn_n = BN_bin2bn(n, (int)n_len, NULL);
+    BIGNUM *bn_e = BN_bin2bn(e, (int)e_len, NULL);
+    OSSL_PARAM_BLD *bld = OSSL_PARAM_BLD_new();
+    OSSL_PARAM *params = NULL;
+    if (bn_n && bn_e && bld &&
+        OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_N, bn_n) &&
+        OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_E, bn_e) &&
+        (params = OSSL_PARAM_BLD_to_param(bld)) != NULL) {
+        pkey = pkey_from_params("RSA", params);
+    }
+    OSSL_PARAM_free(params);
+    OSSL_PARAM_BLD_free(bld);
+    BN_free(bn_n);
+    BN_free(bn_e);
+    return pkey;
+}
+
+static EVP_PKEY *ec_key(json_object *jwk) {
+    unsigned char point[65];
+    size_t x_len = 0, y_len = 0;
+    const char *crv = get_string(jwk, "crv");
+
+    if (!crv || strcmp(crv, "P-256") != 0 ||
+        !get_bytes(jwk, "x", point + 1, 33, &x_len) || x_len != 32 ||
+        !get_bytes(jwk, "y", point + 33, 33, &y_len) || y_len != 32) {
+        return NULL;
+    }
+    point[0] = POINT_CONVERSION_UNCOMPRESSED;
+
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_utf8_string(OSSL_PKEY_PARAM_GROUP_NAME, "prime256v1", 0),
+        OSSL_PARAM_construct_octet_string(OSSL_PKEY_PARAM_PUB_KEY, point, sizeof(point)),
+        OSSL_PARAM_construct_end()
+    };
+    return pkey_from_params("EC", params);
+}
+
+void k8s_jwks_free_keys(k8s_jwk_t *set, int count) {
+    for (int i = 0; set && i < count; i++) {
+        EVP_PKEY_free(set[i].pkey);
+        set[i].pkey = NULL;
+    }
+}
+
+static void free_keys(k8s_jwk_t *set, int count) {
+    k8s_jwks_free_keys(set, count);
+    k8s_free(set);
+}
+
+int k8s_jwks_parse(const char *json, k8s_jwk_t *set, int max, char *issuer, size_t issuer_len) {
+    json_object *doc = json ? json_tokener_parse(json) : NULL;
+    json_object *list = NULL;
+    int count = 0;
+
+    if (!doc || !json_object_object_get_ex(doc, "keys", &list) ||
+        !json_object_is_type(list, json_type_array)) {
+        json_object_put(doc);
+        return -1;
+    }
+    if (issuer && issuer_len > 0) {
+        const char *iss = get_string(doc, "issuer");
+        snprintf(issuer, issuer_len, "%s", iss && strlen(iss) < issuer_len ? iss : "");
+    }
+
+    size_t n = json_object_array_length(list);
+    for (size_t i = 0; i < n && count < max; i++) {
+        json_object *jwk = json_object_array_get_idx(list, i);
+        const char *kty = get_string(jwk, "kty");
+        const char *kid = get_string(jwk, "kid");
+        const char *use = get_string(jwk, "use");
+        k8s_jwk_t *key = &set[count];
+
+        if (!kty || (use && strcmp(use, "sig") != 0)) {
+            continue;
+        }
+        if (strcmp(kty, "RSA") == 0) {
+            key->alg = K8S_JWK_RS256;
+            key->pkey = rsa_key(jwk);
+        } else if (strcmp(kty, "EC") == 0) {
+            key->alg = K8S_JWK_ES256;
+            key->pkey = ec_key(jwk);
+        }
+        if (!key->pkey) {
+            K8S_LOG(K8S_LOG_DEBUG, "jwks_key_skipped", "kid=\"%s\" kty=%s",
+                    kid ? kid : "", kty);
+            continue;
+        }
+        snprintf(key->kid, sizeof(key->kid), "%s", kid ? kid : "");
+        count++;
+    }
+    json_object_put(doc);
+    return count;
+}
+
+int k8s_jwks_load(const char *json, const char *issuer) {
+    char doc_issuer[K8S_JWKS_ISSUER_MAX + 1] = "";
+    k8s_jwk_t *set = k8s_calloc(K8S_MEM_JWKS, K8S_JWKS_MAX_KEYS, sizeof(k8s_jwk_t));
+    if (!set) {
+        K8S_LOG(K8S_LOG_ERROR, "out_of_memory", "where=jwks");
+        return 0;
+    }
+
+    int count = k8s_jwks_parse(json, set, K8S_JWKS_MAX_KEYS, doc_issuer, sizeof(doc_issuer));
+    if (!issuer || !*issuer) {
+        issuer = doc_issuer;
+    }
+    if (count < 0) {
+        K8S_LOG(K8S_LOG_WARNING, "jwks_invalid", "reason=not_a_jwks");
+        k8s_free(set);
+        return 0;
+    }
+    if (count == 0) {
+        K8S_LOG(K8S_LOG_WARNING, "jwks_invalid", "reason=no_usable_keys");
+        k8s_free(set);
+        return 0;
+    }
+    /* Without it a token issued for another audience cannot be told apart */
+    if (!*issuer || strlen(issuer) > K8S_JWKS_ISSUER_MAX) {
+        K8S_LOG(K8S_LOG_WARNING, "jwks_invalid", "reason=no_issuer");
+        free_keys(set, count);
+        return 0;
+    }
+
+    k8s_mutex_lock(&jwks_lock);
+    k8s_jwk_t *old = keys;
+    int old_count = key_count;
+    keys = set;
+    key_count = count;
+    strcpy(key_issuer, issuer);
+    loaded_at = time(NULL);
+    unknown_kid_at = 0;
+    k8s_mutex_unlock(&jwks_lock);
+
+    free_keys(old, old_count);
+    K8S_LOG(K8S_LOG_INFO, "jwks_loaded", "keys=%d issuer=\"%s\"", count, issuer);
+    return count;
+}
+
+int k8s_jwks_refresh(const k8s_config_t *config) {
+    k8s_mutex_lock(&jwks_lock);
+    fetched_at = time(NULL);
+    k8s_mutex_unlock(&jwks_lock);
+
+    /* The issuer is the audience of tokens meant for the API server */
+    char issuer[K8S_JWKS_ISSUER_MAX + 1] = "";
+    char *body = k8s_api_get(K8S_JWKS_DISCOVERY_PATH, config);
+    if (!body) {
+        return 0;
+    }
+    json_object *doc = json_tokener_parse(body);
+    const char *iss = doc ? get_string(doc, "issuer") : NULL;
+    if (iss && strlen(iss) <= K8S_JWKS_ISSUER_MAX) {
+        strcpy(issuer, iss);
+    }
+    json_object_put(doc);
+    k8s_free(body);
+    if (!*issuer) {
+        K8S_LOG(K8S_LOG_WARNING, "jwks_invalid", "reason=no_issuer path=%s",
+                K8S_JWKS_DISCOVERY_PATH);
+        return 0;
+    }
+
+    body = k8s_api_get(K8S_JWKS_PATH, config);
+    if (!body) {
+        return 0;
+    }
+    int loaded = k8s_jwks_load(body, issuer);
+    k8s_free(body);
+    return loaded > 0;
+}
+
+int k8s_jwks_needs_refresh(int max_age) {
+    time_t now = time(NULL);
+    k8s_mutex_lock(&jwks_lock);
+    int due = key_count == 0 ? fetched_at + K8S_JWKS_MIN_REFETCH <= now :
+              loaded_at + max_age <= now ||
+              (unknown_kid_at && unknown_kid_at >= fetched_at && fetched_at + K8S_JWKS_MIN_REFETCH <= now);
+    k8s_mutex_unlock(&jwks_lock);
+    return due;
+}
+
+/* Key for a token header, with a reference the caller frees, and the issuer
+ * it signs for (if issuer is not NULL) */
+static EVP_PKEY *find_key(const char *kid, k8s_jwk_alg_t alg, char *issuer) {
+    EVP_PKEY *pkey = NULL;
+    int found = 0;
+
+    k8s_mutex_lock(&jwks_lock);
+    for (int i = 0; i < key_count; i++) {
+        /* Without a kid only a lone key can be meant */
+        if (kid ? strcmp(keys[i].kid, kid) == 0 : key_count == 1) {
+            found = 1;
+            if (keys[i].alg == alg && EVP_PKEY_up_ref(keys[i].pkey)) {
+                pkey = keys[i].pkey;
+                if (issuer) {
+                    strcpy(issuer, key_issuer);
+                }
+            }
+            break;
+        }
+    }
+    if (!found && key_count > 0) {
+        unknown_kid_at = time(NULL);
+    }
+    k8s_mutex_unlock(&jwks_lock);
+    return pkey;
+}
+
+/* Raw r || s (JWS) to the DER encoding OpenSSL verifies */
+static int es256_to_der(const unsigned char *sig, size_t len, unsigned char **der,
+                        int *der_len) {
+    if (len != 64) {
+        return 0;
+    }
+    ECDSA_SIG *ecdsa = ECDSA_SIG_new();
+    BIGNUM *r = BN_bin2bn(sig, 32, NULL);
+    BIGNUM *s = BN_bin2bn(sig + 32, 32, NULL);
+    if (!ecdsa || !r || !s || !ECDSA_SIG_set0(ecdsa, r, s)) {
+        BN_free(r);
+        BN_free(s);
+        ECDSA_SIG_free(ecdsa);
+        return 0;
+    }
+    *der = NULL;
+    *der_len = i2d_ECDSA_SIG(ecdsa, der);
+    ECDSA_SIG_free(ecdsa);
+    return *der_len > 0;
+}
+
+static int verify_signature(const char *token, const char *second_dot, EVP_PKEY *pkey,
+                            k8s_jwk_alg_t alg) {
+    unsigned char sig[MAX_SIGNATURE_LEN];
+    size_t sig_len = 0;
+    const char *encoded = second_dot + 1;
+    size_t encoded_len = strlen(encoded);
+    unsigned char *der = NULL;
+    int der_len = 0;
+    int ok = 0;
+
+    if (encoded_len == 0 || encoded_len * 3 / 4 > sizeof(sig) ||
+        !k8s_base64url_decode(encoded, encoded_len, sig, &sig_len)) {
+        return 0;
+    }
+
+    const unsigned char *check = sig;
+    size_t check_len = sig_len;
+    if (alg == K8S_JWK_ES256) {
+        if (!es256_to_der(sig, sig_len, &der, &der_len)) {
+            return 0;
+        }
+        check = der;
+        check_len = (size_t)der_len;
+    }
+
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    if (ctx && EVP_DigestVerifyInit(ctx, NULL, EVP_sha256(), NULL, pkey) == 1) {
+        ok = EVP_DigestVerify(ctx, check, check_len, (const unsigned char *)token,
+                              (size_t)(second_dot - token)) == 1;
+    }
+    EVP_MD_CTX_free(ctx);
+    OPENSSL_free(der);
+    return ok;
+}
+
+int k8s_jwks_header(const char *token, k8s_jwk_alg_t *alg, char *kid, int *has_kid) {
+    unsigned char header[MAX_HEADER_LEN];
+    const char *dot = token ? strchr(token, '.') : NULL;
+    size_t len = dot ? (size_t)(dot - token) : 0;
+    size_t header_len = 0;
+    int ok = 0;
+
+    if (len == 0 || len * 3 / 4 >= sizeof(header) ||
+        !k8s_base64url_decode(token, len, header, &header_len)) {
+        return 0;
+    }
+    header[header_len] = '\0';
+
+    json_object *obj = json_tokener_parse((const char *)header);
+    const char *name = obj ? get_string(obj, "alg") : NULL;
+    const char *id = obj ? get_string(obj, "kid") : NULL;
+    if (name && (strcmp(name, "RS256") == 0 || strcmp(name, "ES256") == 0)) {
+        *alg = name[0] == 'R' ? K8S_JWK_RS256 : K8S_JWK_ES256;
+        *has_kid = id != NULL;
+        snprintf(kid, K8S_JWKS_KID_MAX + 1, "%s", id ? id : "");
+        ok = 1;
+    }
+    json_object_put(obj);
+    return ok;
+}
+
+/* Issuer, audience, time claims and ServiceAccount identity; 0 if the token
+ * must not be trusted */
+static int check_claims(const char *token, time_t now, const char *issuer, const char *audience,
+                        k8s_token_info_t *info) {
+    json_object *payload = k8s_jwt_payload(token);
+    json_object *exp = NULL, *nbf = NULL, *k8s = NULL, *sa = NULL;
+    const char *sub = NULL;
+    const char *uid = NULL;
+    const char *iss = NULL;
+    int ok = 0;
+
+    if (!payload) {
+        return 0;
+    }
+    if ((!issuer || ((iss = get_string(payload, "iss")) != NULL && strcmp(iss, issuer) == 0)) &&
+        (!audience || k8s_jwt_audience_matches(payload, audience)) &&
+        json_object_object_get_ex(payload, "exp", &exp) &&
+        json_object_get_int64(exp) > (int64_t)now &&
+        (!json_object_object_get_ex(payload, "nbf", &nbf) ||
+         json_object_get_int64(nbf) <= (int64_t)now) &&
+        (sub = get_string(payload, "sub")) != NULL &&
+        json_object_object_get_ex(payload, "kubernetes.io", &k8s) &&
+        json_object_object_get_ex(k8s, "serviceaccount", &sa) &&
+        (uid = get_string(sa, "uid")) != NULL && strlen(uid) <= K8S_MAX_UID_LEN &&
+        strlen(sub) <= K8S_MAX_USERNAME_LEN &&
+        k8s_parse_username(sub, info->namespace, sizeof(info->namespace),
+                           info->service_account, sizeof(info->service_account))) {
+        strcpy(info->username, sub);
+        strcpy(info->uid, uid);
+        ok = 1;
+    }
+    json_object_put(payload);
+    return ok;
+}
+
+int k8s_jwks_verify_key(const char *token, const k8s_jwk_t *key, const char *issuer,
+                        const char *audience, k8s_token_info_t *info) {
+    const char *dot = strchr(token, '.');
+    const char *second_dot = dot ? strchr(dot + 1, '.') : NULL;
+    k8s_jwk_alg_t alg;
+    char kid[K8S_JWKS_KID_MAX + 1];
+    int has_kid = 0;
+
+    memset(info, 0, sizeof(*info));
+    if (!second_dot || !k8s_jwks_header(token, &alg, kid, &has_kid) || alg != key->alg) {
+        return 0;
+    }
+
+    time_t now = time(NULL);
+    if (!verify_signature(token, second_dot, key->pkey, key->alg) ||
+        !check_claims(token, now, issuer, audience, info)) {
+        memset(info, 0, sizeof(*info));
+        return 0;
+    }
+
+    info->authenticated = 1;
+    info->validated_at = now;
+    return 1;
+}
+
+int k8s_jwks_verify(const char *token, k8s_token_info_t *info) {
+    char kid[K8S_JWKS_KID_MAX + 1];
+    char issuer[K8S_JWKS_ISSUER_MAX + 1];
+    k8s_jwk_t key;
+    int has_kid = 0;
+
+    if (!token || !info) {
+        return 0;
+    }
+    memset(info, 0, sizeof(*info));
+    memset(&key, 0, sizeof(key));
+
+    if (!k8s_jwks_header(token, &key.alg, kid, &has_kid)) {
+        return 0;
+    }
+    key.pkey = find_key(has_kid ? kid : NULL, key.alg, issuer);
+    if (!key.pkey) {
+        return 0;
+    }
+    int verified = k8s_jwks_verify_key(token, &key, issuer, issuer, info);
+    EVP_PKEY_free(key.pkey);
+    return verified;
+}
+
+int k8s_jwks_forged(const char *token) {
+    const char *dot = token ? strchr(token, '.') : NULL;
+    const char *second_dot = dot ? strchr(dot + 1, '.') : NULL;
+    char kid[K8S_JWKS_KID_MAX + 1];
+    k8s_jwk_t key;
+    int has_kid = 0;
+
+    memset(&key, 0, sizeof(key));
+    if (!second_dot || !k8s_jwks_header(token, &key.alg, kid, &has_kid) || !has_kid) {
+        return 0;
+    }
+    key.pkey = find_key(kid, key.alg, NULL);
+    if (!key.pkey) {
+        return 0;
+    }
+    int forged = !verify_signature(token, second_dot, key.pkey, key.alg);
+    EVP_PKEY_free(key.pkey);
+    return forged;
+}
+
+int k8s_jwks_count(void) {
+    k8s_mutex_lock(&jwks_lock);
+    int count = key_count;
+    k8s_mutex_unlock(&jwks_lock);
+    return count;
+}
+
+void k8s_jwks_clear(void) {
+    k8s_mutex_lock(&jwks_lock);
+    k8s_jwk_t *old = keys;
+    int old_count = key_count;
+    keys = NULL;
+    key_count = 0;
+    loaded_at = 0;
+    fetched_at = 0;
+    unknown_kid_at = 0;
+    key_issuer[0] = '\0';
+    k8s_mutex_unlock(&jwks_lock);
+
+    free_keys(old, old_count);
+}
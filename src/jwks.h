@@ -0,0 +1,169 @@
+/*
+ * Issuer Signing Keys
+ *
+ * Keeps the public keys the API server signs ServiceAccount tokens with, as
+ * it publishes them at /openid/v1/jwks, so that a token's signature and
+ * claims can be checked locally in microseconds. Only tokens issued for the
+ * API server itself are verified. A locally verified token is only trusted
+ * provisionally: it may have been bound to a pod that is gone, so
+ * TokenReview remains the authority (see k8s_session_confirm()).
+ *
+ * RS256 and ES256 keys are supported. Parsing and verification are also
+ * used with the key bundles of other clusters (see issuers.h).
+ */
+
+#ifndef K8S_JWKS_H
+#define K8S_JWKS_H
+
+#include "tokenreview_api.h"
+#include <openssl/evp.h>
+
+/* Where the API server publishes its ServiceAccount signing keys */
+#define K8S_JWKS_PATH "/openid/v1/jwks"
+
+/* Where the API server publishes its issuer */
+#define K8S_JWKS_DISCOVERY_PATH "/.well-known/openid-configuration"
+
+/* Most keys kept; clusters rotating keys publish two or three */
+#define K8S_JWKS_MAX_KEYS 32
+
+/* Minimum seconds between refetches triggered by an unknown key id */
+#define K8S_JWKS_MIN_REFETCH 10
+
+/* Longest key id kept */
+#define K8S_JWKS_KID_MAX 128
+
+/* Longest issuer kept */
+#define K8S_JWKS_ISSUER_MAX 512
+
+typedef enum { K8S_JWK_RS256, K8S_JWK_ES256 } k8s_jwk_alg_t;
+
+/* A public signing key */
+typedef struct {
+    char kid[K8S_JWKS_KID_MAX + 1];
+    k8s_jwk_alg_t alg;
+    EVP_PKEY *pkey;
+} k8s_jwk_t;
+
+/**
+ * Parse the usable keys of a JWKS document
+ *
+ * @param json JWKS document ({"keys": [...]})
+ * @param set Filled with up to max keys, to be freed with k8s_jwks_free_keys()
+ * @param max Size of set
+ * @param issuer Set to the document's "issuer" member, empty if it has none
+ *               or it does not fit; may be NULL
+ * @param issuer_len Size of issuer
+ * @return Number of keys parsed, -1 if json is not a JWKS document
+ */
+int k8s_jwks_parse(const char *json, k8s_jwk_t *set, int max, char *issuer, size_t issuer_len);
+
+/**
+ * Release the keys of a set (not the set itself)
+ *
+ * @param set Keys
+ * @param count Number of keys in set
+ */
+void k8s_jwks_free_keys(k8s_jwk_t *set, int count);
+
+/**
+ * Read the algorithm and key id from a token's header
+ *
+ * @param token Token as sent by the client
+ * @param alg Set to the signing algorithm
+ * @param kid Set to the key id, at least K8S_JWKS_KID_MAX + 1 bytes
+ * @param has_kid Set to 1 if the header names a key id
+ * @return 1 if the header is a JWS header with a supported algorithm
+ */
+int k8s_jwks_header(const char *token, k8s_jwk_alg_t *alg, char *kid, int *has_kid);
+
+/**
+ * Verify a ServiceAccount token against one key
+ *
+ * Checks as k8s_jwks_verify() does, with the given key, issuer and audience.
+ *
+ * @param token Token as sent by the client
+ * @param key Key the token must be signed with
+ * @param issuer Issuer iss must name, or NULL for any
+ * @param audience Audience aud must include, or NULL for any
+ * @param info Filled like a TokenReview result, with reviewed set to 0
+ * @return 1 if the token verified, 0 otherwise
+ */
+int k8s_jwks_verify_key(const char *token, const k8s_jwk_t *key, const char *issuer,
+                        const char *audience, k8s_token_info_t *info);
+
+/**
+ * Replace the key set from a JWKS document
+ *
+ * Keys of unsupported types are skipped. A document without any usable key,
+ * or without an issuer, leaves the current set in place.
+ *
+ * @param json JWKS document ({"keys": [...]})
+ * @param issuer Issuer the keys sign for, or NULL for the document's
+ *               "issuer" member
+ * @return Number of keys loaded, 0 if the set was not replaced
+ */
+int k8s_jwks_load(const char *json, const char *issuer);
+
+/**
+ * Fetch the API server's issuer and key set and load them
+ *
+ * @param config Configuration for K8s API access
+ * @return 1 if a new set was loaded, 0 otherwise
+ */
+int k8s_jwks_refresh(const k8s_config_t *config);
+
+/**
+ * Whether the key set should be fetched again
+ *
+ * True when no set was ever loaded, when the set is max_age seconds old, or
+ * when a token named a key id the set lacks (at most every
+ * K8S_JWKS_MIN_REFETCH seconds).
+ *
+ * @param max_age Seconds after which the set is refreshed regardless
+ * @return 1 if k8s_jwks_refresh() is due, 0 otherwise
+ */
+int k8s_jwks_needs_refresh(int max_age);
+
+/**
+ * Verify a ServiceAccount token locally
+ *
+ * Checks the signature against the loaded keys, that iss is the API
+ * server's issuer and aud includes it (the audience of tokens meant for the
+ * API server, which TokenReview accepts without audiences), that exp is in
+ * the future, nbf in the past, that sub names a ServiceAccount and that the
+ * token carries the ServiceAccount UID. Legacy Secret-based tokens without
+ * exp, and tokens a pod requested for another audience, are not verified
+ * locally.
+ *
+ * @param token Token as sent by the client
+ * @param info Filled like a TokenReview result, with reviewed set to 0
+ * @return 1 if the token verified, 0 otherwise
+ */
+int k8s_jwks_verify(const char *token, k8s_token_info_t *info);
+
+/**
+ * Whether a token certainly was not signed by the cluster
+ *
+ * True only when the token names the key id of a loaded key of its
+ * algorithm and its signature does not verify against it. Tokens of keys
+ * not loaded, and the claims, are left to the API server.
+ *
+ * @param token Token as sent by the client
+ * @return 1 if the signature is forged, 0 otherwise
+ */
+int k8s_jwks_forged(const char *token);
+
+/**
+ * Number of keys loaded
+ *
+ * @return Key count
+ */
+int k8s_jwks_count(void);
+
+/**
+ * Forget all keys
+ */
+void k8s_jwks_clear(void);
+
+#endif /* K8S_JWKS_H */
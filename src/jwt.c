@@ -0,0 +1,146 @@
+/*
+ * JWT Decoding Implementation
+ */
+
+#include "jwt.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Largest encoded payload accepted */
+#define MAX_PAYLOAD_LEN 16384
+
+static int b64url_value(unsigned char c) {
+    if (c >= 'A' && c <= 'Z') {
+        return c - 'A';
+    }
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 26;
+    }
+    if (c >= '0' && c <= '9') {
+        return c - '0' + 52;
+    }
+    if (c == '-') {
+        return 62;
+    }
+    if (c == '_') {
+        return 63;
+    }
+    return -1;
+}
+
+int k8s_base64url_decode(const char *in, size_t len, unsigned char *out, size_t *out_len) {
+    unsigned int acc = 0;
+    int bits = 0;
+    size_t n = 0;
+
+    /* Tolerate padding even though JWTs omit it */
+    while (len > 0 && in[len - 1] == '=') {
+        len--;
+    }
+    if (len % 4 == 1) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        int v = b64url_value((unsigned char)in[i]);
+        if (v < 0) {
+            return 0;
+        }
+        acc = (acc << 6) | (unsigned int)v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out[n++] = (unsigned char)(acc >> bits);
+        }
+    }
+
+    *out_len = n;
+    return 1;
+}
+
+json_object *k8s_jwt_payload(const char *token) {
+    const char *start = token ? strchr(token, '.') : NULL;
+    if (!start) {
+        return NULL;
+    }
+    start++;
+
+    const char *end = strchr(start, '.');
+    if (!end || end == start || (size_t)(end - start) > MAX_PAYLOAD_LEN) {
+        return NULL;
+    }
+
+    size_t len = (size_t)(end - start);
+    unsigned char *json = malloc(len * 3 / 4 + 2);
+    size_t json_len = 0;
+    if (!json) {
+        return NULL;
+    }
+    if (!k8s_base64url_decode(start, len, json, &json_len)) {
+        free(json);
+        return NULL;
+    }
+    json[json_len] = '\0';
+
+    json_object *claims = json_tokener_parse((const char *)json);
+    free(json);
+    if (claims && !json_object_is_type(claims, json_type_object)) {
+        json_object_put(claims);
+        return NULL;
+    }
+    return claims;
+}
+
+int k8s_jwt_audience_matches(json_object *payload, const char *audience) {
+    json_object *aud = NULL;
+
+    if (!json_object_object_get_ex(payload, "aud", &aud)) {
+        return 0;
+    }
+    if (json_object_is_type(aud, json_type_string)) {
+        return strcmp(json_object_get_string(aud), audience) == 0;
+    }
+    if (json_object_is_type(aud, json_type_array)) {
+        size_t n = json_object_array_length(aud);
+        for (size_t i = 0; i < n; i++) {
+            json_object *item = json_object_array_get_idx(aud, i);
+            if (json_object_is_type(item, json_type_string) &&
+                strcmp(json_object_get_string(item), audience) == 0) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int k8s_jwt_claims(const char *token, k8s_jwt_claims_t *claims) {
+    json_object *payload = k8s_jwt_payload(token);
+    json_object *exp = NULL, *k8s = NULL, *pod = NULL, *uid = NULL;
+
+    memset(claims, 0, sizeof(*claims));
+    if (!payload) {
+        return 0;
+    }
+
+    if (json_object_object_get_ex(payload, "exp", &exp) &&
+        (json_object_is_type(exp, json_type_int) || json_object_is_type(exp, json_type_double))) {
+        int64_t value = json_object_get_int64(exp);
+        claims->exp = value > 0 ? (time_t)value : 0;
+    }
+
+    /* Bound tokens: {"kubernetes.io": {"pod": {"name": ..., "uid": ...}}} */
+    if (json_object_object_get_ex(payload, "kubernetes.io", &k8s) &&
+        json_object_object_get_ex(k8s, "pod", &pod) &&
+        json_object_object_get_ex(pod, "uid", &uid) &&
+        json_object_is_type(uid, json_type_string)) {
+        strncpy(claims->pod_uid, json_object_get_string(uid), K8S_JWT_UID_MAX);
+    }
+
+    json_object_put(payload);
+    return 1;
+}
+
+time_t k8s_jwt_expiry(const char *token) {
+    k8s_jwt_claims_t claims;
+    return k8s_jwt_claims(token, &claims) ? claims.exp : 0;
+}
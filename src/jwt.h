@@ -0,0 +1,72 @@
+/*
+ * JWT Decoding
+ *
+ * Reads the claims of a ServiceAccount token without verifying its
+ * signature. Only use the claims of a token that was validated some other
+ * way (e.g. by TokenReview), or for decisions that are safe on untrusted
+ * input.
+ */
+
+#ifndef K8S_JWT_H
+#define K8S_JWT_H
+
+#include <stddef.h>
+#include <time.h>
+#include <json-c/json.h>
+
+/* Longest pod UID kept from a token */
+#define K8S_JWT_UID_MAX 128
+
+/* ServiceAccount token claims used by the plugin */
+typedef struct {
+    time_t exp;                            /* 0 if absent */
+    char pod_uid[K8S_JWT_UID_MAX + 1];     /* kubernetes.io/pod/uid; empty if not pod-bound */
+} k8s_jwt_claims_t;
+
+/**
+ * Decode unpadded base64url
+ *
+ * @param in Encoded text
+ * @param len Length of in
+ * @param out Output buffer, at least len * 3 / 4 + 1 bytes
+ * @param out_len Set to the decoded length
+ * @return 1 on success, 0 on invalid input
+ */
+int k8s_base64url_decode(const char *in, size_t len, unsigned char *out, size_t *out_len);
+
+/**
+ * Parse the payload (second part) of a JWT
+ *
+ * @param token Compact serialized JWT
+ * @return Claims object (caller releases with json_object_put), or NULL if
+ *         the token is not a JWT
+ */
+json_object *k8s_jwt_payload(const char *token);
+
+/**
+ * Whether a payload's aud claim, a string or a list, names an audience
+ *
+ * @param payload Claims from k8s_jwt_payload()
+ * @param audience Audience looked for
+ * @return 1 if aud names it, 0 otherwise
+ */
+int k8s_jwt_audience_matches(json_object *payload, const char *audience);
+
+/**
+ * Extract the claims the plugin uses
+ *
+ * @param token Compact serialized JWT
+ * @param claims Filled in; fields missing from the token are zero/empty
+ * @return 1 if the token is a JWT, 0 otherwise
+ */
+int k8s_jwt_claims(const char *token, k8s_jwt_claims_t *claims);
+
+/**
+ * Expiry of a JWT from its exp claim
+ *
+ * @param token Compact serialized JWT
+ * @return exp as a Unix time, or 0 if absent or not a JWT
+ */
+time_t k8s_jwt_expiry(const char *token);
+
+#endif /* K8S_JWT_H */
@@ -0,0 +1,381 @@
+/*
+ * Asynchronous Structured Logging Implementation
+ *
+ * Each logging thread owns a single-producer/single-consumer ring; the drain
+ * thread is the only consumer. Rings are kept on a push-only list and handed
+ * to a new thread once their owner has exited and they are drained, so the
+ * list only grows to the number of threads logging at the same time.
+ */
+
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+/* Slots of the rate limiter table, indexed by line hash */
+#define RATE_SLOTS 64
+
+typedef struct {
+    long long ts_usec;                  /* Wall clock time of the call */
+    int level;
+    char event[K8S_LOG_EVENT_MAX];
+    char text[K8S_LOG_TEXT_MAX];
+} log_entry_t;
+
+typedef struct log_ring {
+    log_entry_t entries[K8S_LOG_RING_SIZE];
+    unsigned head;                      /* Next slot the owner writes */
+    unsigned tail;                      /* Next slot the drain thread reads */
+    int in_use;                         /* Owned by a live thread */
+    struct log_ring *next;
+} log_ring_t;
+
+typedef struct {
+    uint64_t hash;                      /* 0: free */
+    time_t window_start;
+    unsigned suppressed;
+    int level;
+    char event[K8S_LOG_EVENT_MAX];
+} rate_slot_t;
+
+int k8s_log_current_level = K8S_LOG_DEFAULT_LEVEL;
+
+static const char *level_names[] = { "error", "warning", "info", "debug" };
+
+/* Ring list and thread ownership */
+static log_ring_t *rings = NULL;
+static unsigned ring_generation = 1;    /* Bumped when the rings are freed */
+static __thread log_ring_t *my_ring = NULL;
+static __thread unsigned my_generation = 0;
+static pthread_key_t ring_key;
+
+/* Drain thread */
+static pthread_mutex_t state_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t state_cond;
+static pthread_t drain_thread;
+static int drain_running = 0;
+static int drain_stopping = 0;
+
+/* Output: sink, rate limiter and drop reporting, all under out_lock */
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+static k8s_log_sink_fn sink = NULL;
+static rate_slot_t rate_table[RATE_SLOTS];
+static unsigned long long dropped = 0;
+static unsigned long long dropped_reported = 0;
+
+static void stderr_sink(const char *line) {
+    fprintf(stderr, "%s\n", line);
+}
+
+static uint64_t line_hash(int level, const char *event, const char *text) {
+    uint64_t h = 1469598103934665603ULL ^ (uint64_t)level;
+    for (const char *p = event; *p; p++) {
+        h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+    }
+    h = (h ^ 0xff) * 1099511628211ULL;
+    for (const char *p = text; *p; p++) {
+        h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+/**
+ * Format the prefix and body of a line and hand it to the sink
+ */
+static void output(long long ts_usec, int level, const char *event, const char *text) {
+    char line[K8S_LOG_TEXT_MAX + 128];
+    char stamp[32];
+    time_t secs = (time_t)(ts_usec / 1000000);
+    struct tm tm;
+
+    localtime_r(&secs, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(line, sizeof(line), "%s.%03d K8s Auth: level=%s event=%s%s%s",
+             stamp, (int)(ts_usec / 1000 % 1000), level_names[level], event,
+             text[0] ? " " : "", text);
+
+    (sink ? sink : stderr_sink)(line);
+}
+
+static void output_suppressed(rate_slot_t *slot, long long ts_usec) {
+    char text[64];
+    snprintf(text, sizeof(text), "suppressed=%u window=%ds", slot->suppressed,
+             K8S_LOG_RATE_WINDOW);
+    output(ts_usec, slot->level, slot->event, text);
+}
+
+/**
+ * Write a line unless it repeats a line written within the rate window
+ */
+static void emit(const log_entry_t *entry) {
+    uint64_t hash = line_hash(entry->level, entry->event, entry->text);
+    rate_slot_t *slot = &rate_table[hash % RATE_SLOTS];
+    time_t now = (time_t)(entry->ts_usec / 1000000);
+
+    if (slot->hash == hash && now - slot->window_start < K8S_LOG_RATE_WINDOW) {
+        slot->suppressed++;
+        return;
+    }
+
+    /* Slot taken over by another line or window over: report the old one */
+    if (slot->hash && slot->suppressed) {
+        output_suppressed(slot, entry->ts_usec);
+    }
+
+    slot->hash = hash;
+    slot->window_start = now;
+    slot->suppressed = 0;
+    slot->level = entry->level;
+    strcpy(slot->event, entry->event);
+
+    output(entry->ts_usec, entry->level, entry->event, entry->text);
+}
+
+static long long now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Report suppressed repeats whose window has ended and new ring drops
+ */
+static void report_pending(int force) {
+    long long ts = now_usec();
+    time_t now = (time_t)(ts / 1000000);
+
+    for (int i = 0; i < RATE_SLOTS; i++) {
+        rate_slot_t *slot = &rate_table[i];
+        if (slot->hash && (force || now - slot->window_start >= K8S_LOG_RATE_WINDOW)) {
+            if (slot->suppressed) {
+                output_suppressed(slot, ts);
+            }
+            slot->hash = 0;
+            slot->suppressed = 0;
+        }
+    }
+
+    unsigned long long total = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    if (total != dropped_reported) {
+        char text[64];
+        snprintf(text, sizeof(text), "count=%llu", total - dropped_reported);
+        output(ts, K8S_LOG_WARNING, "log_dropped", text);
+        dropped_reported = total;
+    }
+}
+
+static void fill_entry(log_entry_t *entry, k8s_log_level_t level, const char *event,
+                       const char *fmt, va_list ap) {
+    entry->ts_usec = now_usec();
+    entry->level = level;
+    snprintf(entry->event, sizeof(entry->event), "%s", event);
+    vsnprintf(entry->text, sizeof(entry->text), fmt, ap);
+}
+
+static void release_ring(void *ring) {
+    __atomic_store_n(&((log_ring_t *)ring)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * The calling thread's ring: a drained ring left by an exited thread, or a
+ * new one
+ */
+static log_ring_t *thread_ring(void) {
+    unsigned generation = __atomic_load_n(&ring_generation, __ATOMIC_ACQUIRE);
+    if (my_ring && my_generation == generation) {
+        return my_ring;
+    }
+
+    log_ring_t *ring;
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        int expected = 0;
+        /* Only take over rings the drain thread has emptied */
+        if (__atomic_load_n(&ring->in_use, __ATOMIC_ACQUIRE) == 0 &&
+            ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) &&
+            __atomic_compare_exchange_n(&ring->in_use, &expected, 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (!ring) {
+        ring = calloc(1, sizeof(log_ring_t));
+        if (!ring) {
+            return NULL;
+        }
+        ring->in_use = 1;
+        ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+
+    my_ring = ring;
+    my_generation = generation;
+    pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+void k8s_log_write(k8s_log_level_t level, const char *event, const char *fmt, ...) {
+    va_list ap;
+
+    if (!__atomic_load_n(&drain_running, __ATOMIC_ACQUIRE)) {
+        log_entry_t entry;
+        va_start(ap, fmt);
+        fill_entry(&entry, level, event, fmt, ap);
+        va_end(ap);
+
+        pthread_mutex_lock(&out_lock);
+        emit(&entry);
+        pthread_mutex_unlock(&out_lock);
+        return;
+    }
+
+    log_ring_t *ring = thread_ring();
+    if (!ring) {
+        __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    unsigned head = ring->head;
+    unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= K8S_LOG_RING_SIZE) {
+        __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    va_start(ap, fmt);
+    fill_entry(&ring->entries[head % K8S_LOG_RING_SIZE], level, event, fmt, ap);
+    va_end(ap);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void k8s_log_flush(void) {
+    pthread_mutex_lock(&out_lock);
+    for (log_ring_t *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        unsigned tail = ring->tail;
+        unsigned head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        while (tail != head) {
+            emit(&ring->entries[tail % K8S_LOG_RING_SIZE]);
+            tail++;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    report_pending(0);
+    pthread_mutex_unlock(&out_lock);
+}
+
+static void *drain_main(void *unused) {
+    (void)unused;
+
+    pthread_mutex_lock(&state_lock);
+    while (!drain_stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += K8S_LOG_DRAIN_INTERVAL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+        }
+        pthread_cond_timedwait(&state_cond, &state_lock, &deadline);
+
+        pthread_mutex_unlock(&state_lock);
+        k8s_log_flush();
+        pthread_mutex_lock(&state_lock);
+    }
+    pthread_mutex_unlock(&state_lock);
+
+    k8s_log_flush();
+    return NULL;
+}
+
+int k8s_log_start(void) {
+    pthread_condattr_t attr;
+
+    pthread_mutex_lock(&state_lock);
+    if (drain_running) {
+        pthread_mutex_unlock(&state_lock);
+        return 1;
+    }
+
+    if (pthread_key_create(&ring_key, release_ring) != 0) {
+        pthread_mutex_unlock(&state_lock);
+        return 0;
+    }
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&state_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    drain_stopping = 0;
+    if (pthread_create(&drain_thread, NULL, drain_main, NULL) != 0) {
+        pthread_cond_destroy(&state_cond);
+        pthread_key_delete(ring_key);
+        pthread_mutex_unlock(&state_lock);
+        return 0;
+    }
+    __atomic_store_n(&drain_running, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&state_lock);
+
+    return 1;
+}
+
+void k8s_log_stop(void) {
+    pthread_mutex_lock(&state_lock);
+    if (!drain_running) {
+        pthread_mutex_unlock(&state_lock);
+        return;
+    }
+
+    /* New lines go straight to the sink from here on */
+    __atomic_store_n(&drain_running, 0, __ATOMIC_RELEASE);
+    drain_stopping = 1;
+    pthread_cond_signal(&state_cond);
+    pthread_mutex_unlock(&state_lock);
+
+    pthread_join(drain_thread, NULL);
+
+    pthread_mutex_lock(&state_lock);
+    pthread_cond_destroy(&state_cond);
+    pthread_key_delete(ring_key);
+
+    /* Threads still holding a ring see the generation change and never
+     * touch it again */
+    __atomic_add_fetch(&ring_generation, 1, __ATOMIC_ACQ_REL);
+    log_ring_t *ring = __atomic_exchange_n(&rings, NULL, __ATOMIC_ACQ_REL);
+    while (ring) {
+        log_ring_t *next = ring->next;
+        free(ring);
+        ring = next;
+    }
+    pthread_mutex_unlock(&state_lock);
+
+    pthread_mutex_lock(&out_lock);
+    report_pending(1);
+    pthread_mutex_unlock(&out_lock);
+}
+
+void k8s_log_set_level(int level) {
+    if (level < K8S_LOG_ERROR) {
+        level = K8S_LOG_ERROR;
+    }
+    if (level > K8S_LOG_DEBUG) {
+        level = K8S_LOG_DEBUG;
+    }
+    __atomic_store_n(&k8s_log_current_level, level, __ATOMIC_RELAXED);
+}
+
+void k8s_log_set_sink(k8s_log_sink_fn fn) {
+    pthread_mutex_lock(&out_lock);
+    sink = fn;
+    pthread_mutex_unlock(&out_lock);
+}
+
+unsigned long long k8s_log_dropped(void) {
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,119 @@
+/*
+ * Asynchronous Structured Logging
+ *
+ * Log calls format one key=value line into a lock-free ring buffer owned by
+ * the calling thread; a drain thread writes the lines to the error log. A
+ * message below the current level costs one relaxed atomic load, so the
+ * login path does no log I/O unless something is worth reporting. Identical
+ * lines repeated within K8S_LOG_RATE_WINDOW seconds are collapsed into a
+ * single "suppressed" summary.
+ *
+ * Output format:
+ *   2026-01-01 12:00:00.123 K8s Auth: level=warning event=login_failed user="ns/sa" reason=rejected
+ */
+
+#ifndef K8S_LOG_H
+#define K8S_LOG_H
+
+typedef enum {
+    K8S_LOG_ERROR = 0,
+    K8S_LOG_WARNING = 1,
+    K8S_LOG_INFO = 2,
+    K8S_LOG_DEBUG = 3
+} k8s_log_level_t;
+
+#define K8S_LOG_DEFAULT_LEVEL K8S_LOG_WARNING
+
+/* Entries per thread ring; further lines are dropped and counted */
+#define K8S_LOG_RING_SIZE 16
+
+/* Longest event name and key=value text kept per line */
+#define K8S_LOG_EVENT_MAX 32
+#define K8S_LOG_TEXT_MAX 320
+
+/* Interval in milliseconds at which the drain thread empties the rings */
+#define K8S_LOG_DRAIN_INTERVAL_MS 100
+
+/* Seconds during which repeats of an identical line are suppressed */
+#define K8S_LOG_RATE_WINDOW 10
+
+/**
+ * Output function for finished lines (without trailing newline)
+ */
+typedef void (*k8s_log_sink_fn)(const char *line);
+
+/* Current level; read through k8s_log_enabled() */
+extern int k8s_log_current_level;
+
+/**
+ * Whether a message of the given level would be logged
+ */
+static inline int k8s_log_enabled(k8s_log_level_t level) {
+    return (int)level <= __atomic_load_n(&k8s_log_current_level, __ATOMIC_RELAXED);
+}
+
+/**
+ * Log one line if the level is enabled
+ *
+ * Arguments are not evaluated when the level is disabled.
+ */
+#define K8S_LOG(level, event, ...) \
+    do { \
+        if (k8s_log_enabled(level)) { \
+            k8s_log_write((level), (event), __VA_ARGS__); \
+        } \
+    } while (0)
+
+/**
+ * Queue one line, without a level check
+ *
+ * Written synchronously when the drain thread is not running.
+ *
+ * @param level Message level
+ * @param event Short snake_case event name
+ * @param fmt printf-style key=value text
+ */
+void k8s_log_write(k8s_log_level_t level, const char *event, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/**
+ * Set the level threshold
+ *
+ * @param level New level; lines above it are discarded
+ */
+void k8s_log_set_level(int level);
+
+/**
+ * Replace the output function (NULL restores stderr)
+ *
+ * @param sink Function receiving each finished line
+ */
+void k8s_log_set_sink(k8s_log_sink_fn sink);
+
+/**
+ * Start the drain thread
+ *
+ * @return 1 on success, 0 on failure (logging stays synchronous)
+ */
+int k8s_log_start(void);
+
+/**
+ * Write all queued lines and stop the drain thread
+ *
+ * Logging is synchronous again afterwards.
+ */
+void k8s_log_stop(void);
+
+/**
+ * Write all queued lines now, from the calling thread
+ */
+void k8s_log_flush(void);
+
+/**
+ * Number of lines dropped because a thread's ring was full
+ *
+ * @return Total since load
+ */
+unsigned long long k8s_log_dropped(void);
+
+#endif /* K8S_LOG_H */
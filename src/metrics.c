@@ -0,0 +1,402 @@
+/*
+ * Prometheus Metrics Endpoint Implementation
+ */
+
+#include "metrics.h"
+#include "stats.h"
+#include "identity_stats.h"
+#include "backend.h"
+#include "cluster.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#define SUB_BUCKETS (1 << K8S_HIST_SUB_BITS)
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    int failed;
+} text_buf_t;
+
+static pthread_mutex_t control_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t listener;
+static int running = 0;
+static int listen_fd = -1;
+static int wake_fds[2] = { -1, -1 };
+
+static void append(text_buf_t *buf, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void append(text_buf_t *buf, const char *fmt, ...) {
+    va_list ap;
+
+    if (buf->failed) {
+        return;
+    }
+
+    for (;;) {
+        va_start(ap, fmt);
+        int n = vsnprintf(buf->data + buf->len, buf->cap - buf->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            buf->failed = 1;
+            return;
+        }
+        if (buf->len + (size_t)n < buf->cap) {
+            buf->len += (size_t)n;
+            return;
+        }
+
+        size_t cap = buf->cap * 2;
+        while (cap <= buf->len + (size_t)n) {
+            cap *= 2;
+        }
+        char *data = realloc(buf->data, cap);
+        if (!data) {
+            buf->failed = 1;
+            return;
+        }
+        buf->data = data;
+        buf->cap = cap;
+    }
+}
+
+/**
+ * One histogram with a bucket per power of two, in seconds
+ */
+static void render_histogram(text_buf_t *buf, const k8s_stats_totals_t *totals,
+                             k8s_hist_t hist) {
+    const char *name = k8s_stats_hist_name(hist);
+    uint64_t cumulative = 0;
+
+    append(buf, "# TYPE auth_k8s_%s_latency_seconds histogram\n", name);
+    for (int b = 0; b < K8S_HIST_BUCKETS; b++) {
+        cumulative += totals->hist[hist][b];
+        /* Report the last sub-bucket of every power of two; the finer
+         * split only matters for the status variable percentiles */
+        if (b % SUB_BUCKETS == SUB_BUCKETS - 1 && b < K8S_HIST_BUCKETS - 1) {
+            append(buf, "auth_k8s_%s_latency_seconds_bucket{le=\"%.6f\"} %llu\n", name,
+                   (double)k8s_stats_bucket_upper(b) / 1e6, (unsigned long long)cumulative);
+        }
+    }
+    append(buf, "auth_k8s_%s_latency_seconds_bucket{le=\"+Inf\"} %llu\n", name,
+           (unsigned long long)totals->hist_count[hist]);
+    append(buf, "auth_k8s_%s_latency_seconds_sum %.6f\n", name,
+           (double)totals->hist_sum[hist] / 1e6);
+    append(buf, "auth_k8s_%s_latency_seconds_count %llu\n", name,
+           (unsigned long long)totals->hist_count[hist]);
+}
+
+/**
+ * Health and counters of every validation backend, labelled by name
+ */
+static void render_backends(text_buf_t *buf) {
+    static const char *counters[] = { "requests", "verdicts", "accepted", "unavailable" };
+    k8s_backend_stats_t stats[K8S_BACKEND_MAX];
+    const char *names[K8S_BACKEND_MAX];
+    int n = k8s_backend_count();
+
+    if (n > K8S_BACKEND_MAX) {
+        n = K8S_BACKEND_MAX;
+    }
+    for (int i = 0; i < n; i++) {
+        const k8s_backend_t *backend = k8s_backend_get(i);
+        memset(&stats[i], 0, sizeof(stats[i]));
+        backend->stats(&stats[i]);
+        names[i] = backend->name;
+    }
+    if (n == 0) {
+        return;
+    }
+
+    for (int c = 0; c < 4; c++) {
+        append(buf, "# TYPE auth_k8s_backend_%s_total counter\n", counters[c]);
+        for (int i = 0; i < n; i++) {
+            unsigned long long values[4] = {
+                stats[i].requests, stats[i].verdicts, stats[i].accepted, stats[i].unavailable
+            };
+            append(buf, "auth_k8s_backend_%s_total{backend=\"%s\"} %llu\n", counters[c],
+                   names[i], values[c]);
+        }
+    }
+    append(buf, "# TYPE auth_k8s_backend_seconds_total counter\n");
+    for (int i = 0; i < n; i++) {
+        append(buf, "auth_k8s_backend_seconds_total{backend=\"%s\"} %.6f\n", names[i],
+               (double)stats[i].time_us / 1e6);
+    }
+    append(buf, "# TYPE auth_k8s_backend_healthy gauge\n");
+    for (int i = 0; i < n; i++) {
+        append(buf, "auth_k8s_backend_healthy{backend=\"%s\"} %d\n", names[i],
+               stats[i].healthy ? 1 : 0);
+    }
+}
+
+/**
+ * Circuits and counters of every remote cluster, labelled by name
+ */
+static void render_clusters(text_buf_t *buf) {
+    static const char *counters[] = { "requests", "unavailable", "refused", "shed" };
+    k8s_cluster_row_t *rows = malloc(sizeof(k8s_cluster_row_t) * K8S_CLUSTER_MAX);
+    int n = rows ? k8s_cluster_collect(rows, K8S_CLUSTER_MAX) : 0;
+
+    if (!rows) {
+        buf->failed = 1;
+        return;
+    }
+
+    /* Cluster names are [a-z0-9-], safe as label values */
+    for (int c = 0; n > 0 && c < 4; c++) {
+        append(buf, "# TYPE auth_k8s_cluster_%s_total counter\n", counters[c]);
+        for (int i = 0; i < n; i++) {
+            unsigned long long values[4] = {
+                rows[i].requests, rows[i].unavailable, rows[i].refused, rows[i].shed
+            };
+            append(buf, "auth_k8s_cluster_%s_total{cluster=\"%s\"} %llu\n", counters[c],
+                   rows[i].name, values[c]);
+        }
+    }
+    if (n > 0) {
+        append(buf, "# TYPE auth_k8s_cluster_in_flight gauge\n");
+        for (int i = 0; i < n; i++) {
+            append(buf, "auth_k8s_cluster_in_flight{cluster=\"%s\"} %d\n", rows[i].name,
+                   rows[i].in_flight);
+        }
+        append(buf, "# TYPE auth_k8s_cluster_open gauge\n");
+        for (int i = 0; i < n; i++) {
+            append(buf, "auth_k8s_cluster_open{cluster=\"%s\"} %d\n", rows[i].name,
+                   rows[i].open ? 1 : 0);
+        }
+    }
+    free(rows);
+}
+
+char *k8s_metrics_render(size_t *len) {
+    k8s_stats_totals_t *totals = malloc(sizeof(k8s_stats_totals_t));
+    text_buf_t buf = { malloc(16384), 0, 16384, 0 };
+
+    if (!totals || !buf.data) {
+        free(totals);
+        free(buf.data);
+        return NULL;
+    }
+    buf.data[0] = '\0';
+
+    k8s_stats_collect(totals);
+    for (int i = 0; i < K8S_STAT_COUNT; i++) {
+        const char *name = k8s_stats_name((k8s_stat_t)i);
+        append(&buf, "# TYPE auth_k8s_%s_total counter\nauth_k8s_%s_total %llu\n",
+               name, name, (unsigned long long)totals->counters[i]);
+    }
+    for (int h = 0; h < K8S_HIST_COUNT; h++) {
+        render_histogram(&buf, totals, (k8s_hist_t)h);
+    }
+    append(&buf, "# TYPE auth_k8s_identities_evicted_total counter\n"
+           "auth_k8s_identities_evicted_total %llu\n",
+           (unsigned long long)k8s_identity_evictions());
+    append(&buf, "# TYPE auth_k8s_log_dropped_total counter\n"
+           "auth_k8s_log_dropped_total %llu\n", k8s_log_dropped());
+    render_backends(&buf);
+    render_clusters(&buf);
+    free(totals);
+
+    if (buf.failed) {
+        free(buf.data);
+        return NULL;
+    }
+    *len = buf.len;
+    return buf.data;
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+static void send_status(int fd, const char *status) {
+    char head[128];
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+    write_all(fd, head, (size_t)n);
+}
+
+/**
+ * Answer one scrape; the connection is closed afterwards
+ */
+static void handle_client(int fd) {
+    char request[K8S_METRICS_MAX_REQUEST];
+    size_t got = 0;
+    struct timeval tv = { K8S_METRICS_IO_TIMEOUT, 0 };
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    /* Read the request head; the body, if any, is ignored */
+    while (got < sizeof(request) - 1) {
+        ssize_t n = recv(fd, request + got, sizeof(request) - 1 - got, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        got += (size_t)n;
+        request[got] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+            break;
+        }
+    }
+    request[got] = '\0';
+
+    if (strncmp(request, "GET ", 4) != 0) {
+        send_status(fd, "405 Method Not Allowed");
+        return;
+    }
+    const char *path = request + 4;
+    size_t path_len = strcspn(path, " ?\r\n");
+    if (!((path_len == 8 && strncmp(path, "/metrics", 8) == 0) ||
+          (path_len == 1 && path[0] == '/'))) {
+        send_status(fd, "404 Not Found");
+        return;
+    }
+
+    size_t body_len = 0;
+    char *body = k8s_metrics_render(&body_len);
+    if (!body) {
+        send_status(fd, "500 Internal Server Error");
+        return;
+    }
+
+    char head[192];
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                     "Content-Length: %zu\r\nConnection: close\r\n\r\n", body_len);
+    if (write_all(fd, head, (size_t)n)) {
+        write_all(fd, body, body_len);
+    }
+    free(body);
+}
+
+static void *listener_main(void *unused) {
+    (void)unused;
+    struct pollfd fds[2] = {
+        { listen_fd, POLLIN, 0 },
+        { wake_fds[0], POLLIN, 0 },
+    };
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents) {
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            int client = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (client >= 0) {
+                handle_client(client);
+                close(client);
+            }
+        }
+    }
+    return NULL;
+}
+
+int k8s_metrics_start(int port) {
+    struct sockaddr_in addr;
+    int one = 1;
+
+    pthread_mutex_lock(&control_lock);
+    if (running) {
+        pthread_mutex_unlock(&control_lock);
+        return 1;
+    }
+
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        goto fail;
+    }
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((unsigned short)port);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, 16) != 0) {
+        goto fail;
+    }
+
+    if (pipe2(wake_fds, O_CLOEXEC) != 0) {
+        wake_fds[0] = wake_fds[1] = -1;
+        goto fail;
+    }
+
+    if (pthread_create(&listener, NULL, listener_main, NULL) != 0) {
+        goto fail;
+    }
+
+    running = 1;
+    pthread_mutex_unlock(&control_lock);
+    K8S_LOG(K8S_LOG_INFO, "metrics_listening", "port=%d", port);
+    return 1;
+
+fail:
+    K8S_LOG(K8S_LOG_WARNING, "metrics_failed", "port=%d error=\"%s\"", port, strerror(errno));
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+    if (wake_fds[0] >= 0) {
+        close(wake_fds[0]);
+        close(wake_fds[1]);
+        wake_fds[0] = wake_fds[1] = -1;
+    }
+    pthread_mutex_unlock(&control_lock);
+    return 0;
+}
+
+void k8s_metrics_stop(void) {
+    pthread_mutex_lock(&control_lock);
+    if (!running) {
+        pthread_mutex_unlock(&control_lock);
+        return;
+    }
+
+    ssize_t ignored = write(wake_fds[1], "x", 1);
+    (void)ignored;
+    pthread_join(listener, NULL);
+
+    close(listen_fd);
+    close(wake_fds[0]);
+    close(wake_fds[1]);
+    listen_fd = -1;
+    wake_fds[0] = wake_fds[1] = -1;
+    running = 0;
+    pthread_mutex_unlock(&control_lock);
+}
@@ -0,0 +1,46 @@
+/*
+ * Prometheus Metrics Endpoint
+ *
+ * An optional listener thread serving the plugin's counters and latency
+ * histograms in the Prometheus text exposition format at /metrics, so they
+ * can be scraped without a database connection per scrape. Rendering only
+ * sums the statistics shards with atomic loads; it takes no lock that a
+ * login could wait on.
+ */
+
+#ifndef K8S_METRICS_H
+#define K8S_METRICS_H
+
+#include <stddef.h>
+
+/* Largest request head read from a scraper */
+#define K8S_METRICS_MAX_REQUEST 4096
+
+/* Seconds a scraper may take to send its request or read the response */
+#define K8S_METRICS_IO_TIMEOUT 2
+
+/**
+ * Render all metrics in the Prometheus text format
+ *
+ * @param len Set to the length of the result
+ * @return Allocated, NUL-terminated text (caller frees), or NULL on
+ *         allocation failure
+ */
+char *k8s_metrics_render(size_t *len);
+
+/**
+ * Start the listener thread
+ *
+ * @param port TCP port to listen on, all addresses
+ * @return 1 on success (or already running), 0 on failure
+ */
+int k8s_metrics_start(int port);
+
+/**
+ * Stop the listener thread and close its socket
+ *
+ * Safe to call when the listener is not running.
+ */
+void k8s_metrics_stop(void);
+
+#endif /* K8S_METRICS_H */
@@ -0,0 +1,619 @@
+/*
+ * Account Policies Implementation
+ */
+
+#include "policy.h"
+#include "cluster.h"
+#include "log.h"
+#include "instrumentation.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <json-c/json.h>
+
+/* Characters of Kubernetes names (lowercase DNS subdomains) and the
+ * namespace separator; nothing else can be part of a pattern */
+#define SYMBOLS 39
+
+#define NO_ACCOUNT -1
+
+/* Option not given: the global setting applies */
+#define UNSET -1
+
+/*
+ * One trie node per distinct pattern prefix. A child index of 0 means no
+ * child: the root is never anyone's child.
+ */
+typedef struct {
+    uint16_t next[SYMBOLS];
+    int32_t exact;                  /* Account of a pattern ending here */
+    int32_t prefix;                 /* Account of a pattern ending here in * */
+} trie_node_t;
+
+struct k8s_policy {
+    char *text;                     /* Authentication string, the cache key */
+    size_t text_len;
+    uint64_t hash;
+    int refs;                       /* The cache's reference and one per user */
+    uint64_t used;                  /* Cache clock at the last lookup */
+    struct k8s_policy *next;        /* Cache bucket chain */
+    int valid;
+    int rules;
+    trie_node_t *nodes;
+    int node_count;
+    char *arena;                    /* Parsed copy of text; all strings point here */
+    const char *audience;
+    int cache_ttl;
+    int timeout;
+    const char *groups[K8S_POLICY_MAX_GROUPS];
+    int group_count;
+    const char *label_keys[K8S_POLICY_MAX_LABELS];
+    const char *label_values[K8S_POLICY_MAX_LABELS];
+    int label_count;
+    const char *clusters[K8S_POLICY_MAX_CLUSTERS];
+    int cluster_count;
+};
+
+_Static_assert(K8S_POLICY_MAX_LEN < UINT16_MAX, "trie node index does not fit");
+
+static k8s_mutex_t cache_lock = K8S_MUTEX_INITIALIZER(K8S_MUTEX_POLICY);
+static k8s_policy_t *buckets[K8S_POLICY_CACHE_SIZE];
+static int cached = 0;
+static uint64_t cache_clock = 0;
+
+static int symbol(char c) {
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a';
+    }
+    if (c >= '0' && c <= '9') {
+        return 26 + (c - '0');
+    }
+    switch (c) {
+    case '-': return 36;
+    case '.': return 37;
+    case '/': return 38;
+    default:  return -1;
+    }
+}
+
+static uint64_t text_hash(const char *text, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)text[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+/* Strip surrounding white space in place */
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) {
+        s++;
+    }
+    size_t len = strlen(s);
+    while (len > 0 && isspace((unsigned char)s[len - 1])) {
+        s[--len] = '\0';
+    }
+    return s;
+}
+
+/* Characters of one name part, a trailing * excluded; 0 if one is invalid */
+static int valid_part(const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '/' || symbol(s[i]) < 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Reduce a pattern to the literal its matches start with. The literal is
+ * always a prefix of the pattern itself.
+ *
+ * @return Length of the literal, -1 if the pattern is malformed
+ */
+static int pattern_literal(const char *pattern, int *is_prefix) {
+    size_t len = strlen(pattern);
+    const char *slash = strchr(pattern, '/');
+
+    *is_prefix = 1;
+    if (len == 1 && pattern[0] == '*') {
+        return 0;
+    }
+    if (!slash || slash == pattern) {
+        return -1;
+    }
+
+    size_t ns_len = (size_t)(slash - pattern);
+    const char *name = slash + 1;
+    size_t name_len = len - ns_len - 1;
+    if (name_len == 0) {
+        return -1;
+    }
+
+    if (pattern[ns_len - 1] == '*') {
+        /* Any rest of the namespace: the name cannot be narrowed any more */
+        if (name_len != 1 || name[0] != '*' || !valid_part(pattern, ns_len - 1)) {
+            return -1;
+        }
+        return (int)ns_len - 1;
+    }
+    if (!valid_part(pattern, ns_len)) {
+        return -1;
+    }
+    if (name[name_len - 1] == '*') {
+        return valid_part(name, name_len - 1) ? (int)len - 1 : -1;
+    }
+    *is_prefix = 0;
+    return valid_part(name, name_len) ? (int)len : -1;
+}
+
+/* Account names are used as given, so refuse anything that cannot be one */
+static int valid_account(const char *account) {
+    size_t len = strlen(account);
+    if (len == 0 || len > K8S_POLICY_ACCOUNT_MAX) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)account[i];
+        if (isspace(c) || iscntrl(c) || c == '\'' || c == '"' || c == '`') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Compile one "<pattern> -> <account>" item; returns NULL or why it failed */
+static const char *compile_rule(k8s_policy_t *policy, char *item) {
+    char *arrow = strstr(item, "->");
+    int is_prefix;
+
+    if (!arrow) {
+        return "unknown_item";
+    }
+    *arrow = '\0';
+    char *pattern = trim(item);
+    char *account = trim(arrow + 2);
+
+    int literal = pattern_literal(pattern, &is_prefix);
+    if (literal < 0) {
+        return "bad_pattern";
+    }
+    if (!valid_account(account)) {
+        return "bad_account";
+    }
+
+    int node = 0;
+    for (int i = 0; i < literal; i++) {
+        int s = symbol(pattern[i]);
+        if (!policy->nodes[node].next[s]) {
+            trie_node_t *child = &policy->nodes[policy->node_count];
+            child->exact = NO_ACCOUNT;
+            child->prefix = NO_ACCOUNT;
+            policy->nodes[node].next[s] = (uint16_t)policy->node_count++;
+        }
+        node = policy->nodes[node].next[s];
+    }
+
+    int32_t *slot = is_prefix ? &policy->nodes[node].prefix : &policy->nodes[node].exact;
+    if (*slot != NO_ACCOUNT) {
+        return "duplicate_pattern";
+    }
+    *slot = (int32_t)(account - policy->arena);
+    policy->rules++;
+    return NULL;
+}
+
+/* Non-negative integer option value within [min, max], or -1 */
+static int int_value(const char *value, int min, int max) {
+    char *end;
+    errno = 0;
+    long v = strtol(value, &end, 10);
+    if (!isdigit((unsigned char)value[0]) || *end || errno || v < min || v > max) {
+        return -1;
+    }
+    return (int)v;
+}
+
+static int plain_value(const char *value, int allow_empty) {
+    size_t len = strlen(value);
+    if ((len == 0 && !allow_empty) || len > K8S_POLICY_VALUE_MAX) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (isspace((unsigned char)value[i]) || iscntrl((unsigned char)value[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Compile one "<key>=<value>" item; returns NULL or why it failed */
+static const char *compile_option(k8s_policy_t *policy, char *key, char *value) {
+    if (strcmp(key, "audience") == 0) {
+        if (policy->audience) {
+            return "duplicate_option";
+        }
+        if (!plain_value(value, 0)) {
+            return "bad_value";
+        }
+        policy->audience = value;
+    } else if (strcmp(key, "cache_ttl") == 0 || strcmp(key, "timeout") == 0) {
+        int is_ttl = key[0] == 'c';
+        int *slot = is_ttl ? &policy->cache_ttl : &policy->timeout;
+        if (*slot != UNSET) {
+            return "duplicate_option";
+        }
+        /* The ranges of auth_k8s_cache_ttl and auth_k8s_timeout */
+        if ((*slot = int_value(value, is_ttl ? 0 : 1, is_ttl ? 86400 : 300)) == UNSET) {
+            return "bad_value";
+        }
+    } else if (strcmp(key, "group") == 0) {
+        if (policy->group_count == K8S_POLICY_MAX_GROUPS) {
+            return "too_many_groups";
+        }
+        if (!plain_value(value, 0)) {
+            return "bad_value";
+        }
+        policy->groups[policy->group_count++] = value;
+    } else if (strcmp(key, "pod_label") == 0) {
+        char *eq = strchr(value, '=');
+        if (policy->label_count == K8S_POLICY_MAX_LABELS) {
+            return "too_many_labels";
+        }
+        if (!eq) {
+            return "bad_value";
+        }
+        *eq = '\0';
+        if (!plain_value(value, 0) || !plain_value(eq + 1, 1)) {
+            return "bad_value";
+        }
+        policy->label_keys[policy->label_count] = value;
+        policy->label_values[policy->label_count++] = eq + 1;
+    } else if (strcmp(key, "cluster") == 0) {
+        size_t len = strlen(value);
+        if (policy->cluster_count == K8S_POLICY_MAX_CLUSTERS) {
+            return "too_many_clusters";
+        }
+        if (len == 0 || len > K8S_CLUSTER_NAME_MAX ||
+            strspn(value, "abcdefghijklmnopqrstuvwxyz0123456789-") != len) {
+            return "bad_value";
+        }
+        policy->clusters[policy->cluster_count++] = value;
+    } else {
+        return "unknown_option";
+    }
+    return NULL;
+}
+
+/* Compile one item, a rule or an option; returns NULL or why it failed */
+static const char *compile_item(k8s_policy_t *policy, char *item) {
+    /* Options start with a lowercase key; patterns cannot contain = */
+    size_t key_len = strspn(item, "abcdefghijklmnopqrstuvwxyz_");
+    char *eq = item + key_len;
+    while (isspace((unsigned char)*eq)) {
+        eq++;
+    }
+    if (key_len == 0 || *eq != '=') {
+        return compile_rule(policy, item);
+    }
+    item[key_len] = '\0';
+    return compile_option(policy, item, trim(eq + 1));
+}
+
+/* Parse the items of policy->arena; returns NULL or why it failed */
+static const char *compile_items(k8s_policy_t *policy, int *item_number) {
+    char *item = policy->arena;
+
+    /* Each node but the root stands for at least one character */
+    policy->nodes = k8s_calloc(K8S_MEM_POLICY, policy->text_len + 1, sizeof(trie_node_t));
+    if (!policy->nodes) {
+        return "out_of_memory";
+    }
+    policy->nodes[0].exact = NO_ACCOUNT;
+    policy->nodes[0].prefix = NO_ACCOUNT;
+    policy->node_count = 1;
+
+    for (*item_number = 1; ; (*item_number)++) {
+        char *comma = strchr(item, ',');
+        if (comma) {
+            *comma = '\0';
+        }
+        char *text = trim(item);
+        if (*text) {
+            const char *reason = compile_item(policy, text);
+            if (reason) {
+                return reason;
+            }
+        }
+        if (!comma) {
+            return NULL;
+        }
+        item = comma + 1;
+    }
+}
+
+static void destroy(k8s_policy_t *policy) {
+    k8s_free(policy->nodes);
+    k8s_free(policy->arena);
+    k8s_free(policy->text);
+    k8s_free(policy);
+}
+
+static k8s_policy_t *compile(const char *text, size_t len, uint64_t hash) {
+    k8s_policy_t *policy = k8s_calloc(K8S_MEM_POLICY, 1, sizeof(*policy));
+    if (!policy) {
+        return NULL;
+    }
+    policy->text = k8s_malloc(K8S_MEM_POLICY, len);
+    policy->arena = k8s_malloc(K8S_MEM_POLICY, len + 1);
+    if (!policy->text || !policy->arena) {
+        destroy(policy);
+        return NULL;
+    }
+    memcpy(policy->text, text, len);
+    memcpy(policy->arena, text, len);
+    policy->arena[len] = '\0';
+    policy->text_len = len;
+    policy->hash = hash;
+    policy->cache_ttl = UNSET;
+    policy->timeout = UNSET;
+
+    const char *reason;
+    int item = 0;
+    if (len > K8S_POLICY_MAX_LEN) {
+        reason = "too_long";
+    } else if (memchr(text, '\0', len)) {
+        reason = "bad_character";
+    } else {
+        reason = compile_items(policy, &item);
+    }
+
+    if (reason) {
+        if (strcmp(reason, "out_of_memory") == 0) {
+            destroy(policy);
+            return NULL;
+        }
+        K8S_LOG(K8S_LOG_WARNING, "policy_invalid", "item=%d reason=%s", item, reason);
+        k8s_free(policy->nodes);
+        policy->nodes = NULL;
+        policy->node_count = 0;
+        policy->rules = 0;
+        policy->audience = NULL;
+        policy->cache_ttl = UNSET;
+        policy->timeout = UNSET;
+        policy->group_count = 0;
+        policy->label_count = 0;
+        policy->cluster_count = 0;
+        return policy;
+    }
+
+    /* Give back the nodes the estimate reserved but the rules did not use */
+    trie_node_t *nodes = k8s_realloc(K8S_MEM_POLICY, policy->nodes,
+                                     policy->node_count * sizeof(trie_node_t));
+    if (nodes) {
+        policy->nodes = nodes;
+    }
+    policy->valid = 1;
+    return policy;
+}
+
+/* Caller holds cache_lock */
+static k8s_policy_t *find(const char *text, size_t len, uint64_t hash) {
+    k8s_policy_t *p = buckets[hash % K8S_POLICY_CACHE_SIZE];
+    while (p && (p->hash != hash || p->text_len != len || memcmp(p->text, text, len) != 0)) {
+        p = p->next;
+    }
+    if (p) {
+        __atomic_add_fetch(&p->refs, 1, __ATOMIC_RELAXED);
+        p->used = ++cache_clock;
+    }
+    return p;
+}
+
+/* Unlink the least recently used policy; caller holds cache_lock and
+ * releases the cache's reference of the result */
+static k8s_policy_t *evict(void) {
+    k8s_policy_t **victim = NULL;
+    for (int i = 0; i < K8S_POLICY_CACHE_SIZE; i++) {
+        for (k8s_policy_t **link = &buckets[i]; *link; link = &(*link)->next) {
+            if (!victim || (*link)->used < (*victim)->used) {
+                victim = link;
+            }
+        }
+    }
+    if (!victim) {
+        return NULL;
+    }
+    k8s_policy_t *p = *victim;
+    *victim = p->next;
+    cached--;
+    return p;
+}
+
+k8s_policy_t *k8s_policy_acquire(const char *auth_string, size_t len) {
+    if (!auth_string || len == 0) {
+        return NULL;
+    }
+    uint64_t hash = text_hash(auth_string, len);
+
+    k8s_mutex_lock(&cache_lock);
+    k8s_policy_t *policy = find(auth_string, len, hash);
+    k8s_mutex_unlock(&cache_lock);
+    if (policy) {
+        return policy;
+    }
+
+    /* Compile outside the lock; if another login was quicker, use its copy */
+    k8s_policy_t *fresh = compile(auth_string, len, hash);
+    if (!fresh) {
+        K8S_LOG(K8S_LOG_ERROR, "out_of_memory", "where=policy");
+        return NULL;
+    }
+
+    k8s_policy_t *evicted = NULL;
+    k8s_mutex_lock(&cache_lock);
+    policy = find(auth_string, len, hash);
+    if (!policy) {
+        if (cached >= K8S_POLICY_CACHE_SIZE) {
+            evicted = evict();
+        }
+        policy = fresh;
+        policy->refs = 2;
+        policy->used = ++cache_clock;
+        policy->next = buckets[hash % K8S_POLICY_CACHE_SIZE];
+        buckets[hash % K8S_POLICY_CACHE_SIZE] = policy;
+        cached++;
+        fresh = NULL;
+    }
+    k8s_mutex_unlock(&cache_lock);
+
+    if (fresh) {
+        destroy(fresh);
+    }
+    k8s_policy_release(evicted);
+    return policy;
+}
+
+void k8s_policy_release(k8s_policy_t *policy) {
+    if (policy && __atomic_sub_fetch(&policy->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        destroy(policy);
+    }
+}
+
+int k8s_policy_valid(const k8s_policy_t *policy) {
+    return policy->valid;
+}
+
+int k8s_policy_rules(const k8s_policy_t *policy) {
+    return policy->rules;
+}
+
+const char *k8s_policy_map(const k8s_policy_t *policy, const char *identity) {
+    if (!policy->valid || policy->rules == 0) {
+        return NULL;
+    }
+
+    /* The deepest * rule passed so far is the longest matching pattern,
+     * unless the whole identity is matched exactly */
+    const trie_node_t *node = &policy->nodes[0];
+    int32_t best = node->prefix;
+    for (const char *c = identity; node && *c; c++) {
+        int s = symbol(*c);
+        node = s >= 0 && node->next[s] ? &policy->nodes[node->next[s]] : NULL;
+        if (node && node->prefix != NO_ACCOUNT) {
+            best = node->prefix;
+        }
+    }
+    if (node && node->exact != NO_ACCOUNT) {
+        best = node->exact;
+    }
+    return best != NO_ACCOUNT ? policy->arena + best : NULL;
+}
+
+const char *k8s_policy_audience(const k8s_policy_t *policy) {
+    return policy ? policy->audience : NULL;
+}
+
+int k8s_policy_cache_ttl(const k8s_policy_t *policy, int fallback) {
+    return policy && policy->cache_ttl != UNSET ? policy->cache_ttl : fallback;
+}
+
+int k8s_policy_timeout(const k8s_policy_t *policy, int fallback) {
+    return policy && policy->timeout != UNSET ? policy->timeout : fallback;
+}
+
+int k8s_policy_strict(const k8s_policy_t *policy) {
+    return policy && (policy->audience || policy->group_count > 0 || policy->label_count > 0);
+}
+
+int k8s_policy_groups_allowed(const k8s_policy_t *policy, const char *groups) {
+    if (!policy || policy->group_count == 0) {
+        return 1;
+    }
+    for (const char *line = groups; line && *line; ) {
+        const char *end = strchr(line, '\n');
+        size_t len = end ? (size_t)(end - line) : strlen(line);
+        for (int i = 0; i < policy->group_count; i++) {
+            if (strlen(policy->groups[i]) == len && memcmp(policy->groups[i], line, len) == 0) {
+                return 1;
+            }
+        }
+        line = end ? end + 1 : line + len;
+    }
+    return 0;
+}
+
+int k8s_policy_cluster_allowed(const k8s_policy_t *policy, const char *cluster) {
+    if (!policy || policy->cluster_count == 0) {
+        /* Mapping rules match on namespace/name alone */
+        return !policy || policy->rules == 0 || strcmp(cluster, K8S_CLUSTER_LOCAL) == 0;
+    }
+    for (int i = 0; i < policy->cluster_count; i++) {
+        if (strcmp(policy->clusters[i], cluster) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int k8s_policy_pod_labels(const k8s_policy_t *policy) {
+    return policy ? policy->label_count : 0;
+}
+
+int k8s_policy_pod_allowed(const k8s_policy_t *policy, const char *pod_json,
+                           const char *pod_uid) {
+    json_object *pod = pod_json ? json_tokener_parse(pod_json) : NULL;
+    json_object *metadata = NULL, *uid = NULL, *labels = NULL;
+    int allowed = pod && pod_uid && pod_uid[0] &&
+                  json_object_object_get_ex(pod, "metadata", &metadata) &&
+                  json_object_object_get_ex(metadata, "uid", &uid) &&
+                  json_object_is_type(uid, json_type_string) &&
+                  strcmp(json_object_get_string(uid), pod_uid) == 0;
+
+    if (allowed && policy->label_count > 0) {
+        allowed = json_object_object_get_ex(metadata, "labels", &labels);
+        for (int i = 0; allowed && i < policy->label_count; i++) {
+            json_object *value = NULL;
+            allowed = json_object_object_get_ex(labels, policy->label_keys[i], &value) &&
+                      json_object_is_type(value, json_type_string) &&
+                      strcmp(json_object_get_string(value), policy->label_values[i]) == 0;
+        }
+    }
+    if (pod) {
+        json_object_put(pod);
+    }
+    return allowed;
+}
+
+int k8s_policy_cached(void) {
+    k8s_mutex_lock(&cache_lock);
+    int count = cached;
+    k8s_mutex_unlock(&cache_lock);
+    return count;
+}
+
+void k8s_policy_clear(void) {
+    k8s_policy_t *dropped = NULL;
+
+    k8s_mutex_lock(&cache_lock);
+    for (int i = 0; i < K8S_POLICY_CACHE_SIZE; i++) {
+        while (buckets[i]) {
+            k8s_policy_t *p = buckets[i];
+            buckets[i] = p->next;
+            p->next = dropped;
+            dropped = p;
+        }
+    }
+    cached = 0;
+    k8s_mutex_unlock(&cache_lock);
+
+    while (dropped) {
+        k8s_policy_t *p = dropped;
+        dropped = p->next;
+        k8s_policy_release(p);
+    }
+}
@@ -0,0 +1,181 @@
+/*
+ * Account Policies
+ *
+ * Compiles the authentication string of an account (IDENTIFIED VIA auth_k8s
+ * USING '...') once and keeps the result cached by its text, so a login
+ * looks a policy up instead of parsing it; an ALTER USER changes the text
+ * and so compiles a new one. A policy is a comma-separated list of items:
+ *
+ *   <pattern> -> <account>   log the ServiceAccount in as <account>, through
+ *                            MariaDB's PROXY mechanism
+ *   audience=<audience>      accept only tokens issued for this audience
+ *   cache_ttl=<seconds>      reuse window of validated tokens, in place of
+ *                            auth_k8s_cache_ttl (0: review every login)
+ *   timeout=<seconds>        TokenReview timeout, in place of auth_k8s_timeout
+ *   group=<group>            require membership of this group (repeatable:
+ *                            any one of them)
+ *   pod_label=<key>=<value>  require the pod the token is bound to to carry
+ *                            this label (repeatable: all of them)
+ *   cluster=<name>           accept logins from this cluster of cluster.h
+ *                            (repeatable: any one of them; "local" for the
+ *                            plugin's own)
+ *
+ * audience, group and pod_label depend on the TokenReview of the login
+ * itself, so such an account never accepts a cached, optimistic or ticket
+ * login (see k8s_policy_strict()). Without cluster, an account with mapping
+ * rules only accepts ServiceAccounts of the local cluster, since the rules
+ * match on namespace and name alone; any other account accepts the cluster
+ * its user name names.
+ *
+ * A pattern is <namespace>/<name>, where either part may end in * to match
+ * any rest of that part. A namespace ending in * must be followed by a name
+ * of just * (every name), and a lone * matches every ServiceAccount. The
+ * rules are compiled into a prefix trie, so finding the account for a
+ * ServiceAccount takes one walk along its name however many rules there
+ * are; when several rules match, the longest pattern wins.
+ */
+
+#ifndef K8S_POLICY_H
+#define K8S_POLICY_H
+
+#include <stddef.h>
+
+/* Longest authentication string compiled; longer ones are invalid */
+#define K8S_POLICY_MAX_LEN 4096
+
+/* Longest account name a rule may map to (USERNAME_CHAR_LENGTH) */
+#define K8S_POLICY_ACCOUNT_MAX 128
+
+/* Compiled policies kept; the least recently used one is dropped */
+#define K8S_POLICY_CACHE_SIZE 256
+
+/* Most group, pod_label and cluster options per account */
+#define K8S_POLICY_MAX_GROUPS 16
+#define K8S_POLICY_MAX_LABELS 16
+#define K8S_POLICY_MAX_CLUSTERS 16
+
+/* Longest option value */
+#define K8S_POLICY_VALUE_MAX 256
+
+typedef struct k8s_policy k8s_policy_t;
+
+/**
+ * Get the compiled policy for an authentication string
+ *
+ * Compiles and caches it on first use. A string that cannot be compiled
+ * yields an invalid policy, which is cached and logged once as well.
+ *
+ * @param auth_string Authentication string of the account
+ * @param len Length of auth_string
+ * @return Policy to pass to k8s_policy_release(), NULL if the string is
+ *         empty or on allocation failure
+ */
+k8s_policy_t *k8s_policy_acquire(const char *auth_string, size_t len);
+
+/**
+ * Release a policy from k8s_policy_acquire()
+ *
+ * @param policy Policy, may be NULL
+ */
+void k8s_policy_release(k8s_policy_t *policy);
+
+/**
+ * @param policy Policy
+ * @return 1 if the authentication string compiled, 0 otherwise
+ */
+int k8s_policy_valid(const k8s_policy_t *policy);
+
+/**
+ * @param policy Policy
+ * @return Number of mapping rules
+ */
+int k8s_policy_rules(const k8s_policy_t *policy);
+
+/**
+ * Find the account a ServiceAccount is mapped to
+ *
+ * @param policy Policy
+ * @param identity ServiceAccount as namespace/name
+ * @return Account of the longest matching pattern, NULL if none matches
+ */
+const char *k8s_policy_map(const k8s_policy_t *policy, const char *identity);
+
+/**
+ * @param policy Policy, may be NULL
+ * @return Audience tokens must be issued for, NULL for the API server's
+ */
+const char *k8s_policy_audience(const k8s_policy_t *policy);
+
+/**
+ * @param policy Policy, may be NULL
+ * @param fallback Global setting
+ * @return Seconds a validated token may be reused for this account
+ */
+int k8s_policy_cache_ttl(const k8s_policy_t *policy, int fallback);
+
+/**
+ * @param policy Policy, may be NULL
+ * @param fallback Global setting
+ * @return TokenReview timeout in seconds for this account
+ */
+int k8s_policy_timeout(const k8s_policy_t *policy, int fallback);
+
+/**
+ * Whether every login needs a TokenReview of its own
+ *
+ * True when the policy has an audience, group or pod_label: neither the
+ * token cache nor local signature checks nor tickets know about those.
+ *
+ * @param policy Policy, may be NULL
+ * @return 1 if so, 0 otherwise
+ */
+int k8s_policy_strict(const k8s_policy_t *policy);
+
+/**
+ * Check the groups of a reviewed token
+ *
+ * @param policy Policy, may be NULL
+ * @param groups Groups of the token, one per line
+ * @return 1 if the policy requires no group or one of them is listed
+ */
+int k8s_policy_groups_allowed(const k8s_policy_t *policy, const char *groups);
+
+/**
+ * Check the cluster a login comes from
+ *
+ * @param policy Policy, may be NULL
+ * @param cluster Cluster name, K8S_CLUSTER_LOCAL for the local cluster
+ * @return 1 if the account accepts logins from it, 0 otherwise
+ */
+int k8s_policy_cluster_allowed(const k8s_policy_t *policy, const char *cluster);
+
+/**
+ * @param policy Policy, may be NULL
+ * @return Number of required pod labels
+ */
+int k8s_policy_pod_labels(const k8s_policy_t *policy);
+
+/**
+ * Check the pod a token is bound to
+ *
+ * @param policy Policy
+ * @param pod_json Pod object as returned by the API server
+ * @param pod_uid UID the token was bound to; a pod recreated under the same
+ *                name does not match
+ * @return 1 if the pod is the one the token was issued for and carries
+ *         every required label, 0 otherwise
+ */
+int k8s_policy_pod_allowed(const k8s_policy_t *policy, const char *pod_json,
+                           const char *pod_uid);
+
+/**
+ * @return Number of cached policies
+ */
+int k8s_policy_cached(void);
+
+/**
+ * Drop every cached policy; policies still acquired stay usable
+ */
+void k8s_policy_clear(void);
+
+#endif /* K8S_POLICY_H */
@@ -0,0 +1,172 @@
+/*
+ * Pinned Resolution of the API Server Host - Implementation
+ */
+
+#include "resolver.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/**
+ * Check whether a host names the in-cluster API service
+ * (kubernetes, kubernetes.default, kubernetes.default.svc[.<cluster domain>])
+ */
+static int is_kubernetes_service_host(const char *host) {
+    static const char *names[] = {"kubernetes", "kubernetes.default", "kubernetes.default.svc"};
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcasecmp(host, names[i]) == 0) {
+            return 1;
+        }
+    }
+    return strncasecmp(host, "kubernetes.default.svc.", 23) == 0;
+}
+
+static int is_ip_literal(const char *host) {
+    unsigned char buf[sizeof(struct in6_addr)];
+    return inet_pton(AF_INET, host, buf) == 1 || inet_pton(AF_INET6, host, buf) == 1;
+}
+
+/**
+ * Append an address to a comma-separated list, bracketing IPv6
+ *
+ * @return 1 if appended, 0 if the buffer is full
+ */
+static int append_address(char *entry, size_t entry_len, const char *addr, int is_v6) {
+    size_t used = strlen(entry);
+    int n = snprintf(entry + used, entry_len - used, is_v6 ? "%s[%s]" : "%s%s",
+                     entry[used - 1] == ':' ? "" : ",", addr);
+    if (n < 0 || (size_t)n >= entry_len - used) {
+        entry[used] = '\0';
+        return 0;
+    }
+    return 1;
+}
+
+int k8s_resolver_init(k8s_resolver_t *resolver, const char *api_server_url) {
+    if (!resolver || !api_server_url) {
+        return 0;
+    }
+    memset(resolver, 0, sizeof(k8s_resolver_t));
+
+    const char *p = strstr(api_server_url, "://");
+    if (!p) {
+        return 0;
+    }
+    int is_https = (size_t)(p - api_server_url) == 5 && strncasecmp(api_server_url, "https", 5) == 0;
+    p += 3;
+
+    /* Authority ends at the first '/', '?' or '#' */
+    size_t authority_len = strcspn(p, "/?#");
+    const char *at = memchr(p, '@', authority_len);
+    if (at) {
+        authority_len -= (size_t)(at + 1 - p);
+        p = at + 1;
+    }
+
+    const char *host = p;
+    size_t host_len;
+    const char *port = NULL;
+
+    if (*p == '[') {
+        const char *close = memchr(p, ']', authority_len);
+        if (!close) {
+            return 0;
+        }
+        host = p + 1;
+        host_len = (size_t)(close - host);
+        if (close + 1 < p + authority_len && close[1] == ':') {
+            port = close + 2;
+        }
+    } else {
+        const char *colon = memchr(p, ':', authority_len);
+        host_len = colon ? (size_t)(colon - p) : authority_len;
+        if (colon) {
+            port = colon + 1;
+        }
+    }
+
+    if (host_len == 0 || host_len > K8S_RESOLVER_MAX_HOST_LEN) {
+        return 0;
+    }
+    memcpy(resolver->host, host, host_len);
+    resolver->host[host_len] = '\0';
+
+    if (port) {
+        char *end = NULL;
+        resolver->port = strtol(port, &end, 10);
+        if (end == port || resolver->port <= 0 || resolver->port > 65535) {
+            return 0;
+        }
+    } else {
+        resolver->port = is_https ? 443 : 80;
+    }
+
+    return !is_ip_literal(resolver->host);
+}
+
+int k8s_resolver_resolve(const k8s_resolver_t *resolver, char *entry, size_t entry_len) {
+    int count = 0;
+
+    if (!resolver || !entry || entry_len == 0 || !resolver->host[0]) {
+        return 0;
+    }
+
+    int n = snprintf(entry, entry_len, "%s:%ld:", resolver->host, resolver->port);
+    if (n < 0 || (size_t)n >= entry_len) {
+        entry[0] = '\0';
+        return 0;
+    }
+
+    /* In a pod, the kubelet injects the API service address */
+    const char *env_host = getenv("KUBERNETES_SERVICE_HOST");
+    const char *env_port = getenv("KUBERNETES_SERVICE_PORT");
+    long service_port = env_port ? strtol(env_port, NULL, 10) : 443;
+    if (env_host && *env_host && is_kubernetes_service_host(resolver->host) &&
+        service_port == resolver->port && is_ip_literal(env_host)) {
+        if (append_address(entry, entry_len, env_host, strchr(env_host, ':') != NULL)) {
+            return 1;
+        }
+    }
+
+    struct addrinfo hints;
+    struct addrinfo *result = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(resolver->host, NULL, &hints, &result) != 0) {
+        entry[0] = '\0';
+        return 0;
+    }
+
+    for (struct addrinfo *ai = result; ai; ai = ai->ai_next) {
+        char addr[INET6_ADDRSTRLEN];
+        const void *src;
+
+        if (ai->ai_family == AF_INET) {
+            src = &((struct sockaddr_in *)ai->ai_addr)->sin_addr;
+        } else if (ai->ai_family == AF_INET6) {
+            src = &((struct sockaddr_in6 *)ai->ai_addr)->sin6_addr;
+        } else {
+            continue;
+        }
+        if (!inet_ntop(ai->ai_family, src, addr, sizeof(addr))) {
+            continue;
+        }
+        if (!append_address(entry, entry_len, addr, ai->ai_family == AF_INET6)) {
+            break;
+        }
+        count++;
+    }
+    freeaddrinfo(result);
+
+    if (count == 0) {
+        entry[0] = '\0';
+    }
+    return count;
+}
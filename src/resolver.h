@@ -0,0 +1,50 @@
+/*
+ * Pinned Resolution of the API Server Host
+ *
+ * Resolves the API server host once (off the login path) and formats the
+ * result as a CURLOPT_RESOLVE entry, so that logins never go through the
+ * pod's resolv.conf search path. Inside a pod the KUBERNETES_SERVICE_HOST
+ * and KUBERNETES_SERVICE_PORT environment variables are preferred over DNS.
+ */
+
+#ifndef K8S_RESOLVER_H
+#define K8S_RESOLVER_H
+
+#include <stddef.h>
+
+#define K8S_RESOLVER_MAX_HOST_LEN 255
+#define K8S_RESOLVER_MAX_ENTRY_LEN 1024
+
+/**
+ * Host and port parsed from the API server URL
+ */
+typedef struct {
+    char host[K8S_RESOLVER_MAX_HOST_LEN + 1];  /* Host name without brackets */
+    long port;                                 /* Port (scheme default if not in URL) */
+} k8s_resolver_t;
+
+/**
+ * Parse the API server URL
+ *
+ * @param resolver Structure to fill
+ * @param api_server_url API server URL (https://host[:port][/path])
+ * @return 1 if the host is a name that can be pinned, 0 if the URL is
+ *         invalid or the host is already an IP address
+ */
+int k8s_resolver_init(k8s_resolver_t *resolver, const char *api_server_url);
+
+/**
+ * Resolve the host and format a CURLOPT_RESOLVE entry
+ *
+ * The entry has the form "host:port:addr[,addr...]". When the host is the
+ * in-cluster API service name and KUBERNETES_SERVICE_HOST is set for the
+ * same port, that address is used without any DNS lookup.
+ *
+ * @param resolver Parsed host and port
+ * @param entry Output buffer for the entry
+ * @param entry_len Size of entry
+ * @return Number of addresses in the entry, 0 if resolution failed
+ */
+int k8s_resolver_resolve(const k8s_resolver_t *resolver, char *entry, size_t entry_len);
+
+#endif /* K8S_RESOLVER_H */
@@ -0,0 +1,562 @@
+/*
+ * Live Session Registry Implementation
+ */
+
+#include "session.h"
+#include "backend.h"
+#include "denylist.h"
+#include "token_cache.h"
+#include "jwt.h"
+#include "stats.h"
+#include "log.h"
+#include "instrumentation.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <openssl/evp.h>
+#include <openssl/crypto.h>
+
+#define HASH_LEN 32
+#define IDENTITY_LEN (K8S_MAX_NAMESPACE_LEN + K8S_MAX_NAME_LEN + 2)
+
+typedef struct session session_t;
+
+/* A token and the connections that logged in with it */
+typedef struct session_token {
+    unsigned char digest[HASH_LEN];
+    char *token;
+    char namespace[K8S_MAX_NAMESPACE_LEN + 1];
+    char service_account[K8S_MAX_NAME_LEN + 1];
+    char uid[K8S_MAX_UID_LEN + 1];
+    time_t expires_at;              /* exp claim, 0 if unknown */
+    time_t checked_at;              /* Last login or successful revalidation */
+    time_t accepted_at;             /* First unconfirmed login */
+    int confirmed;                  /* The API server vouched for it */
+    int revoked;                    /* Reported; not checked again */
+    int sessions;
+    session_t *first;               /* Connections using the token */
+    struct session_token *next;     /* Bucket chain */
+} session_token_t;
+
+struct session {
+    unsigned long thread_id;
+    session_token_t *token;
+    session_t *next;                /* Bucket chain */
+    session_t *prev_use;            /* Connections of the same token */
+    session_t *next_use;
+};
+
+/* Copy of a due token, checked without the registry lock */
+typedef struct {
+    unsigned char digest[HASH_LEN];
+    char *token;
+    char namespace[K8S_MAX_NAMESPACE_LEN + 1];
+    char service_account[K8S_MAX_NAME_LEN + 1];
+    char uid[K8S_MAX_UID_LEN + 1];
+    time_t expires_at;
+    time_t accepted_at;
+    const char *verdict;            /* NULL: still valid or no verdict */
+    int verified;                   /* The API server confirmed it */
+    int first_id;                   /* Revoked connections in the id list */
+    int ids;
+} due_token_t;
+
+/* A revoked token refused until it would have expired */
+typedef struct {
+    unsigned char digest[HASH_LEN];
+    time_t until;
+} denied_token_t;
+
+/* Slots probed per revoked token */
+#define DENIED_PROBES 8
+
+static k8s_mutex_t registry_lock = K8S_MUTEX_INITIALIZER(K8S_MUTEX_SESSION);
+static session_t *sessions[K8S_SESSION_BUCKETS];
+static session_token_t *tokens[K8S_SESSION_BUCKETS];
+static int session_count = 0;
+static int token_count = 0;
+static denied_token_t denied[K8S_SESSION_DENIED];
+static int denied_used = 0;         /* Set once a token was denied */
+
+static size_t session_bucket(unsigned long thread_id) {
+    return (thread_id * 11400714819323198485ULL >> 32) % K8S_SESSION_BUCKETS;
+}
+
+static size_t token_bucket(const unsigned char *digest) {
+    size_t b;
+    memcpy(&b, digest, sizeof(b));
+    return b % K8S_SESSION_BUCKETS;
+}
+
+static int token_digest(const char *token, unsigned char *digest) {
+    unsigned int len = 0;
+    return EVP_Digest(token, strlen(token), digest, &len, EVP_sha256(), NULL) == 1;
+}
+
+static session_token_t *find_token(const unsigned char *digest) {
+    session_token_t *t = tokens[token_bucket(digest)];
+    while (t && memcmp(t->digest, digest, HASH_LEN) != 0) {
+        t = t->next;
+    }
+    return t;
+}
+
+static session_t **find_session(unsigned long thread_id) {
+    session_t **link = &sessions[session_bucket(thread_id)];
+    while (*link && (*link)->thread_id != thread_id) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+/*
+ * Refuse a revoked token from now on; the registry lock must be held
+ *
+ * Takes a free or expired slot near the token's home slot, or else the one
+ * that expires first.
+ */
+static void deny_token(const unsigned char *digest, time_t until) {
+    size_t home = token_bucket(digest) % K8S_SESSION_DENIED;
+    denied_token_t *slot = NULL;
+
+    for (size_t i = 0; i < DENIED_PROBES; i++) {
+        denied_token_t *d = &denied[(home + i) % K8S_SESSION_DENIED];
+        if (memcmp(d->digest, digest, HASH_LEN) == 0) {
+            slot = d;
+            break;
+        }
+        if (!slot || d->until < slot->until) {
+            slot = d;
+        }
+    }
+    memcpy(slot->digest, digest, HASH_LEN);
+    if (until > slot->until) {
+        slot->until = until;
+    }
+    __atomic_store_n(&denied_used, 1, __ATOMIC_RELEASE);
+}
+
+static void free_token(session_token_t *t) {
+    OPENSSL_cleanse(t->token, strlen(t->token));
+    k8s_free(t->token);
+    k8s_free(t);
+}
+
+/*
+ * Unlink a connection and drop its token with the last user; the registry
+ * lock must be held
+ */
+static void remove_session(session_t **link) {
+    session_t *s = *link;
+    session_token_t *t = s->token;
+
+    *link = s->next;
+    if (s->prev_use) {
+        s->prev_use->next_use = s->next_use;
+    } else {
+        t->first = s->next_use;
+    }
+    if (s->next_use) {
+        s->next_use->prev_use = s->prev_use;
+    }
+    k8s_free(s);
+    session_count--;
+
+    if (--t->sessions == 0) {
+        session_token_t **tl = &tokens[token_bucket(t->digest)];
+        while (*tl != t) {
+            tl = &(*tl)->next;
+        }
+        *tl = t->next;
+        free_token(t);
+        token_count--;
+    }
+}
+
+/* Track a connection as a user of a token; the registry lock must be held */
+static void link_session(session_t *s, session_token_t *t, unsigned long thread_id) {
+    s->thread_id = thread_id;
+    s->token = t;
+    s->next_use = t->first;
+    if (t->first) {
+        t->first->prev_use = s;
+    }
+    t->first = s;
+    t->sessions++;
+
+    size_t b = session_bucket(thread_id);
+    s->next = sessions[b];
+    sessions[b] = s;
+    session_count++;
+}
+
+int k8s_session_register(unsigned long thread_id, const char *token,
+                         const k8s_token_info_t *info, int confirmed) {
+    unsigned char digest[HASH_LEN];
+    k8s_jwt_claims_t claims;
+    time_t now = time(NULL);
+    int tracked = 0;
+    int full = 0;
+
+    if (!token || !info || !token_digest(token, digest)) {
+        return 0;
+    }
+    if (!k8s_jwt_claims(token, &claims)) {
+        claims.exp = 0;
+    }
+
+    k8s_mutex_lock(&registry_lock);
+
+    /* Re-authentication on the same connection replaces its token */
+    session_t **link = find_session(thread_id);
+    if (*link) {
+        remove_session(link);
+    }
+
+    session_token_t *t = find_token(digest);
+    session_t *s = NULL;
+    if (t && t->revoked && !confirmed) {
+        /* Only the API server can vouch for it again */
+        k8s_mutex_unlock(&registry_lock);
+        return 0;
+    }
+    if (session_count < K8S_SESSION_MAX &&
+        (s = k8s_calloc(K8S_MEM_SESSION, 1, sizeof(session_t))) != NULL) {
+        if (!t) {
+            t = k8s_calloc(K8S_MEM_SESSION, 1, sizeof(session_token_t));
+            if (t && !(t->token = k8s_malloc(K8S_MEM_TOKEN, strlen(token) + 1))) {
+                k8s_free(t);
+                t = NULL;
+            }
+            if (t) {
+                memcpy(t->digest, digest, HASH_LEN);
+                strcpy(t->token, token);
+                size_t b = token_bucket(digest);
+                t->next = tokens[b];
+                tokens[b] = t;
+                token_count++;
+            }
+        }
+    }
+
+    if (s && t) {
+        strncpy(t->namespace, info->namespace, K8S_MAX_NAMESPACE_LEN);
+        strncpy(t->service_account, info->service_account, K8S_MAX_NAME_LEN);
+        strncpy(t->uid, info->uid, K8S_MAX_UID_LEN);
+        t->expires_at = claims.exp;
+        if (confirmed) {
+            /* A validated login vouches for the token again */
+            t->checked_at = now;
+            t->confirmed = 1;
+            t->revoked = 0;
+        } else if (!t->checked_at) {
+            /* New token: it is due for confirmation at once */
+            t->checked_at = now;
+            t->accepted_at = now;
+        }
+
+        link_session(s, t, thread_id);
+        tracked = 1;
+    } else {
+        k8s_free(s);
+        full = session_count >= K8S_SESSION_MAX;
+    }
+    k8s_mutex_unlock(&registry_lock);
+
+    if (!tracked) {
+        K8S_LOG(K8S_LOG_WARNING, "session_untracked", "user=\"%s/%s\" reason=%s",
+                info->namespace, info->service_account,
+                full ? "table_full" : "out_of_memory");
+    }
+    return tracked;
+}
+
+int k8s_session_attach(unsigned long thread_id, const unsigned char *digest, const char *uid) {
+    session_t *s = NULL;
+
+    k8s_mutex_lock(&registry_lock);
+    session_t **link = find_session(thread_id);
+    if (*link) {
+        remove_session(link);
+    }
+
+    session_token_t *t = find_token(digest);
+    if (t && !t->revoked && t->confirmed && strcmp(t->uid, uid) == 0 &&
+        session_count < K8S_SESSION_MAX &&
+        (s = k8s_calloc(K8S_MEM_SESSION, 1, sizeof(session_t))) != NULL) {
+        link_session(s, t, thread_id);
+    }
+    k8s_mutex_unlock(&registry_lock);
+    return s != NULL;
+}
+
+void k8s_session_forget(unsigned long thread_id) {
+    k8s_mutex_lock(&registry_lock);
+    session_t **link = find_session(thread_id);
+    if (*link) {
+        remove_session(link);
+    }
+    k8s_mutex_unlock(&registry_lock);
+}
+
+void k8s_session_user_changed(unsigned long thread_id, const char *user, size_t user_len) {
+    char identity[IDENTITY_LEN];
+
+    k8s_mutex_lock(&registry_lock);
+    session_t **link = find_session(thread_id);
+    if (*link) {
+        session_token_t *t = (*link)->token;
+        int len = snprintf(identity, sizeof(identity), "%s/%s",
+                           t->namespace, t->service_account);
+        if (!user || (size_t)len != user_len || memcmp(identity, user, user_len) != 0) {
+            remove_session(link);
+        }
+    }
+    k8s_mutex_unlock(&registry_lock);
+}
+
+int k8s_session_count(void) {
+    k8s_mutex_lock(&registry_lock);
+    int count = session_count;
+    k8s_mutex_unlock(&registry_lock);
+    return count;
+}
+
+/**
+ * Copy the tokens that are due for revalidation, or with confirming set,
+ * the tokens still waiting for confirmation
+ *
+ * @return Array of *count copies, NULL if none are due or out of memory
+ */
+static due_token_t *collect_due(time_t now, int interval, int confirming, int *count) {
+    due_token_t *due = NULL;
+    int n = 0;
+
+    k8s_mutex_lock(&registry_lock);
+    if (token_count > 0) {
+        due = k8s_calloc(K8S_MEM_SESSION, token_count, sizeof(due_token_t));
+    }
+    for (size_t b = 0; due && b < K8S_SESSION_BUCKETS; b++) {
+        for (session_token_t *t = tokens[b]; t; t = t->next) {
+            if (t->revoked || (confirming ? t->confirmed : t->checked_at + interval > now)) {
+                continue;
+            }
+            due_token_t *d = &due[n];
+            if (!(d->token = k8s_malloc(K8S_MEM_TOKEN, strlen(t->token) + 1))) {
+                continue;
+            }
+            strcpy(d->token, t->token);
+            memcpy(d->digest, t->digest, HASH_LEN);
+            memcpy(d->namespace, t->namespace, sizeof(d->namespace));
+            memcpy(d->service_account, t->service_account, sizeof(d->service_account));
+            memcpy(d->uid, t->uid, sizeof(d->uid));
+            d->expires_at = t->expires_at;
+            d->accepted_at = t->accepted_at;
+            n++;
+        }
+    }
+    k8s_mutex_unlock(&registry_lock);
+
+    if (n == 0) {
+        k8s_free(due);
+        due = NULL;
+    }
+    *count = n;
+    return due;
+}
+
+/**
+ * Decide about every due token: locally where possible, otherwise with
+ * one batch of reviews by the authoritative backends
+ *
+ * @return Number of tokens that got no verdict
+ */
+static int check_due(due_token_t *due, int count, time_t now,
+                     const k8s_config_t *config, int concurrency) {
+    const char **batch = k8s_calloc(K8S_MEM_SESSION, count, sizeof(char *));
+    k8s_token_info_t *infos = k8s_calloc(K8S_MEM_SESSION, count, sizeof(k8s_token_info_t));
+    int *index = k8s_calloc(K8S_MEM_SESSION, count, sizeof(int));
+    int pending = 0;
+    int unanswered = 0;
+
+    if (!batch || !infos || !index) {
+        K8S_LOG(K8S_LOG_ERROR, "out_of_memory", "where=revalidate");
+        k8s_free(batch);
+        k8s_free(infos);
+        k8s_free(index);
+        return count;
+    }
+
+    for (int i = 0; i < count; i++) {
+        due_token_t *d = &due[i];
+        if (d->expires_at > 0 && d->expires_at <= now) {
+            d->verdict = "expired";
+        } else if (k8s_denylist_check_token(d->token) != K8S_DENY_NONE ||
+                   k8s_denylist_check_identity(d->namespace, d->service_account,
+                                               d->uid) != K8S_DENY_NONE) {
+            d->verdict = "denied";
+        } else {
+            index[pending] = i;
+            batch[pending++] = d->token;
+        }
+    }
+
+    if (pending > 0) {
+        k8s_backend_validate_batch(batch, pending, infos, config, concurrency);
+    }
+
+    for (int p = 0; p < pending; p++) {
+        due_token_t *d = &due[index[p]];
+        const k8s_token_info_t *info = &infos[p];
+        if (!info->reviewed) {
+            unanswered++;
+        } else if (!info->authenticated ||
+                   (d->uid[0] && info->uid[0] && strcmp(d->uid, info->uid) != 0)) {
+            /* Not authenticated any more, or the ServiceAccount was recreated */
+            d->verdict = "rejected";
+        } else if (info->namespace[0]) {
+            d->verified = 1;
+        } else {
+            unanswered++;
+        }
+    }
+
+    k8s_free(batch);
+    k8s_free(infos);
+    k8s_free(index);
+    return unanswered;
+}
+
+/**
+ * One revalidation or confirmation round
+ *
+ * @param window Seconds a token may stay unconfirmed; 0 for revalidation
+ */
+static int run_round(const k8s_config_t *config, int interval, int window, int concurrency,
+                     k8s_session_revoke_fn revoke, void *arg) {
+    time_t now = time(NULL);
+    int count = 0;
+    int revoked = 0;
+    unsigned long *ids = NULL;
+    char identity[IDENTITY_LEN];
+
+    due_token_t *due = collect_due(now, interval, window > 0, &count);
+    if (!due) {
+        return 0;
+    }
+
+    int unanswered = check_due(due, count, now, config, concurrency);
+    for (int i = 0; window > 0 && i < count; i++) {
+        due_token_t *d = &due[i];
+        if (!d->verdict && !d->verified && d->accepted_at + window <= now) {
+            d->verdict = "unconfirmed";
+        }
+    }
+
+    /* Apply the verdicts to tokens that still have connections */
+    k8s_mutex_lock(&registry_lock);
+    ids = k8s_malloc(K8S_MEM_SESSION, sizeof(unsigned long) * (session_count + 1));
+    for (int i = 0; ids && i < count; i++) {
+        due_token_t *d = &due[i];
+        session_token_t *t = find_token(d->digest);
+        if (!t || t->revoked) {
+            continue;
+        }
+        if (d->verified) {
+            t->checked_at = now;
+            t->confirmed = 1;
+        } else if (d->verdict) {
+            t->revoked = 1;
+            if (strcmp(d->verdict, "expired") != 0) {
+                deny_token(t->digest, t->expires_at > now ? t->expires_at
+                                                          : now + K8S_SESSION_DENY_SECONDS);
+            }
+            d->first_id = revoked;
+            for (session_t *s = t->first; s; s = s->next_use) {
+                ids[revoked++] = s->thread_id;
+            }
+            d->ids = revoked - d->first_id;
+        }
+    }
+    k8s_mutex_unlock(&registry_lock);
+
+    for (int i = 0; i < count; i++) {
+        due_token_t *d = &due[i];
+        if (d->ids > 0) {
+            /* A cached login must not bring the token back */
+            k8s_token_cache_remove(d->token);
+
+            snprintf(identity, sizeof(identity), "%s/%s", d->namespace, d->service_account);
+            K8S_LOG(K8S_LOG_WARNING, "session_revoked", "user=\"%s\" reason=%s sessions=%d",
+                    identity, d->verdict, d->ids);
+            k8s_stats_add(K8S_STAT_SESSIONS_REVOKED, (uint64_t)d->ids);
+            for (int j = 0; revoke && j < d->ids; j++) {
+                revoke(ids[d->first_id + j], identity, d->verdict, arg);
+            }
+        }
+        OPENSSL_cleanse(d->token, strlen(d->token));
+        k8s_free(d->token);
+    }
+
+    if (unanswered > 0) {
+        K8S_LOG(K8S_LOG_WARNING, "revalidate_incomplete", "tokens=%d unanswered=%d action=retry",
+                count, unanswered);
+    }
+    K8S_LOG(K8S_LOG_DEBUG, window > 0 ? "confirmed" : "revalidated",
+            "tokens=%d revoked_sessions=%d", count, revoked);
+
+    k8s_free(ids);
+    k8s_free(due);
+    return revoked;
+}
+
+int k8s_session_revalidate(const k8s_config_t *config, int interval, int concurrency,
+                           k8s_session_revoke_fn revoke, void *arg) {
+    return run_round(config, interval, 0, concurrency, revoke, arg);
+}
+
+int k8s_session_confirm(const k8s_config_t *config, int window, int concurrency,
+                        k8s_session_revoke_fn revoke, void *arg) {
+    return run_round(config, 0, window > 0 ? window : 1, concurrency, revoke, arg);
+}
+
+int k8s_session_denied(const char *token) {
+    unsigned char digest[HASH_LEN];
+
+    /* Most servers never revoke anything: skip hashing the token */
+    if (!__atomic_load_n(&denied_used, __ATOMIC_ACQUIRE) || !token ||
+        !token_digest(token, digest)) {
+        return 0;
+    }
+    return k8s_session_denied_digest(digest);
+}
+
+int k8s_session_denied_digest(const unsigned char *digest) {
+    int found = 0;
+
+    if (!__atomic_load_n(&denied_used, __ATOMIC_ACQUIRE) || !digest) {
+        return 0;
+    }
+
+    time_t now = time(NULL);
+    size_t home = token_bucket(digest) % K8S_SESSION_DENIED;
+    k8s_mutex_lock(&registry_lock);
+    for (size_t i = 0; i < DENIED_PROBES && !found; i++) {
+        const denied_token_t *d = &denied[(home + i) % K8S_SESSION_DENIED];
+        found = d->until > now && memcmp(d->digest, digest, HASH_LEN) == 0;
+    }
+    k8s_mutex_unlock(&registry_lock);
+    return found;
+}
+
+void k8s_session_clear(void) {
+    k8s_mutex_lock(&registry_lock);
+    for (size_t b = 0; b < K8S_SESSION_BUCKETS; b++) {
+        while (sessions[b]) {
+            remove_session(&sessions[b]);
+        }
+    }
+    k8s_mutex_unlock(&registry_lock);
+}
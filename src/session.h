@@ -0,0 +1,172 @@
+/*
+ * Live Session Registry
+ *
+ * Remembers which token every live connection logged in with, so that a
+ * connection does not stay authorized forever once its token expires or its
+ * ServiceAccount is deleted. Connections are grouped by token: a pool of
+ * thousands of connections opened with the same projected token costs one
+ * TokenReview per revalidation round, and the tokens due in a round are
+ * reviewed concurrently (see k8s_validate_tokens()).
+ *
+ * Tokens are held in memory only, for as long as a connection uses them.
+ */
+
+#ifndef K8S_SESSION_H
+#define K8S_SESSION_H
+
+#include "tokenreview_api.h"
+
+/* Most connections tracked at once; further logins are not tracked */
+#define K8S_SESSION_MAX 65536
+
+/* Hash buckets for connections and for tokens */
+#define K8S_SESSION_BUCKETS 8192
+
+/* Revoked tokens remembered to refuse logins with them */
+#define K8S_SESSION_DENIED 4096
+
+/* Seconds a revoked token without exp claim is refused */
+#define K8S_SESSION_DENY_SECONDS 3600
+
+/**
+ * Called for every connection whose token was found to be no longer valid
+ *
+ * @param thread_id Connection (thread) id
+ * @param identity "namespace/name" of the ServiceAccount
+ * @param reason "expired", "rejected", "denied" or "unconfirmed"
+ * @param arg Opaque argument given to k8s_session_revalidate()
+ */
+typedef void (*k8s_session_revoke_fn)(unsigned long thread_id, const char *identity,
+                                      const char *reason, void *arg);
+
+/**
+ * Track a connection that just logged in
+ *
+ * A connection that is already tracked (COM_CHANGE_USER) switches to the
+ * new token. A confirmed token counts as validated now; an unconfirmed one
+ * (accepted on a local signature check) waits for k8s_session_confirm().
+ *
+ * @param thread_id Connection (thread) id
+ * @param token Token the connection logged in with (copied)
+ * @param info Identity the token was validated as
+ * @param confirmed 1 if the API server vouched for the token, 0 if not yet
+ * @return 1 if tracked, 0 if the registry is full, out of memory, or an
+ *         unconfirmed token was already revoked
+ */
+int k8s_session_register(unsigned long thread_id, const char *token,
+                         const k8s_token_info_t *info, int confirmed);
+
+/**
+ * Track a connection that logged in with a ticket for a tracked token
+ *
+ * The server only holds the SHA-256 of a ticket's token, so a ticket login
+ * can only be revalidated along with a connection that logged in with the
+ * token itself. A connection that is already tracked is untracked first.
+ *
+ * @param thread_id Connection (thread) id
+ * @param digest SHA-256 of the token (32 bytes)
+ * @param uid ServiceAccount UID the ticket was issued for
+ * @return 1 if tracked, 0 if no connection uses the token, it is revoked or
+ *         unconfirmed, belongs to another UID, or the registry is full
+ */
+int k8s_session_attach(unsigned long thread_id, const unsigned char *digest, const char *uid);
+
+/**
+ * Stop tracking a connection that closed
+ *
+ * @param thread_id Connection (thread) id; unknown ids are ignored
+ */
+void k8s_session_forget(unsigned long thread_id);
+
+/**
+ * Stop tracking a connection that switched to another MariaDB user
+ *
+ * Nothing happens if the user is still the ServiceAccount of its token.
+ *
+ * @param thread_id Connection (thread) id
+ * @param user New MariaDB user name (not necessarily NUL-terminated)
+ * @param user_len Length of user
+ */
+void k8s_session_user_changed(unsigned long thread_id, const char *user, size_t user_len);
+
+/**
+ * Number of tracked connections
+ *
+ * @return Connection count
+ */
+int k8s_session_count(void);
+
+/**
+ * Revalidate the tokens of tracked connections
+ *
+ * Every token last validated at least interval seconds ago is checked once,
+ * however many connections use it: past its exp claim it is expired, listed
+ * on the denylist it is denied, and otherwise it is sent to the authoritative
+ * backends of config->backends (the TokenReview API), up to concurrency
+ * requests at a time. A token that is no longer
+ * authenticated, or now belongs to another ServiceAccount UID, is rejected.
+ * Tokens the API server gave no verdict for are retried in the next round.
+ *
+ * Revoked tokens are dropped from the token cache, refused at later logins
+ * (see k8s_session_denied()) and reported through revoke once for each of
+ * their connections, outside any lock. Their
+ * connections stay tracked but are not reported again.
+ *
+ * @param config Configuration for K8s API access
+ * @param interval Seconds between validations of the same token
+ * @param concurrency Most TokenReview requests in flight at once
+ * @param revoke Called for each revoked connection (may be NULL)
+ * @param arg Passed to revoke
+ * @return Number of connections revoked in this round
+ */
+int k8s_session_revalidate(const k8s_config_t *config, int interval, int concurrency,
+                           k8s_session_revoke_fn revoke, void *arg);
+
+/**
+ * Confirm tokens accepted without a TokenReview
+ *
+ * Reviews every unconfirmed token like k8s_session_revalidate() does. A
+ * token the API server has still not answered for window seconds after its
+ * first login is revoked as "unconfirmed", so a provisional login never
+ * outlives the window unconfirmed.
+ *
+ * @param config Configuration for K8s API access
+ * @param window Most seconds a token may stay unconfirmed
+ * @param concurrency Most TokenReview requests in flight at once
+ * @param revoke Called for each revoked connection (may be NULL)
+ * @param arg Passed to revoke
+ * @return Number of connections revoked in this round
+ */
+int k8s_session_confirm(const k8s_config_t *config, int window, int concurrency,
+                        k8s_session_revoke_fn revoke, void *arg);
+
+/**
+ * Whether a token was revoked by revalidation or confirmation
+ *
+ * Revoked tokens are refused for as long as they would otherwise be valid
+ * (K8S_SESSION_DENY_SECONDS if they carry no exp claim), even after their
+ * connections closed. The most recent K8S_SESSION_DENIED are kept.
+ *
+ * @param token Token as sent by the client
+ * @return 1 if revoked, 0 otherwise
+ */
+int k8s_session_denied(const char *token);
+
+/**
+ * Whether a token was revoked, by its SHA-256
+ *
+ * Same as k8s_session_denied() for callers that only hold the digest.
+ *
+ * @param digest SHA-256 of the token (32 bytes)
+ * @return 1 if revoked, 0 otherwise
+ */
+int k8s_session_denied_digest(const unsigned char *digest);
+
+/**
+ * Forget every connection and token
+ *
+ * Revoked tokens stay refused.
+ */
+void k8s_session_clear(void);
+
+#endif /* K8S_SESSION_H */
@@ -0,0 +1,177 @@
+/*
+ * Plugin Statistics Implementation
+ */
+
+#include "stats.h"
+#include <string.h>
+#include <time.h>
+
+#define SUB_BUCKETS (1 << K8S_HIST_SUB_BITS)
+#define MAX_VALUE ((UINT64_C(1) << K8S_HIST_MAX_BITS) - 1)
+
+typedef struct {
+    uint64_t counters[K8S_STAT_COUNT];
+    uint64_t hist[K8S_HIST_COUNT][K8S_HIST_BUCKETS];
+    uint64_t hist_sum[K8S_HIST_COUNT];
+} __attribute__((aligned(64))) stats_shard_t;
+
+static stats_shard_t shards[K8S_STATS_SHARDS];
+static unsigned next_shard = 0;
+static __thread int thread_shard = -1;
+
+static const char *stat_names[K8S_STAT_COUNT] = {
+    [K8S_STAT_ATTEMPTS] = "attempts",
+    [K8S_STAT_SUCCESSES] = "successes",
+    [K8S_STAT_FAIL_NO_TOKEN] = "failures_no_token",
+    [K8S_STAT_FAIL_REJECTED] = "failures_rejected",
+    [K8S_STAT_FAIL_USER_MISMATCH] = "failures_user_mismatch",
+    [K8S_STAT_FAIL_DENIED] = "failures_denied",
+    [K8S_STAT_FAIL_POLICY] = "failures_policy",
+    [K8S_STAT_FAIL_FORBIDDEN] = "failures_forbidden",
+    [K8S_STAT_FAIL_UNKNOWN_CLUSTER] = "failures_unknown_cluster",
+    [K8S_STAT_FAIL_API_ERROR] = "failures_api_error",
+    [K8S_STAT_FAIL_INTERNAL] = "failures_internal",
+    [K8S_STAT_TOKENREVIEW_CALLS] = "tokenreview_calls",
+    [K8S_STAT_HTTP_2XX] = "http_2xx",
+    [K8S_STAT_HTTP_4XX] = "http_4xx",
+    [K8S_STAT_HTTP_5XX] = "http_5xx",
+    [K8S_STAT_HTTP_OTHER] = "http_other",
+    [K8S_STAT_TIMEOUTS] = "timeouts",
+    [K8S_STAT_CONNECT_ERRORS] = "connect_errors",
+    [K8S_STAT_BYTES_SENT] = "bytes_sent",
+    [K8S_STAT_BYTES_RECEIVED] = "bytes_received",
+    [K8S_STAT_CACHE_HITS] = "cache_hits",
+    [K8S_STAT_CACHE_MISSES] = "cache_misses",
+    [K8S_STAT_CACHE_REVOKED] = "cache_revoked",
+    [K8S_STAT_SESSIONS_REVOKED] = "sessions_revoked",
+    [K8S_STAT_SESSIONS_KILLED] = "sessions_killed",
+    [K8S_STAT_OPTIMISTIC] = "optimistic_logins",
+    [K8S_STAT_TICKET_LOGINS] = "ticket_logins",
+    [K8S_STAT_TICKETS_ISSUED] = "tickets_issued",
+    [K8S_STAT_OFFLINE_LOGINS] = "offline_logins",
+    [K8S_STAT_ACCESS_REVIEWS] = "access_reviews",
+    [K8S_STAT_ACCESS_REVIEW_HITS] = "access_review_hits",
+};
+
+static const char *hist_names[K8S_HIST_COUNT] = {
+    [K8S_HIST_LOGIN] = "login",
+    [K8S_HIST_API] = "api",
+    [K8S_HIST_QUEUE] = "queue",
+    [K8S_HIST_DNS] = "dns",
+    [K8S_HIST_CONNECT] = "connect",
+    [K8S_HIST_TLS] = "tls",
+    [K8S_HIST_SERVER] = "server",
+    [K8S_HIST_TRANSFER] = "transfer",
+    [K8S_HIST_PARSE] = "parse",
+};
+
+/**
+ * The calling thread's shard, assigned round-robin on first use
+ */
+static stats_shard_t *my_shard(void) {
+    if (thread_shard < 0) {
+        thread_shard = (int)(__atomic_fetch_add(&next_shard, 1, __ATOMIC_RELAXED) %
+                             K8S_STATS_SHARDS);
+    }
+    return &shards[thread_shard];
+}
+
+void k8s_stats_add(k8s_stat_t stat, uint64_t n) {
+    __atomic_add_fetch(&my_shard()->counters[stat], n, __ATOMIC_RELAXED);
+}
+
+void k8s_stats_inc(k8s_stat_t stat) {
+    k8s_stats_add(stat, 1);
+}
+
+int k8s_stats_bucket(uint64_t usec) {
+    if (usec > MAX_VALUE) {
+        usec = MAX_VALUE;
+    }
+    if (usec < SUB_BUCKETS) {
+        return (int)usec;
+    }
+
+    int msb = 63 - __builtin_clzll(usec);
+    int shift = msb - K8S_HIST_SUB_BITS;
+    return ((shift + 1) << K8S_HIST_SUB_BITS) | (int)((usec >> shift) & (SUB_BUCKETS - 1));
+}
+
+uint64_t k8s_stats_bucket_upper(int bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return (uint64_t)bucket;
+    }
+
+    int shift = (bucket >> K8S_HIST_SUB_BITS) - 1;
+    uint64_t lower = (uint64_t)(SUB_BUCKETS | (bucket & (SUB_BUCKETS - 1))) << shift;
+    return lower + (UINT64_C(1) << shift) - 1;
+}
+
+void k8s_stats_record(k8s_hist_t hist, uint64_t usec) {
+    stats_shard_t *shard = my_shard();
+    __atomic_add_fetch(&shard->hist[hist][k8s_stats_bucket(usec)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&shard->hist_sum[hist], usec, __ATOMIC_RELAXED);
+}
+
+uint64_t k8s_stats_now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+void k8s_stats_collect(k8s_stats_totals_t *totals) {
+    memset(totals, 0, sizeof(*totals));
+
+    for (int s = 0; s < K8S_STATS_SHARDS; s++) {
+        stats_shard_t *shard = &shards[s];
+        for (int i = 0; i < K8S_STAT_COUNT; i++) {
+            totals->counters[i] += __atomic_load_n(&shard->counters[i], __ATOMIC_RELAXED);
+        }
+        for (int h = 0; h < K8S_HIST_COUNT; h++) {
+            for (int b = 0; b < K8S_HIST_BUCKETS; b++) {
+                uint64_t n = __atomic_load_n(&shard->hist[h][b], __ATOMIC_RELAXED);
+                totals->hist[h][b] += n;
+                totals->hist_count[h] += n;
+            }
+            totals->hist_sum[h] += __atomic_load_n(&shard->hist_sum[h], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+uint64_t k8s_stats_percentile(const k8s_stats_totals_t *totals, k8s_hist_t hist,
+                              double percentile) {
+    uint64_t count = totals->hist_count[hist];
+    if (count == 0) {
+        return 0;
+    }
+
+    /* Rank of the sample at the percentile, 1-based */
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > count) {
+        rank = count;
+    }
+
+    uint64_t seen = 0;
+    for (int b = 0; b < K8S_HIST_BUCKETS; b++) {
+        seen += totals->hist[hist][b];
+        if (seen >= rank) {
+            return k8s_stats_bucket_upper(b);
+        }
+    }
+    return MAX_VALUE;
+}
+
+const char *k8s_stats_name(k8s_stat_t stat) {
+    return stat_names[stat];
+}
+
+const char *k8s_stats_hist_name(k8s_hist_t hist) {
+    return hist_names[hist];
+}
+
+void k8s_stats_reset(void) {
+    memset(shards, 0, sizeof(shards));
+}
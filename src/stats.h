@@ -0,0 +1,176 @@
+/*
+ * Plugin Statistics
+ *
+ * Event counters and log-bucketed latency histograms behind the
+ * auth_k8s_% status variables. Each thread updates its own cache-line
+ * aligned shard with relaxed atomic adds, so recording costs a few
+ * uncontended instructions on the login path; shards are only summed when
+ * the statistics are read.
+ */
+
+#ifndef K8S_STATS_H
+#define K8S_STATS_H
+
+#include <stdint.h>
+
+/* Number of shards; threads are spread over them round-robin */
+#define K8S_STATS_SHARDS 32
+
+/*
+ * Histogram resolution: every power of two is split into
+ * 2^K8S_HIST_SUB_BITS buckets, bounding the error of a percentile at 25%
+ */
+#define K8S_HIST_SUB_BITS 2
+
+/* Buckets up to 2^28 microseconds (about 4.5 minutes); larger values are clamped */
+#define K8S_HIST_MAX_BITS 28
+#define K8S_HIST_BUCKETS ((K8S_HIST_MAX_BITS - K8S_HIST_SUB_BITS + 1) << K8S_HIST_SUB_BITS)
+
+typedef enum {
+    K8S_STAT_ATTEMPTS,               /* Logins handled by the plugin */
+    K8S_STAT_SUCCESSES,
+    K8S_STAT_FAIL_NO_TOKEN,          /* Client sent no token */
+    K8S_STAT_FAIL_REJECTED,          /* API server said the token is not authenticated */
+    K8S_STAT_FAIL_USER_MISMATCH,     /* Token is for another ServiceAccount */
+    K8S_STAT_FAIL_DENIED,            /* Token or ServiceAccount is on the denylist */
+    K8S_STAT_FAIL_POLICY,            /* Refused by the account's policy */
+    K8S_STAT_FAIL_FORBIDDEN,         /* Refused by a SubjectAccessReview */
+    K8S_STAT_FAIL_UNKNOWN_CLUSTER,   /* User names a cluster that is not registered */
+    K8S_STAT_FAIL_API_ERROR,         /* No usable answer from the API server */
+    K8S_STAT_FAIL_INTERNAL,          /* Client I/O, memory or configuration */
+    K8S_STAT_TOKENREVIEW_CALLS,
+    K8S_STAT_HTTP_2XX,
+    K8S_STAT_HTTP_4XX,
+    K8S_STAT_HTTP_5XX,
+    K8S_STAT_HTTP_OTHER,
+    K8S_STAT_TIMEOUTS,
+    K8S_STAT_CONNECT_ERRORS,         /* Other transport failures */
+    K8S_STAT_BYTES_SENT,
+    K8S_STAT_BYTES_RECEIVED,
+    K8S_STAT_CACHE_HITS,             /* Logins served from the token cache */
+    K8S_STAT_CACHE_MISSES,           /* Cache enabled but the token was not in it */
+    K8S_STAT_CACHE_REVOKED,          /* Entries dropped because their SA or pod was deleted */
+    K8S_STAT_SESSIONS_REVOKED,       /* Live connections whose token stopped being valid */
+    K8S_STAT_SESSIONS_KILLED,        /* Of those, connections that were killed */
+    K8S_STAT_OPTIMISTIC,             /* Logins accepted on a locally verified signature */
+    K8S_STAT_TICKET_LOGINS,          /* Logins accepted on a session ticket */
+    K8S_STAT_TICKETS_ISSUED,
+    K8S_STAT_OFFLINE_LOGINS,         /* Logins verified against an offline issuer's keys */
+    K8S_STAT_ACCESS_REVIEWS,         /* SubjectAccessReview calls */
+    K8S_STAT_ACCESS_REVIEW_HITS,     /* Logins decided by a cached access review */
+    K8S_STAT_COUNT
+} k8s_stat_t;
+
+typedef enum {
+    K8S_HIST_LOGIN,                  /* Whole login, from token request to result */
+    K8S_HIST_API,                    /* TokenReview request */
+    K8S_HIST_QUEUE,                  /* Handle checkout and request build */
+    K8S_HIST_DNS,                    /* Phases of the TokenReview transfer */
+    K8S_HIST_CONNECT,
+    K8S_HIST_TLS,
+    K8S_HIST_SERVER,
+    K8S_HIST_TRANSFER,
+    K8S_HIST_PARSE,                  /* Response parsing */
+    K8S_HIST_COUNT
+} k8s_hist_t;
+
+/* Summed view of all shards */
+typedef struct {
+    uint64_t counters[K8S_STAT_COUNT];
+    uint64_t hist[K8S_HIST_COUNT][K8S_HIST_BUCKETS];
+    uint64_t hist_count[K8S_HIST_COUNT];
+    uint64_t hist_sum[K8S_HIST_COUNT];   /* Microseconds */
+} k8s_stats_totals_t;
+
+/**
+ * Add to a counter
+ *
+ * @param stat Counter to update
+ * @param n Amount to add
+ */
+void k8s_stats_add(k8s_stat_t stat, uint64_t n);
+
+/**
+ * Increment a counter by one
+ *
+ * @param stat Counter to update
+ */
+void k8s_stats_inc(k8s_stat_t stat);
+
+/**
+ * Record a latency sample
+ *
+ * @param hist Histogram to update
+ * @param usec Duration in microseconds
+ */
+void k8s_stats_record(k8s_hist_t hist, uint64_t usec);
+
+/**
+ * Monotonic clock in microseconds, for measuring durations
+ *
+ * @return Current time in microseconds
+ */
+uint64_t k8s_stats_now_usec(void);
+
+/**
+ * Sum all shards
+ *
+ * Concurrent updates may or may not be included, but no update is
+ * counted twice.
+ *
+ * @param totals Output structure
+ */
+void k8s_stats_collect(k8s_stats_totals_t *totals);
+
+/**
+ * Estimate a percentile from a collected histogram
+ *
+ * @param totals Collected statistics
+ * @param hist Histogram to inspect
+ * @param percentile Percentile between 0 and 100
+ * @return Upper bound in microseconds of the bucket holding the percentile,
+ *         0 if the histogram is empty
+ */
+uint64_t k8s_stats_percentile(const k8s_stats_totals_t *totals, k8s_hist_t hist,
+                              double percentile);
+
+/**
+ * Status variable name of a counter, without the auth_k8s_ prefix
+ *
+ * @param stat Counter
+ * @return Static name string
+ */
+const char *k8s_stats_name(k8s_stat_t stat);
+
+/**
+ * Short name of a histogram, e.g. "login"
+ *
+ * @param hist Histogram
+ * @return Static name string
+ */
+const char *k8s_stats_hist_name(k8s_hist_t hist);
+
+/**
+ * Bucket index of a value, for histograms kept elsewhere and tests
+ *
+ * @param usec Value in microseconds
+ * @return Bucket index in [0, K8S_HIST_BUCKETS)
+ */
+int k8s_stats_bucket(uint64_t usec);
+
+/**
+ * Largest value that falls into a bucket
+ *
+ * @param bucket Bucket index
+ * @return Upper bound in microseconds
+ */
+uint64_t k8s_stats_bucket_upper(int bucket);
+
+/**
+ * Zero every counter and histogram
+ *
+ * Not atomic with respect to concurrent updates; intended for tests.
+ */
+void k8s_stats_reset(void);
+
+#endif /* K8S_STATS_H */
@@ -0,0 +1,214 @@
+/*
+ * Session Tickets Implementation
+ *
+ * A ticket is K8S_TICKET_PREFIX followed by the unpadded base64url of
+ *
+ *   expires (8, big-endian) | token SHA-256 (32) |
+ *   namespace length (1) | namespace | name length (1) | name |
+ *   uid length (1) | uid | HMAC-SHA256 of everything before (32)
+ */
+
+#include "ticket.h"
+#include "jwt.h"
+#include "log.h"
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#define KEY_LEN 32
+#define MAC_LEN 32
+
+/* Fixed part before the identity strings */
+#define HEADER_LEN (8 + K8S_TICKET_DIGEST_LEN)
+
+/* Longest body: header, three length-prefixed strings, MAC */
+#define BODY_MAX (HEADER_LEN + 3 + K8S_MAX_NAMESPACE_LEN + K8S_MAX_NAME_LEN + \
+                  K8S_MAX_UID_LEN + MAC_LEN)
+
+_Static_assert(sizeof(K8S_TICKET_PREFIX) - 1 + (BODY_MAX + 2) / 3 * 4 <= K8S_TICKET_MAX_LEN,
+               "largest ticket exceeds K8S_TICKET_MAX_LEN");
+
+/* Written once by k8s_ticket_init() before logins start */
+static unsigned char ticket_key[KEY_LEN];
+static int have_key = 0;
+
+static const char b64url[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+/* Unpadded base64url; out must hold (len + 2) / 3 * 4 + 1 bytes */
+static size_t encode(const unsigned char *in, size_t len, char *out) {
+    size_t o = 0;
+    for (size_t i = 0; i < len; i += 3) {
+        size_t left = len - i;
+        uint32_t v = (uint32_t)in[i] << 16;
+        if (left > 1) {
+            v |= (uint32_t)in[i + 1] << 8;
+        }
+        if (left > 2) {
+            v |= in[i + 2];
+        }
+        out[o++] = b64url[(v >> 18) & 63];
+        out[o++] = b64url[(v >> 12) & 63];
+        if (left > 1) {
+            out[o++] = b64url[(v >> 6) & 63];
+        }
+        if (left > 2) {
+            out[o++] = b64url[v & 63];
+        }
+    }
+    out[o] = '\0';
+    return o;
+}
+
+static int sign(const unsigned char *body, size_t len, unsigned char *mac) {
+    unsigned int mac_len = 0;
+    return HMAC(EVP_sha256(), ticket_key, KEY_LEN, body, len, mac, &mac_len) != NULL &&
+           mac_len == MAC_LEN;
+}
+
+/* Append a length-prefixed string; 0 if it does not fit in a byte */
+static size_t put_string(unsigned char *p, const char *s) {
+    size_t len = strlen(s);
+    if (len > 255) {
+        return 0;
+    }
+    p[0] = (unsigned char)len;
+    memcpy(p + 1, s, len);
+    return len + 1;
+}
+
+/* Read a length-prefixed string into out (size max + 1); 0 if malformed */
+static size_t get_string(const unsigned char *p, size_t avail, char *out, size_t max) {
+    if (avail < 1 || p[0] > max || (size_t)p[0] + 1 > avail) {
+        return 0;
+    }
+    memcpy(out, p + 1, p[0]);
+    out[p[0]] = '\0';
+    return (size_t)p[0] + 1;
+}
+
+int k8s_ticket_init(void) {
+    if (RAND_bytes(ticket_key, KEY_LEN) != 1) {
+        K8S_LOG(K8S_LOG_ERROR, "ticket_key_failed", "reason=no_randomness");
+        __atomic_store_n(&have_key, 0, __ATOMIC_RELEASE);
+        return 0;
+    }
+    __atomic_store_n(&have_key, 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int k8s_ticket_issue(const char *token, const k8s_token_info_t *info, int ttl,
+                     char *out, size_t out_len) {
+    unsigned char body[BODY_MAX];
+    unsigned int digest_len = 0;
+    size_t len = HEADER_LEN, n;
+
+    if (!__atomic_load_n(&have_key, __ATOMIC_ACQUIRE) || !token || !info || ttl <= 0 ||
+        out_len < K8S_TICKET_MAX_LEN + 1) {
+        return 0;
+    }
+
+    /* Never outlive the token */
+    time_t now = time(NULL);
+    time_t expires = now + ttl;
+    time_t token_exp = k8s_jwt_expiry(token);
+    if (token_exp > 0 && token_exp < expires) {
+        expires = token_exp;
+    }
+    if (expires <= now) {
+        return 0;
+    }
+
+    for (int i = 0; i < 8; i++) {
+        body[i] = (unsigned char)((uint64_t)expires >> (56 - 8 * i));
+    }
+    if (EVP_Digest(token, strlen(token), body + 8, &digest_len, EVP_sha256(), NULL) != 1) {
+        return 0;
+    }
+    const char *strings[] = { info->namespace, info->service_account, info->uid };
+    for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); i++) {
+        if (!(n = put_string(body + len, strings[i]))) {
+            return 0;
+        }
+        len += n;
+    }
+    if (!sign(body, len, body + len)) {
+        return 0;
+    }
+    len += MAC_LEN;
+
+    memcpy(out, K8S_TICKET_PREFIX, sizeof(K8S_TICKET_PREFIX) - 1);
+    encode(body, len, out + sizeof(K8S_TICKET_PREFIX) - 1);
+    OPENSSL_cleanse(body, sizeof(body));
+    return (int)(expires - now);
+}
+
+int k8s_ticket_verify(const char *ticket, size_t len, k8s_token_info_t *info,
+                      unsigned char *digest) {
+    /* Sized for the base64url decoder's worst case */
+    unsigned char body[K8S_TICKET_MAX_LEN * 3 / 4 + 1];
+    unsigned char mac[MAC_LEN];
+    char canonical[K8S_TICKET_MAX_LEN + 1];
+    size_t prefix = sizeof(K8S_TICKET_PREFIX) - 1;
+    size_t body_len = 0, pos, n;
+
+    if (!__atomic_load_n(&have_key, __ATOMIC_ACQUIRE) || !ticket || !info ||
+        len <= prefix || len > K8S_TICKET_MAX_LEN ||
+        memcmp(ticket, K8S_TICKET_PREFIX, prefix) != 0 ||
+        !k8s_base64url_decode(ticket + prefix, len - prefix, body, &body_len) ||
+        body_len < HEADER_LEN + 3 + MAC_LEN || body_len > BODY_MAX) {
+        return 0;
+    }
+
+    /* The decoder ignores the unused bits of the last character: accept
+     * only the one spelling that was issued */
+    if (encode(body, body_len, canonical) != len - prefix ||
+        memcmp(canonical, ticket + prefix, len - prefix) != 0) {
+        return 0;
+    }
+
+    /* Nothing in the body is looked at before the MAC checks out */
+    body_len -= MAC_LEN;
+    if (!sign(body, body_len, mac) || CRYPTO_memcmp(mac, body + body_len, MAC_LEN) != 0) {
+        return 0;
+    }
+
+    uint64_t expires = 0;
+    for (int i = 0; i < 8; i++) {
+        expires = (expires << 8) | body[i];
+    }
+    if ((time_t)expires <= time(NULL)) {
+        return 0;
+    }
+
+    memset(info, 0, sizeof(*info));
+    char *strings[] = { info->namespace, info->service_account, info->uid };
+    size_t limits[] = { K8S_MAX_NAMESPACE_LEN, K8S_MAX_NAME_LEN, K8S_MAX_UID_LEN };
+    pos = HEADER_LEN;
+    for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); i++) {
+        if (!(n = get_string(body + pos, body_len - pos, strings[i], limits[i]))) {
+            return 0;
+        }
+        pos += n;
+    }
+    if (pos != body_len) {
+        return 0;
+    }
+
+    info->authenticated = 1;
+    info->reviewed = 1;
+    info->validated_at = time(NULL);
+    if (digest) {
+        memcpy(digest, body + 8, K8S_TICKET_DIGEST_LEN);
+    }
+    return 1;
+}
+
+void k8s_ticket_shutdown(void) {
+    __atomic_store_n(&have_key, 0, __ATOMIC_RELEASE);
+    OPENSSL_cleanse(ticket_key, KEY_LEN);
+}
@@ -0,0 +1,66 @@
+/*
+ * Session Tickets
+ *
+ * After a token was reviewed, the server hands the client a short-lived
+ * ticket: the ServiceAccount identity, the SHA-256 of the token and an
+ * expiry, signed with HMAC-SHA256 under a key that never leaves this
+ * process. A client reconnecting with the ticket is authenticated by one
+ * local MAC check instead of a TokenReview. The key is generated at startup,
+ * so a restart (or another server) simply refuses old tickets and the
+ * client falls back to its token.
+ */
+
+#ifndef K8S_TICKET_H
+#define K8S_TICKET_H
+
+#include <stddef.h>
+#include "tokenreview_api.h"
+#include "ticket_protocol.h"
+
+/* Length of the token digest bound into a ticket */
+#define K8S_TICKET_DIGEST_LEN 32
+
+/**
+ * Generate a new signing key
+ *
+ * Tickets signed with the previous key stop verifying.
+ *
+ * @return 1 on success, 0 if no random key could be generated
+ */
+int k8s_ticket_init(void);
+
+/**
+ * Issue a ticket for a reviewed token
+ *
+ * The ticket expires after ttl seconds, or with the token if that is sooner.
+ *
+ * @param token Token the ticket stands for
+ * @param info Identity the API server reported for the token
+ * @param ttl Lifetime in seconds
+ * @param out Receives the NUL-terminated ticket
+ * @param out_len Size of out, at least K8S_TICKET_MAX_LEN + 1
+ * @return Lifetime of the ticket in seconds, 0 if none was issued
+ */
+int k8s_ticket_issue(const char *token, const k8s_token_info_t *info, int ttl,
+                     char *out, size_t out_len);
+
+/**
+ * Verify a ticket
+ *
+ * The MAC is compared in constant time before anything else is trusted.
+ *
+ * @param ticket Ticket as sent by the client
+ * @param len Length of ticket
+ * @param info Filled with the ticket's namespace, name and UID, authenticated
+ * @param digest Receives the SHA-256 of the token (K8S_TICKET_DIGEST_LEN bytes)
+ * @return 1 if the ticket is authentic and unexpired, 0 otherwise
+ */
+int k8s_ticket_verify(const char *ticket, size_t len, k8s_token_info_t *info,
+                      unsigned char *digest);
+
+/**
+ * Forget the signing key; no ticket verifies until k8s_ticket_init()
+ */
+void k8s_ticket_shutdown(void);
+
+#endif /* K8S_TICKET_H */
@@ -0,0 +1,36 @@
+/*
+ * Session Ticket Exchange
+ *
+ * Messages between the auth_k8s_ticket server plugin and the auth_k8s_client
+ * client plugin. Every message starts with one type byte. The server opens
+ * with HELLO; each client message is answered with exactly one server
+ * message, or with the login's final error:
+ *
+ *   HELLO  -> TICKET <ticket> -> ACCEPTED
+ *                             -> RETRY  -> TOKEN <token> -> ISSUED ...
+ *          -> TOKEN <token>   -> ISSUED <lifetime> <ticket>
+ *
+ * ISSUED carries the ticket lifetime in seconds (4 bytes, big-endian)
+ * followed by the ticket, or nothing when no ticket was issued. A client
+ * without auth_k8s_client answers HELLO with an empty packet.
+ *
+ * Shared by both plugins; keep it free of server-only headers.
+ */
+
+#ifndef K8S_TICKET_PROTOCOL_H
+#define K8S_TICKET_PROTOCOL_H
+
+#define K8S_TICKET_MSG_HELLO 'K'        /* server: send a ticket or a token */
+#define K8S_TICKET_MSG_TICKET 'T'       /* client: a ticket follows */
+#define K8S_TICKET_MSG_TOKEN 'J'        /* client: a token follows */
+#define K8S_TICKET_MSG_ACCEPTED 'A'     /* server: the ticket was accepted */
+#define K8S_TICKET_MSG_RETRY 'R'        /* server: ticket refused, send the token */
+#define K8S_TICKET_MSG_ISSUED 'I'       /* server: lifetime and ticket follow */
+
+/* Prefix of every ticket; a JWT never starts with it */
+#define K8S_TICKET_PREFIX "k8st1."
+
+/* Longest ticket, prefix included */
+#define K8S_TICKET_MAX_LEN 1024
+
+#endif /* K8S_TICKET_PROTOCOL_H */
@@ -0,0 +1,463 @@
+/*
+ * Validated Token Cache Implementation
+ */
+
+#include "token_cache.h"
+#include "instrumentation.h"
+#include "jwt.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+
+#define SETS (K8S_CACHE_SLOTS / K8S_CACHE_WAYS)
+#define HASH_LEN 32
+#define KEY_LEN 32
+#define IV_LEN 12
+#define TAG_LEN 16
+
+/* Largest key file accepted */
+#define MAX_KEY_FILE 4096
+
+typedef struct {
+    unsigned char hash[HASH_LEN];       /* SHA-256 of the token */
+    k8s_cache_entry_t entry;            /* expires_at 0: slot free */
+} cache_record_t;
+
+typedef struct {
+    cache_record_t rec;
+    uint64_t last_use;                  /* Tick of the latest hit, for LRU */
+} cache_slot_t;
+
+/* One slot as stored in the file */
+typedef struct {
+    unsigned char iv[IV_LEN];
+    unsigned char tag[TAG_LEN];         /* All zero: never written */
+    unsigned char sealed[sizeof(cache_record_t)];
+} file_record_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t slots;
+    uint32_t record_size;
+    uint32_t reserved;
+} file_header_t;
+
+#define FILE_SIZE (sizeof(file_header_t) + K8S_CACHE_SLOTS * sizeof(file_record_t))
+
+static cache_slot_t slots[SETS][K8S_CACHE_WAYS];
+static k8s_mutex_t stripes[K8S_CACHE_STRIPES] = {
+    [0 ... K8S_CACHE_STRIPES - 1] = K8S_MUTEX_INITIALIZER(K8S_MUTEX_TOKEN_CACHE)
+};
+static uint64_t ticks = 0;
+
+/* Persistence; changed only with every stripe held */
+static unsigned char *mapping = NULL;
+static int mapping_fd = -1;
+static unsigned char file_key[KEY_LEN];
+
+static void lock_all(void) {
+    for (int s = 0; s < K8S_CACHE_STRIPES; s++) {
+        k8s_mutex_lock(&stripes[s]);
+    }
+}
+
+static void unlock_all(void) {
+    for (int s = K8S_CACHE_STRIPES - 1; s >= 0; s--) {
+        k8s_mutex_unlock(&stripes[s]);
+    }
+}
+
+static void token_hash(const char *token, unsigned char *hash) {
+    unsigned int len = HASH_LEN;
+    EVP_Digest(token, strlen(token), hash, &len, EVP_sha256(), NULL);
+}
+
+static size_t hash_set(const unsigned char *hash) {
+    uint64_t h;
+    memcpy(&h, hash, sizeof(h));
+    return h % SETS;
+}
+
+static file_record_t *file_record(size_t index) {
+    return (file_record_t *)(mapping + sizeof(file_header_t)) + index;
+}
+
+/* Records are bound to their position so they can't be moved around */
+static void record_aad(size_t index, unsigned char *aad) {
+    memcpy(aad, K8S_CACHE_MAGIC, 8);
+    for (int i = 0; i < 4; i++) {
+        aad[8 + i] = (unsigned char)(index >> (8 * i));
+    }
+}
+
+static int seal(size_t index, const cache_record_t *rec, file_record_t *out) {
+    unsigned char aad[12];
+    int len = 0;
+    int ok = 0;
+
+    if (RAND_bytes(out->iv, IV_LEN) != 1) {
+        return 0;
+    }
+    record_aad(index, aad);
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (ctx &&
+        EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, file_key, out->iv) == 1 &&
+        EVP_EncryptUpdate(ctx, NULL, &len, aad, sizeof(aad)) == 1 &&
+        EVP_EncryptUpdate(ctx, out->sealed, &len, (const unsigned char *)rec,
+                          sizeof(*rec)) == 1 &&
+        EVP_EncryptFinal_ex(ctx, out->sealed + len, &len) == 1 &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, TAG_LEN, out->tag) == 1) {
+        ok = 1;
+    }
+    EVP_CIPHER_CTX_free(ctx);
+    return ok;
+}
+
+static int unseal(size_t index, const file_record_t *in, cache_record_t *rec) {
+    unsigned char aad[12];
+    unsigned char tag[TAG_LEN];
+    int len = 0;
+    int ok = 0;
+
+    record_aad(index, aad);
+    memcpy(tag, in->tag, TAG_LEN);
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (ctx &&
+        EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, file_key, in->iv) == 1 &&
+        EVP_DecryptUpdate(ctx, NULL, &len, aad, sizeof(aad)) == 1 &&
+        EVP_DecryptUpdate(ctx, (unsigned char *)rec, &len, in->sealed,
+                          sizeof(in->sealed)) == 1 &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, TAG_LEN, tag) == 1 &&
+        EVP_DecryptFinal_ex(ctx, (unsigned char *)rec + len, &len) == 1) {
+        ok = 1;
+    }
+    EVP_CIPHER_CTX_free(ctx);
+    if (!ok) {
+        OPENSSL_cleanse(rec, sizeof(*rec));
+    }
+    return ok;
+}
+
+/* Write one slot to the file; caller holds its stripe */
+static void write_through(size_t set, int way) {
+    if (!mapping) {
+        return;
+    }
+
+    size_t index = set * K8S_CACHE_WAYS + (size_t)way;
+    file_record_t *out = file_record(index);
+    if (!seal(index, &slots[set][way].rec, out)) {
+        /* A torn record would only fail to decrypt; make it obviously empty */
+        memset(out, 0, sizeof(*out));
+    }
+}
+
+/**
+ * Derive the file key from the key file's contents (trailing whitespace
+ * is ignored, so a Secret written with or without a newline both work)
+ */
+static int load_key(const char *key_path) {
+    unsigned char buf[MAX_KEY_FILE];
+    unsigned int len = KEY_LEN;
+    size_t n = 0;
+
+    FILE *f = fopen(key_path, "rbe");
+    if (!f) {
+        return 0;
+    }
+    n = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+
+    while (n > 0 && isspace(buf[n - 1])) {
+        n--;
+    }
+    int ok = n > 0 && EVP_Digest(buf, n, file_key, &len, EVP_sha256(), NULL) == 1;
+    OPENSSL_cleanse(buf, sizeof(buf));
+    return ok;
+}
+
+static int header_valid(const file_header_t *h) {
+    return memcmp(h->magic, K8S_CACHE_MAGIC, 8) == 0 &&
+           h->version == K8S_CACHE_VERSION &&
+           h->slots == K8S_CACHE_SLOTS &&
+           h->record_size == sizeof(file_record_t);
+}
+
+/* Decrypt every record of a freshly mapped file into the table */
+static int load_records(int *rejected) {
+    static const unsigned char unused[TAG_LEN];
+    time_t now = time(NULL);
+    int loaded = 0;
+
+    for (size_t index = 0; index < K8S_CACHE_SLOTS; index++) {
+        file_record_t *in = file_record(index);
+        size_t set = index / K8S_CACHE_WAYS;
+        int way = (int)(index % K8S_CACHE_WAYS);
+        cache_record_t rec;
+
+        if (memcmp(in->tag, unused, TAG_LEN) == 0) {
+            continue;
+        }
+        if (!unseal(index, in, &rec) || hash_set(rec.hash) != set) {
+            (*rejected)++;
+            memset(in, 0, sizeof(*in));
+            continue;
+        }
+        if (rec.entry.expires_at <= now) {
+            memset(in, 0, sizeof(*in));
+            continue;
+        }
+
+        /* Entries cached since start-up win over the file */
+        if (slots[set][way].rec.entry.expires_at == 0) {
+            slots[set][way].rec = rec;
+            slots[set][way].last_use = ++ticks;
+            loaded++;
+        }
+        OPENSSL_cleanse(&rec, sizeof(rec));
+    }
+    return loaded;
+}
+
+int k8s_token_cache_open(const char *path, const char *key_path) {
+    int rejected = 0;
+
+    if (!path || !*path || !key_path || !*key_path) {
+        return -1;
+    }
+
+    lock_all();
+    if (mapping) {
+        unlock_all();
+        return -1;
+    }
+
+    if (!load_key(key_path)) {
+        unlock_all();
+        K8S_LOG(K8S_LOG_ERROR, "cache_unavailable", "path=\"%s\" reason=key_unreadable key=\"%s\"",
+                path, key_path);
+        return -1;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        goto fail;
+    }
+
+    /* Start over on a file of another size or format */
+    int fresh = (size_t)st.st_size != FILE_SIZE;
+    if (fresh && (ftruncate(fd, 0) != 0 || ftruncate(fd, FILE_SIZE) != 0)) {
+        goto fail;
+    }
+
+    unsigned char *map = mmap(NULL, FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        goto fail;
+    }
+    file_header_t *header = (file_header_t *)map;
+    if (!fresh && !header_valid(header)) {
+        memset(map, 0, FILE_SIZE);
+        fresh = 1;
+    }
+    if (fresh) {
+        memcpy(header->magic, K8S_CACHE_MAGIC, 8);
+        header->version = K8S_CACHE_VERSION;
+        header->slots = K8S_CACHE_SLOTS;
+        header->record_size = sizeof(file_record_t);
+    }
+
+    mapping = map;
+    mapping_fd = fd;
+    int loaded = load_records(&rejected);
+    unlock_all();
+
+    K8S_LOG(K8S_LOG_INFO, "cache_loaded", "path=\"%s\" entries=%d rejected=%d",
+            path, loaded, rejected);
+    if (rejected > 0) {
+        K8S_LOG(K8S_LOG_WARNING, "cache_records_rejected",
+                "path=\"%s\" count=%d hint=\"key changed or file modified\"", path, rejected);
+    }
+    return loaded;
+
+fail:
+    K8S_LOG(K8S_LOG_ERROR, "cache_unavailable", "path=\"%s\" error=\"%s\"", path, strerror(errno));
+    if (fd >= 0) {
+        close(fd);
+    }
+    OPENSSL_cleanse(file_key, sizeof(file_key));
+    unlock_all();
+    return -1;
+}
+
+void k8s_token_cache_close(void) {
+    lock_all();
+    if (mapping) {
+        msync(mapping, FILE_SIZE, MS_SYNC);
+        munmap(mapping, FILE_SIZE);
+        close(mapping_fd);
+        mapping = NULL;
+        mapping_fd = -1;
+    }
+    OPENSSL_cleanse(file_key, sizeof(file_key));
+    unlock_all();
+}
+
+int k8s_token_cache_lookup(const char *token, int ttl, k8s_cache_entry_t *entry) {
+    unsigned char hash[HASH_LEN];
+    time_t now = time(NULL);
+    int hit = 0;
+
+    if (!token || ttl <= 0) {
+        return 0;
+    }
+
+    token_hash(token, hash);
+    size_t set = hash_set(hash);
+
+    k8s_mutex_lock(&stripes[set % K8S_CACHE_STRIPES]);
+    for (int i = 0; i < K8S_CACHE_WAYS; i++) {
+        cache_slot_t *s = &slots[set][i];
+        if (s->rec.entry.expires_at > now && memcmp(s->rec.hash, hash, HASH_LEN) == 0) {
+            /* A lowered TTL applies to entries cached before the change */
+            if (s->rec.entry.validated_at + ttl > now) {
+                *entry = s->rec.entry;
+                s->last_use = __atomic_add_fetch(&ticks, 1, __ATOMIC_RELAXED);
+                hit = 1;
+            }
+            break;
+        }
+    }
+    k8s_mutex_unlock(&stripes[set % K8S_CACHE_STRIPES]);
+    return hit;
+}
+
+void k8s_token_cache_insert(const char *token, const k8s_token_info_t *info, int ttl) {
+    cache_record_t rec;
+    time_t now = time(NULL);
+
+    if (!token || !info || ttl <= 0) {
+        return;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    token_hash(token, rec.hash);
+    strncpy(rec.entry.namespace, info->namespace, K8S_MAX_NAMESPACE_LEN);
+    strncpy(rec.entry.service_account, info->service_account, K8S_MAX_NAME_LEN);
+    strncpy(rec.entry.uid, info->uid, K8S_MAX_UID_LEN);
+    rec.entry.validated_at = info->validated_at ? info->validated_at : now;
+    rec.entry.expires_at = rec.entry.validated_at + ttl;
+
+    /* Never outlive the token itself, and remember the pod it is bound to */
+    k8s_jwt_claims_t claims;
+    if (k8s_jwt_claims(token, &claims)) {
+        if (claims.exp > 0 && claims.exp < rec.entry.expires_at) {
+            rec.entry.expires_at = claims.exp;
+        }
+        strncpy(rec.entry.pod_uid, claims.pod_uid, K8S_MAX_UID_LEN);
+    }
+    if (rec.entry.expires_at <= now) {
+        return;
+    }
+
+    size_t set = hash_set(rec.hash);
+    cache_slot_t *ways = slots[set];
+    int way = -1;
+    int victim = 0;
+
+    k8s_mutex_lock(&stripes[set % K8S_CACHE_STRIPES]);
+    for (int i = 0; i < K8S_CACHE_WAYS; i++) {
+        cache_slot_t *s = &ways[i];
+        if (memcmp(s->rec.hash, rec.hash, HASH_LEN) == 0) {
+            way = i;
+            break;
+        }
+        /* Prefer a free or expired slot, then the least recently used one */
+        int usable = s->rec.entry.expires_at <= now;
+        int victim_usable = ways[victim].rec.entry.expires_at <= now;
+        if (!victim_usable && (usable || s->last_use < ways[victim].last_use)) {
+            victim = i;
+        }
+    }
+    if (way < 0) {
+        way = victim;
+    }
+
+    ways[way].rec = rec;
+    ways[way].last_use = __atomic_add_fetch(&ticks, 1, __ATOMIC_RELAXED);
+    write_through(set, way);
+    k8s_mutex_unlock(&stripes[set % K8S_CACHE_STRIPES]);
+}
+
+/*
+ * Clear a slot and its file record; the slot's stripe must be held
+ */
+static void drop_slot(size_t set, int way) {
+    OPENSSL_cleanse(&slots[set][way], sizeof(cache_slot_t));
+    if (mapping) {
+        memset(file_record(set * K8S_CACHE_WAYS + (size_t)way), 0, sizeof(file_record_t));
+    }
+}
+
+int k8s_token_cache_remove(const char *token) {
+    unsigned char hash[HASH_LEN];
+    int removed = 0;
+
+    if (!token) {
+        return 0;
+    }
+
+    token_hash(token, hash);
+    size_t set = hash_set(hash);
+
+    k8s_mutex_lock(&stripes[set % K8S_CACHE_STRIPES]);
+    for (int i = 0; i < K8S_CACHE_WAYS; i++) {
+        cache_slot_t *s = &slots[set][i];
+        if (s->rec.entry.expires_at != 0 && memcmp(s->rec.hash, hash, HASH_LEN) == 0) {
+            drop_slot(set, i);
+            removed = 1;
+            break;
+        }
+    }
+    k8s_mutex_unlock(&stripes[set % K8S_CACHE_STRIPES]);
+    return removed;
+}
+
+int k8s_token_cache_evict_if(k8s_cache_drop_fn drop, void *arg) {
+    int dropped = 0;
+
+    for (size_t set = 0; set < SETS; set++) {
+        k8s_mutex_lock(&stripes[set % K8S_CACHE_STRIPES]);
+        for (int i = 0; i < K8S_CACHE_WAYS; i++) {
+            cache_slot_t *s = &slots[set][i];
+            if (s->rec.entry.expires_at != 0 && drop(&s->rec.entry, arg)) {
+                drop_slot(set, i);
+                dropped++;
+            }
+        }
+        k8s_mutex_unlock(&stripes[set % K8S_CACHE_STRIPES]);
+    }
+    return dropped;
+}
+
+void k8s_token_cache_clear(void) {
+    lock_all();
+    OPENSSL_cleanse(slots, sizeof(slots));
+    if (mapping) {
+        memset(mapping + sizeof(file_header_t), 0, FILE_SIZE - sizeof(file_header_t));
+    }
+    unlock_all();
+}
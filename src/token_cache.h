@@ -0,0 +1,116 @@
+/*
+ * Validated Token Cache
+ *
+ * Remembers recent successful TokenReviews by the SHA-256 of the token, so
+ * a client that reconnects with the same token skips the API server. An
+ * entry is used until the token's own exp or auth_k8s_cache_ttl seconds
+ * after the review, whichever comes first.
+ *
+ * The cache can be backed by a memory-mapped file so that it survives a
+ * mariadbd restart, when every client reconnects at once. Each record in
+ * the file is sealed with AES-256-GCM under a key derived from a separate
+ * key file (e.g. a mounted Secret); without the key the file is useless,
+ * and records that don't decrypt are ignored.
+ */
+
+#ifndef K8S_TOKEN_CACHE_H
+#define K8S_TOKEN_CACHE_H
+
+#include <time.h>
+#include "tokenreview_api.h"
+
+/* Number of cached tokens (sets of K8S_CACHE_WAYS, least recently used evicted) */
+#define K8S_CACHE_SLOTS 4096
+#define K8S_CACHE_WAYS 8
+
+/* Locks over the sets */
+#define K8S_CACHE_STRIPES 16
+
+/* Persistent file format */
+#define K8S_CACHE_MAGIC "K8SAUTHC"
+#define K8S_CACHE_VERSION 2
+
+typedef struct {
+    char namespace[K8S_MAX_NAMESPACE_LEN + 1];
+    char service_account[K8S_MAX_NAME_LEN + 1];
+    char uid[K8S_MAX_UID_LEN + 1];              /* User UID from the TokenReview (the SA's UID) */
+    char pod_uid[K8S_MAX_UID_LEN + 1];          /* Pod the token is bound to; empty if none */
+    time_t validated_at;
+    time_t expires_at;                          /* Token exp, capped by the TTL */
+} k8s_cache_entry_t;
+
+/**
+ * Back the cache with a file and load the entries it holds
+ *
+ * The file is created (mode 0600) if needed. Entries that are expired,
+ * don't decrypt with the key, or come from a file of another format are
+ * dropped.
+ *
+ * @param path Cache file
+ * @param key_path File holding the secret the encryption key is derived from
+ * @return Number of entries loaded, or -1 if persistence could not be set up
+ *         (the cache then works in memory only)
+ */
+int k8s_token_cache_open(const char *path, const char *key_path);
+
+/**
+ * Flush and unmap the cache file, and forget the key
+ *
+ * Cached entries stay in memory. Safe to call when no file is open.
+ */
+void k8s_token_cache_close(void);
+
+/**
+ * Look up a token
+ *
+ * @param token Client token
+ * @param ttl Maximum age in seconds of a usable entry
+ * @param entry Filled with the cached identity on a hit
+ * @return 1 on a hit, 0 on a miss
+ */
+int k8s_token_cache_lookup(const char *token, int ttl, k8s_cache_entry_t *entry);
+
+/**
+ * Remember a successfully validated token
+ *
+ * Written through to the cache file when one is open.
+ *
+ * @param token Client token
+ * @param info Result of the TokenReview
+ * @param ttl Seconds the entry may be used
+ */
+void k8s_token_cache_insert(const char *token, const k8s_token_info_t *info, int ttl);
+
+/**
+ * Forget a token, including its record in the cache file
+ *
+ * @param token Client token
+ * @return 1 if the token was cached, 0 otherwise
+ */
+int k8s_token_cache_remove(const char *token);
+
+/**
+ * Decides whether a cached entry must be dropped
+ *
+ * @return 1 to drop the entry, 0 to keep it
+ */
+typedef int (*k8s_cache_drop_fn)(const k8s_cache_entry_t *entry, void *arg);
+
+/**
+ * Drop the entries a predicate selects, including those in the cache file
+ *
+ * The predicate is called with a cache lock held and must not call back
+ * into the cache.
+ *
+ * @param drop Predicate
+ * @param arg Passed to the predicate
+ * @return Number of entries dropped
+ */
+int k8s_token_cache_evict_if(k8s_cache_drop_fn drop, void *arg);
+
+/**
+ * Drop every entry, including those in the cache file
+ */
+void k8s_token_cache_clear(void);
+
+#endif /* K8S_TOKEN_CACHE_H */
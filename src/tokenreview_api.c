@@ -3,6 +3,10 @@
  */
 
 #include "tokenreview_api.h"
+#include "http_pool.h"
+#include "stats.h"
+#include "instrumentation.h"
+#include "log.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,9 +32,9 @@ static size_t write_callback(void *contents, size_t size, size_t nmemb, void *us
     size_t realsize = size * nmemb;
     response_buffer_t *buffer = (response_buffer_t *)userp;
 
-    char *ptr = realloc(buffer->data, buffer->size + realsize + 1);
+    char *ptr = k8s_realloc(K8S_MEM_RESPONSE, buffer->data, buffer->size + realsize + 1);
     if (ptr == NULL) {
-        fprintf(stderr, "K8s Auth: Out of memory for response buffer\n");
+        K8S_LOG(K8S_LOG_ERROR, "out_of_memory", "where=response_buffer");
         return 0;
     }
 
@@ -43,9 +47,53 @@ static size_t write_callback(void *contents, size_t size, size_t nmemb, void *us
 }
 
 /**
- * Read file contents into a string
+ * Count the HTTP bytes a transfer sent and received, headers included
  */
-static char* read_file(const char *path) {
+static void record_transfer_stats(CURL *curl) {
+    long request_size = 0;   /* Headers plus the small POST body sent with them */
+    long header_size = 0;
+    curl_off_t download = 0;
+
+    curl_easy_getinfo(curl, CURLINFO_REQUEST_SIZE, &request_size);
+    curl_easy_getinfo(curl, CURLINFO_HEADER_SIZE, &header_size);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &download);
+
+    k8s_stats_add(K8S_STAT_BYTES_SENT, (uint64_t)request_size);
+    k8s_stats_add(K8S_STAT_BYTES_RECEIVED, (uint64_t)header_size + (uint64_t)download);
+}
+
+/**
+ * Split libcurl's cumulative timers into phases and record each of them
+ */
+static void record_phase_timing(CURL *curl, k8s_request_timing_t *timing) {
+    curl_off_t namelookup = 0, connect = 0, appconnect = 0;
+    curl_off_t pretransfer = 0, starttransfer = 0, total = 0;
+
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &namelookup);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &appconnect);
+    curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &starttransfer);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+
+    /* Each timer is measured from the start of the transfer; a phase that did
+     * not happen (reused connection, plain HTTP) reports 0 */
+    timing->dns_us = (unsigned long long)namelookup;
+    timing->connect_us = connect > namelookup ? (unsigned long long)(connect - namelookup) : 0;
+    timing->tls_us = appconnect > connect ? (unsigned long long)(appconnect - connect) : 0;
+    timing->server_us = starttransfer > pretransfer ?
+        (unsigned long long)(starttransfer - pretransfer) : 0;
+    timing->transfer_us = total > starttransfer ? (unsigned long long)(total - starttransfer) : 0;
+    timing->total_us = (unsigned long long)total;
+
+    k8s_stats_record(K8S_HIST_DNS, timing->dns_us);
+    k8s_stats_record(K8S_HIST_CONNECT, timing->connect_us);
+    k8s_stats_record(K8S_HIST_TLS, timing->tls_us);
+    k8s_stats_record(K8S_HIST_SERVER, timing->server_us);
+    k8s_stats_record(K8S_HIST_TRANSFER, timing->transfer_us);
+}
+
+char *k8s_read_file(const char *path) {
     FILE *fp = fopen(path, "r");
     if (!fp) {
         return NULL;
@@ -78,6 +126,9 @@ void k8s_config_init_default(k8s_config_t *config) {
     config->ca_cert_path = DEFAULT_CA_CERT;
     config->token_path = DEFAULT_TOKEN_PATH;
     config->timeout_seconds = DEFAULT_TIMEOUT;
+    config->audience = NULL;
+    config->pool = NULL;
+    config->backends = NULL;
 }
 
 int k8s_parse_username(const char *username, char *namespace, size_t namespace_len,
@@ -104,41 +155,11 @@ int k8s_parse_username(const char *username, char *namespace, size_t namespace_l
     return 1;
 }
 
-int k8s_validate_token(const char *token, k8s_token_info_t *info, const k8s_config_t *config) {
-    CURL *curl = NULL;
-    CURLcode res;
-    int result = 0;
-    response_buffer_t response = {NULL, 0};
-    struct curl_slist *headers = NULL;
-    char *service_account_token = NULL;
-    json_object *request_obj = NULL;
-    json_object *response_obj = NULL;
-
-    /* Input validation */
-    if (!token || !info) {
-        fprintf(stderr, "K8s Auth: Invalid input parameters\n");
-        return 0;
-    }
-
-    /* Initialize info structure */
-    memset(info, 0, sizeof(k8s_token_info_t));
-
-    /* Use default config if not provided */
-    k8s_config_t default_config;
-    if (!config) {
-        k8s_config_init_default(&default_config);
-        config = &default_config;
-    }
-
-    /* Initialize libcurl */
-    curl = curl_easy_init();
-    if (!curl) {
-        fprintf(stderr, "K8s Auth: Failed to initialize curl\n");
-        return 0;
-    }
-
-    /* Build TokenReview request JSON */
-    request_obj = json_object_new_object();
+/**
+ * Build the TokenReview request body for a token
+ */
+static json_object *build_request(const char *token, const char *audience) {
+    json_object *request_obj = json_object_new_object();
     json_object *spec_obj = json_object_new_object();
 
     json_object_object_add(request_obj, "apiVersion",
@@ -146,97 +167,198 @@ int k8s_validate_token(const char *token, k8s_token_info_t *info, const k8s_conf
     json_object_object_add(request_obj, "kind",
                           json_object_new_string("TokenReview"));
     json_object_object_add(spec_obj, "token", json_object_new_string(token));
+    if (audience) {
+        json_object *audiences_obj = json_object_new_array();
+        json_object_array_add(audiences_obj, json_object_new_string(audience));
+        json_object_object_add(spec_obj, "audiences", audiences_obj);
+    }
     json_object_object_add(request_obj, "spec", spec_obj);
 
-    const char *request_json = json_object_to_json_string(request_obj);
+    return request_obj;
+}
 
-    /* Read service account token for authentication */
-    service_account_token = read_file(config->token_path);
-    if (!service_account_token) {
-        fprintf(stderr, "K8s Auth: Failed to read service account token from %s\n",
-                config->token_path);
-        goto cleanup;
+/**
+ * Format the Authorization header: from the pool's cached credential, or
+ * read from disk for one-shot handles
+ */
+static int build_auth_header(const k8s_config_t *config, char *buf, size_t len) {
+    if (config->pool) {
+        if (k8s_http_pool_auth_header(config->pool, buf, len)) {
+            return 1;
+        }
+    } else {
+        char *service_account_token = k8s_read_file(config->token_path);
+        if (service_account_token) {
+            snprintf(buf, len, "Authorization: Bearer %s", service_account_token);
+            free(service_account_token);
+            return 1;
+        }
     }
 
-    /* Set up HTTP headers */
-    headers = curl_slist_append(headers, "Content-Type: application/json");
+    K8S_LOG(K8S_LOG_WARNING, "credential_missing", "path=\"%s\"", config->token_path);
+    return 0;
+}
 
-    char auth_header[4096];
-    snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s",
-             service_account_token);
-    headers = curl_slist_append(headers, auth_header);
+/**
+ * First string of an array-valued member of user.extra, or NULL
+ */
+static const char *extra_value(json_object *user_obj, const char *key) {
+    json_object *extra_obj = NULL, *values_obj = NULL;
+    if (!json_object_object_get_ex(user_obj, "extra", &extra_obj) ||
+        !json_object_object_get_ex(extra_obj, key, &values_obj) ||
+        !json_object_is_type(values_obj, json_type_array) ||
+        json_object_array_length(values_obj) < 1) {
+        return NULL;
+    }
+    return json_object_get_string(json_object_array_get_idx(values_obj, 0));
+}
 
-    /* Build TokenReview API URL */
-    char api_url[1024];
-    snprintf(api_url, sizeof(api_url),
-             "%s/apis/authentication.k8s.io/v1/tokenreviews",
-             config->api_server_url);
+/**
+ * Whether status.audiences lists the audience
+ */
+static int has_audience(json_object *status_obj, const char *audience) {
+    json_object *audiences_obj = NULL;
+    if (!json_object_object_get_ex(status_obj, "audiences", &audiences_obj) ||
+        !json_object_is_type(audiences_obj, json_type_array)) {
+        return 0;
+    }
+    for (size_t i = 0; i < json_object_array_length(audiences_obj); i++) {
+        const char *listed = json_object_get_string(json_object_array_get_idx(audiences_obj, i));
+        if (listed && strcmp(listed, audience) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Copy user.groups into a list with one group per line; groups that do not
+ * fit are left out
+ */
+static void extract_groups(json_object *user_obj, char *out, size_t out_len) {
+    json_object *groups_obj = NULL;
+    size_t used = 0;
+
+    out[0] = '\0';
+    if (!json_object_object_get_ex(user_obj, "groups", &groups_obj) ||
+        !json_object_is_type(groups_obj, json_type_array)) {
+        return;
+    }
+    for (size_t i = 0; i < json_object_array_length(groups_obj); i++) {
+        const char *group = json_object_get_string(json_object_array_get_idx(groups_obj, i));
+        size_t len = group ? strlen(group) : 0;
+        if (len == 0 || strchr(group, '\n') || used + len + 2 > out_len) {
+            continue;
+        }
+        memcpy(out + used, group, len);
+        used += len;
+        out[used++] = '\n';
+        out[used] = '\0';
+    }
+}
 
-    /* Configure curl options */
+/**
+ * Set the request options of one TokenReview on a handle
+ */
+static void prepare_request(CURL *curl, const k8s_config_t *config, const char *api_url,
+                            struct curl_slist *headers, const char *body,
+                            response_buffer_t *response) {
     curl_easy_setopt(curl, CURLOPT_URL, api_url);
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request_json);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, config->timeout_seconds);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
 
-    /* SSL/TLS configuration */
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
-    curl_easy_setopt(curl, CURLOPT_CAINFO, config->ca_cert_path);
+    /* Timeout and SSL/TLS configuration */
+    k8s_http_apply_common(curl, config);
+}
 
-    /* Perform the request */
-    fprintf(stderr, "K8s Auth: Calling TokenReview API at %s\n", api_url);
-    res = curl_easy_perform(curl);
+/**
+ * Record the outcome of a finished transfer and extract the verdict
+ *
+ * @param audience Audience the review asked for, NULL for the API server's
+ * @param transport_ok Set to 1 if the connection delivered an HTTP response
+ * @return 1 if the token was authenticated and its user extracted, 0 otherwise
+ */
+static int finish_request(CURL *curl, CURLcode res, const response_buffer_t *response,
+                          const char *audience, k8s_token_info_t *info, int *transport_ok) {
+    int result = 0;
+    json_object *response_obj = NULL;
+    uint64_t parse_started = 0;
+
+    record_transfer_stats(curl);
+    record_phase_timing(curl, &info->timing);
 
     if (res != CURLE_OK) {
-        fprintf(stderr, "K8s Auth: TokenReview API call failed: %s\n",
+        K8S_LOG(K8S_LOG_WARNING, "tokenreview_failed", "error=\"%s\"",
                 curl_easy_strerror(res));
+        k8s_stats_inc(res == CURLE_OPERATION_TIMEDOUT ? K8S_STAT_TIMEOUTS
+                                                      : K8S_STAT_CONNECT_ERRORS);
         goto cleanup;
     }
+    *transport_ok = 1;
 
     /* Check HTTP response code */
     long http_code = 0;
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    k8s_stats_inc(http_code >= 200 && http_code < 300 ? K8S_STAT_HTTP_2XX :
+                  http_code >= 400 && http_code < 500 ? K8S_STAT_HTTP_4XX :
+                  http_code >= 500 && http_code < 600 ? K8S_STAT_HTTP_5XX :
+                  K8S_STAT_HTTP_OTHER);
     if (http_code != 201 && http_code != 200) {
-        fprintf(stderr, "K8s Auth: TokenReview API returned HTTP %ld\n", http_code);
-        if (response.data) {
-            fprintf(stderr, "K8s Auth: Response: %s\n", response.data);
-        }
+        K8S_LOG(K8S_LOG_WARNING, "tokenreview_failed", "http_status=%ld", http_code);
+        K8S_LOG(K8S_LOG_DEBUG, "tokenreview_response", "body=%s",
+                response->data ? response->data : "");
         goto cleanup;
     }
 
     /* Parse JSON response */
-    response_obj = json_tokener_parse(response.data);
+    k8s_psi_stage(K8S_STAGE_PARSE);
+    parse_started = k8s_stats_now_usec();
+    response_obj = json_tokener_parse(response->data);
     if (!response_obj) {
-        fprintf(stderr, "K8s Auth: Failed to parse TokenReview response\n");
+        K8S_LOG(K8S_LOG_WARNING, "tokenreview_failed", "reason=invalid_json");
         goto cleanup;
     }
 
     /* Extract status.authenticated */
     json_object *status_obj = NULL;
     if (!json_object_object_get_ex(response_obj, "status", &status_obj)) {
-        fprintf(stderr, "K8s Auth: No 'status' field in TokenReview response\n");
+        K8S_LOG(K8S_LOG_WARNING, "tokenreview_failed", "reason=missing_field field=status");
         goto cleanup;
     }
 
     json_object *authenticated_obj = NULL;
     if (!json_object_object_get_ex(status_obj, "authenticated", &authenticated_obj)) {
-        fprintf(stderr, "K8s Auth: No 'authenticated' field in TokenReview response\n");
+        K8S_LOG(K8S_LOG_WARNING, "tokenreview_failed",
+                "reason=missing_field field=authenticated");
         goto cleanup;
     }
 
     info->authenticated = json_object_get_boolean(authenticated_obj);
+    info->reviewed = 1;
 
     if (!info->authenticated) {
-        fprintf(stderr, "K8s Auth: Token authentication failed\n");
+        K8S_LOG(K8S_LOG_DEBUG, "tokenreview_rejected", "http_status=%ld", http_code);
+        goto cleanup;
+    }
+
+    /*
+     * An API server that ignores spec.audiences authenticates the token for
+     * its own audience; only one listing ours in status.audiences vouches
+     * for the audience asked for
+     */
+    if (audience && !has_audience(status_obj, audience)) {
+        K8S_LOG(K8S_LOG_WARNING, "tokenreview_rejected", "reason=audience_mismatch "
+                "audience=\"%s\"", audience);
+        info->authenticated = 0;
         goto cleanup;
     }
 
     /* Extract user information */
     json_object *user_obj = NULL;
     if (!json_object_object_get_ex(status_obj, "user", &user_obj)) {
-        fprintf(stderr, "K8s Auth: No 'user' field in TokenReview response\n");
+        K8S_LOG(K8S_LOG_WARNING, "tokenreview_failed", "reason=missing_field field=user");
         goto cleanup;
     }
 
@@ -249,14 +371,14 @@ int k8s_validate_token(const char *token, k8s_token_info_t *info, const k8s_conf
         /* Parse namespace and service account from username */
         if (!k8s_parse_username(username, info->namespace, sizeof(info->namespace),
                                info->service_account, sizeof(info->service_account))) {
-            fprintf(stderr, "K8s Auth: Failed to parse username: %s\n", username);
+            K8S_LOG(K8S_LOG_WARNING, "tokenreview_failed",
+                    "reason=unexpected_username username=\"%s\"", username);
             goto cleanup;
         }
 
-        fprintf(stderr, "K8s Auth: Token validated successfully\n");
-        fprintf(stderr, "K8s Auth: Username: %s\n", info->username);
-        fprintf(stderr, "K8s Auth: Namespace: %s\n", info->namespace);
-        fprintf(stderr, "K8s Auth: ServiceAccount: %s\n", info->service_account);
+        K8S_LOG(K8S_LOG_DEBUG, "tokenreview_authenticated",
+                "username=\"%s\" namespace=%s service_account=%s",
+                info->username, info->namespace, info->service_account);
     }
 
     /* Extract UID */
@@ -266,28 +388,348 @@ int k8s_validate_token(const char *token, k8s_token_info_t *info, const k8s_conf
         strncpy(info->uid, uid, sizeof(info->uid) - 1);
     }
 
+    /* Groups and the pod a bound token belongs to, for account policies */
+    extract_groups(user_obj, info->groups, sizeof(info->groups));
+    const char *pod_name = extra_value(user_obj, "authentication.kubernetes.io/pod-name");
+    const char *pod_uid = extra_value(user_obj, "authentication.kubernetes.io/pod-uid");
+    if (pod_name && pod_uid) {
+        strncpy(info->pod_name, pod_name, sizeof(info->pod_name) - 1);
+        strncpy(info->pod_uid, pod_uid, sizeof(info->pod_uid) - 1);
+    }
+
     info->validated_at = time(NULL);
     result = 1;
 
+cleanup:
+    if (parse_started) {
+        info->timing.parse_us = k8s_stats_now_usec() - parse_started;
+        k8s_stats_record(K8S_HIST_PARSE, info->timing.parse_us);
+    }
+    if (response_obj) {
+        json_object_put(response_obj);
+    }
+
+    return result;
+}
+
+int k8s_validate_token(const char *token, k8s_token_info_t *info, const k8s_config_t *config) {
+    CURL *curl = NULL;
+    CURLcode res;
+    int result = 0;
+    int transport_ok = 0;
+    response_buffer_t response = {NULL, 0};
+    struct curl_slist *headers = NULL;
+    json_object *request_obj = NULL;
+    uint64_t entered = k8s_stats_now_usec();
+
+    /* Input validation */
+    if (!token || !info) {
+        K8S_LOG(K8S_LOG_ERROR, "invalid_argument", "function=k8s_validate_token");
+        return 0;
+    }
+
+    /* Initialize info structure */
+    memset(info, 0, sizeof(k8s_token_info_t));
+
+    /* Use default config if not provided */
+    k8s_config_t default_config;
+    if (!config) {
+        k8s_config_init_default(&default_config);
+        config = &default_config;
+    }
+
+    /* Take a warm handle from the pool, or create a one-shot handle */
+    curl = config->pool ? k8s_http_pool_acquire(config->pool) : curl_easy_init();
+    if (!curl) {
+        K8S_LOG(K8S_LOG_ERROR, "init_failed", "reason=curl_handle");
+        return 0;
+    }
+
+    /* Build TokenReview request JSON */
+    request_obj = build_request(token, config->audience);
+    const char *request_json = json_object_to_json_string(request_obj);
+
+    char auth_header[4096];
+    if (!build_auth_header(config, auth_header, sizeof(auth_header))) {
+        goto cleanup;
+    }
+
+    /* Set up HTTP headers */
+    headers = curl_slist_append(headers, "Content-Type: application/json");
+    headers = curl_slist_append(headers, auth_header);
+
+    /* Build TokenReview API URL */
+    char api_url[1024];
+    snprintf(api_url, sizeof(api_url),
+             "%s/apis/authentication.k8s.io/v1/tokenreviews",
+             config->api_server_url);
+
+    prepare_request(curl, config, api_url, headers, request_json, &response);
+
+    /* Perform the request */
+    K8S_LOG(K8S_LOG_DEBUG, "tokenreview_request", "url=\"%s\"", api_url);
+    k8s_stats_inc(K8S_STAT_TOKENREVIEW_CALLS);
+    uint64_t started = k8s_stats_now_usec();
+    info->timing.queue_us = started - entered;
+    k8s_stats_record(K8S_HIST_QUEUE, info->timing.queue_us);
+
+    k8s_psi_stage(K8S_STAGE_TOKENREVIEW);
+    res = curl_easy_perform(curl);
+
+    k8s_stats_record(K8S_HIST_API, k8s_stats_now_usec() - started);
+    result = finish_request(curl, res, &response, config->audience, info, &transport_ok);
+
 cleanup:
     if (curl) {
-        curl_easy_cleanup(curl);
+        if (config->pool) {
+            k8s_http_pool_release(config->pool, curl, transport_ok);
+        } else {
+            curl_easy_cleanup(curl);
+        }
     }
     if (headers) {
         curl_slist_free_all(headers);
     }
     if (response.data) {
-        free(response.data);
-    }
-    if (service_account_token) {
-        free(service_account_token);
+        k8s_free(response.data);
     }
     if (request_obj) {
         json_object_put(request_obj);
     }
-    if (response_obj) {
-        json_object_put(response_obj);
-    }
 
     return result;
 }
+
+/* One TokenReview in flight as part of a batch */
+typedef struct {
+    CURL *curl;
+    int index;                      /* Token being reviewed, -1 when free */
+    json_object *request;
+    response_buffer_t response;
+    uint64_t started;
+} batch_slot_t;
+
+static void release_batch_handle(const k8s_config_t *config, CURL *curl, int reusable) {
+    /* Pooled handles are shared with logins, which never wait for a
+     * multiplexed connection */
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 0L);
+    if (config->pool) {
+        k8s_http_pool_release(config->pool, curl, reusable);
+    } else {
+        curl_easy_cleanup(curl);
+    }
+}
+
+int k8s_validate_tokens(const char *const *tokens, int count, k8s_token_info_t *infos,
+                        const k8s_config_t *config, int concurrency) {
+    CURLM *multi = NULL;
+    batch_slot_t *slots = NULL;
+    struct curl_slist *headers = NULL;
+    char auth_header[4096];
+    char api_url[1024];
+    int reviewed = 0;
+    int next = 0;
+    int active = 0;
+
+    if (!tokens || !infos || count <= 0 || !config) {
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        memset(&infos[i], 0, sizeof(k8s_token_info_t));
+    }
+    if (concurrency < 1) {
+        concurrency = 1;
+    }
+    if (concurrency > count) {
+        concurrency = count;
+    }
+
+    if (!build_auth_header(config, auth_header, sizeof(auth_header))) {
+        return 0;
+    }
+    headers = curl_slist_append(headers, "Content-Type: application/json");
+    headers = curl_slist_append(headers, auth_header);
+    snprintf(api_url, sizeof(api_url), "%s/apis/authentication.k8s.io/v1/tokenreviews",
+             config->api_server_url);
+
+    multi = curl_multi_init();
+    slots = k8s_calloc(K8S_MEM_RESPONSE, concurrency, sizeof(batch_slot_t));
+    if (!headers || !multi || !slots) {
+        K8S_LOG(K8S_LOG_ERROR, "out_of_memory", "where=tokenreview_batch");
+        goto cleanup;
+    }
+
+    /* Over HTTP/2 the requests share one connection instead of one each */
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+    for (int i = 0; i < concurrency; i++) {
+        slots[i].index = -1;
+    }
+
+    while (next < count || active > 0) {
+        /* Fill every free slot */
+        for (int i = 0; i < concurrency && next < count; i++) {
+            batch_slot_t *slot = &slots[i];
+            if (slot->index >= 0) {
+                continue;
+            }
+            if (!tokens[next]) {
+                next++;
+                continue;
+            }
+
+            CURL *curl = config->pool ? k8s_http_pool_acquire(config->pool) : curl_easy_init();
+            if (!curl) {
+                K8S_LOG(K8S_LOG_ERROR, "init_failed", "reason=curl_handle");
+                next = count;
+                break;
+            }
+            slot->curl = curl;
+            slot->index = next++;
+            slot->request = build_request(tokens[slot->index], config->audience);
+            memset(&slot->response, 0, sizeof(slot->response));
+
+            prepare_request(curl, config, api_url, headers,
+                            json_object_to_json_string(slot->request), &slot->response);
+            curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+            curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *)slot);
+
+            k8s_stats_inc(K8S_STAT_TOKENREVIEW_CALLS);
+            slot->started = k8s_stats_now_usec();
+            curl_multi_add_handle(multi, curl);
+            active++;
+        }
+        if (active == 0) {
+            break;
+        }
+
+        int running = 0;
+        if (curl_multi_perform(multi, &running) != CURLM_OK) {
+            break;
+        }
+
+        CURLMsg *msg;
+        int queued = 0;
+        while ((msg = curl_multi_info_read(multi, &queued)) != NULL) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            batch_slot_t *slot = NULL;
+            int transport_ok = 0;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&slot);
+            k8s_token_info_t *info = &infos[slot->index];
+
+            k8s_stats_record(K8S_HIST_API, k8s_stats_now_usec() - slot->started);
+            finish_request(slot->curl, msg->data.result, &slot->response, config->audience,
+                           info, &transport_ok);
+            reviewed += info->reviewed;
+
+            curl_multi_remove_handle(multi, slot->curl);
+            release_batch_handle(config, slot->curl, transport_ok);
+            k8s_free(slot->response.data);
+            json_object_put(slot->request);
+            slot->curl = NULL;
+            slot->index = -1;
+            active--;
+        }
+
+        if (running) {
+            curl_multi_wait(multi, NULL, 0, 200, NULL);
+        }
+    }
+
+cleanup:
+    if (slots) {
+        /* Only left over when the multi handle failed */
+        for (int i = 0; i < concurrency; i++) {
+            if (slots[i].index >= 0) {
+                curl_multi_remove_handle(multi, slots[i].curl);
+                release_batch_handle(config, slots[i].curl, 0);
+                k8s_free(slots[i].response.data);
+                json_object_put(slots[i].request);
+            }
+        }
+        k8s_free(slots);
+    }
+    if (multi) {
+        curl_multi_cleanup(multi);
+    }
+    curl_slist_free_all(headers);
+
+    return reviewed;
+}
+
+/**
+ * Send a GET, or a POST of body, to the API server; the response body on
+ * success
+ */
+static char *api_request(const char *path, const char *body, const k8s_config_t *config) {
+    CURL *curl = NULL;
+    int transport_ok = 0;
+    response_buffer_t response = {NULL, 0};
+    struct curl_slist *headers = NULL;
+    const char *failed = body ? "api_post_failed" : "api_get_failed";
+    char auth_header[4096];
+    char url[1024];
+
+    if (!path || !config || !build_auth_header(config, auth_header, sizeof(auth_header))) {
+        return NULL;
+    }
+
+    curl = config->pool ? k8s_http_pool_acquire(config->pool) : curl_easy_init();
+    if (!curl) {
+        K8S_LOG(K8S_LOG_ERROR, "init_failed", "reason=curl_handle");
+        return NULL;
+    }
+
+    headers = curl_slist_append(headers, "Accept: application/json");
+    if (body) {
+        headers = curl_slist_append(headers, "Content-Type: application/json");
+    }
+    headers = curl_slist_append(headers, auth_header);
+    snprintf(url, sizeof(url), "%s%s", config->api_server_url, path);
+
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    if (body) {
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+    } else {
+        curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+    }
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+    k8s_http_apply_common(curl, config);
+
+    CURLcode res = curl_easy_perform(curl);
+    if (res != CURLE_OK) {
+        K8S_LOG(K8S_LOG_WARNING, failed, "path=\"%s\" error=\"%s\"",
+                path, curl_easy_strerror(res));
+    } else {
+        long http_code = 0;
+        transport_ok = 1;
+        record_transfer_stats(curl);
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        /* Created objects, such as reviews, come back with 201 */
+        if ((http_code != 200 && !(body && http_code == 201)) || !response.data) {
+            K8S_LOG(K8S_LOG_WARNING, failed, "path=\"%s\" http_status=%ld",
+                    path, http_code);
+            k8s_free(response.data);
+            response.data = NULL;
+        }
+    }
+
+    if (config->pool) {
+        k8s_http_pool_release(config->pool, curl, transport_ok);
+    } else {
+        curl_easy_cleanup(curl);
+    }
+    curl_slist_free_all(headers);
+    return response.data;
+}
+
+char *k8s_api_get(const char *path, const k8s_config_t *config) {
+    return api_request(path, NULL, config);
+}
+
+char *k8s_api_post(const char *path, const char *body, const k8s_config_t *config) {
+    return body ? api_request(path, body, config) : NULL;
+}
@@ -8,6 +8,7 @@
 #ifndef K8S_TOKEN_VALIDATOR_H
 #define K8S_TOKEN_VALIDATOR_H
 
+#include <stddef.h>
 #include <time.h>
 
 /* Maximum lengths for token info fields */
@@ -15,19 +16,41 @@
 #define K8S_MAX_NAME_LEN 253
 #define K8S_MAX_USERNAME_LEN 512
 #define K8S_MAX_UID_LEN 128
+#define K8S_MAX_GROUPS_LEN 1024
+
+/* Where the time of one TokenReview request went, in microseconds */
+typedef struct {
+    unsigned long long queue_us;     /* Handle checkout, credential and request build */
+    unsigned long long dns_us;       /* Name resolution (0 when pinned or reused) */
+    unsigned long long connect_us;   /* TCP connect (0 on a reused connection) */
+    unsigned long long tls_us;       /* TLS handshake (0 on a reused connection) */
+    unsigned long long server_us;    /* Request sent until first response byte */
+    unsigned long long transfer_us;  /* First to last response byte */
+    unsigned long long total_us;     /* Whole transfer as measured by libcurl */
+    unsigned long long parse_us;     /* Response JSON parsing and extraction */
+} k8s_request_timing_t;
 
 /**
  * Structure to hold validated token information
  */
 typedef struct {
     int authenticated;                          /* 1 if token is valid, 0 otherwise */
+    int reviewed;                               /* 1 if a verdict was returned (by the API
+                                                   server, or by the backend of backend.h) */
     char namespace[K8S_MAX_NAMESPACE_LEN + 1]; /* ServiceAccount namespace */
     char service_account[K8S_MAX_NAME_LEN + 1]; /* ServiceAccount name */
     char username[K8S_MAX_USERNAME_LEN + 1];    /* Full username from K8s */
     char uid[K8S_MAX_UID_LEN + 1];             /* User UID */
+    char groups[K8S_MAX_GROUPS_LEN + 1];        /* Groups, one per line (those that fit) */
+    char pod_name[K8S_MAX_NAME_LEN + 1];        /* Pod the token is bound to, if any */
+    char pod_uid[K8S_MAX_UID_LEN + 1];          /* UID of that pod */
     time_t validated_at;                        /* Timestamp of validation */
+    k8s_request_timing_t timing;                /* Latency breakdown of the API call */
 } k8s_token_info_t;
 
+struct k8s_http_pool;
+struct k8s_backend_chain;
+
 /**
  * Configuration for Kubernetes API access
  */
@@ -36,6 +59,9 @@ typedef struct {
     const char *ca_cert_path;    /* Path to CA certificate (default: /var/run/secrets/.../ca.crt) */
     const char *token_path;      /* Path to service account token for auth (default: /var/run/.../token) */
     int timeout_seconds;         /* HTTP timeout (default: 10) */
+    const char *audience;        /* Audience tokens must be issued for, or NULL for the API server's (default: NULL) */
+    struct k8s_http_pool *pool;  /* Warm connection pool, or NULL for a one-shot handle (default: NULL) */
+    const struct k8s_backend_chain *backends; /* Validation backends, or NULL for TokenReview alone (default: NULL) */
 } k8s_config_t;
 
 /**
@@ -58,6 +84,46 @@ void k8s_config_init_default(k8s_config_t *config);
  */
 int k8s_validate_token(const char *token, k8s_token_info_t *info, const k8s_config_t *config);
 
+/**
+ * Validate several tokens with concurrent TokenReview requests
+ *
+ * Keeps up to concurrency requests in flight on handles from config->pool
+ * (or one-shot handles). Against an HTTP/2 API server they are multiplexed
+ * on a shared connection rather than each opening its own. Used for
+ * background work; logins call k8s_validate_token().
+ *
+ * @param tokens Tokens to validate (NULL entries are skipped)
+ * @param count Number of tokens
+ * @param infos Output, one entry per token, as for k8s_validate_token()
+ * @param config Configuration for K8s API access
+ * @param concurrency Most requests in flight at once
+ * @return Number of tokens the API server returned a verdict for
+ */
+int k8s_validate_tokens(const char *const *tokens, int count, k8s_token_info_t *infos,
+                        const k8s_config_t *config, int concurrency);
+
+/**
+ * GET a resource from the API server with the plugin's credential
+ *
+ * @param path Path below the API server URL, e.g. "/openid/v1/jwks"
+ * @param config Configuration for K8s API access
+ * @return Response body on HTTP 200, to be freed with k8s_free(); NULL on
+ *         any error
+ */
+char *k8s_api_get(const char *path, const k8s_config_t *config);
+
+/**
+ * POST a JSON object to the API server with the plugin's credential
+ *
+ * @param path Path below the API server URL, e.g.
+ *             "/apis/authorization.k8s.io/v1/subjectaccessreviews"
+ * @param body Request body
+ * @param config Configuration for K8s API access
+ * @return Response body on HTTP 200 or 201, to be freed with k8s_free();
+ *         NULL on any error
+ */
+char *k8s_api_post(const char *path, const char *body, const k8s_config_t *config);
+
 /**
  * Parse namespace and service account from Kubernetes username
  *
@@ -74,4 +140,12 @@ int k8s_validate_token(const char *token, k8s_token_info_t *info, const k8s_conf
 int k8s_parse_username(const char *username, char *namespace, size_t namespace_len,
                        char *service_account, size_t sa_len);
 
+/**
+ * Read a small file (at most 1MB) into a newly allocated string
+ *
+ * @param path File to read
+ * @return NUL-terminated contents to be freed by the caller, or NULL on error
+ */
+char *k8s_read_file(const char *path);
+
 #endif /* K8S_TOKEN_VALIDATOR_H */
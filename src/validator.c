@@ -0,0 +1,762 @@
+/*
+ * Node Validator Implementation
+ *
+ * Clients are reference-counted: the reader holds one reference and every
+ * request waiting for a review another, so a client that hangs up while
+ * its requests are reviewed keeps its descriptor until the last answer has
+ * been attempted and no answer goes to a reused descriptor.
+ *
+ * Answers are never sent blocking: what the socket does not take waits in
+ * the client's own buffer and is sent by the reader when the socket can
+ * take more, so a client that stops reading holds up neither the reader
+ * nor a worker, only itself.
+ */
+
+#include "validator.h"
+#include "federated_protocol.h"
+#include "jwks.h"
+#include "jwt.h"
+#include "log.h"
+#include <errno.h>
+#include <openssl/evp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/* SHA-256 of the audience and the token */
+#define KEY_LEN 32
+
+/* Buckets of the table of reviews in flight */
+#define INFLIGHT_BUCKETS 256
+
+/* Locks of the cache, each guarding every CACHE_STRIPES-th set */
+#define CACHE_STRIPES 16
+
+/* Milliseconds the reader waits for input before checking for a stop */
+#define POLL_MS 100
+
+/* Largest RESULT: header, status and the strings of a k8s_token_info_t */
+#define RESULT_MAX (K8S_FEDERATED_HEADER_LEN + 1 + 7 * 2 + sizeof(k8s_token_info_t))
+
+/* Bytes of answers a client may leave unsent before it is dropped */
+#define OUT_MAX 65536
+
+typedef struct {
+    int fd;
+    int refs;                       /* The reader's and one per waiting request */
+    pthread_mutex_t send_lock;      /* Guards out, pending and progress_at */
+    size_t have;                    /* Bytes of in read but not handled */
+    size_t pending;                 /* Bytes of out not sent yet */
+    time_t progress_at;             /* When out was last empty or sent from */
+    unsigned char in[K8S_FEDERATED_FRAME_MAX];
+    unsigned char out[OUT_MAX];
+} client_t;
+
+typedef struct waiter {
+    client_t *client;
+    uint32_t id;
+    struct waiter *next;
+} waiter_t;
+
+typedef struct review {
+    unsigned char key[KEY_LEN];
+    char *token;
+    char *audience;                 /* NULL for the API server's */
+    waiter_t *waiters;              /* Requests answered by this review */
+    struct review *next;            /* In its in-flight bucket */
+    struct review *queued;          /* Next in the work queue */
+} review_t;
+
+typedef struct {
+    unsigned char key[KEY_LEN];
+    time_t expires_at;              /* 0: unused */
+    uint64_t used;                  /* Tick of the last hit, for LRU */
+    k8s_token_info_t info;
+} cache_entry_t;
+
+static k8s_validator_options_t options;
+static int listen_fd = -1;
+static pthread_t reader;
+static int reader_stopping = 0;
+
+/* Owned by the reader thread */
+static client_t *clients[K8S_VALIDATOR_MAX_CLIENTS];
+
+/* Reviews in flight and the work queue, under state_lock */
+static pthread_mutex_t state_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static review_t *inflight[INFLIGHT_BUCKETS];
+static review_t *queue_head = NULL;
+static review_t *queue_tail = NULL;
+static int workers_stopping = 0;
+static pthread_t workers[K8S_VALIDATOR_MAX_WORKERS];
+static int worker_count = 0;
+
+static cache_entry_t *cache = NULL;
+static size_t cache_sets = 0;
+static pthread_mutex_t cache_locks[CACHE_STRIPES];
+static uint64_t cache_tick = 0;
+
+static k8s_validator_stats_t counters;
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static unsigned char *put_string(unsigned char *p, const char *s) {
+    size_t len = strlen(s);
+    p[0] = (unsigned char)(len >> 8);
+    p[1] = (unsigned char)len;
+    memcpy(p + 2, s, len);
+    return p + 2 + len;
+}
+
+/* Next string of a request, not copied; 0 if it is cut off */
+static int take_string(const unsigned char **p, const unsigned char *end,
+                       const unsigned char **s, size_t *len) {
+    if (end - *p < 2) {
+        return 0;
+    }
+    *len = (size_t)(*p)[0] << 8 | (*p)[1];
+    if ((size_t)(end - *p - 2) < *len) {
+        return 0;
+    }
+    *s = *p + 2;
+    *p += 2 + *len;
+    return 1;
+}
+
+static char *copy_string(const unsigned char *s, size_t len) {
+    char *copy = malloc(len + 1);
+    if (copy) {
+        memcpy(copy, s, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+/*
+ * Tokens are cached per audience: a token valid for one may not be for another
+ *
+ * The key is all the cache and the reviews in flight compare, so there is
+ * no fallback: 0 if the digest cannot be computed.
+ */
+static int request_key(const char *audience, const char *token, unsigned char *key) {
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    unsigned int len = KEY_LEN;
+    int ok = ctx && EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) &&
+             EVP_DigestUpdate(ctx, audience ? audience : "",
+                              audience ? strlen(audience) + 1 : 1) &&
+             EVP_DigestUpdate(ctx, token, strlen(token)) &&
+             EVP_DigestFinal_ex(ctx, key, &len) && len == KEY_LEN;
+
+    EVP_MD_CTX_free(ctx);
+    return ok;
+}
+
+static size_t key_bucket(const unsigned char *key, size_t n) {
+    uint64_t h;
+    memcpy(&h, key, sizeof(h));
+    return (size_t)(h % n);
+}
+
+/*
+ * Result cache
+ */
+
+static int cache_get(const unsigned char *key, k8s_token_info_t *info) {
+    if (!cache) {
+        return 0;
+    }
+    size_t set = key_bucket(key, cache_sets);
+    cache_entry_t *ways = cache + set * K8S_VALIDATOR_CACHE_WAYS;
+    time_t now = time(NULL);
+    int found = 0;
+
+    pthread_mutex_lock(&cache_locks[set % CACHE_STRIPES]);
+    for (int i = 0; i < K8S_VALIDATOR_CACHE_WAYS; i++) {
+        if (ways[i].expires_at > now && memcmp(ways[i].key, key, KEY_LEN) == 0) {
+            *info = ways[i].info;
+            ways[i].used = __atomic_add_fetch(&cache_tick, 1, __ATOMIC_RELAXED);
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache_locks[set % CACHE_STRIPES]);
+    return found;
+}
+
+static void cache_put(const unsigned char *key, const char *token, const k8s_token_info_t *info) {
+    if (!cache) {
+        return;
+    }
+    time_t now = time(NULL);
+    time_t expires_at = now + options.cache_ttl;
+    time_t exp = k8s_jwt_expiry(token);
+    if (exp > 0 && exp < expires_at) {
+        expires_at = exp;
+    }
+    if (expires_at <= now) {
+        return;
+    }
+
+    size_t set = key_bucket(key, cache_sets);
+    cache_entry_t *ways = cache + set * K8S_VALIDATOR_CACHE_WAYS;
+    cache_entry_t *victim = NULL;
+
+    pthread_mutex_lock(&cache_locks[set % CACHE_STRIPES]);
+    for (int i = 0; i < K8S_VALIDATOR_CACHE_WAYS; i++) {
+        if (memcmp(ways[i].key, key, KEY_LEN) == 0) {
+            victim = &ways[i];
+            break;
+        }
+        /* Free or expired ways count as least recently used */
+        uint64_t used = ways[i].expires_at <= now ? 0 : ways[i].used;
+        if (!victim || used < (victim->expires_at <= now ? 0 : victim->used)) {
+            victim = &ways[i];
+        }
+    }
+    memcpy(victim->key, key, KEY_LEN);
+    victim->expires_at = expires_at;
+    victim->used = __atomic_add_fetch(&cache_tick, 1, __ATOMIC_RELAXED);
+    victim->info = *info;
+    pthread_mutex_unlock(&cache_locks[set % CACHE_STRIPES]);
+}
+
+/*
+ * Clients
+ */
+
+static void client_unref(client_t *c) {
+    if (__atomic_sub_fetch(&c->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        close(c->fd);
+        pthread_mutex_destroy(&c->send_lock);
+        free(c);
+    }
+}
+
+/* Stop reading from a client; its descriptor lives on for the answers still due */
+static void client_drop(int i) {
+    client_t *c = clients[i];
+
+    shutdown(c->fd, SHUT_RDWR);
+    clients[i] = NULL;
+    __atomic_sub_fetch(&counters.clients, 1, __ATOMIC_RELAXED);
+    client_unref(c);
+}
+
+static void client_accept(void) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    int slot = -1;
+    for (int i = 0; i < K8S_VALIDATOR_MAX_CLIENTS && slot < 0; i++) {
+        slot = clients[i] ? -1 : i;
+    }
+    client_t *c = slot >= 0 ? malloc(sizeof(*c)) : NULL;
+    if (!c) {
+        K8S_LOG(K8S_LOG_WARNING, "validator_client_refused", "clients=%d",
+                __atomic_load_n(&counters.clients, __ATOMIC_RELAXED));
+        close(fd);
+        return;
+    }
+
+    c->fd = fd;
+    c->refs = 1;
+    c->have = 0;
+    c->pending = 0;
+    c->progress_at = 0;
+    pthread_mutex_init(&c->send_lock, NULL);
+    clients[slot] = c;
+    __atomic_add_fetch(&counters.clients, 1, __ATOMIC_RELAXED);
+}
+
+/* Give up on a client, under its send_lock; the reader sees the hang-up and drops it */
+static void client_abandon(client_t *c, const char *error) {
+    K8S_LOG(K8S_LOG_WARNING, "validator_client_dropped", "error=\"%s\"", error);
+    shutdown(c->fd, SHUT_RDWR);
+    c->pending = 0;
+}
+
+/* Send as much of out as the socket takes without waiting, under its send_lock */
+static void client_flush(client_t *c) {
+    size_t sent = 0;
+
+    while (sent < c->pending) {
+        ssize_t n = send(c->fd, c->out + sent, c->pending - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n <= 0) {
+            client_abandon(c, n < 0 ? strerror(errno) : "closed");
+            return;
+        }
+        sent += (size_t)n;
+    }
+    if (sent > 0) {
+        c->pending -= sent;
+        memmove(c->out, c->out + sent, c->pending);
+        c->progress_at = time(NULL);
+    }
+}
+
+static void reply(client_t *c, uint32_t id, int status, const k8s_token_info_t *info) {
+    unsigned char frame[RESULT_MAX];
+    unsigned char *p = frame + K8S_FEDERATED_HEADER_LEN;
+
+    *p++ = (unsigned char)status;
+    if (status == K8S_FEDERATED_VALID) {
+        p = put_string(p, info->namespace);
+        p = put_string(p, info->service_account);
+        p = put_string(p, info->username);
+        p = put_string(p, info->uid);
+        p = put_string(p, info->groups);
+        p = put_string(p, info->pod_name);
+        p = put_string(p, info->pod_uid);
+    }
+    size_t len = (size_t)(p - frame);
+    put_u32(frame, (uint32_t)(len - 4));
+    frame[4] = K8S_FEDERATED_MSG_RESULT;
+    put_u32(frame + 5, id);
+
+    __atomic_add_fetch(&counters.requests, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&c->send_lock);
+    if (c->pending + len > sizeof(c->out)) {
+        client_abandon(c, "answers not read");
+    } else {
+        if (c->pending == 0) {
+            c->progress_at = time(NULL);
+        }
+        memcpy(c->out + c->pending, frame, len);
+        c->pending += len;
+        client_flush(c);
+    }
+    pthread_mutex_unlock(&c->send_lock);
+}
+
+/*
+ * Reviews
+ */
+
+/* Queue a review of the token, or join the one already in flight */
+static void submit(client_t *c, uint32_t id, const unsigned char *key, char *token,
+                   char *audience) {
+    waiter_t *w = malloc(sizeof(*w));
+    if (!w) {
+        K8S_LOG(K8S_LOG_ERROR, "out_of_memory", "where=validator_waiter");
+        reply(c, id, K8S_FEDERATED_UNAVAILABLE, NULL);
+        free(token);
+        free(audience);
+        return;
+    }
+    __atomic_add_fetch(&c->refs, 1, __ATOMIC_RELAXED);
+    w->client = c;
+    w->id = id;
+
+    size_t bucket = key_bucket(key, INFLIGHT_BUCKETS);
+    pthread_mutex_lock(&state_lock);
+    review_t *r = inflight[bucket];
+    while (r && memcmp(r->key, key, KEY_LEN) != 0) {
+        r = r->next;
+    }
+    if (r) {
+        w->next = r->waiters;
+        r->waiters = w;
+        pthread_mutex_unlock(&state_lock);
+        __atomic_add_fetch(&counters.coalesced, 1, __ATOMIC_RELAXED);
+        free(token);
+        free(audience);
+        return;
+    }
+
+    r = calloc(1, sizeof(*r));
+    if (!r) {
+        pthread_mutex_unlock(&state_lock);
+        K8S_LOG(K8S_LOG_ERROR, "out_of_memory", "where=validator_review");
+        reply(c, id, K8S_FEDERATED_UNAVAILABLE, NULL);
+        client_unref(c);
+        free(w);
+        free(token);
+        free(audience);
+        return;
+    }
+    memcpy(r->key, key, KEY_LEN);
+    r->token = token;
+    r->audience = audience;
+    w->next = NULL;
+    r->waiters = w;
+    r->next = inflight[bucket];
+    inflight[bucket] = r;
+    if (queue_tail) {
+        queue_tail->queued = r;
+    } else {
+        queue_head = r;
+    }
+    queue_tail = r;
+    pthread_cond_signal(&work_cond);
+    pthread_mutex_unlock(&state_lock);
+}
+
+static void review(review_t *r) {
+    k8s_config_t config = options.config;
+    k8s_token_info_t info;
+
+    config.audience = r->audience;
+    int valid = k8s_validate_token(r->token, &info, &config);
+    __atomic_add_fetch(&counters.reviews, 1, __ATOMIC_RELAXED);
+    if (!info.reviewed) {
+        __atomic_add_fetch(&counters.unavailable, 1, __ATOMIC_RELAXED);
+    }
+    if (valid) {
+        cache_put(r->key, r->token, &info);
+    }
+
+    /* Requests arriving from here on find the cache, or start a review */
+    pthread_mutex_lock(&state_lock);
+    review_t **link = &inflight[key_bucket(r->key, INFLIGHT_BUCKETS)];
+    while (*link != r) {
+        link = &(*link)->next;
+    }
+    *link = r->next;
+    waiter_t *w = r->waiters;
+    pthread_mutex_unlock(&state_lock);
+
+    int status = valid ? K8S_FEDERATED_VALID
+                       : info.reviewed ? K8S_FEDERATED_REJECTED : K8S_FEDERATED_UNAVAILABLE;
+    while (w) {
+        waiter_t *next = w->next;
+        reply(w->client, w->id, status, &info);
+        client_unref(w->client);
+        free(w);
+        w = next;
+    }
+    free(r->token);
+    free(r->audience);
+    free(r);
+}
+
+static void *work(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&state_lock);
+    for (;;) {
+        while (!queue_head && !workers_stopping) {
+            pthread_cond_wait(&work_cond, &state_lock);
+        }
+        review_t *r = queue_head;
+        if (!r) {
+            break;
+        }
+        queue_head = r->queued;
+        if (!queue_head) {
+            queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&state_lock);
+        review(r);
+        pthread_mutex_lock(&state_lock);
+    }
+    pthread_mutex_unlock(&state_lock);
+    return NULL;
+}
+
+/*
+ * Reader
+ */
+
+/* Answer or queue one request; 0 if the client broke the protocol */
+static int handle(client_t *c, const unsigned char *frame, size_t len) {
+    const unsigned char *p = frame + K8S_FEDERATED_HEADER_LEN - 4;
+    const unsigned char *end = frame + len;
+    const unsigned char *cluster, *audience, *token;
+    size_t cluster_len, audience_len, token_len;
+
+    if (frame[0] != K8S_FEDERATED_MSG_VALIDATE ||
+        !take_string(&p, end, &cluster, &cluster_len) ||
+        !take_string(&p, end, &audience, &audience_len) ||
+        !take_string(&p, end, &token, &token_len) || p != end) {
+        K8S_LOG(K8S_LOG_WARNING, "validator_protocol_error", "type=%u frame_len=%zu",
+                (unsigned)frame[0], len);
+        return 0;
+    }
+    uint32_t id = get_u32(frame + 1);
+
+    /* Only the cluster of its own credential is served */
+    if (cluster_len > 0) {
+        reply(c, id, K8S_FEDERATED_UNAVAILABLE, NULL);
+        return 1;
+    }
+
+    char *token_copy = copy_string(token, token_len);
+    char *audience_copy = audience_len > 0 ? copy_string(audience, audience_len) : NULL;
+    if (!token_copy || (audience_len > 0 && !audience_copy)) {
+        K8S_LOG(K8S_LOG_ERROR, "out_of_memory", "where=validator_request");
+        reply(c, id, K8S_FEDERATED_UNAVAILABLE, NULL);
+        free(token_copy);
+        free(audience_copy);
+        return 1;
+    }
+
+    unsigned char key[KEY_LEN];
+    k8s_token_info_t info;
+    if (!request_key(audience_copy, token_copy, key)) {
+        K8S_LOG(K8S_LOG_ERROR, "validator_digest_failed", "token_len=%zu", token_len);
+        reply(c, id, K8S_FEDERATED_UNAVAILABLE, NULL);
+        free(token_copy);
+        free(audience_copy);
+        return 1;
+    }
+    if (cache_get(key, &info)) {
+        __atomic_add_fetch(&counters.cache_hits, 1, __ATOMIC_RELAXED);
+        reply(c, id, K8S_FEDERATED_VALID, &info);
+        free(token_copy);
+        free(audience_copy);
+        return 1;
+    }
+    if (options.screen && k8s_jwks_forged(token_copy)) {
+        __atomic_add_fetch(&counters.forged, 1, __ATOMIC_RELAXED);
+        K8S_LOG(K8S_LOG_DEBUG, "validator_forged", "token_len=%zu", token_len);
+        reply(c, id, K8S_FEDERATED_REJECTED, NULL);
+        free(token_copy);
+        free(audience_copy);
+        return 1;
+    }
+    submit(c, id, key, token_copy, audience_copy);
+    return 1;
+}
+
+/* Handle every complete request read; 0 if the client is to be dropped */
+static int client_read(client_t *c) {
+    ssize_t got = recv(c->fd, c->in + c->have, sizeof(c->in) - c->have, MSG_DONTWAIT);
+    if (got < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return 1;
+    }
+    if (got <= 0) {
+        return 0;
+    }
+    c->have += (size_t)got;
+
+    while (c->have >= 4) {
+        size_t len = get_u32(c->in);
+        if (len < K8S_FEDERATED_HEADER_LEN - 4 || len > K8S_FEDERATED_FRAME_MAX - 4) {
+            K8S_LOG(K8S_LOG_WARNING, "validator_protocol_error", "frame_len=%zu", len);
+            return 0;
+        }
+        if (c->have < len + 4) {
+            break;
+        }
+        if (!handle(c, c->in + 4, len)) {
+            return 0;
+        }
+        c->have -= len + 4;
+        memmove(c->in, c->in + len + 4, c->have);
+    }
+    return 1;
+}
+
+/* POLLOUT if answers wait to be sent; -1 if they have waited too long */
+static int client_out_events(client_t *c, time_t now) {
+    int events = 0;
+
+    pthread_mutex_lock(&c->send_lock);
+    if (c->pending > 0) {
+        events = now - c->progress_at >= K8S_VALIDATOR_SEND_TIMEOUT ? -1 : POLLOUT;
+    }
+    pthread_mutex_unlock(&c->send_lock);
+    return events;
+}
+
+static void *serve(void *arg) {
+    (void)arg;
+
+    while (!__atomic_load_n(&reader_stopping, __ATOMIC_ACQUIRE)) {
+        struct pollfd pfds[K8S_VALIDATOR_MAX_CLIENTS + 1];
+        int index[K8S_VALIDATOR_MAX_CLIENTS + 1];
+        time_t now = time(NULL);
+        int n = 0;
+
+        pfds[n].fd = listen_fd;
+        pfds[n++].events = POLLIN;
+        for (int i = 0; i < K8S_VALIDATOR_MAX_CLIENTS; i++) {
+            if (!clients[i]) {
+                continue;
+            }
+            int out = client_out_events(clients[i], now);
+            if (out < 0) {
+                K8S_LOG(K8S_LOG_WARNING, "validator_client_dropped",
+                        "error=\"answers not read\"");
+                client_drop(i);
+                continue;
+            }
+            index[n] = i;
+            pfds[n].fd = clients[i]->fd;
+            pfds[n++].events = (short)(POLLIN | out);
+        }
+        if (poll(pfds, (nfds_t)n, POLL_MS) <= 0) {
+            continue;
+        }
+
+        for (int k = 1; k < n; k++) {
+            client_t *c = clients[index[k]];
+            if (pfds[k].revents & POLLOUT) {
+                pthread_mutex_lock(&c->send_lock);
+                client_flush(c);
+                pthread_mutex_unlock(&c->send_lock);
+            }
+            if ((pfds[k].revents & (POLLIN | POLLHUP | POLLERR)) && !client_read(c)) {
+                client_drop(index[k]);
+            }
+        }
+        if (pfds[0].revents & POLLIN) {
+            client_accept();
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Lifecycle
+ */
+
+static void stop_workers(void) {
+    pthread_mutex_lock(&state_lock);
+    workers_stopping = 1;
+    pthread_cond_broadcast(&work_cond);
+    pthread_mutex_unlock(&state_lock);
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    worker_count = 0;
+}
+
+static void release(void) {
+    if (listen_fd >= 0) {
+        close(listen_fd);
+    }
+    listen_fd = -1;
+    unlink(options.socket_path);
+    for (int i = 0; i < CACHE_STRIPES && cache; i++) {
+        pthread_mutex_destroy(&cache_locks[i]);
+    }
+    free(cache);
+    cache = NULL;
+    cache_sets = 0;
+}
+
+int k8s_validator_start(const k8s_validator_options_t *opts) {
+    struct sockaddr_un addr;
+
+    if (listen_fd >= 0) {
+        return 0;
+    }
+    if (!opts->socket_path || strlen(opts->socket_path) >= sizeof(addr.sun_path)) {
+        K8S_LOG(K8S_LOG_ERROR, "validator_invalid", "reason=socket_path");
+        return 0;
+    }
+    options = *opts;
+    if (options.workers < 1) {
+        options.workers = 1;
+    } else if (options.workers > K8S_VALIDATOR_MAX_WORKERS) {
+        options.workers = K8S_VALIDATOR_MAX_WORKERS;
+    }
+    memset(&counters, 0, sizeof(counters));
+
+    if (options.cache_ttl > 0 && options.cache_size > 0) {
+        cache_sets = ((size_t)options.cache_size + K8S_VALIDATOR_CACHE_WAYS - 1) /
+                     K8S_VALIDATOR_CACHE_WAYS;
+        cache = calloc(cache_sets * K8S_VALIDATOR_CACHE_WAYS, sizeof(*cache));
+        if (!cache) {
+            K8S_LOG(K8S_LOG_ERROR, "out_of_memory", "where=validator_cache entries=%zu",
+                    cache_sets * K8S_VALIDATOR_CACHE_WAYS);
+            return 0;
+        }
+        for (int i = 0; i < CACHE_STRIPES; i++) {
+            pthread_mutex_init(&cache_locks[i], NULL);
+        }
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, options.socket_path, strlen(options.socket_path));
+    unlink(options.socket_path);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        chmod(options.socket_path, (mode_t)options.socket_mode) != 0 ||
+        listen(listen_fd, SOMAXCONN) != 0) {
+        K8S_LOG(K8S_LOG_ERROR, "validator_unavailable", "path=\"%s\" error=\"%s\"",
+                options.socket_path, strerror(errno));
+        release();
+        return 0;
+    }
+
+    workers_stopping = 0;
+    for (worker_count = 0; worker_count < options.workers; worker_count++) {
+        if (pthread_create(&workers[worker_count], NULL, work, NULL) != 0) {
+            break;
+        }
+    }
+    __atomic_store_n(&reader_stopping, 0, __ATOMIC_RELEASE);
+    if (worker_count == 0 || pthread_create(&reader, NULL, serve, NULL) != 0) {
+        K8S_LOG(K8S_LOG_ERROR, "validator_unavailable", "path=\"%s\" error=\"no threads\"",
+                options.socket_path);
+        stop_workers();
+        release();
+        return 0;
+    }
+
+    K8S_LOG(K8S_LOG_INFO, "validator_started", "path=\"%s\" workers=%d cache_entries=%zu "
+            "cache_ttl=%d screen=%d", options.socket_path, worker_count,
+            cache_sets * K8S_VALIDATOR_CACHE_WAYS, options.cache_ttl, options.screen);
+    return 1;
+}
+
+void k8s_validator_stop(void) {
+    if (listen_fd < 0) {
+        return;
+    }
+
+    /* No new requests, then every queued one is answered */
+    __atomic_store_n(&reader_stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(reader, NULL);
+    stop_workers();
+    for (int i = 0; i < K8S_VALIDATOR_MAX_CLIENTS; i++) {
+        if (clients[i]) {
+            pthread_mutex_lock(&clients[i]->send_lock);
+            client_flush(clients[i]);
+            pthread_mutex_unlock(&clients[i]->send_lock);
+            client_drop(i);
+        }
+    }
+    release();
+    K8S_LOG(K8S_LOG_INFO, "validator_stopped", "requests=%llu reviews=%llu",
+            counters.requests, counters.reviews);
+}
+
+void k8s_validator_stats(k8s_validator_stats_t *out) {
+    out->requests = __atomic_load_n(&counters.requests, __ATOMIC_RELAXED);
+    out->cache_hits = __atomic_load_n(&counters.cache_hits, __ATOMIC_RELAXED);
+    out->coalesced = __atomic_load_n(&counters.coalesced, __ATOMIC_RELAXED);
+    out->forged = __atomic_load_n(&counters.forged, __ATOMIC_RELAXED);
+    out->reviews = __atomic_load_n(&counters.reviews, __ATOMIC_RELAXED);
+    out->unavailable = __atomic_load_n(&counters.unavailable, __ATOMIC_RELAXED);
+    out->clients = __atomic_load_n(&counters.clients, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,81 @@
+/*
+ * Node Validator
+ *
+ * The server side of federated_protocol.h, run by the auth_k8s_validator
+ * daemon once per node so that every mariadbd on the node shares one
+ * TokenReview connection pool, one result cache and one signing key set
+ * instead of keeping its own. Plugins reach it through their federated
+ * backend (federated.h).
+ *
+ * One thread reads the requests of every client. A token found in the
+ * cache is answered at once, and so is one the key set shows is forged;
+ * the others go to a pool of workers doing TokenReviews. Requests for a
+ * token that is already being reviewed wait for that review instead of
+ * starting another, so the API server sees each distinct token once
+ * however many processes present it.
+ */
+
+#ifndef K8S_VALIDATOR_H
+#define K8S_VALIDATOR_H
+
+#include "tokenreview_api.h"
+
+/* Most clients connected at once */
+#define K8S_VALIDATOR_MAX_CLIENTS 256
+
+/* Most worker threads */
+#define K8S_VALIDATOR_MAX_WORKERS 64
+
+/* Ways of each cache set; the least recently used entry of a set is evicted */
+#define K8S_VALIDATOR_CACHE_WAYS 8
+
+/* Seconds a client may take to accept an answer before it is dropped */
+#define K8S_VALIDATOR_SEND_TIMEOUT 5
+
+typedef struct {
+    const char *socket_path;        /* Socket to listen on, replaced if it exists */
+    int socket_mode;                /* Permissions of the socket file, e.g. 0660 */
+    k8s_config_t config;            /* API server access, usually with a pool */
+    int workers;                    /* TokenReviews in flight at once */
+    int cache_ttl;                  /* Seconds a valid token is answered from the
+                                       cache (capped by its exp); 0 disables */
+    int cache_size;                 /* Cached tokens, rounded up to whole sets */
+    int screen;                     /* Reject forged tokens with the key set of jwks.h */
+} k8s_validator_options_t;
+
+/* Counters since the validator was started */
+typedef struct {
+    unsigned long long requests;    /* Requests answered */
+    unsigned long long cache_hits;  /* ... from the cache */
+    unsigned long long coalesced;   /* ... by another request's review */
+    unsigned long long forged;      /* ... rejected by the key set */
+    unsigned long long reviews;     /* TokenReviews made */
+    unsigned long long unavailable; /* ... that returned no verdict */
+    int clients;                    /* Clients connected now */
+} k8s_validator_stats_t;
+
+/**
+ * Listen on the socket and start the reader and worker threads
+ *
+ * @param options Settings; the strings and the pool must outlive the
+ *                validator
+ * @return 1 if the validator serves, 0 otherwise
+ */
+int k8s_validator_start(const k8s_validator_options_t *options);
+
+/**
+ * Stop serving: disconnect every client, remove the socket and drop the
+ * cache
+ *
+ * Requests under review are finished first.
+ */
+void k8s_validator_stop(void);
+
+/**
+ * Report the counters
+ *
+ * @param out Filled with the counters
+ */
+void k8s_validator_stats(k8s_validator_stats_t *out);
+
+#endif /* K8S_VALIDATOR_H */
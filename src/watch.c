@@ -0,0 +1,810 @@
+/*
+ * ServiceAccount and Pod Watches Implementation
+ */
+
+#include "watch.h"
+#include "token_cache.h"
+#include "tokenreview_api.h"
+#include "access_review.h"
+#include "http_pool.h"
+#include "resolver.h"
+#include "stats.h"
+#include "log.h"
+#include "instrumentation.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <curl/curl.h>
+#include <json-c/json.h>
+
+/* Largest list page, and largest single watch event */
+#define MAX_LIST_BODY (32 * 1024 * 1024)
+#define MAX_EVENT_LINE (1024 * 1024)
+
+/* Seconds a list request may take */
+#define LIST_TIMEOUT 30
+
+/* Only object metadata is needed */
+#define ACCEPT_LIST "Accept: application/json;as=PartialObjectMetadataList;g=meta.k8s.io;v=v1,application/json"
+#define ACCEPT_WATCH "Accept: application/json;as=PartialObjectMetadata;g=meta.k8s.io;v=v1,application/json"
+
+typedef enum {
+    KIND_SERVICEACCOUNT,
+    KIND_POD,
+    KIND_ROLEBINDING,
+    KIND_CLUSTERROLEBINDING,
+    KIND_COUNT
+} watch_kind_t;
+
+static const char *kind_api[KIND_COUNT] = {
+    "/api/v1", "/api/v1",
+    "/apis/rbac.authorization.k8s.io/v1", "/apis/rbac.authorization.k8s.io/v1"
+};
+static const char *kind_resource[KIND_COUNT] = {
+    "serviceaccounts", "pods", "rolebindings", "clusterrolebindings"
+};
+static const char *kind_label[KIND_COUNT] = {
+    "serviceaccount", "pod", "rolebinding", "clusterrolebinding"
+};
+
+/* Bindings only invalidate access review decisions */
+#define IS_RBAC(kind) ((kind) == KIND_ROLEBINDING || (kind) == KIND_CLUSTERROLEBINDING)
+
+typedef enum {
+    PHASE_IDLE,                  /* Waiting for retry_at */
+    PHASE_LIST,
+    PHASE_WATCH
+} watch_phase_t;
+
+/* UIDs seen by a list, sorted once the list is complete */
+typedef struct {
+    char **uids;
+    size_t count;
+    size_t cap;
+} uid_set_t;
+
+typedef struct {
+    watch_kind_t kind;
+    char namespace[K8S_MAX_NAMESPACE_LEN + 1];   /* Empty: all namespaces */
+    watch_phase_t phase;
+    int listed;                  /* A list completed; watches resume from resource_version */
+    int gone;                    /* The API server expired resource_version */
+    char resource_version[64];
+    char *continue_token;        /* Next list page */
+    uid_set_t seen;
+    CURL *curl;
+    struct curl_slist *headers;
+    struct curl_slist *resolve;  /* Pinned addresses last given to curl */
+    char *buf;                   /* List body, or the incomplete watch event line */
+    size_t len;
+    size_t cap;
+    int overflow;
+    time_t retry_at;
+    int backoff;
+} watch_stream_t;
+
+typedef struct {
+    watch_kind_t kind;
+    const char *namespace;       /* Empty: all namespaces */
+    const char *uid;             /* Deleted object */
+    const uid_set_t *live;       /* Or: every object that still exists */
+} drop_ctx_t;
+
+static pthread_mutex_t control_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t watcher;
+static int running = 0;
+static int stopping = 0;
+static int listed_streams = 0;
+static CURLM *multi = NULL;
+static watch_stream_t *streams = NULL;
+static int stream_count = 0;
+
+/* Active configuration (owned copies) */
+static char *cfg_url = NULL;
+static char *cfg_ca = NULL;
+static char *cfg_token = NULL;
+static char *cfg_namespaces = NULL;
+static int cfg_rbac = 0;
+static k8s_http_pool_t *cfg_pool = NULL;
+
+/* Hashes of deleted ServiceAccount UIDs, oldest overwritten first */
+static pthread_mutex_t deleted_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t deleted[K8S_WATCH_DELETED];
+static size_t deleted_next = 0;
+
+static int same_str(const char *a, const char *b) {
+    return strcmp(a ? a : "", b ? b : "") == 0;
+}
+
+static char *dup_str(const char *s) {
+    if (!s) {
+        return NULL;
+    }
+    size_t len = strlen(s) + 1;
+    char *copy = k8s_malloc(K8S_MEM_WATCH, len);
+    if (copy) {
+        memcpy(copy, s, len);
+    }
+    return copy;
+}
+
+/* ========================================================================
+ * UID sets
+ * ======================================================================== */
+
+static int uid_set_add(uid_set_t *set, const char *uid) {
+    if (set->count == set->cap) {
+        size_t cap = set->cap ? set->cap * 2 : 256;
+        char **uids = k8s_realloc(K8S_MEM_WATCH, set->uids, cap * sizeof(char *));
+        if (!uids) {
+            return 0;
+        }
+        set->uids = uids;
+        set->cap = cap;
+    }
+    set->uids[set->count] = dup_str(uid);
+    if (!set->uids[set->count]) {
+        return 0;
+    }
+    set->count++;
+    return 1;
+}
+
+static int compare_uid(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int uid_set_contains(const uid_set_t *set, const char *uid) {
+    return set->count > 0 &&
+           bsearch(&uid, set->uids, set->count, sizeof(char *), compare_uid) != NULL;
+}
+
+static uint64_t uid_hash(const char *uid) {
+    uint64_t h = 1469598103934665603ULL;
+    for (; *uid; uid++) {
+        h = (h ^ (unsigned char)*uid) * 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+static void remember_deleted(const char *uid) {
+    uint64_t h = uid_hash(uid);
+    pthread_mutex_lock(&deleted_lock);
+    deleted[deleted_next] = h;
+    deleted_next = (deleted_next + 1) % K8S_WATCH_DELETED;
+    pthread_mutex_unlock(&deleted_lock);
+}
+
+static void uid_set_free(uid_set_t *set) {
+    for (size_t i = 0; i < set->count; i++) {
+        k8s_free(set->uids[i]);
+    }
+    k8s_free(set->uids);
+    memset(set, 0, sizeof(*set));
+}
+
+/* ========================================================================
+ * Cache eviction
+ * ======================================================================== */
+
+static int drop_entry(const k8s_cache_entry_t *entry, void *arg) {
+    const drop_ctx_t *ctx = arg;
+    const char *uid = ctx->kind == KIND_SERVICEACCOUNT ? entry->uid : entry->pod_uid;
+
+    if (!uid[0]) {
+        return 0;
+    }
+    if (ctx->namespace[0] && strcmp(entry->namespace, ctx->namespace) != 0) {
+        return 0;
+    }
+    if (ctx->uid) {
+        return strcmp(uid, ctx->uid) == 0;
+    }
+    if (uid_set_contains(ctx->live, uid)) {
+        return 0;
+    }
+    /* Deleted while the watch was down; only known through the cache */
+    if (ctx->kind == KIND_SERVICEACCOUNT) {
+        remember_deleted(uid);
+    }
+    return 1;
+}
+
+/* ========================================================================
+ * Requests
+ * ======================================================================== */
+
+static size_t on_data(char *data, size_t size, size_t nmemb, void *userp);
+
+static void schedule_retry(watch_stream_t *s) {
+    s->backoff = s->backoff ? s->backoff * 2 : 1;
+    if (s->backoff > K8S_WATCH_MAX_BACKOFF) {
+        s->backoff = K8S_WATCH_MAX_BACKOFF;
+    }
+    s->retry_at = time(NULL) + s->backoff;
+}
+
+/* The pool's cached credential, or the token file when there is no pool */
+static int auth_header(char *buf, size_t len) {
+    if (cfg_pool) {
+        return k8s_http_pool_auth_header(cfg_pool, buf, len);
+    }
+    char *credential = k8s_read_file(cfg_token);
+    if (!credential) {
+        return 0;
+    }
+    int n = snprintf(buf, len, "Authorization: Bearer %s", credential);
+    free(credential);
+    return n > 0 && (size_t)n < len;
+}
+
+/* Watches reach the API server at the pool's pinned addresses too */
+static void apply_resolve(watch_stream_t *s) {
+    char entry[K8S_RESOLVER_MAX_ENTRY_LEN];
+
+    if (!cfg_pool || !k8s_http_pool_pinned(cfg_pool, entry, sizeof(entry)) ||
+        (s->resolve && strcmp(s->resolve->data, entry) == 0)) {
+        return;
+    }
+    struct curl_slist *list = curl_slist_append(NULL, entry);
+    if (!list) {
+        return;
+    }
+    curl_easy_setopt(s->curl, CURLOPT_RESOLVE, list);
+    curl_slist_free_all(s->resolve);
+    s->resolve = list;
+}
+
+static void restart_list(watch_stream_t *s) {
+    s->listed = 0;
+    s->gone = 0;
+    s->resource_version[0] = '\0';
+    k8s_free(s->continue_token);
+    s->continue_token = NULL;
+    uid_set_free(&s->seen);
+}
+
+static void start_request(watch_stream_t *s) {
+    char url[4096];
+    char auth[4096];
+    k8s_config_t http;
+    int n;
+
+    const char *base = cfg_url;
+    size_t base_len = strlen(base);
+    while (base_len > 0 && base[base_len - 1] == '/') {
+        base_len--;
+    }
+    if (s->namespace[0]) {
+        n = snprintf(url, sizeof(url), "%.*s%s/namespaces/%s/%s", (int)base_len, base,
+                     kind_api[s->kind], s->namespace, kind_resource[s->kind]);
+    } else {
+        n = snprintf(url, sizeof(url), "%.*s%s/%s", (int)base_len, base,
+                     kind_api[s->kind], kind_resource[s->kind]);
+    }
+
+    if ((size_t)n < sizeof(url) && s->listed) {
+        n += snprintf(url + n, sizeof(url) - n,
+                      "?watch=1&allowWatchBookmarks=true&resourceVersion=%s&timeoutSeconds=%d",
+                      s->resource_version, K8S_WATCH_TIMEOUT);
+    } else if ((size_t)n < sizeof(url)) {
+        char *escaped = s->continue_token ? curl_easy_escape(s->curl, s->continue_token, 0) : NULL;
+        n += snprintf(url + n, sizeof(url) - n, "?limit=%d%s%s", K8S_WATCH_LIST_LIMIT,
+                      escaped ? "&continue=" : "", escaped ? escaped : "");
+        curl_free(escaped);
+    }
+    if ((size_t)n >= sizeof(url)) {
+        K8S_LOG(K8S_LOG_WARNING, "watch_failed", "kind=%s namespace=\"%s\" reason=url_too_long",
+                kind_label[s->kind], s->namespace);
+        schedule_retry(s);
+        return;
+    }
+
+    if (!auth_header(auth, sizeof(auth))) {
+        K8S_LOG(K8S_LOG_WARNING, "credential_missing", "path=\"%s\" action=retry", cfg_token);
+        schedule_retry(s);
+        return;
+    }
+
+    curl_slist_free_all(s->headers);
+    s->headers = curl_slist_append(NULL, auth);
+    s->headers = curl_slist_append(s->headers, s->listed ? ACCEPT_WATCH : ACCEPT_LIST);
+
+    s->len = 0;
+    s->overflow = 0;
+    s->phase = s->listed ? PHASE_WATCH : PHASE_LIST;
+
+    curl_easy_setopt(s->curl, CURLOPT_URL, url);
+    curl_easy_setopt(s->curl, CURLOPT_HTTPHEADER, s->headers);
+    curl_easy_setopt(s->curl, CURLOPT_WRITEFUNCTION, on_data);
+    curl_easy_setopt(s->curl, CURLOPT_WRITEDATA, s);
+    curl_easy_setopt(s->curl, CURLOPT_PRIVATE, s);
+
+    /* TLS verification and CA trust as for every other API server request */
+    k8s_config_init_default(&http);
+    http.api_server_url = cfg_url;
+    http.ca_cert_path = cfg_ca;
+    http.token_path = cfg_token;
+    http.pool = cfg_pool;
+    http.timeout_seconds = s->listed ? K8S_WATCH_TIMEOUT + LIST_TIMEOUT : LIST_TIMEOUT;
+    k8s_http_apply_common(s->curl, &http);
+    curl_easy_setopt(s->curl, CURLOPT_CONNECTTIMEOUT, 10L);
+    apply_resolve(s);
+    curl_multi_add_handle(multi, s->curl);
+}
+
+/* ========================================================================
+ * Responses
+ * ======================================================================== */
+
+static const char *get_string(json_object *obj, const char *key) {
+    json_object *value = NULL;
+    if (obj && json_object_object_get_ex(obj, key, &value) &&
+        json_object_is_type(value, json_type_string)) {
+        return json_object_get_string(value);
+    }
+    return NULL;
+}
+
+static void handle_event(watch_stream_t *s, json_object *event) {
+    json_object *object = NULL, *metadata = NULL, *code = NULL;
+    const char *type = get_string(event, "type");
+
+    if (!type || !json_object_object_get_ex(event, "object", &object)) {
+        return;
+    }
+
+    if (strcmp(type, "ERROR") == 0) {
+        if (json_object_object_get_ex(object, "code", &code) && json_object_get_int(code) == 410) {
+            s->gone = 1;
+        } else {
+            K8S_LOG(K8S_LOG_WARNING, "watch_error", "kind=%s namespace=\"%s\" message=\"%s\"",
+                    kind_label[s->kind], s->namespace,
+                    get_string(object, "message") ? get_string(object, "message") : "");
+        }
+        return;
+    }
+
+    json_object_object_get_ex(object, "metadata", &metadata);
+    const char *rv = get_string(metadata, "resourceVersion");
+    if (rv && strlen(rv) < sizeof(s->resource_version)) {
+        strcpy(s->resource_version, rv);
+    }
+    s->backoff = 0;
+
+    /* Any change to a binding may grant or revoke the reviewed permission */
+    if (IS_RBAC(s->kind)) {
+        if (strcmp(type, "BOOKMARK") != 0) {
+            const char *ns = s->kind == KIND_ROLEBINDING ? get_string(metadata, "namespace")
+                                                         : NULL;
+            k8s_access_review_invalidate(ns);
+            K8S_LOG(K8S_LOG_DEBUG, "access_reviews_dropped", "kind=%s object=\"%s/%s\"",
+                    kind_label[s->kind], ns ? ns : "",
+                    get_string(metadata, "name") ? get_string(metadata, "name") : "");
+        }
+        return;
+    }
+
+    const char *uid = get_string(metadata, "uid");
+    if (strcmp(type, "DELETED") != 0 || !uid) {
+        return;
+    }
+
+    if (s->kind == KIND_SERVICEACCOUNT) {
+        remember_deleted(uid);
+    }
+    drop_ctx_t ctx = { s->kind, "", uid, NULL };
+    int dropped = k8s_token_cache_evict_if(drop_entry, &ctx);
+    if (dropped > 0) {
+        k8s_stats_add(K8S_STAT_CACHE_REVOKED, (uint64_t)dropped);
+        K8S_LOG(K8S_LOG_INFO, "cache_revoked", "kind=%s object=\"%s/%s\" uid=%s entries=%d",
+                kind_label[s->kind],
+                get_string(metadata, "namespace") ? get_string(metadata, "namespace") : "",
+                get_string(metadata, "name") ? get_string(metadata, "name") : "", uid, dropped);
+    }
+}
+
+/* Handle every complete line of a watch stream */
+static void process_lines(watch_stream_t *s) {
+    size_t start = 0;
+
+    for (size_t i = 0; i < s->len; i++) {
+        if (s->buf[i] != '\n') {
+            continue;
+        }
+        s->buf[i] = '\0';
+        json_object *event = json_tokener_parse(s->buf + start);
+        if (event) {
+            handle_event(s, event);
+            json_object_put(event);
+        }
+        start = i + 1;
+    }
+    memmove(s->buf, s->buf + start, s->len - start);
+    s->len -= start;
+}
+
+static size_t on_data(char *data, size_t size, size_t nmemb, void *userp) {
+    watch_stream_t *s = userp;
+    size_t n = size * nmemb;
+    size_t limit = s->phase == PHASE_WATCH ? MAX_EVENT_LINE : MAX_LIST_BODY;
+    long status = 0;
+
+    if (s->len + n + 1 > limit) {
+        s->overflow = 1;
+        return 0;
+    }
+    if (s->len + n + 1 > s->cap) {
+        size_t cap = s->cap ? s->cap : 16384;
+        while (cap < s->len + n + 1) {
+            cap *= 2;
+        }
+        char *buf = k8s_realloc(K8S_MEM_WATCH, s->buf, cap);
+        if (!buf) {
+            s->overflow = 1;
+            return 0;
+        }
+        s->buf = buf;
+        s->cap = cap;
+    }
+    memcpy(s->buf + s->len, data, n);
+    s->len += n;
+    s->buf[s->len] = '\0';
+
+    curl_easy_getinfo(s->curl, CURLINFO_RESPONSE_CODE, &status);
+    if (s->phase == PHASE_WATCH && status == 200) {
+        process_lines(s);
+    }
+    return n;
+}
+
+/* One list page arrived; returns 0 if it was unusable */
+static int handle_list_page(watch_stream_t *s) {
+    json_object *list = json_tokener_parse(s->buf ? s->buf : "");
+    json_object *metadata = NULL, *items = NULL;
+
+    if (!list || !json_object_object_get_ex(list, "items", &items) ||
+        !json_object_is_type(items, json_type_array)) {
+        if (list) {
+            json_object_put(list);
+        }
+        return 0;
+    }
+
+    json_object_object_get_ex(list, "metadata", &metadata);
+    /* The first page's version is the snapshot the whole list belongs to */
+    const char *rv = get_string(metadata, "resourceVersion");
+    if (!s->continue_token && rv && strlen(rv) < sizeof(s->resource_version)) {
+        strcpy(s->resource_version, rv);
+    }
+
+    size_t count = json_object_array_length(items);
+    for (size_t i = 0; i < count; i++) {
+        json_object *item_meta = NULL;
+        json_object_object_get_ex(json_object_array_get_idx(items, i), "metadata", &item_meta);
+        const char *uid = get_string(item_meta, "uid");
+        if (uid && !IS_RBAC(s->kind) && !uid_set_add(&s->seen, uid)) {
+            json_object_put(list);
+            return 0;
+        }
+    }
+
+    const char *next = get_string(metadata, "continue");
+    k8s_free(s->continue_token);
+    s->continue_token = next && *next ? dup_str(next) : NULL;
+    json_object_put(list);
+    return 1;
+}
+
+/* The list is complete: drop entries for objects that no longer exist */
+static void finish_list(watch_stream_t *s) {
+    if (s->seen.count > 0) {
+        qsort(s->seen.uids, s->seen.count, sizeof(char *), compare_uid);
+    }
+
+    int dropped = 0;
+    if (IS_RBAC(s->kind)) {
+        /* Bindings may have changed while nothing watched them */
+        k8s_access_review_invalidate(s->kind == KIND_ROLEBINDING && s->namespace[0] ?
+                                     s->namespace : NULL);
+    } else {
+        drop_ctx_t ctx = { s->kind, s->namespace, NULL, &s->seen };
+        dropped = k8s_token_cache_evict_if(drop_entry, &ctx);
+        if (dropped > 0) {
+            k8s_stats_add(K8S_STAT_CACHE_REVOKED, (uint64_t)dropped);
+        }
+    }
+
+    K8S_LOG(K8S_LOG_INFO, "watch_synced", "kind=%s namespace=\"%s\" objects=%zu "
+            "resource_version=%s revoked=%d", kind_label[s->kind],
+            s->namespace[0] ? s->namespace : "*", s->seen.count, s->resource_version, dropped);
+
+    uid_set_free(&s->seen);
+    s->listed = 1;
+    s->backoff = 0;
+    __atomic_add_fetch(&listed_streams, 1, __ATOMIC_RELAXED);
+}
+
+static void finish_request(watch_stream_t *s, CURLcode result) {
+    long status = 0;
+    watch_phase_t phase = s->phase;
+
+    curl_multi_remove_handle(multi, s->curl);
+    curl_easy_getinfo(s->curl, CURLINFO_RESPONSE_CODE, &status);
+    s->phase = PHASE_IDLE;
+    s->retry_at = 0;
+
+    if (phase == PHASE_LIST) {
+        if (result == CURLE_OK && status == 200 && handle_list_page(s)) {
+            if (!s->continue_token) {
+                finish_list(s);
+            }
+            return;
+        }
+        K8S_LOG(K8S_LOG_WARNING, "watch_failed", "kind=%s namespace=\"%s\" phase=list "
+                "http_status=%ld error=\"%s\"", kind_label[s->kind], s->namespace, status,
+                s->overflow ? "response too large" : curl_easy_strerror(result));
+        /* An expired continue token also lands here: start the list over */
+        restart_list(s);
+        schedule_retry(s);
+        return;
+    }
+
+    if (s->gone || status == 410) {
+        K8S_LOG(K8S_LOG_INFO, "watch_expired", "kind=%s namespace=\"%s\" resource_version=%s "
+                "action=relist", kind_label[s->kind], s->namespace, s->resource_version);
+        __atomic_sub_fetch(&listed_streams, 1, __ATOMIC_RELAXED);
+        restart_list(s);
+        return;
+    }
+
+    /* The server ends every watch after timeoutSeconds; resume right away */
+    if (result == CURLE_OK && status == 200) {
+        return;
+    }
+    if (result == CURLE_OPERATION_TIMEDOUT && status == 200) {
+        return;
+    }
+
+    K8S_LOG(K8S_LOG_WARNING, "watch_failed", "kind=%s namespace=\"%s\" phase=watch "
+            "http_status=%ld error=\"%s\" action=resume", kind_label[s->kind], s->namespace,
+            status, s->overflow ? "event too large" : curl_easy_strerror(result));
+    schedule_retry(s);
+}
+
+static void *watcher_main(void *unused) {
+    (void)unused;
+
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        time_t now = time(NULL);
+        for (int i = 0; i < stream_count; i++) {
+            if (streams[i].phase == PHASE_IDLE && now >= streams[i].retry_at) {
+                start_request(&streams[i]);
+            }
+        }
+
+        int active = 0;
+        curl_multi_perform(multi, &active);
+
+        CURLMsg *msg;
+        int queued = 0;
+        while ((msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg == CURLMSG_DONE) {
+                watch_stream_t *s = NULL;
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&s);
+                finish_request(s, msg->data.result);
+            }
+        }
+
+        curl_multi_poll(multi, NULL, 0, 1000, NULL);
+    }
+    return NULL;
+}
+
+/* ========================================================================
+ * Control
+ * ======================================================================== */
+
+static void free_streams(void) {
+    for (int i = 0; i < stream_count; i++) {
+        watch_stream_t *s = &streams[i];
+        if (s->curl) {
+            if (s->phase != PHASE_IDLE) {
+                curl_multi_remove_handle(multi, s->curl);
+            }
+            curl_easy_cleanup(s->curl);
+        }
+        curl_slist_free_all(s->headers);
+        curl_slist_free_all(s->resolve);
+        k8s_free(s->buf);
+        k8s_free(s->continue_token);
+        uid_set_free(&s->seen);
+    }
+    k8s_free(streams);
+    streams = NULL;
+    stream_count = 0;
+    listed_streams = 0;
+}
+
+static void free_config(void) {
+    k8s_free(cfg_url);
+    k8s_free(cfg_ca);
+    k8s_free(cfg_token);
+    k8s_free(cfg_namespaces);
+    cfg_url = cfg_ca = cfg_token = cfg_namespaces = NULL;
+    cfg_rbac = 0;
+    cfg_pool = NULL;
+}
+
+static void stop_locked(void) {
+    if (!running) {
+        return;
+    }
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    curl_multi_wakeup(multi);
+    pthread_join(watcher, NULL);
+
+    free_streams();
+    curl_multi_cleanup(multi);
+    multi = NULL;
+    free_config();
+    running = 0;
+    stopping = 0;
+}
+
+/* One stream per kind and namespace, and one for ClusterRoleBindings */
+static int build_streams(const char *namespaces, int rbac) {
+    char list[K8S_WATCH_MAX_NAMESPACES * (K8S_MAX_NAMESPACE_LEN + 1)];
+    char *save = NULL;
+    int count = 0;
+
+    streams = k8s_calloc(K8S_MEM_WATCH, K8S_WATCH_MAX_NAMESPACES * KIND_COUNT,
+                         sizeof(watch_stream_t));
+    if (!streams) {
+        return 0;
+    }
+
+    snprintf(list, sizeof(list), "%s", namespaces);
+    for (char *ns = strtok_r(list, ", ", &save); ns; ns = strtok_r(NULL, ", ", &save)) {
+        if (count == K8S_WATCH_MAX_NAMESPACES) {
+            K8S_LOG(K8S_LOG_WARNING, "watch_namespaces_truncated", "max=%d",
+                    K8S_WATCH_MAX_NAMESPACES);
+            break;
+        }
+        if (strlen(ns) > K8S_MAX_NAMESPACE_LEN) {
+            continue;
+        }
+        for (int k = 0; k < KIND_COUNT; k++) {
+            if (k == KIND_CLUSTERROLEBINDING || (k == KIND_ROLEBINDING && !rbac)) {
+                continue;
+            }
+            watch_stream_t *s = &streams[stream_count];
+            s->kind = (watch_kind_t)k;
+            /* "*" watches the whole cluster */
+            strcpy(s->namespace, strcmp(ns, "*") == 0 ? "" : ns);
+            s->curl = curl_easy_init();
+            if (!s->curl) {
+                return 0;
+            }
+            stream_count++;
+        }
+        count++;
+    }
+    if (rbac && stream_count > 0) {
+        watch_stream_t *s = &streams[stream_count];
+        s->kind = KIND_CLUSTERROLEBINDING;
+        s->curl = curl_easy_init();
+        if (!s->curl) {
+            return 0;
+        }
+        stream_count++;
+    }
+    return stream_count > 0;
+}
+
+/* Caller holds control_lock */
+static int configure_locked(const k8s_watch_config_t *config) {
+    const char *namespaces = config->namespaces;
+
+    if (running && same_str(cfg_url, config->api_server_url) &&
+        same_str(cfg_ca, config->ca_cert_path) && same_str(cfg_token, config->token_path) &&
+        same_str(cfg_namespaces, namespaces) && cfg_rbac == config->rbac &&
+        cfg_pool == config->pool) {
+        return 1;
+    }
+
+    stop_locked();
+    if (!namespaces || !*namespaces || !config->api_server_url || !config->token_path) {
+        return 1;
+    }
+
+    cfg_url = dup_str(config->api_server_url);
+    cfg_ca = dup_str(config->ca_cert_path);
+    cfg_token = dup_str(config->token_path);
+    cfg_namespaces = dup_str(namespaces);
+    cfg_rbac = config->rbac;
+    cfg_pool = config->pool;
+    multi = curl_multi_init();
+    if (!cfg_url || !cfg_token || !cfg_namespaces || !multi ||
+        !build_streams(namespaces, config->rbac)) {
+        goto fail;
+    }
+
+    if (pthread_create(&watcher, NULL, watcher_main, NULL) != 0) {
+        goto fail;
+    }
+    running = 1;
+
+    K8S_LOG(K8S_LOG_INFO, "watch_started", "namespaces=\"%s\" rbac=%d", namespaces,
+            config->rbac);
+    return 1;
+
+fail:
+    K8S_LOG(K8S_LOG_ERROR, "watch_unavailable", "namespaces=\"%s\"", namespaces);
+    free_streams();
+    if (multi) {
+        curl_multi_cleanup(multi);
+        multi = NULL;
+    }
+    free_config();
+    return 0;
+}
+
+int k8s_watch_configure(const k8s_watch_config_t *config) {
+    pthread_mutex_lock(&control_lock);
+    int ok = configure_locked(config);
+    pthread_mutex_unlock(&control_lock);
+    return ok;
+}
+
+int k8s_watch_retarget(const k8s_config_t *config) {
+    int ok = 1;
+
+    pthread_mutex_lock(&control_lock);
+    if (running) {
+        /* Restarting frees the current settings */
+        char *namespaces = dup_str(cfg_namespaces);
+        k8s_watch_config_t next = {
+            config->api_server_url, config->ca_cert_path, config->token_path,
+            namespaces, cfg_rbac, config->pool
+        };
+        if (namespaces) {
+            ok = configure_locked(&next);
+        } else {
+            /* Must not keep using a pool the caller is about to let go */
+            stop_locked();
+            ok = 0;
+        }
+        k8s_free(namespaces);
+    }
+    pthread_mutex_unlock(&control_lock);
+    return ok;
+}
+
+int k8s_watch_synced(void) {
+    pthread_mutex_lock(&control_lock);
+    int synced = running && __atomic_load_n(&listed_streams, __ATOMIC_RELAXED) == stream_count;
+    pthread_mutex_unlock(&control_lock);
+    return synced;
+}
+
+int k8s_watch_deleted(const char *uid) {
+    uint64_t h = uid_hash(uid);
+    int found = 0;
+
+    pthread_mutex_lock(&deleted_lock);
+    for (size_t i = 0; i < K8S_WATCH_DELETED && !found; i++) {
+        found = deleted[i] == h;
+    }
+    pthread_mutex_unlock(&deleted_lock);
+    return found;
+}
+
+void k8s_watch_stop(void) {
+    pthread_mutex_lock(&control_lock);
+    stop_locked();
+    pthread_mutex_unlock(&control_lock);
+}
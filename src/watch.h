@@ -0,0 +1,98 @@
+/*
+ * ServiceAccount and Pod Watches
+ *
+ * A background thread that lists, then watches, the ServiceAccounts and
+ * Pods of the configured namespaces and drops cached validations (see
+ * token_cache.h) as soon as their ServiceAccount or the pod their token is
+ * bound to is deleted. This makes long cache TTLs safe without polling.
+ *
+ * Watches resume from the last resourceVersion seen, which bookmarks keep
+ * current, so reconnecting neither misses a deletion nor lists again. Only
+ * an expired resourceVersion (410 Gone) forces a new list; entries whose
+ * ServiceAccount or pod is missing from the list are then dropped, which
+ * also covers deletions that happened while mariadbd was down.
+ *
+ * With rbac set, the RoleBindings of the same namespaces and all
+ * ClusterRoleBindings are watched as well, and every change to one drops
+ * the access review decisions it may affect (see access_review.h).
+ */
+
+#ifndef K8S_WATCH_H
+#define K8S_WATCH_H
+
+#include "tokenreview_api.h"
+
+/* Most namespaces that can be watched */
+#define K8S_WATCH_MAX_NAMESPACES 32
+
+/* Objects per list request */
+#define K8S_WATCH_LIST_LIMIT 500
+
+/* Seconds the API server keeps one watch request open */
+#define K8S_WATCH_TIMEOUT 300
+
+/* Longest wait in seconds before retrying a failed request */
+#define K8S_WATCH_MAX_BACKOFF 30
+
+/* Deleted ServiceAccount UIDs remembered for k8s_watch_deleted() */
+#define K8S_WATCH_DELETED 4096
+
+typedef struct {
+    const char *api_server_url;
+    const char *ca_cert_path;    /* CA bundle, unless the pool has it parsed */
+    const char *token_path;      /* Credential for list and watch requests */
+    const char *namespaces;      /* Comma-separated, "*" for all; NULL or empty disables */
+    int rbac;                    /* Also watch RoleBindings and ClusterRoleBindings */
+    struct k8s_http_pool *pool;  /* Credential, CA store and pinned addresses, or NULL to
+                                    read token_path and ca_cert_path; must outlive the watches */
+} k8s_watch_config_t;
+
+/**
+ * Start, restart or stop the watches to match a configuration
+ *
+ * Nothing happens when the configuration is unchanged.
+ *
+ * @param config Settings; strings are copied
+ * @return 1 on success, 0 if the watch thread could not be started
+ */
+int k8s_watch_configure(const k8s_watch_config_t *config);
+
+/**
+ * Point running watches at another API server configuration
+ *
+ * Keeps the namespaces and rbac setting of the last k8s_watch_configure()
+ * call; the watches restart only when the server, CA, credential or pool
+ * changed. Nothing happens when they are stopped.
+ *
+ * @param config API server configuration; strings are copied
+ * @return 1 on success, 0 if the watch thread could not be restarted
+ */
+int k8s_watch_retarget(const k8s_config_t *config);
+
+/**
+ * Whether every watch has completed its initial list
+ *
+ * @return 1 if running and synced, 0 otherwise
+ */
+int k8s_watch_synced(void);
+
+/**
+ * Whether a ServiceAccount was deleted since the plugin started
+ *
+ * Covers the last K8S_WATCH_DELETED deletions the watches saw, and those
+ * of cached ServiceAccounts found missing when a watch had to list again.
+ * For what carries a UID but no token to review, such as session tickets.
+ *
+ * @param uid ServiceAccount UID
+ * @return 1 if deleted, 0 if not known to be
+ */
+int k8s_watch_deleted(const char *uid);
+
+/**
+ * Stop the watch thread and close its connections
+ *
+ * Safe to call when the watches are not running.
+ */
+void k8s_watch_stop(void);
+
+#endif /* K8S_WATCH_H */
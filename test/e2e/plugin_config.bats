@@ -39,8 +39,67 @@ setup() {
     [[ "$output" == *"10"* ]]
 }
 
-@test "auth_k8s_timeout is read-only" {
+@test "auth_k8s_timeout can be changed at runtime" {
     run mysql_root "SET GLOBAL auth_k8s_timeout = 30"
+    [[ "$status" -eq 0 ]]
+
+    run mysql_root "SHOW GLOBAL VARIABLES LIKE 'auth_k8s_timeout'"
+    [[ "$status" -eq 0 ]]
+    [[ "$output" == *"30"* ]]
+
+    run mysql_root "SET GLOBAL auth_k8s_timeout = DEFAULT"
+    [[ "$status" -eq 0 ]]
+}
+
+@test "auth_k8s_api_url rejects an empty value" {
+    run mysql_root "SET GLOBAL auth_k8s_api_url = ''"
     [[ "$status" -ne 0 ]]
-    [[ "$output" == *"read only"* ]]
+
+    run mysql_root "SHOW GLOBAL VARIABLES LIKE 'auth_k8s_api_url'"
+    [[ "$output" == *"https://kubernetes.default.svc"* ]]
+}
+
+@test "auth_k8s_api_url keeps its value after the statement that set it" {
+    run mysql_root "SET GLOBAL auth_k8s_api_url = 'https://kubernetes.default.svc.cluster.local'"
+    [[ "$status" -eq 0 ]]
+
+    run mysql_root "SELECT @@auth_k8s_api_url"
+    [[ "$status" -eq 0 ]]
+    [[ "$output" == *"https://kubernetes.default.svc.cluster.local"* ]]
+
+    run mysql_root "SET GLOBAL auth_k8s_api_url = DEFAULT"
+    [[ "$status" -eq 0 ]]
+
+    run mysql_root "SELECT @@auth_k8s_api_url"
+    [[ "$output" == *"https://kubernetes.default.svc"* ]]
+    [[ "$output" != *"cluster.local"* ]]
+}
+
+@test "auth_k8s string variables set at runtime revert to their startup values on a plugin reload" {
+    run mysql_root "SET GLOBAL auth_k8s_api_url = 'https://kubernetes.default.svc.cluster.local'"
+    [[ "$status" -eq 0 ]]
+    run mysql_root "SET GLOBAL auth_k8s_backends = 'jwks, tokenreview'"
+    [[ "$status" -eq 0 ]]
+
+    # Unloading frees the values set above with the server's allocator
+    run mysql_root "UNINSTALL SONAME 'auth_k8s'; INSTALL SONAME 'auth_k8s'"
+    [[ "$status" -eq 0 ]]
+
+    run mysql_root "SELECT PLUGIN_STATUS FROM information_schema.PLUGINS WHERE PLUGIN_NAME = 'auth_k8s'"
+    [[ "$output" == *"ACTIVE"* ]]
+    run mysql_root "SELECT @@auth_k8s_api_url, @@auth_k8s_token_path, @@auth_k8s_backends"
+    [[ "$status" -eq 0 ]]
+    [[ "$output" == *"https://kubernetes.default.svc"* ]]
+    [[ "$output" != *"cluster.local"* ]]
+    [[ "$output" == *"/var/run/secrets/tokenreviewer/token"* ]]
+    [[ "$output" != *"jwks"* ]]
+
+    run mysql_query user1 "mariadb-auth-test/user1" "SELECT 1"
+    [[ "$status" -eq 0 ]]
+}
+
+@test "auth_k8s_log_level defaults to warnings" {
+    run mysql_root "SHOW GLOBAL VARIABLES LIKE 'auth_k8s_log_level'"
+    [[ "$status" -eq 0 ]]
+    [[ "$output" == *"1"* ]]
 }
@@ -0,0 +1,150 @@
+/*
+ * Stand-in Kubernetes API Server Implementation
+ *
+ * One thread polls the listening socket and a stop pipe, and reads each
+ * accepted connection's request to the end of the body Content-Length
+ * announces before handing it on.
+ */
+
+#include "fake_api.h"
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define REQUEST_MAX 8192
+
+static fake_api_handler_t handler;
+static pthread_t thread;
+static int listen_fd = -1;
+static int stop_fds[2] = { -1, -1 };
+
+/* Read one request and hand it on; 0 if the connection is to be closed */
+static int handle(int fd) {
+    char request[REQUEST_MAX];
+    size_t got = 0;
+    char *end = NULL;
+
+    /* Headers, then as much body as Content-Length announces */
+    while (got < sizeof(request) - 1) {
+        ssize_t n = recv(fd, request + got, sizeof(request) - 1 - got, 0);
+        if (n <= 0) {
+            return 0;
+        }
+        got += (size_t)n;
+        request[got] = '\0';
+        if (!end) {
+            end = strstr(request, "\r\n\r\n");
+        }
+        if (end) {
+            const char *length = strstr(request, "Content-Length: ");
+            size_t want = length && length < end ? strtoul(length + 16, NULL, 10) : 0;
+            if (strlen(end + 4) >= want) {
+                break;
+            }
+        }
+    }
+    if (!end) {
+        return 0;
+    }
+
+    /* Split "METHOD PATH HTTP/1.1\r\nheaders\r\n\r\nbody" in place */
+    fake_api_request_t req = { fd, request, "", "", end + 4 };
+    *end = '\0';
+    char *line_end = strstr(request, "\r\n");
+    if (line_end) {
+        *line_end = '\0';
+        req.headers = line_end + 2;
+    }
+    char *path = strchr(request, ' ');
+    if (path) {
+        *path++ = '\0';
+        path[strcspn(path, " ")] = '\0';
+        req.path = path;
+    }
+    return handler(&req);
+}
+
+static void *serve(void *unused) {
+    (void)unused;
+    struct pollfd fds[2] = {
+        { listen_fd, POLLIN, 0 },
+        { stop_fds[0], POLLIN, 0 },
+    };
+
+    while (poll(fds, 2, -1) > 0 && !fds[1].revents) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd >= 0 && !handle(fd)) {
+            close(fd);
+        }
+    }
+    return NULL;
+}
+
+int fake_api_start(fake_api_handler_t on_request) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        return 0;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, 64) != 0 ||
+        getsockname(listen_fd, (struct sockaddr *)&addr, &len) != 0 ||
+        pipe(stop_fds) != 0) {
+        stop_fds[0] = stop_fds[1] = -1;
+        close(listen_fd);
+        listen_fd = -1;
+        return 0;
+    }
+
+    handler = on_request;
+    if (pthread_create(&thread, NULL, serve, NULL) != 0) {
+        close(stop_fds[0]);
+        close(stop_fds[1]);
+        stop_fds[0] = stop_fds[1] = -1;
+        close(listen_fd);
+        listen_fd = -1;
+        return 0;
+    }
+    return ntohs(addr.sin_port);
+}
+
+void fake_api_stop(void) {
+    if (stop_fds[1] >= 0) {
+        ssize_t ignored = write(stop_fds[1], "x", 1);
+        (void)ignored;
+        pthread_join(thread, NULL);
+        close(stop_fds[0]);
+        close(stop_fds[1]);
+        stop_fds[0] = stop_fds[1] = -1;
+    }
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+}
+
+void fake_api_respond(int fd, int status, const char *body) {
+    char head[256];
+    snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\n"
+             "Content-Length: %zu\r\nConnection: close\r\n\r\n", status,
+             status == 200 ? "OK" : status == 201 ? "Created" : "Error", strlen(body));
+    send(fd, head, strlen(head), MSG_NOSIGNAL);
+    send(fd, body, strlen(body), MSG_NOSIGNAL);
+}
+
+void fake_api_stream(int fd) {
+    const char *head = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                       "Connection: close\r\n\r\n";
+    send(fd, head, strlen(head), MSG_NOSIGNAL);
+}
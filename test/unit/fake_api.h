@@ -0,0 +1,61 @@
+/*
+ * Stand-in Kubernetes API Server
+ *
+ * Plain HTTP on the loopback interface, for the tests that need the API
+ * server to answer: it reads each request, headers and body, and hands it
+ * to the test's handler, which decides the answer. Requests are handled one
+ * at a time, in the order their connections were accepted.
+ */
+
+#ifndef FAKE_API_H
+#define FAKE_API_H
+
+/* One request, valid until the handler returns */
+typedef struct {
+    int fd;                         /* Connection, to answer on */
+    const char *method;             /* "GET", "POST", ... */
+    const char *path;               /* With the query string */
+    const char *headers;            /* Header lines, "\r\n" separated */
+    const char *body;               /* "" for none */
+} fake_api_request_t;
+
+/**
+ * Answer one request
+ *
+ * @param request The request
+ * @return 0 to have the connection closed, 1 if the handler keeps it
+ */
+typedef int (*fake_api_handler_t)(const fake_api_request_t *request);
+
+/**
+ * Serve from a thread of its own
+ *
+ * @param handler Called for every request, on the server's thread
+ * @return Port listened on, 0 if the server did not start
+ */
+int fake_api_start(fake_api_handler_t handler);
+
+/**
+ * Stop serving and close the socket; connections kept by the handler stay
+ * open
+ */
+void fake_api_stop(void);
+
+/**
+ * Send a complete JSON response
+ *
+ * @param fd Connection
+ * @param status HTTP status
+ * @param body Response body
+ */
+void fake_api_respond(int fd, int status, const char *body);
+
+/**
+ * Send the head of a streamed JSON response, as for a watch; what follows
+ * is sent on fd as the test goes
+ *
+ * @param fd Connection
+ */
+void fake_api_stream(int fd);
+
+#endif /* FAKE_API_H */
@@ -0,0 +1,355 @@
+/*
+ * Stand-in Federated Validator Implementation
+ *
+ * One thread polls the listening socket and every connection. Answers wait
+ * in a per-connection queue until they are due, so a delayed one does not
+ * hold back those after it.
+ *
+ * Built with -DFEDERATED_DAEMON_MAIN it is a program serving the socket
+ * given as its argument until interrupted.
+ */
+
+#include "federated_daemon.h"
+#include "federated_protocol.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MAX_CONNECTIONS 32
+#define MAX_QUEUED 256
+
+/* Largest RESULT: status and seven strings */
+#define RESULT_MAX 4096
+
+typedef struct {
+    uint64_t due_ms;
+    size_t len;                     /* 0: close the connection instead */
+    unsigned char frame[RESULT_MAX];
+} reply_t;
+
+typedef struct {
+    int fd;                         /* -1: unused */
+    size_t have;
+    unsigned char in[K8S_FEDERATED_FRAME_MAX];
+    int queued;
+    reply_t *queue[MAX_QUEUED];
+} conn_t;
+
+static int listen_fd = -1;
+static char listen_path[108];
+static pthread_t thread;
+static int stopping = 0;
+static conn_t *conns[MAX_CONNECTIONS];
+static int connections = 0;
+static int requests = 0;
+static int max_pending = 0;
+static char last_audience[256];
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static unsigned char *put_string(unsigned char *p, const char *s) {
+    size_t len = strlen(s);
+    p[0] = (unsigned char)(len >> 8);
+    p[1] = (unsigned char)len;
+    memcpy(p + 2, s, len);
+    return p + 2 + len;
+}
+
+/* Next string of a request as a NUL-terminated copy; 0 if it is cut off */
+static int take_string(const unsigned char **p, const unsigned char *end, char *out,
+                       size_t size) {
+    if (end - *p < 2) {
+        return 0;
+    }
+    size_t len = (size_t)(*p)[0] << 8 | (*p)[1];
+    if ((size_t)(end - *p - 2) < len) {
+        return 0;
+    }
+    size_t copy = len < size ? len : size - 1;
+    memcpy(out, *p + 2, copy);
+    out[copy] = '\0';
+    *p += 2 + len;
+    return 1;
+}
+
+static void answer(reply_t *r, uint32_t id, const char *audience, const char *token) {
+    unsigned char *p = r->frame + K8S_FEDERATED_HEADER_LEN;
+    char ns[256];
+    char name[256];
+    char value[1024];
+
+    if (strncmp(token, "delay=", 6) == 0) {
+        r->due_ms += (uint64_t)atoi(token + 6);
+        token = strchr(token, '/') ? strchr(token, '/') + 1 : "";
+    }
+    if (strcmp(token, "close") == 0) {
+        r->len = 0;
+        return;
+    }
+
+    if (sscanf(token, "valid:%255[^:]:%255s", ns, name) == 2 &&
+        (!audience[0] || strcmp(audience, "mariadb") == 0)) {
+        *p++ = K8S_FEDERATED_VALID;
+        p = put_string(p, ns);
+        p = put_string(p, name);
+        snprintf(value, sizeof(value), "system:serviceaccount:%s:%s", ns, name);
+        p = put_string(p, value);
+        snprintf(value, sizeof(value), "uid-%s", name);
+        p = put_string(p, value);
+        snprintf(value, sizeof(value),
+                 "system:serviceaccounts\nsystem:serviceaccounts:%s\nsystem:authenticated", ns);
+        p = put_string(p, value);
+        snprintf(value, sizeof(value), "%s-pod", name);
+        p = put_string(p, value);
+        p = put_string(p, "pod-uid");
+    } else if (strcmp(token, "unavailable") == 0) {
+        *p++ = K8S_FEDERATED_UNAVAILABLE;
+    } else if (strcmp(token, "garbage") == 0) {
+        *p++ = 9;
+    } else {
+        *p++ = K8S_FEDERATED_REJECTED;
+    }
+    r->len = (size_t)(p - r->frame);
+    put_u32(r->frame, (uint32_t)(r->len - 4));
+    r->frame[4] = K8S_FEDERATED_MSG_RESULT;
+    put_u32(r->frame + 5, id);
+}
+
+static void conn_close(int i) {
+    conn_t *c = conns[i];
+    for (int q = 0; q < c->queued; q++) {
+        free(c->queue[q]);
+    }
+    close(c->fd);
+    free(c);
+    conns[i] = NULL;
+}
+
+/* Queue an answer per complete request; 0 if the client broke the protocol */
+static int conn_read(conn_t *c) {
+    char cluster[256];
+    char token[K8S_FEDERATED_FRAME_MAX];
+
+    while (c->have >= 4) {
+        size_t len = get_u32(c->in);
+        if (len < K8S_FEDERATED_HEADER_LEN - 4 || len > K8S_FEDERATED_FRAME_MAX - 4) {
+            return 0;
+        }
+        if (c->have < len + 4) {
+            break;
+        }
+        const unsigned char *p = c->in + K8S_FEDERATED_HEADER_LEN;
+        const unsigned char *end = c->in + 4 + len;
+        if (c->in[4] != K8S_FEDERATED_MSG_VALIDATE || c->queued == MAX_QUEUED ||
+            !take_string(&p, end, cluster, sizeof(cluster)) ||
+            !take_string(&p, end, last_audience, sizeof(last_audience)) ||
+            !take_string(&p, end, token, sizeof(token)) || p != end) {
+            return 0;
+        }
+        reply_t *r = calloc(1, sizeof(*r));
+        if (!r) {
+            return 0;
+        }
+        r->due_ms = now_ms();
+        answer(r, get_u32(c->in + 5), last_audience, token);
+        c->queue[c->queued++] = r;
+        __atomic_add_fetch(&requests, 1, __ATOMIC_RELAXED);
+
+        c->have -= len + 4;
+        memmove(c->in, c->in + len + 4, c->have);
+    }
+    if (c->queued > __atomic_load_n(&max_pending, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&max_pending, c->queued, __ATOMIC_RELAXED);
+    }
+    return 1;
+}
+
+/* Send the answers that are due; 0 if the connection is to be closed */
+static int conn_flush(conn_t *c, uint64_t now) {
+    for (int q = 0; q < c->queued;) {
+        reply_t *r = c->queue[q];
+        if (r->due_ms > now) {
+            q++;
+            continue;
+        }
+        if (r->len == 0 || send(c->fd, r->frame, r->len, MSG_NOSIGNAL) != (ssize_t)r->len) {
+            return 0;
+        }
+        free(r);
+        c->queue[q] = c->queue[--c->queued];
+    }
+    return 1;
+}
+
+static void *serve(void *arg) {
+    (void)arg;
+
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        struct pollfd pfds[MAX_CONNECTIONS + 1];
+        int index[MAX_CONNECTIONS + 1];
+        int n = 0;
+        uint64_t now = now_ms();
+        uint64_t next = now + 20;
+
+        pfds[n].fd = listen_fd;
+        pfds[n++].events = POLLIN;
+        for (int i = 0; i < MAX_CONNECTIONS; i++) {
+            if (!conns[i]) {
+                continue;
+            }
+            for (int q = 0; q < conns[i]->queued; q++) {
+                if (conns[i]->queue[q]->due_ms < next) {
+                    next = conns[i]->queue[q]->due_ms;
+                }
+            }
+            index[n] = i;
+            pfds[n].fd = conns[i]->fd;
+            pfds[n++].events = POLLIN;
+        }
+        poll(pfds, (nfds_t)n, next > now ? (int)(next - now) : 0);
+
+        if (pfds[0].revents & POLLIN) {
+            int fd = accept(listen_fd, NULL, NULL);
+            int slot = -1;
+            for (int i = 0; i < MAX_CONNECTIONS && slot < 0 && fd >= 0; i++) {
+                slot = conns[i] ? -1 : i;
+            }
+            conn_t *c = slot >= 0 ? calloc(1, sizeof(*c)) : NULL;
+            if (c) {
+                c->fd = fd;
+                conns[slot] = c;
+                __atomic_add_fetch(&connections, 1, __ATOMIC_RELAXED);
+            } else if (fd >= 0) {
+                close(fd);
+            }
+        }
+        for (int k = 1; k < n; k++) {
+            conn_t *c = conns[index[k]];
+            if (pfds[k].revents & (POLLIN | POLLHUP | POLLERR)) {
+                ssize_t got = recv(c->fd, c->in + c->have, sizeof(c->in) - c->have, 0);
+                if (got <= 0 || (c->have += (size_t)got, !conn_read(c))) {
+                    conn_close(index[k]);
+                    continue;
+                }
+            }
+            if (!conn_flush(c, now_ms())) {
+                conn_close(index[k]);
+            }
+        }
+    }
+    return NULL;
+}
+
+int federated_daemon_start(const char *path) {
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return 0;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path));
+    unlink(path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, 64) != 0) {
+        if (listen_fd >= 0) {
+            close(listen_fd);
+        }
+        listen_fd = -1;
+        return 0;
+    }
+    snprintf(listen_path, sizeof(listen_path), "%s", path);
+    connections = 0;
+    requests = 0;
+    max_pending = 0;
+    last_audience[0] = '\0';
+    __atomic_store_n(&stopping, 0, __ATOMIC_RELEASE);
+    if (pthread_create(&thread, NULL, serve, NULL) != 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        return 0;
+    }
+    return 1;
+}
+
+void federated_daemon_stop(void) {
+    if (listen_fd < 0) {
+        return;
+    }
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (conns[i]) {
+            conn_close(i);
+        }
+    }
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(listen_path);
+}
+
+int federated_daemon_connections(void) {
+    return __atomic_load_n(&connections, __ATOMIC_RELAXED);
+}
+
+int federated_daemon_requests(void) {
+    return __atomic_load_n(&requests, __ATOMIC_RELAXED);
+}
+
+int federated_daemon_max_pending(void) {
+    return __atomic_load_n(&max_pending, __ATOMIC_RELAXED);
+}
+
+const char *federated_daemon_last_audience(void) {
+    return last_audience;
+}
+
+#ifdef FEDERATED_DAEMON_MAIN
+#include <signal.h>
+
+int main(int argc, char **argv) {
+    sigset_t signals;
+    int sig;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <socket>\n", argv[0]);
+        return 2;
+    }
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    if (!federated_daemon_start(argv[1])) {
+        fprintf(stderr, "cannot listen on %s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+    sigwait(&signals, &sig);
+    federated_daemon_stop();
+    return 0;
+}
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Stand-in Federated Validator
+ *
+ * Speaks federated_protocol.h on a Unix socket, for the tests of federated.c
+ * and for trying the federated backend without kube-federated-auth. Its
+ * verdicts follow from the token alone:
+ *
+ *   valid:<namespace>:<name>   VALID for that ServiceAccount, unless an
+ *                              audience other than "mariadb" is asked for
+ *   unavailable                UNAVAILABLE
+ *   garbage                    a RESULT of an unknown status
+ *   close                      the connection is closed
+ *   anything else              REJECTED
+ *
+ * A token prefixed with "delay=<ms>/" is answered that much later, while
+ * later requests are answered meanwhile.
+ */
+
+#ifndef FEDERATED_DAEMON_H
+#define FEDERATED_DAEMON_H
+
+/**
+ * Serve on a socket from a thread of its own
+ *
+ * @param path Socket path, replaced if it exists
+ * @return 1 if the daemon listens, 0 otherwise
+ */
+int federated_daemon_start(const char *path);
+
+/**
+ * Close every connection and the socket, and remove it
+ */
+void federated_daemon_stop(void);
+
+/**
+ * @return Connections accepted since the start
+ */
+int federated_daemon_connections(void);
+
+/**
+ * @return Requests read since the start
+ */
+int federated_daemon_requests(void);
+
+/**
+ * @return Most requests of one connection read at once and not answered yet
+ */
+int federated_daemon_max_pending(void);
+
+/**
+ * @return Audience of the last request, "" for none
+ */
+const char *federated_daemon_last_audience(void);
+
+#endif /* FEDERATED_DAEMON_H */
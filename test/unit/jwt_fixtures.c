@@ -0,0 +1,99 @@
+/*
+ * JWT Fixtures Implementation
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <string.h>
+#include <openssl/bn.h>
+#include <openssl/core_names.h>
+#include <openssl/ec.h>
+
+#include "jwt_fixtures.h"
+
+void jwt_fixture_b64url(const void *in, size_t len, char *out) {
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    const unsigned char *bytes = in;
+    size_t o = 0;
+    unsigned int acc = 0;
+    int bits = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        acc = (acc << 8) | bytes[i];
+        bits += 8;
+        while (bits >= 6) {
+            bits -= 6;
+            out[o++] = alphabet[(acc >> bits) & 63];
+        }
+    }
+    if (bits > 0) {
+        out[o++] = alphabet[(acc << (6 - bits)) & 63];
+    }
+    out[o] = '\0';
+}
+
+void jwt_fixture_b64url_bn(EVP_PKEY *pkey, const char *param, char *out) {
+    BIGNUM *bn = NULL;
+    unsigned char buf[512];
+    assert_int_equal(EVP_PKEY_get_bn_param(pkey, param, &bn), 1);
+    int len = BN_bn2bin(bn, buf);
+    jwt_fixture_b64url(buf, (size_t)len, out);
+    BN_free(bn);
+}
+
+void jwt_fixture_unsigned(const char *payload, char *out) {
+    static const char header[] = "{\"alg\":\"RS256\"}";
+    size_t o;
+
+    jwt_fixture_b64url(header, strlen(header), out);
+    o = strlen(out);
+    out[o++] = '.';
+    jwt_fixture_b64url(payload, strlen(payload), out + o);
+    strcat(out, ".c2ln");
+}
+
+void jwt_fixture_expiring(time_t exp, char *out) {
+    char payload[32];
+    snprintf(payload, sizeof(payload), "{\"exp\":%lld}", (long long)exp);
+    jwt_fixture_unsigned(payload, out);
+}
+
+void jwt_fixture_sign(EVP_PKEY *pkey, const char *alg, const char *kid, const char *payload,
+                      char *out) {
+    char header[128], sig_b64[700];
+    unsigned char sig[512];
+    size_t sig_len = sizeof(sig);
+    size_t o;
+
+    snprintf(header, sizeof(header), "{\"alg\":\"%s\",\"kid\":\"%s\"}", alg, kid);
+    jwt_fixture_b64url(header, strlen(header), out);
+    o = strlen(out);
+    out[o++] = '.';
+    jwt_fixture_b64url(payload, strlen(payload), out + o);
+
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    assert_int_equal(EVP_DigestSignInit(ctx, NULL, EVP_sha256(), NULL, pkey), 1);
+    assert_int_equal(EVP_DigestSign(ctx, sig, &sig_len, (const unsigned char *)out,
+                                    strlen(out)), 1);
+    EVP_MD_CTX_free(ctx);
+
+    if (strcmp(alg, "ES256") == 0) {
+        const unsigned char *p = sig;
+        unsigned char raw[64];
+        ECDSA_SIG *ecdsa = d2i_ECDSA_SIG(NULL, &p, (long)sig_len);
+        assert_non_null(ecdsa);
+        assert_int_equal(BN_bn2binpad(ECDSA_SIG_get0_r(ecdsa), raw, 32), 32);
+        assert_int_equal(BN_bn2binpad(ECDSA_SIG_get0_s(ecdsa), raw + 32, 32), 32);
+        ECDSA_SIG_free(ecdsa);
+        memcpy(sig, raw, 64);
+        sig_len = 64;
+    }
+
+    jwt_fixture_b64url(sig, sig_len, sig_b64);
+    strcat(out, ".");
+    strcat(out, sig_b64);
+}
@@ -0,0 +1,61 @@
+/*
+ * JWT Fixtures
+ *
+ * Tokens for the tests: unsigned ones, for code that only reads the
+ * claims, and ones signed with a test key, for code that verifies them.
+ */
+
+#ifndef JWT_FIXTURES_H
+#define JWT_FIXTURES_H
+
+#include <stddef.h>
+#include <time.h>
+#include <openssl/evp.h>
+
+/**
+ * Unpadded base64url
+ *
+ * @param in Bytes to encode
+ * @param len Number of bytes
+ * @param out Output, at least (len * 4 + 2) / 3 + 1 bytes
+ */
+void jwt_fixture_b64url(const void *in, size_t len, char *out);
+
+/**
+ * Unpadded base64url of a big-endian key parameter, e.g. an RSA modulus
+ *
+ * @param pkey Key
+ * @param param OSSL_PKEY_PARAM_* name
+ * @param out Output, at least 4 / 3 of the parameter's size plus 2 bytes
+ */
+void jwt_fixture_b64url_bn(EVP_PKEY *pkey, const char *param, char *out);
+
+/**
+ * Token with an RS256 header and a signature nothing verifies
+ *
+ * @param payload JSON claims
+ * @param out Output, at least 4 / 3 of the payload plus 32 bytes
+ */
+void jwt_fixture_unsigned(const char *payload, char *out);
+
+/**
+ * Unsigned token whose only claim is exp
+ *
+ * @param exp Expiry
+ * @param out Output, at least 64 bytes
+ */
+void jwt_fixture_expiring(time_t exp, char *out);
+
+/**
+ * Token signed with a key; ES256 signatures are converted to r || s
+ *
+ * @param pkey RSA key for RS256, P-256 key for ES256
+ * @param alg "RS256" or "ES256"
+ * @param kid Key id in the header
+ * @param payload JSON claims, at most 1024 bytes
+ * @param out Output, at least 2048 bytes
+ */
+void jwt_fixture_sign(EVP_PKEY *pkey, const char *alg, const char *kid, const char *payload,
+                      char *out);
+
+#endif /* JWT_FIXTURES_H */
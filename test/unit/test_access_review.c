@@ -0,0 +1,267 @@
+/*
+ * Unit tests for access_review.c using CMocka
+ *
+ * k8s_api_post() is replaced by a stub that records the review it was sent
+ * and answers with a canned response.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "access_review.h"
+#include "instrumentation.h"
+
+#define ALLOWED "{\"kind\":\"SubjectAccessReview\",\"status\":{\"allowed\":true}}"
+#define DENIED "{\"kind\":\"SubjectAccessReview\",\"status\":{\"allowed\":false," \
+               "\"reason\":\"no RBAC policy matched\"}}"
+
+static const char *response = ALLOWED;
+static char last_path[256];
+static char last_body[2048];
+static int posts = 0;
+
+/* Run while a review is in flight */
+static void (*during_post)(void) = NULL;
+
+char *k8s_api_post(const char *path, const char *body, const k8s_config_t *config) {
+    (void)config;
+    posts++;
+    snprintf(last_path, sizeof(last_path), "%s", path);
+    snprintf(last_body, sizeof(last_body), "%s", body);
+    if (during_post) {
+        during_post();
+    }
+    if (!response) {
+        return NULL;
+    }
+    char *copy = k8s_malloc(K8S_MEM_RESPONSE, strlen(response) + 1);
+    strcpy(copy, response);
+    return copy;
+}
+
+static k8s_access_t check(const char *namespace, const char *name, int *cached) {
+    k8s_config_t config;
+    memset(&config, 0, sizeof(config));
+    return k8s_access_review_check(NULL, namespace, name, "sa-uid", &config, cached);
+}
+
+static int setup(void **state) {
+    (void)state;
+    response = ALLOWED;
+    posts = 0;
+    during_post = NULL;
+    last_body[0] = '\0';
+    return 0;
+}
+
+static int teardown(void **state) {
+    (void)state;
+    k8s_access_review_shutdown();
+    return 0;
+}
+
+static void test_rules(void **state) {
+    (void)state;
+    const char *valid[] = {
+        "",
+        "connect databases.mariadb.example.com/orders",
+        "connect databases.mariadb.example.com",
+        "get pods",
+        "  get   configmaps/db-login  ",
+        "* *",
+    };
+    const char *invalid[] = {
+        "connect",
+        "connect databases extra",
+        "Connect databases",
+        "connect Databases",
+        "connect databases./orders",
+        "connect databases/",
+        "connect databases/orders/x",
+        "connect /orders",
+        "connect databases.example.com/ord ers",
+    };
+
+    assert_int_equal(k8s_access_review_valid(NULL), 1);
+    for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+        assert_int_equal(k8s_access_review_valid(valid[i]), 1);
+    }
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        assert_int_equal(k8s_access_review_valid(invalid[i]), 0);
+    }
+}
+
+static void test_disabled(void **state) {
+    (void)state;
+    assert_int_equal(k8s_access_review_configure("", 60), 1);
+    assert_int_equal(k8s_access_review_enabled(), 0);
+    assert_int_equal(check("team-a", "app", NULL), K8S_ACCESS_ALLOWED);
+    assert_int_equal(posts, 0);
+}
+
+static void test_review(void **state) {
+    (void)state;
+    int cached = -1;
+
+    assert_int_equal(k8s_access_review_configure("connect databases.mariadb.example.com/orders",
+                                                 60), 1);
+    assert_int_equal(k8s_access_review_enabled(), 1);
+    assert_int_equal(check("team-a", "app", &cached), K8S_ACCESS_ALLOWED);
+    assert_int_equal(cached, 0);
+    assert_int_equal(posts, 1);
+
+    assert_string_equal(last_path, "/apis/authorization.k8s.io/v1/subjectaccessreviews");
+    assert_non_null(strstr(last_body, "\"SubjectAccessReview\""));
+    assert_non_null(strstr(last_body, "system:serviceaccount:team-a:app"));
+    assert_non_null(strstr(last_body, "system:serviceaccounts:team-a"));
+    assert_non_null(strstr(last_body, "\"sa-uid\""));
+    assert_non_null(strstr(last_body, "\"connect\""));
+    assert_non_null(strstr(last_body, "\"databases\""));
+    assert_non_null(strstr(last_body, "\"mariadb.example.com\""));
+    assert_non_null(strstr(last_body, "\"orders\""));
+}
+
+static void test_cached_decisions(void **state) {
+    (void)state;
+    int cached = 0;
+
+    k8s_access_review_configure("connect databases.mariadb.example.com", 60);
+    response = DENIED;
+    assert_int_equal(check("team-a", "app", NULL), K8S_ACCESS_DENIED);
+
+    /* Denials are reused as well */
+    response = ALLOWED;
+    assert_int_equal(check("team-a", "app", &cached), K8S_ACCESS_DENIED);
+    assert_int_equal(cached, 1);
+    assert_int_equal(posts, 1);
+
+    assert_int_equal(check("team-a", "worker", NULL), K8S_ACCESS_ALLOWED);
+    assert_int_equal(posts, 2);
+    assert_int_equal(k8s_access_review_cached(), 2);
+
+    /* The TTL alone does not change what is cached */
+    k8s_access_review_configure("connect databases.mariadb.example.com", 120);
+    assert_int_equal(k8s_access_review_cached(), 2);
+
+    /* A new rule does */
+    k8s_access_review_configure("connect databases.mariadb.example.com/orders", 120);
+    assert_int_equal(k8s_access_review_cached(), 0);
+    assert_int_equal(check("team-a", "app", NULL), K8S_ACCESS_ALLOWED);
+    assert_int_equal(posts, 3);
+}
+
+static void test_no_ttl(void **state) {
+    (void)state;
+    k8s_access_review_configure("get pods", 0);
+    check("team-a", "app", NULL);
+    check("team-a", "app", NULL);
+    assert_int_equal(posts, 2);
+    assert_int_equal(k8s_access_review_cached(), 0);
+}
+
+static void test_errors(void **state) {
+    (void)state;
+    k8s_access_review_configure("get pods", 60);
+
+    /* Errors are not remembered */
+    response = NULL;
+    assert_int_equal(check("team-a", "app", NULL), K8S_ACCESS_ERROR);
+    response = "{\"status\":{}}";
+    assert_int_equal(check("team-a", "app", NULL), K8S_ACCESS_ERROR);
+    response = "not json";
+    assert_int_equal(check("team-a", "app", NULL), K8S_ACCESS_ERROR);
+    assert_int_equal(k8s_access_review_cached(), 0);
+
+    response = ALLOWED;
+    assert_int_equal(check("team-a", "app", NULL), K8S_ACCESS_ALLOWED);
+    assert_int_equal(posts, 4);
+
+    /* A rule that cannot be used refuses every login */
+    assert_int_equal(k8s_access_review_configure("get", 60), 0);
+    assert_int_equal(k8s_access_review_enabled(), 1);
+    assert_int_equal(check("team-a", "app", NULL), K8S_ACCESS_ERROR);
+    assert_int_equal(posts, 4);
+}
+
+static void test_invalidate(void **state) {
+    (void)state;
+    k8s_access_review_configure("get pods", 60);
+    check("team-a", "app", NULL);
+    check("team-a", "worker", NULL);
+    check("team-ab", "app", NULL);
+    check("team-b", "app", NULL);
+    assert_int_equal(k8s_access_review_cached(), 4);
+
+    /* A RoleBinding only grants within its own namespace */
+    k8s_access_review_invalidate("team-a");
+    assert_int_equal(k8s_access_review_cached(), 2);
+    check("team-ab", "app", NULL);
+    assert_int_equal(posts, 4);
+
+    /* A ClusterRoleBinding may affect everyone */
+    k8s_access_review_invalidate(NULL);
+    assert_int_equal(k8s_access_review_cached(), 0);
+}
+
+static void test_clusters(void **state) {
+    (void)state;
+    k8s_config_t config;
+    memset(&config, 0, sizeof(config));
+    k8s_access_review_configure("get pods", 60);
+
+    /* The same name in another cluster is another ServiceAccount */
+    check("team-a", "app", NULL);
+    response = DENIED;
+    assert_int_equal(k8s_access_review_check("east", "team-a", "app", "", &config, NULL),
+                     K8S_ACCESS_DENIED);
+    assert_int_equal(check("team-a", "app", NULL), K8S_ACCESS_ALLOWED);
+    assert_int_equal(posts, 2);
+
+    /* Watches only see the local cluster's RoleBindings */
+    k8s_access_review_invalidate("team-a");
+    assert_int_equal(k8s_access_review_cached(), 1);
+    k8s_access_review_invalidate("east");
+    assert_int_equal(k8s_access_review_cached(), 1);
+    k8s_access_review_invalidate(NULL);
+    assert_int_equal(k8s_access_review_cached(), 0);
+}
+
+static void invalidate_all(void) {
+    k8s_access_review_invalidate(NULL);
+}
+
+static void test_invalidated_in_flight(void **state) {
+    (void)state;
+    k8s_access_review_configure("get pods", 60);
+
+    /* The binding changed while the review was being answered */
+    during_post = invalidate_all;
+    assert_int_equal(check("team-a", "app", NULL), K8S_ACCESS_ALLOWED);
+    assert_int_equal(k8s_access_review_cached(), 0);
+
+    during_post = NULL;
+    check("team-a", "app", NULL);
+    assert_int_equal(k8s_access_review_cached(), 1);
+    assert_int_equal(posts, 2);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_rules, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_disabled, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_review, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_cached_decisions, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_no_ttl, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_errors, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_invalidate, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_clusters, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_invalidated_in_flight, setup, teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
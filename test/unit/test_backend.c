@@ -0,0 +1,437 @@
+/*
+ * Unit tests for backend.c using CMocka
+ *
+ * TokenReview, the local signature check and the federated validator are
+ * replaced by stubs whose answers each test sets.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "backend.h"
+#include "jwks.h"
+#include "federated.h"
+
+static int review_answers = 1;      /* 0: the API server is unreachable */
+static int review_valid = 1;
+static int reviews = 0;
+static int batches = 0;
+static int last_timeout = 0;
+
+static int keys = 1;
+static int local_valid = 1;
+static int local_checks = 0;
+
+static int validator_ready = 1;
+static int validator_answers = 1;
+static int validator_calls = 0;
+static int last_timeout_ms = 0;
+static const char *last_audience = NULL;
+
+static void identity(k8s_token_info_t *info) {
+    snprintf(info->namespace, sizeof(info->namespace), "default");
+    snprintf(info->service_account, sizeof(info->service_account), "app");
+}
+
+int k8s_validate_token(const char *token, k8s_token_info_t *info, const k8s_config_t *config) {
+    (void)token;
+    reviews++;
+    last_timeout = config->timeout_seconds;
+    memset(info, 0, sizeof(*info));
+    if (!review_answers) {
+        return 0;
+    }
+    info->reviewed = 1;
+    info->authenticated = review_valid;
+    if (review_valid) {
+        identity(info);
+    }
+    return review_valid;
+}
+
+int k8s_validate_tokens(const char *const *tokens, int count, k8s_token_info_t *infos,
+                        const k8s_config_t *config, int concurrency) {
+    int verdicts = 0;
+    (void)concurrency;
+    batches++;
+    for (int i = 0; i < count; i++) {
+        if (tokens[i]) {
+            k8s_validate_token(tokens[i], &infos[i], config);
+            verdicts += infos[i].reviewed;
+        }
+    }
+    return verdicts;
+}
+
+int k8s_jwks_verify(const char *token, k8s_token_info_t *info) {
+    (void)token;
+    local_checks++;
+    if (!local_valid) {
+        return 0;
+    }
+    info->authenticated = 1;
+    identity(info);
+    return 1;
+}
+
+int k8s_jwks_count(void) {
+    return keys;
+}
+
+int k8s_federated_ready(void) {
+    return validator_ready;
+}
+
+int k8s_federated_validate(const char *cluster, const char *token, const char *audience,
+                           k8s_token_info_t *info, int timeout_ms) {
+    (void)cluster;
+    (void)token;
+    validator_calls++;
+    last_timeout_ms = timeout_ms;
+    last_audience = audience;
+    memset(info, 0, sizeof(*info));
+    if (!validator_answers) {
+        return 0;
+    }
+    info->reviewed = 1;
+    info->authenticated = 1;
+    identity(info);
+    return 1;
+}
+
+int k8s_federated_validate_batch(const char *const *tokens, int count, const char *audience,
+                                 k8s_token_info_t *infos, int timeout_ms, int concurrency) {
+    int verdicts = 0;
+    (void)concurrency;
+    for (int i = 0; i < count; i++) {
+        if (tokens[i]) {
+            k8s_federated_validate(NULL, tokens[i], audience, &infos[i], timeout_ms);
+            verdicts += infos[i].reviewed;
+        }
+    }
+    return verdicts;
+}
+
+static k8s_backend_chain_t chain;
+
+static k8s_config_t config_for(const char *spec) {
+    k8s_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.timeout_seconds = 10;
+    if (spec) {
+        assert_int_equal(k8s_backend_chain_parse(spec, &chain), 1);
+        config.backends = &chain;
+    }
+    return config;
+}
+
+static const k8s_backend_t *find(const char *name) {
+    for (int i = 0; i < k8s_backend_count(); i++) {
+        if (strcmp(k8s_backend_get(i)->name, name) == 0) {
+            return k8s_backend_get(i);
+        }
+    }
+    return NULL;
+}
+
+static int setup(void **state) {
+    (void)state;
+    review_answers = 1;
+    review_valid = 1;
+    reviews = 0;
+    batches = 0;
+    last_timeout = 0;
+    keys = 1;
+    local_valid = 1;
+    local_checks = 0;
+    validator_ready = 1;
+    validator_answers = 1;
+    validator_calls = 0;
+    last_timeout_ms = 0;
+    last_audience = NULL;
+    return 0;
+}
+
+static void test_parse(void **state) {
+    (void)state;
+    const char *invalid[] = {
+        "",
+        " ",
+        "tokenreview,",
+        ",tokenreview",
+        "tokenreview jwks",
+        "tokenreview, tokenreview",
+        "tokenreview:0",
+        "tokenreview:301",
+        "tokenreview:",
+        "tokenreview:5s",
+        "tokenreview:-1",
+        "tokenreview:0005",
+        "TokenReview",
+        "webhook",
+        "federated:",
+    };
+    k8s_backend_chain_t parsed;
+
+    assert_int_equal(k8s_backend_chain_parse("tokenreview", &parsed), 1);
+    assert_int_equal(parsed.count, 1);
+    assert_string_equal(parsed.entries[0].backend->name, "tokenreview");
+    assert_int_equal(parsed.entries[0].timeout, 0);
+
+    assert_int_equal(k8s_backend_chain_parse(" jwks:1 ,tokenreview:300 ", &parsed), 1);
+    assert_int_equal(parsed.count, 2);
+    assert_string_equal(parsed.entries[0].backend->name, "jwks");
+    assert_int_equal(parsed.entries[0].timeout, 1);
+    assert_string_equal(parsed.entries[1].backend->name, "tokenreview");
+    assert_int_equal(parsed.entries[1].timeout, 300);
+
+    assert_int_equal(k8s_backend_chain_parse(NULL, NULL), 0);
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        assert_int_equal(k8s_backend_chain_parse(invalid[i], NULL), 0);
+    }
+
+    int timeout = -1;
+    assert_int_equal(k8s_backend_chain_find(&parsed, "tokenreview", &timeout), 1);
+    assert_int_equal(timeout, 300);
+    assert_int_equal(k8s_backend_chain_find(NULL, "tokenreview", NULL), 1);
+    assert_int_equal(k8s_backend_chain_find(NULL, "jwks", NULL), 0);
+}
+
+static void test_default_chain(void **state) {
+    (void)state;
+    k8s_config_t config = config_for(NULL);
+    k8s_token_info_t info;
+    const k8s_backend_t *used = NULL;
+
+    assert_int_equal(k8s_backend_validate("token", &info, &config, 0, &used), 1);
+    assert_ptr_equal(used, find("tokenreview"));
+    assert_int_equal(used->authoritative, 1);
+    assert_int_equal(reviews, 1);
+    assert_int_equal(last_timeout, 10);
+    assert_int_equal(local_checks, 0);
+    assert_string_equal(info.service_account, "app");
+}
+
+static void test_fallback(void **state) {
+    (void)state;
+    k8s_config_t config = config_for("jwks, tokenreview:3");
+    k8s_token_info_t info;
+    const k8s_backend_t *used = NULL;
+
+    /* Verified locally: the API server is not asked */
+    assert_int_equal(k8s_backend_validate("token", &info, &config, 0, &used), 1);
+    assert_ptr_equal(used, find("jwks"));
+    assert_int_equal(info.reviewed, 1);
+    assert_int_equal(local_checks, 1);
+    assert_int_equal(reviews, 0);
+
+    /* Not verified locally: TokenReview decides, within its own timeout */
+    local_valid = 0;
+    review_valid = 0;
+    assert_int_equal(k8s_backend_validate("token", &info, &config, 0, &used), 0);
+    assert_ptr_equal(used, find("tokenreview"));
+    assert_int_equal(info.reviewed, 1);
+    assert_int_equal(reviews, 1);
+    assert_int_equal(last_timeout, 3);
+
+    /* No keys yet: not even tried */
+    keys = 0;
+    review_valid = 1;
+    assert_int_equal(k8s_backend_validate("token", &info, &config, 0, &used), 1);
+    assert_int_equal(local_checks, 2);
+    assert_int_equal(reviews, 2);
+}
+
+static void test_rejection_is_final(void **state) {
+    (void)state;
+    k8s_config_t config = config_for("tokenreview, jwks");
+    k8s_token_info_t info;
+    const k8s_backend_t *used = NULL;
+
+    review_valid = 0;
+    assert_int_equal(k8s_backend_validate("token", &info, &config, 0, &used), 0);
+    assert_int_equal(info.reviewed, 1);
+    assert_int_equal(info.authenticated, 0);
+    assert_ptr_equal(used, find("tokenreview"));
+    assert_int_equal(local_checks, 0);
+
+    /* No answer is not a rejection */
+    review_answers = 0;
+    assert_int_equal(k8s_backend_validate("token", &info, &config, 0, &used), 1);
+    assert_ptr_equal(used, find("jwks"));
+    assert_int_equal(local_checks, 1);
+
+    /* Nobody had an answer */
+    local_valid = 0;
+    assert_int_equal(k8s_backend_validate("token", &info, &config, 0, &used), 0);
+    assert_int_equal(info.reviewed, 0);
+    assert_null(used);
+
+    /* Leave TokenReview healthy for the tests that follow */
+    review_answers = 1;
+    k8s_backend_validate("token", &info, &config, 0, NULL);
+}
+
+static void test_authoritative_only(void **state) {
+    (void)state;
+    k8s_config_t config = config_for("jwks, tokenreview");
+    k8s_token_info_t info;
+    const k8s_backend_t *used = NULL;
+
+    assert_int_equal(k8s_backend_validate("token", &info, &config, 1, &used), 1);
+    assert_ptr_equal(used, find("tokenreview"));
+    assert_int_equal(local_checks, 0);
+
+    /* A chain without an authoritative backend has no answer */
+    config = config_for("jwks");
+    assert_int_equal(k8s_backend_validate("token", &info, &config, 1, &used), 0);
+    assert_int_equal(info.reviewed, 0);
+    assert_null(used);
+    assert_int_equal(local_checks, 0);
+    assert_int_equal(reviews, 1);
+}
+
+static void test_federated(void **state) {
+    (void)state;
+    k8s_config_t config = config_for("federated:1, tokenreview");
+    k8s_token_info_t info;
+    const k8s_backend_t *used = NULL;
+
+    /* Authoritative: asked for strict logins, with the audience and timeout */
+    config.audience = "mariadb";
+    assert_int_equal(k8s_backend_validate("token", &info, &config, 1, &used), 1);
+    assert_ptr_equal(used, find("federated"));
+    assert_int_equal(used->authoritative, 1);
+    assert_int_equal(last_timeout_ms, 1000);
+    assert_string_equal(last_audience, "mariadb");
+    assert_int_equal(reviews, 0);
+
+    /* No answer from the validator: TokenReview decides */
+    validator_answers = 0;
+    assert_int_equal(k8s_backend_validate("token", &info, &config, 0, &used), 1);
+    assert_ptr_equal(used, find("tokenreview"));
+    assert_int_equal(reviews, 1);
+
+    /* Not configured or not reachable: not even tried */
+    validator_ready = 0;
+    assert_int_equal(k8s_backend_validate("token", &info, &config, 0, &used), 1);
+    assert_int_equal(validator_calls, 2);
+    assert_int_equal(reviews, 2);
+
+    /* Revalidation goes to it first too */
+    const char *tokens[] = { "a", "b" };
+    k8s_token_info_t infos[2];
+    validator_ready = 1;
+    validator_answers = 1;
+    assert_int_equal(k8s_backend_validate_batch(tokens, 2, infos, &config, 4), 2);
+    assert_int_equal(validator_calls, 4);
+    assert_int_equal(batches, 0);
+}
+
+static void test_batch(void **state) {
+    (void)state;
+    k8s_config_t config = config_for("jwks, tokenreview:2");
+    const char *tokens[] = { "a", NULL, "b" };
+    k8s_token_info_t infos[3];
+
+    /* Revalidation is about revocation: only TokenReview knows */
+    assert_int_equal(k8s_backend_validate_batch(tokens, 3, infos, &config, 4), 2);
+    assert_int_equal(batches, 1);
+    assert_int_equal(local_checks, 0);
+    assert_int_equal(last_timeout, 2);
+    assert_int_equal(infos[0].authenticated, 1);
+    assert_int_equal(infos[1].reviewed, 0);
+
+    review_answers = 0;
+    assert_int_equal(k8s_backend_validate_batch(tokens, 3, infos, &config, 4), 0);
+    assert_int_equal(infos[0].reviewed, 0);
+
+    config = config_for("jwks");
+    assert_int_equal(k8s_backend_validate_batch(tokens, 3, infos, &config, 4), 0);
+    assert_int_equal(batches, 2);
+
+    review_answers = 1;
+    config = config_for(NULL);
+    assert_int_equal(k8s_backend_validate_batch(tokens, 3, infos, &config, 4), 2);
+}
+
+static void test_stats(void **state) {
+    (void)state;
+    k8s_config_t config = config_for("tokenreview, jwks");
+    const k8s_backend_t *tokenreview = find("tokenreview");
+    k8s_backend_stats_t before;
+    k8s_backend_stats_t after;
+    k8s_token_info_t info;
+
+    assert_int_equal(k8s_backend_count(), 3);
+    assert_null(k8s_backend_get(k8s_backend_count()));
+
+    tokenreview->stats(&before);
+    k8s_backend_validate("token", &info, &config, 0, NULL);
+    review_valid = 0;
+    k8s_backend_validate("token", &info, &config, 0, NULL);
+    review_answers = 0;
+    k8s_backend_validate("token", &info, &config, 0, NULL);
+    tokenreview->stats(&after);
+
+    assert_int_equal(after.requests - before.requests, 3);
+    assert_int_equal(after.verdicts - before.verdicts, 2);
+    assert_int_equal(after.accepted - before.accepted, 1);
+    assert_int_equal(after.unavailable - before.unavailable, 1);
+    assert_int_equal(after.healthy, 1);
+
+    review_answers = 1;
+    k8s_backend_validate("token", &info, &config, 0, NULL);
+}
+
+static void test_unresponsive(void **state) {
+    (void)state;
+    k8s_config_t config = config_for("tokenreview, jwks");
+    const k8s_backend_t *tokenreview = find("tokenreview");
+    k8s_backend_stats_t stats;
+    k8s_token_info_t info;
+    const k8s_backend_t *used = NULL;
+
+    review_answers = 0;
+    for (int i = 0; i < K8S_BACKEND_FAILURES; i++) {
+        k8s_backend_validate("token", &info, &config, 0, NULL);
+    }
+    assert_int_equal(reviews, K8S_BACKEND_FAILURES);
+    tokenreview->stats(&stats);
+    assert_int_equal(stats.healthy, 0);
+
+    /* Passed over while it has a fallback */
+    assert_int_equal(k8s_backend_validate("token", &info, &config, 0, &used), 1);
+    assert_ptr_equal(used, find("jwks"));
+    assert_int_equal(reviews, K8S_BACKEND_FAILURES);
+
+    /* Still asked when it is the only one */
+    config = config_for("tokenreview");
+    review_answers = 1;
+    assert_int_equal(k8s_backend_validate("token", &info, &config, 0, &used), 1);
+    assert_int_equal(reviews, K8S_BACKEND_FAILURES + 1);
+
+    /* A verdict makes it healthy again */
+    tokenreview->stats(&stats);
+    assert_int_equal(stats.healthy, 1);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup(test_parse, setup),
+        cmocka_unit_test_setup(test_default_chain, setup),
+        cmocka_unit_test_setup(test_fallback, setup),
+        cmocka_unit_test_setup(test_rejection_is_final, setup),
+        cmocka_unit_test_setup(test_authoritative_only, setup),
+        cmocka_unit_test_setup(test_federated, setup),
+        cmocka_unit_test_setup(test_batch, setup),
+        cmocka_unit_test_setup(test_stats, setup),
+        cmocka_unit_test_setup(test_unresponsive, setup),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,159 @@
+/*
+ * Unit tests for ca_store.c using CMocka
+ *
+ * Writes PEM bundles to a temporary directory and swaps them with rename(),
+ * the same way the kubelet updates mounted secrets.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ca_store.h"
+
+#define CERT_A \
+    "-----BEGIN CERTIFICATE-----\n" \
+    "MIIBkzCCATmgAwIBAgIUI3UJPFwMZWoqeCuVBk5h/jEv1NMwCgYIKoZIzj0EAwIw\n" \
+    "FDESMBAGA1UEAwwJbG9jYWxob3N0MB4XDTI2MTAxNjE1NDkyNVoXDTM2MTAxMzE1\n" \
+    "NDkyNVowFDESMBAGA1UEAwwJbG9jYWxob3N0MFkwEwYHKoZIzj0CAQYIKoZIzj0D\n" \
+    "AQcDQgAEmL4ErhWXxOWy32lLGbdWWLKFQkxtguqrSz1r0YKgOzEAuM/rQNzsNHLR\n" \
+    "IGG2pOhNdalQcKT142XZpy+3kRx/+KNpMGcwHQYDVR0OBBYEFK3muwaIRl9nnsgq\n" \
+    "kDvrhqe1BGZlMB8GA1UdIwQYMBaAFK3muwaIRl9nnsgqkDvrhqe1BGZlMA8GA1Ud\n" \
+    "EwEB/wQFMAMBAf8wFAYDVR0RBA0wC4IJbG9jYWxob3N0MAoGCCqGSM49BAMCA0gA\n" \
+    "MEUCIFxk5lzvMQ0FiSaRRk7CbRe5rPyPWQ895NCOCbrGe+WtAiEA6Ug2ymItlI1K\n" \
+    "HqEiOEUzUhKRtI9DB0JBT/1R3JQPQVA=\n" \
+    "-----END CERTIFICATE-----\n"
+
+#define CERT_B \
+    "-----BEGIN CERTIFICATE-----\n" \
+    "MIIBgDCCASWgAwIBAgIUcL+Bd9j5YcfucUm7cqSnRBPUXyEwCgYIKoZIzj0EAwIw\n" \
+    "FDESMBAGA1UEAwwJdGVzdC1jYS0yMCAXDTI2MTAxNjE1NDkyNVoYDzIxMjYwOTIy\n" \
+    "MTU0OTI1WjAUMRIwEAYDVQQDDAl0ZXN0LWNhLTIwWTATBgcqhkjOPQIBBggqhkjO\n" \
+    "PQMBBwNCAARsw1pCTZmHhzy4RrA5C/YoubrsgTx/3p3m8NzelmvfJOatupFX9ChA\n" \
+    "J6FeXueRfLhMeIJr+yLw4phnsoKyfH/bo1MwUTAdBgNVHQ4EFgQUY3a/EbjBjTOW\n" \
+    "IKgSORD14VQdyUwwHwYDVR0jBBgwFoAUY3a/EbjBjTOWIKgSORD14VQdyUwwDwYD\n" \
+    "VR0TAQH/BAUwAwEB/zAKBggqhkjOPQQDAgNJADBGAiEAzN7I6jt1h0MYfrv0O73f\n" \
+    "tEItot4Ca97bVdTKXhsiAaECIQD95wbAFVnEjhp0+0Gf+cQ1OgTV4NOCA8hg/dfk\n" \
+    "1RRHPA==\n" \
+    "-----END CERTIFICATE-----\n"
+
+static char tmp_dir[64];
+static char ca_path[128];
+
+/* Replace the bundle atomically, like the kubelet's symlink swap */
+static void write_bundle(const char *content) {
+    char tmp_path[160];
+    snprintf(tmp_path, sizeof(tmp_path), "%s/ca.crt.tmp", tmp_dir);
+    FILE *fp = fopen(tmp_path, "w");
+    assert_non_null(fp);
+    fputs(content, fp);
+    fclose(fp);
+    assert_int_equal(rename(tmp_path, ca_path), 0);
+}
+
+static int test_setup(void **state) {
+    (void)state;
+    strcpy(tmp_dir, "/tmp/test_ca_store.XXXXXX");
+    if (!mkdtemp(tmp_dir)) {
+        return -1;
+    }
+    snprintf(ca_path, sizeof(ca_path), "%s/ca.crt", tmp_dir);
+    return 0;
+}
+
+static int test_teardown(void **state) {
+    (void)state;
+    unlink(ca_path);
+    rmdir(tmp_dir);
+    return 0;
+}
+
+static void test_create_missing_file(void **state) {
+    (void)state;
+    assert_null(k8s_ca_store_create(ca_path));
+    assert_null(k8s_ca_store_create(NULL));
+}
+
+static void test_create_no_certificates(void **state) {
+    (void)state;
+    write_bundle("not a certificate\n");
+    assert_null(k8s_ca_store_create(ca_path));
+}
+
+static void test_create_single_certificate(void **state) {
+    (void)state;
+    write_bundle(CERT_A);
+    k8s_ca_store_t *store = k8s_ca_store_create(ca_path);
+    assert_non_null(store);
+    assert_int_equal(k8s_ca_store_count(store), 1);
+    k8s_ca_store_destroy(store);
+}
+
+static void test_create_bundle(void **state) {
+    (void)state;
+    write_bundle(CERT_A CERT_B);
+    k8s_ca_store_t *store = k8s_ca_store_create(ca_path);
+    assert_non_null(store);
+    assert_int_equal(k8s_ca_store_count(store), 2);
+    k8s_ca_store_destroy(store);
+}
+
+static void test_reload_unchanged(void **state) {
+    (void)state;
+    write_bundle(CERT_A);
+    k8s_ca_store_t *store = k8s_ca_store_create(ca_path);
+    assert_non_null(store);
+    assert_int_equal(k8s_ca_store_reload(store), 0);
+    assert_int_equal(k8s_ca_store_count(store), 1);
+    k8s_ca_store_destroy(store);
+}
+
+static void test_reload_changed(void **state) {
+    (void)state;
+    write_bundle(CERT_A);
+    k8s_ca_store_t *store = k8s_ca_store_create(ca_path);
+    assert_non_null(store);
+
+    write_bundle(CERT_A CERT_B);
+    assert_int_equal(k8s_ca_store_reload(store), 1);
+    assert_int_equal(k8s_ca_store_count(store), 2);
+
+    /* Second check sees the same file again */
+    assert_int_equal(k8s_ca_store_reload(store), 0);
+    k8s_ca_store_destroy(store);
+}
+
+static void test_reload_keeps_previous_on_bad_file(void **state) {
+    (void)state;
+    write_bundle(CERT_A CERT_B);
+    k8s_ca_store_t *store = k8s_ca_store_create(ca_path);
+    assert_non_null(store);
+
+    write_bundle("garbage\n");
+    assert_int_equal(k8s_ca_store_reload(store), 0);
+    assert_int_equal(k8s_ca_store_count(store), 2);
+
+    unlink(ca_path);
+    assert_int_equal(k8s_ca_store_reload(store), 0);
+    assert_int_equal(k8s_ca_store_count(store), 2);
+    k8s_ca_store_destroy(store);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_create_missing_file, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_create_no_certificates, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_create_single_certificate, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_create_bundle, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_reload_unchanged, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_reload_changed, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_reload_keeps_previous_on_bad_file, test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,370 @@
+/*
+ * Unit tests for cluster.c using CMocka
+ *
+ * The connection pool is replaced by stubs that count the pools opened and
+ * closed, so no request leaves the test. Registry files are swapped in with
+ * rename(), as for the denylist.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cluster.h"
+#include "http_pool.h"
+
+static char tmp_dir[64];
+static char registry_path[128];
+static int pools_created = 0;
+static int pools_destroyed = 0;
+static int pings = 0;
+
+/* ===== Stubs ===== */
+
+struct k8s_http_pool {
+    int size;
+};
+
+k8s_http_pool_t *k8s_http_pool_create(const k8s_config_t *config, int size) {
+    (void)config;
+    k8s_http_pool_t *pool = calloc(1, sizeof(*pool));
+    pool->size = size;
+    pools_created++;
+    return pool;
+}
+
+void k8s_http_pool_destroy(k8s_http_pool_t *pool) {
+    if (pool) {
+        pools_destroyed++;
+        free(pool);
+    }
+}
+
+int k8s_http_pool_ping(k8s_http_pool_t *pool, int idle_seconds) {
+    (void)idle_seconds;
+    pings++;
+    return pool->size;
+}
+
+int k8s_http_pool_resolve(k8s_http_pool_t *pool) {
+    (void)pool;
+    return 0;
+}
+
+int k8s_http_pool_refresh_credential(k8s_http_pool_t *pool) {
+    (void)pool;
+    return 1;
+}
+
+int k8s_http_pool_reload_ca(k8s_http_pool_t *pool) {
+    (void)pool;
+    return 0;
+}
+
+void k8s_config_init_default(k8s_config_t *config) {
+    memset(config, 0, sizeof(*config));
+    config->timeout_seconds = 10;
+}
+
+char *k8s_read_file(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return NULL;
+    }
+    char *content = calloc(1, 65536);
+    size_t n = fread(content, 1, 65535, fp);
+    content[n] = '\0';
+    fclose(fp);
+    return content;
+}
+
+/* ===== Helpers ===== */
+
+static void write_registry(const char *content) {
+    char tmp_path[160];
+    snprintf(tmp_path, sizeof(tmp_path), "%s/clusters.tmp", tmp_dir);
+    FILE *fp = fopen(tmp_path, "w");
+    assert_non_null(fp);
+    fputs(content, fp);
+    fclose(fp);
+    assert_int_equal(rename(tmp_path, registry_path), 0);
+}
+
+static void load(const char *content) {
+    write_registry(content);
+    k8s_cluster_configure(registry_path);
+    assert_int_equal(k8s_cluster_reload(), 1);
+}
+
+static int test_setup(void **state) {
+    (void)state;
+    strcpy(tmp_dir, "/tmp/test_cluster.XXXXXX");
+    if (!mkdtemp(tmp_dir)) {
+        return -1;
+    }
+    snprintf(registry_path, sizeof(registry_path), "%s/clusters", tmp_dir);
+    pools_created = 0;
+    pools_destroyed = 0;
+    pings = 0;
+    return 0;
+}
+
+static int test_teardown(void **state) {
+    (void)state;
+    k8s_cluster_shutdown();
+    unlink(registry_path);
+    rmdir(tmp_dir);
+    return 0;
+}
+
+#define EAST "east https://east.example.com:6443 /etc/east/ca.crt /etc/east/token\n"
+#define WEST "west https://west.example.com /etc/west/ca.crt /etc/west/token " \
+             "timeout=2 pool_size=4 max_inflight=2\n"
+
+/* ===== User names ===== */
+
+static void test_split_user(void **state) {
+    (void)state;
+    char cluster[K8S_CLUSTER_NAME_MAX + 1];
+    const char *identity = NULL;
+
+    assert_int_equal(k8s_cluster_split_user("default/app", cluster, &identity), 1);
+    assert_string_equal(cluster, K8S_CLUSTER_LOCAL);
+    assert_string_equal(identity, "default/app");
+
+    assert_int_equal(k8s_cluster_split_user("east/default/app", cluster, &identity), 1);
+    assert_string_equal(cluster, "east");
+    assert_string_equal(identity, "default/app");
+
+    assert_int_equal(k8s_cluster_split_user("local/default/app", cluster, &identity), 1);
+    assert_string_equal(cluster, K8S_CLUSTER_LOCAL);
+    assert_string_equal(identity, "default/app");
+
+    /* Not a ServiceAccount name at all: left to the user name check */
+    assert_int_equal(k8s_cluster_split_user("root", cluster, &identity), 1);
+    assert_string_equal(cluster, K8S_CLUSTER_LOCAL);
+    assert_string_equal(identity, "root");
+    assert_int_equal(k8s_cluster_split_user("a/b/c/d", cluster, &identity), 1);
+    assert_string_equal(cluster, K8S_CLUSTER_LOCAL);
+
+    assert_int_equal(k8s_cluster_split_user("East/default/app", cluster, &identity), 0);
+    assert_int_equal(k8s_cluster_split_user("/default/app", cluster, &identity), 0);
+}
+
+/* ===== Registry file ===== */
+
+static void test_disabled(void **state) {
+    (void)state;
+    k8s_cluster_lease_t lease;
+
+    assert_int_equal(k8s_cluster_reload(), 0);
+    assert_int_equal(k8s_cluster_count(), 0);
+    assert_int_equal(k8s_cluster_acquire("east", &lease), K8S_CLUSTER_UNKNOWN);
+}
+
+static void test_load(void **state) {
+    (void)state;
+    k8s_cluster_lease_t lease;
+
+    load("# remote clusters\n\n" EAST WEST);
+    assert_int_equal(k8s_cluster_count(), 2);
+    assert_int_equal(pools_created, 2);
+    assert_int_equal(pings, 2);
+
+    assert_int_equal(k8s_cluster_acquire("east", &lease), K8S_CLUSTER_OK);
+    assert_string_equal(lease.config.api_server_url, "https://east.example.com:6443");
+    assert_string_equal(lease.config.ca_cert_path, "/etc/east/ca.crt");
+    assert_string_equal(lease.config.token_path, "/etc/east/token");
+    assert_int_equal(lease.config.timeout_seconds, K8S_CLUSTER_DEFAULT_TIMEOUT);
+    assert_non_null(lease.config.pool);
+    k8s_cluster_release(&lease, 1);
+    assert_null(lease.cluster);
+
+    assert_int_equal(k8s_cluster_acquire("west", &lease), K8S_CLUSTER_OK);
+    assert_int_equal(lease.config.timeout_seconds, 2);
+    k8s_cluster_release(&lease, 1);
+
+    assert_int_equal(k8s_cluster_acquire("north", &lease), K8S_CLUSTER_UNKNOWN);
+    assert_int_equal(k8s_cluster_acquire(K8S_CLUSTER_LOCAL, &lease), K8S_CLUSTER_UNKNOWN);
+
+    /* Unchanged file: nothing to do */
+    assert_int_equal(k8s_cluster_reload(), 0);
+}
+
+static void test_invalid_lines(void **state) {
+    (void)state;
+    load("east https://east.example.com /ca\n"
+         "local https://local.example.com /ca /token\n"
+         "East https://east.example.com /ca /token\n"
+         "east ftp://east.example.com /ca /token\n"
+         "east https://east.example.com ca /token\n"
+         "east https://east.example.com /ca /token timeout=0\n"
+         "east https://east.example.com /ca /token timeout=301\n"
+         "east https://east.example.com /ca /token pool_size=65\n"
+         "east https://east.example.com /ca /token color=blue\n"
+         "east https://east.example.com /ca /token max_inflight=1 max_inflight=2\n"
+         EAST
+         "east https://other.example.com /ca /token\n");
+    assert_int_equal(k8s_cluster_count(), 1);
+    assert_int_equal(pools_created, 1);
+}
+
+static void test_reload_keeps_clusters(void **state) {
+    (void)state;
+    k8s_cluster_lease_t lease;
+
+    load(EAST WEST);
+    assert_int_equal(pools_created, 2);
+
+    /* east is unchanged and keeps its pool; west changed and gets a new one */
+    write_registry(EAST "west https://west.example.com /etc/west/ca.crt /etc/west/token\n");
+    assert_int_equal(k8s_cluster_reload(), 1);
+    assert_int_equal(pools_created, 3);
+    assert_int_equal(k8s_cluster_acquire("west", &lease), K8S_CLUSTER_OK);
+    assert_int_equal(lease.config.timeout_seconds, K8S_CLUSTER_DEFAULT_TIMEOUT);
+    k8s_cluster_release(&lease, 1);
+
+    /* A missing file keeps the registry */
+    unlink(registry_path);
+    assert_int_equal(k8s_cluster_reload(), 0);
+    assert_int_equal(k8s_cluster_count(), 2);
+
+    /* The replaced registries and the old west pool go at shutdown */
+    assert_int_equal(pools_destroyed, 0);
+    k8s_cluster_shutdown();
+    assert_int_equal(pools_destroyed, 3);
+}
+
+static void test_disable(void **state) {
+    (void)state;
+    k8s_cluster_lease_t lease;
+
+    load(EAST);
+    assert_int_equal(k8s_cluster_acquire("east", &lease), K8S_CLUSTER_OK);
+
+    /* A lease outlives the registry it came from */
+    k8s_cluster_configure("");
+    assert_int_equal(k8s_cluster_count(), 0);
+    assert_non_null(lease.config.api_server_url);
+    assert_string_equal(lease.config.api_server_url, "https://east.example.com:6443");
+    k8s_cluster_release(&lease, 1);
+
+    k8s_cluster_lease_t other;
+    assert_int_equal(k8s_cluster_acquire("east", &other), K8S_CLUSTER_UNKNOWN);
+}
+
+/* ===== Circuit and in-flight cap ===== */
+
+static void test_circuit(void **state) {
+    (void)state;
+    k8s_cluster_lease_t lease;
+    k8s_cluster_row_t rows[2];
+
+    load(EAST WEST);
+    for (int i = 0; i < K8S_CLUSTER_FAILURES; i++) {
+        assert_int_equal(k8s_cluster_acquire("east", &lease), K8S_CLUSTER_OK);
+        k8s_cluster_release(&lease, 0);
+    }
+
+    /* Failing: refused at once, other clusters unaffected */
+    assert_int_equal(k8s_cluster_acquire("east", &lease), K8S_CLUSTER_OPEN);
+    assert_int_equal(k8s_cluster_acquire("west", &lease), K8S_CLUSTER_OK);
+    k8s_cluster_release(&lease, 1);
+
+    assert_int_equal(k8s_cluster_collect(rows, 2), 2);
+    assert_string_equal(rows[0].name, "east");
+    assert_int_equal(rows[0].requests, K8S_CLUSTER_FAILURES);
+    assert_int_equal(rows[0].unavailable, K8S_CLUSTER_FAILURES);
+    assert_int_equal(rows[0].refused, 1);
+    assert_int_equal(rows[0].open, 1);
+    assert_int_equal(rows[1].open, 0);
+
+    /* The circuit state survives a reload that keeps the cluster */
+    write_registry(WEST EAST);
+    assert_int_equal(k8s_cluster_reload(), 1);
+    assert_int_equal(k8s_cluster_acquire("east", &lease), K8S_CLUSTER_OPEN);
+}
+
+static void test_cached_answers(void **state) {
+    (void)state;
+    k8s_cluster_lease_t lease;
+
+    load(EAST);
+    for (int i = 0; i < K8S_CLUSTER_FAILURES - 1; i++) {
+        assert_int_equal(k8s_cluster_acquire("east", &lease), K8S_CLUSTER_OK);
+        k8s_cluster_release(&lease, 0);
+    }
+
+    /* A lease that asked nothing neither fails nor recovers the cluster */
+    assert_int_equal(k8s_cluster_acquire("east", &lease), K8S_CLUSTER_OK);
+    k8s_cluster_release(&lease, -1);
+    assert_int_equal(k8s_cluster_acquire("east", &lease), K8S_CLUSTER_OK);
+    k8s_cluster_release(&lease, 0);
+    assert_int_equal(k8s_cluster_acquire("east", &lease), K8S_CLUSTER_OPEN);
+}
+
+static void test_max_inflight(void **state) {
+    (void)state;
+    k8s_cluster_lease_t leases[3];
+    k8s_cluster_row_t row;
+
+    load(WEST);
+    assert_int_equal(k8s_cluster_acquire("west", &leases[0]), K8S_CLUSTER_OK);
+    assert_int_equal(k8s_cluster_acquire("west", &leases[1]), K8S_CLUSTER_OK);
+    assert_int_equal(k8s_cluster_acquire("west", &leases[2]), K8S_CLUSTER_BUSY);
+
+    assert_int_equal(k8s_cluster_collect(&row, 1), 1);
+    assert_int_equal(row.in_flight, 2);
+    assert_int_equal(row.shed, 1);
+
+    k8s_cluster_release(&leases[0], 1);
+    assert_int_equal(k8s_cluster_acquire("west", &leases[2]), K8S_CLUSTER_OK);
+    k8s_cluster_release(&leases[1], 1);
+    k8s_cluster_release(&leases[2], 1);
+
+    assert_int_equal(k8s_cluster_collect(&row, 1), 1);
+    assert_int_equal(row.in_flight, 0);
+    assert_int_equal(row.requests, 3);
+}
+
+static void test_maintain(void **state) {
+    (void)state;
+    load(EAST WEST);
+    assert_int_equal(pings, 2);
+
+    k8s_cluster_maintain(0);
+    assert_int_equal(pings, 2);
+    k8s_cluster_maintain(30);
+    assert_int_equal(pings, 4);
+
+    /* A failing cluster is left alone */
+    k8s_cluster_lease_t lease;
+    for (int i = 0; i < K8S_CLUSTER_FAILURES; i++) {
+        assert_int_equal(k8s_cluster_acquire("east", &lease), K8S_CLUSTER_OK);
+        k8s_cluster_release(&lease, 0);
+    }
+    k8s_cluster_maintain(30);
+    assert_int_equal(pings, 5);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_split_user),
+        cmocka_unit_test_setup_teardown(test_disabled, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_load, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_invalid_lines, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_reload_keeps_clusters, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_disable, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_circuit, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_cached_answers, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_max_inflight, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_maintain, test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,226 @@
+/*
+ * Unit tests for config_snapshot.c using CMocka
+ *
+ * Pools are created against paths that don't exist, which is allowed and
+ * needs no network access.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+#include "config_snapshot.h"
+#include "http_pool.h"
+
+static k8s_config_t base_config(void) {
+    k8s_config_t config;
+    k8s_config_init_default(&config);
+    config.api_server_url = "https://kubernetes.default.svc";
+    config.ca_cert_path = "/nonexistent/ca.crt";
+    config.token_path = "/nonexistent/token";
+    return config;
+}
+
+static int test_setup(void **state) {
+    (void)state;
+    k8s_snapshot_shutdown();
+    return 0;
+}
+
+static int test_teardown(void **state) {
+    (void)state;
+    k8s_snapshot_shutdown();
+    return 0;
+}
+
+/* ========================================================================
+ * k8s_snapshot_create / k8s_snapshot_same_pool
+ * ======================================================================== */
+
+static void test_create_copies_strings(void **state) {
+    (void)state;
+    char url[64];
+    strcpy(url, "https://api.example.com:6443");
+
+    k8s_config_t config = base_config();
+    config.api_server_url = url;
+    config.timeout_seconds = 7;
+
+    k8s_snapshot_t *snap = k8s_snapshot_create(&config, 4, 30, 60);
+    assert_non_null(snap);
+    strcpy(url, "https://changed");
+
+    assert_string_equal(snap->config.api_server_url, "https://api.example.com:6443");
+    assert_string_equal(snap->config.token_path, "/nonexistent/token");
+    assert_int_equal(snap->config.timeout_seconds, 7);
+    assert_null(snap->config.pool);
+    assert_int_equal(snap->pool_size, 4);
+    assert_int_equal(snap->keepalive_interval, 30);
+    assert_int_equal(snap->dns_ttl, 60);
+    k8s_snapshot_free(snap);
+}
+
+static void test_same_pool(void **state) {
+    (void)state;
+    k8s_config_t config = base_config();
+    k8s_snapshot_t *a = k8s_snapshot_create(&config, 4, 30, 60);
+
+    config.timeout_seconds = 30;
+    k8s_snapshot_t *b = k8s_snapshot_create(&config, 4, 0, 120);
+    assert_true(k8s_snapshot_same_pool(a, b));
+    k8s_snapshot_free(b);
+
+    b = k8s_snapshot_create(&config, 8, 30, 60);
+    assert_false(k8s_snapshot_same_pool(a, b));
+    k8s_snapshot_free(b);
+
+    b = k8s_snapshot_create(&config, 4, 30, 0);
+    assert_false(k8s_snapshot_same_pool(a, b));
+    k8s_snapshot_free(b);
+
+    config.api_server_url = "https://other:6443";
+    b = k8s_snapshot_create(&config, 4, 30, 60);
+    assert_false(k8s_snapshot_same_pool(a, b));
+    k8s_snapshot_free(b);
+
+    config = base_config();
+    config.token_path = "/other/token";
+    b = k8s_snapshot_create(&config, 4, 30, 60);
+    assert_false(k8s_snapshot_same_pool(a, b));
+    k8s_snapshot_free(b);
+
+    k8s_snapshot_free(a);
+}
+
+/* ========================================================================
+ * Publish / acquire / reclaim
+ * ======================================================================== */
+
+static void test_acquire_before_publish(void **state) {
+    (void)state;
+    assert_null(k8s_snapshot_acquire());
+    k8s_snapshot_release(NULL);
+}
+
+static void test_publish_replaces_current(void **state) {
+    (void)state;
+    k8s_config_t config = base_config();
+    k8s_snapshot_t *a = k8s_snapshot_create(&config, 4, 30, 60);
+    config.timeout_seconds = 20;
+    k8s_snapshot_t *b = k8s_snapshot_create(&config, 4, 30, 60);
+
+    k8s_snapshot_publish(a);
+    k8s_snapshot_t *snap = k8s_snapshot_acquire();
+    assert_ptr_equal(snap, a);
+    k8s_snapshot_release(snap);
+
+    k8s_snapshot_publish(b);
+    snap = k8s_snapshot_acquire();
+    assert_ptr_equal(snap, b);
+    assert_int_equal(snap->config.timeout_seconds, 20);
+    k8s_snapshot_release(snap);
+}
+
+static void test_reclaim_waits_for_users(void **state) {
+    (void)state;
+    k8s_config_t config = base_config();
+    k8s_snapshot_publish(k8s_snapshot_create(&config, 4, 30, 60));
+
+    /* An in-flight login holds the first snapshot across the change */
+    k8s_snapshot_t *in_flight = k8s_snapshot_acquire();
+    k8s_snapshot_publish(k8s_snapshot_create(&config, 4, 30, 60));
+
+    assert_int_equal(k8s_snapshot_reclaim(0), 0);
+    assert_non_null(in_flight->config.api_server_url);
+
+    k8s_snapshot_release(in_flight);
+    assert_int_equal(k8s_snapshot_reclaim(0), 1);
+}
+
+static void test_reclaim_respects_grace(void **state) {
+    (void)state;
+    k8s_config_t config = base_config();
+    k8s_snapshot_publish(k8s_snapshot_create(&config, 4, 30, 60));
+    k8s_snapshot_publish(k8s_snapshot_create(&config, 4, 30, 60));
+
+    assert_int_equal(k8s_snapshot_reclaim(3600), 0);
+    assert_int_equal(k8s_snapshot_reclaim(0), 1);
+}
+
+static void test_reclaim_oldest_first(void **state) {
+    (void)state;
+    k8s_config_t config = base_config();
+    k8s_snapshot_publish(k8s_snapshot_create(&config, 4, 30, 60));
+    k8s_snapshot_t *in_flight = k8s_snapshot_acquire();
+    k8s_snapshot_publish(k8s_snapshot_create(&config, 4, 30, 60));
+    k8s_snapshot_publish(k8s_snapshot_create(&config, 4, 30, 60));
+
+    /* The unused second snapshot waits behind the first */
+    assert_int_equal(k8s_snapshot_reclaim(0), 0);
+
+    k8s_snapshot_release(in_flight);
+    assert_int_equal(k8s_snapshot_reclaim(0), 2);
+}
+
+static void test_shared_pool_survives_reclaim(void **state) {
+    (void)state;
+    k8s_config_t config = base_config();
+    k8s_http_pool_t *pool = k8s_http_pool_create(&config, 2);
+    assert_non_null(pool);
+
+    config.pool = pool;
+    k8s_snapshot_t *a = k8s_snapshot_create(&config, 2, 30, 60);
+    assert_int_equal(a->owns_pool, 1);
+    k8s_snapshot_publish(a);
+
+    /* Timeout-only change keeps the pool */
+    config.timeout_seconds = 30;
+    k8s_snapshot_t *b = k8s_snapshot_create(&config, 2, 30, 60);
+    k8s_snapshot_publish(b);
+    assert_int_equal(a->owns_pool, 0);
+    assert_int_equal(b->owns_pool, 1);
+
+    assert_int_equal(k8s_snapshot_reclaim(0), 1);
+
+    /* Still usable after the first snapshot was freed */
+    CURL *curl = k8s_http_pool_acquire(pool);
+    assert_non_null(curl);
+    k8s_http_pool_release(pool, curl, 1);
+
+    /* Freed exactly once by teardown */
+}
+
+static void test_replaced_pool_destroyed_with_snapshot(void **state) {
+    (void)state;
+    k8s_config_t config = base_config();
+    config.pool = k8s_http_pool_create(&config, 2);
+    k8s_snapshot_publish(k8s_snapshot_create(&config, 2, 30, 60));
+
+    config.api_server_url = "https://other:6443";
+    config.pool = k8s_http_pool_create(&config, 2);
+    k8s_snapshot_publish(k8s_snapshot_create(&config, 2, 30, 60));
+
+    assert_int_equal(k8s_snapshot_reclaim(0), 1);
+    k8s_snapshot_t *snap = k8s_snapshot_acquire();
+    assert_ptr_equal(snap->config.pool, config.pool);
+    assert_string_equal(snap->config.api_server_url, "https://other:6443");
+    k8s_snapshot_release(snap);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_create_copies_strings, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_same_pool, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_acquire_before_publish, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_publish_replaces_current, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_reclaim_waits_for_users, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_reclaim_respects_grace, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_reclaim_oldest_first, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_shared_pool_survives_reclaim, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_replaced_pool_destroyed_with_snapshot, test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
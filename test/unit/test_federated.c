@@ -0,0 +1,269 @@
+/*
+ * Unit tests for federated.c using CMocka
+ *
+ * The client talks to the stand-in validator of federated_daemon.h on a
+ * socket in /tmp.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "federated.h"
+#include "federated_daemon.h"
+
+#define TIMEOUT_MS 2000
+
+static char path[64];
+
+static int setup(void **state) {
+    (void)state;
+    snprintf(path, sizeof(path), "/tmp/test_federated_%d.sock", (int)getpid());
+    assert_int_equal(federated_daemon_start(path), 1);
+    k8s_federated_configure(path);
+    return 0;
+}
+
+static int teardown(void **state) {
+    (void)state;
+    k8s_federated_shutdown();
+    federated_daemon_stop();
+    return 0;
+}
+
+static void test_verdicts(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+
+    assert_int_equal(k8s_federated_ready(), 1);
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 1);
+    assert_int_equal(info.reviewed, 1);
+    assert_int_equal(info.authenticated, 1);
+    assert_string_equal(info.namespace, "default");
+    assert_string_equal(info.service_account, "app");
+    assert_string_equal(info.username, "system:serviceaccount:default:app");
+    assert_string_equal(info.uid, "uid-app");
+    assert_string_equal(info.groups,
+                        "system:serviceaccounts\nsystem:serviceaccounts:default\n"
+                        "system:authenticated");
+    assert_string_equal(info.pod_name, "app-pod");
+    assert_string_equal(info.pod_uid, "pod-uid");
+    assert_true(info.validated_at > 0);
+
+    /* A rejection is a verdict, an unavailable validator is not */
+    assert_int_equal(k8s_federated_validate(NULL, "expired", NULL, &info, TIMEOUT_MS), 0);
+    assert_int_equal(info.reviewed, 1);
+    assert_int_equal(info.authenticated, 0);
+    assert_string_equal(info.namespace, "");
+    assert_int_equal(k8s_federated_validate(NULL, "unavailable", NULL, &info, TIMEOUT_MS), 0);
+    assert_int_equal(info.reviewed, 0);
+
+    /* Each socket is opened by the first request it is picked for */
+    assert_int_equal(federated_daemon_connections(), 3);
+    assert_int_equal(federated_daemon_requests(), 3);
+    assert_int_equal(k8s_federated_sockets(), 3);
+}
+
+static void test_audience(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", "mariadb", &info,
+                                            TIMEOUT_MS), 1);
+    assert_string_equal(federated_daemon_last_audience(), "mariadb");
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", "vault", &info,
+                                            TIMEOUT_MS), 0);
+    assert_int_equal(info.reviewed, 1);
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 1);
+    assert_string_equal(federated_daemon_last_audience(), "");
+}
+
+static void test_disabled(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+
+    k8s_federated_configure("");
+    assert_int_equal(k8s_federated_ready(), 0);
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 0);
+    assert_int_equal(info.reviewed, 0);
+    assert_int_equal(k8s_federated_sockets(), 0);
+    assert_int_equal(federated_daemon_connections(), 0);
+}
+
+static void test_unreachable(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+
+    k8s_federated_configure("/tmp/test_federated_missing.sock");
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 0);
+    assert_int_equal(info.reviewed, 0);
+    /* Not tried again right away */
+    assert_int_equal(k8s_federated_ready(), 0);
+
+    k8s_federated_configure(path);
+    assert_int_equal(k8s_federated_ready(), 1);
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 1);
+}
+
+static void test_pipelined_batch(void **state) {
+    (void)state;
+    const char *tokens[] = {
+        "delay=300/valid:ns:first",
+        "valid:ns:second",
+        NULL,
+        "rejected",
+        "delay=100/valid:ns:fifth",
+        "unavailable",
+        "valid:other:seventh",
+    };
+    int count = (int)(sizeof(tokens) / sizeof(tokens[0]));
+    k8s_token_info_t infos[7];
+
+    assert_int_equal(k8s_federated_validate_batch(tokens, count, NULL, infos, TIMEOUT_MS, 8), 5);
+
+    /* Answers came out of order, each went to its token */
+    assert_string_equal(infos[0].service_account, "first");
+    assert_string_equal(infos[1].service_account, "second");
+    assert_int_equal(infos[2].reviewed, 0);
+    assert_int_equal(infos[3].reviewed, 1);
+    assert_int_equal(infos[3].authenticated, 0);
+    assert_string_equal(infos[4].service_account, "fifth");
+    assert_int_equal(infos[5].reviewed, 0);
+    assert_string_equal(infos[6].namespace, "other");
+
+    /* Sent in one go, before any answer */
+    assert_int_equal(federated_daemon_connections(), 1);
+    assert_int_equal(federated_daemon_max_pending(), 6);
+}
+
+static void test_batch_window(void **state) {
+    (void)state;
+    const char *tokens[10];
+    char names[10][32];
+    k8s_token_info_t infos[10];
+
+    for (int i = 0; i < 10; i++) {
+        snprintf(names[i], sizeof(names[i]), "delay=50/valid:ns:app-%d", i);
+        tokens[i] = names[i];
+    }
+    assert_int_equal(k8s_federated_validate_batch(tokens, 10, NULL, infos, TIMEOUT_MS, 4), 10);
+    for (int i = 0; i < 10; i++) {
+        char expected[32];
+        snprintf(expected, sizeof(expected), "app-%d", i);
+        assert_string_equal(infos[i].service_account, expected);
+    }
+    assert_true(federated_daemon_max_pending() <= 4);
+}
+
+#define THREADS 8
+#define ROUNDS 50
+
+static void *login_thread(void *arg) {
+    int t = (int)(intptr_t)arg;
+    int failures = 0;
+
+    for (int i = 0; i < ROUNDS; i++) {
+        char token[64];
+        char expected[32];
+        k8s_token_info_t info;
+
+        snprintf(expected, sizeof(expected), "app-%d-%d", t, i);
+        snprintf(token, sizeof(token), "%svalid:ns:%s", i % 3 == 0 ? "delay=5/" : "",
+                 expected);
+        if (!k8s_federated_validate(NULL, token, NULL, &info, TIMEOUT_MS) ||
+            strcmp(info.service_account, expected) != 0) {
+            failures++;
+        }
+    }
+    return (void *)(intptr_t)failures;
+}
+
+static void test_concurrent(void **state) {
+    (void)state;
+    pthread_t threads[THREADS];
+
+    for (int t = 0; t < THREADS; t++) {
+        assert_int_equal(pthread_create(&threads[t], NULL, login_thread, (void *)(intptr_t)t), 0);
+    }
+    for (int t = 0; t < THREADS; t++) {
+        void *failures;
+        pthread_join(threads[t], &failures);
+        assert_int_equal((int)(intptr_t)failures, 0);
+    }
+
+    /* Shared sockets, with requests of several threads in flight on each */
+    assert_int_equal(federated_daemon_requests(), THREADS * ROUNDS);
+    assert_true(federated_daemon_connections() <= K8S_FEDERATED_SOCKETS);
+    assert_true(federated_daemon_max_pending() > 1);
+}
+
+static void test_timeout(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+
+    assert_int_equal(k8s_federated_validate(NULL, "delay=1000/valid:default:app", NULL, &info,
+                                            100), 0);
+    assert_int_equal(info.reviewed, 0);
+
+    /* The socket was given up; the next request opens another */
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 1);
+    assert_int_equal(federated_daemon_connections(), 2);
+}
+
+static void test_broken(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+
+    assert_int_equal(k8s_federated_validate(NULL, "close", NULL, &info, TIMEOUT_MS), 0);
+    assert_int_equal(info.reviewed, 0);
+    assert_int_equal(k8s_federated_validate(NULL, "garbage", NULL, &info, TIMEOUT_MS), 0);
+    assert_int_equal(info.reviewed, 0);
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 1);
+    assert_int_equal(federated_daemon_connections(), 3);
+}
+
+static void test_reconfigure(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 1);
+    assert_int_equal(k8s_federated_sockets(), 1);
+
+    /* The old socket is closed, the next request connects again */
+    k8s_federated_configure(path);
+    assert_int_equal(k8s_federated_sockets(), 0);
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 1);
+    assert_int_equal(federated_daemon_connections(), 2);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_verdicts, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_audience, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_disabled, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_unreachable, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_pipelined_batch, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_batch_window, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_concurrent, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_timeout, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_broken, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_reconfigure, setup, teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,272 @@
+/*
+ * Unit tests for http_pool.c using CMocka
+ *
+ * Uses linker --wrap to hand out fake easy handles and record the options
+ * set on them; the share handle is libcurl's own. The resolver, the CA
+ * store and the credential file are stubbed.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <curl/curl.h>
+
+#include "http_pool.h"
+#include "resolver.h"
+#include "ca_store.h"
+
+#define HANDLES 16
+
+/* Fake handles are addresses in this array */
+static char handles[HANDLES];
+static int handles_created = 0;
+static int cleaned_up[HANDLES];
+static int resolve_set[HANDLES];       /* CURLOPT_RESOLVE calls per handle */
+static char resolved[HANDLES][K8S_RESOLVER_MAX_ENTRY_LEN];  /* Last entry given */
+
+static char resolve_entry[K8S_RESOLVER_MAX_ENTRY_LEN];
+
+static int handle_index(CURL *curl) {
+    int i = (int)((char *)curl - handles);
+    assert_true(i >= 0 && i < handles_created);
+    return i;
+}
+
+/* ===== Wraps ===== */
+
+CURL *__wrap_curl_easy_init(void) {
+    assert_true(handles_created < HANDLES);
+    return (CURL *)&handles[handles_created++];
+}
+
+void __wrap_curl_easy_cleanup(CURL *curl) {
+    cleaned_up[handle_index(curl)]++;
+}
+
+void __wrap_curl_easy_reset(CURL *curl) {
+    (void)handle_index(curl);
+}
+
+CURLcode __wrap_curl_easy_setopt(CURL *curl, CURLoption option, ...) {
+    int i = handle_index(curl);
+    va_list ap;
+    va_start(ap, option);
+
+    if (option == CURLOPT_RESOLVE) {
+        struct curl_slist *list = va_arg(ap, struct curl_slist *);
+        resolve_set[i]++;
+        snprintf(resolved[i], sizeof(resolved[i]), "%s", list->data);
+    }
+
+    va_end(ap);
+    return CURLE_OK;
+}
+
+/* ===== Stubs ===== */
+
+char *k8s_read_file(const char *path) {
+    (void)path;
+    return strdup("sa-token");
+}
+
+int k8s_resolver_init(k8s_resolver_t *resolver, const char *api_server_url) {
+    (void)api_server_url;
+    snprintf(resolver->host, sizeof(resolver->host), "kubernetes.default.svc");
+    resolver->port = 443;
+    return 1;
+}
+
+int k8s_resolver_resolve(const k8s_resolver_t *resolver, char *entry, size_t entry_len) {
+    (void)resolver;
+    snprintf(entry, entry_len, "%s", resolve_entry);
+    return resolve_entry[0] ? 1 : 0;
+}
+
+k8s_ca_store_t *k8s_ca_store_create(const char *ca_path) {
+    (void)ca_path;
+    return NULL;
+}
+
+void k8s_ca_store_destroy(k8s_ca_store_t *store) {
+    (void)store;
+}
+
+int k8s_ca_store_reload(k8s_ca_store_t *store) {
+    (void)store;
+    return 0;
+}
+
+int k8s_ca_store_count(k8s_ca_store_t *store) {
+    (void)store;
+    return 0;
+}
+
+int k8s_ca_store_apply(CURL *curl, k8s_ca_store_t *store) {
+    (void)curl;
+    (void)store;
+    return 0;
+}
+
+/* ===== Fixtures ===== */
+
+static k8s_http_pool_t *create(int size) {
+    k8s_config_t config;
+
+    memset(&config, 0, sizeof(config));
+    config.api_server_url = "https://kubernetes.default.svc";
+    config.ca_cert_path = "/nonexistent/ca.crt";
+    config.token_path = "/nonexistent/token";
+    config.timeout_seconds = 5;
+    k8s_http_pool_t *pool = k8s_http_pool_create(&config, size);
+    assert_non_null(pool);
+    return pool;
+}
+
+static int test_setup(void **state) {
+    (void)state;
+    handles_created = 0;
+    memset(cleaned_up, 0, sizeof(cleaned_up));
+    memset(resolve_set, 0, sizeof(resolve_set));
+    memset(resolved, 0, sizeof(resolved));
+    resolve_entry[0] = '\0';
+    return 0;
+}
+
+/* ===== Tests ===== */
+
+static void test_acquire_prefers_recent(void **state) {
+    (void)state;
+    k8s_http_pool_t *pool = create(3);
+
+    /* A connected handle is taken before an empty slot gets one */
+    CURL *a = k8s_http_pool_acquire(pool);
+    k8s_http_pool_release(pool, a, 1);
+    assert_ptr_equal(k8s_http_pool_acquire(pool), a);
+    assert_int_equal(handles_created, 1);
+
+    /* Of two idle handles, the one returned last */
+    CURL *b = k8s_http_pool_acquire(pool);
+    assert_ptr_not_equal(b, a);
+    k8s_http_pool_release(pool, a, 1);
+    sleep(1);
+    k8s_http_pool_release(pool, b, 1);
+    assert_ptr_equal(k8s_http_pool_acquire(pool), b);
+    assert_ptr_equal(k8s_http_pool_acquire(pool), a);
+    k8s_http_pool_release(pool, a, 1);
+    k8s_http_pool_release(pool, b, 1);
+    assert_int_equal(handles_created, 2);
+    assert_int_equal(cleaned_up[0] + cleaned_up[1], 0);
+
+    k8s_http_pool_destroy(pool);
+    assert_int_equal(cleaned_up[0], 1);
+    assert_int_equal(cleaned_up[1], 1);
+}
+
+static void test_exhausted_pool_temporary(void **state) {
+    (void)state;
+    k8s_http_pool_t *pool = create(1);
+
+    CURL *a = k8s_http_pool_acquire(pool);
+    CURL *temp = k8s_http_pool_acquire(pool);
+    assert_non_null(temp);
+    assert_ptr_not_equal(temp, a);
+
+    /* A temporary handle is closed on return, even if reusable */
+    k8s_http_pool_release(pool, temp, 1);
+    assert_int_equal(cleaned_up[handle_index(temp)], 1);
+
+    k8s_http_pool_release(pool, a, 1);
+    assert_ptr_equal(k8s_http_pool_acquire(pool), a);
+    k8s_http_pool_release(pool, a, 1);
+    assert_int_equal(cleaned_up[handle_index(a)], 0);
+
+    k8s_http_pool_destroy(pool);
+}
+
+static void test_release_not_reusable(void **state) {
+    (void)state;
+    k8s_http_pool_t *pool = create(1);
+
+    snprintf(resolve_entry, sizeof(resolve_entry), "kubernetes.default.svc:443:10.0.0.1");
+    assert_int_equal(k8s_http_pool_resolve(pool), 1);
+
+    CURL *a = k8s_http_pool_acquire(pool);
+    k8s_http_pool_release(pool, a, 0);
+    assert_int_equal(cleaned_up[handle_index(a)], 1);
+
+    /* The slot gets a fresh handle, which is given the pinned address again */
+    CURL *b = k8s_http_pool_acquire(pool);
+    assert_ptr_not_equal(b, a);
+    assert_int_equal(resolve_set[handle_index(b)], 1);
+    assert_string_equal(resolved[handle_index(b)], "kubernetes.default.svc:443:10.0.0.1");
+    k8s_http_pool_release(pool, b, 1);
+
+    k8s_http_pool_destroy(pool);
+}
+
+static void test_resolve_generation(void **state) {
+    (void)state;
+    k8s_http_pool_t *pool = create(2);
+    char entry[K8S_RESOLVER_MAX_ENTRY_LEN];
+
+    /* Nothing pinned yet */
+    CURL *a = k8s_http_pool_acquire(pool);
+    assert_int_equal(resolve_set[handle_index(a)], 0);
+    k8s_http_pool_release(pool, a, 1);
+    assert_int_equal(k8s_http_pool_pinned(pool, entry, sizeof(entry)), 0);
+
+    snprintf(resolve_entry, sizeof(resolve_entry), "kubernetes.default.svc:443:10.0.0.1");
+    assert_int_equal(k8s_http_pool_resolve(pool), 1);
+    /* Handles outside the pool get the same entry */
+    assert_int_equal(k8s_http_pool_pinned(pool, entry, sizeof(entry)), 1);
+    assert_string_equal(entry, "kubernetes.default.svc:443:10.0.0.1");
+    assert_ptr_equal(k8s_http_pool_acquire(pool), a);
+    assert_int_equal(resolve_set[handle_index(a)], 1);
+    assert_string_equal(resolved[handle_index(a)], "kubernetes.default.svc:443:10.0.0.1");
+    k8s_http_pool_release(pool, a, 1);
+
+    /* Each handle is given a generation once */
+    assert_int_equal(k8s_http_pool_resolve(pool), 1);
+    assert_ptr_equal(k8s_http_pool_acquire(pool), a);
+    assert_int_equal(resolve_set[handle_index(a)], 1);
+    k8s_http_pool_release(pool, a, 1);
+
+    /* A new address reaches every pooled handle as it is checked out */
+    snprintf(resolve_entry, sizeof(resolve_entry), "kubernetes.default.svc:443:10.0.0.2");
+    assert_int_equal(k8s_http_pool_resolve(pool), 1);
+    assert_ptr_equal(k8s_http_pool_acquire(pool), a);
+    CURL *b = k8s_http_pool_acquire(pool);
+    assert_int_equal(resolve_set[handle_index(a)], 2);
+    assert_string_equal(resolved[handle_index(a)], "kubernetes.default.svc:443:10.0.0.2");
+    assert_int_equal(resolve_set[handle_index(b)], 1);
+    assert_string_equal(resolved[handle_index(b)], "kubernetes.default.svc:443:10.0.0.2");
+    k8s_http_pool_release(pool, a, 1);
+    k8s_http_pool_release(pool, b, 1);
+
+    /* A failed resolution keeps the pinned address */
+    resolve_entry[0] = '\0';
+    assert_int_equal(k8s_http_pool_resolve(pool), 0);
+    a = k8s_http_pool_acquire(pool);
+    b = k8s_http_pool_acquire(pool);
+    assert_int_equal(resolve_set[handle_index(a)] + resolve_set[handle_index(b)], 3);
+    k8s_http_pool_release(pool, a, 1);
+    k8s_http_pool_release(pool, b, 1);
+
+    k8s_http_pool_destroy(pool);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup(test_acquire_prefers_recent, test_setup),
+        cmocka_unit_test_setup(test_exhausted_pool_temporary, test_setup),
+        cmocka_unit_test_setup(test_release_not_reusable, test_setup),
+        cmocka_unit_test_setup(test_resolve_generation, test_setup),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
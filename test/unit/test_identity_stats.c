@@ -0,0 +1,233 @@
+/*
+ * Unit tests for identity_stats.c using CMocka
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "identity_stats.h"
+
+static k8s_identity_row_t rows[K8S_IDENTITY_SLOTS];
+
+static int test_setup(void **state) {
+    (void)state;
+    k8s_identity_reset();
+    return 0;
+}
+
+/* Row of an identity, or NULL if it is not tracked */
+static const k8s_identity_row_t *find_row(int n, const char *identity) {
+    for (int i = 0; i < n; i++) {
+        if (strcmp(rows[i].identity, identity) == 0) {
+            return &rows[i];
+        }
+    }
+    return NULL;
+}
+
+/* ========================================================================
+ * Recording
+ * ======================================================================== */
+
+static void test_record_and_collect(void **state) {
+    (void)state;
+
+    k8s_identity_record("default/myapp", 1, 1000);
+    k8s_identity_record("default/myapp", 1, 3000);
+    k8s_identity_record("default/myapp", 0, 5000);
+    k8s_identity_record("other/worker", 0, 200);
+
+    int n = k8s_identity_collect(rows, K8S_IDENTITY_SLOTS);
+    assert_int_equal(n, 2);
+
+    const k8s_identity_row_t *app = find_row(n, "default/myapp");
+    assert_non_null(app);
+    assert_int_equal(app->logins, 3);
+    assert_int_equal(app->failures, 1);
+    assert_int_equal(app->latency_sum_us, 9000);
+    assert_int_equal(app->latency_max_us, 5000);
+    assert_true(app->last_seen >= app->first_seen);
+    assert_true(app->last_seen > 0);
+
+    const k8s_identity_row_t *worker = find_row(n, "other/worker");
+    assert_non_null(worker);
+    assert_int_equal(worker->logins, 1);
+    assert_int_equal(worker->failures, 1);
+}
+
+static void test_long_name_truncated(void **state) {
+    (void)state;
+    char name[K8S_IDENTITY_NAME_MAX * 2];
+
+    memset(name, 'a', sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+    k8s_identity_record(name, 1, 10);
+
+    int n = k8s_identity_collect(rows, K8S_IDENTITY_SLOTS);
+    assert_int_equal(n, 1);
+    assert_int_equal(strlen(rows[0].identity), K8S_IDENTITY_NAME_MAX);
+}
+
+static void test_unauthenticated_aggregated(void **state) {
+    (void)state;
+    k8s_identity_row_t row;
+
+    k8s_identity_record(NULL, 0, 100);
+    k8s_identity_record(NULL, 0, 300);
+    k8s_identity_record("default/myapp", 1, 10);
+
+    /* Unproven user names never take a row of the table */
+    int n = k8s_identity_collect(rows, K8S_IDENTITY_SLOTS);
+    assert_int_equal(n, 1);
+    assert_string_equal(rows[0].identity, "default/myapp");
+
+    k8s_identity_unauthenticated(&row);
+    assert_string_equal(row.identity, "");
+    assert_int_equal(row.logins, 2);
+    assert_int_equal(row.failures, 2);
+    assert_int_equal(row.latency_max_us, 300);
+
+    k8s_identity_reset();
+    k8s_identity_unauthenticated(&row);
+    assert_int_equal(row.logins, 0);
+}
+
+static void test_percentiles(void **state) {
+    (void)state;
+
+    for (int i = 1; i <= 100; i++) {
+        k8s_identity_record("default/myapp", 1, (uint64_t)i * 1000);
+    }
+    assert_int_equal(k8s_identity_collect(rows, K8S_IDENTITY_SLOTS), 1);
+
+    /* Bucket upper bounds, within 25% above the exact value */
+    assert_true(rows[0].latency_p50_us >= 50000 && rows[0].latency_p50_us <= 62500);
+    assert_true(rows[0].latency_p95_us >= 95000 && rows[0].latency_p95_us <= 118750);
+    assert_true(rows[0].latency_p99_us >= 99000 && rows[0].latency_p99_us <= 123750);
+    assert_true(rows[0].latency_p50_us <= rows[0].latency_p95_us);
+}
+
+static void test_collect_respects_capacity(void **state) {
+    (void)state;
+    char name[32];
+
+    for (int i = 0; i < 10; i++) {
+        snprintf(name, sizeof(name), "ns/sa-%d", i);
+        k8s_identity_record(name, 1, 10);
+    }
+    assert_int_equal(k8s_identity_collect(rows, 4), 4);
+}
+
+static void test_collect_most_recent_first(void **state) {
+    (void)state;
+    char name[32];
+
+    for (int i = 0; i < 10; i++) {
+        snprintf(name, sizeof(name), "ns/sa-%d", i);
+        k8s_identity_record(name, 1, 10);
+    }
+    sleep(1);
+    k8s_identity_record("ns/sa-3", 1, 10);
+    k8s_identity_record("ns/sa-7", 1, 10);
+
+    /* A short array gets the identities seen last */
+    assert_int_equal(k8s_identity_collect(rows, 2), 2);
+    assert_non_null(find_row(2, "ns/sa-3"));
+    assert_non_null(find_row(2, "ns/sa-7"));
+
+    int n = k8s_identity_collect(rows, K8S_IDENTITY_SLOTS);
+    assert_int_equal(n, 10);
+    for (int i = 1; i < n; i++) {
+        assert_true(rows[i - 1].last_seen >= rows[i].last_seen);
+    }
+}
+
+/* ========================================================================
+ * Bounded memory
+ * ======================================================================== */
+
+static void test_distinct_identities_bounded(void **state) {
+    (void)state;
+    char name[32];
+    int total = K8S_IDENTITY_SLOTS * 4;
+
+    for (int i = 0; i < total; i++) {
+        snprintf(name, sizeof(name), "ns/sa-%d", i);
+        k8s_identity_record(name, 1, 10);
+    }
+
+    int n = k8s_identity_collect(rows, K8S_IDENTITY_SLOTS);
+    assert_true(n <= K8S_IDENTITY_SLOTS);
+    assert_int_equal(k8s_identity_evictions(), (uint64_t)(total - n));
+}
+
+static void test_eviction_spares_recent_identity(void **state) {
+    (void)state;
+    char name[32];
+
+    /* An identity logging in between the newcomers is never the least
+     * recently used one in its set */
+    for (int i = 0; i < K8S_IDENTITY_SLOTS * 4; i++) {
+        k8s_identity_record("default/myapp", 1, 10);
+        snprintf(name, sizeof(name), "ns/sa-%d", i);
+        k8s_identity_record(name, 1, 10);
+    }
+
+    int n = k8s_identity_collect(rows, K8S_IDENTITY_SLOTS);
+    const k8s_identity_row_t *app = find_row(n, "default/myapp");
+    assert_non_null(app);
+    assert_int_equal(app->logins, K8S_IDENTITY_SLOTS * 4);
+}
+
+/* ========================================================================
+ * Concurrency
+ * ======================================================================== */
+
+static void *record_from_thread(void *arg) {
+    (void)arg;
+    for (int i = 0; i < 10000; i++) {
+        k8s_identity_record(i % 2 ? "ns/a" : "ns/b", i % 10 != 0, 100);
+    }
+    return NULL;
+}
+
+static void test_concurrent_records(void **state) {
+    (void)state;
+    pthread_t threads[4];
+
+    for (int i = 0; i < 4; i++) {
+        pthread_create(&threads[i], NULL, record_from_thread, NULL);
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    int n = k8s_identity_collect(rows, K8S_IDENTITY_SLOTS);
+    assert_int_equal(n, 2);
+    assert_int_equal(find_row(n, "ns/a")->logins, 20000);
+    assert_int_equal(find_row(n, "ns/b")->logins, 20000);
+    assert_int_equal(find_row(n, "ns/b")->failures, 4000);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup(test_record_and_collect, test_setup),
+        cmocka_unit_test_setup(test_long_name_truncated, test_setup),
+        cmocka_unit_test_setup(test_unauthenticated_aggregated, test_setup),
+        cmocka_unit_test_setup(test_percentiles, test_setup),
+        cmocka_unit_test_setup(test_collect_respects_capacity, test_setup),
+        cmocka_unit_test_setup(test_collect_most_recent_first, test_setup),
+        cmocka_unit_test_setup(test_distinct_identities_bounded, test_setup),
+        cmocka_unit_test_setup(test_eviction_spares_recent_identity, test_setup),
+        cmocka_unit_test_setup(test_concurrent_records, test_setup),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,337 @@
+/*
+ * Unit tests for issuers.c using CMocka
+ *
+ * Generates an RSA and an EC key, mounts them as a JWKS bundle and a PEM
+ * bundle of two clusters and signs ServiceAccount-shaped tokens with them.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/core_names.h>
+
+#include "issuers.h"
+#include "jwt_fixtures.h"
+
+#define EAST_ISSUER "https://east.example.com"
+#define WEST_ISSUER "https://west.example.com"
+
+static EVP_PKEY *rsa_key;
+static EVP_PKEY *ec_key;
+static EVP_PKEY *other_key;
+static char ec_kid[64];
+static char tmp_dir[64];
+
+/* Key id as the API server derives it: SHA-256 of the DER public key */
+static void derive_kid(EVP_PKEY *pkey, char *out) {
+    unsigned char *der = NULL;
+    unsigned char digest[32];
+    int len = i2d_PUBKEY(pkey, &der);
+    assert_true(len > 0);
+    assert_int_equal(EVP_Digest(der, (size_t)len, digest, NULL, EVP_sha256(), NULL), 1);
+    OPENSSL_free(der);
+    jwt_fixture_b64url(digest, sizeof(digest), out);
+}
+
+/* Token of team-a/app issued by iss */
+static void token_for(EVP_PKEY *pkey, const char *alg, const char *kid, const char *iss,
+                      const char *aud, char *out) {
+    char payload[768];
+    time_t now = time(NULL);
+
+    snprintf(payload, sizeof(payload),
+             "{\"aud\":[\"%s\"],\"exp\":%lld,\"nbf\":%lld,\"iss\":\"%s\","
+             "\"kubernetes.io\":{\"namespace\":\"team-a\",\"serviceaccount\":"
+             "{\"name\":\"app\",\"uid\":\"sa-uid-1\"}},"
+             "\"sub\":\"system:serviceaccount:team-a:app\"}",
+             aud, (long long)(now + 600), (long long)(now - 5), iss);
+    jwt_fixture_sign(pkey, alg, kid, payload, out);
+}
+
+/* ===== Bundles ===== */
+
+static void write_file(const char *name, const char *content) {
+    char tmp_path[160], path[160];
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.%s.tmp", tmp_dir, name);
+    snprintf(path, sizeof(path), "%s/%s", tmp_dir, name);
+    FILE *fp = fopen(tmp_path, "w");
+    assert_non_null(fp);
+    fputs(content, fp);
+    fclose(fp);
+    assert_int_equal(rename(tmp_path, path), 0);
+}
+
+static void remove_file(const char *name) {
+    char path[160];
+    snprintf(path, sizeof(path), "%s/%s", tmp_dir, name);
+    unlink(path);
+}
+
+/* The RSA key as the JWKS of east */
+static void write_east(void) {
+    char n[400], e[16], jwks[1024];
+
+    jwt_fixture_b64url_bn(rsa_key, OSSL_PKEY_PARAM_RSA_N, n);
+    jwt_fixture_b64url_bn(rsa_key, OSSL_PKEY_PARAM_RSA_E, e);
+    snprintf(jwks, sizeof(jwks),
+             "{\"issuer\":\"" EAST_ISSUER "\",\"keys\":["
+             "{\"use\":\"sig\",\"kty\":\"RSA\",\"kid\":\"rsa-1\",\"alg\":\"RS256\","
+             "\"n\":\"%s\",\"e\":\"%s\"}]}", n, e);
+    write_file("east.jwks", jwks);
+}
+
+/* The EC key as the PEM bundle of west */
+static void write_west(void) {
+    char pem[1024];
+    BIO *bio = BIO_new(BIO_s_mem());
+    char *data = NULL;
+
+    assert_int_equal(PEM_write_bio_PUBKEY(bio, ec_key), 1);
+    long len = BIO_get_mem_data(bio, &data);
+    snprintf(pem, sizeof(pem), "issuer: " WEST_ISSUER "\n%.*s", (int)len, data);
+    BIO_free(bio);
+    write_file("west.pem", pem);
+}
+
+static int group_setup(void **state) {
+    (void)state;
+    rsa_key = EVP_RSA_gen(2048);
+    other_key = EVP_RSA_gen(2048);
+    ec_key = EVP_EC_gen("P-256");
+    return rsa_key && other_key && ec_key ? 0 : -1;
+}
+
+static int group_teardown(void **state) {
+    (void)state;
+    EVP_PKEY_free(rsa_key);
+    EVP_PKEY_free(other_key);
+    EVP_PKEY_free(ec_key);
+    return 0;
+}
+
+static int test_setup(void **state) {
+    (void)state;
+    strcpy(tmp_dir, "/tmp/test_issuers.XXXXXX");
+    if (!mkdtemp(tmp_dir)) {
+        return -1;
+    }
+    derive_kid(ec_key, ec_kid);
+    write_east();
+    write_west();
+    k8s_issuers_configure(tmp_dir);
+    return k8s_issuers_reload() == 1 ? 0 : -1;
+}
+
+static int test_teardown(void **state) {
+    (void)state;
+    char cmd[96];
+    k8s_issuers_shutdown();
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", tmp_dir);
+    return system(cmd) == 0 ? 0 : -1;
+}
+
+/* ===== Verification ===== */
+
+static void test_jwks_bundle(void **state) {
+    (void)state;
+    char token[2048];
+    k8s_token_info_t info;
+
+    assert_int_equal(k8s_issuers_count(), 2);
+    assert_int_equal(k8s_issuers_known("east"), 1);
+    assert_int_equal(k8s_issuers_known("north"), 0);
+
+    token_for(rsa_key, "RS256", "rsa-1", EAST_ISSUER, "https://east.example.com", token);
+    assert_int_equal(k8s_issuers_verify("east", token, NULL, &info), 1);
+    assert_int_equal(info.authenticated, 1);
+    assert_int_equal(info.reviewed, 1);
+    assert_string_equal(info.namespace, "team-a");
+    assert_string_equal(info.service_account, "app");
+    assert_string_equal(info.uid, "sa-uid-1");
+    assert_non_null(strstr(info.groups, "system:serviceaccounts:team-a\n"));
+}
+
+static void test_pem_bundle(void **state) {
+    (void)state;
+    char token[2048];
+    k8s_token_info_t info;
+
+    token_for(ec_key, "ES256", ec_kid, WEST_ISSUER, WEST_ISSUER, token);
+    assert_int_equal(k8s_issuers_verify("west", token, NULL, &info), 1);
+    assert_string_equal(info.uid, "sa-uid-1");
+}
+
+static void test_refused(void **state) {
+    (void)state;
+    char token[2048];
+    k8s_token_info_t info;
+
+    /* A cluster's token does not log in from another cluster */
+    token_for(rsa_key, "RS256", "rsa-1", EAST_ISSUER, EAST_ISSUER, token);
+    assert_int_equal(k8s_issuers_verify("west", token, NULL, &info), 0);
+    assert_int_equal(info.reviewed, 1);
+    assert_int_equal(info.authenticated, 0);
+
+    /* Claiming another issuer finds no key */
+    token_for(rsa_key, "RS256", "rsa-1", WEST_ISSUER, WEST_ISSUER, token);
+    assert_int_equal(k8s_issuers_verify("west", token, NULL, &info), 0);
+
+    /* Unknown key id, and a known one with a key it is not */
+    token_for(rsa_key, "RS256", "rsa-2", EAST_ISSUER, EAST_ISSUER, token);
+    assert_int_equal(k8s_issuers_verify("east", token, NULL, &info), 0);
+    token_for(other_key, "RS256", "rsa-1", EAST_ISSUER, EAST_ISSUER, token);
+    assert_int_equal(k8s_issuers_verify("east", token, NULL, &info), 0);
+
+    assert_int_equal(k8s_issuers_verify("east", "not a token", NULL, &info), 0);
+    assert_int_equal(info.reviewed, 1);
+}
+
+static void test_audience(void **state) {
+    (void)state;
+    char token[2048];
+    k8s_token_info_t info;
+
+    /* Without a policy audience, the issuer's own */
+    token_for(rsa_key, "RS256", "rsa-1", EAST_ISSUER, "mariadb", token);
+    assert_int_equal(k8s_issuers_verify("east", token, NULL, &info), 0);
+    assert_int_equal(info.reviewed, 1);
+    assert_int_equal(k8s_issuers_verify("east", token, "mariadb", &info), 1);
+    assert_int_equal(k8s_issuers_verify("east", token, "vault", &info), 0);
+
+    /* A policy audience replaces it */
+    token_for(rsa_key, "RS256", "rsa-1", EAST_ISSUER, EAST_ISSUER, token);
+    assert_int_equal(k8s_issuers_verify("east", token, NULL, &info), 1);
+    assert_int_equal(k8s_issuers_verify("east", token, "mariadb", &info), 0);
+}
+
+static void test_bundle_audience(void **state) {
+    (void)state;
+    char token[2048];
+    char pem[1024];
+    k8s_token_info_t info;
+    BIO *bio = BIO_new(BIO_s_mem());
+    char *data = NULL;
+
+    assert_int_equal(PEM_write_bio_PUBKEY(bio, ec_key), 1);
+    long len = BIO_get_mem_data(bio, &data);
+    snprintf(pem, sizeof(pem), "issuer: " WEST_ISSUER "\naudience: mariadb\n%.*s",
+             (int)len, data);
+    BIO_free(bio);
+    write_file("west.pem", pem);
+    assert_int_equal(k8s_issuers_reload(), 1);
+
+    token_for(ec_key, "ES256", ec_kid, WEST_ISSUER, "mariadb", token);
+    assert_int_equal(k8s_issuers_verify("west", token, NULL, &info), 1);
+    token_for(ec_key, "ES256", ec_kid, WEST_ISSUER, WEST_ISSUER, token);
+    assert_int_equal(k8s_issuers_verify("west", token, NULL, &info), 0);
+
+    /* A JWKS audience must be a string */
+    write_file("east.jwks", "{\"issuer\":\"" EAST_ISSUER "\",\"audience\":[\"mariadb\"],"
+               "\"keys\":[]}");
+    assert_int_equal(k8s_issuers_reload(), 1);
+    token_for(rsa_key, "RS256", "rsa-1", EAST_ISSUER, EAST_ISSUER, token);
+    assert_int_equal(k8s_issuers_verify("east", token, NULL, &info), 1);
+}
+
+/* ===== Directory ===== */
+
+static void test_invalid_files(void **state) {
+    (void)state;
+    char token[2048];
+    k8s_token_info_t info;
+
+    write_file("README", "not a bundle");
+    write_file("East.jwks", "{\"keys\":[]}");
+    write_file("local.pem", "issuer: https://local\n");
+    write_file("north.jwks", "not json");
+    write_file("south.jwks", "{\"keys\":[]}");
+    write_file("nowhere.pem", "-----BEGIN PUBLIC KEY-----\n-----END PUBLIC KEY-----\n");
+    assert_int_equal(k8s_issuers_reload(), 1);
+    assert_int_equal(k8s_issuers_count(), 2);
+    assert_int_equal(k8s_issuers_known("north"), 0);
+    assert_int_equal(k8s_issuers_known("south"), 0);
+
+    /* Two clusters cannot share an issuer */
+    char path[160];
+    snprintf(path, sizeof(path), "%s/east.jwks", tmp_dir);
+    char *data = NULL;
+    FILE *fp = fopen(path, "r");
+    assert_non_null(fp);
+    data = calloc(1, 4096);
+    assert_int_equal(fread(data, 1, 4095, fp) > 0, 1);
+    fclose(fp);
+    write_file("a-copy.jwks", data);
+    free(data);
+    assert_int_equal(k8s_issuers_reload(), 1);
+    assert_int_equal(k8s_issuers_known("a-copy") + k8s_issuers_known("east"), 1);
+
+    /* Whichever won, east's token only logs in from that one */
+    token_for(rsa_key, "RS256", "rsa-1", EAST_ISSUER, EAST_ISSUER, token);
+    assert_int_equal(k8s_issuers_verify("east", token, NULL, &info) +
+                     k8s_issuers_verify("a-copy", token, NULL, &info), 1);
+}
+
+static void test_reload(void **state) {
+    (void)state;
+    char token[2048];
+    k8s_token_info_t info;
+
+    /* Nothing changed */
+    assert_int_equal(k8s_issuers_reload(), 0);
+
+    /* A file that cannot be used keeps the keys it had */
+    write_file("east.jwks", "{\"issuer\":\"" EAST_ISSUER "\",\"ke");
+    assert_int_equal(k8s_issuers_reload(), 1);
+    assert_int_equal(k8s_issuers_count(), 2);
+    token_for(rsa_key, "RS256", "rsa-1", EAST_ISSUER, EAST_ISSUER, token);
+    assert_int_equal(k8s_issuers_verify("east", token, NULL, &info), 1);
+
+    /* A removed file takes its keys along */
+    remove_file("east.jwks");
+    assert_int_equal(k8s_issuers_reload(), 1);
+    assert_int_equal(k8s_issuers_known("east"), 0);
+    assert_int_equal(k8s_issuers_verify("east", token, NULL, &info), 0);
+
+    /* And a new one is picked up */
+    write_east();
+    assert_int_equal(k8s_issuers_reload(), 1);
+    assert_int_equal(k8s_issuers_verify("east", token, NULL, &info), 1);
+}
+
+static void test_disabled(void **state) {
+    (void)state;
+    k8s_issuers_configure("");
+    assert_int_equal(k8s_issuers_count(), 0);
+    assert_int_equal(k8s_issuers_known("east"), 0);
+    assert_int_equal(k8s_issuers_reload(), 0);
+
+    /* A missing directory loads nothing */
+    k8s_issuers_configure("/nonexistent/issuers");
+    assert_int_equal(k8s_issuers_reload(), 0);
+    assert_int_equal(k8s_issuers_count(), 0);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_jwks_bundle, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_pem_bundle, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_refused, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_audience, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_bundle_audience, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_invalid_files, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_reload, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_disabled, test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, group_setup, group_teardown);
+}
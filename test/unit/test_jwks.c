@@ -0,0 +1,317 @@
+/*
+ * Unit tests for jwks.c using CMocka
+ *
+ * Generates an RSA and an EC key, publishes them as a JWKS document and
+ * signs ServiceAccount-shaped tokens with them.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/rsa.h>
+#include <openssl/core_names.h>
+
+#include "jwks.h"
+#include "jwt_fixtures.h"
+
+static EVP_PKEY *rsa_key;
+static EVP_PKEY *ec_key;
+static EVP_PKEY *other_key;
+
+/* JWKS with the RSA key as "rsa-1" and the EC key as "ec-1" */
+static void make_jwks(char *out, size_t size) {
+    char n[400], e[16], x[64], y[64];
+    unsigned char point[65];
+    size_t point_len = 0;
+
+    jwt_fixture_b64url_bn(rsa_key, OSSL_PKEY_PARAM_RSA_N, n);
+    jwt_fixture_b64url_bn(rsa_key, OSSL_PKEY_PARAM_RSA_E, e);
+    assert_int_equal(EVP_PKEY_get_octet_string_param(ec_key, OSSL_PKEY_PARAM_PUB_KEY,
+                                                     point, sizeof(point), &point_len), 1);
+    assert_int_equal(point_len, 65);
+    jwt_fixture_b64url(point + 1, 32, x);
+    jwt_fixture_b64url(point + 33, 32, y);
+
+    snprintf(out, size,
+             "{\"keys\":["
+             "{\"use\":\"sig\",\"kty\":\"RSA\",\"kid\":\"rsa-1\",\"alg\":\"RS256\",\"n\":\"%s\",\"e\":\"%s\"},"
+             "{\"use\":\"sig\",\"kty\":\"EC\",\"kid\":\"ec-1\",\"crv\":\"P-256\",\"x\":\"%s\",\"y\":\"%s\"},"
+             "{\"use\":\"sig\",\"kty\":\"oct\",\"kid\":\"hmac\",\"k\":\"c2VjcmV0\"}]}",
+             n, e, x, y);
+}
+
+#define ISSUER "https://kubernetes.default.svc"
+
+/* Claims of a projected token for default/app issued for an audience */
+static void claims_for(char *out, size_t size, const char *iss, const char *aud, time_t exp,
+                       time_t nbf) {
+    snprintf(out, size,
+             "{\"aud\":%s,\"exp\":%lld,\"nbf\":%lld,\"iss\":\"%s\","
+             "\"kubernetes.io\":{\"namespace\":\"default\",\"serviceaccount\":"
+             "{\"name\":\"app\",\"uid\":\"sa-uid-1\"}},"
+             "\"sub\":\"system:serviceaccount:default:app\"}",
+             aud, (long long)exp, (long long)nbf, iss);
+}
+
+/* Claims of a projected token for default/app issued for the API server */
+static void claims(char *out, size_t size, time_t exp, time_t nbf) {
+    claims_for(out, size, ISSUER, "[\"" ISSUER "\"]", exp, nbf);
+}
+
+static int group_setup(void **state) {
+    (void)state;
+    rsa_key = EVP_RSA_gen(2048);
+    other_key = EVP_RSA_gen(2048);
+    ec_key = EVP_EC_gen("P-256");
+    return rsa_key && other_key && ec_key ? 0 : -1;
+}
+
+static int group_teardown(void **state) {
+    (void)state;
+    EVP_PKEY_free(rsa_key);
+    EVP_PKEY_free(other_key);
+    EVP_PKEY_free(ec_key);
+    return 0;
+}
+
+static int test_setup(void **state) {
+    (void)state;
+    char jwks[2048];
+    make_jwks(jwks, sizeof(jwks));
+    return k8s_jwks_load(jwks, ISSUER) == 2 ? 0 : -1;
+}
+
+static int test_teardown(void **state) {
+    (void)state;
+    k8s_jwks_clear();
+    return 0;
+}
+
+/* ===== Verification ===== */
+
+static void test_rs256_verifies(void **state) {
+    (void)state;
+    char payload[512], token[2048];
+    k8s_token_info_t info;
+    time_t now = time(NULL);
+
+    claims(payload, sizeof(payload), now + 600, now - 5);
+    jwt_fixture_sign(rsa_key, "RS256", "rsa-1", payload, token);
+
+    assert_int_equal(k8s_jwks_verify(token, &info), 1);
+    assert_int_equal(info.authenticated, 1);
+    assert_int_equal(info.reviewed, 0);
+    assert_string_equal(info.namespace, "default");
+    assert_string_equal(info.service_account, "app");
+    assert_string_equal(info.uid, "sa-uid-1");
+    assert_string_equal(info.username, "system:serviceaccount:default:app");
+}
+
+static void test_es256_verifies(void **state) {
+    (void)state;
+    char payload[512], token[2048];
+    k8s_token_info_t info;
+    time_t now = time(NULL);
+
+    claims(payload, sizeof(payload), now + 600, now - 5);
+    jwt_fixture_sign(ec_key, "ES256", "ec-1", payload, token);
+    assert_int_equal(k8s_jwks_verify(token, &info), 1);
+    assert_string_equal(info.uid, "sa-uid-1");
+
+    /* The key type must match the algorithm */
+    jwt_fixture_sign(ec_key, "RS256", "ec-1", payload, token);
+    assert_int_equal(k8s_jwks_verify(token, &info), 0);
+}
+
+static void test_bad_signature(void **state) {
+    (void)state;
+    char payload[512], token[2048], forged[2048];
+    k8s_token_info_t info;
+    time_t now = time(NULL);
+
+    claims(payload, sizeof(payload), now + 600, now - 5);
+
+    /* Signed by a key the cluster doesn't publish */
+    jwt_fixture_sign(other_key, "RS256", "rsa-1", payload, token);
+    assert_int_equal(k8s_jwks_verify(token, &info), 0);
+    assert_int_equal(info.authenticated, 0);
+
+    /* Payload swapped after signing */
+    jwt_fixture_sign(rsa_key, "RS256", "rsa-1", payload, token);
+    claims(payload, sizeof(payload), now + 6000, now - 5);
+    jwt_fixture_sign(rsa_key, "RS256", "rsa-1", payload, forged);
+    char *sig = strrchr(token, '.');
+    strcpy(strrchr(forged, '.'), sig);
+    assert_int_equal(k8s_jwks_verify(forged, &info), 0);
+
+    /* Unsigned */
+    assert_int_equal(k8s_jwks_verify("eyJhbGciOiJub25lIn0.e30.", &info), 0);
+    assert_int_equal(k8s_jwks_verify("not a token", &info), 0);
+}
+
+static void test_forged(void **state) {
+    (void)state;
+    char payload[512], token[2048];
+    time_t now = time(NULL);
+
+    claims(payload, sizeof(payload), now + 600, now - 5);
+    jwt_fixture_sign(other_key, "RS256", "rsa-1", payload, token);
+    assert_int_equal(k8s_jwks_forged(token), 1);
+    jwt_fixture_sign(rsa_key, "RS256", "rsa-1", payload, token);
+    assert_int_equal(k8s_jwks_forged(token), 0);
+
+    /* Claims are not judged */
+    claims(payload, sizeof(payload), now - 1, now - 600);
+    jwt_fixture_sign(rsa_key, "RS256", "rsa-1", payload, token);
+    assert_int_equal(k8s_jwks_forged(token), 0);
+
+    /* Keys it may not know of are left to the API server */
+    jwt_fixture_sign(other_key, "RS256", "rotated", payload, token);
+    assert_int_equal(k8s_jwks_forged(token), 0);
+    jwt_fixture_sign(ec_key, "ES256", "rsa-1", payload, token);
+    assert_int_equal(k8s_jwks_forged(token), 0);
+    assert_int_equal(k8s_jwks_forged("eyJhbGciOiJub25lIn0.e30."), 0);
+    assert_int_equal(k8s_jwks_forged("not a token"), 0);
+}
+
+static void test_claims_checked(void **state) {
+    (void)state;
+    char payload[512], token[2048];
+    k8s_token_info_t info;
+    time_t now = time(NULL);
+
+    claims(payload, sizeof(payload), now - 1, now - 600);
+    jwt_fixture_sign(rsa_key, "RS256", "rsa-1", payload, token);
+    assert_int_equal(k8s_jwks_verify(token, &info), 0);
+
+    claims(payload, sizeof(payload), now + 600, now + 60);
+    jwt_fixture_sign(rsa_key, "RS256", "rsa-1", payload, token);
+    assert_int_equal(k8s_jwks_verify(token, &info), 0);
+
+    /* Legacy Secret-based token: no exp, no serviceaccount claim */
+    snprintf(payload, sizeof(payload),
+             "{\"iss\":\"kubernetes/serviceaccount\","
+             "\"sub\":\"system:serviceaccount:default:app\"}");
+    jwt_fixture_sign(rsa_key, "RS256", "rsa-1", payload, token);
+    assert_int_equal(k8s_jwks_verify(token, &info), 0);
+
+    /* Not a ServiceAccount */
+    snprintf(payload, sizeof(payload),
+             "{\"exp\":%lld,\"sub\":\"alice\",\"kubernetes.io\":"
+             "{\"serviceaccount\":{\"uid\":\"x\"}}}", (long long)(now + 600));
+    jwt_fixture_sign(rsa_key, "RS256", "rsa-1", payload, token);
+    assert_int_equal(k8s_jwks_verify(token, &info), 0);
+}
+
+static void test_audience_checked(void **state) {
+    (void)state;
+    char payload[512], token[2048];
+    k8s_token_info_t info;
+    time_t now = time(NULL);
+
+    /* A token the pod requested for another service gets no verdict */
+    claims_for(payload, sizeof(payload), ISSUER, "[\"vault\"]", now + 600, now - 5);
+    jwt_fixture_sign(rsa_key, "RS256", "rsa-1", payload, token);
+    assert_int_equal(k8s_jwks_verify(token, &info), 0);
+    assert_int_equal(info.reviewed, 0);
+    assert_int_equal(info.authenticated, 0);
+
+    claims_for(payload, sizeof(payload), ISSUER, "[\"vault\",\"" ISSUER "\"]", now + 600,
+               now - 5);
+    jwt_fixture_sign(rsa_key, "RS256", "rsa-1", payload, token);
+    assert_int_equal(k8s_jwks_verify(token, &info), 1);
+    claims_for(payload, sizeof(payload), ISSUER, "\"" ISSUER "\"", now + 600, now - 5);
+    jwt_fixture_sign(rsa_key, "RS256", "rsa-1", payload, token);
+    assert_int_equal(k8s_jwks_verify(token, &info), 1);
+
+    /* Nor does one without aud, or of another issuer */
+    snprintf(payload, sizeof(payload),
+             "{\"exp\":%lld,\"iss\":\"" ISSUER "\",\"kubernetes.io\":{\"serviceaccount\":"
+             "{\"name\":\"app\",\"uid\":\"sa-uid-1\"}},"
+             "\"sub\":\"system:serviceaccount:default:app\"}", (long long)(now + 600));
+    jwt_fixture_sign(rsa_key, "RS256", "rsa-1", payload, token);
+    assert_int_equal(k8s_jwks_verify(token, &info), 0);
+    claims_for(payload, sizeof(payload), "https://other.example", "[\"" ISSUER "\"]", now + 600,
+               now - 5);
+    jwt_fixture_sign(rsa_key, "RS256", "rsa-1", payload, token);
+    assert_int_equal(k8s_jwks_verify(token, &info), 0);
+}
+
+/* ===== Key set ===== */
+
+static void test_unknown_kid_requests_refresh(void **state) {
+    (void)state;
+    char payload[512], token[2048];
+    k8s_token_info_t info;
+    time_t now = time(NULL);
+
+    assert_int_equal(k8s_jwks_needs_refresh(300), 0);
+
+    claims(payload, sizeof(payload), now + 600, now - 5);
+    jwt_fixture_sign(rsa_key, "RS256", "rotated", payload, token);
+    assert_int_equal(k8s_jwks_verify(token, &info), 0);
+    assert_int_equal(k8s_jwks_needs_refresh(300), 1);
+
+    /* A stale set is refreshed too */
+    assert_int_equal(k8s_jwks_needs_refresh(0), 1);
+}
+
+static void test_invalid_jwks_keeps_keys(void **state) {
+    (void)state;
+    char jwks[2048];
+
+    assert_int_equal(k8s_jwks_load("not json", ISSUER), 0);
+    assert_int_equal(k8s_jwks_load("{\"keys\":[]}", ISSUER), 0);
+    assert_int_equal(k8s_jwks_load("{\"keys\":[{\"kty\":\"RSA\",\"kid\":\"x\",\"n\":\"AQAB\",\"e\":\"AQAB\"}]}", ISSUER), 0);
+
+    /* Usable keys, but no issuer to check tokens against */
+    make_jwks(jwks, sizeof(jwks));
+    assert_int_equal(k8s_jwks_load(jwks, NULL), 0);
+    assert_int_equal(k8s_jwks_count(), 2);
+}
+
+static void test_unreachable_keeps_keys(void **state) {
+    (void)state;
+    k8s_config_t config;
+    k8s_config_init_default(&config);
+    config.api_server_url = "http://127.0.0.1:1";
+    config.token_path = "/dev/null/none";
+    config.timeout_seconds = 2;
+
+    assert_int_equal(k8s_jwks_refresh(&config), 0);
+    assert_int_equal(k8s_jwks_count(), 2);
+
+    /* Just tried: not due again right away */
+    assert_int_equal(k8s_jwks_needs_refresh(300), 0);
+}
+
+static void test_empty_set_needs_refresh(void **state) {
+    (void)state;
+    k8s_jwks_clear();
+    assert_int_equal(k8s_jwks_count(), 0);
+    assert_int_equal(k8s_jwks_needs_refresh(300), 1);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_rs256_verifies, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_es256_verifies, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_bad_signature, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_forged, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_claims_checked, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_audience_checked, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_unknown_kid_requests_refresh, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_invalid_jwks_keeps_keys, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_unreachable_keeps_keys, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_empty_set_needs_refresh, test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, group_setup, group_teardown);
+}
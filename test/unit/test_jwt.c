@@ -0,0 +1,122 @@
+/*
+ * Unit tests for jwt.c using CMocka
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jwt.h"
+#include "jwt_fixtures.h"
+
+/* ========================================================================
+ * base64url
+ * ======================================================================== */
+
+static void test_base64url_decode(void **state) {
+    (void)state;
+    unsigned char out[32];
+    size_t len = 0;
+
+    assert_true(k8s_base64url_decode("aGVsbG8", 7, out, &len));
+    assert_int_equal(len, 5);
+    assert_memory_equal(out, "hello", 5);
+
+    /* URL-safe alphabet: 0xfb 0xff */
+    assert_true(k8s_base64url_decode("-_8", 3, out, &len));
+    assert_int_equal(len, 2);
+    assert_int_equal(out[0], 0xfb);
+    assert_int_equal(out[1], 0xff);
+
+    /* Padding is tolerated */
+    assert_true(k8s_base64url_decode("aGk=", 4, out, &len));
+    assert_int_equal(len, 2);
+}
+
+static void test_base64url_rejects_invalid(void **state) {
+    (void)state;
+    unsigned char out[32];
+    size_t len = 0;
+
+    assert_false(k8s_base64url_decode("aGVs+G8", 7, out, &len));
+    assert_false(k8s_base64url_decode("aGVsb", 5, out, &len));
+}
+
+/* ========================================================================
+ * Claims
+ * ======================================================================== */
+
+static void test_payload_claims(void **state) {
+    (void)state;
+    char jwt[2048];
+    json_object *value = NULL;
+
+    jwt_fixture_unsigned("{\"iss\":\"https://kubernetes.default.svc\",\"sub\":\"system:serviceaccount:default:app\"}", jwt);
+    json_object *claims = k8s_jwt_payload(jwt);
+    assert_non_null(claims);
+    assert_true(json_object_object_get_ex(claims, "sub", &value));
+    assert_string_equal(json_object_get_string(value), "system:serviceaccount:default:app");
+    json_object_put(claims);
+}
+
+static void test_expiry(void **state) {
+    (void)state;
+    char jwt[2048];
+
+    jwt_fixture_unsigned("{\"exp\":1900000000,\"iat\":1800000000}", jwt);
+    assert_int_equal(k8s_jwt_expiry(jwt), 1900000000);
+
+    jwt_fixture_unsigned("{\"iat\":1800000000}", jwt);
+    assert_int_equal(k8s_jwt_expiry(jwt), 0);
+
+    jwt_fixture_unsigned("{\"exp\":\"soon\"}", jwt);
+    assert_int_equal(k8s_jwt_expiry(jwt), 0);
+}
+
+static void test_bound_pod_claim(void **state) {
+    (void)state;
+    char jwt[2048];
+    k8s_jwt_claims_t claims;
+
+    jwt_fixture_unsigned("{\"exp\":1900000000,\"kubernetes.io\":{\"namespace\":\"default\","
+             "\"pod\":{\"name\":\"app-0\",\"uid\":\"7d3c8f0e-pod\"},"
+             "\"serviceaccount\":{\"name\":\"app\",\"uid\":\"1b2c-sa\"}}}", jwt);
+    assert_true(k8s_jwt_claims(jwt, &claims));
+    assert_int_equal(claims.exp, 1900000000);
+    assert_string_equal(claims.pod_uid, "7d3c8f0e-pod");
+
+    /* Legacy Secret-based tokens are not bound to a pod */
+    jwt_fixture_unsigned("{\"kubernetes.io/serviceaccount/namespace\":\"default\"}", jwt);
+    assert_true(k8s_jwt_claims(jwt, &claims));
+    assert_string_equal(claims.pod_uid, "");
+
+    assert_false(k8s_jwt_claims("opaque-token", &claims));
+}
+
+static void test_not_a_jwt(void **state) {
+    (void)state;
+
+    assert_null(k8s_jwt_payload("opaque-token"));
+    assert_null(k8s_jwt_payload("a..b"));
+    assert_null(k8s_jwt_payload("a.bm90IGpzb24.c"));    /* "not json" */
+    assert_null(k8s_jwt_payload("a.WzFd.c"));           /* "[1]" */
+    assert_null(k8s_jwt_payload(NULL));
+    assert_int_equal(k8s_jwt_expiry("opaque-token"), 0);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_base64url_decode),
+        cmocka_unit_test(test_base64url_rejects_invalid),
+        cmocka_unit_test(test_payload_claims),
+        cmocka_unit_test(test_expiry),
+        cmocka_unit_test(test_bound_pod_claim),
+        cmocka_unit_test(test_not_a_jwt),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
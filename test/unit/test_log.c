@@ -0,0 +1,221 @@
+/*
+ * Unit tests for log.c using CMocka
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "log.h"
+
+#define MAX_CAPTURED 2048
+
+static char captured[MAX_CAPTURED][K8S_LOG_TEXT_MAX + 128];
+static int captured_count = 0;
+
+static void capture_sink(const char *line) {
+    if (captured_count < MAX_CAPTURED) {
+        snprintf(captured[captured_count], sizeof(captured[0]), "%s", line);
+    }
+    captured_count++;
+}
+
+/* Number of captured lines containing the given text */
+static int count_matching(const char *text) {
+    int n = 0;
+    for (int i = 0; i < captured_count && i < MAX_CAPTURED; i++) {
+        if (strstr(captured[i], text)) {
+            n++;
+        }
+    }
+    return n;
+}
+
+static int test_setup(void **state) {
+    (void)state;
+    captured_count = 0;
+    k8s_log_set_sink(capture_sink);
+    k8s_log_set_level(K8S_LOG_DEFAULT_LEVEL);
+    return 0;
+}
+
+static int test_teardown(void **state) {
+    (void)state;
+    k8s_log_stop();
+    k8s_log_set_sink(NULL);
+    return 0;
+}
+
+/* ========================================================================
+ * Levels and format
+ * ======================================================================== */
+
+static void test_level_filtering(void **state) {
+    (void)state;
+
+    K8S_LOG(K8S_LOG_INFO, "filter_test", "n=%d", 1);
+    K8S_LOG(K8S_LOG_DEBUG, "filter_test", "n=%d", 2);
+    K8S_LOG(K8S_LOG_WARNING, "filter_test", "n=%d", 3);
+    K8S_LOG(K8S_LOG_ERROR, "filter_test", "n=%d", 4);
+
+    assert_int_equal(captured_count, 2);
+    assert_int_equal(count_matching("n=3"), 1);
+    assert_int_equal(count_matching("n=4"), 1);
+
+    k8s_log_set_level(K8S_LOG_DEBUG);
+    assert_true(k8s_log_enabled(K8S_LOG_DEBUG));
+    K8S_LOG(K8S_LOG_DEBUG, "filter_test", "n=%d", 5);
+    assert_int_equal(count_matching("n=5"), 1);
+}
+
+static void test_disabled_level_skips_arguments(void **state) {
+    (void)state;
+    int evaluated = 0;
+
+    K8S_LOG(K8S_LOG_DEBUG, "lazy_test", "n=%d", ++evaluated);
+    assert_int_equal(evaluated, 0);
+}
+
+static void test_level_clamped(void **state) {
+    (void)state;
+
+    k8s_log_set_level(99);
+    assert_true(k8s_log_enabled(K8S_LOG_DEBUG));
+    k8s_log_set_level(-5);
+    assert_true(k8s_log_enabled(K8S_LOG_ERROR));
+    assert_false(k8s_log_enabled(K8S_LOG_WARNING));
+}
+
+static void test_line_format(void **state) {
+    (void)state;
+
+    K8S_LOG(K8S_LOG_WARNING, "login_failed", "user=\"%s\" reason=%s", "ns/sa", "rejected");
+
+    assert_int_equal(captured_count, 1);
+    assert_non_null(strstr(captured[0],
+        " K8s Auth: level=warning event=login_failed user=\"ns/sa\" reason=rejected"));
+    /* Timestamp with milliseconds in front */
+    assert_int_equal(captured[0][4], '-');
+    assert_int_equal(captured[0][19], '.');
+}
+
+/* ========================================================================
+ * Rate limiting
+ * ======================================================================== */
+
+static void test_repeats_suppressed(void **state) {
+    (void)state;
+
+    for (int i = 0; i < 5; i++) {
+        K8S_LOG(K8S_LOG_WARNING, "repeat_test", "host=a");
+    }
+    K8S_LOG(K8S_LOG_WARNING, "repeat_test", "host=b");
+
+    assert_int_equal(count_matching("host=a"), 1);
+    assert_int_equal(count_matching("host=b"), 1);
+}
+
+static void test_suppressed_summary_on_stop(void **state) {
+    (void)state;
+
+    assert_true(k8s_log_start());
+    for (int i = 0; i < 4; i++) {
+        K8S_LOG(K8S_LOG_WARNING, "summary_test", "host=c");
+    }
+    k8s_log_stop();
+
+    assert_int_equal(count_matching("event=summary_test host=c"), 1);
+    assert_int_equal(count_matching("event=summary_test suppressed=3"), 1);
+}
+
+/* ========================================================================
+ * Drain thread
+ * ======================================================================== */
+
+static void *log_from_thread(void *arg) {
+    int id = *(int *)arg;
+    for (int i = 0; i < 8; i++) {
+        K8S_LOG(K8S_LOG_WARNING, "thread_test", "thread=%d seq=%d", id, i);
+    }
+    return NULL;
+}
+
+static void test_async_lines_drained(void **state) {
+    (void)state;
+    pthread_t threads[4];
+    int ids[4];
+
+    assert_true(k8s_log_start());
+    for (int i = 0; i < 4; i++) {
+        ids[i] = i;
+        pthread_create(&threads[i], NULL, log_from_thread, &ids[i]);
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    k8s_log_stop();
+
+    assert_int_equal(count_matching("event=thread_test"), 32);
+    assert_int_equal(count_matching("thread=2 seq=7"), 1);
+}
+
+static void test_flush_writes_queued_lines(void **state) {
+    (void)state;
+
+    assert_true(k8s_log_start());
+    K8S_LOG(K8S_LOG_ERROR, "flush_test", "n=1");
+    k8s_log_flush();
+    assert_int_equal(count_matching("event=flush_test"), 1);
+}
+
+static void test_full_ring_drops(void **state) {
+    (void)state;
+    unsigned long long before = k8s_log_dropped();
+
+    assert_true(k8s_log_start());
+    for (int i = 0; i < 1000; i++) {
+        K8S_LOG(K8S_LOG_WARNING, "burst_test", "seq=%d", i);
+    }
+    k8s_log_stop();
+
+    unsigned long long dropped = k8s_log_dropped() - before;
+    assert_true(dropped > 0);
+    assert_int_equal((unsigned long long)count_matching("event=burst_test") + dropped, 1000);
+    assert_int_equal(count_matching("event=log_dropped"), 1);
+}
+
+static void test_restart_after_stop(void **state) {
+    (void)state;
+
+    assert_true(k8s_log_start());
+    K8S_LOG(K8S_LOG_WARNING, "restart_test", "run=1");
+    k8s_log_stop();
+
+    /* This thread's ring was freed by stop; a new one must be used */
+    assert_true(k8s_log_start());
+    K8S_LOG(K8S_LOG_WARNING, "restart_test", "run=2");
+    k8s_log_stop();
+
+    assert_int_equal(count_matching("event=restart_test"), 2);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_level_filtering, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_disabled_level_skips_arguments, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_level_clamped, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_line_format, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_repeats_suppressed, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_suppressed_summary_on_stop, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_async_lines_drained, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_flush_writes_queued_lines, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_full_ring_drops, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_restart_after_stop, test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
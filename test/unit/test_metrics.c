@@ -0,0 +1,317 @@
+/*
+ * Unit tests for metrics.c using CMocka
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metrics.h"
+#include "stats.h"
+#include "identity_stats.h"
+#include "backend.h"
+#include "cluster.h"
+
+/* ===== Stubs ===== */
+
+static int backends = 0;
+static int clusters = 0;
+
+static int stub_health(void) {
+    return 1;
+}
+
+static void stub_stats(k8s_backend_stats_t *out) {
+    out->requests = 10;
+    out->verdicts = 8;
+    out->accepted = 7;
+    out->unavailable = 2;
+    out->time_us = 1500000;
+    out->healthy = 1;
+}
+
+static const k8s_backend_t stub_backend = {
+    .name = "jwks",
+    .health = stub_health,
+    .stats = stub_stats,
+};
+
+int k8s_backend_count(void) {
+    return backends;
+}
+
+const k8s_backend_t *k8s_backend_get(int index) {
+    return index >= 0 && index < backends ? &stub_backend : NULL;
+}
+
+int k8s_cluster_collect(k8s_cluster_row_t *rows, int max) {
+    int n = clusters < max ? clusters : max;
+    for (int i = 0; i < n; i++) {
+        memset(&rows[i], 0, sizeof(rows[i]));
+        snprintf(rows[i].name, sizeof(rows[i].name), "cluster-%d", i);
+        rows[i].requests = 5;
+        rows[i].unavailable = 3;
+        rows[i].refused = 4;
+        rows[i].shed = 1;
+        rows[i].in_flight = 2;
+        rows[i].open = i == 1;
+    }
+    return n;
+}
+
+/* ===== Fixtures ===== */
+
+static int test_setup(void **state) {
+    (void)state;
+    k8s_stats_reset();
+    k8s_identity_reset();
+    backends = 0;
+    clusters = 0;
+    return 0;
+}
+
+static int test_teardown(void **state) {
+    (void)state;
+    k8s_metrics_stop();
+    return 0;
+}
+
+/* A port nothing listens on right now */
+static int free_port(void) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    getsockname(fd, (struct sockaddr *)&addr, &len);
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+/* Send a request and return the whole response (caller frees) */
+static char *http_get(int port, const char *request) {
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    size_t cap = 65536, len = 0;
+    char *response = calloc(1, cap);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((unsigned short)port);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        free(response);
+        return NULL;
+    }
+
+    send(fd, request, strlen(request), 0);
+    for (;;) {
+        if (len + 1 == cap) {
+            cap *= 2;
+            response = realloc(response, cap);
+        }
+        ssize_t n = recv(fd, response + len, cap - len - 1, 0);
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t)n;
+    }
+    response[len] = '\0';
+    close(fd);
+    return response;
+}
+
+/* ========================================================================
+ * Rendering
+ * ======================================================================== */
+
+static void test_render_counters(void **state) {
+    (void)state;
+    size_t len = 0;
+
+    k8s_stats_inc(K8S_STAT_ATTEMPTS);
+    k8s_stats_inc(K8S_STAT_ATTEMPTS);
+    k8s_stats_inc(K8S_STAT_FAIL_REJECTED);
+
+    char *text = k8s_metrics_render(&len);
+    assert_non_null(text);
+    assert_int_equal(strlen(text), len);
+    assert_non_null(strstr(text, "# TYPE auth_k8s_attempts_total counter\n"));
+    assert_non_null(strstr(text, "\nauth_k8s_attempts_total 2\n"));
+    assert_non_null(strstr(text, "\nauth_k8s_failures_rejected_total 1\n"));
+    assert_non_null(strstr(text, "\nauth_k8s_identities_evicted_total 0\n"));
+    assert_non_null(strstr(text, "\nauth_k8s_log_dropped_total "));
+    free(text);
+}
+
+static void test_render_histogram(void **state) {
+    (void)state;
+    size_t len = 0;
+
+    k8s_stats_record(K8S_HIST_LOGIN, 3);          /* Below 4 us */
+    k8s_stats_record(K8S_HIST_LOGIN, 1500);       /* Between 1024 and 2047 us */
+    k8s_stats_record(K8S_HIST_LOGIN, 2500000);    /* 2.5 s */
+
+    char *text = k8s_metrics_render(&len);
+    assert_non_null(text);
+    assert_non_null(strstr(text, "# TYPE auth_k8s_login_latency_seconds histogram\n"));
+    assert_non_null(strstr(text, "auth_k8s_login_latency_seconds_bucket{le=\"0.000003\"} 1\n"));
+    assert_non_null(strstr(text, "auth_k8s_login_latency_seconds_bucket{le=\"0.001023\"} 1\n"));
+    assert_non_null(strstr(text, "auth_k8s_login_latency_seconds_bucket{le=\"0.002047\"} 2\n"));
+    assert_non_null(strstr(text, "auth_k8s_login_latency_seconds_bucket{le=\"+Inf\"} 3\n"));
+    assert_non_null(strstr(text, "auth_k8s_login_latency_seconds_sum 2.501503\n"));
+    assert_non_null(strstr(text, "auth_k8s_login_latency_seconds_count 3\n"));
+    assert_non_null(strstr(text, "auth_k8s_parse_latency_seconds_count 0\n"));
+    free(text);
+}
+
+static void test_render_buckets_cumulative(void **state) {
+    (void)state;
+    size_t len = 0;
+
+    for (uint64_t v = 1; v < 100000000; v *= 3) {
+        k8s_stats_record(K8S_HIST_API, v);
+    }
+
+    char *text = k8s_metrics_render(&len);
+    assert_non_null(text);
+
+    unsigned long long prev = 0;
+    int lines = 0;
+    for (char *p = strstr(text, "auth_k8s_api_latency_seconds_bucket"); p;
+         p = strstr(p + 1, "auth_k8s_api_latency_seconds_bucket")) {
+        unsigned long long count = strtoull(strstr(p, "} ") + 2, NULL, 10);
+        assert_true(count >= prev);
+        prev = count;
+        lines++;
+    }
+    assert_true(lines > 20);
+    free(text);
+}
+
+static void test_render_backends_and_clusters(void **state) {
+    (void)state;
+    size_t len = 0;
+
+    char *text = k8s_metrics_render(&len);
+    assert_non_null(text);
+    assert_null(strstr(text, "auth_k8s_backend_"));
+    assert_null(strstr(text, "auth_k8s_cluster_"));
+    free(text);
+
+    backends = 1;
+    clusters = 2;
+    text = k8s_metrics_render(&len);
+    assert_non_null(text);
+    assert_non_null(strstr(text, "# TYPE auth_k8s_backend_requests_total counter\n"
+                                 "auth_k8s_backend_requests_total{backend=\"jwks\"} 10\n"));
+    assert_non_null(strstr(text, "\nauth_k8s_backend_unavailable_total{backend=\"jwks\"} 2\n"));
+    assert_non_null(strstr(text, "\nauth_k8s_backend_seconds_total{backend=\"jwks\"} 1.500000\n"));
+    assert_non_null(strstr(text, "# TYPE auth_k8s_backend_healthy gauge\n"
+                                 "auth_k8s_backend_healthy{backend=\"jwks\"} 1\n"));
+    assert_non_null(strstr(text, "# TYPE auth_k8s_cluster_refused_total counter\n"
+                                 "auth_k8s_cluster_refused_total{cluster=\"cluster-0\"} 4\n"
+                                 "auth_k8s_cluster_refused_total{cluster=\"cluster-1\"} 4\n"));
+    assert_non_null(strstr(text, "\nauth_k8s_cluster_in_flight{cluster=\"cluster-1\"} 2\n"));
+    assert_non_null(strstr(text, "# TYPE auth_k8s_cluster_open gauge\n"
+                                 "auth_k8s_cluster_open{cluster=\"cluster-0\"} 0\n"
+                                 "auth_k8s_cluster_open{cluster=\"cluster-1\"} 1\n"));
+    free(text);
+}
+
+/* ========================================================================
+ * Listener
+ * ======================================================================== */
+
+static void test_serves_metrics(void **state) {
+    (void)state;
+    int port = free_port();
+
+    k8s_stats_inc(K8S_STAT_SUCCESSES);
+    assert_true(k8s_metrics_start(port));
+
+    char *response = http_get(port, "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    assert_non_null(response);
+    assert_memory_equal(response, "HTTP/1.1 200 OK\r\n", 17);
+    assert_non_null(strstr(response, "Content-Type: text/plain; version=0.0.4"));
+    assert_non_null(strstr(response, "\nauth_k8s_successes_total 1\n"));
+    free(response);
+}
+
+static void test_unknown_path_and_method(void **state) {
+    (void)state;
+    int port = free_port();
+
+    assert_true(k8s_metrics_start(port));
+
+    char *response = http_get(port, "GET /admin HTTP/1.1\r\n\r\n");
+    assert_non_null(response);
+    assert_memory_equal(response, "HTTP/1.1 404", 12);
+    free(response);
+
+    response = http_get(port, "POST /metrics HTTP/1.1\r\n\r\n");
+    assert_non_null(response);
+    assert_memory_equal(response, "HTTP/1.1 405", 12);
+    free(response);
+}
+
+static void test_stop_and_restart(void **state) {
+    (void)state;
+    int port = free_port();
+
+    assert_true(k8s_metrics_start(port));
+    /* Already running: no second listener */
+    assert_true(k8s_metrics_start(port));
+    k8s_metrics_stop();
+    assert_null(http_get(port, "GET /metrics HTTP/1.1\r\n\r\n"));
+
+    assert_true(k8s_metrics_start(port));
+    char *response = http_get(port, "GET /metrics HTTP/1.1\r\n\r\n");
+    assert_non_null(response);
+    free(response);
+}
+
+static void test_port_in_use(void **state) {
+    (void)state;
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    assert_int_equal(bind(fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+    listen(fd, 1);
+    getsockname(fd, (struct sockaddr *)&addr, &len);
+
+    assert_false(k8s_metrics_start(ntohs(addr.sin_port)));
+    close(fd);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_render_counters, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_render_histogram, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_render_buckets_cumulative, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_render_backends_and_clusters, test_setup,
+                                        test_teardown),
+        cmocka_unit_test_setup_teardown(test_serves_metrics, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_unknown_path_and_method, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_stop_and_restart, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_port_in_use, test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,287 @@
+/*
+ * Unit tests for policy.c using CMocka
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "policy.h"
+
+static k8s_policy_t *acquire(const char *text) {
+    return k8s_policy_acquire(text, strlen(text));
+}
+
+static int teardown(void **state) {
+    (void)state;
+    k8s_policy_clear();
+    return 0;
+}
+
+static void test_map(void **state) {
+    (void)state;
+    k8s_policy_t *p = acquire("team-*/* -> app_rw, payments/* -> payments_rw,"
+                              " payments/report-* -> payments_ro, payments/admin -> dba");
+    assert_non_null(p);
+    assert_int_equal(k8s_policy_valid(p), 1);
+    assert_int_equal(k8s_policy_rules(p), 4);
+
+    assert_string_equal(k8s_policy_map(p, "team-a/web"), "app_rw");
+    assert_string_equal(k8s_policy_map(p, "team-blue/worker"), "app_rw");
+    assert_string_equal(k8s_policy_map(p, "payments/api"), "payments_rw");
+
+    /* The longest matching pattern wins */
+    assert_string_equal(k8s_policy_map(p, "payments/report-daily"), "payments_ro");
+    assert_string_equal(k8s_policy_map(p, "payments/admin"), "dba");
+    assert_string_equal(k8s_policy_map(p, "payments/admins"), "payments_rw");
+
+    assert_null(k8s_policy_map(p, "team/web"));
+    assert_null(k8s_policy_map(p, "default/myapp"));
+    assert_null(k8s_policy_map(p, "payments"));
+    assert_null(k8s_policy_map(p, "Team-a/web"));
+    k8s_policy_release(p);
+}
+
+static void test_catch_all(void **state) {
+    (void)state;
+    k8s_policy_t *p = acquire("* -> app_ro, prod/* -> app_rw");
+    assert_string_equal(k8s_policy_map(p, "dev/web"), "app_ro");
+    assert_string_equal(k8s_policy_map(p, "prod/web"), "app_rw");
+    assert_string_equal(k8s_policy_map(p, "prod"), "app_ro");
+    k8s_policy_release(p);
+
+    p = acquire("*/* -> app_ro");
+    assert_string_equal(k8s_policy_map(p, "dev/web"), "app_ro");
+    k8s_policy_release(p);
+}
+
+static void test_no_rules(void **state) {
+    (void)state;
+    assert_null(acquire(""));
+    assert_null(k8s_policy_acquire(NULL, 0));
+
+    k8s_policy_t *p = acquire(" , ");
+    assert_non_null(p);
+    assert_int_equal(k8s_policy_valid(p), 1);
+    assert_int_equal(k8s_policy_rules(p), 0);
+    assert_null(k8s_policy_map(p, "default/myapp"));
+    k8s_policy_release(p);
+}
+
+static void test_invalid(void **state) {
+    (void)state;
+    const char *invalid[] = {
+        "team-*/web -> app_rw",         /* Namespace wildcard with a name */
+        "team-*",                       /* Not a rule */
+        "payments -> app_rw",           /* No name */
+        "/web -> app_rw",
+        "payments/ -> app_rw",
+        "pay*ments/web -> app_rw",
+        "Payments/web -> app_rw",
+        "payments/web/x -> app_rw",
+        "payments/web ->",
+        "payments/web -> app rw",
+        "payments/web -> 'app'",
+        "payments/* -> a, payments/* -> b",
+    };
+
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        k8s_policy_t *p = acquire(invalid[i]);
+        assert_non_null(p);
+        assert_int_equal(k8s_policy_valid(p), 0);
+        assert_null(k8s_policy_map(p, "payments/web"));
+        k8s_policy_release(p);
+    }
+
+    char text[K8S_POLICY_MAX_LEN + 64];
+    memset(text, ' ', sizeof(text));
+    memcpy(text, "* -> app_rw", 11);
+    k8s_policy_t *p = k8s_policy_acquire(text, sizeof(text));
+    assert_int_equal(k8s_policy_valid(p), 0);
+    k8s_policy_release(p);
+
+    p = k8s_policy_acquire("* -> a\0b", 8);
+    assert_int_equal(k8s_policy_valid(p), 0);
+    k8s_policy_release(p);
+}
+
+static void test_options(void **state) {
+    (void)state;
+    k8s_policy_t *p = acquire("audience=mariadb, cache_ttl=3600, timeout = 2,"
+                              " group=system:serviceaccounts:payments, group=admins,"
+                              " pod_label=app=api, pod_label=tier=, payments/* -> payments_rw");
+    assert_int_equal(k8s_policy_valid(p), 1);
+    assert_int_equal(k8s_policy_rules(p), 1);
+    assert_string_equal(k8s_policy_audience(p), "mariadb");
+    assert_int_equal(k8s_policy_cache_ttl(p, 60), 3600);
+    assert_int_equal(k8s_policy_timeout(p, 10), 2);
+    assert_int_equal(k8s_policy_strict(p), 1);
+    assert_int_equal(k8s_policy_pod_labels(p), 2);
+
+    assert_int_equal(k8s_policy_groups_allowed(p, "system:serviceaccounts\n"
+                                                  "system:serviceaccounts:payments\n"), 1);
+    assert_int_equal(k8s_policy_groups_allowed(p, "admins\n"), 1);
+    assert_int_equal(k8s_policy_groups_allowed(p, "system:serviceaccounts\n"
+                                                  "system:serviceaccounts:pay\n"), 0);
+    assert_int_equal(k8s_policy_groups_allowed(p, ""), 0);
+    k8s_policy_release(p);
+
+    /* Nothing set: the global settings apply */
+    p = acquire("payments/* -> payments_rw");
+    assert_null(k8s_policy_audience(p));
+    assert_int_equal(k8s_policy_cache_ttl(p, 60), 60);
+    assert_int_equal(k8s_policy_timeout(p, 10), 10);
+    assert_int_equal(k8s_policy_strict(p), 0);
+    assert_int_equal(k8s_policy_groups_allowed(p, ""), 1);
+    k8s_policy_release(p);
+
+    assert_null(k8s_policy_audience(NULL));
+    assert_int_equal(k8s_policy_cache_ttl(NULL, 60), 60);
+    assert_int_equal(k8s_policy_strict(NULL), 0);
+    assert_int_equal(k8s_policy_pod_labels(NULL), 0);
+
+    /* A reuse window of its own is not strict */
+    p = acquire("cache_ttl=0");
+    assert_int_equal(k8s_policy_cache_ttl(p, 60), 0);
+    assert_int_equal(k8s_policy_strict(p), 0);
+    k8s_policy_release(p);
+}
+
+static void test_bad_options(void **state) {
+    (void)state;
+    const char *invalid[] = {
+        "audience=",
+        "audience=a b",
+        "audience=a, audience=b",
+        "cache_ttl=-1",
+        "cache_ttl=86401",
+        "cache_ttl=10s",
+        "timeout=0",
+        "timeout=",
+        "group=",
+        "pod_label=app",
+        "pod_label==web",
+        "cluster=",
+        "cluster=East",
+        "cluster=east_1",
+        "color=blue",
+    };
+
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        k8s_policy_t *p = acquire(invalid[i]);
+        assert_int_equal(k8s_policy_valid(p), 0);
+        assert_null(k8s_policy_audience(p));
+        assert_int_equal(k8s_policy_strict(p), 0);
+        k8s_policy_release(p);
+    }
+}
+
+static void test_clusters(void **state) {
+    (void)state;
+    k8s_policy_t *p = acquire("cluster=east, cluster=local, * -> app_rw");
+    assert_int_equal(k8s_policy_valid(p), 1);
+    assert_int_equal(k8s_policy_cluster_allowed(p, "east"), 1);
+    assert_int_equal(k8s_policy_cluster_allowed(p, "local"), 1);
+    assert_int_equal(k8s_policy_cluster_allowed(p, "west"), 0);
+    k8s_policy_release(p);
+
+    /* Mapping rules alone only map ServiceAccounts of the local cluster */
+    p = acquire("* -> app_rw");
+    assert_int_equal(k8s_policy_cluster_allowed(p, "local"), 1);
+    assert_int_equal(k8s_policy_cluster_allowed(p, "east"), 0);
+    k8s_policy_release(p);
+
+    /* Otherwise the user name decides */
+    p = acquire("timeout=2");
+    assert_int_equal(k8s_policy_cluster_allowed(p, "east"), 1);
+    k8s_policy_release(p);
+    assert_int_equal(k8s_policy_cluster_allowed(NULL, "east"), 1);
+
+    p = acquire("cluster=east");
+    assert_int_equal(k8s_policy_cluster_allowed(p, "local"), 0);
+    k8s_policy_release(p);
+}
+
+#define POD_JSON \
+    "{\"kind\":\"Pod\",\"metadata\":{\"name\":\"api-1\",\"uid\":\"pod-uid-1\"," \
+    "\"labels\":{\"app\":\"api\",\"tier\":\"backend\"}}}"
+
+static void test_pod_labels(void **state) {
+    (void)state;
+    k8s_policy_t *p = acquire("pod_label=app=api, pod_label=tier=backend");
+    assert_int_equal(k8s_policy_pod_allowed(p, POD_JSON, "pod-uid-1"), 1);
+
+    /* Another pod under the same name */
+    assert_int_equal(k8s_policy_pod_allowed(p, POD_JSON, "pod-uid-2"), 0);
+    assert_int_equal(k8s_policy_pod_allowed(p, POD_JSON, ""), 0);
+    assert_int_equal(k8s_policy_pod_allowed(p, NULL, "pod-uid-1"), 0);
+    assert_int_equal(k8s_policy_pod_allowed(p, "{", "pod-uid-1"), 0);
+    k8s_policy_release(p);
+
+    p = acquire("pod_label=app=api, pod_label=tier=frontend");
+    assert_int_equal(k8s_policy_pod_allowed(p, POD_JSON, "pod-uid-1"), 0);
+    k8s_policy_release(p);
+
+    p = acquire("pod_label=owner=");
+    assert_int_equal(k8s_policy_pod_allowed(p, POD_JSON, "pod-uid-1"), 0);
+    k8s_policy_release(p);
+}
+
+static void test_cached(void **state) {
+    (void)state;
+    k8s_policy_t *a = acquire("prod/* -> app_rw");
+    k8s_policy_t *b = acquire("prod/* -> app_rw");
+    k8s_policy_t *c = acquire("prod/* -> app_ro");
+
+    /* Compiled once per distinct text */
+    assert_ptr_equal(a, b);
+    assert_ptr_not_equal(a, c);
+    assert_int_equal(k8s_policy_cached(), 2);
+
+    /* Still usable after the cache let go of it */
+    k8s_policy_clear();
+    assert_int_equal(k8s_policy_cached(), 0);
+    assert_string_equal(k8s_policy_map(a, "prod/web"), "app_rw");
+    k8s_policy_release(a);
+    k8s_policy_release(b);
+    k8s_policy_release(c);
+}
+
+static void test_eviction(void **state) {
+    (void)state;
+    char text[64];
+    k8s_policy_t *first = acquire("ns-0/* -> account_0");
+
+    for (int i = 1; i <= K8S_POLICY_CACHE_SIZE; i++) {
+        snprintf(text, sizeof(text), "ns-%d/* -> account_%d", i, i);
+        k8s_policy_release(acquire(text));
+    }
+    assert_int_equal(k8s_policy_cached(), K8S_POLICY_CACHE_SIZE);
+
+    /* The least recently used one went, but its holder can still use it */
+    assert_string_equal(k8s_policy_map(first, "ns-0/web"), "account_0");
+    k8s_policy_t *again = acquire("ns-0/* -> account_0");
+    assert_ptr_not_equal(again, first);
+    k8s_policy_release(again);
+    k8s_policy_release(first);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_teardown(test_map, teardown),
+        cmocka_unit_test_teardown(test_catch_all, teardown),
+        cmocka_unit_test_teardown(test_no_rules, teardown),
+        cmocka_unit_test_teardown(test_invalid, teardown),
+        cmocka_unit_test_teardown(test_options, teardown),
+        cmocka_unit_test_teardown(test_bad_options, teardown),
+        cmocka_unit_test_teardown(test_clusters, teardown),
+        cmocka_unit_test_teardown(test_pod_labels, teardown),
+        cmocka_unit_test_teardown(test_cached, teardown),
+        cmocka_unit_test_teardown(test_eviction, teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,177 @@
+/*
+ * Unit tests for resolver.c using CMocka
+ *
+ * Uses localhost and the KUBERNETES_SERVICE_* environment variables, so no
+ * network access is needed.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "resolver.h"
+
+static int test_setup(void **state) {
+    (void)state;
+    unsetenv("KUBERNETES_SERVICE_HOST");
+    unsetenv("KUBERNETES_SERVICE_PORT");
+    return 0;
+}
+
+/* ========================================================================
+ * k8s_resolver_init
+ * ======================================================================== */
+
+static void test_init_default_https_port(void **state) {
+    (void)state;
+    k8s_resolver_t r;
+    assert_int_equal(k8s_resolver_init(&r, "https://kubernetes.default.svc"), 1);
+    assert_string_equal(r.host, "kubernetes.default.svc");
+    assert_int_equal(r.port, 443);
+}
+
+static void test_init_explicit_port_and_path(void **state) {
+    (void)state;
+    k8s_resolver_t r;
+    assert_int_equal(k8s_resolver_init(&r, "https://api.example.com:6443/prefix"), 1);
+    assert_string_equal(r.host, "api.example.com");
+    assert_int_equal(r.port, 6443);
+}
+
+static void test_init_http_default_port(void **state) {
+    (void)state;
+    k8s_resolver_t r;
+    assert_int_equal(k8s_resolver_init(&r, "http://localhost"), 1);
+    assert_int_equal(r.port, 80);
+}
+
+static void test_init_ip_literal_not_pinned(void **state) {
+    (void)state;
+    k8s_resolver_t r;
+    assert_int_equal(k8s_resolver_init(&r, "https://10.96.0.1:443"), 0);
+    assert_int_equal(k8s_resolver_init(&r, "https://[fd00::1]:6443"), 0);
+    assert_string_equal(r.host, "fd00::1");
+    assert_int_equal(r.port, 6443);
+}
+
+static void test_init_invalid(void **state) {
+    (void)state;
+    k8s_resolver_t r;
+    assert_int_equal(k8s_resolver_init(&r, "kubernetes.default.svc"), 0);
+    assert_int_equal(k8s_resolver_init(&r, "https://host:notaport"), 0);
+    assert_int_equal(k8s_resolver_init(&r, "https://:443"), 0);
+    assert_int_equal(k8s_resolver_init(NULL, "https://host"), 0);
+}
+
+/* ========================================================================
+ * k8s_resolver_resolve
+ * ======================================================================== */
+
+static void test_resolve_localhost(void **state) {
+    (void)state;
+    k8s_resolver_t r;
+    char entry[K8S_RESOLVER_MAX_ENTRY_LEN];
+
+    k8s_resolver_init(&r, "https://localhost:6443");
+    assert_true(k8s_resolver_resolve(&r, entry, sizeof(entry)) >= 1);
+    assert_true(strncmp(entry, "localhost:6443:", 15) == 0);
+    assert_true(strstr(entry, "127.0.0.1") != NULL || strstr(entry, "[::1]") != NULL);
+}
+
+static void test_resolve_prefers_service_env(void **state) {
+    (void)state;
+    k8s_resolver_t r;
+    char entry[K8S_RESOLVER_MAX_ENTRY_LEN];
+
+    setenv("KUBERNETES_SERVICE_HOST", "10.96.0.1", 1);
+    setenv("KUBERNETES_SERVICE_PORT", "443", 1);
+
+    k8s_resolver_init(&r, "https://kubernetes.default.svc");
+    assert_int_equal(k8s_resolver_resolve(&r, entry, sizeof(entry)), 1);
+    assert_string_equal(entry, "kubernetes.default.svc:443:10.96.0.1");
+
+    k8s_resolver_init(&r, "https://kubernetes.default.svc.cluster.local");
+    assert_int_equal(k8s_resolver_resolve(&r, entry, sizeof(entry)), 1);
+    assert_string_equal(entry, "kubernetes.default.svc.cluster.local:443:10.96.0.1");
+}
+
+static void test_resolve_service_env_ipv6(void **state) {
+    (void)state;
+    k8s_resolver_t r;
+    char entry[K8S_RESOLVER_MAX_ENTRY_LEN];
+
+    setenv("KUBERNETES_SERVICE_HOST", "fd00:10:96::1", 1);
+
+    k8s_resolver_init(&r, "https://kubernetes.default.svc");
+    assert_int_equal(k8s_resolver_resolve(&r, entry, sizeof(entry)), 1);
+    assert_string_equal(entry, "kubernetes.default.svc:443:[fd00:10:96::1]");
+}
+
+static void test_resolve_env_ignored_for_other_hosts(void **state) {
+    (void)state;
+    k8s_resolver_t r;
+    char entry[K8S_RESOLVER_MAX_ENTRY_LEN];
+
+    setenv("KUBERNETES_SERVICE_HOST", "10.96.0.1", 1);
+
+    k8s_resolver_init(&r, "https://localhost");
+    assert_true(k8s_resolver_resolve(&r, entry, sizeof(entry)) >= 1);
+    assert_null(strstr(entry, "10.96.0.1"));
+}
+
+static void test_resolve_env_ignored_for_other_port(void **state) {
+    (void)state;
+    k8s_resolver_t r;
+    char entry[K8S_RESOLVER_MAX_ENTRY_LEN];
+
+    setenv("KUBERNETES_SERVICE_HOST", "10.96.0.1", 1);
+    setenv("KUBERNETES_SERVICE_PORT", "443", 1);
+
+    /* Port differs from the service port: fall back to DNS, which fails for
+     * this name outside a cluster */
+    k8s_resolver_init(&r, "https://kubernetes.default.svc.invalid:6443");
+    assert_int_equal(k8s_resolver_resolve(&r, entry, sizeof(entry)), 0);
+    assert_string_equal(entry, "");
+}
+
+static void test_resolve_unresolvable(void **state) {
+    (void)state;
+    k8s_resolver_t r;
+    char entry[K8S_RESOLVER_MAX_ENTRY_LEN];
+
+    k8s_resolver_init(&r, "https://does-not-exist.invalid");
+    assert_int_equal(k8s_resolver_resolve(&r, entry, sizeof(entry)), 0);
+    assert_string_equal(entry, "");
+}
+
+static void test_resolve_buffer_too_small(void **state) {
+    (void)state;
+    k8s_resolver_t r;
+    char entry[8];
+
+    k8s_resolver_init(&r, "https://localhost:6443");
+    assert_int_equal(k8s_resolver_resolve(&r, entry, sizeof(entry)), 0);
+    assert_string_equal(entry, "");
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup(test_init_default_https_port, test_setup),
+        cmocka_unit_test_setup(test_init_explicit_port_and_path, test_setup),
+        cmocka_unit_test_setup(test_init_http_default_port, test_setup),
+        cmocka_unit_test_setup(test_init_ip_literal_not_pinned, test_setup),
+        cmocka_unit_test_setup(test_init_invalid, test_setup),
+        cmocka_unit_test_setup(test_resolve_localhost, test_setup),
+        cmocka_unit_test_setup(test_resolve_prefers_service_env, test_setup),
+        cmocka_unit_test_setup(test_resolve_service_env_ipv6, test_setup),
+        cmocka_unit_test_setup(test_resolve_env_ignored_for_other_hosts, test_setup),
+        cmocka_unit_test_setup(test_resolve_env_ignored_for_other_port, test_setup),
+        cmocka_unit_test_setup(test_resolve_unresolvable, test_setup),
+        cmocka_unit_test_setup(test_resolve_buffer_too_small, test_setup),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,431 @@
+/*
+ * Unit tests for session.c using CMocka
+ *
+ * A fake API server on the loopback interface answers TokenReviews by the
+ * token's prefix: "bad" tokens are not authenticated, "moved" tokens belong
+ * to a recreated ServiceAccount, "silent" tokens get a 500 and everything
+ * else is default/app.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <openssl/evp.h>
+
+#include "session.h"
+#include "denylist.h"
+#include "token_cache.h"
+#include "stats.h"
+#include "fake_api.h"
+#include "jwt_fixtures.h"
+
+#define TOKEN_FILE "/tmp/test_session.token"
+
+static struct {
+    pthread_mutex_t lock;
+    int port;
+    int reviews;
+    int silent;                     /* Answer "silent" tokens with 500 */
+} fake = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int fake_handle(const fake_api_request_t *request) {
+    const char *token = strstr(request->body, "\"token\":");
+    token = token ? token + 8 + strspn(token + 8, " \"") : "";
+
+    pthread_mutex_lock(&fake.lock);
+    fake.reviews++;
+    int silent = fake.silent;
+    pthread_mutex_unlock(&fake.lock);
+
+    if (strncmp(token, "bad", 3) == 0) {
+        fake_api_respond(request->fd, 201, "{\"status\":{\"authenticated\":false}}");
+    } else if (strncmp(token, "silent", 6) == 0 && silent) {
+        fake_api_respond(request->fd, 500, "{}");
+    } else {
+        fake_api_respond(request->fd, 201, strncmp(token, "moved", 5) == 0 ?
+                         "{\"status\":{\"authenticated\":true,\"user\":{\"username\":"
+                         "\"system:serviceaccount:default:app\",\"uid\":\"uid-2\"}}}" :
+                         "{\"status\":{\"authenticated\":true,\"user\":{\"username\":"
+                         "\"system:serviceaccount:default:app\",\"uid\":\"uid-1\"}}}");
+    }
+    return 0;
+}
+
+static int fake_reviews(void) {
+    pthread_mutex_lock(&fake.lock);
+    int n = fake.reviews;
+    pthread_mutex_unlock(&fake.lock);
+    return n;
+}
+
+/* Connections reported by the revoke callback */
+static struct {
+    int count;
+    unsigned long last_id;
+    char identity[128];
+    char reason[16];
+} revoked;
+
+static void on_revoke(unsigned long thread_id, const char *identity,
+                      const char *reason, void *arg) {
+    (void)arg;
+    revoked.count++;
+    revoked.last_id = thread_id;
+    snprintf(revoked.identity, sizeof(revoked.identity), "%s", identity);
+    snprintf(revoked.reason, sizeof(revoked.reason), "%s", reason);
+}
+
+static char api_url[64];
+static k8s_config_t config;
+static char tmp_dir[64];
+
+static int register_login(unsigned long thread_id, const char *token, int confirmed) {
+    k8s_token_info_t info;
+    memset(&info, 0, sizeof(info));
+    info.authenticated = 1;
+    info.reviewed = confirmed;
+    strcpy(info.namespace, "default");
+    strcpy(info.service_account, "app");
+    strcpy(info.uid, "uid-1");
+    info.validated_at = time(NULL);
+    return k8s_session_register(thread_id, token, &info, confirmed);
+}
+
+/* A login the API server vouched for */
+static void login(unsigned long thread_id, const char *token) {
+    assert_true(register_login(thread_id, token, 1));
+}
+
+/* A login accepted on a local signature check */
+static void login_optimistic(unsigned long thread_id, const char *token) {
+    assert_true(register_login(thread_id, token, 0));
+}
+
+/* SHA-256 of a token, as a ticket carries it */
+static void digest_of(const char *token, unsigned char *digest) {
+    assert_int_equal(EVP_Digest(token, strlen(token), digest, NULL, EVP_sha256(), NULL), 1);
+}
+
+/* Revalidate every tracked token, however recently it was checked */
+static int revalidate_all(void) {
+    return k8s_session_revalidate(&config, 0, 4, on_revoke, NULL);
+}
+
+static int test_setup(void **state) {
+    (void)state;
+    FILE *f = fopen(TOKEN_FILE, "w");
+    fputs("reviewer-token", f);
+    fclose(f);
+
+    fake.reviews = 0;
+    fake.silent = 1;
+    fake.port = fake_api_start(fake_handle);
+    assert_int_not_equal(fake.port, 0);
+    snprintf(api_url, sizeof(api_url), "http://127.0.0.1:%d", fake.port);
+    k8s_config_init_default(&config);
+    config.api_server_url = api_url;
+    config.token_path = TOKEN_FILE;
+    config.timeout_seconds = 5;
+
+    memset(&revoked, 0, sizeof(revoked));
+    k8s_token_cache_clear();
+    k8s_stats_reset();
+    strcpy(tmp_dir, "/tmp/test_session.XXXXXX");
+    return mkdtemp(tmp_dir) ? 0 : -1;
+}
+
+static int test_teardown(void **state) {
+    (void)state;
+    k8s_session_clear();
+    k8s_denylist_shutdown();
+    fake_api_stop();
+    unlink(TOKEN_FILE);
+    rmdir(tmp_dir);
+    return 0;
+}
+
+/* ===== Tracking ===== */
+
+static void test_register_and_forget(void **state) {
+    (void)state;
+    login(1, "token-a");
+    login(2, "token-a");
+    login(3, "token-b");
+    assert_int_equal(k8s_session_count(), 3);
+
+    k8s_session_forget(2);
+    k8s_session_forget(99);
+    assert_int_equal(k8s_session_count(), 2);
+
+    /* Logging in again on a connection replaces its token */
+    login(3, "token-a");
+    assert_int_equal(k8s_session_count(), 2);
+
+    k8s_session_forget(1);
+    k8s_session_forget(3);
+    assert_int_equal(k8s_session_count(), 0);
+}
+
+static void test_ticket_attached(void **state) {
+    (void)state;
+    unsigned char digest[32];
+
+    /* Only a token some connection logged in with can be revalidated */
+    digest_of("bad-token", digest);
+    assert_false(k8s_session_attach(9, digest, "uid-1"));
+    login(1, "bad-token");
+    assert_false(k8s_session_attach(9, digest, "uid-2"));
+    assert_true(k8s_session_attach(9, digest, "uid-1"));
+    assert_int_equal(k8s_session_count(), 2);
+
+    /* The ticket connection keeps the token after the first one closed */
+    k8s_session_forget(1);
+    assert_int_equal(revalidate_all(), 1);
+    assert_int_equal(revoked.last_id, 9);
+    assert_false(k8s_session_attach(10, digest, "uid-1"));
+
+    /* Nor one the API server has not vouched for yet */
+    login_optimistic(2, "token-opt");
+    digest_of("token-opt", digest);
+    assert_false(k8s_session_attach(11, digest, "uid-1"));
+    assert_int_equal(k8s_session_count(), 2);
+}
+
+static void test_user_changed(void **state) {
+    (void)state;
+    login(1, "token-a");
+    login(2, "token-a");
+
+    k8s_session_user_changed(1, "default/app", strlen("default/app"));
+    assert_int_equal(k8s_session_count(), 2);
+
+    /* Not NUL-terminated, as the server passes it */
+    k8s_session_user_changed(2, "root@localhost", 4);
+    assert_int_equal(k8s_session_count(), 1);
+}
+
+/* ===== Revalidation ===== */
+
+static void test_shared_token_reviewed_once(void **state) {
+    (void)state;
+    for (unsigned long id = 1; id <= 200; id++) {
+        login(id, "token-pool");
+    }
+    login(500, "token-other");
+
+    assert_int_equal(revalidate_all(), 0);
+    assert_int_equal(fake_reviews(), 2);
+    assert_int_equal(revoked.count, 0);
+
+    /* Checked just now: nothing is due within the interval */
+    assert_int_equal(k8s_session_revalidate(&config, 3600, 4, on_revoke, NULL), 0);
+    assert_int_equal(fake_reviews(), 2);
+    assert_int_equal(k8s_session_count(), 201);
+}
+
+static void test_rejected_token_revokes_sessions(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    memset(&info, 0, sizeof(info));
+    strcpy(info.namespace, "default");
+    strcpy(info.service_account, "app");
+    k8s_token_cache_insert("bad-token", &info, 600);
+
+    for (unsigned long id = 1; id <= 5; id++) {
+        login(id, "bad-token");
+    }
+    login(6, "token-good");
+
+    assert_int_equal(revalidate_all(), 5);
+    assert_int_equal(revoked.count, 5);
+    assert_string_equal(revoked.identity, "default/app");
+    assert_string_equal(revoked.reason, "rejected");
+
+    /* A cached login must not let the token back in */
+    k8s_cache_entry_t entry;
+    assert_false(k8s_token_cache_lookup("bad-token", 600, &entry));
+
+    k8s_stats_totals_t totals;
+    k8s_stats_collect(&totals);
+    assert_int_equal(totals.counters[K8S_STAT_SESSIONS_REVOKED], 5);
+
+    /* Reported once; the connections stay tracked until they close */
+    int reviews = fake_reviews();
+    assert_int_equal(revalidate_all(), 0);
+    assert_int_equal(revoked.count, 5);
+    assert_int_equal(fake_reviews(), reviews + 1);
+    assert_int_equal(k8s_session_count(), 6);
+}
+
+static void test_recreated_serviceaccount_rejected(void **state) {
+    (void)state;
+    login(7, "moved-token");
+
+    assert_int_equal(revalidate_all(), 1);
+    assert_int_equal(revoked.last_id, 7);
+    assert_string_equal(revoked.reason, "rejected");
+}
+
+static void test_expired_without_review(void **state) {
+    (void)state;
+    char expired[256];
+    char valid[256];
+    jwt_fixture_expiring(time(NULL) - 1, expired);
+    jwt_fixture_expiring(time(NULL) + 3600, valid);
+    login(1, expired);
+    login(2, valid);
+
+    assert_int_equal(revalidate_all(), 1);
+    assert_int_equal(revoked.last_id, 1);
+    assert_string_equal(revoked.reason, "expired");
+    assert_int_equal(fake_reviews(), 1);
+}
+
+static void test_denied_without_review(void **state) {
+    (void)state;
+    char path[128];
+    snprintf(path, sizeof(path), "%s/denylist", tmp_dir);
+    FILE *fp = fopen(path, "w");
+    assert_non_null(fp);
+    fputs("default/app\n", fp);
+    fclose(fp);
+    k8s_denylist_configure(path);
+    assert_int_equal(k8s_denylist_reload(), 1);
+
+    login(1, "token-a");
+    login(2, "token-a");
+
+    assert_int_equal(revalidate_all(), 2);
+    assert_string_equal(revoked.reason, "denied");
+    assert_int_equal(fake_reviews(), 0);
+    unlink(path);
+}
+
+static void test_unanswered_retried(void **state) {
+    (void)state;
+    login(1, "silent-token");
+    sleep(1);
+
+    assert_int_equal(k8s_session_revalidate(&config, 1, 4, on_revoke, NULL), 0);
+    assert_int_equal(fake_reviews(), 1);
+
+    /* No verdict: still due, so the next round asks again */
+    pthread_mutex_lock(&fake.lock);
+    fake.silent = 0;
+    pthread_mutex_unlock(&fake.lock);
+    assert_int_equal(k8s_session_revalidate(&config, 1, 4, on_revoke, NULL), 0);
+    assert_int_equal(fake_reviews(), 2);
+
+    /* Now verified, so it waits for the interval */
+    assert_int_equal(k8s_session_revalidate(&config, 3600, 4, on_revoke, NULL), 0);
+    assert_int_equal(fake_reviews(), 2);
+    assert_int_equal(revoked.count, 0);
+}
+
+static void test_disconnected_not_revoked(void **state) {
+    (void)state;
+    login(1, "bad-token");
+    k8s_session_forget(1);
+
+    assert_int_equal(revalidate_all(), 0);
+    assert_int_equal(fake_reviews(), 0);
+    assert_int_equal(revoked.count, 0);
+}
+
+/* ===== Confirmation ===== */
+
+static void test_confirm_verified(void **state) {
+    (void)state;
+    login_optimistic(1, "token-opt");
+    login_optimistic(2, "token-opt");
+
+    assert_int_equal(k8s_session_confirm(&config, 30, 4, on_revoke, NULL), 0);
+    assert_int_equal(fake_reviews(), 1);
+
+    /* Confirmed tokens are left to revalidation */
+    assert_int_equal(k8s_session_confirm(&config, 30, 4, on_revoke, NULL), 0);
+    assert_int_equal(fake_reviews(), 1);
+    assert_int_equal(revoked.count, 0);
+}
+
+static void test_confirm_rejected_is_denied(void **state) {
+    (void)state;
+    login(1, "token-good");
+    login_optimistic(2, "bad-opt");
+    login_optimistic(3, "bad-opt");
+    assert_false(k8s_session_denied("bad-opt"));
+
+    assert_int_equal(k8s_session_confirm(&config, 30, 4, on_revoke, NULL), 2);
+    assert_string_equal(revoked.reason, "rejected");
+    assert_int_equal(fake_reviews(), 1);
+
+    /* Refused from now on, even after its connections are gone */
+    assert_false(register_login(4, "bad-opt", 0));
+    k8s_session_forget(2);
+    k8s_session_forget(3);
+    assert_true(k8s_session_denied("bad-opt"));
+    assert_false(k8s_session_denied("token-good"));
+}
+
+static void test_confirm_window(void **state) {
+    (void)state;
+    login_optimistic(1, "silent-opt");
+
+    /* No answer yet, but still inside the window */
+    assert_int_equal(k8s_session_confirm(&config, 1, 4, on_revoke, NULL), 0);
+    sleep(1);
+
+    assert_int_equal(k8s_session_confirm(&config, 1, 4, on_revoke, NULL), 1);
+    assert_string_equal(revoked.reason, "unconfirmed");
+    assert_int_equal(fake_reviews(), 2);
+}
+
+/* ===== Batched TokenReview ===== */
+
+static void test_validate_tokens_batch(void **state) {
+    (void)state;
+    char names[40][24];
+    const char *tokens[40];
+    k8s_token_info_t infos[40];
+
+    for (int i = 0; i < 40; i++) {
+        snprintf(names[i], sizeof(names[i]), "%s-%d", i % 4 == 0 ? "bad" : "token", i);
+        tokens[i] = names[i];
+    }
+
+    assert_int_equal(k8s_validate_tokens(tokens, 40, infos, &config, 8), 40);
+    assert_int_equal(fake_reviews(), 40);
+    for (int i = 0; i < 40; i++) {
+        assert_true(infos[i].reviewed);
+        assert_int_equal(infos[i].authenticated, i % 4 != 0);
+    }
+    assert_string_equal(infos[1].namespace, "default");
+    assert_string_equal(infos[1].uid, "uid-1");
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_register_and_forget, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_ticket_attached, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_user_changed, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_shared_token_reviewed_once, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_rejected_token_revokes_sessions, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_recreated_serviceaccount_rejected, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_expired_without_review, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_denied_without_review, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_unanswered_retried, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_disconnected_not_revoked, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_confirm_verified, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_confirm_rejected_is_denied, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_confirm_window, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_validate_tokens_batch, test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
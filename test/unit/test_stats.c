@@ -0,0 +1,167 @@
+/*
+ * Unit tests for stats.c using CMocka
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "stats.h"
+
+static int test_setup(void **state) {
+    (void)state;
+    k8s_stats_reset();
+    return 0;
+}
+
+/* ========================================================================
+ * Bucket layout
+ * ======================================================================== */
+
+static void test_bucket_small_values_exact(void **state) {
+    (void)state;
+    for (uint64_t v = 0; v < 8; v++) {
+        assert_int_equal(k8s_stats_bucket_upper(k8s_stats_bucket(v)), v);
+    }
+}
+
+static void test_bucket_contains_value(void **state) {
+    (void)state;
+    uint64_t values[] = { 8, 9, 100, 1000, 4095, 4096, 123456, 9999999 };
+
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        int b = k8s_stats_bucket(values[i]);
+        uint64_t upper = k8s_stats_bucket_upper(b);
+        assert_true(upper >= values[i]);
+        /* Within the 25% resolution */
+        assert_true(upper <= values[i] + values[i] / 4);
+        assert_true(b == 0 || k8s_stats_bucket_upper(b - 1) < values[i]);
+    }
+}
+
+static void test_bucket_monotonic(void **state) {
+    (void)state;
+    int prev = 0;
+    for (uint64_t v = 0; v < 100000; v += 7) {
+        int b = k8s_stats_bucket(v);
+        assert_true(b >= prev);
+        prev = b;
+    }
+}
+
+static void test_bucket_clamped(void **state) {
+    (void)state;
+    assert_int_equal(k8s_stats_bucket(UINT64_MAX), K8S_HIST_BUCKETS - 1);
+    assert_int_equal(k8s_stats_bucket(UINT64_C(1) << 40), K8S_HIST_BUCKETS - 1);
+}
+
+/* ========================================================================
+ * Counters and percentiles
+ * ======================================================================== */
+
+static void test_counters(void **state) {
+    (void)state;
+    k8s_stats_totals_t totals;
+
+    k8s_stats_inc(K8S_STAT_ATTEMPTS);
+    k8s_stats_inc(K8S_STAT_ATTEMPTS);
+    k8s_stats_add(K8S_STAT_BYTES_SENT, 1500);
+
+    k8s_stats_collect(&totals);
+    assert_int_equal(totals.counters[K8S_STAT_ATTEMPTS], 2);
+    assert_int_equal(totals.counters[K8S_STAT_BYTES_SENT], 1500);
+    assert_int_equal(totals.counters[K8S_STAT_SUCCESSES], 0);
+}
+
+static void test_percentiles(void **state) {
+    (void)state;
+    k8s_stats_totals_t totals;
+
+    /* 90 fast logins at 1ms, 9 at 10ms, one at 1s */
+    for (int i = 0; i < 90; i++) {
+        k8s_stats_record(K8S_HIST_LOGIN, 1000);
+    }
+    for (int i = 0; i < 9; i++) {
+        k8s_stats_record(K8S_HIST_LOGIN, 10000);
+    }
+    k8s_stats_record(K8S_HIST_LOGIN, 1000000);
+
+    k8s_stats_collect(&totals);
+    assert_int_equal(totals.hist_count[K8S_HIST_LOGIN], 100);
+    assert_int_equal(totals.hist_sum[K8S_HIST_LOGIN], 90 * 1000 + 9 * 10000 + 1000000);
+    assert_int_equal(totals.hist_count[K8S_HIST_API], 0);
+
+    uint64_t p50 = k8s_stats_percentile(&totals, K8S_HIST_LOGIN, 50);
+    uint64_t p95 = k8s_stats_percentile(&totals, K8S_HIST_LOGIN, 95);
+    uint64_t p99 = k8s_stats_percentile(&totals, K8S_HIST_LOGIN, 99);
+    uint64_t p100 = k8s_stats_percentile(&totals, K8S_HIST_LOGIN, 100);
+
+    assert_true(p50 >= 1000 && p50 < 1250);
+    assert_true(p95 >= 10000 && p95 < 12500);
+    assert_true(p99 >= 10000 && p99 < 12500);
+    assert_true(p100 >= 1000000 && p100 < 1250000);
+    assert_int_equal(k8s_stats_percentile(&totals, K8S_HIST_API, 99), 0);
+}
+
+static void test_names(void **state) {
+    (void)state;
+    for (int i = 0; i < K8S_STAT_COUNT; i++) {
+        assert_non_null(k8s_stats_name((k8s_stat_t)i));
+    }
+    assert_string_equal(k8s_stats_name(K8S_STAT_ATTEMPTS), "attempts");
+    for (int i = 0; i < K8S_HIST_COUNT; i++) {
+        assert_non_null(k8s_stats_hist_name((k8s_hist_t)i));
+    }
+    assert_string_equal(k8s_stats_hist_name(K8S_HIST_LOGIN), "login");
+}
+
+/* ========================================================================
+ * Concurrency: every update lands in some shard exactly once
+ * ======================================================================== */
+
+#define THREADS 8
+#define UPDATES 10000
+
+static void *hammer(void *arg) {
+    (void)arg;
+    for (int i = 0; i < UPDATES; i++) {
+        k8s_stats_inc(K8S_STAT_TOKENREVIEW_CALLS);
+        k8s_stats_record(K8S_HIST_API, (uint64_t)i);
+    }
+    return NULL;
+}
+
+static void test_concurrent_updates(void **state) {
+    (void)state;
+    pthread_t threads[THREADS];
+    k8s_stats_totals_t totals;
+
+    for (int i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, hammer, NULL);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    k8s_stats_collect(&totals);
+    assert_int_equal(totals.counters[K8S_STAT_TOKENREVIEW_CALLS], THREADS * UPDATES);
+    assert_int_equal(totals.hist_count[K8S_HIST_API], THREADS * UPDATES);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup(test_bucket_small_values_exact, test_setup),
+        cmocka_unit_test_setup(test_bucket_contains_value, test_setup),
+        cmocka_unit_test_setup(test_bucket_monotonic, test_setup),
+        cmocka_unit_test_setup(test_bucket_clamped, test_setup),
+        cmocka_unit_test_setup(test_counters, test_setup),
+        cmocka_unit_test_setup(test_percentiles, test_setup),
+        cmocka_unit_test_setup(test_names, test_setup),
+        cmocka_unit_test_setup(test_concurrent_updates, test_setup),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
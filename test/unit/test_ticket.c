@@ -0,0 +1,136 @@
+/*
+ * Unit tests for ticket.c using CMocka
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/evp.h>
+
+#include "ticket.h"
+#include "jwt_fixtures.h"
+
+#define LEGACY_TOKEN "legacy-secret-token"
+
+static void make_info(k8s_token_info_t *info) {
+    memset(info, 0, sizeof(*info));
+    info->authenticated = 1;
+    info->reviewed = 1;
+    strcpy(info->namespace, "default");
+    strcpy(info->service_account, "myapp");
+    strcpy(info->uid, "u-123");
+}
+
+static int setup(void **state) {
+    (void)state;
+    return k8s_ticket_init() ? 0 : -1;
+}
+
+static void test_round_trip(void **state) {
+    (void)state;
+    k8s_token_info_t info, out;
+    char ticket[K8S_TICKET_MAX_LEN + 1];
+    unsigned char digest[K8S_TICKET_DIGEST_LEN], expected[K8S_TICKET_DIGEST_LEN];
+    unsigned int len = 0;
+
+    make_info(&info);
+    assert_int_equal(k8s_ticket_issue(LEGACY_TOKEN, &info, 300, ticket, sizeof(ticket)), 300);
+    assert_memory_equal(ticket, K8S_TICKET_PREFIX, strlen(K8S_TICKET_PREFIX));
+
+    assert_int_equal(k8s_ticket_verify(ticket, strlen(ticket), &out, digest), 1);
+    assert_int_equal(out.authenticated, 1);
+    assert_string_equal(out.namespace, "default");
+    assert_string_equal(out.service_account, "myapp");
+    assert_string_equal(out.uid, "u-123");
+
+    EVP_Digest(LEGACY_TOKEN, strlen(LEGACY_TOKEN), expected, &len, EVP_sha256(), NULL);
+    assert_memory_equal(digest, expected, sizeof(expected));
+}
+
+static void test_tampered(void **state) {
+    (void)state;
+    k8s_token_info_t info, out;
+    char ticket[K8S_TICKET_MAX_LEN + 1];
+    size_t prefix = strlen(K8S_TICKET_PREFIX);
+
+    make_info(&info);
+    assert_true(k8s_ticket_issue(LEGACY_TOKEN, &info, 300, ticket, sizeof(ticket)) > 0);
+    size_t len = strlen(ticket);
+
+    /* Every changed character breaks the MAC or the encoding */
+    for (size_t i = prefix; i < len; i++) {
+        char saved = ticket[i];
+        ticket[i] = saved == 'A' ? 'B' : 'A';
+        assert_int_equal(k8s_ticket_verify(ticket, len, &out, NULL), 0);
+        ticket[i] = saved;
+    }
+
+    assert_int_equal(k8s_ticket_verify(ticket, len - 1, &out, NULL), 0);
+    assert_int_equal(k8s_ticket_verify(ticket + prefix, len - prefix, &out, NULL), 0);
+    assert_int_equal(k8s_ticket_verify(K8S_TICKET_PREFIX, prefix, &out, NULL), 0);
+    assert_int_equal(k8s_ticket_verify(ticket, len, &out, NULL), 1);
+}
+
+static void test_new_key(void **state) {
+    (void)state;
+    k8s_token_info_t info, out;
+    char ticket[K8S_TICKET_MAX_LEN + 1];
+
+    make_info(&info);
+    assert_true(k8s_ticket_issue(LEGACY_TOKEN, &info, 300, ticket, sizeof(ticket)) > 0);
+
+    /* A restart generates another key */
+    assert_int_equal(k8s_ticket_init(), 1);
+    assert_int_equal(k8s_ticket_verify(ticket, strlen(ticket), &out, NULL), 0);
+}
+
+static void test_bounded_by_token(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    char token[512];
+    char ticket[K8S_TICKET_MAX_LEN + 1];
+
+    make_info(&info);
+
+    jwt_fixture_expiring(time(NULL) + 60, token);
+    int lifetime = k8s_ticket_issue(token, &info, 300, ticket, sizeof(ticket));
+    assert_true(lifetime > 0 && lifetime <= 60);
+
+    jwt_fixture_expiring(time(NULL) + 3600, token);
+    assert_int_equal(k8s_ticket_issue(token, &info, 300, ticket, sizeof(ticket)), 300);
+
+    /* Nothing for an expired token, or when tickets are off */
+    jwt_fixture_expiring(time(NULL) - 10, token);
+    assert_int_equal(k8s_ticket_issue(token, &info, 300, ticket, sizeof(ticket)), 0);
+    assert_int_equal(k8s_ticket_issue(LEGACY_TOKEN, &info, 0, ticket, sizeof(ticket)), 0);
+}
+
+static void test_shutdown(void **state) {
+    (void)state;
+    k8s_token_info_t info, out;
+    char ticket[K8S_TICKET_MAX_LEN + 1];
+
+    make_info(&info);
+    assert_true(k8s_ticket_issue(LEGACY_TOKEN, &info, 300, ticket, sizeof(ticket)) > 0);
+
+    k8s_ticket_shutdown();
+    assert_int_equal(k8s_ticket_verify(ticket, strlen(ticket), &out, NULL), 0);
+    assert_int_equal(k8s_ticket_issue(LEGACY_TOKEN, &info, 300, ticket, sizeof(ticket)), 0);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup(test_round_trip, setup),
+        cmocka_unit_test_setup(test_tampered, setup),
+        cmocka_unit_test_setup(test_new_key, setup),
+        cmocka_unit_test_setup(test_bounded_by_token, setup),
+        cmocka_unit_test_setup(test_shutdown, setup),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,356 @@
+/*
+ * Unit tests for token_cache.c using CMocka
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+
+#include "token_cache.h"
+#include "jwt_fixtures.h"
+
+#define CACHE_FILE "/tmp/test_token_cache.bin"
+#define KEY_FILE "/tmp/test_token_cache.key"
+
+static void write_file(const char *path, const char *content) {
+    FILE *f = fopen(path, "w");
+    assert_non_null(f);
+    fputs(content, f);
+    fclose(f);
+}
+
+static int test_setup(void **state) {
+    (void)state;
+    k8s_token_cache_close();
+    k8s_token_cache_clear();
+    unlink(CACHE_FILE);
+    write_file(KEY_FILE, "correct horse battery staple\n");
+    return 0;
+}
+
+static void make_info(k8s_token_info_t *info, const char *ns, const char *sa) {
+    memset(info, 0, sizeof(*info));
+    info->authenticated = 1;
+    info->reviewed = 1;
+    strcpy(info->namespace, ns);
+    strcpy(info->service_account, sa);
+    strcpy(info->uid, "4a6f0c1e-uid");
+    info->validated_at = time(NULL);
+}
+
+/* The set a token lands in, as computed by the cache */
+static size_t token_set(const char *token) {
+    unsigned char hash[32];
+    unsigned int len = sizeof(hash);
+    uint64_t h;
+
+    EVP_Digest(token, strlen(token), hash, &len, EVP_sha256(), NULL);
+    memcpy(&h, hash, sizeof(h));
+    return h % (K8S_CACHE_SLOTS / K8S_CACHE_WAYS);
+}
+
+/* ========================================================================
+ * In-memory cache
+ * ======================================================================== */
+
+static void test_insert_and_lookup(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_cache_entry_t entry;
+
+    assert_false(k8s_token_cache_lookup("token-a", 60, &entry));
+
+    make_info(&info, "default", "myapp");
+    k8s_token_cache_insert("token-a", &info, 60);
+
+    assert_true(k8s_token_cache_lookup("token-a", 60, &entry));
+    assert_string_equal(entry.namespace, "default");
+    assert_string_equal(entry.service_account, "myapp");
+    assert_string_equal(entry.uid, "4a6f0c1e-uid");
+    assert_int_equal(entry.validated_at, info.validated_at);
+    assert_int_equal(entry.expires_at, info.validated_at + 60);
+
+    assert_false(k8s_token_cache_lookup("token-b", 60, &entry));
+}
+
+static void test_disabled_by_zero_ttl(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_cache_entry_t entry;
+
+    make_info(&info, "default", "myapp");
+    k8s_token_cache_insert("token-a", &info, 0);
+    assert_false(k8s_token_cache_lookup("token-a", 60, &entry));
+
+    k8s_token_cache_insert("token-a", &info, 60);
+    assert_false(k8s_token_cache_lookup("token-a", 0, &entry));
+}
+
+static void test_ttl_expiry(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_cache_entry_t entry;
+
+    /* Reviewed 100 s ago */
+    make_info(&info, "default", "myapp");
+    info.validated_at -= 100;
+
+    k8s_token_cache_insert("too-old", &info, 50);
+    assert_false(k8s_token_cache_lookup("too-old", 50, &entry));
+
+    k8s_token_cache_insert("fresh", &info, 200);
+    assert_true(k8s_token_cache_lookup("fresh", 200, &entry));
+    /* A lowered TTL applies to existing entries */
+    assert_false(k8s_token_cache_lookup("fresh", 50, &entry));
+}
+
+static void test_capped_by_token_exp(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_cache_entry_t entry;
+    char token[512];
+    time_t now = time(NULL);
+
+    make_info(&info, "default", "myapp");
+    jwt_fixture_expiring(now + 5, token);
+    k8s_token_cache_insert(token, &info, 3600);
+    assert_true(k8s_token_cache_lookup(token, 3600, &entry));
+    assert_int_equal(entry.expires_at, now + 5);
+
+    jwt_fixture_expiring(now - 1, token);
+    k8s_token_cache_insert(token, &info, 3600);
+    assert_false(k8s_token_cache_lookup(token, 3600, &entry));
+}
+
+static void test_lru_eviction(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_cache_entry_t entry;
+    char tokens[K8S_CACHE_WAYS + 1][32];
+    int found = 0;
+    size_t set = token_set("seed-0");
+
+    /* Find more tokens than ways in one set */
+    for (int i = 0; found < K8S_CACHE_WAYS + 1; i++) {
+        char candidate[32];
+        snprintf(candidate, sizeof(candidate), "seed-%d", i);
+        if (token_set(candidate) == set) {
+            strcpy(tokens[found++], candidate);
+        }
+    }
+
+    make_info(&info, "default", "myapp");
+    for (int i = 0; i < K8S_CACHE_WAYS; i++) {
+        k8s_token_cache_insert(tokens[i], &info, 60);
+    }
+    /* Touch the oldest so the second oldest is evicted */
+    assert_true(k8s_token_cache_lookup(tokens[0], 60, &entry));
+    k8s_token_cache_insert(tokens[K8S_CACHE_WAYS], &info, 60);
+
+    assert_true(k8s_token_cache_lookup(tokens[0], 60, &entry));
+    assert_false(k8s_token_cache_lookup(tokens[1], 60, &entry));
+    assert_true(k8s_token_cache_lookup(tokens[K8S_CACHE_WAYS], 60, &entry));
+}
+
+static int drop_namespace(const k8s_cache_entry_t *entry, void *arg) {
+    return strcmp(entry->namespace, (const char *)arg) == 0;
+}
+
+static void test_evict_if(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_cache_entry_t entry;
+    char token[512];
+
+    make_info(&info, "team-a", "app");
+    k8s_token_cache_insert("token-a", &info, 60);
+    make_info(&info, "team-b", "app");
+    k8s_token_cache_insert("token-b", &info, 60);
+
+    assert_int_equal(k8s_token_cache_evict_if(drop_namespace, "team-a"), 1);
+    assert_false(k8s_token_cache_lookup("token-a", 60, &entry));
+    assert_true(k8s_token_cache_lookup("token-b", 60, &entry));
+
+    /* Bound tokens remember their pod */
+    jwt_fixture_unsigned("{\"kubernetes.io\":{\"pod\":{\"name\":\"app-0\",\"uid\":\"pod-uid-1\"}}}",
+                         token);
+    k8s_token_cache_insert(token, &info, 60);
+    assert_true(k8s_token_cache_lookup(token, 60, &entry));
+    assert_string_equal(entry.pod_uid, "pod-uid-1");
+}
+
+/* ========================================================================
+ * Persistence
+ * ======================================================================== */
+
+static void test_survives_restart(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_cache_entry_t entry;
+    struct stat st;
+
+    assert_int_equal(k8s_token_cache_open(CACHE_FILE, KEY_FILE), 0);
+    assert_int_equal(stat(CACHE_FILE, &st), 0);
+    assert_int_equal(st.st_mode & 0777, 0600);
+
+    make_info(&info, "prod", "billing");
+    k8s_token_cache_insert("token-a", &info, 600);
+    k8s_token_cache_close();
+
+    /* A restart starts with an empty table */
+    k8s_token_cache_clear();
+    assert_false(k8s_token_cache_lookup("token-a", 600, &entry));
+
+    assert_int_equal(k8s_token_cache_open(CACHE_FILE, KEY_FILE), 1);
+    assert_true(k8s_token_cache_lookup("token-a", 600, &entry));
+    assert_string_equal(entry.namespace, "prod");
+    assert_string_equal(entry.service_account, "billing");
+    assert_int_equal(entry.validated_at, info.validated_at);
+}
+
+static void test_file_does_not_hold_plaintext(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    char buf[4096];
+
+    assert_int_equal(k8s_token_cache_open(CACHE_FILE, KEY_FILE), 0);
+    make_info(&info, "plaintext-namespace", "plaintext-account");
+    k8s_token_cache_insert("token-a", &info, 600);
+    k8s_token_cache_close();
+
+    FILE *f = fopen(CACHE_FILE, "rb");
+    assert_non_null(f);
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        assert_null(memmem(buf, n, "plaintext", 9));
+    }
+    fclose(f);
+}
+
+static void test_wrong_key_loads_nothing(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_cache_entry_t entry;
+
+    assert_int_equal(k8s_token_cache_open(CACHE_FILE, KEY_FILE), 0);
+    make_info(&info, "prod", "billing");
+    k8s_token_cache_insert("token-a", &info, 600);
+    k8s_token_cache_close();
+    k8s_token_cache_clear();
+
+    write_file(KEY_FILE, "another secret");
+    assert_int_equal(k8s_token_cache_open(CACHE_FILE, KEY_FILE), 0);
+    assert_false(k8s_token_cache_lookup("token-a", 600, &entry));
+}
+
+static void test_tampered_record_rejected(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_cache_entry_t entry;
+    struct stat st;
+
+    assert_int_equal(k8s_token_cache_open(CACHE_FILE, KEY_FILE), 0);
+    make_info(&info, "prod", "billing");
+    k8s_token_cache_insert("token-a", &info, 600);
+    k8s_token_cache_insert("token-b", &info, 600);
+    k8s_token_cache_close();
+    k8s_token_cache_clear();
+
+    /* Flip one bit in every non-zero byte past the header */
+    assert_int_equal(stat(CACHE_FILE, &st), 0);
+    FILE *f = fopen(CACHE_FILE, "r+b");
+    assert_non_null(f);
+    unsigned char *data = malloc(st.st_size);
+    assert_int_equal(fread(data, 1, st.st_size, f), (size_t)st.st_size);
+    for (off_t i = 64; i < st.st_size; i++) {
+        if (data[i]) {
+            data[i] ^= 1;
+        }
+    }
+    rewind(f);
+    fwrite(data, 1, st.st_size, f);
+    fclose(f);
+    free(data);
+
+    assert_int_equal(k8s_token_cache_open(CACHE_FILE, KEY_FILE), 0);
+    assert_false(k8s_token_cache_lookup("token-a", 600, &entry));
+    assert_false(k8s_token_cache_lookup("token-b", 600, &entry));
+}
+
+static void test_foreign_file_reinitialized(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_cache_entry_t entry;
+
+    write_file(CACHE_FILE, "not a cache file");
+    assert_int_equal(k8s_token_cache_open(CACHE_FILE, KEY_FILE), 0);
+
+    make_info(&info, "prod", "billing");
+    k8s_token_cache_insert("token-a", &info, 600);
+    k8s_token_cache_close();
+    k8s_token_cache_clear();
+
+    assert_int_equal(k8s_token_cache_open(CACHE_FILE, KEY_FILE), 1);
+    assert_true(k8s_token_cache_lookup("token-a", 600, &entry));
+}
+
+static void test_missing_key_is_memory_only(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_cache_entry_t entry;
+
+    unlink(KEY_FILE);
+    assert_int_equal(k8s_token_cache_open(CACHE_FILE, KEY_FILE), -1);
+    assert_int_not_equal(access(CACHE_FILE, F_OK), 0);
+
+    make_info(&info, "prod", "billing");
+    k8s_token_cache_insert("token-a", &info, 600);
+    assert_true(k8s_token_cache_lookup("token-a", 600, &entry));
+}
+
+static void test_clear_wipes_file(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_cache_entry_t entry;
+
+    assert_int_equal(k8s_token_cache_open(CACHE_FILE, KEY_FILE), 0);
+    make_info(&info, "prod", "billing");
+    k8s_token_cache_insert("token-a", &info, 600);
+    k8s_token_cache_clear();
+    k8s_token_cache_close();
+
+    assert_int_equal(k8s_token_cache_open(CACHE_FILE, KEY_FILE), 0);
+    assert_false(k8s_token_cache_lookup("token-a", 600, &entry));
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup(test_insert_and_lookup, test_setup),
+        cmocka_unit_test_setup(test_disabled_by_zero_ttl, test_setup),
+        cmocka_unit_test_setup(test_ttl_expiry, test_setup),
+        cmocka_unit_test_setup(test_capped_by_token_exp, test_setup),
+        cmocka_unit_test_setup(test_lru_eviction, test_setup),
+        cmocka_unit_test_setup(test_evict_if, test_setup),
+        cmocka_unit_test_setup(test_survives_restart, test_setup),
+        cmocka_unit_test_setup(test_file_does_not_hold_plaintext, test_setup),
+        cmocka_unit_test_setup(test_wrong_key_loads_nothing, test_setup),
+        cmocka_unit_test_setup(test_tampered_record_rejected, test_setup),
+        cmocka_unit_test_setup(test_foreign_file_reinitialized, test_setup),
+        cmocka_unit_test_setup(test_missing_key_is_memory_only, test_setup),
+        cmocka_unit_test_setup(test_clear_wipes_file, test_setup),
+    };
+
+    int failed = cmocka_run_group_tests(tests, NULL, NULL);
+    k8s_token_cache_close();
+    unlink(CACHE_FILE);
+    unlink(KEY_FILE);
+    return failed;
+}
@@ -13,6 +13,7 @@
 #include <curl/curl.h>
 
 #include "tokenreview_api.h"
+#include "stats.h"
 
 /* ========================================================================
  * Wrap state: captures curl options set by production code
@@ -20,8 +21,10 @@
 
 static size_t (*captured_write_fn)(void*, size_t, size_t, void*) = NULL;
 static void *captured_write_data = NULL;
+static char captured_body[1024];
 static const char *mock_response_json = NULL;
 static long mock_http_code = 200;
+static curl_off_t mock_times[6];  /* NAMELOOKUP, CONNECT, APPCONNECT, PRETRANSFER, STARTTRANSFER, TOTAL */
 
 /* ========================================================================
  * __wrap_ functions for curl
@@ -44,6 +47,8 @@ CURLcode __wrap_curl_easy_setopt(CURL *curl, CURLoption option, ...) {
         captured_write_fn = va_arg(ap, void*);
     } else if (option == CURLOPT_WRITEDATA) {
         captured_write_data = va_arg(ap, void*);
+    } else if (option == CURLOPT_POSTFIELDS) {
+        snprintf(captured_body, sizeof(captured_body), "%s", va_arg(ap, const char*));
     }
 
     va_end(ap);
@@ -71,6 +76,16 @@ CURLcode __wrap_curl_easy_getinfo(CURL *curl, CURLINFO info, ...) {
     if (info == CURLINFO_RESPONSE_CODE) {
         long *code_ptr = va_arg(ap, long*);
         *code_ptr = mock_http_code;
+    } else {
+        static const CURLINFO timers[6] = {
+            CURLINFO_NAMELOOKUP_TIME_T, CURLINFO_CONNECT_TIME_T, CURLINFO_APPCONNECT_TIME_T,
+            CURLINFO_PRETRANSFER_TIME_T, CURLINFO_STARTTRANSFER_TIME_T, CURLINFO_TOTAL_TIME_T
+        };
+        for (int i = 0; i < 6; i++) {
+            if (info == timers[i]) {
+                *va_arg(ap, curl_off_t*) = mock_times[i];
+            }
+        }
     }
 
     va_end(ap);
@@ -161,12 +176,21 @@ static int test_setup(void **state) {
     captured_write_data = NULL;
     mock_response_json = NULL;
     mock_http_code = 200;
+    captured_body[0] = '\0';
+    memset(mock_times, 0, sizeof(mock_times));
     mock_file_content = NULL;
     mock_file_size = 0;
     mock_file_pos = 0;
+    k8s_stats_reset();
     return 0;
 }
 
+static uint64_t stat_total(k8s_stat_t stat) {
+    k8s_stats_totals_t totals;
+    k8s_stats_collect(&totals);
+    return totals.counters[stat];
+}
+
 /* ========================================================================
  * Pure logic tests: k8s_config_init_default
  * ======================================================================== */
@@ -180,6 +204,7 @@ static void test_config_init_default(void **state) {
     assert_string_equal(config.ca_cert_path, "/var/run/secrets/kubernetes.io/serviceaccount/ca.crt");
     assert_string_equal(config.token_path, "/var/run/secrets/kubernetes.io/serviceaccount/token");
     assert_int_equal(config.timeout_seconds, 10);
+    assert_null(config.audience);
 }
 
 /* ========================================================================
@@ -245,6 +270,15 @@ static void test_parse_username_null_inputs(void **state) {
     "\"username\":\"system:serviceaccount:other-ns:other-sa\"," \
     "\"uid\":\"uid-456\"}}}"
 
+#define BOUND_RESPONSE \
+    "{\"status\":{\"authenticated\":true,\"audiences\":[\"mariadb\"],\"user\":{" \
+    "\"username\":\"system:serviceaccount:default:myapp\"," \
+    "\"uid\":\"test-uid-123\"," \
+    "\"groups\":[\"system:serviceaccounts\",\"system:serviceaccounts:default\"," \
+    "\"system:authenticated\"]," \
+    "\"extra\":{\"authentication.kubernetes.io/pod-name\":[\"myapp-7d4b9\"]," \
+    "\"authentication.kubernetes.io/pod-uid\":[\"pod-uid-1\"]}}}}"
+
 #define MALFORMED_RESPONSE "not json at all {"
 
 #define NO_STATUS_RESPONSE "{\"kind\":\"TokenReview\"}"
@@ -281,6 +315,147 @@ static void test_validate_token_happy_path(void **state) {
     assert_true(info.validated_at > 0);
 }
 
+static void test_validate_token_bound(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_config_t config;
+    k8s_config_init_default(&config);
+    config.audience = "mariadb";
+
+    setup_mock_file("sa-token-data");
+    will_return(__wrap_fopen, (FILE*)0xDEAD);
+    will_return(__wrap_curl_easy_init, (CURL*)0xBEEF);
+
+    mock_response_json = BOUND_RESPONSE;
+    mock_http_code = 201;
+    will_return(__wrap_curl_easy_perform, CURLE_OK);
+
+    int ret = k8s_validate_token("test-token", &info, &config);
+    assert_int_equal(ret, 1);
+    assert_non_null(strstr(captured_body, "\"audiences\""));
+    assert_non_null(strstr(captured_body, "\"mariadb\""));
+    assert_string_equal(info.groups, "system:serviceaccounts\nsystem:serviceaccounts:default\n"
+                                     "system:authenticated\n");
+    assert_string_equal(info.pod_name, "myapp-7d4b9");
+    assert_string_equal(info.pod_uid, "pod-uid-1");
+
+    /* No audience, groups or pod */
+    setup_mock_file("sa-token-data");
+    will_return(__wrap_fopen, (FILE*)0xDEAD);
+    will_return(__wrap_curl_easy_init, (CURL*)0xBEEF);
+    mock_response_json = VALID_RESPONSE;
+    will_return(__wrap_curl_easy_perform, CURLE_OK);
+
+    config.audience = NULL;
+    assert_int_equal(k8s_validate_token("test-token", &info, &config), 1);
+    assert_null(strstr(captured_body, "audiences"));
+    assert_string_equal(info.groups, "");
+    assert_string_equal(info.pod_name, "");
+}
+
+static void test_validate_token_audience_mismatch(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_config_t config;
+    k8s_config_init_default(&config);
+    config.audience = "vault";
+
+    /* Authenticated, but for an audience other than the one asked for */
+    setup_mock_file("sa-token-data");
+    will_return(__wrap_fopen, (FILE*)0xDEAD);
+    will_return(__wrap_curl_easy_init, (CURL*)0xBEEF);
+    mock_response_json = BOUND_RESPONSE;
+    will_return(__wrap_curl_easy_perform, CURLE_OK);
+
+    assert_int_equal(k8s_validate_token("test-token", &info, &config), 0);
+    assert_int_equal(info.reviewed, 1);
+    assert_int_equal(info.authenticated, 0);
+
+    /* An API server that ignored spec.audiences lists none */
+    setup_mock_file("sa-token-data");
+    will_return(__wrap_fopen, (FILE*)0xDEAD);
+    will_return(__wrap_curl_easy_init, (CURL*)0xBEEF);
+    mock_response_json = VALID_RESPONSE;
+    will_return(__wrap_curl_easy_perform, CURLE_OK);
+
+    config.audience = "mariadb";
+    assert_int_equal(k8s_validate_token("test-token", &info, &config), 0);
+    assert_int_equal(info.reviewed, 1);
+    assert_int_equal(info.authenticated, 0);
+
+    /* An empty list */
+    setup_mock_file("sa-token-data");
+    will_return(__wrap_fopen, (FILE*)0xDEAD);
+    will_return(__wrap_curl_easy_init, (CURL*)0xBEEF);
+    mock_response_json = "{\"status\":{\"authenticated\":true,\"audiences\":[],\"user\":{"
+                         "\"username\":\"system:serviceaccount:default:myapp\"}}}";
+    will_return(__wrap_curl_easy_perform, CURLE_OK);
+
+    assert_int_equal(k8s_validate_token("test-token", &info, &config), 0);
+    assert_int_equal(info.authenticated, 0);
+}
+
+static void test_validate_token_phase_timing(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_config_t config;
+    k8s_config_init_default(&config);
+
+    setup_mock_file("sa-token-data");
+    will_return(__wrap_fopen, (FILE*)0xDEAD);
+    will_return(__wrap_curl_easy_init, (CURL*)0xBEEF);
+
+    /* Cumulative libcurl timers of a cold TLS request */
+    curl_off_t times[6] = { 1000, 3000, 9000, 9100, 29100, 29600 };
+    memcpy(mock_times, times, sizeof(mock_times));
+
+    mock_response_json = VALID_RESPONSE;
+    mock_http_code = 201;
+    will_return(__wrap_curl_easy_perform, CURLE_OK);
+
+    int ret = k8s_validate_token("test-token", &info, &config);
+    assert_int_equal(ret, 1);
+    assert_int_equal(info.timing.dns_us, 1000);
+    assert_int_equal(info.timing.connect_us, 2000);
+    assert_int_equal(info.timing.tls_us, 6000);
+    assert_int_equal(info.timing.server_us, 20000);
+    assert_int_equal(info.timing.transfer_us, 500);
+    assert_int_equal(info.timing.total_us, 29600);
+
+    k8s_stats_totals_t totals;
+    k8s_stats_collect(&totals);
+    assert_int_equal(totals.hist_count[K8S_HIST_TLS], 1);
+    assert_int_equal(totals.hist_sum[K8S_HIST_SERVER], 20000);
+    assert_int_equal(totals.hist_count[K8S_HIST_PARSE], 1);
+    assert_int_equal(totals.hist_count[K8S_HIST_QUEUE], 1);
+}
+
+static void test_validate_token_reused_connection_timing(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_config_t config;
+    k8s_config_init_default(&config);
+
+    setup_mock_file("sa-token-data");
+    will_return(__wrap_fopen, (FILE*)0xDEAD);
+    will_return(__wrap_curl_easy_init, (CURL*)0xBEEF);
+
+    /* No name lookup, connect or handshake on a reused connection */
+    curl_off_t times[6] = { 0, 0, 0, 40, 2040, 2100 };
+    memcpy(mock_times, times, sizeof(mock_times));
+
+    mock_response_json = VALID_RESPONSE;
+    mock_http_code = 201;
+    will_return(__wrap_curl_easy_perform, CURLE_OK);
+
+    assert_int_equal(k8s_validate_token("test-token", &info, &config), 1);
+    assert_int_equal(info.timing.dns_us, 0);
+    assert_int_equal(info.timing.connect_us, 0);
+    assert_int_equal(info.timing.tls_us, 0);
+    assert_int_equal(info.timing.server_us, 2000);
+    assert_int_equal(info.timing.transfer_us, 60);
+}
+
 static void test_validate_token_unauthenticated(void **state) {
     (void)state;
     k8s_token_info_t info;
@@ -297,6 +472,10 @@ static void test_validate_token_unauthenticated(void **state) {
 
     int ret = k8s_validate_token("bad-token", &info, &config);
     assert_int_equal(ret, 0);
+    assert_int_equal(info.reviewed, 1);
+    assert_int_equal(info.authenticated, 0);
+    assert_int_equal(stat_total(K8S_STAT_TOKENREVIEW_CALLS), 1);
+    assert_int_equal(stat_total(K8S_STAT_HTTP_2XX), 1);
 }
 
 static void test_validate_token_username_mismatch(void **state) {
@@ -338,6 +517,9 @@ static void test_validate_token_http_403(void **state) {
 
     int ret = k8s_validate_token("test-token", &info, &config);
     assert_int_equal(ret, 0);
+    assert_int_equal(info.reviewed, 0);
+    assert_int_equal(stat_total(K8S_STAT_HTTP_4XX), 1);
+    assert_int_equal(stat_total(K8S_STAT_HTTP_2XX), 0);
 }
 
 static void test_validate_token_curl_perform_fails(void **state) {
@@ -354,6 +536,12 @@ static void test_validate_token_curl_perform_fails(void **state) {
 
     int ret = k8s_validate_token("test-token", &info, &config);
     assert_int_equal(ret, 0);
+    assert_int_equal(stat_total(K8S_STAT_TIMEOUTS), 1);
+    assert_int_equal(stat_total(K8S_STAT_CONNECT_ERRORS), 0);
+
+    k8s_stats_totals_t totals;
+    k8s_stats_collect(&totals);
+    assert_int_equal(totals.hist_count[K8S_HIST_API], 1);
 }
 
 static void test_validate_token_curl_init_fails(void **state) {
@@ -477,6 +665,10 @@ int main(void) {
 
         /* Mocked k8s_validate_token tests */
         cmocka_unit_test_setup(test_validate_token_happy_path, test_setup),
+        cmocka_unit_test_setup(test_validate_token_bound, test_setup),
+        cmocka_unit_test_setup(test_validate_token_audience_mismatch, test_setup),
+        cmocka_unit_test_setup(test_validate_token_phase_timing, test_setup),
+        cmocka_unit_test_setup(test_validate_token_reused_connection_timing, test_setup),
         cmocka_unit_test_setup(test_validate_token_unauthenticated, test_setup),
         cmocka_unit_test_setup(test_validate_token_username_mismatch, test_setup),
         cmocka_unit_test_setup(test_validate_token_http_403, test_setup),
@@ -0,0 +1,382 @@
+/*
+ * Unit tests for validator.c using CMocka
+ *
+ * The federated client of federated.c talks to the validator on a socket in
+ * /tmp. TokenReviews, the key set and the expiry claim are stubbed; their
+ * verdicts follow from the token:
+ *
+ *   valid:<namespace>:<name>   valid, unless an audience other than
+ *                              "mariadb" is asked for
+ *   unavailable                no verdict
+ *   forged...                  refused by the key set
+ *   ...expiring                already past its exp
+ *   anything else              rejected
+ *
+ * A token prefixed with "slow/" takes 200ms to review. EVP_DigestFinal_ex is
+ * wrapped so that a test can make the cache key fail.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <openssl/evp.h>
+
+#include "federated_protocol.h"
+
+#include "federated.h"
+#include "jwks.h"
+#include "jwt.h"
+#include "validator.h"
+
+#define TIMEOUT_MS 2000
+
+static char path[64];
+static int reviews = 0;
+static int digest_fails = 0;
+
+/* ===== Stubs ===== */
+
+int k8s_validate_token(const char *token, k8s_token_info_t *info, const k8s_config_t *config) {
+    char ns[64];
+    char name[64];
+
+    memset(info, 0, sizeof(*info));
+    __atomic_add_fetch(&reviews, 1, __ATOMIC_RELAXED);
+    if (strncmp(token, "slow/", 5) == 0) {
+        usleep(200000);
+        token += 5;
+    }
+    if (strcmp(token, "unavailable") == 0) {
+        return 0;
+    }
+    info->reviewed = 1;
+    if (sscanf(token, "valid:%63[^:]:%63[^:]", ns, name) != 2 ||
+        (config->audience && strcmp(config->audience, "mariadb") != 0)) {
+        return 0;
+    }
+    info->authenticated = 1;
+    snprintf(info->namespace, sizeof(info->namespace), "%s", ns);
+    snprintf(info->service_account, sizeof(info->service_account), "%s", name);
+    snprintf(info->username, sizeof(info->username), "system:serviceaccount:%s:%s", ns, name);
+    snprintf(info->uid, sizeof(info->uid), "uid-%s", name);
+    snprintf(info->groups, sizeof(info->groups), "system:serviceaccounts\nsystem:authenticated");
+    snprintf(info->pod_name, sizeof(info->pod_name), "%s-pod", name);
+    info->validated_at = time(NULL);
+    return 1;
+}
+
+int k8s_jwks_forged(const char *token) {
+    return strncmp(token, "forged", 6) == 0;
+}
+
+time_t k8s_jwt_expiry(const char *token) {
+    size_t len = strlen(token);
+    return len > 8 && strcmp(token + len - 8, "expiring") == 0 ? time(NULL) - 1 : 0;
+}
+
+int __real_EVP_DigestFinal_ex(EVP_MD_CTX *ctx, unsigned char *md, unsigned int *len);
+
+int __wrap_EVP_DigestFinal_ex(EVP_MD_CTX *ctx, unsigned char *md, unsigned int *len) {
+    if (__atomic_load_n(&digest_fails, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    return __real_EVP_DigestFinal_ex(ctx, md, len);
+}
+
+/* ===== Fixtures ===== */
+
+static int start(int cache_ttl) {
+    k8s_validator_options_t options;
+
+    memset(&options, 0, sizeof(options));
+    options.socket_path = path;
+    options.socket_mode = 0600;
+    options.workers = 4;
+    options.cache_ttl = cache_ttl;
+    options.cache_size = 64;
+    options.screen = 1;
+    reviews = 0;
+    digest_fails = 0;
+    if (!k8s_validator_start(&options)) {
+        return -1;
+    }
+    k8s_federated_configure(path);
+    return 0;
+}
+
+static int setup(void **state) {
+    (void)state;
+    snprintf(path, sizeof(path), "/tmp/test_validator_%d.sock", (int)getpid());
+    return start(60);
+}
+
+static int setup_uncached(void **state) {
+    (void)state;
+    snprintf(path, sizeof(path), "/tmp/test_validator_%d.sock", (int)getpid());
+    return start(0);
+}
+
+static int teardown(void **state) {
+    (void)state;
+    k8s_federated_shutdown();
+    k8s_validator_stop();
+    return 0;
+}
+
+/* ===== Tests ===== */
+
+static void test_verdicts(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_validator_stats_t stats;
+
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 1);
+    assert_int_equal(info.reviewed, 1);
+    assert_string_equal(info.namespace, "default");
+    assert_string_equal(info.service_account, "app");
+    assert_string_equal(info.username, "system:serviceaccount:default:app");
+    assert_string_equal(info.uid, "uid-app");
+    assert_string_equal(info.groups, "system:serviceaccounts\nsystem:authenticated");
+    assert_string_equal(info.pod_name, "app-pod");
+    assert_string_equal(info.pod_uid, "");
+
+    assert_int_equal(k8s_federated_validate(NULL, "expired", NULL, &info, TIMEOUT_MS), 0);
+    assert_int_equal(info.reviewed, 1);
+    assert_int_equal(k8s_federated_validate(NULL, "unavailable", NULL, &info, TIMEOUT_MS), 0);
+    assert_int_equal(info.reviewed, 0);
+
+    k8s_validator_stats(&stats);
+    assert_int_equal(stats.requests, 3);
+    assert_int_equal(stats.reviews, 3);
+    assert_int_equal(stats.unavailable, 1);
+    assert_true(stats.clients >= 1);
+}
+
+static void test_cached(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_validator_stats_t stats;
+
+    for (int i = 0; i < 3; i++) {
+        assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", "mariadb", &info,
+                                                TIMEOUT_MS), 1);
+        assert_string_equal(info.service_account, "app");
+    }
+    assert_int_equal(reviews, 1);
+
+    /* Another audience is another question */
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", "vault", &info,
+                                            TIMEOUT_MS), 0);
+    assert_int_equal(info.reviewed, 1);
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 1);
+    assert_int_equal(reviews, 3);
+
+    k8s_validator_stats(&stats);
+    assert_int_equal(stats.cache_hits, 2);
+}
+
+static void test_not_cached(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+
+    /* Neither rejections, missing verdicts nor tokens past their exp */
+    for (int i = 0; i < 2; i++) {
+        assert_int_equal(k8s_federated_validate(NULL, "rejected", NULL, &info, TIMEOUT_MS), 0);
+        assert_int_equal(k8s_federated_validate(NULL, "unavailable", NULL, &info,
+                                                TIMEOUT_MS), 0);
+        assert_int_equal(k8s_federated_validate(NULL, "valid:default:expiring", NULL, &info,
+                                                TIMEOUT_MS), 1);
+    }
+    assert_int_equal(reviews, 6);
+}
+
+static void test_cache_disabled(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 1);
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 1);
+    assert_int_equal(reviews, 2);
+}
+
+#define THREADS 8
+
+static void *login_thread(void *arg) {
+    k8s_token_info_t info;
+    (void)arg;
+
+    if (!k8s_federated_validate(NULL, "slow/valid:ns:shared", NULL, &info, TIMEOUT_MS) ||
+        strcmp(info.service_account, "shared") != 0) {
+        return (void *)1;
+    }
+    return NULL;
+}
+
+static void test_coalesced(void **state) {
+    (void)state;
+    pthread_t threads[THREADS];
+    k8s_validator_stats_t stats;
+
+    for (int t = 0; t < THREADS; t++) {
+        assert_int_equal(pthread_create(&threads[t], NULL, login_thread, NULL), 0);
+    }
+    for (int t = 0; t < THREADS; t++) {
+        void *failed;
+        pthread_join(threads[t], &failed);
+        assert_null(failed);
+    }
+
+    /* One review answered every request */
+    assert_int_equal(reviews, 1);
+    k8s_validator_stats(&stats);
+    assert_int_equal(stats.requests, THREADS);
+    assert_int_equal(stats.coalesced + stats.cache_hits, THREADS - 1);
+}
+
+static void test_forged(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_validator_stats_t stats;
+
+    assert_int_equal(k8s_federated_validate(NULL, "forged:valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 0);
+    assert_int_equal(info.reviewed, 1);
+    assert_int_equal(reviews, 0);
+    k8s_validator_stats(&stats);
+    assert_int_equal(stats.forged, 1);
+}
+
+static void test_other_cluster(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+
+    assert_int_equal(k8s_federated_validate("east", "valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 0);
+    assert_int_equal(info.reviewed, 0);
+    assert_int_equal(reviews, 0);
+}
+
+static void test_digest_failed(void **state) {
+    (void)state;
+    k8s_token_info_t info;
+    k8s_validator_stats_t stats;
+
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 1);
+
+    /* Without a key neither the cache nor a review in flight may answer */
+    __atomic_store_n(&digest_fails, 1, __ATOMIC_RELAXED);
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 0);
+    assert_int_equal(info.reviewed, 0);
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:other", NULL, &info,
+                                            TIMEOUT_MS), 0);
+    assert_int_equal(info.reviewed, 0);
+    assert_int_equal(reviews, 1);
+    k8s_validator_stats(&stats);
+    assert_int_equal(stats.cache_hits, 0);
+
+    __atomic_store_n(&digest_fails, 0, __ATOMIC_RELAXED);
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 1);
+    assert_int_equal(reviews, 1);
+}
+
+/* Send VALIDATE frames for a cached token, many to a call, without reading an answer */
+static void flood(int fd) {
+    const char token[] = "valid:default:app";
+    size_t len = K8S_FEDERATED_HEADER_LEN + 6 + sizeof(token) - 1;
+    static unsigned char frames[1000 * 64];
+    size_t total = 0;
+
+    memset(frames, 0, sizeof(frames));
+    while (total + len <= sizeof(frames)) {
+        unsigned char *frame = frames + total;
+        frame[3] = (unsigned char)(len - 4);
+        frame[4] = K8S_FEDERATED_MSG_VALIDATE;
+        frame[K8S_FEDERATED_HEADER_LEN + 5] = (unsigned char)(sizeof(token) - 1);
+        memcpy(frame + K8S_FEDERATED_HEADER_LEN + 6, token, sizeof(token) - 1);
+        total += len;
+    }
+    for (int i = 0; i < 100; i++) {
+        if (send(fd, frames, total, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)total) {
+            break;
+        }
+        usleep(1000);
+    }
+}
+
+static void test_slow_client(void **state) {
+    (void)state;
+    struct sockaddr_un addr;
+    k8s_token_info_t info;
+
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert_true(fd >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path));
+    assert_int_equal(connect(fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+    flood(fd);
+    usleep(100000);
+
+    /* The others are answered, well within the send timeout, while its answers pile up */
+    assert_int_equal(k8s_federated_validate(NULL, "valid:default:app", NULL, &info,
+                                            TIMEOUT_MS), 1);
+    assert_int_equal(reviews, 1);
+    close(fd);
+}
+
+static void *slow_login(void *arg) {
+    k8s_token_info_t *info = arg;
+    return (void *)(intptr_t)k8s_federated_validate(NULL, "slow/valid:ns:late", NULL, info,
+                                                    TIMEOUT_MS);
+}
+
+static void test_stop_answers(void **state) {
+    (void)state;
+    pthread_t thread;
+    k8s_token_info_t info;
+    void *valid;
+
+    assert_int_equal(pthread_create(&thread, NULL, slow_login, &info), 0);
+    usleep(50000);
+    k8s_validator_stop();
+    pthread_join(thread, &valid);
+    assert_int_equal((int)(intptr_t)valid, 1);
+    assert_string_equal(info.service_account, "late");
+    assert_int_equal(access(path, F_OK), -1);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_verdicts, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_cached, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_not_cached, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_cache_disabled, setup_uncached, teardown),
+        cmocka_unit_test_setup_teardown(test_coalesced, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_forged, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_other_cluster, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_digest_failed, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_slow_client, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_stop_answers, setup, teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
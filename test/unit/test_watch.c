@@ -0,0 +1,450 @@
+/*
+ * Unit tests for watch.c using CMocka
+ *
+ * A fake API server on the loopback interface answers list requests from
+ * canned bodies and keeps watch connections open, so tests can push events
+ * down them one at a time. It allows every SubjectAccessReview.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <curl/curl.h>
+
+#include "watch.h"
+#include "token_cache.h"
+#include "access_review.h"
+#include "stats.h"
+#include "http_pool.h"
+#include "fake_api.h"
+
+#define TOKEN_FILE "/tmp/test_watch.token"
+
+enum { FAKE_SA, FAKE_POD, FAKE_RB, FAKE_CRB, FAKE_KINDS };
+
+static struct {
+    pthread_mutex_t lock;
+    int port;
+    const char *list_body[FAKE_KINDS];
+    int watch_fd[FAKE_KINDS];
+    int lists[FAKE_KINDS];
+    int watches[FAKE_KINDS];
+    char last_path[FAKE_KINDS][1024];
+    char last_auth[256];
+    int reviews;
+} fake = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int fake_handle(const fake_api_request_t *request) {
+    if (strcmp(request->method, "POST") == 0) {
+        fake_api_respond(request->fd, 201, "{\"status\":{\"allowed\":true}}");
+        pthread_mutex_lock(&fake.lock);
+        fake.reviews++;
+        pthread_mutex_unlock(&fake.lock);
+        return 0;
+    }
+
+    const char *path = request->path;
+    int kind = strstr(path, "/clusterrolebindings") ? FAKE_CRB :
+               strstr(path, "/rolebindings") ? FAKE_RB :
+               strstr(path, "/pods") ? FAKE_POD : FAKE_SA;
+    const char *auth = strstr(request->headers, "Authorization: ");
+    int kept = 0;
+
+    pthread_mutex_lock(&fake.lock);
+    snprintf(fake.last_path[kind], sizeof(fake.last_path[kind]), "%.1000s", path);
+    if (auth) {
+        snprintf(fake.last_auth, sizeof(fake.last_auth), "%.*s",
+                 (int)strcspn(auth, "\r\n"), auth);
+    }
+
+    if (strstr(path, "watch=1")) {
+        fake_api_stream(request->fd);
+        if (fake.watch_fd[kind] >= 0) {
+            close(fake.watch_fd[kind]);
+        }
+        fake.watch_fd[kind] = request->fd;
+        fake.watches[kind]++;
+        kept = 1;
+    } else {
+        fake_api_respond(request->fd, 200, fake.list_body[kind]);
+        fake.lists[kind]++;
+    }
+    pthread_mutex_unlock(&fake.lock);
+    return kept;
+}
+
+static void fake_start(void) {
+    for (int k = 0; k < FAKE_KINDS; k++) {
+        fake.watch_fd[k] = -1;
+        fake.lists[k] = fake.watches[k] = 0;
+        fake.last_path[k][0] = '\0';
+        fake.list_body[k] = "{\"metadata\":{\"resourceVersion\":\"100\"},\"items\":[]}";
+    }
+    fake.reviews = 0;
+    fake.port = fake_api_start(fake_handle);
+    assert_int_not_equal(fake.port, 0);
+}
+
+static void fake_stop(void) {
+    fake_api_stop();
+    for (int k = 0; k < FAKE_KINDS; k++) {
+        if (fake.watch_fd[k] >= 0) {
+            close(fake.watch_fd[k]);
+        }
+    }
+}
+
+/* Push one watch event line to the open watch of a kind */
+static void fake_event(int kind, const char *json) {
+    pthread_mutex_lock(&fake.lock);
+    assert_true(fake.watch_fd[kind] >= 0);
+    send(fake.watch_fd[kind], json, strlen(json), MSG_NOSIGNAL);
+    send(fake.watch_fd[kind], "\n", 1, MSG_NOSIGNAL);
+    pthread_mutex_unlock(&fake.lock);
+}
+
+/* End the open watch of a kind, as the API server does after timeoutSeconds */
+static void fake_close_watch(int kind) {
+    pthread_mutex_lock(&fake.lock);
+    close(fake.watch_fd[kind]);
+    fake.watch_fd[kind] = -1;
+    pthread_mutex_unlock(&fake.lock);
+}
+
+static int fake_count(const int *counter) {
+    pthread_mutex_lock(&fake.lock);
+    int n = *counter;
+    pthread_mutex_unlock(&fake.lock);
+    return n;
+}
+
+#define WAIT_FOR(cond) \
+    do { \
+        for (int waited_ = 0; !(cond) && waited_ < 500; waited_++) { \
+            usleep(10000); \
+        } \
+        assert_true(cond); \
+    } while (0)
+
+static void cache(const char *token, const char *ns, const char *uid) {
+    k8s_token_info_t info;
+    memset(&info, 0, sizeof(info));
+    strcpy(info.namespace, ns);
+    strcpy(info.service_account, "app");
+    strcpy(info.uid, uid);
+    info.validated_at = time(NULL);
+    k8s_token_cache_insert(token, &info, 600);
+}
+
+static int cached(const char *token) {
+    k8s_cache_entry_t entry;
+    return k8s_token_cache_lookup(token, 600, &entry);
+}
+
+static void start_watches(const char *namespaces, int rbac) {
+    char url[64];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d", fake.port);
+    k8s_watch_config_t config = { url, NULL, TOKEN_FILE, namespaces, rbac, NULL };
+    assert_true(k8s_watch_configure(&config));
+}
+
+static void start_watch(const char *namespaces) {
+    start_watches(namespaces, 0);
+}
+
+/* Ask for an access review decision; the fake allows everything */
+static void review(const char *ns) {
+    char url[64];
+    k8s_config_t config;
+    k8s_config_init_default(&config);
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d", fake.port);
+    config.api_server_url = url;
+    config.token_path = TOKEN_FILE;
+    config.ca_cert_path = NULL;
+    assert_int_equal(k8s_access_review_check(NULL, ns, "app", "", &config, NULL), K8S_ACCESS_ALLOWED);
+}
+
+static void write_token(const char *token) {
+    FILE *f = fopen(TOKEN_FILE, "w");
+    fputs(token, f);
+    fclose(f);
+}
+
+static int test_setup(void **state) {
+    (void)state;
+    write_token("watcher-token");
+    k8s_token_cache_clear();
+    k8s_stats_reset();
+    fake_start();
+    return 0;
+}
+
+static int test_teardown(void **state) {
+    (void)state;
+    k8s_watch_stop();
+    k8s_access_review_shutdown();
+    fake_stop();
+    unlink(TOKEN_FILE);
+    return 0;
+}
+
+/* ========================================================================
+ * Initial list
+ * ======================================================================== */
+
+static void test_list_drops_missing_objects(void **state) {
+    (void)state;
+
+    fake.list_body[FAKE_SA] =
+        "{\"metadata\":{\"resourceVersion\":\"120\"},\"items\":["
+        "{\"metadata\":{\"name\":\"app\",\"namespace\":\"team-a\",\"uid\":\"sa-live\"}}]}";
+    cache("token-live", "team-a", "sa-live");
+    cache("token-gone", "team-a", "sa-deleted-while-down");
+    cache("token-other", "team-b", "sa-unwatched");
+
+    start_watch("team-a");
+    WAIT_FOR(k8s_watch_synced());
+
+    assert_true(cached("token-live"));
+    assert_false(cached("token-gone"));
+    /* Namespaces that aren't watched are left alone */
+    assert_true(cached("token-other"));
+    /* Remembered for tickets, which have no cache entry to drop */
+    assert_true(k8s_watch_deleted("sa-deleted-while-down"));
+    assert_false(k8s_watch_deleted("sa-live"));
+
+    WAIT_FOR(fake_count(&fake.watches[FAKE_SA]) == 1);
+    assert_non_null(strstr(fake.last_path[FAKE_SA],
+                           "/api/v1/namespaces/team-a/serviceaccounts?watch=1"));
+    assert_non_null(strstr(fake.last_path[FAKE_SA], "allowWatchBookmarks=true"));
+    assert_non_null(strstr(fake.last_path[FAKE_SA], "resourceVersion=120"));
+    assert_string_equal(fake.last_auth, "Authorization: Bearer watcher-token");
+}
+
+/* ========================================================================
+ * Events
+ * ======================================================================== */
+
+static void test_serviceaccount_deletion(void **state) {
+    (void)state;
+
+    fake.list_body[FAKE_SA] =
+        "{\"metadata\":{\"resourceVersion\":\"120\"},\"items\":["
+        "{\"metadata\":{\"uid\":\"sa-1\"}},{\"metadata\":{\"uid\":\"sa-2\"}}]}";
+    cache("token-1", "team-a", "sa-1");
+    cache("token-2", "team-a", "sa-2");
+
+    start_watch("team-a");
+    WAIT_FOR(fake_count(&fake.watches[FAKE_SA]) == 1);
+
+    /* Other event types only move the resourceVersion */
+    fake_event(FAKE_SA, "{\"type\":\"MODIFIED\",\"object\":{\"metadata\":"
+               "{\"name\":\"one\",\"namespace\":\"team-a\",\"uid\":\"sa-1\",\"resourceVersion\":\"121\"}}}");
+    fake_event(FAKE_SA, "{\"type\":\"DELETED\",\"object\":{\"metadata\":"
+               "{\"name\":\"one\",\"namespace\":\"team-a\",\"uid\":\"sa-1\",\"resourceVersion\":\"122\"}}}");
+    WAIT_FOR(!cached("token-1"));
+    assert_true(cached("token-2"));
+    assert_true(k8s_watch_deleted("sa-1"));
+    assert_false(k8s_watch_deleted("sa-2"));
+
+    k8s_stats_totals_t totals;
+    k8s_stats_collect(&totals);
+    assert_int_equal(totals.counters[K8S_STAT_CACHE_REVOKED], 1);
+}
+
+static void test_pod_deletion(void **state) {
+    (void)state;
+    char token[256];
+
+    /* A token bound to pod "pod-1" */
+    snprintf(token, sizeof(token), "eyJhbGciOiJSUzI1NiJ9.%s.c2ln",
+             "eyJrdWJlcm5ldGVzLmlvIjp7InBvZCI6eyJ1aWQiOiJwb2QtMSJ9fX0");
+    fake.list_body[FAKE_SA] =
+        "{\"metadata\":{\"resourceVersion\":\"1\"},\"items\":[{\"metadata\":{\"uid\":\"sa-1\"}}]}";
+    fake.list_body[FAKE_POD] =
+        "{\"metadata\":{\"resourceVersion\":\"1\"},\"items\":[{\"metadata\":{\"uid\":\"pod-1\"}}]}";
+    cache(token, "team-a", "sa-1");
+    cache("unbound-token", "team-a", "sa-1");
+
+    start_watch("team-a");
+    WAIT_FOR(fake_count(&fake.watches[FAKE_POD]) == 1);
+    assert_true(cached(token));
+
+    fake_event(FAKE_POD, "{\"type\":\"DELETED\",\"object\":{\"metadata\":"
+               "{\"name\":\"app-0\",\"namespace\":\"team-a\",\"uid\":\"pod-1\",\"resourceVersion\":\"2\"}}}");
+    WAIT_FOR(!cached(token));
+    assert_true(cached("unbound-token"));
+    /* Only ServiceAccounts are remembered */
+    assert_false(k8s_watch_deleted("pod-1"));
+}
+
+/* ========================================================================
+ * Resuming
+ * ======================================================================== */
+
+static void test_resume_from_bookmark(void **state) {
+    (void)state;
+
+    start_watch("team-a");
+    WAIT_FOR(fake_count(&fake.watches[FAKE_SA]) == 1);
+
+    fake_event(FAKE_SA, "{\"type\":\"BOOKMARK\",\"object\":{\"kind\":\"ServiceAccount\","
+               "\"metadata\":{\"resourceVersion\":\"205\"}}}");
+    usleep(100000);
+    fake_close_watch(FAKE_SA);
+
+    WAIT_FOR(fake_count(&fake.watches[FAKE_SA]) == 2);
+    assert_non_null(strstr(fake.last_path[FAKE_SA], "resourceVersion=205"));
+    /* No second list */
+    assert_int_equal(fake_count(&fake.lists[FAKE_SA]), 1);
+}
+
+static void test_relist_when_expired(void **state) {
+    (void)state;
+
+    start_watch("team-a");
+    WAIT_FOR(fake_count(&fake.watches[FAKE_SA]) == 1);
+    assert_int_equal(fake_count(&fake.lists[FAKE_SA]), 1);
+
+    fake_event(FAKE_SA, "{\"type\":\"ERROR\",\"object\":{\"kind\":\"Status\",\"code\":410,"
+               "\"reason\":\"Expired\",\"message\":\"too old resource version\"}}");
+    fake_close_watch(FAKE_SA);
+
+    WAIT_FOR(fake_count(&fake.lists[FAKE_SA]) == 2);
+    WAIT_FOR(fake_count(&fake.watches[FAKE_SA]) == 2);
+}
+
+/* ========================================================================
+ * RoleBindings
+ * ======================================================================== */
+
+static void test_binding_changes(void **state) {
+    (void)state;
+
+    k8s_access_review_configure("connect databases.mariadb.example.com", 600);
+    start_watches("team-a", 1);
+    WAIT_FOR(k8s_watch_synced());
+    WAIT_FOR(fake_count(&fake.watches[FAKE_RB]) == 1);
+    WAIT_FOR(fake_count(&fake.watches[FAKE_CRB]) == 1);
+    assert_non_null(strstr(fake.last_path[FAKE_RB],
+                           "/apis/rbac.authorization.k8s.io/v1/namespaces/team-a/rolebindings"));
+    assert_non_null(strstr(fake.last_path[FAKE_CRB],
+                           "/apis/rbac.authorization.k8s.io/v1/clusterrolebindings?watch=1"));
+
+    review("team-a");
+    review("team-b");
+    assert_int_equal(k8s_access_review_cached(), 2);
+
+    /* Bookmarks change nothing */
+    fake_event(FAKE_RB, "{\"type\":\"BOOKMARK\",\"object\":{\"kind\":\"RoleBinding\","
+               "\"metadata\":{\"resourceVersion\":\"150\"}}}");
+    fake_event(FAKE_RB, "{\"type\":\"ADDED\",\"object\":{\"metadata\":{\"name\":\"db\","
+               "\"namespace\":\"team-a\",\"resourceVersion\":\"151\"}}}");
+    WAIT_FOR(k8s_access_review_cached() == 1);
+
+    /* The next login of team-a is reviewed again, team-b's is not */
+    review("team-a");
+    review("team-b");
+    assert_int_equal(fake_count(&fake.reviews), 3);
+
+    fake_event(FAKE_CRB, "{\"type\":\"DELETED\",\"object\":{\"metadata\":"
+               "{\"name\":\"db-admins\",\"resourceVersion\":\"152\"}}}");
+    WAIT_FOR(k8s_access_review_cached() == 0);
+}
+
+static void test_bindings_not_watched(void **state) {
+    (void)state;
+
+    start_watch("team-a");
+    WAIT_FOR(k8s_watch_synced());
+    WAIT_FOR(fake_count(&fake.watches[FAKE_POD]) == 1);
+    assert_int_equal(fake_count(&fake.lists[FAKE_RB]), 0);
+    assert_int_equal(fake_count(&fake.lists[FAKE_CRB]), 0);
+}
+
+/* ========================================================================
+ * Control
+ * ======================================================================== */
+
+static void test_cluster_wide_and_stop(void **state) {
+    (void)state;
+
+    start_watch("*");
+    WAIT_FOR(k8s_watch_synced());
+    WAIT_FOR(fake_count(&fake.watches[FAKE_POD]) == 1);
+    assert_non_null(strstr(fake.last_path[FAKE_POD], "/api/v1/pods?watch=1"));
+
+    /* Same settings: the watches are kept */
+    start_watch("*");
+    assert_int_equal(fake_count(&fake.lists[FAKE_POD]), 1);
+
+    /* Empty namespaces stop them */
+    start_watch("");
+    assert_false(k8s_watch_synced());
+}
+
+static void test_pool_credential(void **state) {
+    (void)state;
+    char url[64];
+    k8s_config_t config;
+
+    k8s_config_init_default(&config);
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d", fake.port);
+    config.api_server_url = url;
+    config.ca_cert_path = "/nonexistent/ca.crt";
+    config.token_path = TOKEN_FILE;
+    k8s_http_pool_t *pool = k8s_http_pool_create(&config, 1);
+    assert_non_null(pool);
+
+    k8s_watch_config_t watch = { url, config.ca_cert_path, TOKEN_FILE, "team-a", 0, pool };
+    assert_true(k8s_watch_configure(&watch));
+    WAIT_FOR(fake_count(&fake.watches[FAKE_SA]) == 1);
+
+    /* Reconnects use the pool's cached credential rather than read the file */
+    write_token("rotated-token");
+    fake_close_watch(FAKE_SA);
+    WAIT_FOR(fake_count(&fake.watches[FAKE_SA]) == 2);
+    assert_string_equal(fake.last_auth, "Authorization: Bearer watcher-token");
+
+    /* Another pool restarts the watches on it */
+    config.pool = k8s_http_pool_create(&config, 1);
+    assert_non_null(config.pool);
+    assert_true(k8s_watch_retarget(&config));
+    WAIT_FOR(fake_count(&fake.lists[FAKE_SA]) == 2);
+    assert_string_equal(fake.last_auth, "Authorization: Bearer rotated-token");
+
+    /* The same one leaves them alone */
+    assert_true(k8s_watch_retarget(&config));
+    WAIT_FOR(fake_count(&fake.watches[FAKE_SA]) == 3);
+    assert_int_equal(fake_count(&fake.lists[FAKE_SA]), 2);
+
+    k8s_watch_stop();
+    k8s_http_pool_destroy(config.pool);
+    k8s_http_pool_destroy(pool);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_list_drops_missing_objects, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_serviceaccount_deletion, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_pod_deletion, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_resume_from_bookmark, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_relist_when_expired, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_binding_changes, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_bindings_not_watched, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_cluster_wide_and_stop, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_pool_credential, test_setup, test_teardown),
+    };
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    int failed = cmocka_run_group_tests(tests, NULL, NULL);
+    curl_global_cleanup();
+    return failed;
+}